@@ -0,0 +1,152 @@
+/**
+ * Mixer benchmark
+ *
+ * Measures the cost of the audio mixer while sweeping the number of playing
+ * channels, the format of the waveforms (8/16 bit, mono/stereo) and the
+ * resampling ratio. For each configuration, the mixer is run for a fixed
+ * number of output samples (without the AI actually playing them), and the
+ * mixer statistics are used to report:
+ *
+ *   * rsp: RSP cycles per output sample (time spent waiting for the mixer
+ *     ucode, converted to RCP cycles).
+ *   * cpu: percentage of CPU time required by mixer_poll to mix in real-time
+ *     at the output frequency, excluding the RSP wait.
+ *   * read: percentage of CPU time spent in the waveform read callbacks
+ *     (filling the sample buffers), which is included in cpu.
+ *
+ * The results are printed on screen and on the debug log, so that they can
+ * be easily compared across versions of rsp_mixer.S.
+ */
+#include <libdragon.h>
+#include <string.h>
+
+#define SAMPLE_RATE        44100
+#define WAVE_LEN           4096         ///< Length of the test waveforms (samples)
+#define POLL_SAMPLES       1024         ///< Samples generated by each call to mixer_poll
+#define BENCH_POLLS        32           ///< Calls to mixer_poll measured for each configuration
+#define MAX_RATIO          2.0f         ///< Maximum resampling ratio tested
+
+static const int channel_counts[] = { 1, 2, 4, 8, 16, 24, 32 };
+static const float ratios[] = { 0.5f, 1.0f, 1.5f, 2.0f };
+
+/** @brief Synthetic test waveform, kept in RDRAM */
+typedef struct {
+	waveform_t wave;
+	void *data;
+	int bps;           ///< Bytes per sample (all channels)
+} bench_wave_t;
+
+static bench_wave_t waves[2][2];       // [16bit][stereo]
+
+static void bench_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
+	bench_wave_t *bw = ctx;
+	uint8_t *dst = samplebuffer_append(sbuf, wlen);
+	while (wlen > 0) {
+		int pos = wpos % WAVE_LEN;
+		int n = WAVE_LEN - pos;
+		if (n > wlen) n = wlen;
+		memcpy(dst, bw->data + pos*bw->bps, n*bw->bps);
+		dst += n*bw->bps;
+		wpos += n;
+		wlen -= n;
+	}
+}
+
+static void bench_wave_init(bench_wave_t *bw, int bits, int channels) {
+	bw->bps = bits/8 * channels;
+	bw->data = malloc(WAVE_LEN * bw->bps);
+
+	// A sawtooth, with a slightly different period on the right channel
+	for (int i=0;i<WAVE_LEN;i++) {
+		for (int c=0;c<channels;c++) {
+			int v = ((i * (8+c)) & 0xFF) - 0x80;
+			if (bits == 8)
+				((int8_t*)bw->data)[i*channels+c] = v;
+			else
+				((int16_t*)bw->data)[i*channels+c] = v << 8;
+		}
+	}
+
+	bw->wave = (waveform_t){
+		.name = "bench",
+		.bits = bits,
+		.channels = channels,
+		.frequency = SAMPLE_RATE,
+		.len = WAVE_LEN,
+		.loop_len = WAVE_LEN,
+		.read = bench_read,
+		.ctx = bw,
+	};
+}
+
+static void bench_run(int num_channels, int bits, int channels, float ratio, int16_t *out) {
+	bench_wave_t *bw = &waves[bits == 16][channels == 2];
+	if (channels > num_channels)
+		return;
+
+	// Stereo waveforms use two mixer channels each
+	for (int ch=0;ch<num_channels;ch+=channels) {
+		mixer_ch_play(ch, &bw->wave);
+		mixer_ch_set_freq(ch, SAMPLE_RATE * ratio);
+		// Use a non-unity volume, so that the slowest mixing path is measured
+		mixer_ch_set_vol(ch, 0.5f, 0.5f);
+	}
+
+	// Warm up (first reads, sample buffer allocations), then measure
+	mixer_poll(out, POLL_SAMPLES);
+	mixer_reset_stats();
+	for (int i=0;i<BENCH_POLLS;i++)
+		mixer_poll(out, POLL_SAMPLES);
+
+	mixer_stats_t stats;
+	mixer_get_stats(&stats);
+
+	for (int ch=0;ch<num_channels;ch+=channels)
+		mixer_ch_stop(ch);
+
+	// RSP cycles run at 4/3 of the CPU ticks (62.5 MHz vs 46.875 MHz)
+	float rsp_cycles = (float)stats.rsp_ticks * 4 / 3 / stats.samples;
+
+	// CPU time needed to mix one second of audio, as a share of one second
+	float secs = (float)stats.samples / SAMPLE_RATE;
+	float cpu = (float)(stats.poll_ticks - stats.rsp_ticks) / TICKS_PER_SECOND / secs * 100;
+	float read = (float)stats.read_ticks / TICKS_PER_SECOND / secs * 100;
+
+	printf("%2d %2d %s %.1fx  rsp:%6.1f cpu:%5.2f%% read:%5.2f%%\n",
+		num_channels, bits, channels == 2 ? "st" : "mo", ratio, rsp_cycles, cpu, read);
+	debugf("mixerbench: channels=%d bits=%d %s ratio=%.1f rsp_cycles_per_sample=%.1f cpu=%.2f%% read=%.2f%%\n",
+		num_channels, bits, channels == 2 ? "stereo" : "mono", ratio, rsp_cycles, cpu, read);
+}
+
+int main(void) {
+	debug_init_usblog();
+	debug_init_isviewer();
+	console_init();
+	console_set_render_mode(RENDER_AUTOMATIC);
+
+	audio_init(SAMPLE_RATE, 4);
+	mixer_init(32);
+
+	for (int b=0;b<2;b++)
+		for (int s=0;s<2;s++)
+			bench_wave_init(&waves[b][s], b ? 16 : 8, s ? 2 : 1);
+
+	for (int ch=0;ch<32;ch++)
+		mixer_ch_set_limits(ch, 16, SAMPLE_RATE * MAX_RATIO, 0);
+
+	int16_t *out = malloc_uncached(POLL_SAMPLES * 2 * sizeof(int16_t));
+
+	printf("Mixer benchmark (%d Hz)\n", SAMPLE_RATE);
+	printf("ch bits fmt ratio  rsp cycles/sample, cpu share\n");
+
+	for (int i=0;i<sizeof(channel_counts)/sizeof(channel_counts[0]);i++)
+		for (int bits=8;bits<=16;bits+=8)
+			for (int channels=1;channels<=2;channels++)
+				for (int r=0;r<sizeof(ratios)/sizeof(ratios[0]);r++)
+					bench_run(channel_counts[i], bits, channels, ratios[r], out);
+
+	printf("Done.\n");
+	debugf("mixerbench: done\n");
+
+	while (1) {}
+}
@@ -0,0 +1,190 @@
+/**
+ * @file arena.h
+ * @brief Arena allocator
+ * @ingroup lowlevel
+ * 
+ * This module implements a simple arena (or region) allocator: memory is
+ * allocated from a fixed buffer by bumping a pointer, and it is released
+ * all at once. This is useful to group allocations that share the same
+ * lifetime (eg: all the resources of a level), so that they can be freed in
+ * O(1) without fragmenting the heap:
+ * 
+ * @code{.c}
+ *      arena_t level_arena;
+ *      arena_init(&level_arena, 512*1024);
+ * 
+ *      sprite_t *tiles = sprite_load_arena(&level_arena, "rom:/tiles.sprite");
+ *      surface_t minimap = surface_alloc_arena(&level_arena, FMT_RGBA16, 64, 64);
+ *      enemy_t *enemies = arena_alloc(&level_arena, sizeof(enemy_t) * num_enemies);
+ *      [...]
+ * 
+ *      // Level completed: release everything at once
+ *      rspq_wait();
+ *      arena_clear(&level_arena);
+ * @endcode
+ * 
+ * Besides the generic allocation functions, some libdragon subsystems can
+ * allocate their objects in an arena: see #surface_alloc_arena,
+ * #asset_load_arena and #sprite_load_arena. Objects allocated in an arena
+ * must not be freed with the standard functions of the subsystem (eg:
+ * #sprite_free can be called, but it will not release any memory). Timers
+ * can also be allocated from an arena, and started via #start_timer.
+ * 
+ * Arenas can also be uncached (#arena_init_uncached), to hold buffers
+ * shared with the RSP and the RDP. Arenas are not thread-safe: each arena
+ * must be used by a single thread at a time, and never from interrupt
+ * handlers.
+ */
+#ifndef __LIBDRAGON_ARENA_H
+#define __LIBDRAGON_ARENA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief The memory of the arena was allocated by #arena_init / #arena_init_uncached */
+#define ARENA_FLAGS_OWNEDBUFFER     0x1
+/** @brief The memory of the arena is accessed as uncached */
+#define ARENA_FLAGS_UNCACHED        0x2
+
+/**
+ * @brief A memory arena
+ *
+ * An arena is a buffer of memory where allocations are made by just bumping
+ * a pointer. Allocations cannot be freed one by one: they are all released
+ * at once with #arena_clear, or back to a previous point with #arena_reset.
+ *
+ * The fields can be read to inspect the arena, but must not be modified.
+ */
+typedef struct arena_s {
+    uint8_t *buffer;            ///< Memory of the arena (uncached address, for uncached arenas)
+    uint32_t size;              ///< Size of the arena in bytes
+    uint32_t used;              ///< Bytes currently allocated (including alignment padding)
+    uint32_t peak;              ///< Maximum value reached by used
+    uint32_t flags;             ///< Flags of the arena (ARENA_FLAGS_*)
+} arena_t;
+
+/** @brief A position in an arena, returned by #arena_mark */
+typedef uint32_t arena_mark_t;
+
+/**
+ * @brief Create an arena, allocating its memory from the heap
+ *
+ * @param[out] arena    Arena to initialize
+ * @param[in]  size     Size of the arena in bytes
+ */
+void arena_init(arena_t *arena, int size);
+
+/**
+ * @brief Create an arena of uncached memory, allocating it from the heap
+ *
+ * All the allocations made in this arena return uncached pointers, like
+ * #malloc_uncached. This is useful for buffers written by the CPU and read
+ * by the RSP or the RDP (or viceversa).
+ *
+ * @param[out] arena    Arena to initialize
+ * @param[in]  size     Size of the arena in bytes
+ */
+void arena_init_uncached(arena_t *arena, int size);
+
+/**
+ * @brief Create an arena on an existing buffer
+ *
+ * The buffer is not freed by #arena_close. If the buffer is uncached (see
+ * #UncachedAddr), the arena will be an uncached arena.
+ *
+ * @param[out] arena    Arena to initialize
+ * @param[in]  buffer   Memory to use for the arena
+ * @param[in]  size     Size of the buffer in bytes
+ */
+void arena_init_buffer(arena_t *arena, void *buffer, int size);
+
+/**
+ * @brief Destroy an arena, freeing its memory
+ *
+ * All the allocations made in the arena become invalid.
+ *
+ * @param[in]  arena    Arena to destroy
+ */
+void arena_close(arena_t *arena);
+
+/**
+ * @brief Allocate memory from an arena
+ *
+ * The returned memory is aligned to 16 bytes (the size of a data cache line).
+ *
+ * @param[in]  arena    Arena to allocate from
+ * @param[in]  size     Number of bytes to allocate
+ * @return     Pointer to the allocated memory, or NULL if the arena is full
+ */
+void *arena_alloc(arena_t *arena, int size);
+
+/**
+ * @brief Allocate memory from an arena, with the specified alignment
+ *
+ * @param[in]  arena    Arena to allocate from
+ * @param[in]  align    Alignment of the memory, in bytes (power of two)
+ * @param[in]  size     Number of bytes to allocate
+ * @return     Pointer to the allocated memory, or NULL if the arena is full
+ */
+void *arena_alloc_aligned(arena_t *arena, int align, int size);
+
+/**
+ * @brief Allocate memory from an arena, to be accessed as uncached
+ *
+ * This is the equivalent of #malloc_uncached_aligned for arenas. It can be
+ * used with any arena: in a cached arena, the allocation is made of full
+ * cache lines, that are invalidated before returning the uncached pointer.
+ *
+ * @param[in]  arena    Arena to allocate from
+ * @param[in]  align    Alignment of the memory, in bytes (power of two, minimum 16)
+ * @param[in]  size     Number of bytes to allocate
+ * @return     Uncached pointer to the allocated memory, or NULL if the arena is full
+ */
+void *arena_alloc_uncached(arena_t *arena, int align, int size);
+
+/**
+ * @brief Get the current position of an arena
+ *
+ * The position can later be passed to #arena_reset to release all the
+ * allocations made after this call.
+ *
+ * @param[in]  arena    Arena
+ * @return     The current position
+ */
+arena_mark_t arena_mark(arena_t *arena);
+
+/**
+ * @brief Release all the allocations made after a position
+ *
+ * @param[in]  arena    Arena
+ * @param[in]  mark     Position returned by #arena_mark
+ */
+void arena_reset(arena_t *arena, arena_mark_t mark);
+
+/**
+ * @brief Release all the allocations made in an arena
+ *
+ * The memory is kept by the arena and reused for the next allocations.
+ *
+ * @param[in]  arena    Arena
+ */
+void arena_clear(arena_t *arena);
+
+/**
+ * @brief Check whether a pointer belongs to the memory of an arena
+ *
+ * @param[in]  arena    Arena
+ * @param[in]  ptr      Pointer to check (either cached or uncached)
+ * @return     True if the pointer is within the arena
+ */
+bool arena_contains(arena_t *arena, const void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
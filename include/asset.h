@@ -47,7 +47,7 @@
  * 
  * To compress your own data files, you can use the mkasset tool.
  * 
- * There are currently two compression levels:
+ * There are currently three compression levels:
  * 
  * * Level 1: this is based on LZ4 by Yann Collet. It is extremely fast and
  *   produce reasonable compression ratios. It is so fast at decompression
@@ -59,13 +59,20 @@
  *   been measured to beat gzip/zlib for small files like those typically used
  *   on N64. Level 2 should be selected if there is a necessity to squeeze data
  *   at the maximum ratio, at the expense of loading speed.
+ * * Level 3: this is LZB, a simple byte-oriented LZ77 variant. Its compression
+ *   ratio is lower than LZ4, but its decoder is even simpler and faster. Level 3
+ *   should be selected for assets that are loaded often (eg: streamed during
+ *   gameplay) where decoding time matters more than ROM size.
  * 
  * To minimize text siz and RAM usage, only the decompression code for level 1
- * is compiled by default. If you need to use level 2, you must call
- * #asset_init_compression(2).
+ * is compiled by default. If you need to use level 2 or 3, you must call
+ * #asset_init_compression with the required level.
  */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "arena.h"
 
 #ifdef N64
 #include "debug.h"
@@ -77,6 +84,8 @@ extern "C" {
 
 /// @private
 extern void __asset_init_compression_lvl2(void);
+/// @private
+extern void __asset_init_compression_lvl3(void);
 
 /**
  * @brief Enable a non-default compression level
@@ -85,8 +94,8 @@ extern void __asset_init_compression_lvl2(void);
  * a non-default compression level. The default compression level is 1,
  * for which no initialization is required.
  * 
- * Currently, only level 2 requires initialization. If you have any assets
- * compressed with level 2, you must call this function before loading them.
+ * Currently, levels 2 and 3 require initialization. If you have any assets
+ * compressed with level 2 or 3, you must call this function before loading them.
  * 
  * @code{.c}
  *      asset_init_compression(2); 
@@ -104,6 +113,7 @@ extern void __asset_init_compression_lvl2(void);
     switch (level) { \
     case 1: break; \
     case 2: __asset_init_compression_lvl2(); break; \
+    case 3: __asset_init_compression_lvl3(); break; \
     default: assertf(0, "Unsupported compression level: %d", level); \
     } \
 })
@@ -121,6 +131,145 @@ extern void __asset_init_compression_lvl2(void);
  */
 void *asset_load(const char *fn, int *sz);
 
+/**
+ * @brief Load an asset file, making it ready to be accessed by RSP or RDP
+ * 
+ * This function works like #asset_load, but the returned buffer is also
+ * written back from the CPU data cache, so that it can be immediately accessed
+ * by the RSP or RDP (eg: textures, audio samples, display lists) without
+ * calling #data_cache_hit_writeback on it.
+ * 
+ * For compressed files, this is much faster than loading the file with #asset_load
+ * and writing it back afterwards: decompressors write the output sequentially,
+ * so most of it is naturally evicted from the cache while decompression
+ * progresses, and only the tail of the buffer needs to be written back.
+ * 
+ * @param fn        Filename to load (including filesystem prefix, eg: "rom:/foo.dat")
+ * @param sz        If not NULL, this will be filed with the uncompressed size of the loaded file
+ * @return void*    Pointer to the loaded file (must be freed with free() when done)
+ */
+void *asset_load_writeback(const char *fn, int *sz);
+
+/**
+ * @brief Load an asset file, decompressing it asynchronously on the RSP
+ * 
+ * This function works like #asset_load, but if the file is compressed with
+ * LZ4 (level 1), the decompression is scheduled on the RSP via rspq, rather
+ * than being performed by the CPU. The function returns as soon as the
+ * compressed data has been read into memory, so that the CPU can keep doing
+ * other work while the RSP decompresses the file.
+ * 
+ * The returned buffer must not be accessed until the RSP has finished
+ * the decompression. To wait for it, create a syncpoint with
+ * #rspq_syncpoint_new right after calling this function (or call
+ * #rspq_wait).
+ * 
+ * Files not compressed with LZ4 are loaded synchronously as #asset_load does.
+ * 
+ * @code{.c}
+ *      int size;
+ *      void *data = asset_load_rsp("rom:/level1.dat", &size);
+ *      rspq_syncpoint_t sync = rspq_syncpoint_new();
+ * 
+ *      // ... do other work ...
+ * 
+ *      rspq_syncpoint_wait(sync);
+ *      // Now data can be used
+ * @endcode
+ * 
+ * @param fn        Filename to load (including filesystem prefix, eg: "rom:/foo.dat")
+ * @param sz        If not NULL, this will be filed with the uncompressed size of the loaded file
+ * @return void*    Pointer to the loaded file (must be freed with free() when done)
+ */
+void *asset_load_rsp(const char *fn, int *sz);
+
+/**
+ * @brief Load an asset file into an arena
+ * 
+ * This function works like #asset_load, but the file is allocated in the
+ * specified arena (see #arena_alloc), so it must not be freed with free():
+ * it is released together with the arena. Uncompressed files are read
+ * directly into the arena; compressed files are decompressed into a
+ * temporary heap buffer, which is then copied into the arena.
+ * 
+ * The function asserts if the arena does not have enough space for the file.
+ * 
+ * @param arena     Arena where the file will be allocated
+ * @param fn        Filename to load (including filesystem prefix, eg: "rom:/foo.dat")
+ * @param sz        If not NULL, this will be filed with the uncompressed size of the loaded file
+ * @return void*    Pointer to the loaded file (within the arena)
+ */
+void *asset_load_arena(arena_t *arena, const char *fn, int *sz);
+
+/** @brief Handle of an asynchronous asset load started by #asset_load_async */
+typedef struct asset_async_s asset_async_t;
+
+/**
+ * @brief Callback invoked when an asynchronous asset load is finished
+ * 
+ * @param ctx       Opaque context passed to #asset_load_async
+ * @param data      Pointer to the loaded file (must be freed with free() when done)
+ * @param size      Uncompressed size of the loaded file
+ */
+typedef void (*asset_async_cb_t)(void *ctx, void *data, int size);
+
+/**
+ * @brief Start loading an asset file asynchronously (possibly uncompressing it)
+ * 
+ * This function starts loading a file like #asset_load, but returns
+ * immediately. Loading is then performed in small steps by calling
+ * #asset_load_async_poll, typically once per frame, so that the application
+ * can keep animating a loading screen or playing audio while big assets
+ * are being loaded.
+ * 
+ * Uncompressed files on ROM are loaded via asynchronous PI DMA, so they
+ * require very little CPU time. Compressed files are decompressed in chunks
+ * via the streaming decompressor (the same used by #asset_fopen).
+ * 
+ * When loading is finished, @p cb is called from within #asset_load_async_poll.
+ * 
+ * @code{.c}
+ *      void level_loaded(void *ctx, void *data, int size) {
+ *          level_data = data;
+ *      }
+ * 
+ *      asset_async_t *req = asset_load_async("rom:/level1.dat", level_loaded, NULL);
+ *      while (!asset_load_async_poll(req, 4000)) {
+ *          draw_loading_bar(asset_load_async_progress(req));
+ *      }
+ * @endcode
+ * 
+ * @param fn        Filename to load (including filesystem prefix, eg: "rom:/foo.dat")
+ * @param cb        Callback to invoke when the load is finished
+ * @param ctx       Opaque context for the callback
+ * @return          Handle of the load operation
+ */
+asset_async_t *asset_load_async(const char *fn, asset_async_cb_t cb, void *ctx);
+
+/**
+ * @brief Make progress on an asynchronous asset load
+ * 
+ * This function performs loading work for at most (roughly) @p budget_us
+ * microseconds. When the load is finished, the completion callback is called,
+ * the handle is released and the function returns true. After that, the
+ * handle must not be used anymore.
+ * 
+ * @param req           Handle returned by #asset_load_async
+ * @param budget_us     Maximum CPU time to spend in this call, in microseconds.
+ *                      At least one chunk is always processed.
+ * @return true         The load is finished (the handle is not valid anymore)
+ * @return false        The load is still in progress
+ */
+bool asset_load_async_poll(asset_async_t *req, int budget_us);
+
+/**
+ * @brief Return the progress of an asynchronous asset load
+ * 
+ * @param req       Handle returned by #asset_load_async
+ * @return          Fraction of the file loaded so far (0.0 to 1.0)
+ */
+float asset_load_async_progress(asset_async_t *req);
+
 /**
  * @brief Open an asset file for reading (with transparent decompression)
  * 
@@ -133,6 +282,12 @@ void *asset_load(const char *fn, int *sz);
  * to do efficiently on a compressed file. Seeking forward is supported and is
  * simulated by reading (decompressing) and discarding data.
  * 
+ * The only exception are compressed assets created with a block index
+ * (using the --seekable option of mkasset): in this case, decompression is
+ * split into independent blocks, and any seek is supported by restarting
+ * decompression from the beginning of the block containing the target
+ * position. Seeking is then as expensive as decompressing up to one block.
+ * 
  * This behavior of the returned file is enforced also for non compressed
  * assets, so that the code is ready to switch to compressed assets if
  * required. If you need random access to an uncompressed file, simply use
@@ -144,6 +299,158 @@ void *asset_load(const char *fn, int *sz);
  */
 FILE *asset_fopen(const char *fn, int *sz);
 
+/**
+ * @brief Default size of the cache of prefetched files (see #asset_prefetch)
+ */
+#define ASSET_PREFETCH_CACHE_SIZE       (256*1024)
+
+/**
+ * @brief Start fetching a file into RAM, ahead of loading it
+ * 
+ * This function queues a background PI DMA transfer of the file contents
+ * (as stored in ROM, so still compressed) into a RAM cache, and returns
+ * immediately. A later #asset_load of the same file (including the functions
+ * built on it, like #sprite_load and #asset_load_writeback) takes the data
+ * from the cache: it only pays for decompression, without any ROM latency.
+ * The data is then removed from the cache.
+ * 
+ * Use this when it is known in advance which files will be needed (eg: the
+ * assets of the next area of a level), so that the transfers overlap with the
+ * gameplay. Transfers are submitted to the DMA queue (see #dma_read_queue) with
+ * the specified priority: use #DMA_PRIORITY_LOW so that they don't delay other
+ * transfers, like audio streaming.
+ * 
+ * The cache is bounded (see #asset_prefetch_set_cache_size). To make room for
+ * a new file, the oldest prefetched files that were never loaded are evicted.
+ * If there is still not enough space (eg: the other files are still being
+ * transferred), the request is ignored.
+ * 
+ * @code{.c}
+ *      // While the player walks towards the next area
+ *      asset_prefetch("rom:/area2/tiles.sprite", DMA_PRIORITY_LOW);
+ *      asset_prefetch("rom:/area2/map.dat", DMA_PRIORITY_LOW);
+ * 
+ *      // Later: no ROM access
+ *      sprite_t *tiles = sprite_load("rom:/area2/tiles.sprite");
+ * @endcode
+ * 
+ * @param fn        Filename to prefetch (only files in DragonFS are supported, eg: "rom:/foo.dat")
+ * @param priority  Priority of the DMA transfer (see #DMA_PRIORITY_NORMAL)
+ * @return true     The file was queued for prefetching (or was already prefetched)
+ * @return false    The file was not found, is compressed by DragonFS itself (see mkdfs -c),
+ *                  or there is not enough space in the cache
+ */
+bool asset_prefetch(const char *fn, int priority);
+
+/**
+ * @brief Set the maximum amount of memory used by prefetched files
+ * 
+ * If the cache is currently bigger, the oldest prefetched files are evicted.
+ * Setting the size to 0 disables prefetching.
+ * 
+ * @param size      Size of the cache in bytes (default: #ASSET_PREFETCH_CACHE_SIZE)
+ */
+void asset_prefetch_set_cache_size(int size);
+
+/**
+ * @brief Discard all the prefetched files
+ * 
+ * Pending transfers are waited for, so this must be called with interrupts enabled.
+ */
+void asset_prefetch_clear(void);
+
+/**
+ * @brief Allocate the state of compressed streams from a fixed pool
+ * 
+ * Each compressed file opened via #asset_fopen needs a decompression state
+ * (including the history window), which is about 16-21 KiB depending on the
+ * compression level. By default, this is allocated with malloc() when the
+ * file is opened, and freed when it is closed.
+ * 
+ * After calling this function, the states are instead allocated from a pool
+ * of at most @p max_streams buffers. Buffers of closed streams are reused by
+ * the next opened streams, so that the memory usage is predictable and
+ * repeatedly opening and closing streams (eg: music tracks, voices) does
+ * not fragment the heap. Opening more than @p max_streams compressed files
+ * at the same time triggers an assertion.
+ * 
+ * Uncompressed files do not need a decompression state, so they don't
+ * use the pool.
+ * 
+ * @param max_streams   Maximum number of compressed streams open at the same time
+ * 
+ * @see #asset_stream_pool_close
+ */
+void asset_stream_pool_init(int max_streams);
+
+/**
+ * @brief Free the stream pool allocated by #asset_stream_pool_init
+ * 
+ * All the compressed streams must be closed before calling this function.
+ * After this call, decompression states go back to being allocated via malloc().
+ */
+void asset_stream_pool_close(void);
+
+/**
+ * @brief Load statistics of a file (see #asset_get_stats)
+ * 
+ * Times are measured in CPU ticks (see #TICKS_READ and #TIMER_MICROS_LL),
+ * and are accumulated over all the loads of the file.
+ * 
+ * Compressed files are read by the decompressors themselves (for ROM files,
+ * while the DMA is still in progress), so #ticks_decompress also includes
+ * the time spent reading the compressed data. #ticks_io instead covers opening
+ * the file and reading its header, or the whole load for uncompressed files.
+ */
+typedef struct {
+    const char *filename;       ///< Filename (as passed to the loading function)
+    int algo;                   ///< Compression algorithm (0 = not compressed)
+    int cmp_size;               ///< Size of the compressed data in bytes
+    int size;                   ///< Size of the uncompressed data in bytes
+    int num_loads;              ///< Number of times the file was loaded or opened
+    uint64_t ticks_io;          ///< Time spent reading the file
+    uint64_t ticks_decompress;  ///< Time spent decompressing the file
+} asset_stats_t;
+
+/**
+ * @brief Enable or disable collection of load statistics
+ * 
+ * When enabled, all the asset loading functions (#asset_load, #asset_fopen,
+ * #asset_load_async, etc.) record per-file statistics, that can be inspected
+ * via #asset_get_stats or #asset_stats_dump. This is useful to decide the
+ * compression level to use for each file.
+ * 
+ * Statistics are disabled by default.
+ * 
+ * @param enable    True to enable statistics, false to disable them
+ */
+void asset_stats_enable(bool enable);
+
+/**
+ * @brief Reset the load statistics of all files
+ */
+void asset_stats_reset(void);
+
+/**
+ * @brief Iterate over the load statistics of all files
+ * 
+ * Files are returned in the order they were first loaded.
+ * 
+ * @code{.c}
+ *      for (const asset_stats_t *st = asset_get_stats(NULL); st; st = asset_get_stats(st))
+ *          debugf("%s: %d loads\n", st->filename, st->num_loads);
+ * @endcode
+ * 
+ * @param prev      Previous entry, or NULL to get the first one
+ * @return          Next entry, or NULL if there are no more entries
+ */
+const asset_stats_t *asset_get_stats(const asset_stats_t *prev);
+
+/**
+ * @brief Dump the load statistics of all files to the debug log (via debugf)
+ */
+void asset_stats_dump(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -26,6 +26,7 @@ extern "C" {
 typedef void(*audio_fill_buffer_callback)(short *buffer, size_t numsamples);
 
 void audio_init(const int frequency, int numbuffers);
+void audio_set_buffer_length(int num_samples);
 void audio_set_buffer_callback(audio_fill_buffer_callback fill_buffer_callback);
 void audio_pause(bool pause);
 void audio_write(const short * const buffer);
@@ -34,6 +35,8 @@ void audio_write_silence();
 void audio_close();
 int audio_get_frequency();
 int audio_get_buffer_length();
+int audio_get_underruns(void);
+int audio_get_buffered(void);
 
 short* audio_write_begin(void);
 void audio_write_end(void);
@@ -186,6 +186,34 @@ char** backtrace_symbols(void **buffer, int size);
 bool backtrace_symbols_cb(void **buffer, int size, uint32_t flags,
     void (*cb)(void *, backtrace_frame_t*), void *cb_arg);
 
+/**
+ * @brief Keep the symbol table in RAM, to speed up symbolization
+ * 
+ * By default, the symbol table is queried directly from ROM, so that
+ * symbolization works even when the heap is not available. This requires
+ * many PI transactions for each symbolized frame. If symbolization is done
+ * often (eg: to print profiles), call this function to keep the address table
+ * in RAM, plus a small cache of the most recently resolved symbols.
+ * 
+ * @param index_stride  Use 1 to load the whole address table in RAM (4 bytes
+ *                      per entry), together with the frame table used by
+ *                      #backtrace (12 bytes per function). Use a bigger value N to only load one
+ *                      entry every N, which saves memory but still requires
+ *                      a few ROM accesses per lookup (about log2(N)).
+ * @return              True if the cache was created, false if there is no
+ *                      symbol table or not enough memory.
+ * 
+ * @see #backtrace_cache_close
+ */
+bool backtrace_cache_init(int index_stride);
+
+/**
+ * @brief Free the memory used by the symbol table cache
+ * 
+ * @see #backtrace_cache_init
+ */
+void backtrace_cache_close(void);
+
 #ifdef __cplusplus
 }
 #endif
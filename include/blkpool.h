@@ -0,0 +1,124 @@
+/**
+ * @file blkpool.h
+ * @brief Fixed-size block allocator
+ * @ingroup lowlevel
+ *
+ * This module implements a pool of memory blocks of the same size, kept in
+ * a free list. Allocating and freeing a block is O(1), does not fragment the
+ * heap and, unlike malloc, can be done from interrupt handlers (eg: timer
+ * callbacks or syncpoint callbacks):
+ *
+ * @code{.c}
+ *      static blkpool_t particle_pool = BLKPOOL_INIT(particle_t, 64);
+ *
+ *      // At init time: make sure there are enough blocks for the interrupt handlers
+ *      blkpool_reserve(&particle_pool, 256);
+ *
+ *      // Anywhere, including interrupt handlers
+ *      particle_t *p = blkpool_alloc(&particle_pool);
+ *      [...]
+ *      blkpool_free(&particle_pool, p);
+ * @endcode
+ *
+ * The pool grows on demand by allocating chunks of blocks from the heap.
+ * This can only happen when the pool is used with interrupts enabled: from
+ * an interrupt handler (or with interrupts disabled), #blkpool_alloc only
+ * takes blocks which are already free, and returns NULL if there are none.
+ * Use #blkpool_reserve to preallocate the blocks needed by the handlers.
+ *
+ * Memory is returned to the heap only by #blkpool_close.
+ */
+#ifndef __LIBDRAGON_BLKPOOL_H
+#define __LIBDRAGON_BLKPOOL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A pool of fixed-size blocks
+ *
+ * The fields can be read to inspect the pool, but must not be modified.
+ */
+typedef struct blkpool_s {
+    void *free_list;            ///< Free blocks, linked via their first word
+    void *chunks;               ///< Chunks allocated from the heap, linked via their first word
+    uint32_t block_size;        ///< Size of each block in bytes
+    uint32_t chunk_blocks;      ///< Number of blocks allocated at once when the pool grows
+    uint32_t capacity;          ///< Total number of blocks in the pool
+    uint32_t used;              ///< Number of blocks currently allocated
+} blkpool_t;
+
+/**
+ * @brief Static initializer of a pool of objects of the specified type
+ *
+ * @param type          Type of the objects allocated from the pool
+ * @param per_chunk     Number of objects allocated at once when the pool grows
+ */
+#define BLKPOOL_INIT(type, per_chunk) \
+    { .block_size = (sizeof(type) + 7) & ~7, .chunk_blocks = (per_chunk) }
+
+/**
+ * @brief Initialize a pool of blocks
+ *
+ * No memory is allocated until the first call to #blkpool_alloc or #blkpool_reserve.
+ *
+ * @param[out] pool         Pool to initialize
+ * @param[in]  block_size   Size of each block in bytes (at least the size of a pointer)
+ * @param[in]  per_chunk    Number of blocks allocated at once when the pool grows
+ */
+void blkpool_init(blkpool_t *pool, int block_size, int per_chunk);
+
+/**
+ * @brief Make sure that the pool has at least the specified number of free blocks
+ *
+ * This is meant to be called at init time, so that the blocks are available
+ * to #blkpool_alloc calls made from interrupt handlers. It must be called
+ * with interrupts enabled.
+ *
+ * @param[in] pool          Pool
+ * @param[in] count         Number of free blocks required
+ */
+void blkpool_reserve(blkpool_t *pool, int count);
+
+/**
+ * @brief Allocate a block from the pool
+ *
+ * This function can be called from interrupt handlers. In that case (and
+ * more generally, when interrupts are disabled), the pool cannot grow, so
+ * NULL is returned if it has no free blocks left.
+ *
+ * The returned block is 8-byte aligned, and its contents are undefined.
+ *
+ * @param[in] pool          Pool
+ * @return Pointer to the block, or NULL if out of memory
+ */
+void *blkpool_alloc(blkpool_t *pool);
+
+/**
+ * @brief Free a block allocated by #blkpool_alloc
+ *
+ * This function can be called from interrupt handlers.
+ *
+ * @param[in] pool          Pool the block was allocated from
+ * @param[in] block         Block to free (NULL is ignored)
+ */
+void blkpool_free(blkpool_t *pool, void *block);
+
+/**
+ * @brief Release all the memory of the pool
+ *
+ * All the blocks allocated from the pool become invalid. The pool is left
+ * empty, and can be used again.
+ *
+ * @param[in] pool          Pool
+ */
+void blkpool_close(blkpool_t *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
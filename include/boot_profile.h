@@ -0,0 +1,80 @@
+/**
+ * @file boot_profile.h
+ * @brief Boot time profiler
+ * @ingroup lowlevel
+ *
+ * The boot profiler measures the time spent by each step of the boot
+ * sequence, from the entrypoint to the first frame shown on screen. The
+ * libdragon subsystems that take a significant time to initialize
+ * (global constructors, #dfs_init, #rtc_init, #controller_init,
+ * #display_init) record their own step automatically, and the application
+ * can add its own with #boot_profile_mark:
+ *
+ * @code{.c}
+ *      dfs_init(DFS_DEFAULT_LOCATION);
+ *      load_assets();
+ *      boot_profile_mark("load_assets");
+ *
+ *      // ... later, once the first frame has been shown
+ *      boot_profile_dump();
+ * @endcode
+ *
+ * All times are relative to the first instruction of the entrypoint, so
+ * they do not include the time spent by the IPL. The slow steps have
+ * non-blocking variants that can be used to show the first frame sooner:
+ * see #rtc_init_async and #controller_init_async.
+ */
+#ifndef __LIBDRAGON_BOOT_PROFILE_H
+#define __LIBDRAGON_BOOT_PROFILE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Maximum number of steps recorded by the boot profiler */
+#define BOOT_PROFILE_MAX_STEPS      32
+
+/** @brief A step of the boot sequence */
+typedef struct {
+    const char *name;           ///< Name of the step
+    uint32_t start;             ///< Start of the step, in ticks since the entrypoint
+    uint32_t ticks;             ///< Duration of the step, in ticks
+} boot_profile_step_t;
+
+/**
+ * @brief Record a step of the boot sequence
+ *
+ * The step spans the time from the end of the previous step (or from the
+ * entrypoint, for the first one) to now.
+ *
+ * @param name      Name of the step (must be a static string)
+ */
+void boot_profile_mark(const char *name);
+
+/**
+ * @brief Get the steps recorded so far
+ *
+ * @param[out] steps    Filled with a pointer to the array of steps
+ * @return              Number of steps in the array
+ */
+int boot_profile_get_steps(const boot_profile_step_t **steps);
+
+/**
+ * @brief Get the time at which the first frame was shown
+ *
+ * @return      Ticks since the entrypoint, or 0 if no frame was shown yet
+ */
+uint32_t boot_profile_first_frame(void);
+
+/**
+ * @brief Print the steps recorded so far via #debugf
+ */
+void boot_profile_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
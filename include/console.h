@@ -34,6 +34,14 @@
  * The screen will be updated on every console interaction
  */
 #define RENDER_AUTOMATIC    1
+/** 
+ * @brief RDP Rendering (flag)
+ *
+ * Can be combined with #RENDER_MANUAL or #RENDER_AUTOMATIC. The console is drawn
+ * by the RDP, redrawing only the rows that changed since the last render. This
+ * requires #rdp_init to have been called, and a 16 bpp display.
+ */
+#define RENDER_RDP          2
 /** @} */
 
 /**
@@ -7,6 +7,7 @@
 #define __LIBDRAGON_CONTROLLER_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 /**
  * @addtogroup controller
@@ -17,6 +18,7 @@
  * @name Bitmasks for controller status
  * @see #get_controllers_present
  * @see #get_accessories_present    
+ * @see #get_accessories_inserted
  * @{
  */
 /** @brief Controller 1 Inserted */
@@ -177,6 +179,9 @@ struct SI_origdat_gc {
  * 
  * When reading N64 controller state, only the `c` member array will be populated.
  * When reading GC controller state, only the `gc` member array will be populated.
+ * The background scan (see #get_keys_pressed) populates, for each port, the
+ * member that matches the identified device; for GameCube controllers, the
+ * `c` entry only carries the error status.
  */
 typedef struct controller_data
 {
@@ -193,17 +198,62 @@ typedef struct controller_origin_data
     struct SI_origdat_gc gc[4];
 } SI_controllers_origin_t;
 
+typedef struct accessory_request_s accessory_request_t;
+
+/** @brief Completion callback of an asynchronous accessory request */
+typedef void (*accessory_callback_t)(accessory_request_t *req, void *ctx);
+
+/**
+ * @brief Asynchronous accessory request
+ *
+ * Started with #accessory_read_async or #accessory_write_async. Only
+ * the done and result fields are meant to be read by the application.
+ */
+struct accessory_request_s
+{
+    /** @brief True when the request is completed */
+    volatile bool done;
+    /** @brief Result of the request, with the same values of #read_mempak_address
+     *         (valid once completed). The request stops at the first failed chunk. */
+    int result;
+    /** @brief Controller being accessed */
+    int controller;
+    /** @brief Address of the first chunk */
+    uint16_t address;
+    /** @brief True for a write request */
+    bool write;
+    /** @brief Data buffer */
+    uint8_t *data;
+    /** @brief Number of 32-byte chunks to transfer */
+    int num_chunks;
+    /** @brief Index of the chunk being transferred */
+    int cur;
+    /** @brief Completion callback (or NULL) */
+    accessory_callback_t callback;
+    /** @brief Opaque pointer passed to the callback */
+    void *ctx;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 void controller_init( void );
+void controller_init_async( void );
 void controller_read( struct controller_data * data );
 void controller_read_gc( struct controller_data * data, const uint8_t rumble[4] );
 void controller_read_gc_origin( struct controller_origin_data * data);
+void controller_set_gc_rumble( int controller, bool rumble );
 int get_controllers_present( void );
 int get_accessories_present( struct controller_data * data );
 void controller_scan( void );
+void controller_set_poll_schedule( uint32_t delay_ticks, int polls_per_frame );
+void controller_set_poll_line( int line, int polls_per_frame );
+uint32_t controller_get_sample_ticks( void );
+void controller_set_accessory_poll( int frames );
+int controller_get_accessories( void );
+int get_accessories_inserted( void );
+int get_accessories_removed( void );
 struct controller_data get_keys_down( void );
 struct controller_data get_keys_up( void );
 struct controller_data get_keys_held( void );
@@ -212,8 +262,16 @@ int get_dpad_direction( int controller );
 int read_mempak_address( int controller, uint16_t address, uint8_t *data );
 int write_mempak_address( int controller, uint16_t address, uint8_t *data );
 int identify_accessory( int controller );
+void accessory_read_async( int controller, uint16_t address, uint8_t *data, int len,
+                           accessory_request_t *req, accessory_callback_t cb, void *ctx );
+void accessory_write_async( int controller, uint16_t address, const uint8_t *data, int len,
+                            accessory_request_t *req, accessory_callback_t cb, void *ctx );
+bool accessory_request_done( accessory_request_t *req );
+int accessory_request_wait( accessory_request_t *req );
 void rumble_start( int controller );
 void rumble_stop( int controller );
+void rumble_set_intensity( int controller, uint8_t intensity );
+void rumble_set_pwm_frequency( int hz );
 void execute_raw_command( int controller, int command, int bytesout, int bytesin, unsigned char *out, unsigned char *in );
 
 #ifdef __cplusplus
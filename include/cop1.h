@@ -14,6 +14,9 @@
 #ifndef __LIBDRAGON_COP1_H
 #define __LIBDRAGON_COP1_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
 /* COP1 Control/Status bits definition. Please refer to MIPS R4300 manual. */
 #define C1_FLAG_INEXACT_OP          0x00000004         ///< Flag recording inexact operation
 #define C1_FLAG_UNDERFLOW           0x00000008         ///< Flag recording underflow
@@ -54,6 +57,44 @@
     asm volatile("ctc1 %0,$f31"::"r"(x)); \
 })
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Enable or disable flushing of denormalized floats to zero
+ *
+ * The FPU of the VR4300 does not implement denormalized floats: any operation
+ * producing or consuming one raises an unimplemented operation exception.
+ * With flush-to-zero enabled (the default, set at boot), denormalized results
+ * are flushed by the FPU itself (see #C1_FCR31_FS), and denormalized operands
+ * (eg: loaded from memory) are flushed to zero by the exception handler, which
+ * then runs the instruction again. Each of these traps costs a few microseconds:
+ * see #cop1_get_trap_count to check whether the code is affected.
+ *
+ * Disabling flush-to-zero makes all denormals crash, which can be useful to
+ * track down where they come from.
+ *
+ * @note In debug builds, the underflow exception is enabled, and the FPU does
+ *       not flush denormalized results when it is: they raise an underflow
+ *       exception instead.
+ *
+ * @param enable  True to flush denormals to zero, false to raise an exception
+ */
+void cop1_set_flush_to_zero(bool enable);
+
+/**
+ * @brief Return the number of FPU exceptions handled so far
+ *
+ * This counts the operations that trapped because of a denormalized operand,
+ * and that were resumed after flushing it to zero.
+ */
+uint32_t cop1_get_trap_count(void);
+
+#ifdef __cplusplus
+}
+#endif
+
 /** @} */
 
 #endif
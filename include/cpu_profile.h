@@ -0,0 +1,47 @@
+/**
+ * @file cpu_profile.h
+ * @brief Sampling CPU profiler
+ * @ingroup cpu_profile
+ */
+#ifndef __LIBDRAGON_CPU_PROFILE_H
+#define __LIBDRAGON_CPU_PROFILE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Maximum number of stack frames recorded for each sample */
+#define CPU_PROFILE_MAX_DEPTH       16
+
+/** @brief Magic of the sample files sent by #cpu_profile_dump ("PROF") */
+#define CPU_PROFILE_MAGIC           0x50524F46
+/** @brief Version of the sample files sent by #cpu_profile_dump */
+#define CPU_PROFILE_VERSION         1
+
+/**
+ * @brief Statistics of the profiler (see #cpu_profile_get_stats)
+ */
+typedef struct {
+    uint32_t samples;           ///< Number of samples recorded
+    uint32_t dropped;           ///< Number of samples lost because the buffer was full
+    uint32_t buffered_words;    ///< Words currently in the buffer, waiting for #cpu_profile_dump
+} cpu_profile_stats_t;
+
+/* start sampling the CPU */
+void cpu_profile_start(int hz, int depth, int buffer_size);
+/* stop sampling the CPU */
+void cpu_profile_stop(void);
+/* send the samples recorded so far via USB, and empty the buffer */
+void cpu_profile_dump(void);
+/* get the statistics of the profiler */
+void cpu_profile_get_stats(cpu_profile_stats_t *stats);
+/* stop sampling and free the buffer */
+void cpu_profile_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
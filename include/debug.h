@@ -7,6 +7,7 @@
 #define __LIBDRAGON_DEBUG_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #ifdef __cplusplus
@@ -115,6 +116,20 @@ extern "C" {
  */
 #define DEBUG_FEATURE_FILE_SD       (1 << 3)
 
+/**
+ * @brief Open flag for fast random access to files on SD (libdragon extension)
+ *
+ * Files on the SD filesystem opened with this flag (eg: `open("sd:/world.dat",
+ * O_RDONLY | O_FASTSEEK)`) get a map of their clusters, built when the file
+ * is opened. Seeking then does not walk the FAT chain anymore, which makes
+ * random access into large fragmented files much faster. Large reads are
+ * also transferred from the card directly into the destination buffer,
+ * with one burst for each run of contiguous clusters.
+ *
+ * This only applies to files opened read-only; the flag is ignored otherwise.
+ */
+#define O_FASTSEEK                  0x40000000
+
 
 /**
  * @brief Flag to activate all supported debugging features.
@@ -129,6 +144,19 @@ extern "C" {
 #define DEBUG_FEATURE_ALL           0xFF
 
 
+/**
+ * @brief Statistics of the USB logging channel (see #debug_get_usblog_stats)
+ */
+typedef struct {
+	uint32_t bytes_written;     ///< Bytes logged since startup (including the dropped ones)
+	uint32_t bytes_dropped;     ///< Bytes lost because the buffer was full
+	uint32_t writes_dropped;    ///< Number of writes lost because the buffer was full
+	uint32_t buffered;          ///< Bytes currently in the buffer, waiting to be sent
+	uint32_t max_buffered;      ///< Maximum number of bytes ever in the buffer
+	uint32_t binlog_records;    ///< Binary log records buffered since startup (see #debugbf)
+	uint32_t binlog_dropped;    ///< Binary log records lost because the buffer was full
+} debug_usblog_stats_t;
+
 #ifndef NDEBUG
 	/** @brief Initialize USB logging. */
 	bool debug_init_usblog(void);
@@ -142,6 +170,20 @@ extern "C" {
 	/** @brief Shutdown SD filesystem. */
 	void debug_close_sdfs(void);
 
+	/**
+	 * @brief Get the statistics of the USB logging channel.
+	 *
+	 * When the timer subsystem is initialized, USB logging is buffered and
+	 * sent in background. These statistics allow to check whether the buffer
+	 * is big enough for the amount of logging done by the application.
+	 *
+	 * @param[out] stats    Structure that will be filled with the statistics
+	 */
+	void debug_get_usblog_stats(debug_usblog_stats_t *stats);
+
+	/** @brief Underlying implementation function for #debugbf. */
+	void debug_binlogf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
 	/**
 	 * @brief Initialize debugging features of libdragon.
 	 *
@@ -177,7 +219,36 @@ extern "C" {
 	 * only simplifies disabling all debugging features, because it
 	 * is disabled when compiling with NDEBUG.
 	 */
+	#ifndef DEBUG_BINLOG
 	#define debugf(msg, ...)           fprintf(stderr, msg, ##__VA_ARGS__)
+	#else
+	#define debugf(msg, ...)           debugbf(msg, ##__VA_ARGS__)
+	#endif
+
+	/**
+	 * @brief Write a message to the binary USB logging channel.
+	 *
+	 * This is like #debugf, but the message is not formatted on the N64:
+	 * the address of the format string and the raw arguments are sent via
+	 * USB, and the n64log tool formats the message on the PC, reading the
+	 * format string from the ELF file. This is an order of magnitude faster
+	 * than #debugf, so it is useful for logging in hot paths without
+	 * affecting the timing too much.
+	 *
+	 * The format string must be a string literal (it is read from the ELF
+	 * file). String arguments are copied, and can be anything.
+	 *
+	 * The binary channel requires USB logging and the timer subsystem
+	 * (see #DEBUG_FEATURE_LOG_USB). When not available, the message is
+	 * formatted and written to stderr like #debugf does. Define
+	 * DEBUG_BINLOG before including libdragon.h to make #debugf use the
+	 * binary channel too.
+	 *
+	 * @code{.sh}
+	 *      n64log build/game.elf binlog-*.bin
+	 * @endcode
+	 */
+	#define debugbf(msg, ...)          debug_binlogf(msg, ##__VA_ARGS__)
 
 	/** 
 	 * @brief assertf() is like assert() with an attached printf().
@@ -202,7 +273,9 @@ extern "C" {
 	#define debug_init_isviewer()      ({ false; })
 	#define debug_init_sdlog(fn,fmt)   ({ false; })
 	#define debug_init_sdfs(prefix,np) ({ false; })
+	#define debug_get_usblog_stats(s)  ({ *(s) = (debug_usblog_stats_t){0}; })
 	#define debugf(msg, ...)           ({ })
+	#define debugbf(msg, ...)          ({ })
 	#define assertf(expr, msg, ...)    ({ })
 #endif
 
@@ -245,7 +318,7 @@ void debug_backtrace(void);
 
 /** @brief Underlying implementation function for assert() and #assertf. */ 
 void debug_assert_func_f(const char *file, int line, const char *func, const char *failedexpr, const char *msg, ...)
-   __attribute__((noreturn, format(printf, 5, 6)));
+   __attribute__((noreturn, cold, format(printf, 5, 6)));
 
 #ifdef __cplusplus
 } /* extern "C" */
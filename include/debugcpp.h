@@ -6,10 +6,12 @@
 #ifndef __LIBDRAGON_DEBUGCPP_H
 #define __LIBDRAGON_DEBUGCPP_H
 
-#if defined(__cplusplus) && !defined(NDEBUG)
+#if defined(__cplusplus) && !defined(NDEBUG) && defined(__cpp_exceptions)
     // We need to run some initialization code only in case libdragon is compiled from
     // a C++ program. So we hook a few common initialization functions and run our code.
     // C programs are not affected and the C++-related code will be unused and stripped by the linker.
+    // Programs built without exceptions (eg: N64_CXX_LITE) do not need the terminate handler,
+    // which would pull in the exception runtime.
     ///@cond
     void __debug_init_cpp(void);
 
@@ -6,6 +6,8 @@
 #ifndef __LIBDRAGON_DFSINTERNAL_H
 #define __LIBDRAGON_DFSINTERNAL_H
 
+#include "dragonfs.h"
+
 /**
  * @addtogroup dfs
  * @{
@@ -28,7 +30,7 @@ struct directory_entry
 {
     /** @brief Offset to next directory entry */
     uint32_t next_entry;
-    /** @brief File size and flags.  See #FLAGS_FILE, #FLAGS_DIR and #FLAGS_EOF */
+    /** @brief File size and flags.  See #FLAGS_FILE, #FLAGS_DIR, #FLAGS_EOF and #FLAGS_COMPRESSED */
     uint32_t flags;
     /** @brief The file or directory name */
     char path[MAX_FILENAME_LEN+1];
@@ -41,6 +43,59 @@ _Static_assert(sizeof(struct directory_entry) == SECTOR_SIZE, "invalid directory
 /** @brief Type definition */
 typedef struct directory_entry directory_entry_t;
 
+/** @brief Magic value at the start of the path hash index ("DFSH") */
+#define HASH_INDEX_MAGIC    0x44465348
+
+/**
+ * @brief Header of the path hash index
+ * 
+ * The hash index is optional, and allows to find a file given its full path
+ * without walking the directory tree. If present, its offset is stored in the
+ * #directory_entry::file_pointer field of the root sector (which is otherwise
+ * unused and zero).
+ * 
+ * The header is followed by #num_slots entries of type #hash_index_slot_t,
+ * forming an open-addressing hash table (with linear probing) keyed by the
+ * FNV-1a hash of the full path of each file, without leading slash
+ * (eg: "sprites/hero.sprite"). Directories are not part of the index.
+ */
+typedef struct hash_index_header
+{
+    /** @brief Magic value (#HASH_INDEX_MAGIC) */
+    uint32_t magic;
+    /** @brief Number of slots in the table (a power of two) */
+    uint32_t num_slots;
+} hash_index_header_t;
+
+/** @brief A slot of the path hash index (see #hash_index_header_t) */
+typedef struct hash_index_slot
+{
+    /** @brief FNV-1a hash of the full path */
+    uint32_t hash;
+    /** @brief Offset of the directory entry of the file (0 for an empty slot) */
+    uint32_t dirent;
+    /** @brief Offset of the full path (NULL-terminated string) */
+    uint32_t path;
+    /** @brief Reserved (0) */
+    uint32_t reserved;
+} hash_index_slot_t;
+
+_Static_assert(sizeof(hash_index_slot_t) == 16, "invalid hash_index_slot_t size");
+
+/**
+ * @brief Hash a path for the path hash index (32-bit FNV-1a)
+ */
+static inline uint32_t hash_index_path(const char *path)
+{
+    uint32_t h = 0x811C9DC5;
+    while (*path)
+    {
+        h ^= (uint8_t)*path++;
+        h *= 0x01000193;
+    }
+    return h;
+}
+
 /** @brief Open file handle structure */
 typedef struct open_file
 {
@@ -50,9 +105,17 @@ typedef struct open_file
      *  16-byte aligned so that it doesn't share cachelines with other
      *  members of the structure, so it's easier to handle coherency.
      * */
-    uint8_t cached_data[512] __attribute__((aligned(16)));
+    uint8_t cached_data[DFS_MIN_CACHE_SIZE] __attribute__((aligned(16)));
     /** @brief location of the cached data */
     uint32_t cached_loc;
+    /** @brief Number of valid bytes in the cache */
+    uint32_t cached_size;
+    /** @brief Cache buffer (either cached_data or a heap buffer of cache_max bytes) */
+    uint8_t *cache;
+    /** @brief Maximum cache size for this file (read-ahead grows up to this) */
+    uint32_t cache_max;
+    /** @brief Number of bytes to read on the next cache refill */
+    uint32_t readahead;
     /** @brief The unique file handle to refer to this file by */
     uint32_t handle;
     /** @brief The size in bytes of this file */
@@ -61,6 +124,15 @@ typedef struct open_file
     uint32_t loc;
     /** @brief The offset within the filesystem where the file is stored */
     uint32_t cart_start_loc;
+    /** @brief Index of the next free slot in the open file pool (when not in use) */
+    int next_free;
+    /** @brief Index of the path of this file in the access trace (-1 if not traced) */
+    int trace_path;
+    /** @brief Decompression state, for compressed files (NULL otherwise).
+     *
+     *  When set, #size, #loc and the cache refer to the compressed data
+     *  stored in ROM, while the state tracks the decompressed stream. */
+    struct dfs_decomp_s *decomp;
 } open_file_t;
 
 /** @} */ /* dfs */
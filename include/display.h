@@ -159,6 +159,85 @@ typedef filter_options_t antialias_t;
 
 ///@endcond
 
+/**
+ * @brief Presentation mode of the frames ready to be shown
+ *
+ * @see #display_set_frame_pacing
+ */
+typedef enum
+{
+    /** @brief Show all frames, in the order they were gotten (default) */
+    DISPLAY_PRESENT_FIFO,
+    /** @brief Show only the most recent ready frame, dropping older ones that
+     *         were not shown yet (lower latency when the CPU runs ahead) */
+    DISPLAY_PRESENT_LATEST,
+} display_present_mode_t;
+
+/**
+ * @brief Frame pacing statistics
+ *
+ * @see #display_get_stats
+ */
+typedef struct
+{
+    /** @brief Number of frames shown on the screen */
+    uint32_t frames_shown;
+    /** @brief Number of ready frames recycled without being shown (#DISPLAY_PRESENT_LATEST) */
+    uint32_t frames_dropped;
+    /** @brief Number of vblanks where a frame was due, but was still being drawn */
+    uint32_t vblanks_missed;
+    /** @brief Ticks spent waiting for a free buffer in the last #display_get */
+    uint32_t wait_ticks;
+    /** @brief Total ticks spent waiting for a free buffer in #display_get */
+    uint64_t wait_ticks_total;
+    /** @brief Number of frames currently ready and waiting to be shown */
+    uint32_t queue_depth;
+} display_stats_t;
+
+/**
+ * @brief Timing of the video interface, updated at each vblank
+ *
+ * All the times are in ticks (see #TICKS_READ), taken at the start of
+ * the vblank interrupt.
+ *
+ * @see #display_get_vi_timing
+ */
+typedef struct
+{
+    /** @brief Time of the last vblank */
+    uint32_t vblank_ticks;
+    /** @brief Measured time between the last two vblanks (one video field) */
+    uint32_t frame_ticks;
+    /** @brief Number of vblanks since #display_init */
+    uint32_t vblank_count;
+    /** @brief Time of the vblank where the current frame was first shown */
+    uint32_t flip_ticks;
+    /** @brief Value of #display_vi_timing_t::vblank_count when the current frame was first shown */
+    uint32_t flip_count;
+} display_vi_timing_t;
+
+/**
+ * @brief Vblank callback
+ *
+ * Called from the vblank interrupt, right after the display has flipped to
+ * the next frame (if one was ready). It runs with interrupts disabled, so it
+ * must be short: typically it records a timestamp, or kicks off some work
+ * that must be aligned to the video refresh.
+ *
+ * @see #display_on_vblank
+ */
+typedef void (*display_vblank_cb_t)(void *arg);
+
+/**
+ * @brief Dynamic resolution governor
+ *
+ * Called by #display_get with the time of the last frame and the current
+ * render size, which it can change to pick the size of the next frame.
+ *
+ * @see #display_set_governor
+ */
+typedef void (*display_governor_t)(uint32_t frame_ticks, uint32_t *width, uint32_t *height);
+
 /** 
  * @brief Display context (DEPRECATED: Use #surface_t instead)
  * 
@@ -262,6 +341,226 @@ uint32_t display_get_bitdepth(void);
  */
 uint32_t display_get_num_buffers(void);
 
+/**
+ * @brief Configure frame pacing
+ *
+ * By default, a new frame is shown at every vblank, as soon as it is ready.
+ * With a refresh divisor, each frame is left on the screen for at least that
+ * many vblanks: for instance, a divisor of 2 gives a steady 30 FPS on NTSC,
+ * instead of alternating between 60 and 30 when the application cannot
+ * keep up.
+ *
+ * @param[in] divisor
+ *            Minimum number of vblanks between two frames (1 or more)
+ * @param[in] mode
+ *            How to present frames when more than one is ready
+ */
+void display_set_frame_pacing(uint32_t divisor, display_present_mode_t mode);
+
+/**
+ * @brief Get the frame pacing statistics
+ *
+ * Statistics are accumulated since #display_init or the last call to
+ * #display_reset_stats, except #display_stats_t::wait_ticks and
+ * #display_stats_t::queue_depth that refer to the last frame and the
+ * current moment.
+ *
+ * @param[out] stats
+ *            Filled with the statistics
+ */
+void display_get_stats(display_stats_t *stats);
+
+/**
+ * @brief Reset the frame pacing statistics
+ */
+void display_reset_stats(void);
+
+/**
+ * @brief Change the rendering resolution at runtime
+ *
+ * The surfaces returned by the following calls to #display_get will have
+ * the specified size, and the VI will scale them up to the screen, reprogramming
+ * the scale registers at the vblank when each of them is shown. Frames already
+ * gotten keep their size. This allows to reduce the rendering cost during heavy
+ * scenes without calling #display_close and #display_init.
+ *
+ * The size cannot be larger than the resolution passed to #display_init, for
+ * which the buffers are allocated. The width is rounded down to the alignment
+ * required by the bit depth.
+ *
+ * @param[in] width
+ *            Width of the next frames in pixels
+ * @param[in] height
+ *            Height of the next frames in pixels
+ */
+void display_set_render_size(uint32_t width, uint32_t height);
+
+/**
+ * @brief Install a dynamic resolution governor
+ *
+ * The governor is called by #display_get before getting each frame, and can
+ * pick its render size (see #display_set_render_size) from the measured frame
+ * time. Sizes larger than the display resolution are clamped.
+ *
+ * @param[in] gov
+ *            The governor callback, or NULL to disable it
+ */
+void display_set_governor(display_governor_t gov);
+
+/**
+ * @brief Enable partial framebuffer updates
+ *
+ * When enabled, the display tracks which regions of each buffer are drawn
+ * (see #display_mark_dirty). The graphics and RDP drawing functions mark the
+ * regions they draw automatically. When #display_get returns a buffer, the
+ * regions changed in the frames shown since that buffer was last drawn are
+ * copied into it from the newest frame, so that the buffer already contains
+ * the last frame and only the parts that change need to be redrawn: there is
+ * no need to clear the screen every frame.
+ *
+ * This assumes that a single frame is drawn at a time. Regions drawn directly
+ * to the buffer memory must be marked with #display_mark_dirty.
+ *
+ * @param[in] enable
+ *            True to enable partial updates, false to disable them
+ */
+void display_set_partial_updates(bool enable);
+
+/**
+ * @brief Mark a region of a display buffer as drawn
+ *
+ * This function does nothing if partial updates are disabled, or if the
+ * surface is not a display buffer.
+ *
+ * @param[in] surf
+ *            A surface returned by #display_get
+ * @param[in] x
+ *            X coordinate of the top left of the region
+ * @param[in] y
+ *            Y coordinate of the top left of the region
+ * @param[in] width
+ *            Width of the region in pixels
+ * @param[in] height
+ *            Height of the region in pixels
+ */
+void display_mark_dirty(surface_t *surf, int x, int y, int width, int height);
+
+/**
+ * @brief Clear automatically the buffers returned by #display_get
+ *
+ * When enabled, #display_get and #display_try_get queue a RDP fill of the
+ * whole buffer before returning it, so that the clear costs no CPU time and
+ * runs in the background. The RDP must be initialized with #rdp_init.
+ *
+ * RDP drawing is correctly ordered after the clear, but drawing with the CPU
+ * is not: in that case, wait for the clear to be done (see #rspq_wait) before
+ * writing to the buffer. See #rdp_clear_surface for the RDP state that is
+ * changed by the clear.
+ *
+ * With partial updates (#display_set_partial_updates), the whole buffer is
+ * marked as dirty, as it is redrawn anyway.
+ *
+ * @param[in] enable
+ *            True to enable the auto-clear, false to disable it
+ * @param[in] color
+ *            Clear color, in the format of the display (see #graphics_make_color)
+ */
+void display_set_auto_clear(bool enable, uint32_t color);
+
+/**
+ * @brief Get the timing of the video interface
+ *
+ * This can be used to align the frame loop to the video refresh: for
+ * instance, the time left before the next vblank is approximately
+ * `frame_ticks - TICKS_SINCE(vblank_ticks)`.
+ *
+ * @param[out] timing
+ *             Filled with the timing as of the last vblank
+ */
+void display_get_vi_timing(display_vi_timing_t *timing);
+
+/**
+ * @brief Get the line currently being scanned out by the video interface
+ *
+ * Lines are counted from the start of the video signal, including the
+ * vertical blanking, so the visible area does not start at line 0.
+ *
+ * @return The current line
+ */
+uint32_t display_get_scanline(void);
+
+/**
+ * @brief Register a callback to be called at each vblank
+ *
+ * Up to 4 callbacks can be registered. See #display_vblank_cb_t for the
+ * constraints of the callback.
+ *
+ * @param[in] cb
+ *            Callback function
+ * @param[in] arg
+ *            Argument passed to the callback
+ */
+void display_on_vblank(display_vblank_cb_t cb, void *arg);
+
+/**
+ * @brief Unregister a callback registered with #display_on_vblank
+ *
+ * @param[in] cb
+ *            Callback function
+ * @param[in] arg
+ *            Argument it was registered with
+ */
+void display_remove_vblank(display_vblank_cb_t cb, void *arg);
+
+/** @brief Magic of the frames sent by #display_capture_start ("FRAM") */
+#define DISPLAY_CAPTURE_MAGIC       0x4652414D
+/** @brief Version of the frames sent by #display_capture_start */
+#define DISPLAY_CAPTURE_VERSION     1
+
+/** @brief Capture flag: downsample the frames by 2 in both directions */
+#define DISPLAY_CAPTURE_HALF        0x1
+/** @brief Capture flag: only send the tiles that changed since the previous frame */
+#define DISPLAY_CAPTURE_DELTA       0x2
+
+/**
+ * @brief Stream the shown frames over USB, for remote capture
+ *
+ * Every @p divisor frames passed to #display_show, the framebuffer is sent
+ * over USB (see #usb_write) as binary messages, that the n64cap tool
+ * converts into images or video. The frame is sent by the next call to
+ * #display_get / #display_try_get (so that the RDP is done drawing it), as
+ * long as the USB is available: otherwise, it is skipped.
+ *
+ * Sending a full 320x240x16 framebuffer takes 150 KiB. To reduce the
+ * bandwidth, #DISPLAY_CAPTURE_HALF halves the resolution, and
+ * #DISPLAY_CAPTURE_DELTA sends only the 16x16 tiles that changed since the
+ * previous captured frame (with periodic full frames). Both require a
+ * processing buffer, allocated by this function, and CPU time to encode
+ * the frames. Without flags, frames are sent with no copy.
+ *
+ * Each frame is made of a header of 8 words (magic, version, frame number,
+ * flags, width, height, bytes per pixel << 16 | stride, payload size),
+ * followed by the payload: the pixels, or for delta frames, a bitmap of
+ * the changed tiles followed by their pixels.
+ *
+ * @param[in] divisor
+ *            Capture one frame every @p divisor shown frames
+ * @param[in] flags
+ *            Flags (#DISPLAY_CAPTURE_HALF, #DISPLAY_CAPTURE_DELTA)
+ *
+ * @see #display_capture_stop
+ */
+void display_capture_start(uint32_t divisor, uint32_t flags);
+
+/**
+ * @brief Stop the capture started by #display_capture_start
+ *
+ * Returns the number of frames that had to be skipped because the USB was
+ * busy (or because frames were shown faster than they could be sent).
+ *
+ * @return Number of skipped frames
+ */
+uint32_t display_capture_stop(void);
 
 /** @cond */
 __attribute__((deprecated("use display_get or display_try_get instead")))
@@ -6,6 +6,7 @@
 #ifndef __LIBDRAGON_DMA_H
 #define __LIBDRAGON_DMA_H
 
+#include <stdint.h>
 #include <stdbool.h>
 
 #ifdef __cplusplus
@@ -27,6 +28,28 @@ void dma_read(void * ram_address, unsigned long pi_address, unsigned long len);
 
 void dma_wait(void);
 
+/**
+ * @name DMA queue priorities
+ *
+ * Suggested priorities for #dma_read_queue and #dma_write_queue. Any integer
+ * value can be used: higher values are serviced first.
+ * @{
+ */
+#define DMA_PRIORITY_LOW        0     ///< Bulk transfers (eg: level data)
+#define DMA_PRIORITY_NORMAL     8     ///< Default priority
+#define DMA_PRIORITY_HIGH       16    ///< Latency-sensitive transfers (eg: audio refills)
+/** @} */
+
+/** @brief Callback invoked at the end of a queued DMA transfer */
+typedef void (*dma_callback_t)(void *ctx);
+
+void dma_read_queue(void *ram_address, unsigned long pi_address, unsigned long len,
+    int priority, dma_callback_t cb, void *ctx);
+void dma_write_queue(const void *ram_address, unsigned long pi_address, unsigned long len,
+    int priority, dma_callback_t cb, void *ctx);
+int dma_queue_pending(void);
+void dma_queue_wait(void);
+
 /* 32 bit IO read from PI device */
 uint32_t io_read(uint32_t pi_address);
 
@@ -35,6 +58,34 @@ void io_write(uint32_t pi_address, uint32_t data);
 
 bool io_accessible(uint32_t pi_address);
 
+/**
+ * @brief Timings of the PI bus for the cartridge domain 1 (ROM)
+ *
+ * Each field is the raw value of the respective PI_BSD_DOM1 register. The
+ * time to transfer a 16-bit word is (pulse_width + 1) + (release + 1) RCP
+ * cycles, plus latency + 1 cycles at the beginning of each page of
+ * 2^(page_size + 2) bytes.
+ *
+ * @see #dma_set_speed_profile
+ */
+typedef struct {
+    uint8_t latency;            ///< Latency before the first word of a page
+    uint8_t pulse_width;        ///< Duration of the read strobe for each word
+    uint8_t page_size;          ///< Page size (2^(page_size + 2) bytes)
+    uint8_t release;            ///< Duration between two words
+} dma_speed_profile_t;
+
+/** @brief Standard ROM timings, as set by the IPL for most cartridges */
+#define DMA_SPEED_PROFILE_DEFAULT   ((dma_speed_profile_t){ .latency = 0x40, .pulse_width = 0x12, .page_size = 0x07, .release = 0x03 })
+/** @brief Faster ROM timings, supported by most flashcarts and dev hardware (validate with #dma_speed_test) */
+#define DMA_SPEED_PROFILE_FAST      ((dma_speed_profile_t){ .latency = 0x40, .pulse_width = 0x0C, .page_size = 0x07, .release = 0x02 })
+/** @brief Fastest ROM timings, only supported by some flashcarts (validate with #dma_speed_test) */
+#define DMA_SPEED_PROFILE_TURBO     ((dma_speed_profile_t){ .latency = 0x20, .pulse_width = 0x05, .page_size = 0x0F, .release = 0x02 })
+
+dma_speed_profile_t dma_get_speed_profile(void);
+void dma_set_speed_profile(dma_speed_profile_t profile);
+int dma_speed_test(dma_speed_profile_t profile, uint32_t pi_address, int len);
+
 __attribute__((deprecated("use dma_wait instead"))) 
 volatile int dma_busy(void);
 
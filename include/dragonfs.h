@@ -6,6 +6,9 @@
 #ifndef __LIBDRAGON_DRAGONFS_H
 #define __LIBDRAGON_DRAGONFS_H
 
+#include <stdio.h>
+#include <stdint.h>
+
 /** 
  * @addtogroup dfs
  * @{
@@ -20,9 +23,19 @@
 #define DFS_DEFAULT_LOCATION    0
 
 /**
- * @brief Maximum open files in DragonFS
+ * @brief Initial number of open file slots in DragonFS
+ *
+ * The pool of open files grows automatically when more files are
+ * opened at the same time, up to 4096 files.
  */
-#define MAX_OPEN_FILES      4
+#define MAX_OPEN_FILES      16
+
+/**
+ * @brief Minimum (and default) size of the read cache of each open file
+ *
+ * See #dfs_set_cache_size.
+ */
+#define DFS_MIN_CACHE_SIZE  512
 
 /**
  * @brief Maximum filename length
@@ -52,6 +65,8 @@
 #define DFS_ENFILE          -4
 /** @brief Invalid file handle */
 #define DFS_EBADHANDLE      -5
+/** @brief The file is compressed, so it cannot be accessed directly in ROM */
+#define DFS_ECOMPRESSED     -6
 /** @} */
 
 /** @cond */
@@ -80,8 +95,35 @@
 #define FLAGS_DIR           0x1
 /** @brief This is the end of a directory list */
 #define FLAGS_EOF           0x2
+/**
+ * @brief The file contents are compressed (see mkdfs -c)
+ *
+ * This flag is combined with #FLAGS_FILE: use #FILETYPE to check the type of an entry.
+ */
+#define FLAGS_COMPRESSED    0x4
 /** @} */
 
+/**
+ * @brief Callback invoked when an asynchronous read has completed
+ *
+ * @param ctx       Opaque context passed to #dfs_read_async
+ * @param len       Number of bytes read
+ */
+typedef void (*dfs_read_cb_t)(void *ctx, int len);
+
+/** @brief An entry of a directory returned by #dfs_dir_read */
+typedef struct
+{
+    /** @brief Name of the file or directory */
+    char name[MAX_FILENAME_LEN+1];
+    /** @brief Flags (#FLAGS_FILE or #FLAGS_DIR, possibly with #FLAGS_COMPRESSED) */
+    uint32_t flags;
+    /** @brief Size of the file as stored in ROM (compressed, for compressed files; 0 for directories) */
+    uint32_t size;
+    /** @brief Physical address of the file body in PI space (0 for directories) */
+    uint32_t rom_addr;
+} dfs_dirent_t;
+
 /** @} */
 
 #ifdef __cplusplus
@@ -92,15 +134,28 @@ int dfs_init(uint32_t base_fs_loc);
 int dfs_chdir(const char * const path);
 int dfs_dir_findfirst(const char * const path, char *buf);
 int dfs_dir_findnext(char *buf);
+int dfs_dir_read(const char * const path, dfs_dirent_t *entries, int max_entries);
 
 int dfs_open(const char * const path);
 int dfs_read(void * const buf, int size, int count, uint32_t handle);
+int dfs_read_async(uint32_t handle, void *buf, int len, dfs_read_cb_t cb, void *ctx);
+int dfs_read_async_pending(void);
 int dfs_seek(uint32_t handle, int offset, int origin);
 int dfs_tell(uint32_t handle);
 int dfs_close(uint32_t handle);
 int dfs_eof(uint32_t handle);
 int dfs_size(uint32_t handle);
 uint32_t dfs_rom_addr(const char *path);
+int dfs_map(const char *path, uint32_t *rom_addr, int *size);
+int dfs_map_read(uint32_t rom_addr, int size, int offset, void *buf, int len);
+int dfs_map_read_async(uint32_t rom_addr, int size, int offset, void *buf, int len,
+    int priority, void (*cb)(void *ctx), void *ctx);
+int dfs_set_cache_size(uint32_t handle, int size);
+void dfs_set_default_cache_size(int size);
+
+void dfs_trace_start(int max_events);
+void dfs_trace_stop(void);
+void dfs_trace_dump(FILE *out);
 
 const char *dfs_strerror(int error);
 
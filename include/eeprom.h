@@ -50,6 +50,17 @@ typedef enum eeprom_type_t
  */
 #define EEPROM_BLOCK_SIZE 8
 
+/**
+ * @brief Callback invoked when an asynchronous EEPROM access completes.
+ *
+ * The callback is called under interrupt. It receives the EEPROM status
+ * byte for writes (0 for reads) and the opaque context pointer.
+ *
+ * @see #eeprom_read_async
+ * @see #eeprom_write_async
+ */
+typedef void (*eeprom_callback_t)( uint8_t status, void * ctx );
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -58,6 +69,8 @@ eeprom_type_t eeprom_present( void );
 size_t eeprom_total_blocks( void );
 void eeprom_read( uint8_t block, uint8_t * dest );
 uint8_t eeprom_write( uint8_t block, const uint8_t * src );
+void eeprom_read_async( uint8_t block, uint8_t * dest, eeprom_callback_t callback, void * ctx );
+void eeprom_write_async( uint8_t block, const uint8_t * src, eeprom_callback_t callback, void * ctx );
 void eeprom_read_bytes( uint8_t * dest, size_t start, size_t len );
 void eeprom_write_bytes( const uint8_t * src, size_t start, size_t len );
 
@@ -83,6 +83,11 @@ int eepfs_erase(const char * path);
 bool eepfs_verify_signature(void);
 void eepfs_wipe(void);
 
+void eepfs_set_deferred(bool deferred);
+int eepfs_flush(void);
+void eepfs_flush_async(void);
+bool eepfs_flush_pending(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,101 @@
+/**
+ * @file fixed.h
+ * @brief Fixed point math
+ * @ingroup lowlevel
+ *
+ * This header defines two fixed point types, with the basic operations
+ * implemented as inline functions:
+ *
+ *  * #fx16_t: signed 16.16 fixed point, stored in 32 bits. It covers
+ *    scale factors, volumes and coordinates (range [-32768, 32768)).
+ *  * #fx32_t: signed 32.32 fixed point, stored in 64 bits. It is meant for
+ *    wide ranges that still need precision (eg: frequencies in Hz).
+ *
+ * The VR4300 FPU is fast on single precision, but all conversions between
+ * integers and floats go through it, and double precision operations (which
+ * C promotes to silently) are slow. Hot paths can use these types to skip
+ * the float round trips: APIs that take fixed point arguments have a "_fx"
+ * suffix (eg: #mixer_ch_set_freq_fx, #rdp_draw_sprite_scaled_fx).
+ *
+ * Constants can be written with #FX16 and #FX32, which are folded at compile
+ * time. In C++, the functions are constexpr.
+ *
+ * @code{.c}
+ *      fx16_t scale = FX16(1.5);
+ *      scale = fx16_mul(scale, FX16(0.75));     // 1.125
+ *      rdp_draw_sprite_scaled_fx(0, x, y, scale, scale, MIRROR_DISABLED);
+ * @endcode
+ */
+#ifndef __LIBDRAGON_FIXED_H
+#define __LIBDRAGON_FIXED_H
+
+#include <stdint.h>
+
+/// @cond
+#ifdef __cplusplus
+#define __FX_INLINE     constexpr inline
+#else
+#define __FX_INLINE     static inline
+#endif
+/// @endcond
+
+/** @brief Signed 16.16 fixed point number */
+typedef int32_t fx16_t;
+/** @brief Signed 32.32 fixed point number */
+typedef int64_t fx32_t;
+
+/** @brief Number of fractional bits of #fx16_t */
+#define FX16_FRAC       16
+/** @brief The value 1.0 as #fx16_t */
+#define FX16_ONE        ((fx16_t)1 << FX16_FRAC)
+/** @brief Convert a floating point constant to #fx16_t (rounding towards zero) */
+#define FX16(f)         ((fx16_t)((f) * (double)FX16_ONE))
+
+/** @brief Number of fractional bits of #fx32_t */
+#define FX32_FRAC       32
+/** @brief The value 1.0 as #fx32_t */
+#define FX32_ONE        ((fx32_t)1 << FX32_FRAC)
+/** @brief Convert a floating point constant to #fx32_t (rounding towards zero) */
+#define FX32(f)         ((fx32_t)((f) * (double)FX32_ONE))
+
+/** @brief Convert an integer to #fx16_t */
+__FX_INLINE fx16_t fx16_from_int(int i) { return (fx16_t)((uint32_t)i << FX16_FRAC); }
+/** @brief Convert a #fx16_t to an integer, rounding down */
+__FX_INLINE int fx16_to_int(fx16_t a) { return a >> FX16_FRAC; }
+/** @brief Convert a #fx16_t to an integer, rounding to nearest */
+__FX_INLINE int fx16_round(fx16_t a) { return (a + (FX16_ONE >> 1)) >> FX16_FRAC; }
+/** @brief Convert a float to #fx16_t (rounding towards zero) */
+__FX_INLINE fx16_t fx16_from_float(float f) { return (fx16_t)(f * (float)FX16_ONE); }
+/** @brief Convert a #fx16_t to float */
+__FX_INLINE float fx16_to_float(fx16_t a) { return (float)a * (1.0f / FX16_ONE); }
+/** @brief Multiply two #fx16_t */
+__FX_INLINE fx16_t fx16_mul(fx16_t a, fx16_t b) { return (fx16_t)(((int64_t)a * b) >> FX16_FRAC); }
+/** @brief Divide two #fx16_t (b must not be zero) */
+__FX_INLINE fx16_t fx16_div(fx16_t a, fx16_t b) { return (fx16_t)(((int64_t)a << FX16_FRAC) / b); }
+
+/** @brief Convert an integer to #fx32_t */
+__FX_INLINE fx32_t fx32_from_int(int64_t i) { return (fx32_t)((uint64_t)i << FX32_FRAC); }
+/** @brief Convert a #fx32_t to an integer, rounding down */
+__FX_INLINE int64_t fx32_to_int(fx32_t a) { return a >> FX32_FRAC; }
+/** @brief Convert a #fx16_t to #fx32_t */
+__FX_INLINE fx32_t fx32_from_fx16(fx16_t a) { return (fx32_t)((uint64_t)(int64_t)a << (FX32_FRAC - FX16_FRAC)); }
+/** @brief Convert a #fx32_t to #fx16_t, rounding down (the integer part must fit) */
+__FX_INLINE fx16_t fx32_to_fx16(fx32_t a) { return (fx16_t)(a >> (FX32_FRAC - FX16_FRAC)); }
+/** @brief Convert a float to #fx32_t (rounding towards zero) */
+__FX_INLINE fx32_t fx32_from_float(float f) { return (fx32_t)(f * (float)FX32_ONE); }
+/** @brief Convert a #fx32_t to float */
+__FX_INLINE float fx32_to_float(fx32_t a) { return (float)a * (1.0f / FX32_ONE); }
+/**
+ * @brief Multiply two #fx32_t
+ *
+ * The product is computed by 32-bit halves, as there is no 128-bit type.
+ * The integer part of the result must fit in 32 bits.
+ */
+__FX_INLINE fx32_t fx32_mul(fx32_t a, fx32_t b) {
+    return (fx32_t)((uint64_t)((a >> 32) * (b >> 32)) << 32)
+        + (a >> 32) * (int64_t)(uint32_t)b
+        + (int64_t)(uint32_t)a * (b >> 32)
+        + (fx32_t)(((uint64_t)(uint32_t)a * (uint32_t)b) >> 32);
+}
+
+#endif
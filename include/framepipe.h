@@ -0,0 +1,162 @@
+/**
+ * @file framepipe.h
+ * @brief Frame pipeline: overlap the CPU and the RSP/RDP across frames
+ * @ingroup display
+ *
+ * A simple frame loop prepares a frame on the CPU, then waits for the RSP
+ * and the RDP to draw it before showing it, and only then starts with the
+ * logic of the next frame. This module pipelines the loop instead: while
+ * the RSP and the RDP are drawing frame N, the CPU is already running the
+ * logic of frame N+1, and each frame is shown automatically as soon as it
+ * has been completely drawn.
+ *
+ * @code{.c}
+ *      frame_pipeline_init(2, FRAME_PIPELINE_RDP);
+ *
+ *      while (1) {
+ *          surface_t *disp = frame_pipeline_begin();
+ *
+ *          update_game_logic();
+ *          draw_scene(disp);           // rdp_* and other rspq commands
+ *
+ *          frame_pipeline_end();       // disp is shown when drawn
+ *      }
+ * @endcode
+ *
+ * #frame_pipeline_begin blocks only when too many frames are in flight
+ * (the CPU is ahead of the RSP/RDP), or when no display buffer is free (the
+ * game is running faster than the display). The time spent in each stage
+ * is available via #frame_pipeline_get_stats, to find out which of the
+ * processors is the bottleneck.
+ *
+ * The pipeline follows the completion of a frame via the rspq: a frame is
+ * done when the RSP has processed all the commands enqueued until
+ * #frame_pipeline_end (for instance, the audio mixer commands). With
+ * #FRAME_PIPELINE_RDP, the RDP is attached to the display buffer by
+ * #frame_pipeline_begin, and the frame is done when the RDP has finished
+ * writing it (see #rdp_detach_async).
+ *
+ * Each frame in flight has its own arena for rspq blocks, returned by
+ * #frame_pipeline_arena: the blocks recorded in it during a frame (eg: a
+ * display list built for that frame only) are released automatically
+ * when the frame is done, so there is no need to track their lifetime.
+ *
+ * @note The CPU must not touch the data used by the commands of a frame
+ *       (eg: vertex buffers) until the frame is done: buffers written by
+ *       the CPU every frame should have one copy per frame in flight,
+ *       indexed by #frame_pipeline_index.
+ */
+#ifndef __LIBDRAGON_FRAMEPIPE_H
+#define __LIBDRAGON_FRAMEPIPE_H
+
+#include <stdint.h>
+#include "surface.h"
+#include "rspq.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Maximum number of frames in flight */
+#define FRAME_PIPELINE_MAX_FRAMES       4
+
+/** @brief Attach the RDP to the display buffer, and wait for the RDP before showing it */
+#define FRAME_PIPELINE_RDP              (1 << 0)
+
+/**
+ * @brief Statistics of the frame pipeline (see #frame_pipeline_get_stats)
+ *
+ * All times are in ticks (see #TICKS_READ).
+ */
+typedef struct {
+    uint32_t frames;            ///< Number of frames submitted with #frame_pipeline_end
+    uint32_t completed;         ///< Number of frames completely drawn and shown
+    uint64_t cpu_ticks;         ///< Total time between #frame_pipeline_begin and #frame_pipeline_end
+    uint32_t cpu_max_ticks;     ///< Maximum time between #frame_pipeline_begin and #frame_pipeline_end
+    uint64_t wait_ticks;        ///< Total time blocked in #frame_pipeline_begin
+    uint32_t wait_max_ticks;    ///< Maximum time blocked in #frame_pipeline_begin
+    uint64_t draw_ticks;        ///< Total time between #frame_pipeline_end and the frame being done
+    uint32_t draw_max_ticks;    ///< Maximum time between #frame_pipeline_end and the frame being done
+} frame_pipeline_stats_t;
+
+/**
+ * @brief Initialize the frame pipeline
+ *
+ * The display (and the RDP, with #FRAME_PIPELINE_RDP) must be initialized.
+ * To actually overlap frames, the display needs at least one buffer more
+ * than the number of frames in flight (eg: triple buffering for 2 frames).
+ *
+ * @param num_frames    Number of frames in flight (1 to #FRAME_PIPELINE_MAX_FRAMES).
+ *                      With 1, the CPU waits for each frame to be drawn before
+ *                      starting the next.
+ * @param flags         Flags (eg: #FRAME_PIPELINE_RDP)
+ */
+void frame_pipeline_init(int num_frames, uint32_t flags);
+
+/**
+ * @brief Begin a new frame
+ *
+ * Waits until the oldest frame in flight is done (if there are already
+ * num_frames in flight), and until a display buffer is available.
+ *
+ * @return The display buffer to draw the frame into
+ */
+surface_t* frame_pipeline_begin(void);
+
+/**
+ * @brief Submit the current frame
+ *
+ * The frame will be shown when the RSP (and the RDP, with
+ * #FRAME_PIPELINE_RDP) has processed all the commands enqueued so far.
+ * This function does not block.
+ */
+void frame_pipeline_end(void);
+
+/**
+ * @brief Get the arena for the rspq blocks of the current frame
+ *
+ * The blocks allocated in the arena (via #rspq_block_begin_arena) are
+ * valid until the current frame is done. Must be called between
+ * #frame_pipeline_begin and #frame_pipeline_end.
+ *
+ * @return The arena of the current frame
+ */
+rspq_block_arena_t* frame_pipeline_arena(void);
+
+/**
+ * @brief Get the index of the current frame among the frames in flight
+ *
+ * This can be used to index per-frame copies of the buffers written by
+ * the CPU.
+ *
+ * @return The index of the current frame (0 to num_frames-1)
+ */
+int frame_pipeline_index(void);
+
+/**
+ * @brief Wait until all the frames in flight are done
+ */
+void frame_pipeline_wait(void);
+
+/**
+ * @brief Get the statistics of the frame pipeline
+ *
+ * @param[out] stats    Structure that will be filled with the statistics
+ */
+void frame_pipeline_get_stats(frame_pipeline_stats_t *stats);
+
+/**
+ * @brief Reset the statistics of the frame pipeline
+ */
+void frame_pipeline_reset_stats(void);
+
+/**
+ * @brief Wait for all the frames in flight, and free the pipeline
+ */
+void frame_pipeline_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,24 @@
+/**
+ * @file gcov_dump.h
+ * @brief Profile data (gcov) for profile-guided optimization
+ * @ingroup gcov_dump
+ */
+#ifndef __LIBDRAGON_GCOV_DUMP_H
+#define __LIBDRAGON_GCOV_DUMP_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* write the profile counters to a file, as a gcov stream */
+bool gcov_dump_file(const char *fn);
+/* send the profile counters via USB, as a gcov stream */
+void gcov_dump_usb(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
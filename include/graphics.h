@@ -67,11 +67,20 @@ inline color_t color_from_packed32(uint32_t c) {
     return (color_t){ .r=(c>>24)&0xFF, .g=(c>>16)&0xFF, .b=(c>>8)&0xFF, .a=c&0xFF };
 }
 
+/** @brief Blend modes of #graphics_draw_sprite_trans (see #graphics_set_blend_mode) */
+typedef enum {
+    GRAPHICS_BLEND_AUTO,          ///< Alpha test on 16 bpp, alpha blend on 32 bpp (default)
+    GRAPHICS_BLEND_OPAQUE,        ///< Copy all the pixels, ignoring alpha
+    GRAPHICS_BLEND_ALPHA_TEST,    ///< Copy only the pixels which are not fully transparent
+    GRAPHICS_BLEND_ALPHA_BLEND,   ///< Blend the pixels using their alpha (16 bpp: same as alpha test)
+} graphics_blend_mode_t;
+
 uint32_t graphics_make_color( int r, int g, int b, int a );
 uint32_t graphics_convert_color( color_t color );
 void graphics_draw_pixel( surface_t* surf, int x, int y, uint32_t c );
 void graphics_draw_pixel_trans( surface_t* surf, int x, int y, uint32_t c );
 void graphics_draw_line( surface_t* surf, int x0, int y0, int x1, int y1, uint32_t c );
+void graphics_draw_lines( surface_t* surf, const int *xy, int num_lines, uint32_t c );
 void graphics_draw_line_trans( surface_t* surf, int x0, int y0, int x1, int y1, uint32_t c );
 void graphics_draw_box( surface_t* surf, int x, int y, int width, int height, uint32_t color );
 void graphics_draw_box_trans( surface_t* surf, int x, int y, int width, int height, uint32_t color );
@@ -85,6 +94,7 @@ void graphics_draw_sprite( surface_t* surf, int x, int y, sprite_t *sprite );
 void graphics_draw_sprite_stride( surface_t* surf, int x, int y, sprite_t *sprite, int offset );
 void graphics_draw_sprite_trans( surface_t* surf, int x, int y, sprite_t *sprite );
 void graphics_draw_sprite_trans_stride( surface_t* surf, int x, int y, sprite_t *sprite, int offset );
+void graphics_set_blend_mode( graphics_blend_mode_t mode );
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,62 @@
+/**
+ * @file heap_profile.h
+ * @brief Heap allocation profiler
+ * @ingroup heap_profile
+ */
+#ifndef __LIBDRAGON_HEAP_PROFILE_H
+#define __LIBDRAGON_HEAP_PROFILE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Maximum number of stack frames recorded for each call site */
+#define HEAP_PROFILE_MAX_DEPTH      8
+
+/** @brief Magic of the dumps sent by #heap_profile_dump ("HEAP") */
+#define HEAP_PROFILE_MAGIC          0x48454150
+/** @brief Version of the dumps sent by #heap_profile_dump */
+#define HEAP_PROFILE_VERSION        1
+
+/**
+ * @brief Allocation statistics of a call site (see #heap_profile_get_sites)
+ */
+typedef struct {
+    uint32_t live_bytes;        ///< Bytes currently allocated by this call site
+    uint32_t live_blocks;       ///< Blocks currently allocated by this call site
+    uint32_t peak_bytes;        ///< Maximum value reached by live_bytes
+    uint32_t allocs;            ///< Total number of allocations made by this call site
+    uint32_t total_bytes;       ///< Total number of bytes allocated by this call site
+    int depth;                  ///< Number of frames in callstack
+    void *callstack[HEAP_PROFILE_MAX_DEPTH];   ///< Call stack of the allocation (innermost first)
+} heap_profile_site_t;
+
+/**
+ * @brief Global statistics of the heap profiler (see #heap_profile_get_stats)
+ */
+typedef struct {
+    uint32_t live_bytes;        ///< Bytes currently allocated (by tracked allocations)
+    uint32_t live_blocks;       ///< Number of tracked blocks currently allocated
+    uint32_t peak_bytes;        ///< Maximum value reached by live_bytes
+    uint32_t num_sites;         ///< Number of different call sites seen
+    uint32_t dropped;           ///< Allocations not tracked because the tables were full
+} heap_profile_stats_t;
+
+/* start tracking the heap allocations */
+void heap_profile_init(int depth, int max_blocks, int max_sites);
+/* stop tracking the heap allocations and free the tables */
+void heap_profile_close(void);
+/* get the global statistics of the heap profiler */
+void heap_profile_get_stats(heap_profile_stats_t *out);
+/* get the statistics of the call sites, sorted by live bytes */
+int heap_profile_get_sites(heap_profile_site_t *out, int max_count);
+/* send the statistics of all the call sites via USB */
+void heap_profile_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,45 @@
+/**
+ * @file idle.h
+ * @brief Background work run while waiting for the hardware
+ * @ingroup idle
+ */
+#ifndef __LIBDRAGON_IDLE_H
+#define __LIBDRAGON_IDLE_H
+
+#include <stdint.h>
+#include "n64sys.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Budget given to the idle tasks by the polling wait loops, in ticks (100 µs)
+ *
+ * Loops that wait for the hardware (eg: #dma_wait, #RSP_WAIT_LOOP) cannot
+ * know how long they will wait, so they run the idle tasks in small slices.
+ */
+#define IDLE_POLL_BUDGET        (TICKS_PER_SECOND / 10000)
+
+/**
+ * @brief An idle task
+ *
+ * @param ctx       Opaque pointer passed to #idle_register
+ * @param budget    Number of ticks the task may run for. The wait is delayed
+ *                  by any time spent past the budget, so a task should do
+ *                  nothing if its smallest step does not fit.
+ */
+typedef void (*idle_func_t)(void *ctx, uint32_t budget);
+
+/* register a task to run while waiting */
+void idle_register(idle_func_t func, void *ctx);
+/* unregister a task registered with idle_register */
+void idle_unregister(idle_func_t func, void *ctx);
+/* run the idle tasks, for at most the specified number of ticks */
+void idle_run(uint32_t budget);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
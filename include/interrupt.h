@@ -30,6 +30,74 @@ typedef enum
     INTERRUPTS_ENABLED
 } interrupt_state_t;
 
+/**
+ * @brief Interrupt sources that can have handlers registered
+ */
+typedef enum
+{
+    INTERRUPT_SP,       ///< RSP interrupt
+    INTERRUPT_SI,       ///< SI (joybus) interrupt
+    INTERRUPT_AI,       ///< Audio interface interrupt
+    INTERRUPT_VI,       ///< Video interface interrupt
+    INTERRUPT_PI,       ///< Peripheral interface interrupt
+    INTERRUPT_DP,       ///< RDP interrupt
+    INTERRUPT_TI,       ///< Timer interrupt (COP0 compare)
+    INTERRUPT_CART,     ///< Cartridge interrupt
+    INTERRUPT_NUM_SOURCES ///< Number of interrupt sources
+} interrupt_source_t;
+
+/**
+ * @brief Accounting of an interrupt handler
+ *
+ * See #interrupt_get_handler_stats.
+ */
+typedef struct
+{
+    /** @brief Registered callback */
+    void (*callback)();
+    /** @brief Number of times the callback was called */
+    uint32_t count;
+    /** @brief Total number of ticks spent in the callback */
+    uint64_t ticks;
+} interrupt_handler_stats_t;
+
+/** @brief Number of buckets in the histogram of disabled-interrupts durations */
+#define INTERRUPT_PROFILE_HISTOGRAM_BUCKETS   24
+/** @brief Maximum number of distinct callers tracked by the interrupt profiler */
+#define INTERRUPT_PROFILE_MAX_CALLERS         32
+
+/**
+ * @brief Statistics of the disabled-interrupts sections started by a caller
+ *
+ * See #interrupt_profile_get.
+ */
+typedef struct
+{
+    void *caller;               ///< Address of the call to #disable_interrupts
+    uint32_t count;             ///< Number of sections
+    uint32_t max_ticks;         ///< Longest section, in ticks
+    uint64_t total_ticks;       ///< Total duration of the sections, in ticks
+} interrupt_profile_caller_t;
+
+/**
+ * @brief Profile of the disabled-interrupts sections
+ *
+ * See #interrupt_profile_get.
+ */
+typedef struct
+{
+    /** @brief Longest section, in ticks */
+    uint32_t max_ticks;
+    /** @brief Address of the call to #disable_interrupts that started the longest section */
+    void *max_caller;
+    /** @brief Histogram of durations: bucket i counts sections lasting [2^i, 2^(i+1)) ticks */
+    uint32_t histogram[INTERRUPT_PROFILE_HISTOGRAM_BUCKETS];
+    /** @brief Callers with the longest sections */
+    interrupt_profile_caller_t callers[INTERRUPT_PROFILE_MAX_CALLERS];
+    /** @brief Number of valid entries in callers */
+    int num_callers;
+} interrupt_profile_t;
+
 /** @} */
 
 void register_AI_handler( void (*callback)() );
@@ -92,6 +160,13 @@ void disable_interrupts();
 
 interrupt_state_t get_interrupts_state(); 
 
+int interrupt_get_handler_stats( interrupt_source_t source, interrupt_handler_stats_t *stats, int max_stats );
+void interrupt_reset_handler_stats( void );
+
+void interrupt_profile_get( interrupt_profile_t *profile );
+void interrupt_profile_reset( void );
+void interrupt_profile_dump( void );
+
 #ifdef __cplusplus
 }
 #endif
@@ -24,11 +24,28 @@
 #define JOYBUS_BLOCK_DWORDS ( JOYBUS_BLOCK_SIZE / sizeof(uint64_t) )
 
 
+/**
+ * @brief Joybus block being composed
+ *
+ * @see #joybus_block_init
+ * @see #joybus_block_add
+ */
+typedef struct {
+    /** @brief Contents of the block, to be passed to #joybus_exec */
+    uint8_t data[JOYBUS_BLOCK_SIZE] __attribute__((aligned(8)));
+    /** @brief Offset where the next command will be written */
+    int pos;
+    /** @brief Channel of the next command */
+    int channel;
+} joybus_block_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 void joybus_exec( const void * inblock, void * outblock );
+void joybus_block_init( joybus_block_t *blk );
+int joybus_block_add( joybus_block_t *blk, int channel, const void *tx, int txlen, int rxlen );
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,95 @@
+/**
+ * @file kernel.h
+ * @brief Cooperative multitasking kernel
+ * @ingroup kernel
+ */
+#ifndef __LIBDRAGON_KERNEL_H
+#define __LIBDRAGON_KERNEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "n64sys.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Minimum stack size for a thread, in bytes */
+#define KTHREAD_MIN_STACK_SIZE    2048
+
+/** @brief A thread (opaque structure) */
+typedef struct kthread_s kthread_t;
+
+/**
+ * @brief A wait queue
+ *
+ * A wait queue is a list of threads waiting for an event, usually signaled
+ * by an interrupt handler via #kwaitq_wake_all. It must be zero-initialized
+ * before use (eg: `static kwaitq_t q;`), and needs no destruction.
+ */
+typedef struct kwaitq_s {
+    kthread_t *head;            ///< First waiting thread
+    kthread_t *tail;            ///< Last waiting thread
+    volatile uint32_t seq;      ///< Number of times the queue was woken
+} kwaitq_t;
+
+/* initialize the kernel, turning the caller into the main thread */
+void kernel_init(void);
+/* check whether the kernel is initialized */
+bool kernel_active(void);
+
+/* create a new thread, ready to run */
+kthread_t *kthread_new(const char *name, int stack_size, int (*entry)(void *arg), void *arg);
+/* return the currently running thread */
+kthread_t *kthread_current(void);
+/* return the name of a thread */
+const char *kthread_name(kthread_t *th);
+/* give the CPU to other threads that are ready to run */
+void kthread_yield(void);
+/* terminate the current thread */
+void kthread_exit(int result) __attribute__((noreturn));
+/* wait for a thread to terminate, free it, and return its result */
+int kthread_join(kthread_t *th);
+
+/**
+ * @brief Read the wake-up counter of a wait queue
+ *
+ * The returned value must be passed to #kwaitq_wait after checking the
+ * condition being waited for. See #kwaitq_wait for an example.
+ *
+ * @param[in] q     Wait queue
+ * @return          Current value of the wake-up counter
+ */
+static inline uint32_t kwaitq_seq(kwaitq_t *q) {
+    uint32_t seq = q->seq;
+    MEMORY_BARRIER();
+    return seq;
+}
+
+/* block the current thread until the queue is woken */
+void kwaitq_wait(kwaitq_t *q, uint32_t seq);
+/* wake all the threads waiting on a queue (also from interrupt handlers) */
+void kwaitq_wake_all(kwaitq_t *q);
+
+/**
+ * @brief Block the current thread until a condition becomes true.
+ *
+ * The condition is evaluated again every time the wait queue is woken.
+ * This is a shortcut for the canonical #kwaitq_wait loop.
+ *
+ * @param[in] q     Wait queue woken whenever the condition might have changed
+ * @param[in] cond  Condition to wait for
+ */
+#define KWAITQ_WAIT_UNTIL(q, cond) ({ \
+    for (;;) { \
+        uint32_t __seq = kwaitq_seq(q); \
+        if (cond) break; \
+        kwaitq_wait(q, __seq); \
+    } \
+})
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -42,11 +42,25 @@
 #include "eepromfs.h"
 #include "graphics.h"
 #include "interrupt.h"
+#include "kernel.h"
+#include "idle.h"
 #include "n64sys.h"
 #include "backtrace.h"
 #include "rdp.h"
+#include "framepipe.h"
 #include "rsp.h"
 #include "timer.h"
+#include "cpu_profile.h"
+#include "heap_profile.h"
+#include "rsp_profile.h"
+#include "arena.h"
+#include "blkpool.h"
+#include "fixed.h"
+#include "vmem.h"
+#include "overlay.h"
+#include "boot_profile.h"
+#include "gcov_dump.h"
+#include "prof_zone.h"
 #include "exception.h"
 #include "dir.h"
 #include "mixer.h"
@@ -55,8 +69,13 @@
 #include "xm64.h"
 #include "ym64.h"
 #include "rspq.h"
+#include "vecmath.h"
+#include "rspmem.h"
+#include "rspjob.h"
 #include "surface.h"
 #include "sprite.h"
+#include "tilemap.h"
 #include "debugcpp.h"
+#include "rspqcpp.h"
 
 #endif
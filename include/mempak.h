@@ -61,7 +61,9 @@ int get_mempak_entry( int controller, int entry, entry_structure_t *entry_data )
 int format_mempak( int controller );
 int read_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *data );
 int write_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *data );
+int update_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *data, const uint8_t *old_data );
 int delete_mempak_entry( int controller, entry_structure_t *entry );
+void invalidate_mempak_cache( int controller );
 
 #ifdef __cplusplus
 }
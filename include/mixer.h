@@ -9,6 +9,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "fixed.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,13 +20,13 @@ extern "C" {
  * @ingroup audio
  * @brief Flexible, composable, fast, RSP-based audio mixer.
  *
- * This module offers a flexible API to mix and play up to 32 independent audio
+ * This module offers a flexible API to mix and play up to 64 independent audio
  * streams called "waveforms". It also supports resampling: each waveform can
  * play at a different playback frequency, which in turn can be different from
  * the final output frequency. The resampling and mixing is performed by a very
  * efficient RSP microcode (see rsp_mixer.S).
  *
- * The mixer exposes 32 channels that can be used to play different audio sources.
+ * The mixer exposes up to 64 channels that can be used to play different audio sources.
  * An audio source is called a "waveform", and is represented by the type
  * waveform_t. To be able to produce audio that can be mixed (eg: decompress
  * and playback a MP3 file), the decoder/player code must implement a waveform_t.
@@ -54,8 +55,18 @@ extern "C" {
  * audio pipeline can work totally off CPU.
  */
 
-/** @brief Maximum number of channels supported by the mixer */
-#define MIXER_MAX_CHANNELS      32
+/**
+ * @brief Maximum number of channels supported by the mixer
+ *
+ * The RSP mixes 32 slots (a stereo channel uses two) in a single pass. Buses
+ * with more slots in use are mixed in multiple passes, each one added to the
+ * previous ones, so the RSP time of channels above the first 32 slots of a bus
+ * is slightly higher.
+ */
+#define MIXER_MAX_CHANNELS      64
+
+/** @brief Maximum number of buses supported by the mixer (see #mixer_ch_set_bus) */
+#define MIXER_MAX_BUSES         4
 
 /**
  * Number of bytes in sample buffers that must be over-read to make the
@@ -126,6 +137,18 @@ void mixer_set_vol(float vol);
  */
 void mixer_ch_set_vol(int ch, float lvol, float rvol);
 
+/**
+ * @brief Set channel volume (as left/right), in fixed point.
+ *
+ * This is the same as #mixer_ch_set_vol, with the volumes in 16.16 fixed
+ * point (eg: FX16(0.5)).
+ *
+ * @param[in]   ch              Channel index
+ * @param[in]   lvol            Left volume (range [0..FX16_ONE])
+ * @param[in]   rvol            Right volume (range [0..FX16_ONE])
+ */
+void mixer_ch_set_vol_fx(int ch, fx16_t lvol, fx16_t rvol);
+
 /**
  * @brief Set channel volume (as volume and panning).
  * 
@@ -167,6 +190,27 @@ void mixer_ch_set_vol_pan(int ch, float vol, float pan);
 void mixer_ch_set_vol_dolby(int ch, float fl, float fr,
 	float c, float sl, float sr);
 
+/**
+ * @brief Ramp channel volume to the specified values.
+ * 
+ * Configure the channel volume like #mixer_ch_set_vol, but reach the new
+ * volumes linearly over the specified number of output samples, starting
+ * from the current ones. The ramp is applied by the RSP while mixing, so it
+ * does not need to be driven by calling #mixer_ch_set_vol more often, and
+ * it continues across #mixer_poll calls until it is complete. This is
+ * useful to implement fade-ins and fade-outs.
+ * 
+ * The ramp is evaluated with a resolution of a few output samples, and the
+ * result is smoothed by the mixer volume filter. Calling #mixer_ch_set_vol
+ * (or one of its variants) cancels any ramp in progress.
+ * 
+ * @param[in]   ch              Channel index
+ * @param[in]   lvol            Final left volume (range [0..1])
+ * @param[in]   rvol            Final right volume (range [0..1])
+ * @param[in]   samples         Duration of the ramp (in output samples)
+ */
+void mixer_ch_set_vol_ramp(int ch, float lvol, float rvol, int samples);
+
 /**
  * @brief Start playing the specified waveform on the specified channel.
  * 
@@ -181,7 +225,10 @@ void mixer_ch_set_vol_dolby(int ch, float fl, float fr,
  * two channels to play it back. "ch" will be used for the left samples,
  * while "ch+1" will be used for the right samples. After this, it is
  * forbidden to call mixer functions on "ch+1" until the stereo
- * waveform is stopped.
+ * waveform is stopped. The waveform is read and resampled as a single
+ * interleaved stream on "ch", and the sample buffer memory of "ch+1" is
+ * also used for it, so that stereo waveforms are buffered as long as
+ * mono ones.
  * 
  * If the same waveform (same pointer) was already being played or was the
  * last one that was played on this channel, the channel sample buffer
@@ -206,6 +253,18 @@ void mixer_ch_play(int ch, waveform_t *wave);
  */
 void mixer_ch_set_freq(int ch, float frequency);
 
+/**
+ * @brief Change the frequency for the specified channel, in fixed point.
+ *
+ * This is the same as #mixer_ch_set_freq, with the frequency in 32.32 fixed
+ * point, so that no floating point math is needed (eg: when the pitch is
+ * computed by integer code, like a tracker).
+ *
+ * @param[in]   ch              Channel index
+ * @param[in]   frequency       Playback frequency (in Hz / samples per second)
+ */
+void mixer_ch_set_freq_fx(int ch, fx32_t frequency);
+
 /** 
  * @brief Change the current playback position within a waveform. 
  * 
@@ -238,6 +297,65 @@ void mixer_ch_stop(int ch);
 /** @brief  Return true if the channel is currently playing samples. */
 bool mixer_ch_playing(int ch);
 
+/**
+ * @brief Pause playback on the specified channel, with a fade-out.
+ * 
+ * The channel volume is ramped down to silence over the specified number of
+ * output samples, after which the channel stops being mixed (and its
+ * waveform stops being read), but keeps its current position. Use
+ * #mixer_ch_resume to restart playback from there. A paused channel is
+ * still considered playing (see #mixer_ch_playing).
+ * 
+ * The fade is applied by the RSP while mixing (see #mixer_ch_set_vol_ramp),
+ * on top of the channel volume.
+ * 
+ * @param[in]   ch              Channel index
+ * @param[in]   fade_samples    Duration of the fade-out (in output samples, 0 for none)
+ */
+void mixer_ch_pause(int ch, int fade_samples);
+
+/**
+ * @brief Resume playback on a paused channel, with a fade-in.
+ * 
+ * Playback restarts from the position at which the channel was paused,
+ * ramping the volume up from silence over the specified number of output
+ * samples. If the channel is still fading out, the fade-in starts from
+ * the current level instead.
+ * 
+ * @param[in]   ch              Channel index
+ * @param[in]   fade_samples    Duration of the fade-in (in output samples, 0 for none)
+ */
+void mixer_ch_resume(int ch, int fade_samples);
+
+/** @brief Return true if the channel is paused or fading out to pause (see #mixer_ch_pause). */
+bool mixer_ch_paused(int ch);
+
+/** @brief Resampling quality of a mixer channel (see #mixer_ch_set_quality) */
+typedef enum {
+	MIXER_QUALITY_DEFAULT = 0,      ///< Nearest sample (fastest)
+	MIXER_QUALITY_HIGH,             ///< 4-tap cubic interpolation
+} mixer_quality_t;
+
+/**
+ * @brief Configure the resampling quality of a channel.
+ *
+ * By default, the mixer resamples each channel by picking the nearest input
+ * sample for each output sample. This is very fast, but causes audible aliasing
+ * when a waveform is played at a frequency very different from its original
+ * one (eg: instruments in music modules pitched over several octaves).
+ *
+ * #MIXER_QUALITY_HIGH computes each output sample with a cubic interpolation
+ * of the 4 input samples around the current position. This removes most of the
+ * aliasing, but it is about 4-5 times slower to resample than the default
+ * (see rsp_mixer.S for the cycle counts), so it is better to enable it only
+ * on the channels that need it. It is currently only implemented for mono
+ * waveforms: the setting is ignored while playing a stereo waveform.
+ *
+ * @param[in]   ch              Channel index
+ * @param[in]   quality         Resampling quality
+ */
+void mixer_ch_set_quality(int ch, mixer_quality_t quality);
+
 /**
  * @brief Configure the limits of a channel with respect to sample bit size, and
  *        frequency.
@@ -283,6 +401,193 @@ bool mixer_ch_playing(int ch);
  */
 void mixer_ch_set_limits(int ch, int max_bits, float max_frequency, int max_buf_sz);
 
+/**
+ * @brief Configure how many bytes of a waveform are read ahead of playback.
+ * 
+ * Normally, the samples required by the channel are read synchronously during
+ * #mixer_poll, as soon as they are needed. If the waveform is streamed from a
+ * slow medium, this directly delays the mixer. By configuring a read-ahead,
+ * the mixer requests the samples that will be needed by the next polls in
+ * advance, and waveforms that support it (eg: uncompressed WAV64 files) will
+ * read them asynchronously via PI DMA, while the game continues running.
+ * 
+ * The sample buffer of the channel is enlarged by the specified size, to make
+ * space for the samples read ahead (the enlargement still honors the maximum
+ * size configured via #mixer_ch_set_limits). A good starting point is the
+ * number of bytes played by the channel during a single call to mixer_poll.
+ * 
+ * Asynchronous reads are only performed when mixer_poll is called with
+ * interrupts enabled, as their completion is notified by an interrupt.
+ * 
+ * @param[in]   ch              Channel index
+ * @param[in]   nbytes          Number of bytes to read ahead (0 to disable,
+ *                              which is the default).
+ */
+void mixer_ch_set_readahead(int ch, int nbytes);
+
+/**
+ * @brief Handle of a voice started via #mixer_voice_play.
+ * 
+ * A handle becomes invalid when the voice finishes playing, is stopped, or
+ * its channel is stolen by another voice. The value 0 is never a valid handle.
+ */
+typedef uint32_t mixer_voice_t;
+
+/**
+ * @brief Configure the channels used as voice pool.
+ * 
+ * The voice pool allows to play waveforms without choosing a channel: each
+ * call to #mixer_voice_play picks a free channel of the pool. This is useful
+ * for one-shot sound effects. The channels of the pool should not be used
+ * directly via mixer_ch_play, but they can be configured as usual (eg: volume,
+ * frequency) through the channel returned by #mixer_voice_ch.
+ * 
+ * @param[in]   first_ch        First channel of the pool
+ * @param[in]   num_ch          Number of channels in the pool (0 to disable it)
+ */
+void mixer_voices_init(int first_ch, int num_ch);
+
+/**
+ * @brief Play a waveform on a channel of the voice pool.
+ * 
+ * The waveform is started on the first free channel of the pool (two
+ * consecutive ones for stereo waveforms). If all the channels are busy,
+ * the voice with the lowest priority is stolen (the oldest one, among voices
+ * with the same priority), as long as its priority is not higher than the
+ * requested one. Otherwise, the waveform is not played.
+ * 
+ * Finding a free channel takes constant time. Stealing requires a scan of the
+ * pool, so it is only done when the pool is full.
+ * 
+ * @param[in]   wave            Waveform to play
+ * @param[in]   priority        Priority of the voice (higher values are more
+ *                              important)
+ * @return                      Handle of the voice, or 0 if the waveform
+ *                              could not be played.
+ */
+mixer_voice_t mixer_voice_play(waveform_t *wave, int priority);
+
+/**
+ * @brief Get the channel of a voice.
+ * 
+ * This can be used to configure the voice (eg: via #mixer_ch_set_vol).
+ * 
+ * @param[in]   voice           Handle of the voice
+ * @return                      Channel index, or -1 if the voice is
+ *                              not playing anymore.
+ */
+int mixer_voice_ch(mixer_voice_t voice);
+
+/**
+ * @brief Stop a voice.
+ * 
+ * Nothing is done if the voice is not playing anymore.
+ * 
+ * @param[in]   voice           Handle of the voice
+ */
+void mixer_voice_stop(mixer_voice_t voice);
+
+/**
+ * @brief Route a channel to a mixer bus.
+ *
+ * Buses are groups of channels that are mixed together, and to which
+ * effects can be applied (see #mixer_bus_set_lowpass and #mixer_bus_set_reverb).
+ * The output of all the buses is then summed to produce the final output.
+ * By default, all channels are routed to bus 0.
+ *
+ * Each bus in use is mixed by a separate run of the RSP ucode, and its effects
+ * are applied by another ucode (rsp_mixer_fx.S) before being added to the output,
+ * so the processing cost grows with the number of active buses. A bus with
+ * effects is processed even when none of its channels is playing, so that
+ * the reverb tail can fade out.
+ *
+ * @param[in]   ch              Channel index
+ * @param[in]   bus             Bus index (range [0..#MIXER_MAX_BUSES-1])
+ */
+void mixer_ch_set_bus(int ch, int bus);
+
+/**
+ * @brief Configure a lowpass filter on a mixer bus.
+ *
+ * The filter is a one-pole lowpass (6 dB/octave) applied to the mix of
+ * all the channels of the bus. It is applied before the reverb (if any).
+ *
+ * @param[in]   bus             Bus index
+ * @param[in]   cutoff          Cutoff frequency in Hz, or 0 to disable the filter
+ */
+void mixer_bus_set_lowpass(int bus, float cutoff);
+
+/**
+ * @brief Configure a reverb on a mixer bus.
+ *
+ * This is a simple Schroeder reverb (a comb filter followed by an allpass
+ * filter), whose output is added to the mix of the bus. The delay lines
+ * are allocated when the reverb is first enabled on a bus, and freed
+ * when it is disabled.
+ *
+ * @param[in]   bus             Bus index
+ * @param[in]   feedback        Feedback of the comb filter (range [0..1)),
+ *                              that controls the length of the reverb tail
+ * @param[in]   wet             Level of the reverb output (range [0..1]),
+ *                              or 0 to disable the reverb
+ */
+void mixer_bus_set_reverb(int bus, float feedback, float wet);
+
+/**
+ * @brief Listener of the positional audio (see #mixer_3d_update).
+ * 
+ * All the vectors are in world units, in any right-handed coordinate system.
+ * The forward and up directions must be normalized and perpendicular.
+ */
+typedef struct {
+	float pos[3];             ///< Position of the listener
+	float vel[3];             ///< Velocity of the listener (units per second)
+	float forward[3];         ///< Direction the listener is facing
+	float up[3];              ///< Up direction of the listener
+	float speed_of_sound;     ///< Speed of sound (units per second), or 0 to disable doppler
+	bool surround;            ///< Encode the direction with Dolby Pro Logic II (see #mixer_ch_set_vol_dolby)
+} mixer_3d_listener_t;
+
+/**
+ * @brief An emitter of the positional audio, played by a mixer channel
+ * (see #mixer_3d_update).
+ */
+typedef struct {
+	int ch;                   ///< Channel playing the emitter (-1 to skip this emitter)
+	float pos[3];             ///< Position of the emitter
+	float vel[3];             ///< Velocity of the emitter (units per second)
+	float vol;                ///< Volume of the emitter at min_dist or closer (range [0..1])
+	float min_dist;           ///< Distance within which the volume is not attenuated (must be > 0)
+	float max_dist;           ///< Distance after which the volume is not attenuated any further
+	float rolloff;            ///< Attenuation factor (1 is the physical inverse distance law)
+	float frequency;          ///< Playback frequency before doppler (Hz), or 0 to leave the frequency unchanged
+} mixer_3d_emitter_t;
+
+/**
+ * @brief Update the positional audio of a batch of channels.
+ * 
+ * For each emitter, the volumes of its channel are calculated from the
+ * position of the emitter relative to the listener: the volume is attenuated
+ * with the distance (the inverse distance law, clamped to [min_dist, max_dist]),
+ * and the direction is encoded as a stereo panning, or with Dolby Pro Logic II
+ * if requested by the listener. If the emitter specifies a frequency, the
+ * playback frequency of the channel is also changed to apply the doppler
+ * effect caused by the velocities of the emitter and the listener.
+ * 
+ * This is meant to be called once per frame with all the emitters, and it
+ * is much faster than configuring each channel via #mixer_ch_set_vol_pan
+ * and #mixer_ch_set_freq, as the calculations are shared across emitters
+ * and write the channel state directly. Like #mixer_ch_set_freq, this must
+ * be called after #mixer_ch_play, which resets the frequency of the channel.
+ * The volume set by this function replaces any volume ramp in progress.
+ * 
+ * @param[in]   listener        Listener
+ * @param[in]   emitters        Array of emitters
+ * @param[in]   num_emitters    Number of emitters
+ */
+void mixer_3d_update(const mixer_3d_listener_t *listener,
+	const mixer_3d_emitter_t *emitters, int num_emitters);
+
 /**
  * @brief Run the mixer to produce output samples.
  * 
@@ -305,6 +610,42 @@ void mixer_ch_set_limits(int ch, int max_bits, float max_frequency, int max_buf_
  */
 void mixer_poll(int16_t *out, int nsamples);
 
+/**
+ * @brief Enable the managed mode, in which the mixer feeds the audio output by itself.
+ * 
+ * Normally, the application must call #mixer_poll often enough to keep the
+ * audio buffers filled: a long frame can starve them, causing an audible gap.
+ * In managed mode, the mixer is run directly by the AI interrupt, in the RSP
+ * highpri queue, every time the number of queued audio buffers drops below the
+ * target needed to cover the specified latency.
+ * 
+ * Higher latencies make underruns less likely (for instance, when interrupts
+ * are disabled for a long time), at the cost of a longer delay before a
+ * change to the mixer (eg: starting a sound effect) can be heard. The
+ * granularity of the latency is the length of an audio buffer, which can be
+ * configured with #audio_set_buffer_length; the latency cannot exceed the
+ * number of buffers allocated by #audio_init.
+ * 
+ * In managed mode:
+ * 
+ *  * #mixer_poll must not be called by the application.
+ *  * Waveform read callbacks and mixer events (see #mixer_add_event) run in
+ *    interrupt context.
+ *  * Mixing is skipped (and retried at the next interrupt) if the main thread
+ *    is in highpri mode or recording a rspq block at the time of the interrupt.
+ *  * Changes to the mixer from the main thread that span multiple calls
+ *    (eg: configuring and starting a channel) should be done with interrupts
+ *    disabled, so that they are applied atomically.
+ * 
+ * The managed mode is only supported when audio is fed through
+ * #audio_write_begin / #audio_write_end (so not together with
+ * #audio_set_buffer_callback).
+ * 
+ * @param[in]   latency_ms      Target latency in milliseconds, or 0 to
+ *                              disable the managed mode.
+ */
+void mixer_set_managed(int latency_ms);
+
 /**
  * @brief Callback invoked by mixer_poll at a specified time
  * 
@@ -314,6 +655,13 @@ void mixer_poll(int16_t *out, int nsamples);
  * status after a certain number of samples, or effects like volume envelopes
  * that must update the channel volumes at regular intervals.
  *
+ * Events are sample-accurate: mixer_poll splits mixing at each event, so the
+ * callback is invoked exactly after the specified number of samples, and
+ * any change it makes to the channels (eg: starting a waveform, or changing
+ * the volume) is applied starting from that sample, irrespective of how many
+ * samples are generated by each call to mixer_poll. Instead, changes done
+ * outside of event callbacks only take effect at the next mixer_poll.
+ *
  * "ctx" is an opaque pointer that provides a context to the callback.
  *
  * If the callback has finished its task, it can return 0 to deregister itself
@@ -335,6 +683,9 @@ typedef int (*MixerEvent)(void* ctx);
  * wait before calling the event callback. "cb" is the event callback. "ctx"
  * is an opaque pointer that will be passed to the callback when invoked.
  * 
+ * Up to 32 events can be registered at the same time. Events that are due
+ * at the same sample are invoked in the order they were registered.
+ * 
  * @param[in]   delay           Number of samples to wait before invoking
  *                              the event.
  * @param[in]   cb              Event callback to invoke
@@ -354,6 +705,47 @@ void mixer_add_event(int64_t delay, MixerEvent cb, void *ctx);
  */
 void mixer_remove_event(MixerEvent cb, void *ctx);
 
+/**
+ * @brief Performance statistics of the mixer (see #mixer_get_stats)
+ * 
+ * These statistics help diagnosing audio glitches. For instance, if
+ * underruns are reported, mixer_poll was not called early enough (or took
+ * too long); if read_misses are reported, a waveform could not generate its
+ * samples in time, and the mixer had to play silence in its place.
+ * 
+ * All times are measured in CPU ticks (see #TICKS_READ). Times spent waiting
+ * for the RSP and in the waveform read callbacks are also included in the
+ * total time spent in mixer_poll.
+ */
+typedef struct {
+	int polls;                  ///< Number of calls to #mixer_poll
+	int64_t samples;            ///< Number of stereo samples generated
+	uint64_t poll_ticks;        ///< Total time spent in #mixer_poll
+	uint32_t poll_ticks_max;    ///< Longest single call to #mixer_poll
+	uint64_t rsp_ticks;         ///< Total time spent waiting for the RSP to mix the channels
+	uint32_t rsp_ticks_max;     ///< Longest single wait for the RSP
+	uint64_t read_ticks;        ///< Total time spent in the waveform read callbacks
+	uint64_t ch_read_ticks[MIXER_MAX_CHANNELS];  ///< Time spent in the waveform read callbacks, per channel
+	int read_misses;            ///< Number of times a channel got less samples than it needed to play
+	int underruns;              ///< Number of times the audio output ran out of samples (see #audio_get_underruns)
+	int managed_skips;          ///< Managed mode: AI interrupts where mixing was skipped because the RSP queue was busy
+} mixer_stats_t;
+
+/**
+ * @brief Get the performance statistics of the mixer
+ * 
+ * Statistics are accumulated since #mixer_init or the last call
+ * to #mixer_reset_stats.
+ * 
+ * @param[out]  stats           Statistics
+ */
+void mixer_get_stats(mixer_stats_t *stats);
+
+/**
+ * @brief Reset the performance statistics of the mixer.
+ */
+void mixer_reset_stats(void);
+
 
 /*********************************************************************
  *
@@ -372,7 +764,8 @@ void mixer_remove_event(MixerEvent cb, void *ctx);
  * samples to read.
  *
  * The read function should push into the provided sample buffer
- * at least *wlen* samples, using #samplebuffer_append. Producing more samples
+ * at least *wlen* samples, using #samplebuffer_append (or
+ * #samplebuffer_append_cached, if they are generated by the CPU). Producing more samples
  * than requested is perfectly fine, they will be stored in the sample buffer
  * and remain available for later use. For instance, a compressed waveform
  * (eg: VADPCM) might decompress samples in blocks of fixed size, and thus
@@ -119,10 +119,13 @@ extern char __rom_end[];
 /** @brief Symbol at the end of code, data, sdata, and bss (set by the linker) */
 extern char __bss_end[];
 
+/** @brief Symbol at the end of bss and of the overlay region (set by the linker) */
+extern char __heap_start[];
+
 /**
  * @brief Void pointer to the start of heap memory
  */
-#define HEAP_START_ADDR ((void*)__bss_end)
+#define HEAP_START_ADDR ((void*)__heap_start)
 
 /**
  * @brief Memory barrier to ensure in-order execution
@@ -213,6 +216,11 @@ inline volatile unsigned long get_ticks_ms(void)
     return TICKS_READ() / (TICKS_PER_SECOND / 1000);
 }
 
+uint64_t get_ticks64(void);
+uint64_t ticks_to_us(uint64_t ticks);
+uint64_t ticks_to_ns(uint64_t ticks);
+uint64_t ticks_from_us(uint64_t us);
+
 void wait_ticks( unsigned long wait );
 void wait_ms( unsigned long wait_ms );
 
@@ -0,0 +1,88 @@
+/**
+ * @file overlay.h
+ * @brief Code overlays
+ * @ingroup lowlevel
+ *
+ * Overlays are modules of code (and their constant and initialized data)
+ * that are not loaded at boot, but only when needed, via #overlay_load. All
+ * the overlays share the same region of RAM (placed after the bss), so only
+ * one of them can be resident at a time, and the memory used by the program
+ * is that of the biggest overlay, rather than that of all of them.
+ *
+ * An overlay is made by all the objects compiled in a directory called
+ * NAME.ovl within the build directory, and must be listed in the
+ * N64_OVERLAYS variable of the Makefile (after including n64.mk):
+ *
+ * @code{.mk}
+ *      include $(N64_INST)/include/n64.mk
+ *      N64_OVERLAYS = level1 level2
+ *
+ *      OBJS = $(BUILD_DIR)/main.o \
+ *             $(BUILD_DIR)/level1.ovl/enemies.o $(BUILD_DIR)/level1.ovl/boss.o \
+ *             $(BUILD_DIR)/level2.ovl/enemies.o
+ * @endcode
+ *
+ * Code outside of an overlay can call functions of the overlay as usual,
+ * after it has been loaded:
+ *
+ * @code{.c}
+ *      overlay_load(level1);
+ *      level1_boss_update();
+ * @endcode
+ *
+ * Some limitations apply to the code in an overlay:
+ *
+ *  * Its uninitialized data (bss) and small data are not part of the
+ *    overlay, and are always resident. Its initialized data instead is
+ *    reloaded with the overlay, so it is reset to the initial values.
+ *  * It must not contain global constructors or C++ exceptions.
+ *  * Pointers to its functions and data become invalid when another overlay
+ *    is loaded. The code in an overlay must not load another overlay.
+ *  * Backtraces and symbols refer to the overlays by the address where they
+ *    are run, which is shared: the symbolizer might show a function of a
+ *    different overlay.
+ */
+#ifndef __LIBDRAGON_OVERLAY_H
+#define __LIBDRAGON_OVERLAY_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @cond */
+void __overlay_load(const char *name, void *load_start, void *load_stop);
+bool __overlay_is_loaded(void *load_start);
+/** @endcond */
+
+/**
+ * @brief Load an overlay from ROM, if it is not loaded already
+ *
+ * The overlay that was previously loaded is discarded. The function blocks
+ * until the overlay is loaded via PI DMA. It must not be called from code
+ * within an overlay.
+ *
+ * @param name      Name of the overlay (as listed in N64_OVERLAYS, not a string)
+ */
+#define overlay_load(name) ({ \
+    extern char __load_start_ovl_##name[], __load_stop_ovl_##name[]; \
+    __overlay_load(#name, __load_start_ovl_##name, __load_stop_ovl_##name); \
+})
+
+/**
+ * @brief Check whether an overlay is currently loaded
+ *
+ * @param name      Name of the overlay (as listed in N64_OVERLAYS, not a string)
+ * @return          True if the overlay is loaded
+ */
+#define overlay_is_loaded(name) ({ \
+    extern char __load_start_ovl_##name[]; \
+    __overlay_is_loaded(__load_start_ovl_##name); \
+})
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+/**
+ * @file prof_zone.h
+ * @brief Timeline profiler
+ * @ingroup prof_zone
+ */
+#ifndef __LIBDRAGON_PROF_ZONE_H
+#define __LIBDRAGON_PROF_ZONE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Maximum nesting level of zones */
+#define PROF_ZONE_MAX_DEPTH         16
+
+/** @brief Magic of the messages sent by #prof_zone_flush ("ZONE") */
+#define PROF_ZONE_MAGIC             0x5A4F4E45
+/** @brief Version of the messages sent by #prof_zone_flush */
+#define PROF_ZONE_VERSION           1
+
+/** @brief Tracks of the timeline, one per processor */
+typedef enum {
+    PROF_TRACK_CPU = 0,         ///< Code running on the CPU
+    PROF_TRACK_RSP = 1,         ///< Events of the RSP (eg: syncpoints reached)
+    PROF_TRACK_RDP = 2,         ///< Events of the RDP (eg: SYNC_FULL completed)
+} prof_track_t;
+
+/** @brief Types of events recorded in the timeline */
+typedef enum {
+    PROF_EVENT_BEGIN = 0,       ///< Start of a zone (#prof_zone_begin)
+    PROF_EVENT_END = 1,         ///< End of a zone (#prof_zone_end)
+    PROF_EVENT_MARK = 2,        ///< Instant event (#prof_zone_mark)
+    PROF_EVENT_FRAME = 3,       ///< Frame boundary (#prof_zone_frame)
+} prof_event_type_t;
+
+/**
+ * @brief Statistics of the timeline profiler (see #prof_zone_get_stats)
+ */
+typedef struct {
+    uint32_t events;            ///< Number of events recorded
+    uint32_t dropped;           ///< Number of events lost because the buffer was full
+    uint32_t buffered;          ///< Events currently in the buffer, waiting for #prof_zone_flush
+} prof_zone_stats_t;
+
+/* initialize the timeline profiler */
+void prof_zone_init(int capacity);
+/* close the timeline profiler and free the buffers */
+void prof_zone_close(void);
+/* begin a zone on the CPU track */
+void prof_zone_begin(const char *name);
+/* end the innermost zone on the CPU track */
+void prof_zone_end(void);
+/* record an instant event on a track */
+void prof_zone_mark(prof_track_t track, const char *name);
+/* record the boundary between two frames */
+void prof_zone_frame(void);
+/* send the events recorded so far via USB */
+void prof_zone_flush(void);
+/* get the statistics of the timeline profiler */
+void prof_zone_get_stats(prof_zone_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,6 +8,7 @@
 
 #include "display.h"
 #include "graphics.h"
+#include "fixed.h"
 
 /**
  * @addtogroup rdp
@@ -44,6 +45,19 @@ typedef enum
     SYNC_TILE
 } sync_t;
 
+/**
+ * @brief Automatic sync modes (see #rdp_set_autosync)
+ */
+typedef enum
+{
+    /** @brief Insert the required syncs automatically, and skip redundant #rdp_sync calls */
+    RDP_AUTOSYNC_ON,
+    /** @brief Send only the syncs requested with #rdp_sync */
+    RDP_AUTOSYNC_OFF,
+    /** @brief Like #RDP_AUTOSYNC_OFF, but assert when a required sync is missing */
+    RDP_AUTOSYNC_VERIFY
+} rdp_autosync_t;
+
 /**
  * @brief Caching strategy for loaded textures
  */
@@ -55,6 +69,30 @@ typedef enum
     FLUSH_STRATEGY_AUTOMATIC
 } flush_t;
 
+/**
+ * @brief A tile of a spritemap to draw with #rdp_draw_sprites_batch
+ */
+typedef struct
+{
+    /** @brief Offset of the slice of the spritemap (see #rdp_load_texture_stride) */
+    int tile;
+    /** @brief The pixel X location of the top left of the tile */
+    int x;
+    /** @brief The pixel Y location of the top left of the tile */
+    int y;
+} rdp_sprite_tile_t;
+
+/**
+ * @brief Statistics of the TMEM residency cache (see #rdp_get_texture_stats)
+ */
+typedef struct
+{
+    /** @brief Number of texture loads skipped because the texture was resident */
+    uint32_t hits;
+    /** @brief Number of texture loads sent to the RDP */
+    uint32_t misses;
+} rdp_texture_stats_t;
+
 /** @} */
 
 #ifdef __cplusplus
@@ -64,7 +102,9 @@ extern "C" {
 void rdp_init( void );
 void rdp_attach( surface_t* disp );
 void rdp_detach( void );
+void rdp_detach_async( void (*cb)(void *arg), void *arg );
 void rdp_sync( sync_t sync );
+void rdp_set_autosync( rdp_autosync_t mode );
 void rdp_set_clipping( uint32_t tx, uint32_t ty, uint32_t bx, uint32_t by );
 void rdp_set_default_clipping( void );
 void rdp_enable_primitive_fill( void );
@@ -76,11 +116,21 @@ void rdp_draw_textured_rectangle( uint32_t texslot, int tx, int ty, int bx, int
 void rdp_draw_textured_rectangle_scaled( uint32_t texslot, int tx, int ty, int bx, int by, double x_scale, double y_scale,  mirror_t mirror );
 void rdp_draw_sprite( uint32_t texslot, int x, int y ,  mirror_t mirror);
 void rdp_draw_sprite_scaled( uint32_t texslot, int x, int y, double x_scale, double y_scale,  mirror_t mirror);
+void rdp_draw_textured_rectangle_scaled_fx( uint32_t texslot, int tx, int ty, int bx, int by, fx16_t x_scale, fx16_t y_scale, mirror_t mirror );
+void rdp_draw_sprite_scaled_fx( uint32_t texslot, int x, int y, fx16_t x_scale, fx16_t y_scale, mirror_t mirror );
+void rdp_draw_surface( int x, int y, surface_t *src );
+void rdp_draw_surface_region( int x, int y, surface_t *src, int sx, int sy, int width, int height );
+void rdp_clear_surface( surface_t *surf, uint32_t color );
+void rdp_draw_sprites_batch( uint32_t texslot, uint32_t texloc, sprite_t *sprite, rdp_sprite_tile_t *tiles, int count, mirror_t mirror );
 void rdp_set_primitive_color( uint32_t color );
 void rdp_set_blend_color( uint32_t color );
 void rdp_draw_filled_rectangle( int tx, int ty, int bx, int by );
 void rdp_draw_filled_triangle( float x1, float y1, float x2, float y2, float x3, float y3 );
+void rdp_draw_filled_triangles( const float *xy, int num_triangles );
 void rdp_set_texture_flush( flush_t flush );
+void rdp_invalidate_texture_cache( void );
+void rdp_get_texture_stats( rdp_texture_stats_t *stats );
+void rdp_reset_texture_stats( void );
 void rdp_close( void );
 
 __attribute__((deprecated("use rdp_attach instead")))
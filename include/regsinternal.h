@@ -130,6 +130,10 @@ typedef struct PI_regs_s {
     uint32_t dom1_latency;
     /** @brief Cartridge domain 1 pulse width in RCP clock cycles. Requires DMA status bit guards to work reliably */
     uint32_t dom1_pulse_width;
+    /** @brief Cartridge domain 1 page size (2^(n+2) bytes). Requires DMA status bit guards to work reliably */
+    uint32_t dom1_page_size;
+    /** @brief Cartridge domain 1 release duration in RCP clock cycles. Requires DMA status bit guards to work reliably */
+    uint32_t dom1_release;
     // TODO: add remaining registers
 } PI_regs_t;
 
@@ -158,6 +158,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include "kernel.h"
+#include "idle.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -509,6 +511,10 @@ void rsp_read_data(void* data, unsigned long size, unsigned int dmem_offset);
  * it is assumed that the RSP has crashed or otherwise stalled and
  * #rsp_crash is invoked to abort the program showing a debugging screen.
  * 
+ * If the multitasking kernel is active, each iteration of the loop calls
+ * #kthread_yield, so that other threads can run while waiting. It also runs
+ * the idle tasks (see #idle_register) with #IDLE_POLL_BUDGET.
+ * 
  * @code{.c}
  *      // This example shows a loop that waits for the RSP to set signal 2
  *      // in the status register. It is just an example on how to use the
@@ -528,7 +534,7 @@ void rsp_read_data(void* data, unsigned long size, unsigned int dmem_offset);
 #define RSP_WAIT_LOOP(timeout_ms) \
     for (uint32_t __t = TICKS_READ() + TICKS_FROM_MS(timeout_ms); \
          TICKS_BEFORE(TICKS_READ(), __t) || (rsp_crashf("wait loop timed out (%d ms)", timeout_ms), false); \
-         __rsp_check_assert(__FILE__, __LINE__, __func__))
+         __rsp_check_assert(__FILE__, __LINE__, __func__), kthread_yield(), idle_run(IDLE_POLL_BUDGET))
 
 static inline __attribute__((deprecated("use rsp_load_code instead")))
 void load_ucode(void * start, unsigned long size) {
@@ -0,0 +1,50 @@
+/**
+ * @file rsp_profile.h
+ * @brief Sampling RSP profiler
+ * @ingroup rsp_profile
+ */
+#ifndef __LIBDRAGON_RSP_PROFILE_H
+#define __LIBDRAGON_RSP_PROFILE_H
+
+#include <stdint.h>
+#include "rsp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Number of instruction slots in IMEM (size of a histogram) */
+#define RSP_PROFILE_IMEM_SLOTS      1024
+
+/** @brief Magic of the sample files sent by #rsp_profile_dump ("RSPP") */
+#define RSP_PROFILE_MAGIC           0x52535050
+/** @brief Version of the sample files sent by #rsp_profile_dump */
+#define RSP_PROFILE_VERSION         1
+
+/**
+ * @brief Statistics of the profiler (see #rsp_profile_get_stats)
+ */
+typedef struct {
+    uint32_t samples;           ///< Number of samples taken while the RSP was running
+    uint32_t idle;              ///< Number of samples taken while the RSP was halted
+    uint32_t dropped;           ///< Number of samples lost because there were too many ucodes
+} rsp_profile_stats_t;
+
+/* start sampling the RSP */
+void rsp_profile_start(int hz, int max_ucodes);
+/* stop sampling the RSP */
+void rsp_profile_stop(void);
+/* send the histograms recorded so far via USB, and clear them */
+void rsp_profile_dump(void);
+/* get the histogram of the samples of a ucode */
+uint32_t rsp_profile_get_histogram(rsp_ucode_t *ucode, uint32_t counts[RSP_PROFILE_IMEM_SLOTS]);
+/* get the statistics of the profiler */
+void rsp_profile_get_stats(rsp_profile_stats_t *stats);
+/* stop sampling and free the histograms */
+void rsp_profile_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
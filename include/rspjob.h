@@ -0,0 +1,89 @@
+/**
+ * @file rspjob.h
+ * @brief Parallel-for jobs on the RSP
+ * @ingroup rsp
+ *
+ * This module runs RSP "kernels" over arrays in RDRAM. A kernel is an
+ * assembly function that processes a tile of elements in DMEM; the DMA
+ * transfers of the tiles (double-buffered, so that they overlap with
+ * the computation) and the rspq command wiring are provided by
+ * rsp_job.inc. Offloading a vectorizable loop is then a matter of
+ * writing its body: see rsp_job.inc for how to write the overlay.
+ *
+ * On the CPU side, register the overlay as usual, describe each kernel
+ * with the size of its elements, and schedule jobs:
+ *
+ * @code{.c}
+ *      DEFINE_RSP_UCODE(rsp_mykernels);
+ *
+ *      uint32_t ovl_id = rspq_overlay_register(&rsp_mykernels);
+ *      rspjob_kernel_t scale;
+ *      rspjob_kernel_init(&scale, ovl_id, 0, sizeof(in[0]), sizeof(out[0]));
+ *
+ *      rspjob_parallel_for(&scale, in, out, num_elements, factor);
+ *      rspq_wait();
+ * @endcode
+ *
+ * Jobs are rspq commands, so they run asynchronously, in order with the
+ * other rspq commands, and can be recorded into rspq blocks. The arrays
+ * are accessed via DMA: the CPU must write back the cache of the input
+ * and invalidate the cache of the output (or use uncached buffers). A
+ * job does not yield to the highpri queue until it is finished.
+ */
+#ifndef __LIBDRAGON_RSPJOB_H
+#define __LIBDRAGON_RSPJOB_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Size in bytes of the DMEM buffers of a tile
+ *
+ * A tile holds as many elements as fit in this size (both for the input
+ * and the output). NOTE: keep in sync with rsp_job.inc.
+ */
+#define RSPJOB_TILE_SIZE        512
+
+/** @brief A kernel of an overlay written with rsp_job.inc */
+typedef struct {
+    uint32_t ovl_id;        ///< ID of the overlay
+    uint8_t index;          ///< Index of the kernel in the overlay
+    uint16_t in_size;       ///< Size of an input element in bytes
+    uint16_t out_size;      ///< Size of an output element in bytes
+    uint16_t tile;          ///< Number of elements per tile
+} rspjob_kernel_t;
+
+/**
+ * @brief Describe a kernel
+ *
+ * The element sizes are the DMEM working set of the kernel for each
+ * element. Either of them can be zero, for kernels that have no input
+ * (eg: generators) or no output arrays.
+ *
+ * @param kernel        Kernel to initialize
+ * @param ovl_id        ID of the overlay (returned by #rspq_overlay_register)
+ * @param index         Index of the kernel in the table of the overlay
+ * @param in_size       Size of an input element (multiple of 8)
+ * @param out_size      Size of an output element (multiple of 8)
+ */
+void rspjob_kernel_init(rspjob_kernel_t *kernel, uint32_t ovl_id, int index, int in_size, int out_size);
+
+/**
+ * @brief Run a kernel over the elements of an array
+ *
+ * @param kernel        Kernel to run
+ * @param in            Input array (8-byte aligned), or NULL if the kernel has no input
+ * @param out           Output array (8-byte aligned), or NULL if the kernel has no output
+ * @param count         Number of elements
+ * @param arg           Argument passed to the kernel (in a3)
+ */
+void rspjob_parallel_for(const rspjob_kernel_t *kernel, const void *in, void *out, int count, uint32_t arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
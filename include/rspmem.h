@@ -0,0 +1,87 @@
+/**
+ * @file rspmem.h
+ * @brief Bulk memory copy and fill on the RSP
+ * @ingroup rsp
+ *
+ * This module copies and fills RDRAM buffers using the RSP DMA engine,
+ * as an asynchronous replacement for big memcpy and memset calls (eg: to
+ * clear or duplicate a framebuffer, or to move decompressed data). The
+ * CPU does not touch the data, so it is free to do other work meanwhile,
+ * and its data cache is not trashed by the transfer.
+ *
+ * The functions enqueue rspq commands, so they return immediately, and
+ * the operation runs in order with the other rspq commands. To know when
+ * it is finished, use a syncpoint:
+ *
+ * @code{.c}
+ *      rspmem_copy(dst, src, size);
+ *      rspq_syncpoint_t sync = rspq_syncpoint_new();
+ *
+ *      // ... do other work ...
+ *
+ *      rspq_syncpoint_wait(sync);
+ *      // dst can now be used
+ * @endcode
+ *
+ * Cache coherency is taken care of when the command is enqueued: the
+ * source buffer is written back from the data cache, and the destination
+ * buffer is invalidated. This means that:
+ *
+ *  * The CPU must not write the source (via cached pointers) until the
+ *    operation is finished, as the RSP could read stale data.
+ *  * The CPU must not access the destination until the operation is
+ *    finished, or stale data could end up in the data cache.
+ *  * Cached destination buffers must be 16-byte aligned and have a size
+ *    multiple of 16, so that they do not share cachelines with other data.
+ *  * Commands recorded in a rspq block only do this when recorded, so the
+ *    caller is responsible for coherency when the block is run.
+ *
+ * All addresses and sizes must be multiples of 8 (a requirement of the
+ * RSP DMA engine). Long operations yield to the highpri queue while they
+ * are running.
+ */
+#ifndef __LIBDRAGON_RSPMEM_H
+#define __LIBDRAGON_RSPMEM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Copy a buffer in RDRAM, using the RSP
+ *
+ * The buffers must not overlap.
+ *
+ * @param dst       Destination buffer (8-byte aligned)
+ * @param src       Source buffer (8-byte aligned)
+ * @param size      Number of bytes to copy (multiple of 8)
+ */
+void rspmem_copy(void *dst, const void *src, int size);
+
+/**
+ * @brief Fill a buffer in RDRAM with a byte, using the RSP
+ *
+ * @param dst       Destination buffer (8-byte aligned)
+ * @param value     Value of each byte
+ * @param size      Number of bytes to fill (multiple of 8)
+ */
+void rspmem_fill(void *dst, uint8_t value, int size);
+
+/**
+ * @brief Fill a buffer in RDRAM with a 32-bit pattern, using the RSP
+ *
+ * This can be used to clear a 16-bit or 32-bit surface to a color.
+ *
+ * @param dst       Destination buffer (8-byte aligned)
+ * @param pattern   Pattern to repeat
+ * @param size      Number of bytes to fill (multiple of 8)
+ */
+void rspmem_fill32(void *dst, uint32_t pattern, int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -137,6 +137,44 @@
  * This feature should normally not be used by end-users, but by libraries
  * in which a very low latency of RSP execution is paramount to their workings.
  * 
+ * ## Profiling
+ * 
+ * When #RSPQ_PROFILE is enabled in rspq_constants.h, the RSP queue engine
+ * measures the RCP cycles spent executing each command, and sends them to
+ * the CPU through a RDRAM ring buffer. Call #rspq_profile_start to begin
+ * collecting data, #rspq_profile_next_frame once per frame, and later
+ * #rspq_profile_get_data or #rspq_profile_dump to inspect the results,
+ * which are grouped by command ID (overlay + command index).
+ * 
+ * Profiling adds a small overhead to each command, so it is disabled by
+ * default and should be activated only while investigating RSP performance.
+ * 
+ * ## Capture and replay
+ * 
+ * To measure the effect of a change to the RSP ucodes or to the RDP setup,
+ * the same workload must be run before and after it. #rspq_capture_start
+ * records the commands written to the lowpri queue by the running game,
+ * frame by frame (see #rspq_capture_next_frame). Each captured frame can then
+ * be resubmitted with #rspq_capture_replay, which measures how long the RSP
+ * takes to run it:
+ * 
+ * @code{.c}
+ *      rspq_capture_t *cap = rspq_capture_start(256*1024);
+ *      for (int i = 0; i < 60; i++) {
+ *          render_frame();
+ *          rspq_capture_next_frame();
+ *      }
+ *      rspq_capture_stop();
+ * 
+ *      for (int i = 0; i < rspq_capture_get_frame_count(cap); i++)
+ *          debugf("frame %d: %lu ticks\n", i, rspq_capture_replay(cap, i));
+ * @endcode
+ * 
+ * The commands refer to RDRAM by address (eg: textures, framebuffers, blocks),
+ * so a capture can only be replayed by the same ROM while that memory is
+ * still valid. #rspq_capture_save writes a capture to a file (eg: on the SD
+ * card, see #debug_init_sdfs) for offline inspection.
+ * 
  */
 
 #ifndef __LIBDRAGON_RSPQ_H
@@ -144,6 +182,7 @@
 
 #include <stdint.h>
 #include <rsp.h>
+#include <n64sys.h>
 #include <pputils.h>
 
 #ifdef __cplusplus
@@ -173,6 +212,31 @@ extern "C" {
  */
 typedef struct rspq_block_s rspq_block_t;
 
+/**
+ * @brief A memory arena for blocks.
+ * 
+ * An arena is a pool of memory where blocks can be allocated via
+ * #rspq_block_begin_arena. All blocks allocated in an arena are released at
+ * once via #rspq_block_arena_reset, which avoids heap fragmentation when
+ * many blocks are created and destroyed together (eg: on level load).
+ */
+typedef struct rspq_block_arena_s rspq_block_arena_t;
+
+/**
+ * @brief A reference to a command within a block, that can be patched
+ *        after the block has been created (see #rspq_block_param).
+ */
+typedef struct {
+    volatile uint32_t *cmd;   ///< Pointer to the first word of the command in the block
+} rspq_block_param_t;
+
+/** @brief Memory statistics of a block (see #rspq_block_get_stats) */
+typedef struct {
+    int chunks;             ///< Number of chunks (contiguous buffers) the block is made of
+    int bytes_used;         ///< Bytes used by commands, including the chunk terminators
+    int bytes_wasted;       ///< Bytes allocated but left unused at the end of the chunks
+} rspq_block_stats_t;
+
 /**
  * @brief A syncpoint in the queue
  * 
@@ -193,6 +257,48 @@ typedef struct rspq_block_s rspq_block_t;
  */
 typedef int rspq_syncpoint_t;
 
+/** @brief Overlay switch statistics (see #rspq_overlay_get_stats) */
+typedef struct {
+    uint32_t switches;            ///< Number of overlay switches performed by the RSP
+    uint32_t bytes;               ///< Bytes transferred by DMA to perform the switches (code, data and state)
+} rspq_overlay_stats_t;
+
+/** @brief Number of command IDs tracked by the profiler (one per possible command ID) */
+#define RSPQ_PROFILE_CMD_COUNT         256
+
+/** @brief Profile data of a single command ID (see #rspq_profile_get_data) */
+typedef struct {
+    uint64_t total_cycles;        ///< Total RCP cycles spent executing the command
+    uint32_t calls;               ///< Number of times the command was executed
+    const char *overlay_name;     ///< Name of the overlay the command belongs to
+    uint16_t overlay_cmd_index;   ///< Index of the command within the overlay
+} rspq_profile_cmd_t;
+
+/** @brief Profile data collected by the RSP queue (see #rspq_profile_get_data) */
+typedef struct {
+    rspq_profile_cmd_t commands[RSPQ_PROFILE_CMD_COUNT];  ///< Per-command data, indexed by command ID
+    uint64_t total_cycles;        ///< Total RCP cycles accounted to all commands
+    uint32_t frame_count;         ///< Number of calls to #rspq_profile_next_frame since the last reset
+    uint32_t dropped_samples;     ///< Number of samples lost because they were not read in time
+} rspq_profile_data_t;
+
+/** @brief Configuration of the RSPQ library (see #rspq_init_ex) */
+typedef struct {
+    int lowpri_buffer_size;       ///< Size of each of the two lowpri buffers, in 32-bit words (0: #RSPQ_DRAM_LOWPRI_BUFFER_SIZE)
+    int highpri_buffer_size;      ///< Size of each of the two highpri buffers, in 32-bit words (0: #RSPQ_DRAM_HIGHPRI_BUFFER_SIZE)
+} rspq_config_t;
+
+/** @brief A capture of the lowpri command stream (see #rspq_capture_start) */
+typedef struct rspq_capture_s rspq_capture_t;
+
+/** @brief Buffer switch statistics (see #rspq_buffer_get_stats) */
+typedef struct {
+    uint32_t switches;            ///< Number of buffer switches
+    uint32_t stalls;              ///< Number of switches in which the CPU waited for the RSP to release the buffer
+    uint64_t stall_ticks;         ///< Total CPU ticks spent waiting (see #TICKS_READ)
+    uint32_t stall_max;           ///< Longest wait, in CPU ticks
+} rspq_buffer_stats_t;
+
 /**
  * @brief Initialize the RSPQ library.
  * 
@@ -205,6 +311,22 @@ typedef int rspq_syncpoint_t;
  */
 void rspq_init(void);
 
+/**
+ * @brief Initialize the RSPQ library, with the specified configuration.
+ * 
+ * The queue is double buffered: while the RSP runs the commands in one buffer,
+ * the CPU writes into the other. When the CPU fills a buffer before the RSP is
+ * done with the other one, it has to wait (see #rspq_buffer_get_stats). Larger
+ * buffers absorb longer bursts of commands, at the cost of RDRAM (two buffers
+ * per queue).
+ * 
+ * This must be called before any other library initializes the RSPQ library
+ * (eg: #rdp_init), as later calls do nothing, like for #rspq_init.
+ * 
+ * @param[in]  config   Configuration (NULL for the defaults)
+ */
+void rspq_init_ex(const rspq_config_t *config);
+
 /**
  * @brief Shut down the RSPQ library.
  * 
@@ -282,6 +404,28 @@ void rspq_overlay_register_static(rsp_ucode_t *overlay_ucode, uint32_t overlay_i
  */
 void rspq_overlay_unregister(uint32_t overlay_id);
 
+/**
+ * @brief Replace the ucode of a registered overlay, keeping its ID.
+ *
+ * This is meant for development: a new build of an overlay (eg: received
+ * via USB) can be swapped in at runtime, without reflashing the ROM. The
+ * commands written after this call run the new ucode. The overlay ID
+ * stays the same, so that the CPU code talking to it needs no change.
+ *
+ * The saved state is carried over to the new ucode if its size did not
+ * change; otherwise, the new ucode starts from its initial state. The new
+ * overlay must not have more commands than the one it replaces, and must be
+ * built against the same version of rsp_queue.inc.
+ *
+ * The function waits for the RSP to be idle, so it is slow, and it cannot
+ * be called in highpri mode or while recording a block. The buffers of
+ * the new ucode must stay valid until the overlay is unregistered.
+ *
+ * @param      overlay_id     The ID of the overlay (as returned by #rspq_overlay_register)
+ * @param      overlay_ucode  The new ucode of the overlay
+ */
+void rspq_overlay_reload(uint32_t overlay_id, rsp_ucode_t *overlay_ucode);
+
 /**
  * @brief Return a pointer to the overlay state (in RDRAM)
  * 
@@ -299,6 +443,40 @@ void rspq_overlay_unregister(uint32_t overlay_id);
  */
 void* rspq_overlay_get_state(rsp_ucode_t *overlay_ucode);
 
+/**
+ * @brief Collect the overlay switch statistics for the current frame
+ * 
+ * Every time the RSP executes a command of an overlay that is not the currently
+ * loaded one, it must save the current overlay's state into RDRAM and load
+ * the code and data of the new overlay. This is a relatively expensive
+ * operation: if the command stream keeps alternating between overlays,
+ * a noticeable part of the RSP time might be spent doing it.
+ * 
+ * The RSP keeps count of the switches and of the number of bytes transferred
+ * for them. This function enqueues commands that publish the counters
+ * accumulated so far (readable via #rspq_overlay_get_stats once the RSP
+ * has processed them) and reset them. Call it once per frame to get per-frame
+ * statistics.
+ * 
+ * Notice that internal commands (eg: those used to run blocks or syncpoints)
+ * never require an overlay switch.
+ * 
+ * @see #rspq_overlay_get_stats
+ */
+void rspq_overlay_stats_next_frame(void);
+
+/**
+ * @brief Get the overlay switch statistics of the last frame
+ * 
+ * This function returns the statistics published by the RSP at the last
+ * call to #rspq_overlay_stats_next_frame. It never blocks: if the RSP has
+ * not yet reached that point of the queue, the statistics of the frame before
+ * are returned.
+ * 
+ * @param[out] stats    Structure that will be filled with the statistics
+ */
+void rspq_overlay_get_stats(rspq_overlay_stats_t *stats);
+
 /**
  * @brief Write a new command into the RSP queue.
  * 
@@ -567,6 +745,31 @@ inline void rspq_write_end(rspq_write_t *w) {
  */
 void rspq_flush(void);
 
+/**
+ * @brief Enqueue a command from interrupt context.
+ * 
+ * #rspq_write can only be used from the main thread. This function can
+ * instead be called also from interrupt handlers (eg: timer callbacks),
+ * and writes the command into a small side queue. The commands in the
+ * side queue are moved into the main queue (in the same order they were
+ * written) by the main thread, at the next call to #rspq_flush or
+ * #rspq_syncpoint_new. This means that the command will not be executed by
+ * the RSP before the main thread flushes the queue.
+ * 
+ * The command is specified like for #rspq_write: the first argument word
+ * is ORed with the command ID (so it must have the top byte set to 0).
+ * 
+ * @param      ovl_id    The overlay ID of the command (preshifted by 28,
+ *                       as returned by #rspq_overlay_register)
+ * @param      cmd_id    The index of the command within the overlay
+ * @param      args      The argument words of the command
+ * @param      nargs     Number of argument words (at most #RSPQ_MAX_SHORT_COMMAND_SIZE)
+ * 
+ * @return     true if the command was enqueued, false if the side queue
+ *             was full (the command is then discarded).
+ */
+bool rspq_isr_write(uint32_t ovl_id, uint32_t cmd_id, const uint32_t *args, int nargs);
+
 /**
  * @brief Wait until all commands in the queue have been executed by RSP.
  *
@@ -632,6 +835,30 @@ bool rspq_syncpoint_check(rspq_syncpoint_t sync_id);
  */
 void rspq_syncpoint_wait(rspq_syncpoint_t sync_id);
 
+/**
+ * @brief Register a callback to be called when a syncpoint is reached.
+ * 
+ * This is an asynchronous alternative to #rspq_syncpoint_wait: instead of
+ * blocking the CPU until the syncpoint is reached, the callback is invoked
+ * by the RSP interrupt handler as soon as the RSP reaches the syncpoint.
+ * It can be used for instance to free buffers or to start the next stage
+ * of a pipeline without stalling the main loop.
+ * 
+ * If the syncpoint was already reached, the callback is invoked immediately
+ * (with interrupts disabled). 
+ * 
+ * @param[in]  sync_id  ID of the syncpoint
+ * @param[in]  cb       Callback to invoke. It runs in interrupt context, so
+ *                      it must be short and cannot wait for other syncpoints.
+ * @param[in]  ctx      Opaque pointer passed to the callback
+ * 
+ * @note At most #RSPQ_MAX_SYNCPOINT_CALLBACKS callbacks can be pending
+ *       at the same time.
+ * 
+ * @see #rspq_syncpoint_t
+ */
+void rspq_syncpoint_on_done(rspq_syncpoint_t sync_id, void (*cb)(void *ctx), void *ctx);
+
 
 /**
  * @brief Begin creating a new block.
@@ -702,6 +929,103 @@ void rspq_block_run(rspq_block_t *block);
  */
 void rspq_block_free(rspq_block_t *block);
 
+/**
+ * @brief Begin creating a new block, allocating it in an arena.
+ * 
+ * This is like #rspq_block_begin, but the memory of the block is allocated
+ * from the specified arena instead of the heap. The block must not be freed
+ * via #rspq_block_free (which does nothing for these blocks): its memory will
+ * be released with all other blocks of the arena by #rspq_block_arena_reset.
+ * 
+ * @param  arena  The arena (or NULL to allocate from the heap)
+ */
+void rspq_block_begin_arena(rspq_block_arena_t *arena);
+
+/**
+ * @brief Create a new arena for blocks.
+ * 
+ * The arena allocates memory in pages of the specified size; more pages are
+ * allocated as needed, and are kept for reuse after a reset. The page size
+ * is increased if it is too small to contain the biggest block chunk.
+ * 
+ * @param  page_size  Size of each page of the arena, in bytes
+ * @return The new arena
+ */
+rspq_block_arena_t* rspq_block_arena_new(int page_size);
+
+/**
+ * @brief Release all the blocks allocated in an arena.
+ * 
+ * After calling this function, all the blocks allocated in the arena are
+ * invalid. The memory is kept by the arena and reused for new blocks.
+ * 
+ * @param  arena  The arena
+ * 
+ * @note Make sure that the RSP is not running any of the blocks of the arena
+ *       (eg: via #rspq_wait or a syncpoint) before resetting it.
+ */
+void rspq_block_arena_reset(rspq_block_arena_t *arena);
+
+/**
+ * @brief Free an arena and all the blocks allocated in it.
+ * 
+ * @param  arena  The arena
+ */
+void rspq_block_arena_free(rspq_block_arena_t *arena);
+
+/**
+ * @brief Mark the next command of the block being created as patchable.
+ * 
+ * This function must be called while creating a block, right before
+ * writing the command that must be patched. It returns a reference to
+ * that command, which can then be used with #rspq_block_patch to change
+ * its arguments without recording the block again. This is useful for
+ * blocks that are identical from frame to frame except for a few words
+ * (eg: positions or colors).
+ * 
+ * @code{.c}
+ *      rspq_block_begin();
+ *      rspq_block_param_t p = rspq_block_param();
+ *      rspq_write(gfx_overlay_id, CMD_SET_COLOR, 0, color);
+ *      rspq_block_t *b = rspq_block_end();
+ *      
+ *      // Later on, change the color and run the block again
+ *      rspq_block_patch(p, 1, new_color);
+ *      rspq_block_run(b);
+ * @endcode
+ * 
+ * @return A reference to the next command written in the block
+ */
+rspq_block_param_t rspq_block_param(void);
+
+/**
+ * @brief Change an argument word of a command in a block.
+ * 
+ * The command must have been marked via #rspq_block_param. Word 0 is the
+ * first word of the command: only its lower 24 bits are changed, as the
+ * top byte contains the command ID.
+ * 
+ * Block memory is not cached, so no cache management is required. 
+ * 
+ * @param  param  The command reference, as returned by #rspq_block_param
+ * @param  word   Index of the word within the command to patch
+ * @param  value  New value of the word
+ * 
+ * @note Patching a block that is being run by the RSP is a race condition:
+ *       the RSP might see either the old or the new value. Make sure that
+ *       the RSP has finished running the block (eg: via a syncpoint)
+ *       before patching it.
+ */
+void rspq_block_patch(rspq_block_param_t param, int word, uint32_t value);
+
+/**
+ * @brief Get memory statistics of a block.
+ * 
+ * @param  block  The block
+ * @param  stats  Statistics (output)
+ */
+void rspq_block_get_stats(rspq_block_t *block, rspq_block_stats_t *stats);
+
 /**
  * @brief Start building a high-priority queue.
  * 
@@ -762,6 +1086,59 @@ void rspq_highpri_end(void);
  */
 void rspq_highpri_sync(void);
 
+/**
+ * @brief Latency statistics of the high-priority queue.
+ * 
+ * All latencies are measured in CPU ticks (see #TICKS_READ) from the call to
+ * #rspq_highpri_begin. Since the RSP only switches to the highpri queue
+ * between commands (or when a command polls for it), the yield latency
+ * mostly depends on the length of the lowpri commands being run.
+ * 
+ * If a highpri sequence is started while the previous one is still pending,
+ * the RSP runs them as a single sequence, and they are counted as one.
+ */
+typedef struct {
+    int count;              ///< Number of highpri sequences completed
+    uint32_t yield_min;     ///< Minimum latency between request and start of execution
+    uint32_t yield_avg;     ///< Average latency between request and start of execution
+    uint32_t yield_max;     ///< Maximum latency between request and start of execution
+    uint32_t done_min;      ///< Minimum latency between request and completion
+    uint32_t done_avg;      ///< Average latency between request and completion
+    uint32_t done_max;      ///< Maximum latency between request and completion
+} rspq_highpri_stats_t;
+
+/**
+ * @brief Get the latency statistics of the high-priority queue.
+ * 
+ * Statistics are accumulated since #rspq_init or the last call to
+ * #rspq_highpri_reset_stats.
+ * 
+ * @param[out]  stats   Statistics
+ */
+void rspq_highpri_get_stats(rspq_highpri_stats_t *stats);
+
+/**
+ * @brief Reset the latency statistics of the high-priority queue.
+ */
+void rspq_highpri_reset_stats(void);
+
+/**
+ * @brief Get the buffer switch statistics
+ * 
+ * Statistics are accumulated since #rspq_init or the last call to
+ * #rspq_buffer_reset_stats, for both the lowpri and the highpri queue.
+ * Frequent stalls mean that the CPU writes commands faster than the RSP
+ * runs them, and the buffers are too small to absorb the difference.
+ * 
+ * @param[out]  stats   Statistics
+ */
+void rspq_buffer_get_stats(rspq_buffer_stats_t *stats);
+
+/**
+ * @brief Reset the buffer switch statistics.
+ */
+void rspq_buffer_reset_stats(void);
+
 /**
  * @brief Enqueue a no-op command in the queue.
  * 
@@ -826,6 +1203,216 @@ void rspq_dma_to_rdram(void *rdram_addr, uint32_t dmem_addr, uint32_t len, bool
  */
 void rspq_dma_to_dmem(uint32_t dmem_addr, void *rdram_addr, uint32_t len, bool is_async);
 
+/**
+ * @brief A DMA transfer descriptor, used by #rspq_dma_list.
+ * 
+ * Use #rspq_dma_desc_to_dmem or #rspq_dma_desc_to_rdram to fill it.
+ */
+typedef struct {
+    uint32_t rdram_addr;    ///< RDRAM physical address (bit 31 set for DMEM to RDRAM transfers)
+    uint16_t dmem_addr;     ///< DMEM address
+    uint16_t size;          ///< Number of bytes to transfer, minus 1
+} rspq_dma_desc_t;
+
+/**
+ * @brief Build a descriptor for a DMA transfer from RDRAM to DMEM
+ *
+ * @param[in]  dmem_addr   The DMEM address (destination, must be aligned to 8)
+ * @param      rdram_addr  The RDRAM address (source, must be aligned to 8)
+ * @param[in]  len         Number of bytes to transfer (must be multiple of 8)
+ * @return     The descriptor
+ */
+inline rspq_dma_desc_t rspq_dma_desc_to_dmem(uint32_t dmem_addr, void *rdram_addr, uint32_t len)
+{
+    return (rspq_dma_desc_t){ (uint32_t)PhysicalAddr(rdram_addr), (uint16_t)dmem_addr, (uint16_t)(len - 1) };
+}
+
+/**
+ * @brief Build a descriptor for a DMA transfer from DMEM to RDRAM
+ *
+ * @param      rdram_addr  The RDRAM address (destination, must be aligned to 8)
+ * @param[in]  dmem_addr   The DMEM address (source, must be aligned to 8)
+ * @param[in]  len         Number of bytes to transfer (must be multiple of 8)
+ * @return     The descriptor
+ */
+inline rspq_dma_desc_t rspq_dma_desc_to_rdram(void *rdram_addr, uint32_t dmem_addr, uint32_t len)
+{
+    return (rspq_dma_desc_t){ (uint32_t)PhysicalAddr(rdram_addr) | 0x80000000, (uint16_t)dmem_addr, (uint16_t)(len - 1) };
+}
+
+/**
+ * @brief Enqueue a command that runs a list of DMA transfers.
+ * 
+ * This is a scatter/gather version of #rspq_dma_to_rdram / #rspq_dma_to_dmem:
+ * all the transfers described by the list are run by the RSP back-to-back,
+ * with a single command, and the RSP waits for their completion only at
+ * the end of the list. It is useful to gather many small structures into
+ * DMEM (or scatter them back to RDRAM).
+ * 
+ * The list is written back from the data cache by this function, but the
+ * RSP reads it asynchronously: it must not be modified or freed until
+ * the command has been executed.
+ * 
+ * @param      list    Array of descriptors (must be aligned to 8)
+ * @param[in]  count   Number of descriptors in the list (at least 1)
+ */
+void rspq_dma_list(rspq_dma_desc_t *list, int count);
+
+/**
+ * @brief Start profiling the commands executed by the RSP
+ * 
+ * After this call, the RSP queue engine will measure the time spent running
+ * each command, and send this information back to the CPU. The data is
+ * accumulated until #rspq_profile_reset is called.
+ * 
+ * This function requires #RSPQ_PROFILE to be enabled in rspq_constants.h
+ * (both libdragon and the RSP overlays must be rebuilt after changing it).
+ * 
+ * @note Samples are written by the RSP into a ring buffer of
+ *       #RSPQ_PROFILE_RING_SIZE entries, which is read by the CPU in
+ *       #rspq_profile_next_frame and #rspq_profile_get_data. If more commands
+ *       than that are run between two calls, some samples will be lost
+ *       (see rspq_profile_data_t::dropped_samples).
+ * 
+ * @see #rspq_profile_stop
+ */
+void rspq_profile_start(void);
+
+/**
+ * @brief Stop profiling the commands executed by the RSP
+ * 
+ * This function waits for the RSP to process all the commands enqueued so far
+ * so that their profile data is fully collected.
+ * 
+ * @see #rspq_profile_start
+ */
+void rspq_profile_stop(void);
+
+/**
+ * @brief Reset all the profile data accumulated so far.
+ */
+void rspq_profile_reset(void);
+
+/**
+ * @brief Notify the profiler that a new frame is starting.
+ * 
+ * This should be called once per frame while profiling. It collects the
+ * samples sent by the RSP, and increments the frame counter that is used
+ * to report per-frame averages.
+ */
+void rspq_profile_next_frame(void);
+
+/**
+ * @brief Get a copy of the profile data accumulated so far.
+ * 
+ * Commands are indexed by command ID (that is, overlay ID in the upper 4 bits,
+ * and command index in the lower 4 bits). The overlay names and command indices
+ * are resolved using the overlays that are currently registered.
+ * 
+ * Time spent by the RSP queue engine between commands (eg: fetching the
+ * queue from RDRAM) is accounted to command 0x00 of the builtin overlay.
+ * Time spent loading an overlay is accounted to the first command that
+ * required it.
+ * 
+ * @param[out] data     Structure that will be filled with the collected data
+ */
+void rspq_profile_get_data(rspq_profile_data_t *data);
+
+/**
+ * @brief Dump the profile data accumulated so far to the debug log.
+ * 
+ * The output contains one line per command that was executed, in the form
+ * `overlay:cmd`, with calls and cycles averaged over the number of frames.
+ */
+void rspq_profile_dump(void);
+
+/**
+ * @brief Start capturing the commands written to the lowpri queue
+ * 
+ * From now on, the commands are copied into the capture buffer when a queue
+ * buffer is full and at each #rspq_capture_next_frame. The captured stream
+ * includes the calls to blocks (see #rspq_block_run), but not the contents
+ * of the blocks, which must not be freed until the capture is replayed.
+ * Highpri sequences are not captured.
+ * 
+ * When the buffer is full, the capture stops at the last complete frame
+ * (see #rspq_capture_is_truncated).
+ * 
+ * @param[in]  max_words   Size of the capture buffer, in 32-bit words
+ * @return The new capture
+ * 
+ * @see #rspq_capture_stop
+ */
+rspq_capture_t* rspq_capture_start(int max_words);
+
+/**
+ * @brief Mark the end of a frame in the capture in progress
+ * 
+ * This should be called once per frame while capturing (eg: after
+ * #rdp_detach). It does nothing if there is no capture in progress.
+ */
+void rspq_capture_next_frame(void);
+
+/**
+ * @brief Stop the capture in progress
+ * 
+ * The commands written after the last #rspq_capture_next_frame are dropped.
+ */
+void rspq_capture_stop(void);
+
+/**
+ * @brief Return the number of frames in a capture
+ * 
+ * @param[in]  cap    Capture
+ * @return Number of complete frames
+ */
+int rspq_capture_get_frame_count(rspq_capture_t *cap);
+
+/**
+ * @brief Check whether a capture stopped early because its buffer was full
+ * 
+ * @param[in]  cap    Capture
+ * @return True if some frames were dropped
+ */
+bool rspq_capture_is_truncated(rspq_capture_t *cap);
+
+/**
+ * @brief Resubmit a captured frame to the RSP, and measure it
+ * 
+ * The frame is run like a block, and waited for. The returned time goes from
+ * when the queue is idle to when the RSP has run all the commands of the frame
+ * (including waiting for the RDP, if the frame contains a full sync).
+ * 
+ * The same overlays must be registered as when the capture was started,
+ * and the memory referenced by the commands must still be valid.
+ * 
+ * @param[in]  cap    Capture (not in progress)
+ * @param[in]  frame  Index of the frame
+ * @return Time taken to run the frame, in CPU ticks (see #TICKS_READ)
+ */
+uint32_t rspq_capture_replay(rspq_capture_t *cap, int frame);
+
+/**
+ * @brief Write a capture to a file
+ * 
+ * The file contains a header (magic "RQC1", number of frames, number of
+ * words), the names of the overlays registered at each of the 16 overlay IDs
+ * (32 bytes each), the frame descriptors (offset, size and number of
+ * syncpoints, in words) and the command words, all big-endian.
+ * 
+ * @param[in]  cap    Capture
+ * @param[in]  fn     Name of the file (eg: "sd:/capture.bin")
+ * @return True if the file was written, false on error
+ */
+bool rspq_capture_save(rspq_capture_t *cap, const char *fn);
+
+/**
+ * @brief Free a capture
+ * 
+ * @param[in]  cap    Capture (not in progress)
+ */
+void rspq_capture_free(rspq_capture_t *cap);
+
 #ifdef __cplusplus
 }
 #endif
@@ -3,10 +3,19 @@
 
 #define RSPQ_DEBUG                     1
 
+/** Enable profiling of RSP commands (see #rspq_profile_start). Adds a few cycles to each command. */
+#define RSPQ_PROFILE                   0
+/** Number of entries of the RDRAM ring buffer where the RSP writes profile samples (must be a power of two) */
+#define RSPQ_PROFILE_RING_SIZE         4096
+
 #define RSPQ_DRAM_LOWPRI_BUFFER_SIZE   0x200   ///< Size of each RSPQ RDRAM buffer for lowpri queue (in 32-bit words)
 #define RSPQ_DRAM_HIGHPRI_BUFFER_SIZE  0x80    ///< Size of each RSPQ RDRAM buffer for highpri queue (in 32-bit words)
 
 #define RSPQ_DMEM_BUFFER_SIZE          0x100   ///< Size of the RSPQ DMEM buffer (in bytes)
+
+/** Enable asynchronous prefetch of the second half of the DMEM buffer while running commands in the first half */
+#define RSPQ_DMEM_PREFETCH             0
+
 #define RSPQ_OVERLAY_TABLE_SIZE        0x10    ///< Number of overlay IDs (0-F)
 #define RSPQ_OVERLAY_DESC_SIZE         0x10    ///< Size of a single overlay descriptor
 
@@ -19,6 +28,15 @@
 #define RSPQ_BLOCK_MIN_SIZE            64
 #define RSPQ_BLOCK_MAX_SIZE            4192
 
+/** Number of slots of the side queue used by #rspq_isr_write (must be a power of two) */
+#define RSPQ_ISR_QUEUE_SLOTS           32
+
+/** Maximum number of pending callbacks registered via #rspq_syncpoint_on_done */
+#define RSPQ_MAX_SYNCPOINT_CALLBACKS   16
+
+/** Number of DMA descriptors fetched at once by RSPQ_CMD_DMA_LIST (affects DMEM size) */
+#define RSPQ_DMA_LIST_CHUNK            4
+
 /** Maximum number of nested block calls */
 #define RSPQ_MAX_BLOCK_NESTING_LEVEL   8
 #define RSPQ_LOWPRI_CALL_SLOT          (RSPQ_MAX_BLOCK_NESTING_LEVEL+0)  ///< Special slot used to store the current lowpri pointer
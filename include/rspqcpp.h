@@ -0,0 +1,140 @@
+/**
+ * @file rspqcpp.h
+ * @brief RSP Command queue: compile-time checked command writers (C++)
+ * @ingroup rsp
+ *
+ * This header (C++14 or later) provides a C++ alternative to #rspq_write, where the number
+ * of argument words of each command is checked at compile time. Commands
+ * are described once, mirroring their definition in the overlay header
+ * (RSPQ_DefineCommand), and then invoked like functions:
+ *
+ * @code{.cpp}
+ *      // In the overlay: RSPQ_DefineCommand GfxCmd_Sprite, 12   # 0x0A
+ *      constexpr rspq::command<0xA, 12> CMD_SPRITE;
+ *
+ *      CMD_SPRITE(gfx_overlay_id, sprite_num, (x0 << 16) | y0, (x1 << 16) | y1);
+ * @endcode
+ *
+ * Passing the wrong number of arguments, or arguments that are not integers
+ * (eg: a float, that would be silently converted by #rspq_write), is a
+ * compile error. The space of the whole command is reserved in the queue
+ * with a single check, and the words are written with straight-line stores;
+ * unlike #rspq_write, this works for commands up to #RSPQ_MAX_COMMAND_SIZE
+ * words, so #rspq_write_begin is not needed for big commands.
+ *
+ * #rspq::write can also be used directly, checking only the maximum size:
+ *
+ * @code{.cpp}
+ *      rspq::write<0xA>(gfx_overlay_id, sprite_num, (x0 << 16) | y0, (x1 << 16) | y1);
+ * @endcode
+ *
+ * As with #rspq_write, the first argument word must have its MSB set to 0,
+ * to leave space for the command ID.
+ */
+#ifndef __LIBDRAGON_RSPQCPP_H
+#define __LIBDRAGON_RSPQCPP_H
+
+#if defined(__cplusplus)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <type_traits>
+#include <utility>
+#include "rspq.h"
+
+/// @cond
+extern "C" {
+    extern volatile uint32_t *rspq_cur_pointer, *rspq_cur_sentinel;
+    extern void rspq_next_buffer(void);
+}
+/// @endcond
+
+namespace rspq {
+
+/// @cond
+namespace detail {
+    // Store the words after the first one, with one store per word
+    template<size_t N, size_t... I>
+    inline void store_tail(volatile uint32_t *ptr, const uint32_t (&words)[N], std::index_sequence<I...>) {
+        using expand = int[];
+        (void)expand{ 0, ((ptr[I + 1] = words[I + 1]), 0)... };
+    }
+
+    // Check that all the arguments can be used as command words
+    constexpr bool all_words() { return true; }
+    template<typename... Rest>
+    constexpr bool all_words(bool first, Rest... rest) { return first && all_words(rest...); }
+}
+/// @endcond
+
+/**
+ * @brief Write a command into the RSP queue
+ *
+ * This is equivalent to #rspq_write, with the number and the type of the
+ * arguments checked at compile time.
+ *
+ * @tparam CmdId        Index of the command within the overlay
+ * @param  ovl_id       The overlay ID (as returned by #rspq_overlay_register)
+ * @param  args         Argument words of the command (integers)
+ */
+template<uint32_t CmdId, typename... Args>
+inline void write(uint32_t ovl_id, Args... args)
+{
+    static_assert(CmdId < 16, "rspq: invalid command index");
+    static_assert(sizeof...(Args) <= RSPQ_MAX_COMMAND_SIZE, "rspq: too many argument words for a command");
+    static_assert(detail::all_words((std::is_integral<Args>::value || std::is_enum<Args>::value)...),
+        "rspq: command arguments must be integers");
+
+    constexpr size_t size = sizeof...(Args) ? sizeof...(Args) : 1;
+    const uint32_t words[size] = { static_cast<uint32_t>(args)... };
+
+    if (__builtin_expect(rspq_cur_pointer > rspq_cur_sentinel - size, 0))
+        rspq_next_buffer();
+
+    // Write the first word last: the RSP might already be polling for it
+    volatile uint32_t *ptr = rspq_cur_pointer;
+    detail::store_tail(ptr, words, std::make_index_sequence<size - 1>{});
+    ptr[0] = (ovl_id + (CmdId << 24)) | words[0];
+    rspq_cur_pointer = ptr + size;
+}
+
+/**
+ * @brief Description of a command of an overlay
+ *
+ * The parameters mirror the definition of the command in the overlay
+ * header (RSPQ_DefineCommand), so that invoking the command with a number
+ * of argument words that does not match its size is a compile error.
+ *
+ * @tparam CmdId        Index of the command within the overlay
+ * @tparam Bytes        Size of the command in bytes (as in RSPQ_DefineCommand)
+ */
+template<uint32_t CmdId, size_t Bytes>
+struct command {
+    static_assert(Bytes % 4 == 0 && Bytes >= 4 && Bytes <= RSPQ_MAX_COMMAND_SIZE * 4,
+        "rspq: invalid command size");
+
+    /** @brief Size of the command in 32-bit words */
+    static constexpr size_t words = Bytes / 4;
+
+    /**
+     * @brief Write the command into the RSP queue
+     *
+     * The first word can be omitted when the command has no arguments,
+     * as with #rspq_write.
+     *
+     * @param  ovl_id       The overlay ID (as returned by #rspq_overlay_register)
+     * @param  args         Argument words of the command
+     */
+    template<typename... Args>
+    void operator()(uint32_t ovl_id, Args... args) const {
+        static_assert(sizeof...(Args) == words || (words == 1 && sizeof...(Args) == 0),
+            "rspq: wrong number of argument words for this command");
+        write<CmdId>(ovl_id, args...);
+    }
+};
+
+} // namespace rspq
+
+#endif
+
+#endif
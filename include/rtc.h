@@ -35,16 +35,31 @@ typedef struct rtc_time_t
     uint8_t week_day;
 } rtc_time_t;
 
+/**
+ * @brief Callback invoked when an asynchronous RTC operation completes.
+ *
+ * The callback is called under interrupt with the outcome of the
+ * operation and the opaque context pointer.
+ *
+ * @see #rtc_get_async
+ * @see #rtc_set_async
+ * @see #rtc_init_async
+ */
+typedef void (*rtc_callback_t)( bool success, void * ctx );
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 bool rtc_init( void );
+void rtc_init_async( rtc_callback_t callback, void * ctx );
 void rtc_close( void );
 bool rtc_is_writable( void );
 bool rtc_get( rtc_time_t * rtc_time );
 bool rtc_set( rtc_time_t * rtc_time );
 void rtc_normalize_time( rtc_time_t * rtc_time );
+bool rtc_get_async( rtc_time_t * rtc_time, rtc_callback_t callback, void * ctx );
+bool rtc_set_async( rtc_time_t * write_time, rtc_callback_t callback, void * ctx );
 
 #ifdef __cplusplus
 }
@@ -75,9 +75,10 @@ typedef uint32_t sample_ptr_t;
  * transfer for unaligned addresses).
  *
  * In general, the sample buffer assumes that the contained data is committed
- * to physical memory, not just CPU cache. It is responsibility of the client
- * to flush DMA cache (via data_cache_writeback) if samples are written
- * via CPU.
+ * to physical memory, not just CPU cache. Waveforms that generate samples
+ * with the CPU should use #samplebuffer_append_cached, that lets them write
+ * through the cache and takes care of writing the samples back before they
+ * are used.
  */
 typedef struct samplebuffer_s {
     /**
@@ -122,6 +123,31 @@ typedef struct samplebuffer_s {
      * wv_ctx is the opaque pointer to pass as context to decoder functions.
      */
     void *wv_ctx;
+
+    /**
+     * True while the waveform read function is being called for a read-ahead
+     * (see #samplebuffer_readahead). In this case, the waveform is allowed to
+     * return before the samples have been transferred, by using
+     * #samplebuffer_append_async.
+     */
+    bool async;
+
+    /**
+     * Number of asynchronous transfers into the buffer that are not
+     * finished yet (see #samplebuffer_append_async).
+     */
+    volatile int async_pending;
+
+    /**
+     * Index of the first sample of the buffer that might still be
+     * transferred asynchronously. Only valid if async_pending is not 0.
+     */
+    int async_idx;
+    /**
+     * Number of samples at the end of the buffer that were appended via
+     * #samplebuffer_append_cached, and might still be in the CPU cache.
+     */
+    int cached_len;
 } samplebuffer_t;
 
 /**
@@ -232,6 +258,93 @@ void* samplebuffer_get(samplebuffer_t *buf, int wpos, int *wlen);
  */
 void* samplebuffer_append(samplebuffer_t *buf, int wlen);
 
+/**
+ * @brief Append samples into the buffer, that will be written asynchronously.
+ * 
+ * This is similar to #samplebuffer_append, but the samples are not expected
+ * to be available when the function returns: for instance, the waveform can
+ * start a PI DMA transfer (see #dma_read_queue) into the returned pointer.
+ * Once the samples have been written, the waveform must call
+ * #samplebuffer_async_done. Until then, #samplebuffer_get will wait before
+ * returning any of these samples.
+ * 
+ * This function can only be called if the "async" field of the buffer is
+ * true, that is during a read-ahead (see #samplebuffer_readahead).
+ * 
+ * @param[in]   buf     Sample buffer
+ * @param[in]   wlen    Number of samples to append.
+ * @return              Pointer to the area where new samples will be written.
+ */
+void* samplebuffer_append_async(samplebuffer_t *buf, int wlen);
+
+/**
+ * @brief Append samples into the buffer, that will be written via the CPU cache.
+ *
+ * This is similar to #samplebuffer_append, but the returned pointer is in
+ * the cached segment. Waveforms that generate samples with the CPU (eg:
+ * synthesizers) should use this function: a CPU store into cached memory is
+ * much faster than one into uncached RDRAM.
+ *
+ * The samples are written back to RDRAM before they are used (that is,
+ * before #samplebuffer_get returns them), so the waveform must not do it.
+ * It must not write them via DMA or RSP either, as the cachelines would
+ * overwrite them later.
+ *
+ * @param[in]   buf     Sample buffer
+ * @param[in]   wlen    Number of samples to append.
+ * @return              Pointer to the area where new samples can be written
+ *                      (in the cached segment).
+ */
+void* samplebuffer_append_cached(samplebuffer_t *buf, int wlen);
+
+/**
+ * @brief Notify that an asynchronous write into the buffer is finished.
+ * 
+ * This must be called once for each call to #samplebuffer_append_async.
+ * It can be called from an interrupt handler, and its
+ * signature matches #dma_callback_t so that it can be directly used
+ * as the callback of a DMA transfer (with the buffer as context).
+ * 
+ * @param[in]   buf     Sample buffer (as void*)
+ */
+void samplebuffer_async_done(void *buf);
+
+/**
+ * @brief Wait until all the asynchronous writes into the buffer are finished.
+ *
+ * This also writes back the samples appended via #samplebuffer_append_cached.
+ * 
+ * @param[in]   buf     Sample buffer
+ */
+void samplebuffer_wait(samplebuffer_t *buf);
+
+/**
+ * @brief Read samples ahead of playback, so that they are available later.
+ * 
+ * This function asks the waveform to read the samples from "wpos" to
+ * "wpos+wlen", if they are not already in the buffer. The waveform is
+ * allowed to read them asynchronously (see #samplebuffer_append_async),
+ * so that a later call to #samplebuffer_get finds them already transferred,
+ * without waiting.
+ * 
+ * To batch reads, nothing is done if at least half of the requested range
+ * is already in the buffer. The read is also clamped to the free space in
+ * the buffer. "wpos" must be consecutive to the samples in the buffer, so
+ * the function is meant to be called right after #samplebuffer_get, with
+ * "wpos" pointing after the samples that were just returned.
+ * 
+ * Asynchronous reads are only done if interrupts are enabled, as their
+ * completion must be notified by an interrupt handler.
+ * 
+ * @note Reading new samples might compact the buffer, so the pointer
+ *       returned by a previous #samplebuffer_get is invalidated.
+ * 
+ * @param[in]   buf     Sample buffer
+ * @param[in]   wpos    Absolute waveform position of the first sample to read
+ * @param[in]   wlen    Number of samples to read ahead
+ */
+void samplebuffer_readahead(samplebuffer_t *buf, int wpos, int wlen);
+
 /**
  * Discard all samples from the buffer that come before a specified
  * absolute waveform position.
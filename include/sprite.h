@@ -61,6 +61,7 @@ typedef struct sprite_s
 
 #define SPRITE_FLAGS_TEXFORMAT      0x1F    ///< Pixel format of the sprite
 #define SPRITE_FLAGS_OWNEDBUFFER    0x20    ///< Flag specifying that the sprite buffer must be freed by sprite_free
+#define SPRITE_FLAGS_STREAMING      0x40    ///< Flag specifying that the sprite LODs are loaded on demand (see #sprite_load_streaming)
 #define SPRITE_FLAGS_EXT            0x80    ///< Sprite contains extended information (new format)
 
 
@@ -80,6 +81,67 @@ typedef struct sprite_s
  */
 sprite_t *sprite_load(const char *fn);
 
+/**
+ * @brief Load a sprite from a filesystem, converting it to the specified format
+ * 
+ * This function works like #sprite_load, but the main image of the sprite
+ * is converted once at load time, so that later blits to a surface of the
+ * same format (eg: #graphics_draw_sprite) take the fast path, instead of
+ * converting each pixel or being rejected. The supported conversions are
+ * the ones of #surface_blit: #FMT_RGBA32, #FMT_RGBA16, #FMT_CI8 and #FMT_CI4
+ * (via the palette) to #FMT_RGBA16 or #FMT_RGBA32.
+ * 
+ * The LODs and the palette are kept as they are. When the image shrinks
+ * (#FMT_RGBA32 to #FMT_RGBA16), it is converted in place; otherwise, a new
+ * buffer is allocated for the converted sprite.
+ * 
+ * @param fn           Filename of the sprite, including filesystem specifier.
+ * @param fmt          Format to convert to, or #FMT_NONE for the format of the
+ *                     display (see #display_get_bitdepth)
+ * @return sprite_t*   The loaded sprite, to be freed with #sprite_free
+ */
+sprite_t *sprite_load_convert(const char *fn, tex_format_t fmt);
+
+/**
+ * @brief Load a sprite from ROM, streaming its LODs on demand
+ * 
+ * This function is similar to #sprite_load, but only the main image (and
+ * the palette, if any) is loaded into RDRAM. The other LOD levels are
+ * read from ROM the first time they are accessed via #sprite_get_lod_pixels,
+ * and are kept in a cache shared by all streaming sprites. When the cache
+ * exceeds its memory budget (see #sprite_set_lod_budget), the least recently
+ * used LODs are evicted.
+ * 
+ * This is useful for mipmapped textures of objects that are often drawn
+ * far away, which only need the smallest levels.
+ * 
+ * The file must be stored uncompressed (mksprite -c 0), as LODs are
+ * read directly from ROM.
+ * 
+ * @note A surface returned by #sprite_get_lod_pixels for a streaming sprite
+ *       is only valid until the LOD is evicted, which can happen on any
+ *       following call to #sprite_get_lod_pixels on any streaming sprite.
+ *       Eviction waits for the RSP queue to be idle, so that the RDP is
+ *       never reading evicted memory.
+ * 
+ * @param fn           Filename of the sprite, including filesystem specifier.
+ *                     Only files on DFS ("rom:/") are supported.
+ * @return sprite_t*   The loaded sprite, to be freed with #sprite_free
+ */
+sprite_t *sprite_load_streaming(const char *fn);
+
+/**
+ * @brief Configure the memory budget for the LODs of streaming sprites
+ * 
+ * Configures how many bytes can be used to keep the LODs of the sprites
+ * loaded with #sprite_load_streaming in RDRAM. The default is 128 KiB.
+ * If the budget is lowered, the least recently used LODs are evicted
+ * immediately.
+ * 
+ * @param bytes         Memory budget in bytes
+ */
+void sprite_set_lod_budget(int bytes);
+
 /**
  * @brief Load a sprite from a buffer
  * 
@@ -98,6 +160,21 @@ sprite_t *sprite_load(const char *fn);
  */
 sprite_t *sprite_load_buf(void *buf, int sz);
 
+/**
+ * @brief Load a sprite from a file into an arena
+ * 
+ * This function works like #sprite_load, but the sprite is allocated in the
+ * specified arena (see #asset_load_arena). Its memory is released together with
+ * the arena: #sprite_free can still be called on it, but it will not free
+ * any memory.
+ *
+ * @param arena         Arena where the sprite is allocated
+ * @param fn            Filename of the sprite, including filesystem specifier.
+ *                      For instance: "rom:/hero.sprite" to load from DFS.
+ * @return sprite_t*    The loaded sprite
+ */
+sprite_t *sprite_load_arena(arena_t *arena, const char *fn);
+
 /** @brief Deallocate a sprite */
 void sprite_free(sprite_t *sprite);
 
@@ -163,6 +240,31 @@ surface_t sprite_get_lod_pixels(sprite_t *sprite, int num_level);
  */
 surface_t sprite_get_tile(sprite_t *sprite, int h, int v);
 
+/**
+ * @brief Return the number of frames of a sprite atlas
+ * 
+ * A sprite atlas is created by mksprite (--atlas) packing multiple images,
+ * possibly of different sizes, into a single sprite. Each of the images
+ * is called a "frame", and can be accessed with #sprite_get_frame.
+ * 
+ * @param   sprite      The sprite to access
+ * @return              The number of frames, or 0 if the sprite is not an atlas
+ */
+int sprite_get_frame_count(sprite_t *sprite);
+
+/**
+ * @brief Return a surface_t pointing to a specific frame of a sprite atlas
+ * 
+ * Frames are numbered in the order in which the images were passed to
+ * mksprite. Notice that no memory allocations or copies are performed:
+ * the returned surface will point to the sprite contents.
+ * 
+ * @param   sprite      The sprite atlas
+ * @param   idx         Index of the frame (from 0 to #sprite_get_frame_count - 1)
+ * @return              A surface pointing to the frame
+ */
+surface_t sprite_get_frame(sprite_t *sprite, int idx);
+
 /**
  * @brief Access the sprite palette (if any)
  * 
@@ -55,6 +55,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "arena.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -212,6 +213,25 @@ inline surface_t surface_make_linear(void *buffer, tex_format_t format, uint32_t
  */
 surface_t surface_alloc(tex_format_t format, uint32_t width, uint32_t height);
 
+/**
+ * @brief Allocate a new surface in an arena
+ * 
+ * This function works like #surface_alloc, but the memory of the surface
+ * is allocated in the specified arena (see #arena_alloc_uncached). The
+ * buffer is released together with the arena: #surface_free can still be
+ * called on the surface, but it will not free any memory.
+ * 
+ * The buffer has the same alignment of #surface_alloc, so the surface can
+ * be used as a RDP frame buffer.
+ *
+ * @param[in]  arena    Arena where the surface buffer is allocated
+ * @param[in]  format   Pixel format of the surface
+ * @param[in]  width    Width in pixels
+ * @param[in]  height   Height in pixels
+ * @return              The initialized surface
+ */
+surface_t surface_alloc_arena(arena_t *arena, tex_format_t format, uint32_t width, uint32_t height);
+
 /**
  * @brief Initialize a surface_t structure, pointing to a rectangular portion of another
  *        surface.
@@ -243,6 +263,128 @@ surface_t surface_make_sub(surface_t *parent,
  */
 void surface_free(surface_t *surface);
 
+#define SURFACE_BLIT_RDP           0x1    ///< #surface_blit: use the RDP when the formats allow it
+
+/**
+ * @brief Copy a surface into another one, converting the pixel format
+ * 
+ * The source surface is copied into the destination at the specified position,
+ * clipping it to the destination bounds. To copy only a portion of a surface,
+ * pass a subsurface created with #surface_make_sub.
+ * 
+ * The following conversions are supported, with optimized kernels:
+ * 
+ *  * Same format (any format with at least 8 bits per pixel)
+ *  * #FMT_RGBA32 to #FMT_RGBA16, and #FMT_RGBA16 to #FMT_RGBA32
+ *  * #FMT_CI8 and #FMT_CI4 to #FMT_RGBA16 or #FMT_RGBA32, via the specified palette
+ * 
+ * By default, conversions are done by the CPU. With #SURFACE_BLIT_RDP, copies
+ * between 16-bit surfaces of the same format are instead done by the RDP in
+ * copy mode: this requires the RDP to be initialized and not attached, and
+ * the function waits for the RDP to finish. Other pairs fall back to the CPU.
+ * See the surface benchmarks in the testsuite to choose between the two paths.
+ * 
+ * @param[in] dst       Destination surface
+ * @param[in] src       Source surface
+ * @param[in] x         X coordinate in the destination (can be negative)
+ * @param[in] y         Y coordinate in the destination (can be negative)
+ * @param[in] tlut      Palette for #FMT_CI8 and #FMT_CI4 sources (RGBA16), NULL otherwise
+ * @param[in] flags     Flags (#SURFACE_BLIT_RDP)
+ */
+void surface_blit(surface_t *dst, const surface_t *src, int x, int y, const uint16_t *tlut, uint32_t flags);
+
+/**
+ * @brief A pool of surface buffers, for transient render targets.
+ * 
+ * Allocating and freeing offscreen surfaces every frame (eg: for effects)
+ * fragments the heap. A surface pool keeps the buffers around after use,
+ * and hands them out again to later allocations of a similar size.
+ * 
+ * Buffers are grouped in size classes (powers of two, starting from 1 KiB):
+ * an allocation is served by any free buffer of its class, or by a new one
+ * if none is free. Buffers are always 64-byte aligned, so that pool
+ * surfaces can be used as RDP frame buffers.
+ * 
+ * Surfaces can be returned to the pool one by one with #surface_pool_release,
+ * or all together with #surface_pool_reset, typically once per frame:
+ * 
+ * @code{.c}
+ *      surface_pool_t *pool = surface_pool_new();
+ * 
+ *      while (1) {
+ *          surface_t tmp = surface_pool_alloc(pool, FMT_RGBA16, 160, 120);
+ *          // ... render into tmp, and use it to compose the frame ...
+ *          rspq_wait();
+ *          surface_pool_reset(pool);
+ *      }
+ * @endcode
+ * 
+ * Memory which is already allocated and currently idle, such as a spare
+ * display buffer, can also be lent to the pool with #surface_pool_add_buffer.
+ */
+typedef struct surface_pool_s surface_pool_t;
+
+/** @brief Create a new, empty surface pool */
+surface_pool_t *surface_pool_new(void);
+
+/**
+ * @brief Allocate a surface from a pool
+ * 
+ * The returned surface does not own its buffer: calling #surface_free on it
+ * has no effect, use #surface_pool_release instead (or #surface_pool_reset).
+ * The contents of the buffer are undefined.
+ * 
+ * @param[in] pool      Surface pool
+ * @param[in] format    Pixel format of the surface
+ * @param[in] width     Width in pixels
+ * @param[in] height    Height in pixels
+ * @return              The initialized surface
+ */
+surface_t surface_pool_alloc(surface_pool_t *pool, tex_format_t format, uint32_t width, uint32_t height);
+
+/**
+ * @brief Return a surface allocated with #surface_pool_alloc to its pool
+ * 
+ * The buffer is kept by the pool for later allocations. Make sure that
+ * the RDP is done with the surface before releasing it.
+ * 
+ * @param[in] pool      Surface pool
+ * @param[in] surface   Surface to release (cleared by this function)
+ */
+void surface_pool_release(surface_pool_t *pool, surface_t *surface);
+
+/**
+ * @brief Return all the surfaces allocated from a pool
+ * 
+ * This is meant to be called once per frame, after the RDP is done rendering
+ * it. All the surfaces allocated from the pool become invalid.
+ * 
+ * @param[in] pool      Surface pool
+ */
+void surface_pool_reset(surface_pool_t *pool);
+
+/**
+ * @brief Lend the buffer of an existing surface to a pool
+ * 
+ * The buffer (which must be 64-byte aligned, like all buffers of
+ * #surface_alloc and display surfaces) becomes available for allocations
+ * from the pool, until #surface_pool_free. The pool never frees it.
+ * 
+ * This allows to reuse memory which is idle, for instance a display buffer
+ * that is not used in the current display mode.
+ * 
+ * @param[in] pool      Surface pool
+ * @param[in] surface   Surface whose buffer will be lent to the pool
+ */
+void surface_pool_add_buffer(surface_pool_t *pool, surface_t *surface);
+
+/**
+ * @brief Free a surface pool and all the buffers it allocated
+ * 
+ * @param[in] pool      Surface pool
+ */
+void surface_pool_free(surface_pool_t *pool);
+
 /**
  * @brief Returns the pixel format of a surface
  * 
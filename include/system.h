@@ -136,6 +136,22 @@ typedef struct
      * @return 0 on successful lookup or a negative value on failure or empty directory.
      */
     int (*findnext)( dir_t *dir );
+    /** 
+     * @brief Function to call when performing an asynchronous read operation
+     * @param[in]  file
+     *             Arbitrary file handle returned by #filesystem_t::open
+     * @param[out] ptr
+     *             Buffer to place data read into
+     * @param[in]  len
+     *             Length of data that should be read into ptr
+     * @param[in]  cb
+     *             Callback to invoke (with ctx and the number of bytes read)
+     *             once the data is available in ptr
+     * @param[in]  ctx
+     *             Opaque context for the callback
+     * @return The number of bytes that will be read into ptr or a negative value on failure.
+     */
+    int (*read_async)( void *file, uint8_t *ptr, int len, void (*cb)(void *ctx, int len), void *ctx );
 } filesystem_t;
 
 /**
@@ -185,6 +201,8 @@ typedef struct
 int attach_filesystem( const char * const prefix, filesystem_t *filesystem );
 int detach_filesystem( const char * const prefix );
 
+int read_async( int file, void *ptr, int len, void (*cb)(void *ctx, int len), void *ctx );
+
 int hook_stdio_calls( stdio_t *stdio_calls );
 int unhook_stdio_calls( stdio_t *stdio_calls );
 
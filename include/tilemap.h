@@ -0,0 +1,41 @@
+/**
+ * @file tilemap.h
+ * @brief Scrolling tilemaps
+ * @ingroup tilemap
+ */
+#ifndef __LIBDRAGON_TILEMAP_H
+#define __LIBDRAGON_TILEMAP_H
+
+#include <stdint.h>
+#include "sprite.h"
+#include "surface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Tile index of an empty cell, drawn as transparent black */
+#define TILEMAP_EMPTY       0xFFFF
+
+/** @brief A scrolling tilemap (opaque) */
+typedef struct tilemap_s tilemap_t;
+
+/* create a tilemap, viewed through a window of the specified size */
+tilemap_t *tilemap_new(sprite_t *tileset, uint16_t *map, int map_width, int map_height,
+    int view_width, int view_height);
+/* free a tilemap */
+void tilemap_free(tilemap_t *tm);
+/* scroll the view to the specified position, in pixels */
+void tilemap_scroll(tilemap_t *tm, int x, int y);
+/* change a cell of the map */
+void tilemap_set_tile(tilemap_t *tm, int tx, int ty, uint16_t tile);
+/* redraw all the visible tiles (eg: after changing the map directly) */
+void tilemap_invalidate(tilemap_t *tm);
+/* draw the view to the attached surface, at the specified position */
+void tilemap_draw(tilemap_t *tm, int x, int y);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -39,8 +39,16 @@ typedef struct timer_link
     };
     /** @brief Callback context parameter */
     void *ctx;
-    /** @brief Link to next timer */
+    /** @brief Next sibling in the timer queue */
     struct timer_link *next;
+    /** @brief First child in the timer queue */
+    struct timer_link *child;
+    /** @brief Previous sibling (or parent, for the first child) in the timer queue */
+    struct timer_link *prev;
+    /** @brief Absolute ticks value at which the timer expires, extended to 64 bits */
+    uint64_t deadline;
+    /** @brief How many ticks the timer is allowed to fire late (see #timer_set_slack) */
+    uint32_t slack;
 } timer_link_t;
 
 /** @brief Timer should fire only once */
@@ -100,6 +108,8 @@ void timer_init(void);
 void timer_close(void);
 /* return total ticks since timer was initialized */
 long long timer_ticks(void);
+/* preallocate a fixed number of timers for new_timer */
+void timer_pool_init(int capacity);
 
 /* create a new timer and add to list */
 timer_link_t *new_timer(int ticks, int flags, timer_callback1_t callback);
@@ -117,6 +127,8 @@ void restart_timer(timer_link_t *timer);
 void stop_timer(timer_link_t *timer);
 /* remove a timer from the list and delete it */
 void delete_timer(timer_link_t *timer);
+/* allow a timer to fire late, to coalesce it with other timers */
+void timer_set_slack(timer_link_t *timer, int slack);
 
 #ifdef __cplusplus
 }
@@ -63,6 +63,8 @@
         usb_write
         Writes data to the USB.
         Will not write if there is data to read from USB
+        If the data is 8-byte aligned, it is DMAed directly
+        to the cartridge without intermediate copies
         @param The DATATYPE that is being sent
         @param A buffer with the data to send
         @param The size of the data being sent
@@ -71,6 +73,18 @@
     extern void usb_write(int datatype, const void* data, int size);
     
     
+    /*==============================
+        usb_canwrite
+        Checks whether usb_write can be called right now.
+        This is false while another USB operation is in
+        progress (eg: from an interrupt handler), or if
+        there is data to read first.
+        @return 1 if data can be written, 0 if not
+    ==============================*/
+    
+    extern char usb_canwrite(void);
+    
+    
     /*==============================
         usb_poll
         Returns the header of data being received via USB
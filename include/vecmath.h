@@ -0,0 +1,200 @@
+/**
+ * @file vecmath.h
+ * @brief Batched vector math on the RSP
+ * @ingroup rsp
+ *
+ * This library runs vector and matrix math over arrays in RDRAM on the RSP,
+ * so that batched work (eg: physics or skinning) can be moved off the CPU.
+ * All the functions enqueue rspq commands: they return immediately, and the
+ * work runs asynchronously, in order with the other rspq commands. They can
+ * also be recorded into rspq blocks.
+ *
+ * All numbers are in 16.16 fixed point, and vectors have 4 components. The
+ * RSP works on vectors in pairs, so arrays are made of #vecmath_slot_t, each
+ * holding two vectors. To convert data from and to this format, use
+ * #vecmath_from_floats and #vecmath_to_floats on the CPU, or
+ * #vecmath_from_fixed and #vecmath_to_fixed on the RSP.
+ *
+ * @code{.c}
+ *      vecmath_init();
+ *
+ *      // Transform the vertices of a mesh by a matrix
+ *      vecmath_load_mtx(0, mtx);
+ *      vecmath_transform(out, 0, vertices, num_vertices / 2);
+ *      rspq_wait();
+ * @endcode
+ *
+ * The arrays are accessed by the RSP via DMA, so the usual rules apply: the
+ * CPU must write back the cache of the inputs before the command runs, and
+ * invalidate the cache of the outputs before reading them (or just use
+ * uncached buffers). The output array of a command can be the same as one
+ * of its inputs. The commands never yield to the highpri queue while they
+ * are running, so very large arrays should be split into multiple commands
+ * if highpri latency matters.
+ */
+#ifndef __LIBDRAGON_VECMATH_H
+#define __LIBDRAGON_VECMATH_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Number of matrices that can be loaded on the RSP at the same time */
+#define VECMATH_MAX_MATRICES    8
+
+/**
+ * @brief Two 4-component vectors in 16.16 fixed point, in RSP format
+ *
+ * The first vector is in the components 0-3 (x, y, z, w), the second one
+ * in the components 4-7. Each component is split into its integer part
+ * and its fractional part.
+ */
+typedef struct {
+    int16_t i[8];       ///< Integer parts of the components
+    uint16_t f[8];      ///< Fractional parts of the components
+} __attribute__((aligned(16))) vecmath_slot_t;
+
+/**
+ * @brief 4x4 matrix in 16.16 fixed point, in RSP format
+ *
+ * The matrix is stored by columns: the first slot holds columns 0 and 1,
+ * the second slot holds columns 2 and 3. A vector v is transformed into
+ * M * v, where v is a column vector.
+ */
+typedef struct {
+    vecmath_slot_t c[2];    ///< Columns of the matrix
+} __attribute__((aligned(16))) vecmath_mtx_t;
+
+/** @brief Initialize the library (registering its rspq overlay) */
+void vecmath_init(void);
+
+/** @brief Close the library */
+void vecmath_close(void);
+
+/**
+ * @brief Load a matrix on the RSP
+ *
+ * The matrix is copied into the RSP state when the command runs, so the
+ * buffer can be reused after that. Just after #vecmath_init, all the
+ * matrices are the identity.
+ *
+ * @param idx       Index of the matrix (0 to #VECMATH_MAX_MATRICES - 1)
+ * @param mtx       Matrix to load
+ */
+void vecmath_load_mtx(int idx, const vecmath_mtx_t *mtx);
+
+/**
+ * @brief Transform vectors by a matrix
+ *
+ * To multiply two matrices A * B, transform the two slots of B by A.
+ *
+ * @param dst       Output array
+ * @param mtx       Index of the matrix (loaded with #vecmath_load_mtx)
+ * @param src       Input array
+ * @param num       Number of slots in the arrays (each holds two vectors)
+ */
+void vecmath_transform(vecmath_slot_t *dst, int mtx, const vecmath_slot_t *src, int num);
+
+/**
+ * @brief Normalize vectors
+ *
+ * The components x, y and z are divided by the length of (x, y, z), while
+ * w is copied as is. The squared length must be less than 32768; zero
+ * vectors are left unchanged.
+ *
+ * @param dst       Output array
+ * @param src       Input array
+ * @param num       Number of slots in the arrays (each holds two vectors)
+ */
+void vecmath_normalize(vecmath_slot_t *dst, const vecmath_slot_t *src, int num);
+
+/**
+ * @brief Compute the dot products of the first 3 components of vectors
+ *
+ * All the components of each output vector are set to the dot product.
+ *
+ * @param dst       Output array
+ * @param a         First input array
+ * @param b         Second input array
+ * @param num       Number of slots in the arrays (each holds two vectors)
+ */
+void vecmath_dot3(vecmath_slot_t *dst, const vecmath_slot_t *a, const vecmath_slot_t *b, int num);
+
+/**
+ * @brief Compute the dot products of vectors
+ *
+ * All the components of each output vector are set to the dot product.
+ *
+ * @param dst       Output array
+ * @param a         First input array
+ * @param b         Second input array
+ * @param num       Number of slots in the arrays (each holds two vectors)
+ */
+void vecmath_dot4(vecmath_slot_t *dst, const vecmath_slot_t *a, const vecmath_slot_t *b, int num);
+
+/**
+ * @brief Compute the cross products of the first 3 components of vectors
+ *
+ * The w component of the output vectors is set to zero.
+ *
+ * @param dst       Output array
+ * @param a         First input array
+ * @param b         Second input array
+ * @param num       Number of slots in the arrays (each holds two vectors)
+ */
+void vecmath_cross(vecmath_slot_t *dst, const vecmath_slot_t *a, const vecmath_slot_t *b, int num);
+
+/**
+ * @brief Convert an array of 16.16 numbers into slots, on the RSP
+ *
+ * @param dst       Output array
+ * @param src       Input array of 8 * num numbers (8-byte aligned)
+ * @param num       Number of slots in the output
+ */
+void vecmath_from_fixed(vecmath_slot_t *dst, const int32_t *src, int num);
+
+/**
+ * @brief Convert slots into an array of 16.16 numbers, on the RSP
+ *
+ * @param dst       Output array of 8 * num numbers (8-byte aligned)
+ * @param src       Input array
+ * @param num       Number of slots in the input
+ */
+void vecmath_to_fixed(int32_t *dst, const vecmath_slot_t *src, int num);
+
+/**
+ * @brief Convert an array of floats into slots, on the CPU
+ *
+ * If the number of floats is not a multiple of 8, the remaining components
+ * of the last slot are set to zero.
+ *
+ * @param dst       Output array (with space for (n + 7) / 8 slots)
+ * @param src       Input array
+ * @param n         Number of floats
+ */
+void vecmath_from_floats(vecmath_slot_t *dst, const float *src, int n);
+
+/**
+ * @brief Convert slots into an array of floats, on the CPU
+ *
+ * @param dst       Output array
+ * @param src       Input array
+ * @param n         Number of floats
+ */
+void vecmath_to_floats(float *dst, const vecmath_slot_t *src, int n);
+
+/**
+ * @brief Convert a matrix of floats into RSP format, on the CPU
+ *
+ * @param dst       Output matrix
+ * @param m         Input matrix, by columns (as in OpenGL)
+ */
+void vecmath_mtx_from_floats(vecmath_mtx_t *dst, const float m[16]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
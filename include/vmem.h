@@ -0,0 +1,119 @@
+/**
+ * @file vmem.h
+ * @brief Virtual memory mappings via TLB
+ * @ingroup lowlevel
+ *
+ * This module uses the VR4300 TLB to map files in ROM (or buffers in RDRAM)
+ * into ranges of virtual memory. Pages are loaded on demand: the first access
+ * to a page triggers a TLB miss, and the exception handler reads the page
+ * from ROM via PI DMA into a physical frame, evicting the oldest page if all
+ * the frames are in use. This allows read-only access to data sets larger than
+ * RDRAM, with no manual streaming code:
+ *
+ * @code{.c}
+ *      // 16 frames of 2x16 KiB each: 512 KiB of RDRAM
+ *      vmem_init(16*1024, 16);
+ *
+ *      int size;
+ *      const uint8_t *map = vmem_map_rom("rom:/world.dat", &size);
+ *      // Any byte of the file can now be accessed directly
+ *      uint8_t tile = map[tile_offset];
+ * @endcode
+ *
+ * Each TLB entry maps two consecutive pages, so the unit of loading (a
+ * "frame") is made of two pages. Mappings of ROM files are read-only: a
+ * store to them triggers a TLB exception, that is reported as a crash.
+ *
+ * Page faults are served within the exception handler with interrupts
+ * disabled, and each of them blocks the CPU for the time of the PI DMA of a
+ * frame. It is thus important to choose a page size that matches the access
+ * pattern: larger pages reduce the number of faults for sequential accesses,
+ * while smaller pages waste less bandwidth for sparse accesses.
+ *
+ * This module owns the whole TLB: it should not be used together with other
+ * code that programs TLB entries.
+ */
+#ifndef __LIBDRAGON_VMEM_H
+#define __LIBDRAGON_VMEM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Maximum number of frames (one per TLB entry) */
+#define VMEM_MAX_FRAMES         32
+
+/** @brief Statistics of the virtual memory subsystem (see #vmem_get_stats) */
+typedef struct {
+    uint32_t faults;            ///< Number of page faults served
+    uint32_t bytes_loaded;      ///< Number of bytes loaded from ROM by the page faults
+    uint32_t evictions;         ///< Number of frames evicted to serve a page fault
+} vmem_stats_t;
+
+/**
+ * @brief Initialize the virtual memory subsystem
+ *
+ * Allocates the physical frames used to hold the pages of the ROM
+ * mappings. Each frame is made of two pages, so the total memory allocated
+ * is page_size * 2 * num_frames.
+ *
+ * @param page_size     Size of a page in bytes (4 KiB, 16 KiB, 64 KiB, 256 KiB or 1 MiB)
+ * @param num_frames    Number of frames (from 1 to #VMEM_MAX_FRAMES)
+ */
+void vmem_init(int page_size, int num_frames);
+
+/**
+ * @brief Close the virtual memory subsystem
+ *
+ * All the mappings are removed, and the frames are freed.
+ */
+void vmem_close(void);
+
+/**
+ * @brief Map a file in ROM into virtual memory
+ *
+ * The file must be stored uncompressed in DragonFS. Its contents are loaded
+ * on demand, when accessed through the returned pointer.
+ *
+ * @param fn        Filename to map (eg: "rom:/world.dat")
+ * @param size      If not NULL, this will be filled with the size of the file
+ * @return          Pointer to the start of the mapping (read-only)
+ */
+const void *vmem_map_rom(const char *fn, int *size);
+
+/**
+ * @brief Map a buffer in RDRAM into virtual memory
+ *
+ * The returned range is an alias of the buffer: accessing it reads and
+ * writes the buffer itself, with no copy and no need of cache maintenance
+ * between the two addresses. The buffer must be aligned to twice the page
+ * size. This does not use any frame, but it still shares the TLB entries
+ * with the ROM mappings.
+ *
+ * @param buf       Buffer to map
+ * @param size      Size of the buffer in bytes
+ * @return          Pointer to the start of the mapping
+ */
+void *vmem_map_ram(void *buf, int size);
+
+/**
+ * @brief Remove a mapping
+ *
+ * @param ptr       Pointer returned by #vmem_map_rom or #vmem_map_ram
+ */
+void vmem_unmap(const void *ptr);
+
+/**
+ * @brief Get the statistics of the virtual memory subsystem
+ *
+ * @param[out] stats    Filled with the statistics
+ */
+void vmem_get_stats(vmem_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -24,6 +24,17 @@ extern "C" {
  * 
  * Use #wav64_play to playback. For more advanced usage, call directly the
  * mixer functions, accessing the #wave structure field.
+ *
+ * Samples can be stored either raw, compressed with ADPCM (about 3.5x
+ * smaller), or compressed with a lossy MDCT transform codec meant for music
+ * streams (about 11x smaller at the default bitrate). See audioconv64
+ * --wav-compress. Compressed samples are decoded by the RSP, right before
+ * mixing; for MDCT, the CPU parses the bitstream and the RSP runs the
+ * inverse transform.
+ *
+ * Uncompressed samples can also be stored in a sample bank shared with other
+ * WAV64 and XM64 files (see audioconv64 --bank). In this case, the bank must be
+ * opened with #wav64_bank_open before opening the WAV64 file.
  */
 typedef struct {
 	/** @brief #waveform_t for this WAV64. 
@@ -34,6 +45,24 @@ typedef struct {
 
 	/** @brief Absolute ROM address of WAV64 */
 	uint32_t rom_addr;
+
+	/** @brief Format of the samples (raw, ADPCM, MDCT or raw in a sample bank) */
+	int format;
+
+	/** @brief ADPCM: decoder history (y1:y2) at #adpcm_loop_pos, per channel */
+	uint32_t adpcm_loop_hist[2];
+
+	/** @brief ADPCM: position of the loop start encoded in the file */
+	int adpcm_loop_pos;
+
+	/** @brief ADPCM: number of decodable samples, including trailing padding */
+	int adpcm_len;
+
+	/** @brief MDCT: size of a compressed frame (all channels) in bytes */
+	int mdct_frame_bytes;
+
+	/** @brief MDCT: number of decodable samples, including trailing padding */
+	int mdct_len;
 } wav64_t;
 
 /** @brief Open a WAV64 file for playback.
@@ -47,6 +76,19 @@ typedef struct {
  */ 
 void wav64_open(wav64_t *wav, const char *fn);
 
+/** @brief Open a sample bank.
+ * 
+ * Sample banks are created by audioconv64 (--bank) and contain the samples of
+ * WAV64 and XM64 files, with identical waveforms stored only once. A bank must
+ * be opened before any WAV64 or XM64 file referring to it. Opening the same bank
+ * multiple times has no effect. Banks are meant to stay open for the whole
+ * life of the application.
+ * 
+ * @param   fn          Filename of the bank (with filesystem prefix). Currently,
+ *                      only files on DFS ("rom:/") are supported.
+ */
+void wav64_bank_open(const char *fn);
+
 /** @brief Configure a WAV64 file for looping playback. */
 void wav64_set_loop(wav64_t *wav, bool loop);
 
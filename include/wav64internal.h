@@ -4,12 +4,15 @@
 #define WAV64_ID            "WV64"
 #define WAV64_FILE_VERSION  2
 #define WAV64_FORMAT_RAW    0
+#define WAV64_FORMAT_ADPCM  1
+#define WAV64_FORMAT_MDCT   2
+#define WAV64_FORMAT_BANK   3
 
 /** @brief Header of a WAV64 file. */
 typedef struct __attribute__((packed)) {
 	char id[4];             ///< ID of the file (WAV64_ID)
 	int8_t version;         ///< Version of the file (WAV64_FILE_VERSION)
-	int8_t format;          ///< Format of the file (WAV64_FORMAT_RAW)
+	int8_t format;          ///< Format of the file (WAV64_FORMAT_RAW, WAV64_FORMAT_ADPCM, WAV64_FORMAT_MDCT or WAV64_FORMAT_BANK)
 	int8_t channels;        ///< Number of interleaved channels
 	int8_t nbits;           ///< Width of sample in bits (8 or 16)
 	int32_t freq;           ///< Default playback frequency
@@ -20,6 +23,177 @@ typedef struct __attribute__((packed)) {
 
 _Static_assert(sizeof(wav64_header_t) == 24, "invalid wav64_header size");
 
+/**
+ * @brief WAV64 ADPCM compression (WAV64_FORMAT_ADPCM).
+ *
+ * Samples are always 16-bit, and are grouped in frames of
+ * #WAV64_ADPCM_FRAME_SAMPLES samples. Each frame contains one block per
+ * channel (left first), and each block is #WAV64_ADPCM_BLOCK_BYTES bytes:
+ *
+ *  * One header byte: bits 4-7 are the residual shift (0-12), bits 0-1
+ *    select one of the fixed predictors (see #wav64_adpcm_predict).
+ *  * 8 bytes of 4-bit signed residuals, high nibble first.
+ *
+ * Each sample is decoded as `clamp16(predict(y1, y2) + (residual << shift))`,
+ * where y1 and y2 are the two previous decoded samples of the same channel.
+ * The predictors only use shifts and adds, so that the decoder can run
+ * on the RSP scalar unit (see rsp_wav64_adpcm.S).
+ *
+ * The file header is followed by a #wav64_header_adpcm_t. After the
+ * last frame, the file contains silent frames to cover the mixer overread.
+ */
+#define WAV64_ADPCM_FRAME_SAMPLES   16
+#define WAV64_ADPCM_BLOCK_BYTES     9
+
+/** @brief Extra header of a WAV64 file in ADPCM format. */
+typedef struct __attribute__((packed)) {
+	int16_t loop_hist[2][2];  ///< Decoder history (y1, y2) at the loop start, for each channel
+} wav64_header_adpcm_t;
+
+_Static_assert(sizeof(wav64_header_adpcm_t) == 8, "invalid wav64_header_adpcm size");
+
+/** @brief Compute the prediction of a WAV64 ADPCM predictor */
+static inline int wav64_adpcm_predict(int filter, int y1, int y2) {
+	switch (filter) {
+	default:
+	case 0: return 0;
+	case 1: return y1 - (y1 >> 4);                                      // 0.9375*y1
+	case 2: return y1 + (y1 >> 1) + (y1 >> 2) - y2 + (y2 >> 3) + (y2 >> 4); // 1.75*y1 - 0.8125*y2
+	case 3: return y1 + (y1 >> 1) - y2 + (y2 >> 3);                     // 1.5*y1 - 0.875*y2
+	}
+}
+
+/** @brief Decode a WAV64 ADPCM sample, given the prediction and the residual */
+static inline int wav64_adpcm_sample(int pred, int residual, int shift) {
+	int y = pred + residual * (1 << shift);
+	if (y > 32767) y = 32767;
+	if (y < -32768) y = -32768;
+	return y;
+}
+
+/**
+ * @brief WAV64 MDCT compression (WAV64_FORMAT_MDCT).
+ *
+ * This is a perceptual transform codec, meant for long music streams. Samples
+ * are always 16-bit. The signal is transformed with a MDCT of
+ * #WAV64_MDCT_FRAME_SAMPLES coefficients, using a sine window of twice that
+ * size (50% overlap between frames). The signal is prefixed with
+ * #WAV64_MDCT_FRAME_SAMPLES samples of silence, so frame N (N >= 1) completes
+ * the output samples [(N-1)*256, N*256), together with frame N-1.
+ *
+ * All frames have the same size in bytes (see #wav64_header_mdct_t), so that
+ * the player can seek anywhere. Each frame contains one bitstream per channel
+ * (left first), read MSB-first, and padded with zeros to the frame size.
+ * Coefficients are grouped in #WAV64_MDCT_BANDS bands (#wav64_mdct_band_edges).
+ * For each channel:
+ *
+ *  * For each band, 1 bit that tells whether the band is coded, followed
+ *    (if set) by 3 bits of Rice parameter (k) for the coefficients.
+ *  * For each coded band, the scale factor (sf) of the band: 6 bits for the
+ *    first coded band, and then the difference with the previous
+ *    one as signed exp-Golomb code.
+ *  * For each coded band, the coefficients: Rice code of the absolute value
+ *    (unary quotient, then k bits), followed by the sign bit if not zero.
+ *    A quotient of #WAV64_MDCT_RICE_ESCAPE ones is followed by the absolute
+ *    value as 16 bits.
+ *
+ * Each coefficient is decoded as `value * wav64_mdct_step(sf)`; the
+ * coefficients of uncoded bands are zero. The quantization steps are chosen
+ * by the encoder using a simple psychoacoustic model.
+ *
+ * Decoding is split between the CPU, that parses the bitstream (see
+ * wav64.c), and the RSP, that runs the inverse transform (rsp_wav64_mdct.S).
+ *
+ * The file header is followed by a #wav64_header_mdct_t. After the end of
+ * the waveform, the file contains enough frames to cover the mixer overread.
+ */
+#define WAV64_MDCT_FRAME_SAMPLES    256
+#define WAV64_MDCT_BANDS            20
+#define WAV64_MDCT_RICE_ESCAPE      15
+#define WAV64_MDCT_MAX_FRAME_BYTES  2048
+
+/** @brief Extra header of a WAV64 file in MDCT format. */
+typedef struct __attribute__((packed)) {
+	int16_t frame_bytes;      ///< Size of each frame in bytes (all channels)
+	int16_t reserved;         ///< Reserved for future use (0)
+	int32_t num_frames;       ///< Number of frames in the file
+} wav64_header_mdct_t;
+
+_Static_assert(sizeof(wav64_header_mdct_t) == 8, "invalid wav64_header_mdct size");
+
+/** @brief First coefficient of each MDCT band (and end of the last band) */
+static const uint16_t wav64_mdct_band_edges[WAV64_MDCT_BANDS+1] = {
+	0, 4, 8, 12, 16, 20, 24, 28, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256
+};
+
+/** @brief Quantization step corresponding to a MDCT scale factor (2^(sf/4)) */
+static inline float wav64_mdct_step(int sf) {
+	static const float frac[4] = { 1.0f, 1.18920712f, 1.41421356f, 1.68179283f };
+	return frac[sf & 3] * (float)(1 << (sf >> 2));
+}
+
+/**
+ * @brief WAV64 samples stored in a sample bank (WAV64_FORMAT_BANK).
+ *
+ * Samples are raw (as in WAV64_FORMAT_RAW), but they are not stored in the
+ * WAV64 file itself: the header is followed by a #wav64_header_bank_t which
+ * refers to an entry of a sample bank file. Sample banks are created by
+ * audioconv64 (--bank) to share identical waveforms across WAV64 and XM64
+ * files, so that they are stored only once in ROM.
+ *
+ * A sample bank file begins with a #wav64_bank_header_t, followed by
+ * the table of entries (#wav64_bank_entry_t), followed by the data of each
+ * entry, aligned to 8 bytes. The data of an entry is laid out exactly as the
+ * samples of a raw WAV64 file (including the mixer overread). An entry can be
+ * referred to by waveforms shorter than the entry itself, when their samples
+ * are a prefix of it.
+ */
+#define WAV64_BANK_ID           "BK64"
+#define WAV64_BANK_VERSION      1
+
+/** @brief Header of a sample bank file. */
+typedef struct __attribute__((packed)) {
+	char id[4];             ///< ID of the file (WAV64_BANK_ID)
+	int8_t version;         ///< Version of the file (WAV64_BANK_VERSION)
+	int8_t reserved[3];     ///< Reserved (zero)
+	uint32_t bank_id;       ///< Identifier of the bank, stored in referring files
+	int32_t num_entries;    ///< Number of entries in the bank
+} wav64_bank_header_t;
+
+_Static_assert(sizeof(wav64_bank_header_t) == 16, "invalid wav64_bank_header size");
+
+/** @brief Entry of a sample bank file. */
+typedef struct __attribute__((packed)) {
+	uint32_t offset;        ///< Offset of the data of the entry in the bank file
+	uint32_t size;          ///< Size of the data of the entry in bytes
+} wav64_bank_entry_t;
+
+_Static_assert(sizeof(wav64_bank_entry_t) == 8, "invalid wav64_bank_entry size");
+
+/** @brief Extra header of a WAV64 file in WAV64_FORMAT_BANK format. */
+typedef struct __attribute__((packed)) {
+	uint32_t bank_id;       ///< Identifier of the sample bank (see #wav64_bank_header_t)
+	int32_t index;          ///< Index of the entry within the bank
+} wav64_header_bank_t;
+
+_Static_assert(sizeof(wav64_header_bank_t) == 8, "invalid wav64_header_bank size");
+
+/**
+ * @brief Compute the identifier of a sample bank from its filename.
+ *
+ * The identifier is a hash of the filename (without directories), so that
+ * a file referring to a bank can check that the correct one was opened.
+ */
+static inline uint32_t wav64_bank_hash(const char *fn) {
+	const char *base = fn;
+	for (const char *p = fn; *p; p++)
+		if (*p == '/' || *p == '\\' || *p == ':') base = p+1;
+	uint32_t h = 2166136261u;
+	for (const char *p = base; *p; p++)
+		h = (h ^ (uint8_t)*p) * 16777619u;
+	return h ? h : 1;
+}
+
 typedef struct samplebuffer_s samplebuffer_t;
 
 /**
@@ -29,4 +203,18 @@ typedef struct samplebuffer_s samplebuffer_t;
  */  
 void raw_waveform_read(samplebuffer_t *sbuf, int base_rom_addr, int wpos, int wlen, int bps);
 
+/**
+ * @brief Get the ROM address of an entry of an open sample bank.
+ *
+ * Asserts if the bank is not open (see #wav64_bank_open), or if the entry does
+ * not exist or it is smaller than the requested size.
+ *
+ * @param   bank_id     Identifier of the bank
+ * @param   index       Index of the entry
+ * @param   size        Minimum size of the entry in bytes
+ * @param   fn          Filename of the file referring to the bank (used for errors)
+ * @return  ROM address of the data of the entry
+ */
+uint32_t wav64_bank_entry_addr(uint32_t bank_id, int index, int size, const char *fn);
+
 #endif
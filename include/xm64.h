@@ -31,6 +31,10 @@
  *   * XM64 contains also the precalculated amount of sample buffer memory
  *     required for playing back, per each channel. This allows for precise
  *     memory allocations even within the mixer.
+ *   * Waveforms can be stored in a sample bank shared with other XM64 and WAV64
+ *     files (see audioconv64 --bank), so that identical samples are stored only
+ *     once in ROM. In this case, the bank must be opened with #wav64_bank_open
+ *     before opening the XM64 file.
  */
 
 #ifndef __LIBDRAGON_AUDIO_XM64_H
@@ -27,10 +27,10 @@ extern "C" {
  * 
  * The YM format is a simple dump of the state of all registers of the AY
  * chip at a fixed time step. To playback, it is necessary to emulate the
- * AY PSG. The implementation has been carefully optimized for the N64 MIPS
- * CPU for high-performance, so that playback typically takes less than 5%
- * of CPU time, plus a few percents of RSP time for resampling and mixing
- * (done by the mixer).
+ * AY PSG. The emulation runs on the RSP, driven by the register dumps
+ * pushed by the CPU once per audioframe, so that playback takes a negligible
+ * amount of CPU time, plus a few percents of RSP time for the emulation,
+ * resampling and mixing (done by the mixer).
  * 
  * The YM64 is actually a valid YM file that has been simply normalized against
  * the different existing revisions, in a way to be efficient for reproduction
@@ -39,7 +39,10 @@ extern "C" {
  * 
  * The main conversion option to pay attention too is whether the output file
  * must be compressed or not. Compressed files are smaller but takes 18 KiB
- * more of RDRAM to be played back and cannot be seeked.
+ * more of RDRAM to be played back. audioconv64 compresses them in independent
+ * blocks of audioframes, so that they can be seeked quickly (decompression
+ * restarts from the block containing the requested position). Compressed YM
+ * files created by other tools cannot be seeked.
  * 
  * This player is dedicated to the late Sir Clive Sinclair whose computer,
  * powered by the AY-3-8910, helped popularize what we now call
@@ -60,9 +63,16 @@ typedef struct {
 
 	FILE *f;                  ///< Open file handle
 	void *decoder;            ///< Optional LHA decoder (compressed YM files)
+	uint32_t *blocks;         ///< Compressed files: data offset and size of each LHA member
+	int num_blocks;           ///< Compressed files: number of LHA members
+	int block_frames;         ///< Compressed files: number of audioframes per member
+	int cur_block;            ///< Compressed files: member being decompressed
+	int block_left;           ///< Compressed files: bytes left to decompress in the current member
 	int start_off;            ///< Starting offset of the first audio frame
 
 	AY8910 ay;                ///< AY8910 emulator
+	void *rsp_state;          ///< State of the RSP AY8910 emulator (uncached)
+	bool rsp_pending;         ///< True if there might be RSP commands in flight
 	uint8_t regs[16];         ///< Current cached value of the AY registers
 	uint32_t nframes;         ///< Number of YM audio frames
 	uint32_t chipfreq;        ///< Operating frequency of the AY chip
@@ -140,13 +150,15 @@ void ym64player_tell(ym64player_t *player, int *pos, float *secs);
  * @brief Seek to a specific position in the YM module.
  * 
  * The function seeks to a new absolute position expressed in ticks (internal
- * YM position). Notice that it's not possible to seek in a YM64 file that has
- * been compressed. audioconv64 compresses YM files by default.
+ * YM position). Seeking in a compressed YM64 file is possible only if it
+ * was compressed by audioconv64 (that splits it in independent blocks): in
+ * this case, the cost is bounded by the size of a block, independently of
+ * the position.
  * 
  * @param[in]	player 		YM64 player
  * @param[out] 	pos 		Absolute position in ticks
  * @return                  True if it was possible to seek, false if 
- *                          the file is compressed.
+ *                          the file is compressed without blocks.
  */
 bool ym64player_seek(ym64player_t *player, int pos);
 
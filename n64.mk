@@ -6,6 +6,13 @@ N64_ROM_TITLE = "Made with libdragon" # Override this with the name of your game
 N64_ROM_SAVETYPE = # Supported savetypes: none eeprom4k eeprom16 sram256k sram768k sram1m flashram
 N64_ROM_RTC = # Set to true to enable the Joybus Real-Time Clock
 N64_ROM_REGIONFREE = # Set to true to allow booting on any console region
+N64_ROM_COMPRESS = # Set to true to compress the code and data in ROM (decompressed at boot, less data to load)
+N64_HEAP_PROFILE = # Set to true to wrap the allocation functions for the heap profiler (see heap_profile.h)
+N64_CXX_LITE = # Set to true to build C++ code without exceptions and RTTI, with a smaller runtime (see cxxlite.cpp)
+N64_OVERLAYS = # List of code overlays: objects in $(BUILD_DIR)/NAME.ovl/ are linked in overlay NAME (see overlay.h)
+N64_HOT_FUNCTIONS = # File listing the hot functions, one per line (see n64prof --hot), laid out contiguously for I-cache locality
+N64_PGO = # Set to "generate" to build with profile counters (see gcov_dump.h), or "use" to optimize with the collected profile
+N64_PGO_DATA = gcov.bin # Profile stream dumped by gcov_dump_file/gcov_dump_usb, merged by "make pgo-use"
 
 # Override this to use a toolchain installed separately from libdragon
 N64_GCCPREFIX ?= $(N64_INST)
@@ -27,6 +34,11 @@ N64_OBJCOPY = $(N64_GCCPREFIX_TRIPLET)objcopy
 N64_OBJDUMP = $(N64_GCCPREFIX_TRIPLET)objdump
 N64_SIZE = $(N64_GCCPREFIX_TRIPLET)size
 N64_NM = $(N64_GCCPREFIX_TRIPLET)nm
+N64_GCOV_TOOL = $(N64_GCCPREFIX_TRIPLET)gcov-tool
+
+# Print the IMEM/DMEM usage of a RSP ucode, from the output of "size -A -d".
+# Overlays include the rspq code and data, so this is the space left to them.
+N64_RSP_USAGE = awk '$$1 == ".text" { imem = $$2 } ($$1 == ".data" || $$1 == ".bss") && $$2 > 0 { e = $$3 % 4096 + $$2; if (e > dmem) dmem = e } END { printf "          IMEM: %4d/4096 bytes (%d free), DMEM: %4d/4096 bytes (%d free)\n", imem, 4096 - imem, dmem, 4096 - dmem }'
 
 N64_CHKSUM = $(N64_BINDIR)/chksum64
 N64_ED64ROMCONFIG = $(N64_BINDIR)/ed64romconfig
@@ -39,13 +51,19 @@ N64_C_AND_CXX_FLAGS =  -march=vr4300 -mtune=vr4300 -I$(N64_INCLUDEDIR)
 N64_C_AND_CXX_FLAGS += -falign-functions=32   # NOTE: if you change this, also change backtrace() in backtrace.c
 N64_C_AND_CXX_FLAGS += -ffunction-sections -fdata-sections -g -ffile-prefix-map="$(CURDIR)"=
 N64_C_AND_CXX_FLAGS += -DN64 -O2 -Wall -Werror -Wno-error=deprecated-declarations -fdiagnostics-color=always
+N64_C_AND_CXX_FLAGS += $(if $(filter generate,$(N64_PGO)),-fprofile-generate -fprofile-info-section -fprofile-update=single)
+N64_C_AND_CXX_FLAGS += $(if $(filter use,$(N64_PGO)),-fprofile-use -fprofile-partial-training -Wno-missing-profile -Wno-error=coverage-mismatch)
 N64_CFLAGS = $(N64_C_AND_CXX_FLAGS) -std=gnu99
 N64_CXXFLAGS = $(N64_C_AND_CXX_FLAGS)
+N64_CXXFLAGS += $(if $(N64_CXX_LITE),-fno-exceptions -fno-rtti -fno-threadsafe-statics -fno-asynchronous-unwind-tables)
 N64_ASFLAGS = -mtune=vr4300 -march=vr4300 -Wa,--fatal-warnings -I$(N64_INCLUDEDIR)
 N64_RSPASFLAGS = -march=mips1 -mabi=32 -Wa,--fatal-warnings -I$(N64_INCLUDEDIR)
-N64_LDFLAGS = -g -L$(N64_LIBDIR) -ldragon -lm -ldragonsys -Tn64.ld --gc-sections --wrap __do_global_ctors
+N64_LDFLAGS = -g $(if $(N64_OVERLAYS)$(strip $(N64_HOT_FUNCTIONS)),-L$(BUILD_DIR)) -L$(N64_LIBDIR) -ldragon -lm -ldragonsys -Tn64.ld --gc-sections --wrap __do_global_ctors
+N64_LDFLAGS += $(if $(N64_HEAP_PROFILE),--wrap malloc --wrap calloc --wrap realloc --wrap memalign --wrap free)
+N64_LDFLAGS += $(if $(N64_CXX_LITE),-ldragoncxxlite)
+N64_LDFLAGS += $(if $(filter generate,$(N64_PGO)),--undefined=__gcov_info_to_gcda --undefined=__gcov_filename_to_gcfn -lgcov)
 
-N64_TOOLFLAGS = --header $(N64_HEADERPATH) --title $(N64_ROM_TITLE)
+N64_TOOLFLAGS = --header $(N64_HEADERPATH) --title $(N64_ROM_TITLE) $(if $(N64_ROM_COMPRESS),--compress)
 N64_ED64ROMCONFIGFLAGS =  $(if $(N64_ROM_SAVETYPE),--savetype $(N64_ROM_SAVETYPE))
 N64_ED64ROMCONFIGFLAGS += $(if $(N64_ROM_RTC),--rtc) 
 N64_ED64ROMCONFIGFLAGS += $(if $(N64_ROM_REGIONFREE),--regionfree)
@@ -81,9 +99,9 @@ RSPASFLAGS+=-MMD
 	@rm -f $@
 	DFS_FILE="$(filter %.dfs, $^)"; \
 	if [ -z "$$DFS_FILE" ]; then \
-		$(N64_TOOL) $(N64_TOOLFLAGS) --toc --output $@ $<.bin --align 8 $<.sym; \
+		$(N64_TOOL) $(N64_TOOLFLAGS) --toc --layout --output $@ $<.bin --align 8 $<.sym; \
 	else \
-		$(N64_TOOL) $(N64_TOOLFLAGS) --toc --output $@ $<.bin --align 8 $<.sym --align 16 "$$DFS_FILE"; \
+		$(N64_TOOL) $(N64_TOOLFLAGS) --toc --layout --output $@ $<.bin --align 8 $<.sym --align 16 "$$DFS_FILE"; \
 	fi
 	if [ ! -z "$(strip $(N64_ED64ROMCONFIGFLAGS))" ]; then \
 		$(N64_ED64ROMCONFIG) $(N64_ED64ROMCONFIGFLAGS) $@; \
@@ -97,7 +115,7 @@ RSPASFLAGS+=-MMD
 %.dfs:
 	@mkdir -p $(dir $@)
 	@echo "    [DFS] $@"
-	$(N64_MKDFS) $@ $(<D) >/dev/null
+	$(N64_MKDFS) $(MKDFS_FLAGS) --cache $@.cache $@ $(<D) >/dev/null
 
 # Assembly rule. We use .S for both RSP and MIPS assembly code, and we differentiate
 # using the prefix of the filename: if it starts with "rsp", it is RSP ucode, otherwise
@@ -128,7 +146,7 @@ $(BUILD_DIR)/%.o: $(SOURCE_DIR)/%.S
 				--redefine-sym _binary_$${SYMPREFIX}_data_bin_size=$${FILENAME}_data_size \
 				--set-section-alignment .data=8 \
 				--rename-section .text=.data $$DATASECTION.bin $$DATASECTION.o; \
-		$(N64_SIZE) -G $$BINARY; \
+		$(N64_SIZE) -A -d $$BINARY | $(N64_RSP_USAGE); \
 		$(N64_LD) -relocatable $$TEXTSECTION.o $$DATASECTION.o -o $@; \
 		rm $$TEXTSECTION.bin $$DATASECTION.bin $$TEXTSECTION.o $$DATASECTION.o; \
 	else \
@@ -146,14 +164,49 @@ $(BUILD_DIR)/%.o: $(SOURCE_DIR)/%.cpp
 	@echo "    [CXX] $<"
 	$(CXX) -c $(CXXFLAGS) -o $@ $<
 
-%.elf: $(N64_LIBDIR)/libdragon.a $(N64_LIBDIR)/libdragonsys.a $(N64_LIBDIR)/n64.ld
+%.elf: $(N64_LIBDIR)/libdragon.a $(N64_LIBDIR)/libdragonsys.a $(N64_LIBDIR)/n64.ld $(N64_HOT_FUNCTIONS)
 	@mkdir -p $(dir $@)
 	@echo "    [LD] $@"
+# With overlays, generate the linker script fragment describing them. It is
+# found via -L$(BUILD_DIR) before the default (empty) one in N64_LIBDIR.
+	if [ -n "$(strip $(N64_OVERLAYS))" ]; then \
+		( echo "OVERLAY : AT (__data_end) {"; \
+		  for ovl in $(N64_OVERLAYS); do \
+			echo "    .ovl_$$ovl { */$$ovl.ovl/*.o(.text .text.* .rodata .rodata.* .data .data.*) . = ALIGN(16); }"; \
+		  done; \
+		  echo "} > mem"; \
+		  echo "__overlay_load_end = __load_stop_ovl_$(lastword $(N64_OVERLAYS));" ) > $(BUILD_DIR)/n64_overlays.ld; \
+	fi
+# With a list of hot functions, generate the fragment that places their
+# sections first (see n64.ld), in the same way.
+	if [ -n "$(strip $(N64_HOT_FUNCTIONS))" ]; then \
+		sed -n -e 's/^[[:space:]]*\([^[:space:]#][^[:space:]]*\).*$$/        *(EXCLUDE_FILE(*.ovl\/*.o) .text.\1 .text.hot.\1)/p' \
+			$(N64_HOT_FUNCTIONS) > $(BUILD_DIR)/n64_hot.ld; \
+	else \
+		rm -f $(BUILD_DIR)/n64_hot.ld; \
+	fi
 # We always use g++ to link except for ucode because of the inconsistencies
 # between ld when it comes to global ctors dtors. Also see __do_global_ctors
-	$(CXX) -o $@ $(filter-out $(N64_LIBDIR)/n64.ld,$^) -lc $(patsubst %,-Wl$(COMMA)%,$(LDFLAGS)) -Wl,-Map=$(BUILD_DIR)/$(notdir $(basename $@)).map
+	$(CXX) -o $@ $(filter-out $(N64_LIBDIR)/n64.ld $(N64_HOT_FUNCTIONS),$^) -lc $(patsubst %,-Wl$(COMMA)%,$(LDFLAGS)) -Wl,-Map=$(BUILD_DIR)/$(notdir $(basename $@)).map
 	$(N64_SIZE) -G $@
 
+# Profile-guided optimization (see gcov_dump.h). These targets rebuild the
+# default goal of the project. They must not become the default goal themselves.
+__N64_DEFAULT_GOAL := $(.DEFAULT_GOAL)
+
+.PHONY: pgo-generate pgo-use
+pgo-generate:
+	$(MAKE) -B N64_PGO=generate
+
+# Merge the profile into the .gcda files next to the objects, then rebuild
+# everything with it (without cleaning, as that would remove the .gcda files)
+pgo-use:
+	@echo "    [PGO] $(strip $(N64_PGO_DATA))"
+	$(N64_GCOV_TOOL) merge-stream $(N64_PGO_DATA)
+	$(MAKE) -B N64_PGO=use
+
+.DEFAULT_GOAL := $(__N64_DEFAULT_GOAL)
+
 ifneq ($(V),1)
 .SILENT:
 endif
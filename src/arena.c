@@ -0,0 +1,114 @@
+/**
+ * @file arena.c
+ * @brief Arena allocator
+ * @ingroup lowlevel
+ */
+
+#include "arena.h"
+#include "n64sys.h"
+#include "debug.h"
+#include <malloc.h>
+#include <string.h>
+
+/** @brief Check whether an address is in the uncached segment (KSEG1) */
+#define IS_UNCACHED(addr)       (((uint32_t)(addr) & 0xE0000000) == 0xA0000000)
+
+void arena_init(arena_t *arena, int size)
+{
+    void *buffer = memalign(16, size);
+    assertf(buffer, "arena_init: out of memory (%d bytes)", size);
+    arena_init_buffer(arena, buffer, size);
+    arena->flags |= ARENA_FLAGS_OWNEDBUFFER;
+}
+
+void arena_init_uncached(arena_t *arena, int size)
+{
+    void *buffer = malloc_uncached_aligned(16, size);
+    assertf(buffer, "arena_init_uncached: out of memory (%d bytes)", size);
+    arena_init_buffer(arena, buffer, size);
+    arena->flags |= ARENA_FLAGS_OWNEDBUFFER;
+}
+
+void arena_init_buffer(arena_t *arena, void *buffer, int size)
+{
+    assert(buffer != NULL && size >= 0);
+    memset(arena, 0, sizeof(arena_t));
+    arena->buffer = buffer;
+    arena->size = size;
+    if (IS_UNCACHED(buffer))
+        arena->flags |= ARENA_FLAGS_UNCACHED;
+}
+
+void arena_close(arena_t *arena)
+{
+    if (arena->flags & ARENA_FLAGS_OWNEDBUFFER) {
+        if (arena->flags & ARENA_FLAGS_UNCACHED)
+            free_uncached(arena->buffer);
+        else
+            free(arena->buffer);
+    }
+    memset(arena, 0, sizeof(arena_t));
+}
+
+void *arena_alloc_aligned(arena_t *arena, int align, int size)
+{
+    assertf(align > 0 && (align & (align-1)) == 0, "invalid alignment: %d", align);
+    assert(size >= 0);
+
+    // Align the absolute address, as the buffer itself might be less aligned
+    uint32_t base = (uint32_t)arena->buffer;
+    uint32_t start = ((base + arena->used + align - 1) & ~(align - 1)) - base;
+    if (start > arena->size || arena->size - start < (uint32_t)size)
+        return NULL;
+
+    arena->used = start + size;
+    if (arena->used > arena->peak)
+        arena->peak = arena->used;
+    return arena->buffer + start;
+}
+
+void *arena_alloc(arena_t *arena, int size)
+{
+    return arena_alloc_aligned(arena, 16, size);
+}
+
+void *arena_alloc_uncached(arena_t *arena, int align, int size)
+{
+    if (arena->flags & ARENA_FLAGS_UNCACHED)
+        return arena_alloc_aligned(arena, align, size);
+
+    // Allocate full cachelines, so that no other allocation shares them:
+    // otherwise, writing back the other allocation would overwrite data
+    // written via the uncached pointer.
+    if (align < 16) align = 16;
+    size = (size + 15) & ~15;
+    void *mem = arena_alloc_aligned(arena, align, size);
+    if (!mem)
+        return NULL;
+
+    data_cache_hit_invalidate(mem, size);
+    return UncachedAddr(mem);
+}
+
+arena_mark_t arena_mark(arena_t *arena)
+{
+    return arena->used;
+}
+
+void arena_reset(arena_t *arena, arena_mark_t mark)
+{
+    assertf(mark <= arena->used, "arena_reset: invalid mark %ld (used: %ld)", mark, arena->used);
+    arena->used = mark;
+}
+
+void arena_clear(arena_t *arena)
+{
+    arena_reset(arena, 0);
+}
+
+bool arena_contains(arena_t *arena, const void *ptr)
+{
+    uint8_t *p = CachedAddr(ptr);
+    uint8_t *buf = CachedAddr(arena->buffer);
+    return p >= buf && p < buf + arena->size;
+}
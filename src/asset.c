@@ -2,17 +2,22 @@
 #include "asset_internal.h"
 #include "compress/lzh5_internal.h"
 #include "compress/lz4_dec_internal.h"
+#include "compress/lzb_dec_internal.h"
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <stdalign.h>
+#include "utils.h"
 
 #ifdef N64
 #include <malloc.h>
 #include "debug.h"
 #include "n64sys.h"
+#include "interrupt.h"
 #include "dma.h"
 #include "dragonfs.h"
+#include "rspq.h"
+#include "timer.h"
 #else
 #include <stdlib.h>
 #include <assert.h>
@@ -23,10 +28,10 @@
 /** 
  * @brief Compression algorithms
  * 
- * Only level 1 (LZ4) is always initialized. The other algorithm (LZH5)
- * must be initialized manually via #asset_init_compression.
+ * Only level 1 (LZ4) is always initialized. The other algorithms (LZH5
+ * and LZB) must be initialized manually via #asset_init_compression.
  */
-static asset_compression_t algos[2] = {
+static asset_compression_t algos[3] = {
     {
         .state_size = DECOMPRESS_LZ4_STATE_SIZE,
         .decompress_init = decompress_lz4_init,
@@ -42,9 +47,49 @@ void __asset_init_compression_lvl2(void)
         .decompress_init = decompress_lzh5_init,
         .decompress_read = decompress_lzh5_read,
         .decompress_full = decompress_lzh5_full,
+        .decompress_full_inplace = decompress_lzh5_full_inplace,
     };
 }
 
+void __asset_init_compression_lvl3(void)
+{
+    algos[2] = (asset_compression_t){
+        .state_size = DECOMPRESS_LZB_STATE_SIZE,
+        .decompress_init = decompress_lzb_init,
+        .decompress_read = decompress_lzb_read,
+        .decompress_full = decompress_lzb_full,
+    };
+}
+
+asset_compression_t *__asset_get_compression(int algo)
+{
+    if (algo < 1 || algo > 3 || !algos[algo-1].decompress_init)
+        return NULL;
+    return &algos[algo-1];
+}
+
+/** @brief Contents of a file prefetched in RAM (see #asset_prefetch) */
+typedef struct asset_prefetch_s {
+    struct asset_prefetch_s *next;  ///< Next prefetched file (in order of request)
+    char *fn;                       ///< Filename
+    uint8_t *buf;                   ///< Contents of the file
+    int size;                       ///< Size of the file
+    int bufsize;                    ///< Size of the buffer (accounted in the cache)
+    volatile bool done;             ///< True when the DMA transfer is finished
+} asset_prefetch_t;
+
+#ifdef N64
+static asset_stats_t *asset_stats_get(const char *fn, int algo, int cmp_size, int size);
+static asset_prefetch_t *asset_prefetch_take(const char *fn);
+static void asset_prefetch_free(asset_prefetch_t *pf);
+#define ASSET_TICKS_READ()      TICKS_READ()
+#else
+#define asset_stats_get(...)    ((asset_stats_t*)NULL)
+#define asset_prefetch_take(fn) ((asset_prefetch_t*)NULL)
+#define asset_prefetch_free(pf) ((void)(pf))
+#define ASSET_TICKS_READ()      0
+#endif
+
 FILE *must_fopen(const char *fn)
 {
     FILE *f = fopen(fn, "rb");
@@ -71,10 +116,91 @@ FILE *must_fopen(const char *fn)
     return f;
 }
 
-void *asset_load(const char *fn, int *sz)
+/** @brief Read the in-place decompression margin, if present (file must be positioned after the header) */
+static uint32_t asset_read_margin(FILE *f, asset_header_t *header)
+{
+    uint32_t margin = 0;
+    if (header->flags & ASSET_FLAG_INPLACE) {
+        fread(&margin, 4, 1, f);
+        #ifndef N64
+        margin = __builtin_bswap32(margin);
+        #endif
+    }
+    return margin;
+}
+
+/** @brief Read the block index of a seekable asset (file must be positioned after the header) */
+static asset_index_t *asset_read_index(FILE *f)
+{
+    uint32_t hdr[2];
+    fread(hdr, 4, 2, f);
+    #ifndef N64
+    hdr[0] = __builtin_bswap32(hdr[0]);
+    hdr[1] = __builtin_bswap32(hdr[1]);
+    #endif
+
+    asset_index_t *index = malloc(sizeof(asset_index_t) + hdr[1] * sizeof(uint32_t));
+    index->block_size = hdr[0];
+    index->num_blocks = hdr[1];
+    index->data_offset = sizeof(asset_header_t) + (2 + hdr[1]) * sizeof(uint32_t);
+    fread(index->cmp_offset, sizeof(uint32_t), index->num_blocks, f);
+    #ifndef N64
+    for (int i = 0; i < index->num_blocks; i++)
+        index->cmp_offset[i] = __builtin_bswap32(index->cmp_offset[i]);
+    #endif
+    return index;
+}
+
+/** @brief Load a full seekable asset, decompressing one block at a time */
+static void *asset_load_seekable(const char *fn, FILE *f, asset_compression_t *algo, int size)
+{
+    asset_index_t *index = asset_read_index(f);
+    #ifdef N64
+    void *state = malloc(algo->state_size);
+    #else
+    // state_size is computed for the N64 ABI: leave some slack for
+    // 64-bit hosts (eg: mkasset), where pointers are bigger.
+    void *state = malloc(algo->state_size + 256);
+    #endif
+    uint8_t *s = memalign(16, size);
+    assertf(s, "asset_load: out of memory");
+
+    for (int i = 0; i < index->num_blocks; i++) {
+        int pos = i * index->block_size;
+        int len = MIN((int)index->block_size, size - pos);
+
+        fseek(f, index->data_offset + index->cmp_offset[i], SEEK_SET);
+        algo->decompress_init(state, f);
+        while (len > 0) {
+            int n = algo->decompress_read(state, s + pos, len);
+            assertf(n > 0, "asset: decompression error on file %s: corrupted? (block %d)", fn, i);
+            pos += n;
+            len -= n;
+        }
+    }
+
+    free(state);
+    free(index);
+    return s;
+}
+
+/**
+ * @brief Implementation of #asset_load
+ * 
+ * If @p compressed is not NULL, it is set to true if the file was
+ * decompressed, that is if the whole buffer was written by the CPU.
+ */
+static void *asset_load_ex(const char *fn, int *sz, bool *compressed)
 {
     uint8_t *s; int size;
-    FILE *f = must_fopen(fn);
+    uint32_t t0 = ASSET_TICKS_READ();
+    asset_stats_t *stats;
+
+    // If the file was prefetched, read it from RAM. The decompressors are
+    // then passed no filename, so that they don't read it again from ROM.
+    asset_prefetch_t *pf = asset_prefetch_take(fn);
+    FILE *f = pf ? fmemopen(pf->buf, pf->size, "rb") : must_fopen(fn);
+    const char *src_fn = pf ? NULL : fn;
    
     // Check if file is compressed
     asset_header_t header;
@@ -92,13 +218,28 @@ void *asset_load(const char *fn, int *sz)
         header.orig_size = __builtin_bswap32(header.orig_size);
         #endif
 
-        assertf(header.algo >= 1 || header.algo <= 2,
+        assertf(header.algo >= 1 && header.algo <= 3,
             "unsupported compression algorithm: %d", header.algo);
         assertf(algos[header.algo-1].decompress_full, 
             "asset: compression level %d not initialized. Call asset_init_compression(%d) at initialization time", header.algo, header.algo);
 
         size = header.orig_size;
-        s = algos[header.algo-1].decompress_full(fn, f, header.cmp_size, size);
+        uint32_t margin = asset_read_margin(f, &header);
+        uint32_t t1 = ASSET_TICKS_READ();
+        if (header.flags & ASSET_FLAG_SEEKABLE)
+            s = asset_load_seekable(fn, f, &algos[header.algo-1], size);
+        else if ((header.flags & ASSET_FLAG_INPLACE) && algos[header.algo-1].decompress_full_inplace)
+            s = algos[header.algo-1].decompress_full_inplace(src_fn, f, header.cmp_size, size, margin);
+        else
+            s = algos[header.algo-1].decompress_full(src_fn, f, header.cmp_size, size);
+        if (compressed) *compressed = true;
+
+        // Decompressors read the compressed data by themselves (possibly
+        // racing with the DMA), so all that time is accounted as decompression.
+        if ((stats = asset_stats_get(fn, header.algo, header.cmp_size, size))) {
+            stats->ticks_io += t1 - t0;
+            stats->ticks_decompress += ASSET_TICKS_READ() - t1;
+        }
     } else {
         // Allocate a buffer big enough to hold the file.
         // We force a 16-byte alignment for the buffer so that it's cacheline aligned.
@@ -110,18 +251,301 @@ void *asset_load(const char *fn, int *sz)
 
         fseek(f, 0, SEEK_SET);
         fread(s, 1, size, f);
+        if (compressed) *compressed = false;
+
+        if ((stats = asset_stats_get(fn, 0, size, size)))
+            stats->ticks_io += ASSET_TICKS_READ() - t0;
     }
 
     fclose(f);
+    asset_prefetch_free(pf);
     if (sz) *sz = size;
     return s;
 }
 
+void *asset_load(const char *fn, int *sz)
+{
+    return asset_load_ex(fn, sz, NULL);
+}
+
 #ifdef N64
 
+/** @brief Size of the VR4300 data cache (direct-mapped, 16-byte lines) */
+#define ASSET_DCACHE_SIZE           (8*1024)
+
+void *asset_load_writeback(const char *fn, int *sz)
+{
+    int size; bool compressed;
+    uint8_t *s = asset_load_ex(fn, &size, &compressed);
+
+    if (compressed && size > ASSET_DCACHE_SIZE) {
+        // The decompressors write the output sequentially. The VR4300 data
+        // cache is direct-mapped, so writing a line evicts (and thus writes
+        // back) any line ASSET_DCACHE_SIZE bytes before it. Only the last
+        // ASSET_DCACHE_SIZE bytes of the output can still be dirty.
+        int start = (size - ASSET_DCACHE_SIZE) & ~15;
+        data_cache_hit_writeback(s + start, size - start);
+    } else {
+        // Uncompressed files might have been partly copied by the CPU
+        // (eg: unaligned heads/tails via the stdio buffer), anywhere.
+        data_cache_hit_writeback(s, size);
+    }
+
+    if (sz) *sz = size;
+    return s;
+}
+
+void *asset_load_rsp(const char *fn, int *sz)
+{
+    uint32_t t0 = TICKS_READ();
+    FILE *f = must_fopen(fn);
+
+    asset_header_t header;
+    fread(&header, 1, sizeof(asset_header_t), f);
+    if (memcmp(header.magic, ASSET_MAGIC, 3) || header.version != '2' || header.algo != 1 ||
+        header.flags != 0) {
+        // Not a LZ4 asset: the RSP cannot help, so just load it normally
+        fclose(f);
+        return asset_load(fn, sz);
+    }
+
+    // Allocate a buffer for in-place decompression, using the same layout
+    // of decompress_lz4_full.
+    int size = header.orig_size;
+    int cmp_size = header.cmp_size;
+    int bufsize = size + LZ4_DECOMPRESS_INPLACE_MARGIN(cmp_size);
+    int cmp_offset = bufsize - cmp_size;
+    if (cmp_offset & 1) {
+        cmp_offset++;
+        bufsize++;
+    }
+    if (bufsize & 15)
+        bufsize += 16 - (bufsize & 15);
+
+    uint8_t *s = memalign(16, bufsize);
+    assertf(s, "asset_load: out of memory");
+
+    if (strncmp(fn, "rom:/", 5) == 0) {
+        // The RSP will access the buffer via DMA, so make sure there are no
+        // cachelines covering it, and then load the compressed data via PI DMA.
+        data_cache_hit_invalidate(s, bufsize);
+        uint32_t addr = dfs_rom_addr(fn+5) & 0x1FFFFFFF;
+        dma_read(s+cmp_offset, addr+16, cmp_size);
+    } else {
+        fread(s+cmp_offset, 1, cmp_size, f);
+        data_cache_hit_writeback_invalidate(s, bufsize);
+    }
+    fclose(f);
+
+    // Schedule the decompression on the RSP. The buffer is not shrunk
+    // (as done by asset_load) because the RSP has not written it yet.
+    decompress_lz4_rsp(s+cmp_offset, cmp_size, s, NULL);
+    rspq_flush();
+
+    // Decompression happens on the RSP, so only the loading time is recorded
+    asset_stats_t *stats = asset_stats_get(fn, 1, cmp_size, size);
+    if (stats) stats->ticks_io += TICKS_READ() - t0;
+
+    if (sz) *sz = size;
+    return s;
+}
+
+void *asset_load_arena(arena_t *arena, const char *fn, int *sz)
+{
+    uint32_t t0 = ASSET_TICKS_READ();
+    FILE *f = must_fopen(fn);
+
+    asset_header_t header;
+    fread(&header, 1, sizeof(asset_header_t), f);
+    if (!memcmp(header.magic, ASSET_MAGIC, 3)) {
+        // Decompressors allocate their output buffer by themselves, so
+        // decompress on the heap and move the result into the arena.
+        fclose(f);
+        int size;
+        void *tmp = asset_load(fn, &size);
+        void *s = arena_alloc(arena, size);
+        assertf(s, "asset_load_arena: arena full (loading %s, %d bytes)", fn, size);
+        memcpy(s, tmp, size);
+        free(tmp);
+        if (sz) *sz = size;
+        return s;
+    }
+
+    // Uncompressed file: read it directly into the arena
+    fseek(f, 0, SEEK_END);
+    int size = ftell(f);
+    uint8_t *s = arena_alloc(arena, size);
+    assertf(s, "asset_load_arena: arena full (loading %s, %d bytes)", fn, size);
+    fseek(f, 0, SEEK_SET);
+    fread(s, 1, size, f);
+    fclose(f);
+
+    asset_stats_t *stats = asset_stats_get(fn, 0, size, size);
+    if (stats) stats->ticks_io += ASSET_TICKS_READ() - t0;
+
+    if (sz) *sz = size;
+    return s;
+}
+
+/** @brief Amount of data loaded by each step of an asynchronous load */
+#define ASSET_ASYNC_CHUNK_SIZE      (16*1024)
+
+/** @brief State of an asynchronous asset load (see #asset_load_async) */
+struct asset_async_s {
+    FILE *fp;                       ///< File being read (NULL for uncompressed ROM files)
+    uint8_t *buf;                   ///< Destination buffer
+    int size;                       ///< Total size of the (uncompressed) asset
+    int pos;                        ///< Number of bytes loaded so far
+    uint32_t rom_addr;              ///< PI address of uncompressed ROM files (0 otherwise)
+    asset_async_cb_t cb;            ///< Completion callback
+    void *ctx;                      ///< Opaque context for the callback
+    ssize_t (*read)(void *state, void *buf, size_t len);  ///< Decompressor (NULL if not compressed)
+    asset_stats_t *stats;           ///< Load statistics (NULL if disabled)
+    uint32_t ticks_start;           ///< Time when the load was started
+    uint8_t state[] alignas(8);     ///< Decompressor state
+};
+
+/** @brief Check whether a PI DMA transfer is in progress */
+static bool asset_dma_busy(void)
+{
+    // PI status: DMA busy (bit 0) or IO busy (bit 1)
+    return (*PI_STATUS & 3) != 0;
+}
+
+asset_async_t *asset_load_async(const char *fn, asset_async_cb_t cb, void *ctx)
+{
+    assertf(cb, "asset_load_async: callback required");
+    FILE *f = must_fopen(fn);
+    asset_async_t *req;
+
+    asset_header_t header;
+    fread(&header, 1, sizeof(asset_header_t), f);
+    if (!memcmp(header.magic, ASSET_MAGIC, 3)) {
+        assertf(header.version == '2',
+            "unsupported asset version: %c\nMake sure to rebuild libdragon tools and your assets", header.version);
+        assertf(header.algo >= 1 && header.algo <= 3,
+            "unsupported compression algorithm: %d", header.algo);
+        assertf(algos[header.algo-1].decompress_init, 
+            "asset: compression level %d not initialized. Call asset_init_compression(%d) at initialization time", header.algo, header.algo);
+
+        if (header.flags & ASSET_FLAG_SEEKABLE) {
+            // Seekable assets are made of multiple independent blocks:
+            // let asset_fopen handle them.
+            fclose(f);
+            req = malloc(sizeof(asset_async_t));
+            memset(req, 0, sizeof(asset_async_t));
+            // Statistics are recorded by asset_fopen itself.
+            req->fp = asset_fopen(fn, NULL);
+        } else {
+            // Decompress through the streaming decoder, so that decompression
+            // can be split in chunks.
+            req = malloc(sizeof(asset_async_t) + algos[header.algo-1].state_size);
+            memset(req, 0, sizeof(asset_async_t));
+            req->read = algos[header.algo-1].decompress_read;
+            asset_read_margin(f, &header);
+            algos[header.algo-1].decompress_init(req->state, f);
+            req->fp = f;
+            req->stats = asset_stats_get(fn, header.algo, header.cmp_size, header.orig_size);
+        }
+        req->size = header.orig_size;
+        req->buf = memalign(16, req->size);
+    } else {
+        req = malloc(sizeof(asset_async_t));
+        memset(req, 0, sizeof(asset_async_t));
+        fseek(f, 0, SEEK_END);
+        req->size = ftell(f);
+
+        // Files compressed by DragonFS itself (mkdfs -c) cannot be mapped,
+        // and are read via the file like the other filesystems.
+        uint32_t rom_addr; int rom_size;
+        if (strncmp(fn, "rom:/", 5) == 0 && dfs_map(fn+5, &rom_addr, &rom_size) == DFS_ESUCCESS) {
+            // Uncompressed file on ROM: load it via asynchronous PI DMA.
+            // Allocate a buffer rounded to the cacheline so that it can
+            // be safely invalidated.
+            req->rom_addr = rom_addr & 0x1FFFFFFF;
+            req->buf = memalign(16, ROUND_UP(req->size, 16));
+            data_cache_hit_invalidate(req->buf, ROUND_UP(req->size, 16));
+            fclose(f);
+        } else {
+            fseek(f, 0, SEEK_SET);
+            req->fp = f;
+            req->buf = memalign(16, req->size);
+        }
+        req->stats = asset_stats_get(fn, 0, req->size, req->size);
+    }
+    assertf(req->buf, "asset_load_async: out of memory");
+
+    req->cb = cb;
+    req->ctx = ctx;
+    req->ticks_start = TICKS_READ();
+    return req;
+}
+
+bool asset_load_async_poll(asset_async_t *req, int budget_us)
+{
+    uint32_t t0 = TICKS_READ();
+    uint32_t budget = (uint64_t)budget_us * TICKS_PER_SECOND / 1000000;
+
+    do {
+        if (req->rom_addr) {
+            // Wait for the DMA of the previous chunk to finish before
+            // issuing a new one.
+            if (asset_dma_busy())
+                return false;
+            if (req->pos == req->size)
+                break;
+            int n = MIN(req->size - req->pos, ASSET_ASYNC_CHUNK_SIZE);
+            dma_read_async(req->buf + req->pos, req->rom_addr + req->pos, n);
+            req->pos += n;
+            continue;
+        }
+
+        if (req->pos == req->size)
+            break;
+        uint32_t t1 = TICKS_READ();
+        int n = MIN(req->size - req->pos, ASSET_ASYNC_CHUNK_SIZE);
+        if (req->read)
+            n = req->read(req->state, req->buf + req->pos, n);
+        else
+            n = fread(req->buf + req->pos, 1, n, req->fp);
+        assertf(n > 0, "asset_load_async: read error (%d/%d)", req->pos, req->size);
+        req->pos += n;
+        if (req->stats) {
+            if (req->read) req->stats->ticks_decompress += TICKS_SINCE(t1);
+            else           req->stats->ticks_io += TICKS_SINCE(t1);
+        }
+    } while (TICKS_SINCE(t0) < budget);
+
+    if (req->pos < req->size || (req->rom_addr && asset_dma_busy()))
+        return false;
+
+    // For DMA transfers, the CPU is mostly idle: record the whole duration
+    // of the load as I/O time.
+    if (req->rom_addr && req->stats)
+        req->stats->ticks_io += TICKS_SINCE(req->ticks_start);
+
+    // Loading finished. Release the request before invoking the callback,
+    // so that the callback is free to start a new load.
+    if (req->fp) fclose(req->fp);
+    asset_async_cb_t cb = req->cb;
+    void *ctx = req->ctx, *buf = req->buf;
+    int size = req->size;
+    free(req);
+    cb(ctx, buf, size);
+    return true;
+}
+
+float asset_load_async_progress(asset_async_t *req)
+{
+    if (!req->size)
+        return 1.0f;
+    return (float)req->pos / (float)req->size;
+}
+
 typedef struct  {
     FILE *fp;
     bool seeked;
+    asset_stats_t *stats;       ///< Load statistics (NULL if disabled)
 } cookie_none_t;
 
 static fpos_t seekfn_none(void *c, fpos_t pos, int whence)
@@ -140,7 +564,10 @@ static int readfn_none(void *c, char *buf, int sz)
 {
     cookie_none_t *cookie = c;
     assertf(!cookie->seeked, "Cannot seek in file opened via asset_fopen (it might be compressed)");
-    return fread(buf, 1, sz, cookie->fp);
+    uint32_t t0 = TICKS_READ();
+    int n = fread(buf, 1, sz, cookie->fp);
+    if (cookie->stats) cookie->stats->ticks_io += TICKS_SINCE(t0);
+    return n;
 }
 
 static int closefn_none(void *c)
@@ -151,20 +578,155 @@ static int closefn_none(void *c)
     return 0;
 }
 
+/** @brief A buffer of the stream pool (see #asset_stream_pool_init) */
+typedef struct {
+    void *buf;          ///< Buffer (NULL if not allocated yet)
+    int size;           ///< Size of the buffer
+    bool used;          ///< True if the buffer is used by an open stream
+} stream_pool_slot_t;
+
+static stream_pool_slot_t *stream_pool = NULL;     ///< Stream pool (NULL if not configured)
+static int stream_pool_size = 0;                   ///< Number of slots in the stream pool
+
+void asset_stream_pool_init(int max_streams)
+{
+    assertf(!stream_pool, "asset_stream_pool_init: pool already initialized");
+    assertf(max_streams > 0, "asset_stream_pool_init: invalid number of streams: %d", max_streams);
+    stream_pool = calloc(max_streams, sizeof(stream_pool_slot_t));
+    stream_pool_size = max_streams;
+}
+
+void asset_stream_pool_close(void)
+{
+    for (int i = 0; i < stream_pool_size; i++) {
+        assertf(!stream_pool[i].used, "asset_stream_pool_close: a stream is still open");
+        free(stream_pool[i].buf);
+    }
+    free(stream_pool);
+    stream_pool = NULL;
+    stream_pool_size = 0;
+}
+
+/** @brief Allocate the state of a compressed stream, from the pool if configured */
+static void *stream_pool_alloc(int size)
+{
+    if (!stream_pool)
+        return malloc(size);
+
+    // Prefer a free buffer that is already big enough; otherwise, grow
+    // one of the free buffers.
+    stream_pool_slot_t *slot = NULL;
+    for (int i = 0; i < stream_pool_size; i++) {
+        if (stream_pool[i].used)
+            continue;
+        if (stream_pool[i].size >= size) {
+            slot = &stream_pool[i];
+            break;
+        }
+        if (!slot) slot = &stream_pool[i];
+    }
+    assertf(slot, "asset_fopen: too many concurrent compressed streams (max: %d)\nIncrease the limit in asset_stream_pool_init", stream_pool_size);
+
+    if (slot->size < size) {
+        free(slot->buf);
+        slot->buf = malloc(size);
+        assertf(slot->buf, "asset_fopen: out of memory");
+        slot->size = size;
+    }
+    slot->used = true;
+    return slot->buf;
+}
+
+/** @brief Release the state of a compressed stream */
+static void stream_pool_free(void *buf)
+{
+    for (int i = 0; i < stream_pool_size; i++) {
+        if (stream_pool[i].buf == buf) {
+            stream_pool[i].used = false;
+            return;
+        }
+    }
+    free(buf);
+}
+
 typedef struct  {
     FILE *fp;
     int pos;
     bool seeked;
     ssize_t (*read)(void *state, void *buf, size_t len);
+    asset_index_t *index;       ///< Block index (NULL if the file is not seekable)
+    void (*init)(void *state, FILE *fp);  ///< Decompressor init (only for seekable files)
+    int size;                   ///< Uncompressed size (only for seekable files)
+    int dec_pos;                ///< Position of the decompressor (only for seekable files)
+    int blk_left;               ///< Bytes left in the current block (only for seekable files)
+    asset_stats_t *stats;       ///< Load statistics (NULL if disabled)
     uint8_t state[] alignas(8);
 } cookie_cmp_t;
 
+/** @brief Restart decompression at the beginning of a block (seekable files) */
+static void cookie_cmp_start_block(cookie_cmp_t *cookie, int blk)
+{
+    asset_index_t *index = cookie->index;
+    fseek(cookie->fp, index->data_offset + index->cmp_offset[blk], SEEK_SET);
+    cookie->init(cookie->state, cookie->fp);
+    cookie->dec_pos = blk * index->block_size;
+    cookie->blk_left = MIN((int)index->block_size, cookie->size - cookie->dec_pos);
+}
+
+/** @brief Decompress data from a seekable file, crossing block boundaries as needed */
+static int cookie_cmp_read_blocks(cookie_cmp_t *cookie, uint8_t *buf, int sz)
+{
+    int total = 0;
+    while (sz > 0 && cookie->dec_pos < cookie->size) {
+        if (cookie->blk_left == 0)
+            cookie_cmp_start_block(cookie, cookie->dec_pos / cookie->index->block_size);
+        int n = cookie->read(cookie->state, buf, MIN(sz, cookie->blk_left));
+        if (n <= 0)
+            break;
+        buf += n;
+        sz -= n;
+        total += n;
+        cookie->dec_pos += n;
+        cookie->blk_left -= n;
+    }
+    return total;
+}
+
+static int readfn_cmp_impl(cookie_cmp_t *cookie, char *buf, int sz)
+{
+    if (!cookie->index) {
+        assertf(!cookie->seeked, "Cannot seek in file opened via asset_fopen (it might be compressed)");
+        int n = cookie->read(cookie->state, (uint8_t*)buf, sz);
+        cookie->pos += n;
+        return n;
+    }
+
+    // Seekable file: if a seek was requested, move the decompressor there.
+    // Seeking backward or to another block requires restarting from the
+    // beginning of the block that contains the target position.
+    if (cookie->dec_pos != cookie->pos) {
+        int blk = cookie->pos / cookie->index->block_size;
+        if (cookie->pos < cookie->dec_pos || cookie->blk_left == 0 ||
+            blk != (cookie->dec_pos / cookie->index->block_size))
+            cookie_cmp_start_block(cookie, blk);
+        while (cookie->dec_pos < cookie->pos) {
+            uint8_t tmp[128];
+            if (!cookie_cmp_read_blocks(cookie, tmp, MIN((int)sizeof(tmp), cookie->pos - cookie->dec_pos)))
+                break;
+        }
+    }
+
+    int n = cookie_cmp_read_blocks(cookie, (uint8_t*)buf, sz);
+    cookie->pos += n;
+    return n;
+}
+
 static int readfn_cmp(void *c, char *buf, int sz)
 {
     cookie_cmp_t *cookie = (cookie_cmp_t*)c;
-    assertf(!cookie->seeked, "Cannot seek in file opened via asset_fopen (it might be compressed)");
-    int n = cookie->read(cookie->state, (uint8_t*)buf, sz);
-    cookie->pos += n;
+    uint32_t t0 = TICKS_READ();
+    int n = readfn_cmp_impl(cookie, buf, sz);
+    if (cookie->stats) cookie->stats->ticks_decompress += TICKS_SINCE(t0);
     return n;
 }
 
@@ -176,6 +738,21 @@ static fpos_t seekfn_cmp(void *c, fpos_t pos, int whence)
     if (whence == SEEK_CUR && pos == 0)
         return cookie->pos;
 
+    // Seekable file: just record the new position. The actual seek is
+    // performed by the next read, so that seeks that are not followed by
+    // reads (like the one issued by fclose) cost nothing.
+    if (cookie->index) {
+        int newpos = pos;
+        if (whence == SEEK_CUR) newpos += cookie->pos;
+        if (whence == SEEK_END) newpos += cookie->size;
+        if (newpos < 0 || newpos > cookie->size) {
+            errno = EINVAL;
+            return -1;
+        }
+        cookie->pos = newpos;
+        return newpos;
+    }
+
     // We should really have an assert here but unfortunately newlib's fclose
     // also issue a fseek (backward...) as part of a fflush. So we delay the actual
     // assert until the next read (if any), which is better than nothing.
@@ -187,7 +764,8 @@ static int closefn_cmp(void *c)
 {
     cookie_cmp_t *cookie = (cookie_cmp_t*)c;
     fclose(cookie->fp); cookie->fp = NULL;
-    free(cookie);
+    free(cookie->index);
+    stream_pool_free(cookie);
     return 0;
 }
 
@@ -217,33 +795,239 @@ FILE *asset_fopen(const char *fn, int *sz)
 
         cookie_cmp_t *cookie;
 
-        assertf(header.algo >= 1 || header.algo <= 2,
+        assertf(header.algo >= 1 && header.algo <= 3,
             "unsupported compression algorithm: %d", header.algo);
         assertf(algos[header.algo-1].decompress_init, 
             "asset: compression level %d not initialized. Call asset_init_compression(%d) at initialization time", header.algo, header.algo);
 
-        cookie = malloc(sizeof(cookie_cmp_t) + algos[header.algo-1].state_size);
+        cookie = stream_pool_alloc(sizeof(cookie_cmp_t) + algos[header.algo-1].state_size);
         cookie->read = algos[header.algo-1].decompress_read;
-        algos[header.algo-1].decompress_init(cookie->state, f);
+        cookie->index = NULL;
+        if (header.flags & ASSET_FLAG_SEEKABLE) {
+            // Blocks are started lazily by the first read
+            cookie->index = asset_read_index(f);
+            cookie->init = algos[header.algo-1].decompress_init;
+            cookie->size = header.orig_size;
+            cookie->dec_pos = 0;
+            cookie->blk_left = 0;
+        } else {
+            asset_read_margin(f, &header);
+            algos[header.algo-1].decompress_init(cookie->state, f);
+        }
 
         cookie->fp = f;
         cookie->pos = 0;
         cookie->seeked = false;
+        cookie->stats = asset_stats_get(fn, header.algo, header.cmp_size, header.orig_size);
         if (sz) *sz = header.orig_size;
         return funopen(cookie, readfn_cmp, NULL, seekfn_cmp, closefn_cmp);
     }
 
     // Not compressed. Return a wrapped FILE* without the seeking capability,
     // so that it matches the behavior of the compressed file.
-    if (sz) {
-        fseek(f, 0, SEEK_END);
-        *sz = ftell(f);
-    }
+    fseek(f, 0, SEEK_END);
+    int size = ftell(f);
+    if (sz) *sz = size;
     fseek(f, 0, SEEK_SET);
     cookie_none_t *cookie = malloc(sizeof(cookie_none_t));
     cookie->fp = f;
     cookie->seeked = false;
+    cookie->stats = asset_stats_get(fn, 0, size, size);
     return funopen(cookie, readfn_none, NULL, seekfn_none, closefn_none);
 }
 
+/** @brief Files prefetched in RAM, in order of request */
+static asset_prefetch_t *prefetch_list = NULL;
+/** @brief Maximum amount of memory used by prefetched files */
+static int prefetch_cache_size = ASSET_PREFETCH_CACHE_SIZE;
+/** @brief Memory currently used by prefetched files */
+static int prefetch_used = 0;
+
+/** @brief DMA queue callback: a prefetch transfer is finished */
+static void asset_prefetch_done(void *ctx)
+{
+    asset_prefetch_t *pf = ctx;
+    pf->done = true;
+}
+
+static void asset_prefetch_free(asset_prefetch_t *pf)
+{
+    if (!pf) return;
+    free(pf->buf);
+    free(pf->fn);
+    free(pf);
+}
+
+/** @brief Remove a prefetched file from the list, waiting for its transfer to finish */
+static void asset_prefetch_unlink(asset_prefetch_t **prev)
+{
+    asset_prefetch_t *pf = *prev;
+    if (!pf->done) {
+        assertf(get_interrupts_state() == INTERRUPTS_ENABLED,
+            "asset: waiting for a prefetch with interrupts disabled");
+        while (!pf->done) {}
+    }
+    *prev = pf->next;
+    prefetch_used -= pf->bufsize;
+}
+
+static asset_prefetch_t *asset_prefetch_take(const char *fn)
+{
+    for (asset_prefetch_t **prev = &prefetch_list; *prev; prev = &(*prev)->next) {
+        if (!strcmp((*prev)->fn, fn)) {
+            asset_prefetch_t *pf = *prev;
+            asset_prefetch_unlink(prev);
+            return pf;
+        }
+    }
+    return NULL;
+}
+
+/** @brief Evict the oldest prefetched files whose transfer is finished, until size bytes are available */
+static bool asset_prefetch_evict(int size)
+{
+    asset_prefetch_t **prev = &prefetch_list;
+    while (prefetch_used + size > prefetch_cache_size && *prev) {
+        if (!(*prev)->done) {
+            prev = &(*prev)->next;
+            continue;
+        }
+        asset_prefetch_t *pf = *prev;
+        asset_prefetch_unlink(prev);
+        asset_prefetch_free(pf);
+    }
+    return prefetch_used + size <= prefetch_cache_size;
+}
+
+bool asset_prefetch(const char *fn, int priority)
+{
+    for (asset_prefetch_t *pf = prefetch_list; pf; pf = pf->next)
+        if (!strcmp(pf->fn, fn))
+            return true;
+
+    // Only files in DragonFS can be fetched via DMA, and only if they are not
+    // compressed by DragonFS itself (asset_load would not see the asset header).
+    uint32_t rom_addr; int size;
+    if (strncmp(fn, "rom:/", 5) != 0 || dfs_map(fn+5, &rom_addr, &size) != DFS_ESUCCESS)
+        return false;
+
+    // The buffer is rounded to the cacheline so that it can be safely invalidated,
+    // and the transfer is rounded to an even length as required by the PI.
+    int bufsize = ROUND_UP(size, 16);
+    if (!asset_prefetch_evict(bufsize))
+        return false;
+
+    asset_prefetch_t *pf = malloc(sizeof(asset_prefetch_t));
+    uint8_t *buf = memalign(16, bufsize);
+    char *pfn = strdup(fn);
+    if (!pf || !buf || !pfn) {
+        free(pf); free(buf); free(pfn);
+        return false;
+    }
+    *pf = (asset_prefetch_t){ .fn = pfn, .buf = buf, .size = size, .bufsize = bufsize };
+
+    // Append to the list, so that the oldest requests are evicted first
+    asset_prefetch_t **tail = &prefetch_list;
+    while (*tail) tail = &(*tail)->next;
+    *tail = pf;
+    prefetch_used += bufsize;
+
+    data_cache_hit_invalidate(buf, bufsize);
+    dma_read_queue(buf, rom_addr & 0x1FFFFFFF, ROUND_UP(size, 2), priority, asset_prefetch_done, pf);
+    return true;
+}
+
+void asset_prefetch_set_cache_size(int size)
+{
+    assertf(size >= 0, "asset_prefetch_set_cache_size: invalid size: %d", size);
+    prefetch_cache_size = size;
+    asset_prefetch_evict(0);
+}
+
+void asset_prefetch_clear(void)
+{
+    while (prefetch_list) {
+        asset_prefetch_t *pf = prefetch_list;
+        asset_prefetch_unlink(&prefetch_list);
+        asset_prefetch_free(pf);
+    }
+}
+
+/** @brief Statistics of a file, chained in a list */
+typedef struct asset_stats_node_s {
+    asset_stats_t stats;                ///< Statistics (must be first)
+    struct asset_stats_node_s *next;    ///< Next file
+} asset_stats_node_t;
+
+static bool stats_enabled = false;                 ///< True if statistics are being collected
+static asset_stats_node_t *stats_head = NULL;      ///< First file in the statistics list
+static asset_stats_node_t *stats_tail = NULL;      ///< Last file in the statistics list
+
+/**
+ * @brief Get the statistics entry of a file, and account a new load for it.
+ * 
+ * @return The entry, or NULL if statistics are disabled.
+ */
+static asset_stats_t *asset_stats_get(const char *fn, int algo, int cmp_size, int size)
+{
+    if (!stats_enabled)
+        return NULL;
+
+    asset_stats_node_t *node = stats_head;
+    while (node && strcmp(node->stats.filename, fn))
+        node = node->next;
+    if (!node) {
+        node = calloc(1, sizeof(asset_stats_node_t));
+        node->stats.filename = strdup(fn);
+        if (stats_tail) stats_tail->next = node;
+        else stats_head = node;
+        stats_tail = node;
+    }
+
+    node->stats.algo = algo;
+    node->stats.cmp_size = cmp_size;
+    node->stats.size = size;
+    node->stats.num_loads++;
+    return &node->stats;
+}
+
+void asset_stats_enable(bool enable)
+{
+    stats_enabled = enable;
+}
+
+void asset_stats_reset(void)
+{
+    for (asset_stats_node_t *node = stats_head; node; node = node->next) {
+        node->stats.num_loads = 0;
+        node->stats.ticks_io = 0;
+        node->stats.ticks_decompress = 0;
+    }
+}
+
+const asset_stats_t *asset_get_stats(const asset_stats_t *prev)
+{
+    if (!prev)
+        return stats_head ? &stats_head->stats : NULL;
+    asset_stats_node_t *next = ((asset_stats_node_t*)prev)->next;
+    return next ? &next->stats : NULL;
+}
+
+void asset_stats_dump(void)
+{
+    debugf("asset stats:\n");
+    debugf("  %-32s algo loads  cmp_size      size  ratio   io (us)  dec (us)  dec MB/s\n", "file");
+    for (const asset_stats_t *st = asset_get_stats(NULL); st; st = asset_get_stats(st)) {
+        if (!st->num_loads)
+            continue;
+        long long io_us = TIMER_MICROS_LL(st->ticks_io);
+        long long dec_us = TIMER_MICROS_LL(st->ticks_decompress);
+        debugf("  %-32s %4d %5d %9d %9d %5.1f%% %9lld %9lld %9.2f\n",
+            st->filename, st->algo, st->num_loads, st->cmp_size, st->size,
+            st->size ? 100.0f * st->cmp_size / st->size : 0.0f,
+            io_us, dec_us,
+            dec_us ? (float)st->size * st->num_loads / dec_us : 0.0f);
+    }
+}
+
 #endif /* N64 */
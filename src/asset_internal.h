@@ -6,18 +6,38 @@
 
 #define ASSET_MAGIC    "DCA"   ///< Magic compressed asset header
 
+#define ASSET_FLAG_SEEKABLE     0x0001  ///< The asset has a block index (see #asset_index_t)
+#define ASSET_FLAG_INPLACE      0x0002  ///< The header is followed by the in-place decompression margin (32-bit)
+
 /** @brief Header of a compressed asset */
 typedef struct {
     char magic[3];          ///< Magic header
     uint8_t version;        ///< Version of the asset header
     uint16_t algo;          ///< Compression algorithm
-    uint16_t flags;         ///< Flags (unused for now)
+    uint16_t flags;         ///< Flags (ASSET_FLAG_*)
     uint32_t cmp_size;      ///< Compressed size in bytes
     uint32_t orig_size;     ///< Original size in bytes
 } asset_header_t;
 
 _Static_assert(sizeof(asset_header_t) == 16, "invalid sizeof(asset_header_t)");
 
+/**
+ * @brief Block index of a seekable compressed asset
+ * 
+ * When ASSET_FLAG_SEEKABLE is set, the uncompressed data is split in blocks
+ * of block_size bytes, each one compressed independently. The header is then
+ * followed by block_size, num_blocks and by the offset of each compressed
+ * block (all 32-bit words), relative to the start of the first block, which
+ * immediately follows the index. This allows to seek by restarting
+ * decompression at the beginning of any block.
+ */
+typedef struct {
+    uint32_t block_size;    ///< Uncompressed size of each block (except the last one)
+    uint32_t num_blocks;    ///< Number of blocks
+    uint32_t data_offset;   ///< File offset of the first block (computed at load time)
+    uint32_t cmp_offset[];  ///< Offset of each compressed block, relative to data_offset
+} asset_index_t;
+
 /** @brief A decompression algorithm used by the asset library */
 typedef struct {
     int state_size;     ///< Size of the decompression state
@@ -29,9 +49,19 @@ typedef struct {
 
     /** @brief Decompress a full file in one go */
     void* (*decompress_full)(const char *fn, FILE *fp, size_t cmp_size, size_t len);
+    /** @brief Decompress a full file in one go, in-place (for files with ASSET_FLAG_INPLACE) */
+    void* (*decompress_full_inplace)(const char *fn, FILE *fp, size_t cmp_size, size_t len, size_t margin);
 } asset_compression_t;
 
 
 FILE *must_fopen(const char *fn);
 
+/**
+ * @brief Return the decompression algorithm for the specified level
+ *
+ * @param algo      Compression level (1-3)
+ * @return The algorithm, or NULL if it was not initialized (see #asset_init_compression)
+ */
+asset_compression_t *__asset_get_compression(int algo);
+
 #endif
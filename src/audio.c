@@ -88,6 +88,8 @@ static int _frequency = 0;
 static int _num_buf = NUM_BUFFERS;
 /** @brief The buffer size in bytes for each buffer allocated */
 static int _buf_size = 0;
+/** @brief Buffer length requested via #audio_set_buffer_length (0 = default) */
+static int _buf_size_req = 0;
 /** @brief Array of pointers to the allocated buffers */
 static short **buffers = NULL;
 /** @brief Array of pointers to the allocated buffers (original pointers to free) */
@@ -108,6 +110,8 @@ static volatile int now_empty = 0;
 static volatile int now_writing = 0;
 /** @brief Bitmask of buffers indicating which buffers are full */
 static volatile int buf_full = 0;
+/** @brief Number of times the AI ran out of buffers to play */
+static volatile int underruns = 0;
 
 /** @brief Structure used to interact with the AI registers */
 static volatile struct AI_regs_s * const AI_regs = (struct AI_regs_s *)0xa4500000;
@@ -168,6 +172,10 @@ static void audio_callback()
         playing_queue--;
         now_empty = (now_empty + 1) % _num_buf;
         buf_full &= ~(1<<now_empty);
+        /* The AI has finished playing all the queued buffers, so it is now
+           idle and the output has a gap of silence. */
+        if (playing_queue == 0)
+            underruns++;
     }
 
     /* Copy in as many buffers as can fit (up to 2) */
@@ -276,7 +284,7 @@ void audio_init(const int frequency, int numbuffers)
     set_AI_interrupt(1);
 
     /* Set up buffers */
-    _buf_size = CALC_BUFFER(_frequency);
+    _buf_size = _buf_size_req ? ((_buf_size_req >> 3) << 3) : CALC_BUFFER(_frequency);
     _num_buf = (numbuffers > 1) ? numbuffers : NUM_BUFFERS;
     buffers = malloc(_num_buf * sizeof(short *));
     buffers_orig = malloc(_num_buf * sizeof(short *));
@@ -305,9 +313,33 @@ void audio_init(const int frequency, int numbuffers)
     now_empty = 0;
     now_writing = 0;
     buf_full = 0;
+    underruns = 0;
     _paused = false;
 }
 
+/**
+ * @brief Configure the length of the audio buffers allocated by #audio_init
+ *
+ * By default, each buffer holds 1/25th of second of audio. Shorter buffers
+ * reduce the latency of the audio output (the time between the generation of
+ * a sample and its playback), but must be refilled more frequently, so a
+ * larger number of them might be required to avoid underruns. Use the
+ * numbuffers argument of #audio_init to configure how many buffers are
+ * allocated.
+ *
+ * This function must be called before #audio_init.
+ *
+ * @param[in] num_samples
+ *            Number of stereo samples in each buffer (rounded down to a
+ *            multiple of 8), or 0 to restore the default length.
+ */
+void audio_set_buffer_length(int num_samples)
+{
+    assertf(!buffers, "audio_set_buffer_length must be called before audio_init");
+    assertf(num_samples == 0 || num_samples >= 8, "invalid audio buffer length: %d", num_samples);
+    _buf_size_req = num_samples;
+}
+
 /**
  * @brief Install a audio callback to fill the audio buffer when required.
  * 
@@ -581,4 +613,51 @@ int audio_get_buffer_length()
     return _buf_size;
 }
 
+/**
+ * @brief Return the number of audio underruns since #audio_init
+ *
+ * An underrun happens when the AI has played all the queued buffers before
+ * a new one was written (or filled by the buffer callback), which results
+ * in a gap of silence in the audio output. If audio is fed through
+ * #audio_set_buffer_callback, this means that the AI interrupt was serviced
+ * too late, for instance because interrupts were disabled for too long.
+ *
+ * @note If the application stops writing audio (eg: because playback is
+ *       finished), the AI running out of buffers is counted as an underrun
+ *       as well.
+ *
+ * @return The number of underruns
+ */
+int audio_get_underruns(void)
+{
+    return underruns;
+}
+
+/**
+ * @brief Return the number of buffers that were written and not played yet
+ *
+ * This includes the buffers currently queued in the AI. Multiplied by
+ * #audio_get_buffer_length, it gives the current latency of the audio
+ * output in samples.
+ *
+ * @note This is only meaningful when audio is fed through #audio_write or
+ *       #audio_write_begin / #audio_write_end.
+ *
+ * @return The number of buffers waiting to be played
+ */
+int audio_get_buffered(void)
+{
+    if(!buffers)
+    {
+        return 0;
+    }
+
+    /* Update the state of the queue with the buffers consumed so far */
+    disable_interrupts();
+    audio_callback();
+    int n = __builtin_popcount(buf_full);
+    enable_interrupts();
+    return n;
+}
+
 /** @} */ /* audio */
@@ -1,4 +1,5 @@
 #include "ay8910.h"
+#include "ay8910_internal.h"
 #include <assert.h>
 #include <memory.h>
 
@@ -477,6 +478,19 @@ void ay8910_reset(AY8910 *ay) {
 	ay->ch[2].tone_period = 1;
 }
 
+void __ay8910_rsp_voltable(uint16_t *table) {
+	// Same scale of the stereo output of ay8910_gen: each side is
+	// (s0+s1*0.5f) * (2.f / 3.f) for the two channels mixed on it.
+	for (int i=0; i<16; i++)
+		table[i] = VOL_TABLE[i] * 65535.0f * (2.f / 3.f) / AY8910_DECIMATE;
+}
+
+void __ay8910_rsp_reset(ay8910_rsp_state_t *state) {
+	memset(state, 0, sizeof(*state));
+	__ay8910_rsp_voltable(state->voltable);
+	state->noise_lfsr = 1;
+}
+
 void ay8910_set_ports(AY8910 *ay, uint8_t (*PortRead)(int), void (*PortWrite)(int, uint8_t)) {
 	ay->PortRead = PortRead;
 	ay->PortWrite = PortWrite;
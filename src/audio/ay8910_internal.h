@@ -0,0 +1,41 @@
+#ifndef __LIBDRAGON_AY8910_INTERNAL_H
+#define __LIBDRAGON_AY8910_INTERNAL_H
+
+#include <stdint.h>
+
+/**
+ * @brief State of the RSP AY8910 emulator (rsp_ay8910.S).
+ *
+ * This is kept in RDRAM (uncached) between commands, and it is only
+ * accessed by the RSP after initialization. The layout must match
+ * AY_STATE in the ucode.
+ */
+typedef struct {
+	uint16_t voltable[16];     ///< Volume levels, scaled for decimation (see #__ay8910_rsp_voltable)
+	uint32_t tone_count[3];    ///< Current tick count of the tone channels
+	uint32_t noise_count;      ///< Current tick count of the noise
+	uint32_t noise_lfsr;       ///< Noise shift register
+	uint32_t env_count;        ///< Current tick count of the envelope
+	uint32_t tone_out;         ///< Output of the tone channels (bits 0..2)
+	int32_t env_step;          ///< Current step of the envelope
+	uint32_t env_attack;       ///< 0x0 if in attack, 0xF if in the release
+	uint32_t env_hold;         ///< True if the envelope holds after attack
+	uint32_t env_alternate;    ///< True if attack and release alternate
+	uint32_t env_holding;      ///< True if the envelope is currently holding
+} ay8910_rsp_state_t;
+
+_Static_assert(sizeof(ay8910_rsp_state_t) == 80, "ay8910_rsp_state_t size mismatch with rsp_ay8910.S");
+
+/**
+ * @brief Compute the volume table used by the RSP emulator.
+ *
+ * Each entry is the contribution of one tick at that volume to a stereo
+ * output sample, so that the ucode can rebuild the same output of
+ * #ay8910_gen by just adding #AY8910_DECIMATE ticks.
+ */
+void __ay8910_rsp_voltable(uint16_t *table);
+
+/** @brief Initialize a RSP emulator state (equivalent to #ay8910_reset) */
+void __ay8910_rsp_reset(ay8910_rsp_state_t *state);
+
+#endif
@@ -127,7 +127,7 @@ void xm_context_save(xm_context_t* ctx, FILE* out) {
 	#define WALIGN()  ({ while (ftell(out) % 8) _W8(0); })
 
 
-	const uint8_t version = 6;
+	const uint8_t version = 7;
 	WA("XM64", 4);
 	W8(version);
 	W32(ctx->ctx_size);
@@ -233,26 +233,43 @@ void xm_context_save(xm_context_t* ctx, FILE* out) {
 	pat_off_idx = 0;
 	sam_off_idx = 0;
 
-	WA("WAVE", 4);
 	uint32_t wv_overred = XM_WAVEFORM_OVERREAD;
-	W32(wv_overred);
-	for (int i=0;i<ctx->module.num_instruments;i++) {
-		xm_instrument_t *ins = &ctx->module.instruments[i];
-		for (int j=0;j<ins->num_samples;j++) {
-			xm_sample_t *s = &ins->samples[j];
-			WALIGN();
-
-			uint32_t pos = ftell(out);
-			fseek(out, sam_off[sam_off_idx++], SEEK_SET);
-			W32(pos);
-			fseek(out, pos, SEEK_SET);
-
-			assert(s->bits == 8 || s->bits == 16);
-			if (s->bits == 8)
-				WA(s->data8, s->length+XM_WAVEFORM_OVERREAD);
-			else {
-				for (int k=0;k<s->length+XM_WAVEFORM_OVERREAD/2;k++)
-					W16(s->data16[k]);
+	if (ctx->wave_bank_id) {
+		// Waveforms are stored in a sample bank: data8_offset is the index
+		// of the entry within the bank.
+		WA("WAVB", 4);
+		W32(wv_overred);
+		W32(ctx->wave_bank_id);
+		for (int i=0;i<ctx->module.num_instruments;i++) {
+			xm_instrument_t *ins = &ctx->module.instruments[i];
+			for (int j=0;j<ins->num_samples;j++) {
+				uint32_t pos = ftell(out);
+				fseek(out, sam_off[sam_off_idx++], SEEK_SET);
+				W32(ins->samples[j].data8_offset);
+				fseek(out, pos, SEEK_SET);
+			}
+		}
+	} else {
+		WA("WAVE", 4);
+		W32(wv_overred);
+		for (int i=0;i<ctx->module.num_instruments;i++) {
+			xm_instrument_t *ins = &ctx->module.instruments[i];
+			for (int j=0;j<ins->num_samples;j++) {
+				xm_sample_t *s = &ins->samples[j];
+				WALIGN();
+
+				uint32_t pos = ftell(out);
+				fseek(out, sam_off[sam_off_idx++], SEEK_SET);
+				W32(pos);
+				fseek(out, pos, SEEK_SET);
+
+				assert(s->bits == 8 || s->bits == 16);
+				if (s->bits == 8)
+					WA(s->data8, s->length+XM_WAVEFORM_OVERREAD);
+				else {
+					for (int k=0;k<s->length+XM_WAVEFORM_OVERREAD/2;k++)
+						W16(s->data16[k]);
+				}
 			}
 		}
 	}
@@ -445,8 +462,9 @@ int xm_context_load(xm_context_t** ctxp, FILE* in, uint32_t rate) {
 	//  5: first public version
 	//  6: added overread for non-looping samples. The size of optimal
 	//     stream sample buffer size must change, hance the version bump.
+	//  7: waveforms can be stored in a sample bank (WAVB section).
 	R8(version);
-	if (version != 5 && version != 6) {
+	if (version < 5 || version > 7) {
 		DEBUG("invalid XM64 version %d\n", version);
 		return 1;		
 	}
@@ -469,8 +487,14 @@ int xm_context_load(xm_context_t** ctxp, FILE* in, uint32_t rate) {
 
 	uint32_t alloc_bytes = ctx_size;
 	#if XM_STREAM_PATTERNS
+	// Patterns are decoded one row at a time: only a row and a chunk of
+	// compressed data are kept in memory.
+	uint32_t stream_row_size = ctx_size_stream_pattern_buf;
+	if (stream_row_size > XM_STREAM_MAX_CHANNELS * sizeof(xm_pattern_slot_t))
+		stream_row_size = XM_STREAM_MAX_CHANNELS * sizeof(xm_pattern_slot_t);
+	stream_row_size = (stream_row_size + 7) & ~7;
 	alloc_bytes -= ctx_size_all_patterns;
-	alloc_bytes += ctx_size_stream_pattern_buf;
+	alloc_bytes += stream_row_size + 2 * XM_STREAM_PATTERN_CHUNK_ALLOC + 16;
 	#endif
 	#if XM_STREAM_WAVEFORMS
 	alloc_bytes -= ctx_size_all_samples;
@@ -579,7 +603,8 @@ int xm_context_load(xm_context_t** ctxp, FILE* in, uint32_t rate) {
 	}
 
 	RA(head, 4);
-	if (head[0] != 'W' && head[1] != 'A' && head[2] != 'V' && head[3] != 'E') {
+	bool wave_banked = head[0] == 'W' && head[1] == 'A' && head[2] == 'V' && head[3] == 'B';
+	if (!wave_banked && head[0] != 'W' && head[1] != 'A' && head[2] != 'V' && head[3] != 'E') {
 		DEBUG("invalid WAVE header\n");
 		free(*ctxp);
 		*ctxp = NULL;
@@ -594,6 +619,17 @@ int xm_context_load(xm_context_t** ctxp, FILE* in, uint32_t rate) {
 		*ctxp = NULL;
 		return 1;
 	}
+	if (wave_banked) {
+		R32(ctx->wave_bank_id);
+#if !XM_STREAM_WAVEFORMS
+		// Waveforms must be read from the bank, which is only supported
+		// when streaming them.
+		DEBUG("waveforms stored in a sample bank require streaming\n");
+		free(*ctxp);
+		*ctxp = NULL;
+		return 1;
+#endif
+	}
 
 
 #if !XM_STREAM_WAVEFORMS
@@ -666,10 +702,16 @@ int xm_context_load(xm_context_t** ctxp, FILE* in, uint32_t rate) {
 		return 1;
 	}
 #else
+	assert(ctx->module.num_channels <= XM_STREAM_MAX_CHANNELS);
 	ctx->slot_buffer_index = -1;
 	ctx->slot_buffer = (xm_pattern_slot_t*)mempool;
-	mempool += ctx->ctx_size_stream_pattern_buf;
-	if ((size_t)mempool & 7) mempool += 8 - ((size_t)mempool & 7);
+	mempool += stream_row_size;
+	// Chunks are cacheline-aligned, as they can be written via DMA.
+	if ((size_t)mempool & 15) mempool += 16 - ((size_t)mempool & 15);
+	ctx->stream_buf = (uint8_t*)mempool;
+	mempool += XM_STREAM_PATTERN_CHUNK_ALLOC;
+	ctx->stream_next = (uint8_t*)mempool;
+	mempool += XM_STREAM_PATTERN_CHUNK_ALLOC;
 #endif
 
 	ctx->rate = rate;
@@ -10,6 +10,12 @@
 #include "xm_internal.h"
 #include <inttypes.h>
 #include <assert.h>
+#ifdef N64
+#include "dma.h"
+#include "interrupt.h"
+#include "n64sys.h"
+#include "debug.h"
+#endif
 
 /* ----- Static functions ----- */
 
@@ -857,6 +863,162 @@ static void xm_key_off(xm_channel_context_t* ch) {
 	}
 }
 
+#if XM_STREAM_PATTERNS
+#ifdef N64
+static void xm_stream_dma_done(void* arg) {
+	xm_context_t* ctx = arg;
+	ctx->stream_next_pending = false;
+}
+
+/* Wait for the read-ahead DMA to finish */
+static void xm_stream_wait(xm_context_t* ctx) {
+	if (ctx->stream_next_pending) {
+		assertf(get_interrupts_state() == INTERRUPTS_ENABLED,
+			"xm64: waiting for pattern data with interrupts disabled");
+		while (ctx->stream_next_pending) {}
+	}
+}
+
+/* Read a chunk of compressed data via PI DMA. The data is placed at the same
+ * 2-byte phase of the ROM address, as required by DMA: return its position
+ * within the buffer. */
+static int xm_stream_dma(xm_context_t* ctx, uint8_t* buf, uint32_t offset, int len, bool async) {
+	uint32_t rom_addr = ctx->stream_rom_addr + offset;
+	int pos = rom_addr & 1;
+	data_cache_hit_invalidate(buf, XM_STREAM_PATTERN_CHUNK_ALLOC);
+	if (async) {
+		ctx->stream_next_pending = true;
+		dma_read_queue(buf + pos, rom_addr, len, DMA_PRIORITY_HIGH, xm_stream_dma_done, ctx);
+	} else {
+		dma_read(buf + pos, rom_addr, len);
+	}
+	return pos;
+}
+
+/* Start reading ahead the chunk that will be decoded next: the rest of the
+ * current pattern or, once it has been fully read, the beginning of the next
+ * pattern in the order table. */
+static void xm_stream_prefetch(xm_context_t* ctx) {
+	if (ctx->stream_next_len || get_interrupts_state() != INTERRUPTS_ENABLED)
+		return;
+
+	uint32_t offset = ctx->stream_offset;
+	int len = ctx->stream_left;
+	if (!len) {
+		int idx = ctx->current_table_index + 1;
+		if (idx >= ctx->module.length)
+			idx = ctx->module.restart_position;
+		xm_pattern_t* p = ctx->module.patterns + ctx->module.pattern_table[idx];
+		offset = p->slots_offset;
+		len = p->slots_size;
+	}
+	if (len > XM_STREAM_PATTERN_CHUNK)
+		len = XM_STREAM_PATTERN_CHUNK;
+	if (!len)
+		return;
+
+	ctx->stream_next_offset = offset;
+	ctx->stream_next_len = len;
+	ctx->stream_next_pos = xm_stream_dma(ctx, ctx->stream_next, offset, len, true);
+}
+
+/* Load the next chunk of the pattern via PI DMA, using the chunk that was
+ * read ahead if it is the right one. */
+static void xm_stream_refill_rom(xm_context_t* ctx, int len) {
+	xm_stream_wait(ctx);
+	if (ctx->stream_next_len == len && ctx->stream_next_offset == ctx->stream_offset) {
+		uint8_t* buf = ctx->stream_buf;
+		ctx->stream_buf = ctx->stream_next;
+		ctx->stream_next = buf;
+		ctx->stream_pos = ctx->stream_next_pos;
+	} else {
+		ctx->stream_pos = xm_stream_dma(ctx, ctx->stream_buf, ctx->stream_offset, len, false);
+	}
+	ctx->stream_next_len = 0;
+}
+#endif
+
+/* Read the next byte of compressed data of the pattern being decoded */
+static uint8_t xm_stream_byte(xm_context_t* ctx) {
+	if (ctx->stream_pos == ctx->stream_len) {
+		assert(ctx->stream_left > 0);
+		int len = ctx->stream_left < XM_STREAM_PATTERN_CHUNK ? ctx->stream_left : XM_STREAM_PATTERN_CHUNK;
+#ifdef N64
+		if (ctx->stream_rom_addr) {
+			xm_stream_refill_rom(ctx, len);
+		} else
+#endif
+		{
+			fseek(ctx->fh, ctx->stream_offset, SEEK_SET);
+			fread(ctx->stream_buf, len, 1, ctx->fh);
+			ctx->stream_pos = 0;
+		}
+		ctx->stream_len = ctx->stream_pos + len;
+		ctx->stream_offset += len;
+		ctx->stream_left -= len;
+#ifdef N64
+		if (ctx->stream_rom_addr)
+			xm_stream_prefetch(ctx);
+#endif
+	}
+	return ctx->stream_buf[ctx->stream_pos++];
+}
+
+static uint32_t xm_stream_varint(xm_context_t* ctx) {
+	uint32_t x = 0;
+	uint8_t y;
+	do {
+		y = xm_stream_byte(ctx);
+		x <<= 7; x |= y & 0x7F;
+	} while (y & 0x80);
+	return x;
+}
+
+/* Decode the next row of the pattern into the slot buffer. This is an
+ * incremental version of xm_context_decompress_pattern: RLE commands can
+ * span across rows, so their state is kept in the context. */
+static void xm_stream_decode_row(xm_context_t* ctx) {
+	uint8_t *out = (uint8_t*)ctx->slot_buffer;
+	int left = sizeof(xm_pattern_slot_t) * ctx->module.num_channels;
+
+	while (left > 0) {
+		if (ctx->rle_zeros) {
+			int n = ctx->rle_zeros < left ? ctx->rle_zeros : left;
+			memset(out, 0, n);
+			out += n; left -= n;
+			ctx->rle_zeros -= n;
+		} else if (ctx->rle_runs) {
+			*out++ = xm_stream_byte(ctx);
+			left--;
+			ctx->rle_runs--;
+		} else {
+			uint32_t cmd = xm_stream_varint(ctx);
+			ctx->rle_runs = cmd & 7;
+			if (ctx->rle_runs == 7) ctx->rle_runs += xm_stream_varint(ctx);
+			ctx->rle_zeros = cmd >> 3;
+		}
+	}
+	ctx->slot_buffer_row++;
+}
+
+/* Make the slot buffer contain the specified row of a pattern. Rows are
+ * normally played in order, so this decodes a single row. Jumping backwards
+ * (eg: E6y loops) restarts decoding from the beginning of the pattern. */
+static void xm_stream_seek_row(xm_context_t* ctx, uint8_t pat_idx, uint8_t row) {
+	if (ctx->slot_buffer_index != pat_idx || row + 1 < ctx->slot_buffer_row) {
+		xm_pattern_t* p = ctx->module.patterns + pat_idx;
+		ctx->slot_buffer_index = pat_idx;
+		ctx->slot_buffer_row = 0;
+		ctx->stream_offset = p->slots_offset;
+		ctx->stream_left = p->slots_size;
+		ctx->stream_pos = ctx->stream_len = 0;
+		ctx->rle_zeros = ctx->rle_runs = 0;
+	}
+	while (ctx->slot_buffer_row <= row)
+		xm_stream_decode_row(ctx);
+}
+#endif
+
 static void xm_row(xm_context_t* ctx) {
 	if(ctx->position_jump) {
 		ctx->current_table_index = ctx->jump_dest;
@@ -878,22 +1040,7 @@ static void xm_row(xm_context_t* ctx) {
 	bool in_a_loop = false;
 
 #if XM_STREAM_PATTERNS
-	if (ctx->slot_buffer_index != pat_idx) {
-		// Read the compressed data at the end of the pattern buffer, that is
-		// at the end of the buffer where data will be uncompressed. The chosen
-		// RLE compression guarantees that this is safe.
-		int cmp_size = cur->slots_size;
-		int dec_size = sizeof(xm_pattern_slot_t) * cur->num_rows * ctx->module.num_channels;
-		uint8_t *cmp_data = (uint8_t*)ctx->slot_buffer + dec_size - cmp_size;
-
-		fseek(ctx->fh, cur->slots_offset, SEEK_SET);
-		fread(cmp_data, cmp_size, 1, ctx->fh);
-
-		int sz = xm_context_decompress_pattern(cmp_data, cmp_size, ctx->slot_buffer);
-		assert(sz == dec_size);
-
-		ctx->slot_buffer_index = pat_idx;
-	}
+	xm_stream_seek_row(ctx, pat_idx, ctx->current_row);
 #endif
 
 	/* Read notes… */
@@ -901,7 +1048,7 @@ static void xm_row(xm_context_t* ctx) {
 		#if !XM_STREAM_PATTERNS
 		xm_pattern_slot_t* s = cur->slots + ctx->current_row * ctx->module.num_channels + i;
 		#else
-		xm_pattern_slot_t* s = ctx->slot_buffer + ctx->current_row * ctx->module.num_channels + i;
+		xm_pattern_slot_t* s = ctx->slot_buffer + i;
 		#endif
 		xm_channel_context_t* ch = ctx->channels + i;
 
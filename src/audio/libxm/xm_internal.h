@@ -16,6 +16,16 @@
 // this amount of bytes. See also rspxm.S for details.
 #define XM_WAVEFORM_OVERREAD      64
 
+/* Size of the chunks in which compressed pattern data is read, when
+ * streaming patterns (XM_STREAM_PATTERNS). */
+#define XM_STREAM_PATTERN_CHUNK   128
+/* Memory allocated for each chunk: a chunk can start at an odd address (to
+ * match the phase of the data in ROM for DMA), and is a whole number of
+ * cachelines. */
+#define XM_STREAM_PATTERN_CHUNK_ALLOC  (XM_STREAM_PATTERN_CHUNK + 16)
+/* Maximum number of channels whose row can be streamed. */
+#define XM_STREAM_MAX_CHANNELS    32
+
 #if XM_STREAM_WAVEFORMS
 typedef struct waveform_s waveform_t;
 #endif
@@ -325,13 +335,32 @@ struct xm_context_s {
 		uint64_t channels_offset;
 	};
 
+	uint32_t wave_bank_id; /* Sample bank holding the waveforms (0 = stored in the file) */
 	FILE* fh;  /* open file for streaming content (if requested) */
 	xm_effect_callback_t effect_callback;
 	void *effect_callback_ctx;
 
 #if XM_STREAM_PATTERNS
-	xm_pattern_slot_t *slot_buffer;
-	int slot_buffer_index;
+	/* Patterns are decoded one row at a time from the compressed data in
+	 * the file (see xm_context_decompress_pattern). */
+	xm_pattern_slot_t *slot_buffer; /* Last decoded row */
+	int slot_buffer_index; /* Pattern being decoded (-1 if none) */
+	int slot_buffer_row; /* Number of rows decoded so far */
+	uint8_t *stream_buf; /* Chunk of compressed data being decoded */
+	uint32_t stream_offset; /* File offset of the next chunk */
+	uint16_t stream_left; /* Compressed bytes not read yet */
+	uint16_t stream_pos, stream_len; /* Position and end of the data in stream_buf */
+	uint32_t rle_zeros, rle_runs; /* Remaining zeros and literals of the current RLE command */
+
+	/* If the file is in ROM, chunks are read via PI DMA, and the next chunk
+	 * (or the first one of the next pattern in the order table) is read
+	 * ahead asynchronously into a second buffer. */
+	uint32_t stream_rom_addr; /* ROM address of the file (0 = use fread) */
+	uint8_t *stream_next; /* Chunk being read ahead */
+	uint32_t stream_next_offset; /* File offset of the chunk being read ahead */
+	uint16_t stream_next_len; /* Size of the chunk being read ahead (0 = none) */
+	uint16_t stream_next_pos; /* Position of the data in stream_next */
+	volatile bool stream_next_pending; /* True until the read-ahead DMA is finished */
 #endif
 };
 
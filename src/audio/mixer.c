@@ -19,6 +19,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <assert.h>
+#include <limits.h>
 
 /** @brief Set to 1 to activate debug logs */
 #define MIXER_TRACE   0
@@ -51,19 +52,55 @@
  */
 #define MIXER_POLL_PER_SECOND   8
 
+/** @brief Number of slots mixed by each run of the RSP mixer ucode
+ *
+ * This is the number of channels that fit the settings of rsp_mixer.S in
+ * DMEM (MAX_CHANNELS). A bus using more slots is mixed in multiple passes:
+ * the first pass is mixed as usual, while each following pass is mixed into
+ * a temporary buffer, which the effects ucode then adds (with saturation) to
+ * the output of the first. This only happens while more than this number of
+ * slots of the bus are in use.
+ */
+#define MIXER_RSP_SLOTS         32
+
+/** @brief Maximum number of passes of the RSP mixer ucode for each bus */
+#define MIXER_MAX_PASSES        (MIXER_MAX_CHANNELS / MIXER_RSP_SLOTS)
+
 /**
  * RSP mixer ucode (rsp_mixer.S)
  */
 DEFINE_RSP_UCODE(rsp_mixer);
 
-/** @brief Size of the ucode state that is automatically persisted by rspq */
-#define MIXER_STATE_SIZE 128
+/**
+ * RSP mixer effects ucode (rsp_mixer_fx.S)
+ */
+DEFINE_RSP_UCODE(rsp_mixer_fx);
 
 // NOTE: keep these in sync with rsp_mixer.S
 #define CH_FLAGS_BPS_SHIFT  (3<<0)   ///< BPS shift value
 #define CH_FLAGS_16BIT      (1<<2)   ///< Set if the channel is 16 bit
 #define CH_FLAGS_STEREO     (1<<3)   ///< Set if the channel is stereo (left)
 #define CH_FLAGS_STEREO_SUB (1<<4)   ///< The channel is the second half of a stereo (right)
+#define CH_FLAGS_XVOL_RESET (1<<5)   ///< Reset the volume filter of the RSP slot (only sent to RSP)
+#define CH_FLAGS_HQ         (1<<6)   ///< Resample with cubic interpolation (only sent to RSP)
+
+// NOTE: keep these in sync with rsp_mixer_fx.S
+#define FX_FLAGS_LOWPASS    (1<<0)   ///< The bus has a lowpass filter
+#define FX_FLAGS_REVERB     (1<<1)   ///< The bus has a reverb
+
+/** @brief Output samples to keep mixing a paused channel after its fade-out
+ *
+ * The volume filter of the RSP lags behind the fade-out ramp, so the channel
+ * is mixed a little longer to let the filter reach silence, avoiding clicks.
+ */
+#define MIXER_PAUSE_TAIL          1024
+
+/** @brief Length of the comb filter delay line of the reverb (milliseconds) */
+#define MIXER_REVERB_COMB_MS      41
+/** @brief Length of the allpass filter delay line of the reverb (milliseconds) */
+#define MIXER_REVERB_ALLPASS_MS   7
+/** @brief Coefficient of the allpass filter of the reverb */
+#define MIXER_REVERB_ALLPASS_K    0.6f
 
 /// @brief Fixed point value used in waveform position calculations.
 /// This is a signed 64-bit integer with the fractional part using
@@ -124,11 +161,54 @@ _Static_assert(sizeof(rsp_mixer_channel_t) == 6*4);
  * This struct reflects the settings defined in rsp_mixer.S.
  */
 typedef struct rsp_mixer_settings_s {
-	uint32_t lvol[MIXER_MAX_CHANNELS/2] __attribute__((aligned(16)));
-	uint32_t rvol[MIXER_MAX_CHANNELS/2];
-	rsp_mixer_channel_t channels[MIXER_MAX_CHANNELS] __attribute__((aligned(16)));
+	uint32_t lvol[MIXER_RSP_SLOTS/2] __attribute__((aligned(16)));
+	uint32_t rvol[MIXER_RSP_SLOTS/2];
+	uint32_t xvol_l[MIXER_RSP_SLOTS/2];    ///< Volume filter state (written by RSP)
+	uint32_t xvol_r[MIXER_RSP_SLOTS/2];    ///< Volume filter state (written by RSP)
+	rsp_mixer_channel_t channels[MIXER_RSP_SLOTS] __attribute__((aligned(16)));
+	// NOTE: the ramp steps must follow the channels (see RAMP_RDRAM_OFFSET in rsp_mixer.S)
+	uint32_t ramp_l[MIXER_RSP_SLOTS/2] __attribute__((aligned(16)));    ///< Volume ramp steps (see #mixer_bus_setup)
+	uint32_t ramp_r[MIXER_RSP_SLOTS/2];                                 ///< Volume ramp steps (see #mixer_bus_setup)
 } rsp_mixer_settings_t;
 
+/** @brief Mixer effects ucode configuration and state of a bus.
+ *
+ * This struct reflects the parameters defined in rsp_mixer_fx.S. The fields
+ * starting from lp_state are written back by the RSP after each command.
+ */
+typedef struct rsp_mixer_fx_s {
+	int16_t lp_matrix[10][8];   ///< Lowpass coefficients (see mixer_bus_set_lowpass)
+	int16_t gains[8];           ///< Reverb gains: feedback, 1-feedback, k, -k, wet, 1
+	uint32_t lp_state;          ///< Last frame output by the lowpass
+	uint32_t flags;             ///< Active effects (FX_FLAGS_*)
+	uint32_t comb_buf;          ///< Comb filter delay line (physical address)
+	uint32_t comb_len;          ///< Length of the comb filter delay line (bytes)
+	uint32_t comb_pos;          ///< Current position in the comb filter delay line (bytes)
+	uint32_t ap_buf;            ///< Allpass filter delay line (physical address)
+	uint32_t ap_len;            ///< Length of the allpass filter delay line (bytes)
+	uint32_t ap_pos;            ///< Current position in the allpass filter delay line (bytes)
+} __attribute__((aligned(16))) rsp_mixer_fx_t;
+
+/// @cond
+_Static_assert(sizeof(rsp_mixer_fx_t) == 208);
+/// @endcond
+
+/** @brief A linear ramp of a value over a number of output samples */
+typedef struct {
+	float from;             ///< Value at the start of the ramp
+	float to;               ///< Value at the end of the ramp
+	int len;                ///< Length of the ramp (output samples)
+	int pos;                ///< Output samples mixed since the start of the ramp
+} mixer_ramp_t;
+
+/** @brief A mixer bus: a group of channels mixed together, with its effects */
+typedef struct {
+	int8_t slot_ch[MIXER_MAX_CHANNELS];   ///< Channel using each RSP slot of the bus (-1 if free)
+	uint32_t fx_flags;                    ///< Active effects (FX_FLAGS_*)
+	void *reverb_mem;                     ///< Delay lines of the reverb (uncached)
+	bool unity;                           ///< All the channels had unity gain in the last frame (see #mixer_bus_setup)
+} mixer_bus_t;
+
 /** @brief Configured limits of a mixer channel. 
  *
  * This structure describes the playback limits for a mixer channel. The limits
@@ -138,6 +218,7 @@ typedef struct {
 	int max_bits;           ///< Maximum number of bits per channel
 	float max_frequency;    ///< Maximum frequency
 	int max_buf_sz;         ///< Maximum sample buffer size (bytes)
+	int readahead;          ///< Bytes to read ahead of playback (see #mixer_ch_set_readahead)
 } channel_limit_t;
 
 /** @brief A mixer event (synchronized with sample playback) */
@@ -158,13 +239,40 @@ static struct {
 
 	uint8_t *ch_buf_mem;
 	samplebuffer_t ch_buf[MIXER_MAX_CHANNELS];
+	int ch_buf_size[MIXER_MAX_CHANNELS];      ///< Size of the memory of each sample buffer (bytes)
+	uint64_t ch_buf_merged;                   ///< Channels whose sample buffer also owns the memory of the next one
 	channel_limit_t limits[MIXER_MAX_CHANNELS];
 
 	mixer_channel_t channels[MIXER_MAX_CHANNELS];
-	mixer_fx15_t lvol[MIXER_MAX_CHANNELS];
-	mixer_fx15_t rvol[MIXER_MAX_CHANNELS];
-
-	rsp_mixer_settings_t ucode_settings __attribute__((aligned(8)));
+	int8_t ch_bus[MIXER_MAX_CHANNELS];        ///< Bus each channel is routed to
+	uint64_t ch_hq;                           ///< Channels that requested #MIXER_QUALITY_HIGH
+	int8_t slot_of[MIXER_MAX_CHANNELS];       ///< RSP slot assigned to each channel (-1 if not playing)
+	int8_t slot_bus[MIXER_MAX_CHANNELS];      ///< Bus of the RSP slot assigned to each channel
+	mixer_ramp_t lvol[MIXER_MAX_CHANNELS];       ///< Left volume of each channel (possibly ramping)
+	mixer_ramp_t rvol[MIXER_MAX_CHANNELS];       ///< Right volume of each channel (possibly ramping)
+	mixer_ramp_t pause_gain[MIXER_MAX_CHANNELS]; ///< Gain applied to the volumes for pause/resume fades
+	uint64_t ch_paused;                          ///< Channels paused or fading out to pause
+	uint64_t ch_playing;                      ///< Channels playing a waveform (including the secondary ones of stereo waveforms)
+
+	uint64_t voice_mask;                      ///< Channels that belong to the voice pool (see #mixer_voices_init)
+	uint32_t voice_serial;                    ///< Serial number of the last voice started
+	uint32_t ch_voice[MIXER_MAX_CHANNELS];    ///< Serial number of the voice using each channel
+	int ch_voice_prio[MIXER_MAX_CHANNELS];    ///< Priority of the voice using each channel
+
+	mixer_bus_t buses[MIXER_MAX_BUSES];
+	int16_t *bus_buf;                         ///< Samples of the bus being processed by the effects (uncached)
+	int bus_buf_size;                         ///< Size of bus_buf (bytes)
+	int16_t *pass_buf;                        ///< Samples of the passes after the first of a bus (uncached, see #MIXER_RSP_SLOTS)
+
+	rsp_mixer_settings_t ucode_settings[MIXER_MAX_BUSES][MIXER_MAX_PASSES] __attribute__((aligned(16)));
+	rsp_mixer_fx_t ucode_fx[MIXER_MAX_BUSES];
+	rsp_mixer_fx_t ucode_pass_fx;             ///< Effects configuration (none) used to add up the passes
+
+	mixer_stats_t stats;
+	int underruns_base;                       ///< Value of #audio_get_underruns at the last stats reset
+
+	int managed_target;                       ///< Managed mode: number of audio buffers to keep queued (0 = disabled)
+	bool managed_polling;                     ///< Managed mode: true while mixing from the AI interrupt
 
 } Mixer;
 
@@ -172,28 +280,46 @@ static struct {
 int64_t __mixer_profile_rsp = 0;
 
 static uint32_t __mixer_overlay_id;
+static uint32_t __mixer_fx_overlay_id;
 
 static inline int mixer_initialized(void) { return Mixer.num_channels != 0; }
 
+bool __rspq_highpri_available(void);
+static void mixer_managed_callback(void);
+static void mixer_fx_init(void);
+
 void mixer_init(int num_channels) {
+	assertf(num_channels > 0 && num_channels <= MIXER_MAX_CHANNELS,
+		"mixer_init: invalid number of channels: %d (max: %d)", num_channels, MIXER_MAX_CHANNELS);
 	memset(&Mixer, 0, sizeof(Mixer));
 
 	Mixer.num_channels = num_channels;
 	Mixer.sample_rate = audio_get_frequency();  // actual sample rate obtained via DAC clock
 	assertf(Mixer.sample_rate > 0, "audio_init() must be called before mixer_init()");
 	Mixer.vol = 1.0f;
+	Mixer.underruns_base = audio_get_underruns();
+	memset(Mixer.slot_of, -1, sizeof(Mixer.slot_of));
+	for (int b=0;b<MIXER_MAX_BUSES;b++)
+		memset(Mixer.buses[b].slot_ch, -1, sizeof(Mixer.buses[b].slot_ch));
 
 	for (int ch=0;ch<MIXER_MAX_CHANNELS;ch++) {
 		mixer_ch_set_vol(ch, 1.0f, 1.0f);
+		Mixer.pause_gain[ch] = (mixer_ramp_t){ .from = 1.0f, .to = 1.0f };
 		mixer_ch_set_limits(ch, 16, Mixer.sample_rate, 0);
 	}
 
-	void *mixer_state = rspq_overlay_get_state(&rsp_mixer);
-	memset(mixer_state, 0, MIXER_STATE_SIZE);
-	data_cache_hit_writeback(mixer_state, MIXER_STATE_SIZE);
+	// The ucode settings (including the volume filter state) and the effect
+	// states are only accessed via uncached addresses from now on.
+	data_cache_hit_writeback_invalidate(Mixer.ucode_settings, sizeof(Mixer.ucode_settings));
+	data_cache_hit_writeback_invalidate(Mixer.ucode_fx, sizeof(Mixer.ucode_fx));
+	data_cache_hit_writeback_invalidate(&Mixer.ucode_pass_fx, sizeof(Mixer.ucode_pass_fx));
 
 	rspq_init();
     __mixer_overlay_id = rspq_overlay_register(&rsp_mixer);
+
+	// The passes after the first are added up by the effects ucode
+	if (num_channels > MIXER_RSP_SLOTS)
+		mixer_fx_init();
 }
 
 static void mixer_init_samplebuffers(void) {
@@ -210,13 +336,19 @@ static void mixer_init_samplebuffers(void) {
 		nsamples *= Mixer.limits[i].max_bits / 8;
 
 		// Calculate buffer size according to number of expected polls per second.
-		bufsize[i] = ROUND_UP((int)ceilf((float)nsamples / (float)MIXER_POLL_PER_SECOND), 8);
+		// Buffers are multiple of the cacheline size, so that samples written
+		// via cache (see samplebuffer_append_cached) never share a cacheline
+		// with another buffer.
+		bufsize[i] = ROUND_UP((int)ceilf((float)nsamples / (float)MIXER_POLL_PER_SECOND), 16);
+
+		// Make room for the samples read ahead of playback
+		bufsize[i] += ROUND_UP(Mixer.limits[i].readahead, 16);
 
 		// If we're over the allowed maximum, clamp to it
 		if (Mixer.limits[i].max_buf_sz && bufsize[i] > Mixer.limits[i].max_buf_sz)
-			bufsize[i] = Mixer.limits[i].max_buf_sz;
+			bufsize[i] = Mixer.limits[i].max_buf_sz & ~15;
 
-		assert((bufsize[i] % 8) == 0);
+		assert((bufsize[i] % 16) == 0);
 		totsize += bufsize[i];
 	}
 
@@ -229,12 +361,61 @@ static void mixer_init_samplebuffers(void) {
 	// Initialize the sample buffers
 	for (int i=0;i<Mixer.num_channels;i++) {
 		samplebuffer_init(&Mixer.ch_buf[i], cur, bufsize[i]);
+		Mixer.ch_buf_size[i] = bufsize[i];
 		cur += bufsize[i];
 	}
+	Mixer.ch_buf_merged = 0;
 
 	assert(cur == Mixer.ch_buf_mem+totsize);
 }
 
+static void mixer_free_samplebuffers(void) {
+	if (Mixer.ch_buf_mem) {
+		for (int i=0;i<Mixer.num_channels;i++)
+			samplebuffer_close(&Mixer.ch_buf[i]);
+		free_uncached(Mixer.ch_buf_mem);
+		Mixer.ch_buf_mem = NULL;
+	}
+}
+
+static uint8_t* mixer_ch_buf_mem(int ch) {
+	uint8_t *mem = Mixer.ch_buf_mem;
+	for (int i=0;i<ch;i++)
+		mem += Mixer.ch_buf_size[i];
+	return mem;
+}
+
+// Give back to channel ch+1 its own sample buffer memory, after it was
+// used by a stereo waveform on channel ch (see mixer_ch_buf_merge).
+static void mixer_ch_buf_split(int ch) {
+	if (!(Mixer.ch_buf_merged & (1ull<<ch)))
+		return;
+	samplebuffer_wait(&Mixer.ch_buf[ch]);
+	samplebuffer_init(&Mixer.ch_buf[ch], mixer_ch_buf_mem(ch), Mixer.ch_buf_size[ch]);
+	samplebuffer_init(&Mixer.ch_buf[ch+1], mixer_ch_buf_mem(ch+1), Mixer.ch_buf_size[ch+1]);
+	Mixer.ch_buf_merged &= ~(1ull<<ch);
+}
+
+// A stereo waveform is played as a single interleaved stream on channel ch,
+// and channel ch+1 only provides the slot for the right samples in the RSP
+// mixer. Its sample buffer would otherwise sit unused, so let channel ch
+// use also that memory (the two areas are contiguous). This way, stereo
+// waveforms are buffered for as long as mono ones, and do not require
+// more frequent (and smaller) reads.
+static void mixer_ch_buf_merge(int ch) {
+	if (Mixer.ch_buf_merged & (1ull<<ch))
+		return;
+	if (ch+1 < Mixer.num_channels-1)
+		mixer_ch_buf_split(ch+1);
+	Mixer.channels[ch+1].ptr = 0;
+	samplebuffer_close(&Mixer.ch_buf[ch+1]);
+	Mixer.ch_buf[ch+1].wv_ctx = NULL;
+	samplebuffer_wait(&Mixer.ch_buf[ch]);
+	samplebuffer_init(&Mixer.ch_buf[ch], mixer_ch_buf_mem(ch),
+		Mixer.ch_buf_size[ch] + Mixer.ch_buf_size[ch+1]);
+	Mixer.ch_buf_merged |= 1ull<<ch;
+}
+
 void mixer_set_vol(float vol) {
 	Mixer.vol = vol;
 }
@@ -242,12 +423,29 @@ void mixer_set_vol(float vol) {
 void mixer_close(void) {
 	assert(mixer_initialized());
 
+	mixer_set_managed(0);
+
 	rspq_overlay_unregister(__mixer_overlay_id);
 	__mixer_overlay_id = 0;
+	if (__mixer_fx_overlay_id) {
+		rspq_overlay_unregister(__mixer_fx_overlay_id);
+		__mixer_fx_overlay_id = 0;
+	}
 
-	if (Mixer.ch_buf_mem) {
-		free_uncached(Mixer.ch_buf_mem);
-		Mixer.ch_buf_mem = NULL;
+	mixer_free_samplebuffers();
+	for (int b=0;b<MIXER_MAX_BUSES;b++) {
+		if (Mixer.buses[b].reverb_mem) {
+			free_uncached(Mixer.buses[b].reverb_mem);
+			Mixer.buses[b].reverb_mem = NULL;
+		}
+	}
+	if (Mixer.pass_buf) {
+		free_uncached(Mixer.pass_buf);
+		Mixer.pass_buf = NULL;
+	}
+	if (Mixer.bus_buf) {
+		free_uncached(Mixer.bus_buf);
+		Mixer.bus_buf = NULL;
 	}
 
 	Mixer.num_channels = 0;
@@ -260,19 +458,77 @@ void mixer_ch_set_freq(int ch, float frequency) {
 	c->step = MIXER_FX64(frequency / (float)Mixer.sample_rate) << (c->flags & CH_FLAGS_BPS_SHIFT);
 }
 
+void mixer_ch_set_freq_fx(int ch, fx32_t frequency) {
+	mixer_channel_t *c = &Mixer.channels[ch];
+	assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_ch_set_freq_fx: cannot call on secondary stereo channel %d", ch);
+	assertf(frequency >= 0, "mixer_ch_set_freq_fx: cannot set negative frequency on channel %d: %d", ch, (int)fx32_to_int(frequency));
+	c->step = ((frequency / Mixer.sample_rate) >> (FX32_FRAC - MIXER_FX64_FRAC)) << (c->flags & CH_FLAGS_BPS_SHIFT);
+}
+
+// Value of a ramp after the specified number of output samples from now
+static float mixer_ramp_value(mixer_ramp_t *r, int ahead) {
+	int pos = r->pos + ahead;
+	if (pos >= r->len)
+		return r->to;
+	return r->from + (r->to - r->from) * (float)pos / (float)r->len;
+}
+
+// Start a ramp from the current value of r to the specified value
+static void mixer_ramp_start(mixer_ramp_t *r, float to, int len) {
+	r->from = mixer_ramp_value(r, 0);
+	r->to = to;
+	r->len = MAX(len, 0);
+	r->pos = 0;
+}
+
+// Advance a ramp. The position is capped so that it cannot overflow, but it
+// still goes a little past the end, to track the tail of paused channels.
+static void mixer_ramp_advance(mixer_ramp_t *r, int num_samples) {
+	r->pos = MIN(r->pos + num_samples, r->len + MIXER_PAUSE_TAIL);
+}
+
+// Return true if the channel is paused, and its fade-out is over: it must
+// not be mixed anymore (nor its waveform read).
+static bool mixer_ch_halted(int ch) {
+	mixer_ramp_t *g = &Mixer.pause_gain[ch];
+	return (Mixer.ch_paused & (1ull << ch)) && g->pos >= g->len + (g->len ? MIXER_PAUSE_TAIL : 0);
+}
+
+// Calculate the volumes of a channel after the specified number of output
+// samples from now, applying the ramps and the pause gain.
+static void mixer_ch_vol_at(int ch, int ahead, mixer_fx15_t *lvol, mixer_fx15_t *rvol) {
+	float gain = mixer_ramp_value(&Mixer.pause_gain[ch], ahead);
+	*lvol = MIXER_FX15(mixer_ramp_value(&Mixer.lvol[ch], ahead) * gain);
+	*rvol = MIXER_FX15(mixer_ramp_value(&Mixer.rvol[ch], ahead) * gain);
+}
+
 void mixer_ch_set_vol(int ch, float lvol, float rvol) {
 	mixer_channel_t *c = &Mixer.channels[ch];
 	assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_ch_set_vol: cannot call on secondary stereo channel %d", ch);
-	Mixer.lvol[ch] = MIXER_FX15(lvol);
-	Mixer.rvol[ch] = MIXER_FX15(rvol);
+	Mixer.lvol[ch] = (mixer_ramp_t){ .from = lvol, .to = lvol };
+	Mixer.rvol[ch] = (mixer_ramp_t){ .from = rvol, .to = rvol };
+}
+
+void mixer_ch_set_vol_fx(int ch, fx16_t lvol, fx16_t rvol) {
+	mixer_ch_set_vol(ch, fx16_to_float(lvol), fx16_to_float(rvol));
+}
+
+void mixer_ch_set_vol_ramp(int ch, float lvol, float rvol, int samples) {
+	mixer_channel_t *c = &Mixer.channels[ch];
+	assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_ch_set_vol_ramp: cannot call on secondary stereo channel %d", ch);
+	mixer_ramp_start(&Mixer.lvol[ch], lvol, samples);
+	mixer_ramp_start(&Mixer.rvol[ch], rvol, samples);
 }
 
 void mixer_ch_set_vol_pan(int ch, float vol, float pan) {
 	mixer_ch_set_vol(ch, vol * (1.f - pan), vol * pan);
 }
 
-void mixer_ch_set_vol_dolby(int ch, float fl, float fr,
-	float c, float sl, float sr) {
+// Encode the volumes of 5 channels (front left, front right, center,
+// surround left, surround right) into left/right volumes, according to
+// the Dolby Pro Logic II matrix.
+static void mixer_dolby_encode(float fl, float fr, float c, float sl, float sr,
+	float *lvol, float *rvol) {
 
 	/// @cond
 	#define SQRT_05   0.7071067811865476f
@@ -291,10 +547,15 @@ void mixer_ch_set_vol_dolby(int ch, float fl, float fr,
 	#define KBn       (KB/KTOT)
 	/// @endcond
 
-	mixer_ch_set_vol(ch,
-		fl*KFn + c*KCn - sl*KAn - sr*KBn,
-		fr*KFn + c*KCn + sl*KBn + sr*KAn
-	);
+	*lvol = fl*KFn + c*KCn - sl*KAn - sr*KBn;
+	*rvol = fr*KFn + c*KCn + sl*KBn + sr*KAn;
+}
+
+void mixer_ch_set_vol_dolby(int ch, float fl, float fr,
+	float c, float sl, float sr) {
+	float lvol, rvol;
+	mixer_dolby_encode(fl, fr, c, sl, sr, &lvol, &rvol);
+	mixer_ch_set_vol(ch, lvol, rvol);
 }
 
 // Given a position within a looping waveform, calculate its wrapped position
@@ -374,16 +635,29 @@ void mixer_ch_play(int ch, waveform_t *wave) {
 		mixer_init_samplebuffers();
 	}
 
+	assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_ch_play: cannot call on secondary stereo channel %d", ch);
+
+	// If the memory of this channel was lent to a stereo waveform on the
+	// previous channel (which is now stopped), take it back.
+	if (ch > 0)
+		mixer_ch_buf_split(ch-1);
+
 	// Configure the waveform on this channel, if we have not
 	// already. This optimization is useful in case the caller
 	// wants to play the same waveform on the same channel multiple
 	// times, and the waveform has been already decoded and cached
 	// in the sample buffer.
 	if (wave != sbuf->wv_ctx) {
+		assert(wave->channels == 1 || wave->channels == 2);
+		if (wave->channels == 2) {
+			assertf(ch != Mixer.num_channels-1, "cannot configure last channel (%d) as stereo", ch);
+			mixer_ch_buf_merge(ch);
+		} else {
+			mixer_ch_buf_split(ch);
+		}
 		samplebuffer_flush(sbuf);
 
 		// Configure the sample buffer for this waveform
-		assert(wave->channels == 1 || wave->channels == 2);
 		assert(wave->bits == 8 || wave->bits == 16);
 		samplebuffer_set_bps(sbuf, wave->bits*wave->channels);
 		samplebuffer_set_waveform(sbuf, wave->read ? waveform_read : NULL, wave);
@@ -397,19 +671,23 @@ void mixer_ch_play(int ch, waveform_t *wave) {
 		c->loop_len = MIXER_FX64((int64_t)wave->loop_len) << bps;
 		mixer_ch_set_freq(ch, wave->frequency);
 
-		if (wave->channels == 2) {
-			assertf(ch != Mixer.num_channels-1, "cannot configure last channel (%d) as stereo", ch);
-			Mixer.channels[ch+1].flags |= CH_FLAGS_STEREO_SUB;
-		} else if (ch != Mixer.num_channels-1) {
-			Mixer.channels[ch+1].flags &= ~CH_FLAGS_STEREO_SUB;
-		}
-
 		tracef("mixer_ch_play: ch=%d len=%llx loop_len=%llx wave=%s\n", ch, c->len >> (MIXER_FX64_FRAC+bps), c->loop_len >> (MIXER_FX64_FRAC+bps), wave->name);
 	}
 
-	// Restart from the beginning of the waveform
+	// Reserve the next channel for the right samples. Do this also when
+	// the waveform was cached, as the flag is cleared when playback stops.
+	if (wave->channels == 2) {
+		Mixer.channels[ch+1].flags |= CH_FLAGS_STEREO_SUB;
+	} else if (ch != Mixer.num_channels-1) {
+		Mixer.channels[ch+1].flags &= ~CH_FLAGS_STEREO_SUB;
+	}
+
+	// Restart from the beginning of the waveform, cancelling any pause
 	c->ptr = SAMPLES_PTR(sbuf);
 	c->pos = 0;
+	Mixer.ch_paused &= ~(1ull << ch);
+	Mixer.pause_gain[ch] = (mixer_ramp_t){ .from = 1.0f, .to = 1.0f };
+	Mixer.ch_playing |= (wave->channels == 2 ? 3ull : 1ull) << ch;
 }
 
 void mixer_ch_set_pos(int ch, float pos) {
@@ -427,9 +705,12 @@ float mixer_ch_get_pos(int ch) {
 
 void mixer_ch_stop(int ch) {
 	mixer_channel_t *c = &Mixer.channels[ch];
+	Mixer.ch_playing &= ~((c->flags & CH_FLAGS_STEREO ? 3ull : 1ull) << ch);
 	c->ptr = 0;
 	if (c->flags & CH_FLAGS_STEREO)
 		c[1].flags &= ~CH_FLAGS_STEREO_SUB;
+	Mixer.ch_paused &= ~(1ull << ch);
+	Mixer.pause_gain[ch] = (mixer_ramp_t){ .from = 1.0f, .to = 1.0f };
 
 	// Restart caching if played again. We need this guarantee
 	// because after calling stop(), the caller must be able
@@ -438,12 +719,126 @@ void mixer_ch_stop(int ch) {
 
 }
 
+void mixer_ch_set_quality(int ch, mixer_quality_t quality) {
+	assertf(!(Mixer.channels[ch].flags & CH_FLAGS_STEREO_SUB), "mixer_ch_set_quality: cannot call on secondary stereo channel %d", ch);
+	if (quality == MIXER_QUALITY_HIGH)
+		Mixer.ch_hq |= 1ull << ch;
+	else
+		Mixer.ch_hq &= ~(1ull << ch);
+}
+
 bool mixer_ch_playing(int ch) {
 	mixer_channel_t *c = &Mixer.channels[ch];
 	assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_ch_playing: cannot call on secondary stereo channel %d", ch);
 	return c->ptr != 0;
 }
 
+void mixer_ch_pause(int ch, int fade_samples) {
+	mixer_channel_t *c = &Mixer.channels[ch];
+	assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_ch_pause: cannot call on secondary stereo channel %d", ch);
+	if (Mixer.ch_paused & (1ull << ch))
+		return;
+	Mixer.ch_paused |= 1ull << ch;
+	mixer_ramp_start(&Mixer.pause_gain[ch], 0.0f, fade_samples);
+}
+
+void mixer_ch_resume(int ch, int fade_samples) {
+	mixer_channel_t *c = &Mixer.channels[ch];
+	assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_ch_resume: cannot call on secondary stereo channel %d", ch);
+	if (!(Mixer.ch_paused & (1ull << ch)))
+		return;
+	// If the channel was halted, its slot was released, so the volume
+	// filter will also restart from silence.
+	Mixer.ch_paused &= ~(1ull << ch);
+	mixer_ramp_start(&Mixer.pause_gain[ch], 1.0f, fade_samples);
+}
+
+bool mixer_ch_paused(int ch) {
+	mixer_channel_t *c = &Mixer.channels[ch];
+	assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_ch_paused: cannot call on secondary stereo channel %d", ch);
+	return (Mixer.ch_paused & (1ull << ch)) != 0;
+}
+
+void mixer_voices_init(int first_ch, int num_ch) {
+	assertf(first_ch >= 0 && num_ch >= 0 && first_ch + num_ch <= Mixer.num_channels,
+		"mixer_voices_init: invalid channel range %d-%d", first_ch, first_ch + num_ch - 1);
+	Mixer.voice_mask = num_ch ? (~0ull >> (64 - num_ch)) << first_ch : 0;
+}
+
+mixer_voice_t mixer_voice_play(waveform_t *wave, int priority) {
+	assertf(Mixer.voice_mask, "mixer_voice_play: call mixer_voices_init first");
+	bool stereo = wave->channels == 2;
+
+	// Channels where the voice can start: a stereo voice also needs the
+	// following channel.
+	uint64_t cand = Mixer.voice_mask;
+	uint64_t busy = Mixer.ch_playing;
+	if (stereo) {
+		cand &= Mixer.voice_mask >> 1;
+		busy |= busy >> 1;
+	}
+
+	int ch;
+	if (cand & ~busy) {
+		// Use the first free channel
+		ch = __builtin_ctzll(cand & ~busy);
+	} else {
+		// Steal the voice with the lowest priority, and among those the
+		// oldest one. This scan is only needed when the pool is full.
+		ch = -1;
+		int best_prio = 0; uint32_t best_serial = 0;
+		for (uint64_t m = cand; m; m &= m-1) {
+			int c = __builtin_ctzll(m);
+			int prio = INT_MIN; uint32_t serial = 0;
+			for (int k = c; k <= c + stereo; k++) {
+				if (Mixer.ch_playing & (1ull << k)) {
+					prio = MAX(prio, Mixer.ch_voice_prio[k]);
+					serial = MAX(serial, Mixer.ch_voice[k]);
+				}
+			}
+			if (ch < 0 || prio < best_prio || (prio == best_prio && serial < best_serial)) {
+				ch = c; best_prio = prio; best_serial = serial;
+			}
+		}
+		// Do not steal voices that are more important than the new one.
+		if (best_prio > priority)
+			return 0;
+
+		// Stop the voices using the channels (a channel might be the
+		// secondary channel of a stereo voice started on the previous one).
+		for (int c = ch; c <= ch + stereo; c++) {
+			if (!(Mixer.ch_playing & (1ull << c)))
+				continue;
+			int owner = (Mixer.channels[c].flags & CH_FLAGS_STEREO_SUB) ? c-1 : c;
+			mixer_ch_stop(owner);
+		}
+	}
+
+	// Serial numbers start from 1, so that a valid handle is never 0.
+	Mixer.voice_serial = (Mixer.voice_serial + 1) & 0xFFFFFF;
+	if (!Mixer.voice_serial) Mixer.voice_serial = 1;
+
+	mixer_ch_play(ch, wave);
+	for (int c = ch; c <= ch + stereo; c++) {
+		Mixer.ch_voice[c] = Mixer.voice_serial;
+		Mixer.ch_voice_prio[c] = priority;
+	}
+	return (Mixer.voice_serial << 8) | ch;
+}
+
+int mixer_voice_ch(mixer_voice_t voice) {
+	int ch = voice & 0xFF;
+	if (!voice || Mixer.ch_voice[ch] != (voice >> 8) || !Mixer.channels[ch].ptr)
+		return -1;
+	return ch;
+}
+
+void mixer_voice_stop(mixer_voice_t voice) {
+	int ch = mixer_voice_ch(voice);
+	if (ch >= 0)
+		mixer_ch_stop(ch);
+}
+
 void mixer_ch_set_limits(int ch, int max_bits, float max_frequency, int max_buf_sz) {
 	assert(max_bits == 0 || max_bits == 8 || max_bits == 16);
 	assert(max_frequency >= 0);
@@ -454,16 +849,407 @@ void mixer_ch_set_limits(int ch, int max_bits, float max_frequency, int max_buf_
 		.max_bits = max_bits ? max_bits : 16,
 		.max_frequency = max_frequency ? max_frequency : Mixer.sample_rate,
 		.max_buf_sz = max_buf_sz,
+		.readahead = Mixer.limits[ch].readahead,
 	};
 
 	// Changing the limits will invalidate the whole sample buffer
 	// memory area. Invalidate all sample buffers.
-	if (Mixer.ch_buf_mem) {
-		for (int i=0;i<Mixer.num_channels;i++)
-			samplebuffer_close(&Mixer.ch_buf[i]);
-		free_uncached(Mixer.ch_buf_mem);
-		Mixer.ch_buf_mem = NULL;
+	mixer_free_samplebuffers();
+}
+
+void mixer_ch_set_readahead(int ch, int nbytes) {
+	assert(nbytes >= 0);
+	Mixer.limits[ch].readahead = nbytes;
+
+	// The sample buffers must be resized to make space for the read-ahead.
+	mixer_free_samplebuffers();
+}
+
+// Register the effects ucode, the first time that buses are used.
+static void mixer_fx_init(void) {
+	if (!__mixer_fx_overlay_id)
+		__mixer_fx_overlay_id = rspq_overlay_register(&rsp_mixer_fx);
+}
+
+// Length in bytes of a delay line of the reverb (16-bit stereo). The
+// effects ucode requires the delay to be longer than its block size.
+static int mixer_fx_delay_len(int ms) {
+	int nframes = Mixer.sample_rate * ms / 1000;
+	return ROUND_UP(MAX(nframes, 64), 8) * 4;
+}
+
+void mixer_ch_set_bus(int ch, int bus) {
+	assertf(bus >= 0 && bus < MIXER_MAX_BUSES, "mixer_ch_set_bus: invalid bus %d", bus);
+	assertf(!(Mixer.channels[ch].flags & CH_FLAGS_STEREO_SUB), "mixer_ch_set_bus: cannot call on secondary stereo channel %d", ch);
+	if (bus)
+		mixer_fx_init();
+	Mixer.ch_bus[ch] = bus;
+}
+
+void mixer_bus_set_lowpass(int bus, float cutoff) {
+	assertf(bus >= 0 && bus < MIXER_MAX_BUSES, "mixer_bus_set_lowpass: invalid bus %d", bus);
+	assertf(cutoff >= 0, "mixer_bus_set_lowpass: invalid cutoff frequency %f", cutoff);
+	mixer_bus_t *b = &Mixer.buses[bus];
+	volatile rsp_mixer_fx_t *fx = UncachedAddr(&Mixer.ucode_fx[bus]);
+
+	if (cutoff == 0) {
+		b->fx_flags &= ~FX_FLAGS_LOWPASS;
+		fx->flags = b->fx_flags;
+		return;
+	}
+
+	mixer_fx_init();
+
+	// One-pole lowpass: y[n] = a*x[n] + (1-a)*y[n-1]. The RSP processes
+	// 4 stereo frames at a time (left samples in even lanes, right samples
+	// in odd lanes), so expand the recursion to express each output lane
+	// as a function of the 8 input lanes and of the last output frame.
+	float a = 1.0f - expf(-2.0f * 3.14159265f * cutoff / Mixer.sample_rate);
+	float k[5] = { 1.0f };
+	for (int i=1;i<5;i++)
+		k[i] = k[i-1] * (1.0f - a);
+
+	for (int out=0;out<8;out++) {
+		for (int in=0;in<8;in++) {
+			bool same_ch = (in & 1) == (out & 1);
+			int dist = (out >> 1) - (in >> 1);
+			fx->lp_matrix[in][out] = (same_ch && dist >= 0) ? MIXER_FX15(a * k[dist]) : 0;
+		}
+		fx->lp_matrix[8][out] = (out & 1) == 0 ? MIXER_FX15(k[(out >> 1) + 1]) : 0;
+		fx->lp_matrix[9][out] = (out & 1) == 1 ? MIXER_FX15(k[(out >> 1) + 1]) : 0;
 	}
+
+	b->fx_flags |= FX_FLAGS_LOWPASS;
+	fx->flags = b->fx_flags;
+}
+
+void mixer_bus_set_reverb(int bus, float feedback, float wet) {
+	assertf(bus >= 0 && bus < MIXER_MAX_BUSES, "mixer_bus_set_reverb: invalid bus %d", bus);
+	assertf(feedback >= 0 && feedback < 1, "mixer_bus_set_reverb: invalid feedback %f", feedback);
+	assertf(wet >= 0 && wet <= 1, "mixer_bus_set_reverb: invalid wet level %f", wet);
+	mixer_bus_t *b = &Mixer.buses[bus];
+	volatile rsp_mixer_fx_t *fx = UncachedAddr(&Mixer.ucode_fx[bus]);
+
+	if (wet == 0) {
+		b->fx_flags &= ~FX_FLAGS_REVERB;
+		fx->flags = b->fx_flags;
+		if (b->reverb_mem) {
+			free_uncached(b->reverb_mem);
+			b->reverb_mem = NULL;
+		}
+		return;
+	}
+
+	mixer_fx_init();
+
+	if (!b->reverb_mem) {
+		int comb_len = mixer_fx_delay_len(MIXER_REVERB_COMB_MS);
+		int ap_len = mixer_fx_delay_len(MIXER_REVERB_ALLPASS_MS);
+		b->reverb_mem = malloc_uncached(comb_len + ap_len);
+		assertf(b->reverb_mem, "mixer_bus_set_reverb: out of memory");
+		memset(b->reverb_mem, 0, comb_len + ap_len);
+
+		fx->comb_buf = PhysicalAddr(b->reverb_mem);
+		fx->comb_len = comb_len;
+		fx->comb_pos = 0;
+		fx->ap_buf = PhysicalAddr(b->reverb_mem + comb_len);
+		fx->ap_len = ap_len;
+		fx->ap_pos = 0;
+	}
+
+	fx->gains[0] = MIXER_FX15(feedback);
+	fx->gains[1] = MIXER_FX15(1.0f - feedback);
+	fx->gains[2] = MIXER_FX15(MIXER_REVERB_ALLPASS_K);
+	fx->gains[3] = -MIXER_FX15(MIXER_REVERB_ALLPASS_K);
+	fx->gains[4] = MIXER_FX15(wet);
+	fx->gains[5] = MIXER_FX15(1.0f);
+
+	b->fx_flags |= FX_FLAGS_REVERB;
+	fx->flags = b->fx_flags;
+}
+
+static inline float vec3_dot(const float *a, const float *b) {
+	return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+void mixer_3d_update(const mixer_3d_listener_t *listener,
+	const mixer_3d_emitter_t *emitters, int num_emitters) {
+	// Right direction of the listener, to calculate the panning
+	const float *fwd = listener->forward, *up = listener->up;
+	float right[3] = {
+		fwd[1]*up[2] - fwd[2]*up[1],
+		fwd[2]*up[0] - fwd[0]*up[2],
+		fwd[0]*up[1] - fwd[1]*up[0],
+	};
+	float sos = listener->speed_of_sound;
+	float inv_rate = 1.0f / (float)Mixer.sample_rate;
+
+	for (int i=0;i<num_emitters;i++) {
+		const mixer_3d_emitter_t *e = &emitters[i];
+		if (e->ch < 0)
+			continue;
+		assertf(e->ch < Mixer.num_channels, "mixer_3d_update: invalid channel %d", e->ch);
+		mixer_channel_t *c = &Mixer.channels[e->ch];
+		assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_3d_update: cannot use secondary stereo channel %d", e->ch);
+		assertf(e->min_dist > 0, "mixer_3d_update: invalid min_dist on channel %d: %f", e->ch, e->min_dist);
+
+		// Direction from the listener to the emitter (zero if they are
+		// at the same position, which is then heard as centered).
+		float dir[3] = {
+			e->pos[0] - listener->pos[0],
+			e->pos[1] - listener->pos[1],
+			e->pos[2] - listener->pos[2],
+		};
+		float dist = sqrtf(vec3_dot(dir, dir));
+		float inv_dist = dist > 1e-6f ? 1.0f / dist : 0.0f;
+		for (int k=0;k<3;k++) dir[k] *= inv_dist;
+
+		// Inverse distance attenuation, clamped to [min_dist, max_dist]
+		float d = CLAMP(dist, e->min_dist, MAX(e->max_dist, e->min_dist));
+		float vol = e->vol * e->min_dist / (e->min_dist + e->rolloff * (d - e->min_dist));
+
+		// Project the direction on the horizontal plane of the listener.
+		// Sounds above or below the listener are heard towards the center.
+		float x = vec3_dot(dir, right);
+		float z = vec3_dot(dir, fwd);
+		float lvol, rvol;
+		if (listener->surround) {
+			float front = (1.0f + z) * 0.5f, back = (1.0f - z) * 0.5f;
+			float l = (1.0f - x) * 0.5f, r = (1.0f + x) * 0.5f;
+			mixer_dolby_encode(vol*front*l, vol*front*r, 0,
+				vol*back*l, vol*back*r, &lvol, &rvol);
+		} else {
+			// Same law of mixer_ch_set_vol_pan
+			lvol = vol * (1.0f - x) * 0.5f;
+			rvol = vol * (1.0f + x) * 0.5f;
+		}
+		Mixer.lvol[e->ch] = (mixer_ramp_t){ .from = lvol, .to = lvol };
+		Mixer.rvol[e->ch] = (mixer_ramp_t){ .from = rvol, .to = rvol };
+
+		if (e->frequency > 0) {
+			float freq = e->frequency;
+			if (sos > 0) {
+				// Velocities along the direction, clamped to avoid the
+				// singularity at the speed of sound.
+				float vl = CLAMP(vec3_dot(listener->vel, dir), -sos*0.5f, sos*0.5f);
+				float ve = CLAMP(vec3_dot(e->vel, dir), -sos*0.5f, sos*0.5f);
+				freq *= (sos + vl) / (sos + ve);
+			}
+			c->step = MIXER_FX64(freq * inv_rate) << (c->flags & CH_FLAGS_BPS_SHIFT);
+		}
+	}
+}
+
+// Release the RSP mixer slots of channels that are not playing anymore (or
+// are paused), whose width changed (eg: a stereo waveform replaced a mono one), or that have
+// been routed to a different bus.
+static void mixer_release_slots(void) {
+	for (int ch=0;ch<Mixer.num_channels;ch++) {
+		int slot = Mixer.slot_of[ch];
+		if (slot < 0)
+			continue;
+		int8_t *slot_ch = Mixer.buses[(int)Mixer.slot_bus[ch]].slot_ch;
+		mixer_channel_t *c = &Mixer.channels[ch];
+		int width = (c->flags & CH_FLAGS_STEREO) ? 2 : 1;
+		bool wide = slot+1 < MIXER_MAX_CHANNELS && slot_ch[slot+1] == ch;
+		if (!c->ptr || (c->flags & CH_FLAGS_STEREO_SUB) || (width == 2) != wide ||
+			Mixer.slot_bus[ch] != Mixer.ch_bus[ch] || mixer_ch_halted(ch)) {
+			slot_ch[slot] = -1;
+			if (wide) slot_ch[slot+1] = -1;
+			Mixer.slot_of[ch] = -1;
+		}
+	}
+}
+
+// Assign a RSP mixer slot to each playing channel of a bus (two consecutive
+// slots for stereo channels), and return the number of slots in use.
+// A channel keeps its slot as long as it plays, because the RSP keeps the
+// state of the volume filter per slot. When a slot is assigned to a new
+// channel, its bit is set in *xvol_reset, so that the RSP restarts the volume
+// filter from silence (as it would happen for a channel that is keyed off
+// and then played again).
+static int mixer_assign_slots(int bus, uint64_t *xvol_reset) {
+	int8_t *slot_ch = Mixer.buses[bus].slot_ch;
+	*xvol_reset = 0;
+
+	// Assign the lowest free slots to channels that just started playing.
+	for (int ch=0;ch<Mixer.num_channels;ch++) {
+		mixer_channel_t *c = &Mixer.channels[ch];
+		if (!c->ptr || (c->flags & CH_FLAGS_STEREO_SUB) || Mixer.slot_of[ch] >= 0 || Mixer.ch_bus[ch] != bus ||
+			mixer_ch_halted(ch))
+			continue;
+		int width = (c->flags & CH_FLAGS_STEREO) ? 2 : 1;
+		// A stereo channel cannot straddle two passes of the RSP mixer
+		int slot = 0;
+		while (slot+width <= MIXER_MAX_CHANNELS &&
+			(slot_ch[slot] >= 0 || (width == 2 && (slot_ch[slot+1] >= 0 || slot % MIXER_RSP_SLOTS == MIXER_RSP_SLOTS-1))))
+			slot++;
+		if (slot+width > MIXER_MAX_CHANNELS) {
+			// Slots are too fragmented to fit a stereo channel. This is
+			// very rare: just repack all channels of the bus from scratch.
+			memset(slot_ch, -1, MIXER_MAX_CHANNELS);
+			for (int i=0;i<Mixer.num_channels;i++)
+				if (Mixer.slot_bus[i] == bus)
+					Mixer.slot_of[i] = -1;
+			*xvol_reset = 0;
+			ch = -1;
+			continue;
+		}
+		slot_ch[slot] = ch;
+		if (width == 2) slot_ch[slot+1] = ch;
+		Mixer.slot_of[ch] = slot;
+		Mixer.slot_bus[ch] = bus;
+		*xvol_reset |= ((1ull << width) - 1) << slot;
+	}
+
+	// The RSP processes all the slots up to the last one in use.
+	int num_slots = MIXER_MAX_CHANNELS;
+	while (num_slots > 0 && slot_ch[num_slots-1] < 0)
+		num_slots--;
+	return num_slots;
+}
+
+// Return the RSP settings of a slot of a bus (see #MIXER_RSP_SLOTS)
+static volatile rsp_mixer_channel_t* mixer_rsp_slot(int bus, int slot) {
+	volatile rsp_mixer_settings_t *settings = UncachedAddr(&Mixer.ucode_settings[bus][slot / MIXER_RSP_SLOTS]);
+	return &settings->channels[slot % MIXER_RSP_SLOTS];
+}
+
+// Fill the RSP mixer settings of a bus with the channels routed to it,
+// and return the number of slots in use (0 if no channel is playing).
+// *unity is set if the bus can be mixed by the RSP without applying the
+// volumes, that is when all its channels are mono, centered, at full volume,
+// and the global volume is also full. Since the volume filter does not run
+// in this mode, this is only done if the same was true in the previous
+// frame (so that the filter had reached the final volumes), and no slot
+// was just assigned (which must ramp up from silence).
+//
+// If the volume of any channel is going to change during the num_samples
+// output samples (because of #mixer_ch_set_vol_ramp or a pause fade), the
+// volumes are set to the ones at the start, and the per-slot steps of the
+// linear ramps to the ones at the end are calculated for the RSP. *ramp_shift
+// is then set to the shift of the number of samples used by the RSP to
+// evaluate the ramps, plus 1 (it is 0 if no volume is ramping).
+static int mixer_bus_setup(int bus, uint64_t fake_loop, float gvol, int num_samples, bool *unity, int *ramp_shift) {
+	volatile rsp_mixer_settings_t *settings = UncachedAddr(Mixer.ucode_settings[bus]);
+
+	mixer_fx15_t lvol[MIXER_MAX_CHANNELS] __attribute__((aligned(8))) = {0};
+	mixer_fx15_t rvol[MIXER_MAX_CHANNELS] __attribute__((aligned(8))) = {0};
+	mixer_fx15_t lend[MIXER_MAX_CHANNELS] __attribute__((aligned(8))) = {0};
+	mixer_fx15_t rend[MIXER_MAX_CHANNELS] __attribute__((aligned(8))) = {0};
+
+	// Only playing channels are sent to the RSP, packed into the lowest
+	// slots, so that the faster mixing core can be used whenever few
+	// channels are playing (even if many are configured).
+	uint64_t xvol_reset;
+	int num_slots = mixer_assign_slots(bus, &xvol_reset);
+	int num_passes = DIVIDE_CEIL(MAX(num_slots, 1), MIXER_RSP_SLOTS);
+	bool all_unity = num_slots > 0 && gvol == 1.0f;
+
+	for (int slot=0;slot<MAX(num_slots, 1);slot++) {
+		volatile rsp_mixer_channel_t *wv = mixer_rsp_slot(bus, slot);
+		wv->ptr = 0;
+		wv->flags = (xvol_reset & (1ull<<slot)) ? CH_FLAGS_XVOL_RESET : 0;
+	}
+
+	for (int ch=0;ch<Mixer.num_channels;ch++) {
+		mixer_channel_t *c = &Mixer.channels[ch];
+		int slot = Mixer.slot_of[ch];
+		if (slot < 0 || Mixer.slot_bus[ch] != bus)
+			continue;
+		volatile rsp_mixer_channel_t *wv = mixer_rsp_slot(bus, slot);
+
+		// Convert to RSP mixer channel structure truncating 64-bit values to 32-bit.
+		// We don't need full absolute position on the RSP, so 32-bit is more
+		// than enough. In fact, we only expose 31 bits, so that we can use the
+		// 32nd bit later to correctly update the position without overflow bugs.
+		wv->pos = (uint32_t)c->pos & 0x7FFFFFFF;
+		wv->step = (uint32_t)c->step & 0x7FFFFFFF;
+		wv->ptr = c->ptr + ((c->pos & ~0x7FFFFFFF) >> MIXER_FX64_FRAC);
+		wv->flags |= c->flags;
+		// Cubic interpolation is only implemented for mono waveforms
+		if ((Mixer.ch_hq & (1ull << ch)) && !(c->flags & CH_FLAGS_STEREO))
+			wv->flags |= CH_FLAGS_HQ;
+
+		// If the loop is fake (i.e. we are unrolling it), or the current
+		// position has been truncated but it's far from the end of the waveform,
+		// just tell the RSP that there is no loop.
+		if (fake_loop & (1ull<<ch) || c->pos>>31 != c->len>>31) {
+			wv->len = 0xFFFFFFFF;
+			wv->loop_len = 0;
+		} else {
+			wv->len = (uint32_t)c->len & 0x7FFFFFFF;
+			// We can't represent a very long loop in RSP. But those loops
+			// should be unrolled anyway (and thus be a fake_loop), so we
+			// should not get here.
+			assert(c->loop_len <= 0x7FFFFFFF);
+			wv->loop_len = (uint32_t)c->loop_len & 0x7FFFFFFF;
+		}
+
+		mixer_fx15_t l0, r0, l1, r1;
+		mixer_ch_vol_at(ch, 0, &l0, &r0);
+		mixer_ch_vol_at(ch, num_samples, &l1, &r1);
+
+		if (c->flags & CH_FLAGS_STEREO) {
+			// The right samples are stored by the RSP in the next slot,
+			// which is otherwise ignored. We just need to configure its volume.
+			lvol[slot] = l0; lend[slot] = l1;
+			rvol[slot+1] = r0; rend[slot+1] = r1;
+			all_unity = false;
+		} else {
+			lvol[slot] = l0; lend[slot] = l1;
+			rvol[slot] = r0; rend[slot] = r1;
+			if (l0 != MIXER_FX15(1.0f) || r0 != MIXER_FX15(1.0f) || l0 != l1 || r0 != r1)
+				all_unity = false;
+		}
+	}
+
+	uint32_t *lvol32 = (uint32_t*)lvol;
+	uint32_t *rvol32 = (uint32_t*)rvol;
+	for (int p=0;p<num_passes;p++) {
+		for (int ch=0;ch<MIXER_RSP_SLOTS/2;ch++)  {
+			settings[p].lvol[ch] = lvol32[p*MIXER_RSP_SLOTS/2 + ch];
+			settings[p].rvol[ch] = rvol32[p*MIXER_RSP_SLOTS/2 + ch];
+		}
+	}
+
+	*ramp_shift = 0;
+	if (memcmp(lvol, lend, sizeof(lvol)) || memcmp(rvol, rend, sizeof(rvol))) {
+		// The RSP multiplies the steps by the number of samples mixed so
+		// far, shifted left to use the whole 16 bits of precision.
+		int shift = 0;
+		while (shift < 15 && (num_samples << (shift+1)) <= 0xFFFF)
+			shift++;
+
+		// Calculate the steps so that the final volumes (with the global
+		// volume applied, as done by the RSP) reach the end values. The RSP
+		// calculates start + elapsed * step * 2 / 65536.
+		int16_t lstep[MIXER_MAX_CHANNELS] __attribute__((aligned(8)));
+		int16_t rstep[MIXER_MAX_CHANNELS] __attribute__((aligned(8)));
+		int g16 = (uint16_t)MIXER_FX16(gvol);
+		float scale = 32768.0f / (float)(num_samples << shift);
+		for (int slot=0;slot<MIXER_MAX_CHANNELS;slot++) {
+			int dl = ((lend[slot] * g16) >> 16) - ((lvol[slot] * g16) >> 16);
+			int dr = ((rend[slot] * g16) >> 16) - ((rvol[slot] * g16) >> 16);
+			lstep[slot] = CLAMP(lroundf(dl * scale), -32768, 32767);
+			rstep[slot] = CLAMP(lroundf(dr * scale), -32768, 32767);
+		}
+
+		uint32_t *lstep32 = (uint32_t*)lstep;
+		uint32_t *rstep32 = (uint32_t*)rstep;
+		for (int p=0;p<num_passes;p++) {
+			for (int ch=0;ch<MIXER_RSP_SLOTS/2;ch++)  {
+				settings[p].ramp_l[ch] = lstep32[p*MIXER_RSP_SLOTS/2 + ch];
+				settings[p].ramp_r[ch] = rstep32[p*MIXER_RSP_SLOTS/2 + ch];
+			}
+		}
+		*ramp_shift = shift + 1;
+		all_unity = false;
+	}
+
+	*unity = all_unity && Mixer.buses[bus].unity && !xvol_reset;
+	Mixer.buses[bus].unity = all_unity;
+	return num_slots;
 }
 
 static void mixer_exec(int32_t *out, int num_samples) {
@@ -475,7 +1261,7 @@ static void mixer_exec(int32_t *out, int num_samples) {
 
 	tracef("mixer_exec: 0x%x samples\n", num_samples);
 
-	uint32_t fake_loop = 0;
+	uint64_t fake_loop = 0;
 
 	for (int i=0; i<Mixer.num_channels; i++) {
 		samplebuffer_t *sbuf = &Mixer.ch_buf[i];
@@ -483,7 +1269,8 @@ static void mixer_exec(int32_t *out, int num_samples) {
 		int bps = ch->flags & CH_FLAGS_BPS_SHIFT;
 		int bps_fx64 = bps + MIXER_FX64_FRAC;
 
-		if (ch->ptr) {
+		if (ch->ptr && !mixer_ch_halted(i)) {
+			int wneed;
 			int len = ch->len >> bps_fx64;
 			int loop_len = ch->loop_len >> bps_fx64;
 			int wpos = ch->pos >> bps_fx64;
@@ -505,6 +1292,7 @@ static void mixer_exec(int32_t *out, int num_samples) {
 				// actually present in the waveform.
 				if (wpos+wlen > len)
 					wlen = len-wpos;
+				wneed = wlen;
 				// FIXME: due to a limit in the RSP ucode, we need to overread
 				// more data, possibly even past the end of the sample
 				wlen += MIXER_LOOP_OVERREAD >> bps;
@@ -528,6 +1316,7 @@ static void mixer_exec(int32_t *out, int num_samples) {
 					wpos -= loop_len;
 				if (wpos+wlen > len)
 					wlen = len-wpos;
+				wneed = wlen;
 
 				// FIXME: due to a limit in the RSP ucode, we need to overread
 				// more data past the loop end.
@@ -556,84 +1345,47 @@ static void mixer_exec(int32_t *out, int num_samples) {
 				// no loop in this waveform, since the RSP will always see
 				// the loop unrolled in the buffer, so it doesn't need to
 				// do anything.
-				fake_loop |= 1<<i;
+				fake_loop |= 1ull<<i;
+				wneed = wlen;
 			}
 
+			uint32_t t_read = TICKS_READ();
 			void* ptr = samplebuffer_get(sbuf, wpos, &wlen);
 			assert(ptr);
-			ch->ptr = (uint8_t*)ptr - (wpos<<bps);
-		}
-	}
-
-	volatile rsp_mixer_settings_t *settings = UncachedAddr(&Mixer.ucode_settings);
-
-	volatile rsp_mixer_channel_t *rsp_wv = settings->channels;
-	mixer_fx15_t lvol[MIXER_MAX_CHANNELS] __attribute__((aligned(8))) = {0};
-	mixer_fx15_t rvol[MIXER_MAX_CHANNELS] __attribute__((aligned(8))) = {0};
-
-	for (int ch=0;ch<Mixer.num_channels;ch++) {
-		mixer_channel_t *c = &Mixer.channels[ch];
-
-		// Stereo sub-channel. Will be ignored by RSP but we need to configure
-		// volume correctly.
-		if (c->flags & CH_FLAGS_STEREO_SUB) {
-			rsp_wv[ch].ptr = 0;
-			lvol[ch] = 0;
-			rvol[ch] = Mixer.rvol[ch-1];
-			continue;
-		}
-
-		// Check if the channel is stopped
-		if (!c->ptr) {
-			rsp_wv[ch].ptr = 0;
-			// Configure the volume to 0 when the channel is keyed off. This
-			// makes sure that we smooth volume correctly even for waveforms
-			// where the sequencer creates an a attack ramp (which would nullify
-			// the one-tap volume filter if the volume started from max).
-			lvol[ch] = 0;
-			rvol[ch] = 0;
-			continue;
-		}
 
-		// Convert to RSP mixer channel structure truncating 64-bit values to 32-bit.
-		// We don't need full absolute position on the RSP, so 32-bit is more
-		// than enough. In fact, we only expose 31 bits, so that we can use the
-		// 32nd bit later to correctly update the position without overflow bugs.
-		rsp_wv[ch].pos = (uint32_t)c->pos & 0x7FFFFFFF;
-		rsp_wv[ch].step = (uint32_t)c->step & 0x7FFFFFFF;
-		rsp_wv[ch].ptr = c->ptr + ((c->pos & ~0x7FFFFFFF) >> MIXER_FX64_FRAC);
-		rsp_wv[ch].flags = c->flags;
-
-		// If the loop is fake (i.e. we are unrolling it), or the current
-		// position has been truncated but it's far from the end of the waveform,
-		// just tell the RSP that there is no loop.
-		if (fake_loop & (1<<ch) || c->pos>>31 != c->len>>31) {
-			rsp_wv[ch].len = 0xFFFFFFFF;
-			rsp_wv[ch].loop_len = 0;
-		} else {
-			rsp_wv[ch].len = (uint32_t)c->len & 0x7FFFFFFF;
-			// We can't represent a very long loop in RSP. But those loops
-			// should be unrolled anyway (and thus be a fake_loop), so we
-			// should not get here.
-			assert(c->loop_len <= 0x7FFFFFFF);
-			rsp_wv[ch].loop_len = (uint32_t)c->loop_len & 0x7FFFFFFF;
-		}
-
-		if (c->flags & CH_FLAGS_STEREO) {
-			lvol[ch] = Mixer.lvol[ch];
-			rvol[ch] = 0;
-		} else {
-			lvol[ch] = Mixer.lvol[ch];
-			rvol[ch] = Mixer.rvol[ch];
+			// Read ahead the samples for the next polls, so that they are
+			// hopefully already available by then. Fully cached loops do not
+			// need it, and for waveforms without loop, stop at the end.
+			int ahead = Mixer.limits[i].readahead >> bps;
+			if (!loop_len)
+				ahead = MIN(ahead, len + (MIXER_LOOP_OVERREAD >> bps) - (wpos + wlen));
+			else if (loop_len < sbuf->size)
+				ahead = 0;
+			if (ahead > 0) {
+				samplebuffer_readahead(sbuf, wpos + wlen, ahead);
+				// The buffer might have been compacted: get the samples again.
+				ptr = samplebuffer_get(sbuf, wpos, &wlen);
+			}
+			t_read = TICKS_READ() - t_read;
+			Mixer.stats.read_ticks += t_read;
+			Mixer.stats.ch_read_ticks[i] += t_read;
+			// If the waveform could not provide all the samples that will be
+			// played, the RSP will play silence in their place.
+			if (wlen < wneed)
+				Mixer.stats.read_misses++;
+			ch->ptr = (uint8_t*)ptr - (wpos<<bps);
 		}
 	}
 
-	uint32_t *lvol32 = (uint32_t*)lvol;
-	uint32_t *rvol32 = (uint32_t*)rvol;
-	for (int ch=0;ch<MIXER_MAX_CHANNELS/2;ch++)  {
-		settings->lvol[ch] = lvol32[ch];
-		settings->rvol[ch] = rvol32[ch];
+	// Refresh the channels that are playing, as some of them might have
+	// reached the end of the waveform.
+	uint64_t playing = 0;
+	for (int i=0; i<Mixer.num_channels; i++) {
+		mixer_channel_t *ch = &Mixer.channels[i];
+		if (ch->ptr)
+			playing |= (ch->flags & CH_FLAGS_STEREO ? 3ull : 1ull) << i;
 	}
+	Mixer.ch_playing = playing;
 
 	// Check if we the user pressed RESET. If so, we can apply
 	// a simple global volume ramp to fade out the volume.
@@ -647,24 +1399,92 @@ static void mixer_exec(int32_t *out, int num_samples) {
 		gvol *= (FADE_OUT_TIME - MIN(elapsed, FADE_OUT_TIME)) / FADE_OUT_TIME;
 	}
 
+	// Buses other than the first one (and buses with effects) are mixed
+	// into a temporary buffer, from which the effects ucode adds them
+	// to the output.
+	if (__mixer_fx_overlay_id && Mixer.bus_buf_size < num_samples*4) {
+		if (Mixer.bus_buf)
+			free_uncached(Mixer.bus_buf);
+		Mixer.bus_buf_size = ROUND_UP(num_samples*4, 16);
+		Mixer.bus_buf = malloc_uncached(Mixer.bus_buf_size);
+		assertf(Mixer.bus_buf, "mixer: out of memory");
+
+		if (Mixer.num_channels > MIXER_RSP_SLOTS) {
+			if (Mixer.pass_buf)
+				free_uncached(Mixer.pass_buf);
+			Mixer.pass_buf = malloc_uncached(Mixer.bus_buf_size);
+			assertf(Mixer.pass_buf, "mixer: out of memory");
+		}
+	}
+
+	mixer_release_slots();
+
 	uint32_t t0 = TICKS_READ();
 
 	rspq_highpri_begin();
-	rspq_write(__mixer_overlay_id, 0,
-		(((uint32_t)MIXER_FX16(gvol)) & 0xFFFF),
-		(num_samples << 16) | Mixer.num_channels,
-		PhysicalAddr(out),
-		PhysicalAddr(&Mixer.ucode_settings));
+	bool out_written = false;
+	for (int b=0;b<MIXER_MAX_BUSES;b++) {
+		mixer_bus_t *bus = &Mixer.buses[b];
+		bool unity; int ramp_shift;
+		int num_slots = mixer_bus_setup(b, fake_loop, gvol, num_samples, &unity, &ramp_shift);
+
+		// The first bus always runs, as it initializes the output. Other
+		// buses are skipped if they are silent, unless they have effects
+		// (eg: a reverb tail might still be audible).
+		if (b > 0 && !num_slots && !bus->fx_flags)
+			continue;
+
+		bool direct = !out_written && !bus->fx_flags;
+		void *bus_out = direct ? (void*)out : (void*)Mixer.bus_buf;
+		if (num_slots || direct) {
+			rspq_write(__mixer_overlay_id, 0,
+				(ramp_shift << 24) | (unity ? 1<<16 : 0) | (((uint32_t)MIXER_FX16(gvol)) & 0xFFFF),
+				(num_samples << 16) | MAX(MIN(num_slots, MIXER_RSP_SLOTS), 1),
+				PhysicalAddr(bus_out),
+				PhysicalAddr(&Mixer.ucode_settings[b][0]));
+		}
+		// Mix the other passes (if more slots are in use), and add them
+		// up without effects to the samples of the first pass.
+		for (int p=1;p*MIXER_RSP_SLOTS<num_slots;p++) {
+			rspq_write(__mixer_overlay_id, 0,
+				(ramp_shift << 24) | (unity ? 1<<16 : 0) | (((uint32_t)MIXER_FX16(gvol)) & 0xFFFF),
+				(num_samples << 16) | MIN(num_slots - p*MIXER_RSP_SLOTS, MIXER_RSP_SLOTS),
+				PhysicalAddr(Mixer.pass_buf),
+				PhysicalAddr(&Mixer.ucode_settings[b][p]));
+			rspq_write(__mixer_fx_overlay_id, 0,
+				PhysicalAddr(Mixer.pass_buf),
+				PhysicalAddr(bus_out),
+				0x80000000 | num_samples,
+				PhysicalAddr(&Mixer.ucode_pass_fx));
+		}
+		if (!direct) {
+			rspq_write(__mixer_fx_overlay_id, 0,
+				PhysicalAddr(Mixer.bus_buf),
+				PhysicalAddr(out),
+				(out_written ? 0x80000000 : 0) | (num_slots ? 0 : 0x40000000) | num_samples,
+				PhysicalAddr(&Mixer.ucode_fx[b]));
+		}
+		out_written = true;
+	}
 	rspq_highpri_end();
 
 	rspq_highpri_sync();
 
-	__mixer_profile_rsp += TICKS_READ() - t0;
+	t0 = TICKS_READ() - t0;
+	__mixer_profile_rsp += t0;
+	Mixer.stats.rsp_ticks += t0;
+	if (t0 > Mixer.stats.rsp_ticks_max) Mixer.stats.rsp_ticks_max = t0;
 
 	for (int i=0;i<Mixer.num_channels;i++) {
 		mixer_channel_t *ch = &Mixer.channels[i];
-		if (ch->ptr)
-			ch->pos += (uint64_t)rsp_wv[i].pos - (uint64_t)(ch->pos & 0x7FFFFFFF);
+		int slot = Mixer.slot_of[i];
+		if (slot >= 0) {
+			volatile rsp_mixer_channel_t *wv = mixer_rsp_slot(Mixer.slot_bus[i], slot);
+			ch->pos += (uint64_t)wv->pos - (uint64_t)(ch->pos & 0x7FFFFFFF);
+		}
+		mixer_ramp_advance(&Mixer.lvol[i], num_samples);
+		mixer_ramp_advance(&Mixer.rvol[i], num_samples);
+		mixer_ramp_advance(&Mixer.pause_gain[i], num_samples);
 	}
 
 	Mixer.ticks += num_samples;
@@ -680,6 +1500,8 @@ static mixer_event_t* mixer_next_event(void) {
 }
 
 void mixer_add_event(int64_t delay, MixerEvent cb, void *ctx) {
+	assertf(delay >= 0, "mixer_add_event: invalid negative delay %lld", delay);
+	assertf(Mixer.num_events < MAX_EVENTS, "mixer_add_event: too many events (max %d)", MAX_EVENTS);
 	Mixer.events[Mixer.num_events++] = (mixer_event_t){
 		.cb = cb,
 		.ctx = ctx,
@@ -695,7 +1517,7 @@ void mixer_remove_event(MixerEvent cb, void *ctx) {
 			return;
 		}
 	}
-	assertf("mixer_remove_event: specified event does not exist\ncb:%p ctx:%p", (void*)cb, ctx);
+	assertf(0, "mixer_remove_event: specified event does not exist\ncb:%p ctx:%p", (void*)cb, ctx);
 }
 
 void mixer_poll(int16_t *out16, int num_samples) {
@@ -705,17 +1527,28 @@ void mixer_poll(int16_t *out16, int num_samples) {
 	// it's not possible to call this function with an odd number,
 	// otherwise buffering might become complicated / impossible.
 	assert(num_samples % 2 == 0);
+	assertf(!Mixer.managed_target || Mixer.managed_polling,
+		"mixer_poll cannot be called in managed mode (see mixer_set_managed)");
 
+	uint32_t t0 = TICKS_READ();
+	Mixer.stats.polls++;
+	Mixer.stats.samples += num_samples;
+
+	// Mixing is split at each event, so that callbacks run exactly at the
+	// requested sample, and whatever they change (eg: starting a channel)
+	// is applied starting from that sample.
 	while (num_samples > 0) {
 		mixer_event_t *e = mixer_next_event();
 
-		int ns = MIN(num_samples, e ? e->ticks - Mixer.ticks : num_samples);
+		int ns = MIN(num_samples, e ? MAX(e->ticks - Mixer.ticks, 0) : num_samples);
 		if (ns > 0) {
 			mixer_exec(out, ns);
 			out += ns;
 			num_samples -= ns;
 		}
-		if (e && Mixer.ticks == e->ticks) {
+		// An event can be overdue if its callback returned a negative repeat:
+		// run it immediately rather than waiting for a tick that already passed.
+		if (e && e->ticks <= Mixer.ticks) {
 			int64_t repeat = e->cb(e->ctx);
 			if (repeat)
 				e->ticks += repeat;
@@ -723,4 +1556,66 @@ void mixer_poll(int16_t *out16, int num_samples) {
 				mixer_remove_event(e->cb, e->ctx);
 		}
 	}
+
+	t0 = TICKS_READ() - t0;
+	Mixer.stats.poll_ticks += t0;
+	if (t0 > Mixer.stats.poll_ticks_max) Mixer.stats.poll_ticks_max = t0;
+}
+
+/** @brief AI interrupt handler of the managed mode (see #mixer_set_managed) */
+static void mixer_managed_callback(void) {
+	if (Mixer.managed_polling)
+		return;
+
+	// The RSP cannot be used if the main thread is in highpri mode or it
+	// is recording a block. Skip this interrupt: mixing will catch up
+	// at the next one, as long as there are enough buffers queued.
+	if (!__rspq_highpri_available()) {
+		Mixer.stats.managed_skips++;
+		return;
+	}
+
+	Mixer.managed_polling = true;
+	int buf_len = audio_get_buffer_length();
+	while (audio_get_buffered() < Mixer.managed_target && audio_can_write()) {
+		int16_t *out = audio_write_begin();
+		mixer_poll(out, buf_len);
+		audio_write_end();
+	}
+	Mixer.managed_polling = false;
+}
+
+void mixer_set_managed(int latency_ms) {
+	assert(mixer_initialized());
+
+	disable_interrupts();
+	bool enabled = Mixer.managed_target != 0;
+	if (latency_ms > 0) {
+		// Keep enough buffers queued to cover the requested latency. The AI
+		// holds two buffers (one playing, one queued), so anything less
+		// would leave no margin at all.
+		int buf_len = audio_get_buffer_length();
+		int target = ((int64_t)latency_ms * Mixer.sample_rate / 1000 + buf_len - 1) / buf_len;
+		Mixer.managed_target = MAX(target, 2);
+		if (!enabled)
+			register_AI_handler(mixer_managed_callback);
+
+		// The AI generates interrupts only while playing: fill the buffers
+		// now to start playback.
+		mixer_managed_callback();
+	} else if (enabled) {
+		unregister_AI_handler(mixer_managed_callback);
+		Mixer.managed_target = 0;
+	}
+	enable_interrupts();
+}
+
+void mixer_get_stats(mixer_stats_t *stats) {
+	*stats = Mixer.stats;
+	stats->underruns = audio_get_underruns() - Mixer.underruns_base;
+}
+
+void mixer_reset_stats(void) {
+	memset(&Mixer.stats, 0, sizeof(Mixer.stats));
+	Mixer.underruns_base = audio_get_underruns();
 }
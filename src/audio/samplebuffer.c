@@ -10,6 +10,7 @@
 #include "n64types.h"
 #include "utils.h"
 #include "debug.h"
+#include "interrupt.h"
 #include <string.h>
 
 /** @brief Set to 1 to activate debug logs */
@@ -23,6 +24,33 @@
 #define tracef(fmt, ...)  ({ })
 #endif
 
+/**
+ * @brief Round up a number of samples so that they span a multiple of 8 bytes.
+ * 
+ * This is applied to the number of samples requested to wv_read(), to make
+ * sure that we always keep the sample buffer filled with a multiple of 8 bytes.
+ * This is not strictly required because dma_read() can do wonders,
+ * but it results in slightly faster DMA transfers and its almost free
+ * to do here.
+ */
+#define ROUNDUP8_BPS(nsamples, bps) \
+	(((nsamples)+((8>>(bps))-1)) >> (3-(bps)) << (3-(bps)))
+
+/**
+ * @brief Write back to RDRAM the samples appended via #samplebuffer_append_cached.
+ *
+ * The cachelines are also invalidated, so that nothing of the buffer is left
+ * in the cache, where it could overwrite later writes done by DMA or RSP.
+ */
+static void samplebuffer_writeback(samplebuffer_t *buf) {
+	if (!buf->cached_len)
+		return;
+	int bps = SAMPLES_BPS_SHIFT(buf);
+	uint8_t *start = SAMPLES_PTR(buf) + ((buf->widx - buf->cached_len) << bps);
+	data_cache_hit_writeback_invalidate(CachedAddr(start), buf->cached_len << bps);
+	buf->cached_len = 0;
+}
+
 void samplebuffer_init(samplebuffer_t *buf, uint8_t* uncached_mem, int nbytes) {
 	memset(buf, 0, sizeof(samplebuffer_t));
 
@@ -54,23 +82,26 @@ void samplebuffer_set_waveform(samplebuffer_t *buf, WaveformRead read, void *ctx
 }
 
 void samplebuffer_close(samplebuffer_t *buf) {
+	samplebuffer_wait(buf);
 	buf->ptr_and_flags = 0;
 }
 
-void* samplebuffer_get(samplebuffer_t *buf, int wpos, int *wlen) {
-	// ROUNDUP8_BPS rounds up the specified number of samples
-	// (given the bps shift) so that they span an exact multiple
-	// of 8 bytes. This will be applied to the number of samples
-	// requested to wv_read(), to make sure that we always
-	// keep the sample buffer filled with a multiple of 8 bytes.
-	// This is not strictly required because dma_read() can do wonders,
-	// but it results in slightly faster DMA transfers and its almost free
-	// to do here.
-	/// @cond
-	#define ROUNDUP8_BPS(nsamples, bps) \
-		(((nsamples)+((8>>(bps))-1)) >> (3-(bps)) << (3-(bps)))
-	/// @endcond
+void samplebuffer_wait(samplebuffer_t *buf) {
+	samplebuffer_writeback(buf);
+	if (!buf->async_pending)
+		return;
+	assertf(get_interrupts_state() == INTERRUPTS_ENABLED,
+		"samplebuffer_wait called with interrupts disabled");
+	while (buf->async_pending) {}
+}
+
+void samplebuffer_async_done(void *ctx) {
+	samplebuffer_t *buf = (samplebuffer_t*)ctx;
+	assert(buf->async_pending > 0);
+	buf->async_pending--;
+}
 
+void* samplebuffer_get(samplebuffer_t *buf, int wpos, int *wlen) {
 	int bps = SAMPLES_BPS_SHIFT(buf);
 
 	tracef("samplebuffer_get: wpos=%x wlen=%x\n", wpos, *wlen);
@@ -123,13 +154,27 @@ void* samplebuffer_get(samplebuffer_t *buf, int wpos, int *wlen) {
 	if (len < *wlen)
 		*wlen = len;
 
+	// If some of the returned samples are still being read asynchronously,
+	// wait for them. This only happens if the read-ahead was too late.
+	if (buf->async_pending && idx + *wlen > buf->async_idx)
+		samplebuffer_wait(buf);
+
+	// Commit the samples generated by the CPU before they are used
+	samplebuffer_writeback(buf);
+
 	return SAMPLES_PTR(buf) + (idx << SAMPLES_BPS_SHIFT(buf));
 }
 
 void* samplebuffer_append(samplebuffer_t *buf, int wlen) {
+	// The previous samples written via cache are complete now. Commit them
+	// before the new ones are written, as they might share cachelines.
+	samplebuffer_writeback(buf);
+
 	// If the requested number of samples doesn't fit the buffer, we
 	// need to make space for it by discarding older samples.
+	// The samples that are moved around must have been fully written.
 	if (buf->widx + wlen > buf->size) {
+		samplebuffer_wait(buf);
 		// Make space in the buffer by discarding everything up to the
 		// ridx index, which is the first sample that we still need for playback.
 		assertf(buf->widx >= buf->ridx,
@@ -163,6 +208,56 @@ void* samplebuffer_append(samplebuffer_t *buf, int wlen) {
 	return data;
 }
 
+void* samplebuffer_append_async(samplebuffer_t *buf, int wlen) {
+	assertf(buf->async, "samplebuffer_append_async can only be called during a read-ahead");
+	void *data = samplebuffer_append(buf, wlen);
+
+	disable_interrupts();
+	if (!buf->async_pending)
+		buf->async_idx = buf->widx - wlen;
+	buf->async_pending++;
+	enable_interrupts();
+	return data;
+}
+
+void* samplebuffer_append_cached(samplebuffer_t *buf, int wlen) {
+	// Any DMA transfer into a cacheline that is going to be dirtied must be
+	// finished, or its data would be overwritten by the writeback.
+	samplebuffer_wait(buf);
+	void *data = samplebuffer_append(buf, wlen);
+	buf->cached_len = wlen;
+	return CachedAddr(data);
+}
+
+void samplebuffer_readahead(samplebuffer_t *buf, int wpos, int wlen) {
+	int bps = SAMPLES_BPS_SHIFT(buf);
+	int wend = buf->wpos + buf->widx;
+
+	// The read-ahead must continue the samples in the buffer. Also, skip it
+	// if at least half of the requested samples are already available,
+	// so that reads are done in batches.
+	if (!buf->wv_read || buf->widx == 0 || wpos > wend)
+		return;
+	if (wend - wpos >= wlen / 2)
+		return;
+
+	// Clamp the read to the space that can be freed by compacting the buffer
+	// (that is, discarding the samples before the read pointer, see
+	// samplebuffer_append). Keep a granularity of 8 bytes.
+	int len = wpos + wlen - wend;
+	int space = buf->size - (buf->widx - buf->ridx) - (8 >> bps);
+	if (len > space)
+		len = space;
+	len &= ~((8 >> bps) - 1);
+	if (len <= 0)
+		return;
+
+	tracef("samplebuffer_readahead: wpos=%x wlen=%x\n", wend, len);
+	buf->async = get_interrupts_state() == INTERRUPTS_ENABLED;
+	buf->wv_read(buf->wv_ctx, buf, wend, len, false);
+	buf->async = false;
+}
+
 void samplebuffer_discard(samplebuffer_t *buf, int wpos) {
 	// Compute the index of the first sample that will be preserved (and thus
 	// will be moved to position 0 of the buffer).
@@ -182,6 +277,7 @@ void samplebuffer_discard(samplebuffer_t *buf, int wpos) {
 	}
 
 	tracef("discard: wpos=%x idx:%x buf->wpos=%x buf->widx=%x\n", wpos, idx, buf->wpos, buf->widx);
+	samplebuffer_wait(buf);
 	int kept_bytes = (buf->widx - idx) << SAMPLES_BPS_SHIFT(buf);
 	if (kept_bytes > 0) {		
 		tracef("samplebuffer_discard: compacting buffer, moving 0x%x bytes\n", kept_bytes);
@@ -216,5 +312,6 @@ void samplebuffer_discard(samplebuffer_t *buf, int wpos) {
 }
 
 void samplebuffer_flush(samplebuffer_t *buf) {
+	samplebuffer_wait(buf);
 	buf->wpos = buf->widx = buf->ridx = 0;
 }
@@ -11,10 +11,15 @@
 #include "n64sys.h"
 #include "dma.h"
 #include "samplebuffer.h"
+#include "rspq.h"
+#include "rsp.h"
+#include "utils.h"
 #include "debug.h"
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 
 /** ID of a standard WAV file */
 #define WAV_RIFF_ID   "RIFF"
@@ -26,9 +31,17 @@ int64_t __wav64_profile_dma = 0;
 
 void raw_waveform_read(samplebuffer_t *sbuf, int base_rom_addr, int wpos, int wlen, int bps) {
 	uint32_t rom_addr = base_rom_addr + (wpos << bps);
-	uint8_t* ram_addr = (uint8_t*)samplebuffer_append(sbuf, wlen);
 	int bytes = wlen << bps;
 
+	// During a read-ahead, queue the transfer and return immediately: the
+	// sample buffer will be notified when it is finished.
+	if (sbuf->async) {
+		uint8_t* ram_addr = (uint8_t*)samplebuffer_append_async(sbuf, wlen);
+		dma_read_queue(ram_addr, rom_addr, bytes, DMA_PRIORITY_HIGH, samplebuffer_async_done, sbuf);
+		return;
+	}
+
+	uint8_t* ram_addr = (uint8_t*)samplebuffer_append(sbuf, wlen);
 	uint32_t t0 = TICKS_READ();
 	// Run the DMA transfer. We rely on libdragon's PI DMA function which works
 	// also for misaligned addresses and odd lengths.
@@ -44,6 +57,495 @@ static void waveform_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, b
 	raw_waveform_read(sbuf, wav->rom_addr, wpos, wlen, bps);
 }
 
+DEFINE_RSP_UCODE(rsp_wav64_adpcm);
+
+/** @brief ID of the ADPCM decoder overlay (0 if not registered yet) */
+static uint32_t adpcm_ovl_id = 0;
+
+/**
+ * @brief Size of the staging buffer for compressed ADPCM data.
+ *
+ * Compressed frames are loaded here from ROM via PI DMA, and then
+ * consumed by the RSP. The buffer is used as a ring: when it wraps
+ * around, we wait for all pending decodes to finish.
+ */
+#define ADPCM_STAGING_SIZE      4096
+/** @brief Maximum number of samples decoded by a single RSP command */
+#define ADPCM_MAX_CHUNK         1024
+
+static uint8_t *adpcm_staging;          ///< Staging buffer (uncached)
+static int adpcm_staging_pos;           ///< Next free byte in the staging buffer
+static bool adpcm_pending;              ///< True if there might be decodes in flight
+
+/**
+ * @brief Decoder state (y1, y2 per channel), one slot per sample buffer.
+ *
+ * The state is read and written only by the RSP, so it is kept in
+ * uncached memory. It is tied to the sample buffer rather than to the
+ * wav64_t, so that the same waveform can play on multiple channels.
+ */
+static uint32_t *adpcm_states;
+static samplebuffer_t *adpcm_state_owner[MIXER_MAX_CHANNELS];
+
+static void adpcm_init(void) {
+	if (adpcm_ovl_id)
+		return;
+	rspq_init();
+	adpcm_ovl_id = rspq_overlay_register(&rsp_wav64_adpcm);
+	adpcm_staging = malloc_uncached(ADPCM_STAGING_SIZE);
+	adpcm_states = malloc_uncached(MIXER_MAX_CHANNELS * 8);
+	assert(adpcm_staging && adpcm_states);
+}
+
+/** @brief Wait for all the ADPCM decodes scheduled on the RSP */
+static void adpcm_sync(void) {
+	if (adpcm_pending) {
+		rspq_highpri_sync();
+		adpcm_pending = false;
+	}
+}
+
+static uint32_t *adpcm_state(samplebuffer_t *sbuf) {
+	for (int i=0; i<MIXER_MAX_CHANNELS; i++) {
+		if (adpcm_state_owner[i] == sbuf || !adpcm_state_owner[i]) {
+			adpcm_state_owner[i] = sbuf;
+			return adpcm_states + i*2;
+		}
+	}
+	assertf(0, "too many sample buffers decoding ADPCM");
+	return NULL;
+}
+
+static void waveform_read_adpcm(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
+	wav64_t *wav = (wav64_t*)ctx;
+	int nch = wav->wave.channels;
+	int frame_bytes = WAV64_ADPCM_BLOCK_BYTES * nch;
+	uint32_t hist[2] = {0, 0};
+
+	if (seeking && wpos != 0) {
+		// We can only restart decoding at the positions where we know the
+		// decoder history: the start of the waveform and the loop start.
+		assertf(wpos == wav->adpcm_loop_pos,
+			"wav64 %s: compressed waveforms can only seek to the start or to the loop (%d)",
+			wav->wave.name, wpos);
+		hist[0] = wav->adpcm_loop_hist[0];
+		hist[1] = wav->adpcm_loop_hist[1];
+	}
+
+	// Past the end, the file contains some silence to cover the mixer overread.
+	if (wlen > wav->adpcm_len - wpos)
+		wlen = wav->adpcm_len - wpos;
+
+	uint32_t *state = adpcm_state(sbuf);
+	while (wlen > 0) {
+		int n = MIN(wlen, ADPCM_MAX_CHUNK);
+		int frame = wpos / WAV64_ADPCM_FRAME_SAMPLES;
+		int skip = wpos % WAV64_ADPCM_FRAME_SAMPLES;
+		int nframes = (skip + n + WAV64_ADPCM_FRAME_SAMPLES - 1) / WAV64_ADPCM_FRAME_SAMPLES;
+		int bytes = nframes * frame_bytes;
+		uint32_t rom_addr = wav->rom_addr + frame * frame_bytes;
+
+		// Allocate space in the staging buffer, on the same 2-byte phase
+		// of the ROM address as required by dma_read.
+		int pos = ROUND_UP(adpcm_staging_pos, 2) + (rom_addr & 1);
+		if (pos + bytes > ADPCM_STAGING_SIZE) {
+			adpcm_sync();
+			pos = rom_addr & 1;
+		}
+		adpcm_staging_pos = pos + bytes;
+		uint8_t *src = adpcm_staging + pos;
+
+		uint32_t t0 = TICKS_READ();
+		dma_read(src, rom_addr, bytes);
+		__wav64_profile_dma += TICKS_READ() - t0;
+
+		// If the sample buffer needs to be compacted to make space, the CPU
+		// will move samples around: make sure the RSP is done writing them.
+		if (sbuf->widx + n > sbuf->size)
+			adpcm_sync();
+		void *dst = samplebuffer_append(sbuf, n);
+
+		// Schedule the decoding in the highpri queue, so that it runs
+		// before the mixer (that also runs in highpri, see mixer_exec).
+		rspq_highpri_begin();
+		rspq_write(adpcm_ovl_id, 0x0,
+			PhysicalAddr(src), PhysicalAddr(dst), PhysicalAddr(state),
+			n | (skip << 16) | ((nch == 2) << 20) | (seeking ? 0x80000000 : 0),
+			hist[0], hist[1], bytes);
+		rspq_highpri_end();
+		adpcm_pending = true;
+
+		seeking = false;
+		wpos += n;
+		wlen -= n;
+	}
+}
+
+DEFINE_RSP_UCODE(rsp_wav64_mdct);
+
+/** @brief ID of the MDCT decoder overlay (0 if not registered yet) */
+static uint32_t mdct_ovl_id = 0;
+
+/**
+ * @brief Size of the staging buffer for MDCT coefficients.
+ *
+ * The CPU parses the compressed frames and writes the dequantized
+ * coefficients here, for the RSP to run the inverse transform. As for
+ * ADPCM, the buffer is used as a ring.
+ */
+#define MDCT_STAGING_SIZE       8192
+/** @brief Size of the coefficients of one channel in the staging buffer (header + coefficients) */
+#define MDCT_BLOCK_SIZE         (8 + WAV64_MDCT_FRAME_SAMPLES*2)
+/** @brief Size of the tables used by the RSP transform (see #mdct_init) */
+#define MDCT_TABLES_SIZE        2528
+/** @brief Maximum sum of the absolute values of the coefficients sent to the RSP */
+#define MDCT_MAX_L1             30000.0f
+
+#define MDCT_FLAG_RESET         (1u << 31)  ///< Start from a silent overlap state
+#define MDCT_FLAG_COMMIT        (1u << 30)  ///< Save the overlap state after the frame
+
+static uint8_t *mdct_staging;           ///< Staging buffer (uncached)
+static int mdct_staging_pos;            ///< Next free byte in the staging buffer
+static bool mdct_pending;               ///< True if there might be decodes in flight
+static int16_t *mdct_tables;            ///< Twiddle factors and windows of the transform (uncached)
+
+/**
+ * @brief Overlap state (second half of the last frame, per channel),
+ * one slot per sample buffer.
+ *
+ * As for ADPCM, the state is only accessed by the RSP, and it is tied
+ * to the sample buffer.
+ */
+static int16_t *mdct_states[MIXER_MAX_CHANNELS];
+static samplebuffer_t *mdct_state_owner[MIXER_MAX_CHANNELS];
+
+/** @brief Buffer for the compressed frame being parsed */
+static uint8_t mdct_frame_buf[WAV64_MDCT_MAX_FRAME_BYTES + 16] __attribute__((aligned(16)));
+
+static int16_t mdct_q15(float v) {
+	int x = v * 32768.0f + (v >= 0 ? 0.5f : -0.5f);
+	return x > 32767 ? 32767 : x;
+}
+
+static void mdct_init(void) {
+	if (mdct_ovl_id)
+		return;
+	rspq_init();
+	mdct_ovl_id = rspq_overlay_register(&rsp_wav64_mdct);
+	mdct_staging = malloc_uncached(MDCT_STAGING_SIZE);
+	mdct_tables = malloc_uncached(MDCT_TABLES_SIZE);
+	assert(mdct_staging && mdct_tables);
+
+	// Compute the tables used by rsp_wav64_mdct.S. Each table is made of
+	// the cosines of the angles, followed by the sines.
+	const float M = WAV64_MDCT_FRAME_SAMPLES;
+	int16_t *t = mdct_tables;
+
+	// Pre-twiddle of the N/4-point complex FFT: pi*(j+1/4)/M
+	for (int j=0; j<128; j++) {
+		t[j]     = mdct_q15(cosf(M_PI * (j + 0.25f) / M));
+		t[128+j] = mdct_q15(sinf(M_PI * (j + 0.25f) / M));
+	}
+	t += 256;
+
+	// Twiddles of the FFT radix-2 stages run across vectors (h = 64..8)
+	for (int h=64; h>=8; h/=2) {
+		for (int i=0; i<h; i++) {
+			t[i]   = mdct_q15(cosf(M_PI * i / h));
+			t[h+i] = mdct_q15(sinf(M_PI * i / h));
+		}
+		t += 2*h;
+	}
+
+	// Post-twiddle: pi*k/M, in the (bit-reversed) order of the FFT output
+	static const uint8_t bitrev3[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+	for (int m=0; m<128; m++) {
+		int k = bitrev3[(m >> 3) & 7] * 16 + bitrev3[m & 7] * 2 + (m >> 6);
+		t[m]     = mdct_q15(cosf(M_PI * k / M));
+		t[128+m] = mdct_q15(sinf(M_PI * k / M));
+	}
+	t += 256;
+
+	// Sine window (first half), and the same window reversed
+	for (int n=0; n<256; n++) {
+		t[n]     = mdct_q15(sinf(M_PI * (n + 0.5f) / (2*M)));
+		t[256+n] = mdct_q15(sinf(M_PI * (255 - n + 0.5f) / (2*M)));
+	}
+	t += 512;
+	assert((uint8_t*)t - (uint8_t*)mdct_tables == MDCT_TABLES_SIZE);
+}
+
+/** @brief Wait for all the MDCT decodes scheduled on the RSP */
+static void mdct_sync(void) {
+	if (mdct_pending) {
+		rspq_highpri_sync();
+		mdct_pending = false;
+	}
+}
+
+static int16_t *mdct_state(samplebuffer_t *sbuf) {
+	for (int i=0; i<MIXER_MAX_CHANNELS; i++) {
+		if (mdct_state_owner[i] == sbuf || !mdct_state_owner[i]) {
+			if (!mdct_states[i]) {
+				mdct_states[i] = malloc_uncached(2 * WAV64_MDCT_FRAME_SAMPLES * sizeof(int16_t));
+				assert(mdct_states[i]);
+			}
+			mdct_state_owner[i] = sbuf;
+			return mdct_states[i];
+		}
+	}
+	assertf(0, "too many sample buffers decoding MDCT");
+	return NULL;
+}
+
+/** @brief Reader of the MDCT bitstream (MSB first) */
+typedef struct {
+	const uint8_t *ptr;     ///< Next byte to load
+	const uint8_t *end;     ///< End of the frame
+	uint32_t bits;          ///< Loaded bits, aligned to the MSB
+	int nbits;              ///< Number of loaded bits
+} mdct_bitreader_t;
+
+static inline uint32_t mdct_getbits(mdct_bitreader_t *br, int n) {
+	if (!n)
+		return 0;
+	while (br->nbits < n) {
+		// Past the end of a (corrupted) frame, just read zeros
+		uint32_t byte = br->ptr < br->end ? *br->ptr++ : 0;
+		br->bits |= byte << (24 - br->nbits);
+		br->nbits += 8;
+	}
+	uint32_t v = br->bits >> (32 - n);
+	br->bits <<= n;
+	br->nbits -= n;
+	return v;
+}
+
+static int mdct_getrice(mdct_bitreader_t *br, int k) {
+	int q = 0;
+	while (q < WAV64_MDCT_RICE_ESCAPE && mdct_getbits(br, 1))
+		q++;
+	if (q == WAV64_MDCT_RICE_ESCAPE)
+		return mdct_getbits(br, 16);
+	return (q << k) | mdct_getbits(br, k);
+}
+
+static int mdct_getsexpg(mdct_bitreader_t *br) {
+	int n = 0;
+	while (n < 16 && !mdct_getbits(br, 1))
+		n++;
+	uint32_t z = ((1 << n) | mdct_getbits(br, n)) - 1;
+	return z & 1 ? (int)(z + 1) >> 1 : -(int)(z >> 1);
+}
+
+/**
+ * @brief Parse the bitstream of a channel, and write the coefficients for the RSP.
+ *
+ * The coefficients are scaled down by a power of two (which is stored in the
+ * block header, and applied back by the RSP at the end of the transform), so
+ * that the sum of their absolute values is at most #MDCT_MAX_L1. Since every
+ * intermediate value of the transform is a combination of the coefficients with
+ * weights not larger than 1, this guarantees that the fixed point computations
+ * on the RSP never overflow.
+ *
+ * The coefficients are stored in the order required by the first step of
+ * the transform: even coefficients first (real parts of the complex FFT
+ * input), then odd coefficients in reverse order (imaginary parts).
+ */
+static void mdct_parse_channel(mdct_bitreader_t *br, int16_t *block) {
+	int k[WAV64_MDCT_BANDS];
+	float step[WAV64_MDCT_BANDS];
+	float X[WAV64_MDCT_FRAME_SAMPLES];
+
+	for (int b=0; b<WAV64_MDCT_BANDS; b++)
+		k[b] = mdct_getbits(br, 1) ? (int)mdct_getbits(br, 3) : -1;
+
+	int sf = -1;
+	for (int b=0; b<WAV64_MDCT_BANDS; b++) {
+		if (k[b] < 0) continue;
+		sf = sf < 0 ? (int)mdct_getbits(br, 6) : sf + mdct_getsexpg(br);
+		if (sf < 0) sf = 0;
+		if (sf > 63) sf = 63;
+		step[b] = wav64_mdct_step(sf);
+	}
+
+	float l1 = 0;
+	for (int b=0; b<WAV64_MDCT_BANDS; b++) {
+		for (int i=wav64_mdct_band_edges[b]; i<wav64_mdct_band_edges[b+1]; i++) {
+			if (k[b] < 0) {
+				X[i] = 0;
+				continue;
+			}
+			int v = mdct_getrice(br, k[b]);
+			if (v && mdct_getbits(br, 1))
+				v = -v;
+			X[i] = v * step[b];
+			l1 += fabsf(X[i]);
+		}
+	}
+
+	int e = 0;
+	while (e < 14 && l1 > MDCT_MAX_L1) {
+		l1 *= 0.5f;
+		e++;
+	}
+	float scale = 1.0f / (1 << e);
+
+	block[0] = 1 << e;
+	block[1] = block[2] = block[3] = 0;
+	int16_t *re = block + 4, *im = block + 4 + WAV64_MDCT_FRAME_SAMPLES/2;
+	for (int j=0; j<WAV64_MDCT_FRAME_SAMPLES/2; j++) {
+		float a = X[2*j] * scale;
+		float b = X[WAV64_MDCT_FRAME_SAMPLES-1-2*j] * scale;
+		re[j] = a + (a >= 0 ? 0.5f : -0.5f);
+		im[j] = b + (b >= 0 ? 0.5f : -0.5f);
+	}
+}
+
+/**
+ * @brief Decode a MDCT frame, and schedule the inverse transform on the RSP.
+ *
+ * The output of the frame completes the block of samples that precedes it
+ * (see #WAV64_FORMAT_MDCT). Only the samples [skip, skip+n) of the block are
+ * written to dst.
+ */
+static void mdct_decode(wav64_t *wav, int frame, int16_t *state, void *dst, int skip, int n, uint32_t flags) {
+	int nch = wav->wave.channels;
+	int frame_bytes = wav->mdct_frame_bytes;
+	uint32_t rom_addr = wav->rom_addr + frame * frame_bytes;
+
+	// Load the compressed frame, on the same 2-byte phase of the ROM
+	// address as required by dma_read.
+	uint8_t *buf = mdct_frame_buf + (rom_addr & 1);
+	data_cache_hit_invalidate(mdct_frame_buf, ROUND_UP(frame_bytes + 1, 16));
+	uint32_t t0 = TICKS_READ();
+	dma_read(buf, rom_addr, frame_bytes);
+	__wav64_profile_dma += TICKS_READ() - t0;
+
+	int bytes = nch * MDCT_BLOCK_SIZE;
+	if (mdct_staging_pos + bytes > MDCT_STAGING_SIZE) {
+		mdct_sync();
+		mdct_staging_pos = 0;
+	}
+	int16_t *block = (int16_t*)(mdct_staging + mdct_staging_pos);
+	mdct_staging_pos += bytes;
+
+	mdct_bitreader_t br = { .ptr = buf, .end = buf + frame_bytes };
+	for (int ch=0; ch<nch; ch++)
+		mdct_parse_channel(&br, block + ch * MDCT_BLOCK_SIZE/2);
+
+	// Schedule the transform in the highpri queue, so that it runs
+	// before the mixer (see waveform_read_adpcm).
+	rspq_highpri_begin();
+	rspq_write(mdct_ovl_id, 0x0,
+		PhysicalAddr(block), dst ? PhysicalAddr(dst) : 0, PhysicalAddr(state),
+		n | (skip << 16) | ((nch == 2) << 24) | flags,
+		PhysicalAddr(mdct_tables));
+	rspq_highpri_end();
+	mdct_pending = true;
+}
+
+static void waveform_read_mdct(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
+	wav64_t *wav = (wav64_t*)ctx;
+	int16_t *state = mdct_state(sbuf);
+
+	// Past the end, the file contains some frames to cover the mixer overread.
+	if (wlen > wav->mdct_len - wpos)
+		wlen = wav->mdct_len - wpos;
+
+	// When seeking, rebuild the overlap state from the frame that
+	// precedes the one completing the first block. Its output is discarded.
+	if (seeking)
+		mdct_decode(wav, wpos / WAV64_MDCT_FRAME_SAMPLES, state, NULL, 0, 0,
+			MDCT_FLAG_RESET | MDCT_FLAG_COMMIT);
+
+	while (wlen > 0) {
+		int block = wpos / WAV64_MDCT_FRAME_SAMPLES;
+		int skip = wpos % WAV64_MDCT_FRAME_SAMPLES;
+		int n = MIN(wlen, WAV64_MDCT_FRAME_SAMPLES - skip);
+
+		// See waveform_read_adpcm
+		if (sbuf->widx + n > sbuf->size)
+			mdct_sync();
+		void *dst = samplebuffer_append(sbuf, n);
+
+		// The overlap state is saved only when the block is completed.
+		// Otherwise, the next read will decode the same frame again,
+		// starting from the same state.
+		bool last = skip + n == WAV64_MDCT_FRAME_SAMPLES;
+		mdct_decode(wav, block + 1, state, dst, skip, n, last ? MDCT_FLAG_COMMIT : 0);
+
+		wpos += n;
+		wlen -= n;
+	}
+}
+
+/** @brief Maximum number of sample banks that can be open at the same time */
+#define WAV64_MAX_BANKS   4
+
+/** @brief A sample bank opened via #wav64_bank_open */
+typedef struct {
+	uint32_t bank_id;               ///< Identifier of the bank (0 = free slot)
+	uint32_t rom_addr;              ///< ROM address of the bank file
+	int num_entries;                ///< Number of entries
+	wav64_bank_entry_t *entries;    ///< Table of entries
+} wav64_bank_t;
+
+static wav64_bank_t wav64_banks[WAV64_MAX_BANKS];
+
+void wav64_bank_open(const char *fn) {
+	if (strstr(fn, ":/")) {
+		assertf(strncmp(fn, "rom:/", 5) == 0, "Cannot open %s: sample banks are only supported in ROM (rom:/)", fn);
+		fn += 5;
+	}
+
+	int fh = dfs_open(fn);
+	assertf(fh >= 0, "file does not exist: %s", fn);
+
+	wav64_bank_header_t head;
+	dfs_read(&head, 1, sizeof(head), fh);
+	assertf(memcmp(head.id, WAV64_BANK_ID, 4) == 0, "sample bank %s: invalid ID: %02x%02x%02x%02x\n",
+		fn, head.id[0], head.id[1], head.id[2], head.id[3]);
+	assertf(head.version == WAV64_BANK_VERSION, "sample bank %s: invalid version: %02x\n",
+		fn, head.version);
+
+	wav64_bank_t *free_bank = NULL;
+	for (int i=0; i<WAV64_MAX_BANKS; i++) {
+		if (wav64_banks[i].bank_id == head.bank_id) {
+			// Already open
+			dfs_close(fh);
+			return;
+		}
+		if (!free_bank && wav64_banks[i].bank_id == 0)
+			free_bank = &wav64_banks[i];
+	}
+	assertf(free_bank, "sample bank %s: too many banks open (max: %d)", fn, WAV64_MAX_BANKS);
+
+	free_bank->entries = malloc(head.num_entries * sizeof(wav64_bank_entry_t));
+	assert(free_bank->entries);
+	dfs_read(free_bank->entries, 1, head.num_entries * sizeof(wav64_bank_entry_t), fh);
+	free_bank->num_entries = head.num_entries;
+	free_bank->rom_addr = dfs_rom_addr(fn);
+	free_bank->bank_id = head.bank_id;
+	dfs_close(fh);
+}
+
+uint32_t wav64_bank_entry_addr(uint32_t bank_id, int index, int size, const char *fn) {
+	for (int i=0; i<WAV64_MAX_BANKS; i++) {
+		wav64_bank_t *bank = &wav64_banks[i];
+		if (bank->bank_id != bank_id)
+			continue;
+		assertf(index >= 0 && index < bank->num_entries,
+			"%s: invalid sample bank entry: %d (entries: %d)", fn, index, bank->num_entries);
+		assertf(bank->entries[index].size >= size,
+			"%s: sample bank entry %d is too small (%ld < %d)\nWas the bank converted together with this file?",
+			fn, index, (long)bank->entries[index].size, size);
+		return bank->rom_addr + bank->entries[index].offset;
+	}
+	assertf(0, "%s: samples are stored in a sample bank which is not open\nCall wav64_bank_open() first", fn);
+	return 0;
+}
+
 void wav64_open(wav64_t *wav, const char *fn) {
 	memset(wav, 0, sizeof(*wav));
 
@@ -68,8 +570,9 @@ void wav64_open(wav64_t *wav, const char *fn) {
 	}
 	assertf(head.version == WAV64_FILE_VERSION, "wav64 %s: invalid version: %02x\n",
 		fn, head.version);
-	assertf(head.format == WAV64_FORMAT_RAW, "wav64 %s: invalid format: %02x\n",
-		fn, head.format);
+	assertf(head.format == WAV64_FORMAT_RAW || head.format == WAV64_FORMAT_ADPCM ||
+		head.format == WAV64_FORMAT_MDCT || head.format == WAV64_FORMAT_BANK,
+		"wav64 %s: invalid format: %02x\n", fn, head.format);
 
 	wav->wave.name = fn;
 	wav->wave.channels = head.channels;
@@ -78,10 +581,41 @@ void wav64_open(wav64_t *wav, const char *fn) {
 	wav->wave.len = head.len;
 	wav->wave.loop_len = head.loop_len; 
 	wav->rom_addr = dfs_rom_addr(fn) + head.start_offset;
-	dfs_close(fh);
-
+	wav->format = head.format;
 	wav->wave.read = waveform_read;
 	wav->wave.ctx = wav;
+
+	switch (head.format) {
+	case WAV64_FORMAT_ADPCM: {
+		wav64_header_adpcm_t ahead;
+		dfs_read(&ahead, 1, sizeof(ahead), fh);
+		for (int ch=0; ch<2; ch++)
+			wav->adpcm_loop_hist[ch] = ((uint16_t)ahead.loop_hist[ch][0] << 16) | (uint16_t)ahead.loop_hist[ch][1];
+		wav->adpcm_loop_pos = head.len - head.loop_len;
+		// audioconv64 adds silent frames to cover 64 samples of overread
+		wav->adpcm_len = ROUND_UP(head.len + 64, WAV64_ADPCM_FRAME_SAMPLES);
+		wav->wave.read = waveform_read_adpcm;
+		adpcm_init();
+	}	break;
+	case WAV64_FORMAT_MDCT: {
+		wav64_header_mdct_t mhead;
+		dfs_read(&mhead, 1, sizeof(mhead), fh);
+		assertf(mhead.frame_bytes > 0 && mhead.frame_bytes <= WAV64_MDCT_MAX_FRAME_BYTES,
+			"wav64 %s: invalid MDCT frame size: %d\n", fn, mhead.frame_bytes);
+		wav->mdct_frame_bytes = mhead.frame_bytes;
+		// The first frame only provides the overlap for the second one
+		wav->mdct_len = (mhead.num_frames - 1) * WAV64_MDCT_FRAME_SAMPLES;
+		wav->wave.read = waveform_read_mdct;
+		mdct_init();
+	}	break;
+	case WAV64_FORMAT_BANK: {
+		wav64_header_bank_t bhead;
+		dfs_read(&bhead, 1, sizeof(bhead), fh);
+		int bps = (head.nbits == 8 ? 1 : 2) * head.channels;
+		wav->rom_addr = wav64_bank_entry_addr(bhead.bank_id, bhead.index, head.len * bps, fn);
+	}	break;
+	}
+	dfs_close(fh);
 }
 
 void wav64_play(wav64_t *wav, int ch)
@@ -121,6 +121,9 @@ void xm64player_open(xm64player_t *player, const char *fn) {
 	assertf(strncmp(fn, "rom:/", 5) == 0, "xm64player only supports files in ROM (rom:/)");
 	uint32_t base_rom_addr = dfs_rom_addr(fn+5);
 
+	// Read the patterns directly from ROM via DMA, with read-ahead.
+	player->ctx->stream_rom_addr = base_rom_addr;
+
 	// Count samples
 	int ninst = xm_get_number_of_instruments(player->ctx);
 	int nwaves = 0;
@@ -136,8 +139,15 @@ void xm64player_open(xm64player_t *player, const char *fn) {
 		for (int j=0;j<inst->num_samples;j++) {
 			xm_sample_t *samp = &inst->samples[j];
 
-			// Convert offset of samples from relative to absolute
-			samp->data8_offset += base_rom_addr;
+			// Convert offset of samples from relative to absolute. If the
+			// waveforms are stored in a sample bank, the offset is the index
+			// of the entry within the bank.
+			if (player->ctx->wave_bank_id) {
+				int size = samp->length * (samp->bits / 8) + MIXER_LOOP_OVERREAD;
+				samp->data8_offset = wav64_bank_entry_addr(player->ctx->wave_bank_id, samp->data8_offset, size, fn);
+			} else {
+				samp->data8_offset += base_rom_addr;
+			}
 
 			// Initialize the waveform_t structures with information
 			// coming from the XM "sample".
@@ -262,6 +272,8 @@ void xm64player_close(xm64player_t *player) {
 	}
 
 	if (player->ctx) {
+		// Wait for the read-ahead of pattern data to finish
+		while (player->ctx->stream_next_pending) {}
 		xm_free_context(player->ctx);
 		player->ctx = NULL;
 	}
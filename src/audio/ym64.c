@@ -6,8 +6,12 @@
 
 #include "ym64.h"
 #include "ay8910.h"
+#include "ay8910_internal.h"
 #include "../compress/lzh5_internal.h"
 #include "samplebuffer.h"
+#include "n64sys.h"
+#include "rspq.h"
+#include "rsp.h"
 #include "debug.h"
 #include "asset_internal.h"
 #include "utils.h"
@@ -29,12 +33,139 @@ typedef struct __attribute__((packed)) {
 
 _Static_assert(sizeof(ym5header) == 22, "invalid header size");
 
+/**
+ * @brief True if the AY8910 emulation runs on the RSP (rsp_ay8910.S).
+ *
+ * The ucode only implements the default configuration of the emulator
+ * (stereo output, decimation by 3). With other configurations, the
+ * CPU emulator (ay8910_gen) is used instead.
+ */
+#define YM64_RSP      (AY8910_OUTPUT_STEREO && AY8910_DECIMATE == 3)
+
+DEFINE_RSP_UCODE(rsp_ay8910);
+
+/** @brief ID of the AY8910 overlay (0 if not registered yet) */
+static uint32_t ay8910_ovl_id = 0;
+
+static void ym_rsp_init(void) {
+	if (ay8910_ovl_id)
+		return;
+	rspq_init();
+	ay8910_ovl_id = rspq_overlay_register(&rsp_ay8910);
+}
+
+/** @brief Wait for the RSP to finish generating the samples of a player */
+static void ym_rsp_sync(ym64player_t *player) {
+	if (player->rsp_pending) {
+		rspq_highpri_sync();
+		player->rsp_pending = false;
+	}
+}
+
+/**
+ * @brief Scan the members of a LHA archive.
+ *
+ * audioconv64 compresses YM64 files as a sequence of independent LHA members:
+ * the first one contains the YM header and metadata, and the following ones
+ * contain a fixed number of audioframes each. This allows to seek by just
+ * restarting decompression at the beginning of the right member.
+ *
+ * This function records the offset and size of the compressed data of all
+ * members. Archives that use a different header level are created by other
+ * tools: they are treated as a single member of unknown size.
+ */
+static void ym_scan_blocks(ym64player_t *player) {
+	int cap = 16;
+	player->blocks = malloc(cap * 2 * sizeof(uint32_t));
+	player->num_blocks = 0;
+
+	uint32_t off = 0;
+	while (1) {
+		uint8_t h[22];
+		fseek(player->f, off, SEEK_SET);
+		if (fread(h, 1, sizeof(h), player->f) != sizeof(h) || h[0] == 0)
+			break;
+		if (h[2] != '-' || h[3] != 'l' || h[6] != '-')
+			break;
+
+		uint32_t csize = h[7] | (h[8] << 8) | (h[9] << 16) | ((uint32_t)h[10] << 24);
+		uint32_t dsize = h[11] | (h[12] << 8) | (h[13] << 16) | ((uint32_t)h[14] << 24);
+		if (h[20] != 0) {
+			// Not a level-0 header: we can't walk the archive, so just
+			// decompress the first member as a stream.
+			assertf(player->num_blocks == 0, "invalid LHA archive");
+			dsize = INT32_MAX;
+		}
+
+		if (player->num_blocks == cap) {
+			cap *= 2;
+			player->blocks = realloc(player->blocks, cap * 2 * sizeof(uint32_t));
+		}
+		player->blocks[player->num_blocks*2+0] = off + h[0] + 2;
+		player->blocks[player->num_blocks*2+1] = dsize;
+		player->num_blocks++;
+
+		if (h[20] != 0)
+			break;
+		off += h[0] + 2 + csize;
+	}
+	assertf(player->num_blocks > 0, "invalid LHA archive");
+}
+
+/** @brief Restart decompression at the beginning of the specified LHA member */
+static bool ym_open_block(ym64player_t *player, int idx) {
+	if (idx >= player->num_blocks)
+		return false;
+	fseek(player->f, player->blocks[idx*2+0], SEEK_SET);
+	decompress_lzh5_init(player->decoder, player->f);
+	player->cur_block = idx;
+	player->block_left = player->blocks[idx*2+1];
+	return true;
+}
+
 static int ymread(ym64player_t *player, void *buf, int sz) {
-	if (player->decoder)
-		return decompress_lzh5_read(player->decoder, buf, sz);
+	if (player->decoder) {
+		// Decompress one LHA member at a time, as each member is an
+		// independent stream.
+		int n = 0;
+		while (sz > 0) {
+			if (player->block_left == 0 && !ym_open_block(player, player->cur_block+1))
+				break;
+			int r = decompress_lzh5_read(player->decoder, buf, MIN(sz, player->block_left));
+			if (r <= 0)
+				break;
+			player->block_left -= r;
+			buf += r; sz -= r; n += r;
+		}
+		return n;
+	}
 	return fread(buf, 1, sz, player->f);
 }
 
+/** @brief Return true if the file can be seeked */
+static bool ym_can_seek(ym64player_t *player) {
+	// Compressed files can be seeked only if they were split into blocks
+	return !player->decoder || player->num_blocks > 1;
+}
+
+/** @brief Seek the file to the specified audioframe */
+static void ym_seek_frame(ym64player_t *player, int frame) {
+	player->curframe = frame;
+	if (!player->decoder) {
+		fseek(player->f, player->start_off + frame * 16, SEEK_SET);
+		return;
+	}
+
+	// Restart decompression from the block containing the frame, and
+	// skip the frames that precede it.
+	int block = frame / player->block_frames;
+	ym_open_block(player, block + 1);
+	for (int i = block * player->block_frames; i < frame; i++) {
+		uint8_t regs[16];
+		ymread(player, regs, 16);
+	}
+}
+
 static void ym_wave_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
 	ym64player_t *player = (ym64player_t*)ctx;
 
@@ -43,18 +174,16 @@ static void ym_wave_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bo
 	// and audioframes.
 	float f_samples_per_frame = player->wave.frequency / player->playfreq;
 
-	// If seeking was requested (and we can seek aka file not compressed),
-	// calculate the audioframe index corresponding to the seeking position
-	// and then seek the file there.
+	// If seeking was requested (and we can seek aka file not compressed,
+	// or compressed in blocks), calculate the audioframe index corresponding
+	// to the seeking position and then seek the file there.
 	// Notice that the position could theoretically be in the middle of an
 	// audioframe, but the current API should make it impossible to do:
 	// both ym64player_seek and the looping position are defined in terms of
 	// audioframes position not samples, so there should be no issue in
 	// converting them back from sample number.
-	if (seeking && !player->decoder) {
-		player->curframe = ((float)wpos / f_samples_per_frame);
-		fseek(player->f, player->start_off + player->curframe * 16, SEEK_SET);
-	}
+	if (seeking && ym_can_seek(player))
+		ym_seek_frame(player, (float)wpos / f_samples_per_frame);
 
 	// Calculate the last audioframe to be reconstructed in this call. Notice
 	// that we calculate it from its absolute position using the fractional
@@ -67,12 +196,25 @@ static void ym_wave_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bo
 	int nframes = lastframe - player->curframe + 1;
 	int samples_per_frame = (int)f_samples_per_frame;
 
-	// Get the pointer to the sample buffer.
-	int16_t *samples = samplebuffer_append(sbuf, nframes*samples_per_frame);
+	// If the sample buffer needs to be compacted to make space, the CPU
+	// will move samples around: make sure the RSP is done writing them.
+	if (YM64_RSP && sbuf->widx + nframes*samples_per_frame > sbuf->size)
+		ym_rsp_sync(player);
+
+	// Get the pointer to the sample buffer. The CPU generator writes the
+	// samples via cache, which is much faster than uncached stores.
+	int16_t *samples = YM64_RSP ?
+		samplebuffer_append(sbuf, nframes*samples_per_frame) :
+		samplebuffer_append_cached(sbuf, nframes*samples_per_frame);
 
 	int16_t *out = samples;
 	const int num_channels = AY8910_OUTPUT_STEREO ? 2 : 1;
 
+	// Schedule the generation in the highpri queue, so that it runs
+	// before the mixer (that also runs in highpri, see mixer_exec).
+	if (YM64_RSP)
+		rspq_highpri_begin();
+
 	for (int i=0;i<nframes;i++) {
 		// Read 14 ay8910 registers (+ maybe 2 digidrums regs, unsupported)
 		uint8_t regs[16];
@@ -80,6 +222,7 @@ static void ym_wave_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bo
 
 		// Iterate over the 14 ay8910 registers and see which ones
 		// changed since last tick.
+		bool env_restart = false;
 		for (int i=0;i<14;i++) {
 			if (player->regs[i] != regs[i]) {
 				player->regs[i] = regs[i];
@@ -87,17 +230,37 @@ static void ym_wave_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bo
 				// "don't touch". Writing the reg always restarts the
 				// envelope calculation, so it requires special handling.
 				if (i == 13 && regs[i] == 0xFF) continue;
-				ay8910_write_addr(&player->ay, i);
-				ay8910_write_data(&player->ay, regs[i]);
+				if (i == 13) env_restart = true;
+				if (!YM64_RSP) {
+					ay8910_write_addr(&player->ay, i);
+					ay8910_write_data(&player->ay, regs[i]);
+				}
 			}
 		}
 
 		// Generate the required number of samples, and store them into the
-		// sample buffer.
-		ay8910_gen(&player->ay, out, samples_per_frame);
+		// sample buffer. The RSP receives the full register dump, and
+		// restarts the envelope only if it was written.
+		if (YM64_RSP) {
+			const uint8_t *r = player->regs;
+			rspq_write(ay8910_ovl_id, 0x0,
+				PhysicalAddr(player->rsp_state), PhysicalAddr(out),
+				samples_per_frame | (env_restart ? 0x80000000 : 0),
+				((uint32_t)r[0] << 24) | (r[1] << 16) | (r[2] << 8) | r[3],
+				((uint32_t)r[4] << 24) | (r[5] << 16) | (r[6] << 8) | r[7],
+				((uint32_t)r[8] << 24) | (r[9] << 16) | (r[10] << 8) | r[11],
+				((uint32_t)r[12] << 24) | (r[13] << 16));
+		} else {
+			ay8910_gen(&player->ay, out, samples_per_frame);
+		}
 		out += (int)samples_per_frame * num_channels;
 		player->curframe++;
 	}
+
+	if (YM64_RSP) {
+		rspq_highpri_end();
+		player->rsp_pending = true;
+	}
 }
 
 void ym64player_open(ym64player_t *player, const char *fn, ym64player_songinfo_t *info) {
@@ -118,15 +281,16 @@ void ym64player_open(ym64player_t *player, const char *fn, ym64player_songinfo_t
 	if (head[2] == '-' && head[3] == 'l' && head[6] == '-') {
 		assertf(head[4] == 'h' && head[5] == '5', "Unsupported LHA compression algorithm: -l%c%c-", head[4], head[5]);
 
-		// Skip the header. We don't need anything else from it, just go straight
-		// to the first compressed file which ought to be our YM file.
-		fseek(player->f, head[0]+2, SEEK_SET);
+		// Find all the members of the archive. We don't need anything else
+		// from the headers, just go straight to the first compressed file
+		// which ought to be our YM file.
+		ym_scan_blocks(player);
 
 		// Initialize decompressor and re-read the header (this time, it will
 		// be decompressed and we should find a valid YM header).
 		player->decoder = malloc(DECOMPRESS_LZH5_STATE_SIZE);
 		offset = 0;
-		decompress_lzh5_init(player->decoder, player->f);
+		ym_open_block(player, 0);
 		_ymread(head, 12);
 	}
 
@@ -183,6 +347,13 @@ void ym64player_open(ym64player_t *player, const char *fn, ym64player_songinfo_t
 	// be useful for looping.
 	player->start_off = offset;
 
+	// For compressed files split into blocks, all blocks after the header
+	// contain the same number of audioframes (except the last one).
+	if (player->decoder && player->num_blocks > 1) {
+		player->block_frames = player->blocks[1*2+1] / 16;
+		assertf(player->block_frames > 0, "invalid YM64 block size");
+	}
+
 	// Compute playback frequency. Use floating point for accurate representation
 	// of what is requested by the module definition. The mixer supports fractional
 	// frequency so we don't want to waste precision.
@@ -206,6 +377,12 @@ void ym64player_open(ym64player_t *player, const char *fn, ym64player_songinfo_t
 	};
 
 	ay8910_reset(&player->ay);
+	if (YM64_RSP) {
+		ym_rsp_init();
+		player->rsp_state = malloc_uncached(sizeof(ay8910_rsp_state_t));
+		assert(player->rsp_state);
+		__ay8910_rsp_reset(player->rsp_state);
+	}
 	player->first_ch = -1;
 	debugf("ym64: loading %s (freq:%ld, wfreq:%ld)\n", fn, player->chipfreq/8, player->chipfreq/8/AY8910_DECIMATE);
 }
@@ -239,8 +416,8 @@ void ym64player_tell(ym64player_t *player, int *pos, float *secs) {
 }
 
 bool ym64player_seek(ym64player_t *player, int pos) {
-	// Cannot seek in a compressed file
-	if (player->decoder)
+	// Cannot seek in a compressed file, unless it was compressed in blocks
+	if (!ym_can_seek(player))
 		return false;
 
 	// If playing, seek through the mixer. Otherwise, at least record
@@ -255,11 +432,22 @@ bool ym64player_seek(ym64player_t *player, int pos) {
 void ym64player_close(ym64player_t *player) {
 	ym64player_stop(player);
 
+	if (player->rsp_state) {
+		ym_rsp_sync(player);
+		free_uncached(player->rsp_state);
+		player->rsp_state = NULL;
+	}
+
 	if (player->decoder) {
 		free(player->decoder);
 		player->decoder = NULL;
 	}
 
+	if (player->blocks) {
+		free(player->blocks);
+		player->blocks = NULL;
+	}
+
 	if (player->f) {
 		fclose(player->f);
 		player->f = NULL;
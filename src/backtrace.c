@@ -54,11 +54,17 @@
  * To see more details on how the symbol table is structured in the ROM, see
  * #symtable_header_t and the source code of the n64sym tool.
  * 
+ * Querying the table directly from ROM costs a PI transaction for each probe of
+ * the binary search, and for each string. When symbolizing often (eg: in the
+ * profilers), #backtrace_cache_init can be called to keep (a sparse index of)
+ * the address table in RAM, plus a small LRU cache of the resolved symbols.
+ * 
  */
 #include <stdint.h>
 #include <stdalign.h>
 #include <stdlib.h>
 #include <string.h>
+#include <malloc.h>
 #include "backtrace.h"
 #include "backtrace_internal.h"
 #include "debug.h"
@@ -100,6 +106,16 @@
  *   symbol entries (function names and file names). Each symbol entry stores a string as an offset
  *   within the symbol table and a length. This allows to reuse the same string (or prefix thereof)
  *   multiple times. Notice that strings are not null terminated in the string table.
+ * * Frame table (version 3+): this is a sequence of frame table entries, one for each function
+ *   in address order, plus a final entry marking the end of the code. Each entry describes the
+ *   stack frame of the function, as extracted by n64sym from its prologue, so that the backtrace
+ *   engine does not need to analyze the function code at runtime (see #__bt_lookup_func).
+ * * Page table (version 4+): the address range covered by the address table is split into
+ *   pages of 2^page_shift bytes, starting at page_base. For each page, the table stores the index
+ *   of the first entry of the address table whose address is within the page or after it, plus
+ *   a final entry equal to addrtab_size. n64sym chooses the page size so that most pages contain
+ *   only a few entries: a lookup reads two consecutive entries of the page table, and then the
+ *   whole window of the address table between them, with one DMA each (see #symt_addrtab_search).
  * 
  * The SYMT file is generated by the n64sym tool during the build process.
  */
@@ -112,6 +128,12 @@ typedef struct alignas(8) {
     uint32_t symtab_size;   ///< Size of the symbol table in the file (number of entries); always equal to addrtab_size.
     uint32_t strtab_off;    ///< Offset of the string table in the file
     uint32_t strtab_size;   ///< Size of the string table in the file (number of entries)
+    uint32_t frametab_off;  ///< Offset of the frame table in the file (version 3+)
+    uint32_t frametab_size; ///< Size of the frame table in the file (number of entries; 0 if not available)
+    uint32_t pagetab_off;   ///< Offset of the page table in the file (version 4+)
+    uint32_t pagetab_size;  ///< Size of the page table in the file (number of entries, including the final one; 0 if not available)
+    uint32_t page_shift;    ///< Log2 of the size of a page of the page table
+    uint32_t page_base;     ///< Address of the start of the first page of the page table
 } symtable_header_t;
 
 /** @brief Symbol table entry **/
@@ -136,6 +158,25 @@ typedef uint32_t addrtable_entry_t;
 #define ADDRENTRY_IS_FUNC(e)    ((e) &  1)     ///< True if the address is the start of a function
 #define ADDRENTRY_IS_INLINE(e)  ((e) &  2)     ///< True if the address is an inline duplicate
 
+/** 
+ * @brief Entry in the frame table.
+ * 
+ * Functions for which n64sym could not extract the frame information unambiguously
+ * (eg: multiple prologues, or no stack frame at all) have an entry which is not
+ * valid: for them, the function code is analyzed at runtime by #__bt_analyze_func.
+ */
+typedef struct {
+    uint32_t func_addr;     ///< Start address of the function, with the lowest 2 bits used as flags (see FRAMEENTRY_*)
+    uint16_t stack_size;    ///< Size of the stack frame
+    uint16_t ra_offset;     ///< Offset of the return address from the top of the stack frame
+    uint16_t fp_offset;     ///< Offset of the saved fp from the top of the stack frame (0 if not saved)
+    uint16_t reserved;      ///< Reserved for future use
+} frametable_entry_t;
+
+#define FRAMEENTRY_ADDR(e)      ((e) & ~3)     ///< Address (without the flags)
+#define FRAMEENTRY_IS_VALID(e)  ((e) &  1)     ///< True if the frame information is available
+#define FRAMEENTRY_USES_FP(e)   ((e) &  2)     ///< True if the function uses the frame pointer
+
 #define MIPS_OP_ADDIU_SP(op)   (((op) & 0xFFFF0000) == 0x27BD0000)   ///< Matches: addiu $sp, $sp, imm
 #define MIPS_OP_DADDIU_SP(op)  (((op) & 0xFFFF0000) == 0x67BD0000)   ///< Matches: daddiu $sp, $sp, imm
 #define MIPS_OP_JR_RA(op)      (((op) & 0xFFFFFFFF) == 0x03E00008)   ///< Matches: jr $ra
@@ -156,6 +197,41 @@ static uint32_t SYMT_ROM = 0xFFFFFFFF;
 /** @brief Placeholder used in frames where symbols are not available */
 static const char *UNKNOWN_SYMBOL = "???";
 
+/** @brief Header of the symbol table, once validated by symt_open */
+static symtable_header_t symt_cached_header;
+
+/** @brief Maximum number of address table entries fetched with a single DMA by #symt_addrtab_search */
+#define SYMT_PAGE_WINDOW    32
+
+/** @brief Number of entries in the LRU cache of resolved symbols */
+#define SYMT_LRU_SIZE       32
+/** @brief Maximum length of a string stored in the LRU cache */
+#define SYMT_LRU_STRLEN     64
+
+/** @brief Entry of the LRU cache of resolved symbols */
+typedef struct {
+    symtable_entry_t entry __attribute__((aligned(16)));            ///< Symbol table entry
+    int idx;                                                        ///< Index of the entry (-1 if the slot is empty)
+    uint32_t stamp;                                                 ///< Last time the slot was used
+    char *func_str;                                                 ///< Function name (within the func buffer)
+    char *file_str;                                                 ///< File name (within the file buffer)
+    char func[SYMT_LRU_STRLEN + 2] __attribute__((aligned(16)));    ///< Buffer for the function name
+    char file[SYMT_LRU_STRLEN + 2] __attribute__((aligned(16)));    ///< Buffer for the file name
+} symt_lru_t;
+
+/** @brief RAM copy of the address table (each entry, or one every symt_index_stride) */
+static addrtable_entry_t *symt_index;
+/** @brief Distance between the entries of the address table stored in symt_index */
+static int symt_index_stride;
+/** @brief Number of entries in symt_index */
+static int symt_index_count;
+/** @brief RAM copy of the frame table (NULL if not cached) */
+static frametable_entry_t *symt_frametab;
+/** @brief LRU cache of resolved symbols (NULL if disabled) */
+static symt_lru_t *symt_lru;
+/** @brief Counter used to track the usage of the LRU cache slots */
+static uint32_t symt_lru_clock;
+
 /** @brief Check if addr is a valid PC address */
 static bool is_valid_address(uint32_t addr)
 {
@@ -170,6 +246,10 @@ static bool is_valid_address(uint32_t addr)
  * If not found, return a null header.
  */
 static symtable_header_t symt_open(void) {
+    // The header is validated only once: the table never changes
+    if (symt_cached_header.head[0])
+        return symt_cached_header;
+
     if (SYMT_ROM == 0xFFFFFFFF) {
         SYMT_ROM = rompak_search_ext(".sym");
         if (!SYMT_ROM)
@@ -189,12 +269,25 @@ static symtable_header_t symt_open(void) {
         SYMT_ROM = 0;
         return (symtable_header_t){0};
     }
-    if (symt_header.version != 2) {
+    if (symt_header.version < 2 || symt_header.version > 4) {
         debugf("backtrace: unsupported symbol table version %ld -- please update your n64sym tool\n", symt_header.version);
         SYMT_ROM = 0;
         return (symtable_header_t){0};
     }
+    if (symt_header.version < 3) {
+        // No frame table: the header is shorter, so we read the start of the next table
+        symt_header.frametab_off = 0;
+        symt_header.frametab_size = 0;
+    }
+    if (symt_header.version < 4) {
+        // No page table
+        symt_header.pagetab_off = 0;
+        symt_header.pagetab_size = 0;
+        symt_header.page_shift = 0;
+        symt_header.page_base = 0;
+    }
 
+    symt_cached_header = symt_header;
     return symt_header;
 }
 
@@ -208,6 +301,8 @@ static symtable_header_t symt_open(void) {
 static addrtable_entry_t symt_addrtab_entry(symtable_header_t *symt, int idx)
 {
     assert(idx >= 0 && idx < symt->addrtab_size);
+    if (symt_index_stride == 1)
+        return symt_index[idx];
     return io_read(SYMT_ROM + symt->addrtab_off + idx * 4);
 }
 
@@ -220,6 +315,10 @@ static addrtable_entry_t symt_addrtab_entry(symtable_header_t *symt, int idx)
  * the current one will have the same address). If there is no exact match, the entry
  * with the biggest address just before the given address is returned.
  *
+ * Without the RAM index, the page table (if available) is used to find the window of
+ * the address table that contains the address; the window is then fetched with a single
+ * DMA and searched in RAM.
+ *
  * @param symt      SYMT file header
  * @param addr      Address to search for
  * @param idx       If not null, will be set to the index of the entry found (or the index just before)
@@ -229,6 +328,59 @@ static addrtable_entry_t symt_addrtab_search(symtable_header_t *symt, uint32_t a
 {
     int min = 0;
     int max = symt->addrtab_size - 1;
+
+    // If the RAM index is available, use it to restrict the search to a
+    // window of the address table (or to the exact entry, if it is complete).
+    if (symt_index) {
+        int lo = 0, hi = symt_index_count - 1;
+        while (lo < hi) {
+            int mid = (lo + hi + 1) / 2;
+            if (ADDRENTRY_ADDR(symt_index[mid]) < addr)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        min = lo * symt_index_stride;
+        max = MIN(min + symt_index_stride, max);
+    } else if (symt->pagetab_size && max >= 0) {
+        // Find the window of entries whose lower bound is the address: the
+        // entries from the first one of its page to the first one of the next page.
+        int npages = symt->pagetab_size - 1;
+        int page = addr < symt->page_base ? -1 : (int)MIN((addr - symt->page_base) >> symt->page_shift, (uint32_t)npages);
+        if (page < 0) {
+            max = 0;
+        } else if (page == npages) {
+            min = max;
+        } else {
+            alignas(16) uint32_t pages[2];
+            data_cache_hit_writeback_invalidate(pages, sizeof(pages));
+            dma_read(pages, SYMT_ROM + symt->pagetab_off + page * 4, sizeof(pages));
+            max = MIN((int)pages[1], max);
+            min = MIN((int)pages[0], max);
+        }
+
+        // Fetch the window with one DMA, including the entry before it
+        // (which is returned if the first entry is after the address).
+        int first = MAX(min - 1, 0);
+        int count = max - first + 1;
+        if (count <= SYMT_PAGE_WINDOW) {
+            alignas(16) addrtable_entry_t window[SYMT_PAGE_WINDOW];
+            data_cache_hit_writeback_invalidate(window, sizeof(window));
+            dma_read(window, SYMT_ROM + symt->addrtab_off + first * 4, count * 4);
+            while (min < max) {
+                int mid = (min + max) / 2;
+                if (addr <= ADDRENTRY_ADDR(window[mid - first]))
+                    max = mid;
+                else
+                    min = mid + 1;
+            }
+            if (min > 0 && ADDRENTRY_ADDR(window[min - first]) > addr)
+                --min;
+            if (idx) *idx = min;
+            return window[min - first];
+        }
+    }
+
     while (min < max) {
         int mid = (min + max) / 2;
         addrtable_entry_t entry = symt_addrtab_entry(symt, mid);
@@ -282,6 +434,47 @@ static void symt_entry_fetch(symtable_header_t *symt, symtable_entry_t *entry, i
     dma_read(entry, SYMT_ROM + symt->symtab_off + idx * sizeof(symtable_entry_t), sizeof(symtable_entry_t));
 }
 
+/**
+ * @brief Fetch an entry and its strings, using the LRU cache
+ * 
+ * @param symt    SYMT file
+ * @param idx     Index of the entry to fetch
+ * @return        The cache slot containing the entry, or NULL if the cache
+ *                is disabled or the strings are too long to be cached.
+ */
+static symt_lru_t* symt_lru_fetch(symtable_header_t *symt, int idx)
+{
+    if (!symt_lru)
+        return NULL;
+
+    disable_interrupts();
+    symt_lru_t *slot = &symt_lru[0];
+    for (int i=0; i<SYMT_LRU_SIZE; i++) {
+        if (symt_lru[i].idx == idx) {
+            slot = &symt_lru[i];
+            slot->stamp = ++symt_lru_clock;
+            enable_interrupts();
+            return slot;
+        }
+        if (symt_lru[i].stamp < slot->stamp)
+            slot = &symt_lru[i];
+    }
+
+    // Evict the least recently used slot
+    slot->idx = -1;
+    symt_entry_fetch(symt, &slot->entry, idx);
+    if (slot->entry.func_len > SYMT_LRU_STRLEN || slot->entry.file_len > SYMT_LRU_STRLEN) {
+        enable_interrupts();
+        return NULL;
+    }
+    slot->func_str = symt_string(symt, slot->entry.func_sidx, slot->entry.func_len, slot->func, sizeof(slot->func));
+    slot->file_str = symt_string(symt, slot->entry.file_sidx, slot->entry.file_len, slot->file, sizeof(slot->file));
+    slot->idx = idx;
+    slot->stamp = ++symt_lru_clock;
+    enable_interrupts();
+    return slot;
+}
+
 // Fetch the function name of an entry
 static char* symt_entry_func(symtable_header_t *symt, symtable_entry_t *entry, uint32_t addr, char *buf, int size)
 {
@@ -312,9 +505,16 @@ char* __symbolize(void *vaddr, char *buf, int size)
             a = symt_addrtab_entry(&symt, --idx);
 
         // Read the symbol name
-        symtable_entry_t entry alignas(8);
-        symt_entry_fetch(&symt, &entry, idx);
-        char *func = symt_entry_func(&symt, &entry, addr, buf, size-12);
+        char *func;
+        symt_lru_t *slot = symt_lru_fetch(&symt, idx);
+        if (slot && !(addr >= (uint32_t)inthandler && addr < (uint32_t)inthandler_end)) {
+            func = buf;
+            strlcpy(buf, slot->func_str, size-12);
+        } else {
+            symtable_entry_t entry alignas(8);
+            symt_entry_fetch(&symt, &entry, idx);
+            func = symt_entry_func(&symt, &entry, addr, buf, size-12);
+        }
         char lbuf[12];
         snprintf(lbuf, sizeof(lbuf), "+0x%lx", addr - ADDRENTRY_ADDR(a));
         return strcat(func, lbuf);
@@ -450,7 +650,76 @@ bool __bt_analyze_func(bt_func_t *func, uint32_t *ptr, uint32_t func_start, bool
     return true;
 }
 
-static void backtrace_foreach(void (*cb)(void *arg, void *ptr), void *arg)
+/**
+ * @brief Return the address word of an entry in the frame table by index
+ * 
+ * @param symt      SYMT file header
+ * @param idx       Index of the entry
+ * @return uint32_t Address of the function, with the FRAMEENTRY_* flags
+ */
+static uint32_t symt_frametab_addr(symtable_header_t *symt, int idx)
+{
+    if (symt_frametab)
+        return symt_frametab[idx].func_addr;
+    return io_read(SYMT_ROM + symt->frametab_off + idx * sizeof(frametable_entry_t));
+}
+
+/**
+ * @brief Look up the stack frame layout of a function in the frame table.
+ * 
+ * This is the fast path of #__bt_analyze_func: instead of analyzing the function
+ * code, the frame information extracted by n64sym is used. It is only correct if
+ * the function was stopped after its prologue, which is always true for a function
+ * that made a call, but not for one interrupted by an exception.
+ * 
+ * @param func      Output function description structure
+ * @param ptr       Pointer to the function code where the backtrace starts (see #__bt_analyze_func)
+ * @return true if the information was found, false if the function must be analyzed
+ */
+bool __bt_lookup_func(bt_func_t *func, uint32_t *ptr)
+{
+    uint32_t addr = (uint32_t)ptr;
+    if (!is_valid_address(addr) || (ptr >= inthandler && ptr < inthandler_end))
+        return false;
+
+    symtable_header_t symt = symt_open();
+    if (!symt.frametab_size)
+        return false;
+
+    // Find the last function starting at or before the address
+    int min = 0;
+    int max = symt.frametab_size - 1;
+    while (min < max) {
+        int mid = (min + max + 1) / 2;
+        if (FRAMEENTRY_ADDR(symt_frametab_addr(&symt, mid)) <= addr)
+            min = mid;
+        else
+            max = mid - 1;
+    }
+
+    frametable_entry_t entry;
+    if (symt_frametab) {
+        entry = symt_frametab[min];
+    } else {
+        uint32_t rom = SYMT_ROM + symt.frametab_off + min * sizeof(frametable_entry_t);
+        uint32_t w1 = io_read(rom + 4), w2 = io_read(rom + 8);
+        entry = (frametable_entry_t){
+            .func_addr = io_read(rom),
+            .stack_size = w1 >> 16, .ra_offset = w1 & 0xFFFF,
+            .fp_offset = w2 >> 16,
+        };
+    }
+    if (FRAMEENTRY_ADDR(entry.func_addr) > addr || !FRAMEENTRY_IS_VALID(entry.func_addr))
+        return false;
+
+    *func = (bt_func_t){
+        .type = FRAMEENTRY_USES_FP(entry.func_addr) ? BT_FUNCTION_FRAMEPOINTER : BT_FUNCTION,
+        .stack_size = entry.stack_size, .ra_offset = entry.ra_offset, .fp_offset = entry.fp_offset,
+    };
+    return true;
+}
+
+static void backtrace_foreach(bool (*cb)(void *arg, void *ptr), void *arg)
 {
     /*
      * This function is called in very risky contexts, for instance as part of an exception
@@ -487,9 +756,14 @@ static void backtrace_foreach(void (*cb)(void *arg, void *ptr), void *arg)
     while (1) {
         // Analyze the function pointed by ra, passing information about the previous exception frame if any.
         // If the analysis fail (for invalid memory accesses), stop right away.
+        // Use the frame table generated by n64sym if possible; functions interrupted
+        // by an exception might be stopped before the end of their prologue, so
+        // they are always analyzed.
         bt_func_t func; 
-        if (!__bt_analyze_func(&func, ra, func_start, exception_ra))
-            return;
+        if (exception_ra || !__bt_lookup_func(&func, ra)) {
+            if (!__bt_analyze_func(&func, ra, func_start, exception_ra))
+                return;
+        }
 
         #if BACKTRACE_DEBUG
         debugf("backtrace: %s, ra=%p, sp=%p, fp=%p ra_offset=%d, fp_offset=%d, stack_size=%d\n", 
@@ -545,7 +819,8 @@ static void backtrace_foreach(void (*cb)(void *arg, void *ptr), void *arg)
                     
                     // Store the invalid address in the backtrace, so that it will appear in dumps.
                     // This makes it easier for the user to understand the reason for the exception.
-                    cb(arg, ra);
+                    if (!cb(arg, ra))
+                        return;
                     #if BACKTRACE_DEBUG
                     debugf("backtrace: %s, ra=%p, sp=%p, fp=%p ra_offset=%d, fp_offset=%d, stack_size=%d\n", 
                         "BT_INVALID", ra, sp, fp, func.ra_offset, func.fp_offset, func.stack_size);
@@ -587,18 +862,20 @@ static void backtrace_foreach(void (*cb)(void *arg, void *ptr), void *arg)
                 break;
         }
 
-        // Call the callback with this stack frame
-        cb(arg, ra);
+        // Call the callback with this stack frame. Stop if it is not interested
+        // in more frames.
+        if (!cb(arg, ra))
+            return;
     }
 }
 
 int backtrace(void **buffer, int size)
 {
     int i = -1; // skip backtrace itself
-    void cb(void *arg, void *ptr) {
-        if (i >= 0 && i < size)
+    bool cb(void *arg, void *ptr) {
+        if (i >= 0)
             buffer[i] = ptr;
-        i++;
+        return ++i < size;
     }
     backtrace_foreach(cb, NULL);
     return i;
@@ -607,6 +884,20 @@ int backtrace(void **buffer, int size)
 static void format_entry(void (*cb)(void *, backtrace_frame_t *), void *cb_arg, 
     symtable_header_t *symt, int idx, uint32_t addr, uint32_t offset, bool is_func, bool is_inline)
 {       
+    symt_lru_t *slot = symt_lru_fetch(symt, idx);
+    if (slot) {
+        bool exc = (addr >= (uint32_t)inthandler && addr < (uint32_t)inthandler_end);
+        cb(cb_arg, &(backtrace_frame_t){
+            .addr = addr,
+            .func_offset = offset ? offset : slot->entry.func_off,
+            .func = exc ? "<EXCEPTION HANDLER>" : slot->func_str,
+            .source_file = slot->file_str,
+            .source_line = is_func ? 0 : slot->entry.line,
+            .is_inline = is_inline,
+        });
+        return;
+    }
+
     symtable_entry_t entry alignas(8);
     symt_entry_fetch(symt, &entry, idx);
 
@@ -673,6 +964,73 @@ bool backtrace_symbols_cb(void **buffer, int size, uint32_t flags,
     return true;
 }
 
+bool backtrace_cache_init(int index_stride)
+{
+    assertf(index_stride >= 1, "invalid index stride: %d", index_stride);
+    backtrace_cache_close();
+
+    symtable_header_t symt = symt_open();
+    if (!symt.head[0])
+        return false;
+
+    // Load the address table (or one entry every index_stride) in RAM
+    int count = (symt.addrtab_size + index_stride - 1) / index_stride;
+    addrtable_entry_t *index = memalign(16, ROUND_UP(count * sizeof(addrtable_entry_t), 16));
+    symt_lru_t *lru = memalign(16, SYMT_LRU_SIZE * sizeof(symt_lru_t));
+    // With the full index, keep also the frame table in RAM
+    frametable_entry_t *frametab = NULL;
+    if (index_stride == 1 && symt.frametab_size)
+        frametab = memalign(16, ROUND_UP(symt.frametab_size * sizeof(frametable_entry_t), 16));
+    if (!index || !lru || (index_stride == 1 && symt.frametab_size && !frametab)) {
+        free(index);
+        free(lru);
+        free(frametab);
+        return false;
+    }
+    if (index_stride == 1) {
+        data_cache_hit_writeback_invalidate(index, count * sizeof(addrtable_entry_t));
+        dma_read(index, SYMT_ROM + symt.addrtab_off, count * sizeof(addrtable_entry_t));
+        if (frametab) {
+            data_cache_hit_writeback_invalidate(frametab, symt.frametab_size * sizeof(frametable_entry_t));
+            dma_read(frametab, SYMT_ROM + symt.frametab_off, symt.frametab_size * sizeof(frametable_entry_t));
+        }
+    } else {
+        for (int i=0; i<count; i++)
+            index[i] = io_read(SYMT_ROM + symt.addrtab_off + i * index_stride * 4);
+    }
+    for (int i=0; i<SYMT_LRU_SIZE; i++) {
+        lru[i].idx = -1;
+        lru[i].stamp = 0;
+    }
+
+    disable_interrupts();
+    symt_index = index;
+    symt_index_stride = index_stride;
+    symt_index_count = count;
+    symt_frametab = frametab;
+    symt_lru = lru;
+    symt_lru_clock = 0;
+    enable_interrupts();
+    return true;
+}
+
+void backtrace_cache_close(void)
+{
+    disable_interrupts();
+    addrtable_entry_t *index = symt_index;
+    symt_lru_t *lru = symt_lru;
+    frametable_entry_t *frametab = symt_frametab;
+    symt_index = NULL;
+    symt_index_stride = 0;
+    symt_index_count = 0;
+    symt_frametab = NULL;
+    symt_lru = NULL;
+    enable_interrupts();
+    free(index);
+    free(frametab);
+    free(lru);
+}
+
 char** backtrace_symbols(void **buffer, int size)
 {
     const int MAX_FILE_LEN = 120;
@@ -18,6 +18,7 @@ typedef struct {
 } bt_func_t;
 
 bool __bt_analyze_func(bt_func_t *func, uint32_t *ptr, uint32_t func_start, bool from_exception);
+bool __bt_lookup_func(bt_func_t *func, uint32_t *ptr);
 
 
 /**
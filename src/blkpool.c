@@ -0,0 +1,117 @@
+/**
+ * @file blkpool.c
+ * @brief Fixed-size block allocator
+ * @ingroup lowlevel
+ */
+
+#include "blkpool.h"
+#include "interrupt.h"
+#include "cop0.h"
+#include "debug.h"
+#include <malloc.h>
+#include <stdbool.h>
+
+/** @brief Size of the header of each chunk (keeps the blocks 8-byte aligned) */
+#define CHUNK_HEADER_SIZE       8
+
+/** @brief Check whether the pool can grow from the current context */
+static bool blkpool_can_grow(void)
+{
+    // malloc is not reentrant: it can only be called with interrupts enabled,
+    // outside of interrupt handlers.
+    return get_interrupts_state() != INTERRUPTS_DISABLED &&
+        !(C0_STATUS() & C0_STATUS_EXL);
+}
+
+/** @brief Allocate a new chunk of blocks from the heap, and add them to the free list */
+static bool blkpool_grow(blkpool_t *pool)
+{
+    int n = pool->chunk_blocks;
+    uint8_t *chunk = memalign(8, CHUNK_HEADER_SIZE + n * pool->block_size);
+    if (!chunk)
+        return false;
+
+    // Link the blocks among themselves before publishing them
+    uint8_t *first = chunk + CHUNK_HEADER_SIZE;
+    uint8_t *last = first + (n-1) * pool->block_size;
+    for (uint8_t *b = first; b < last; b += pool->block_size)
+        *(void**)b = b + pool->block_size;
+
+    disable_interrupts();
+    *(void**)chunk = pool->chunks;
+    pool->chunks = chunk;
+    *(void**)last = pool->free_list;
+    pool->free_list = first;
+    pool->capacity += n;
+    enable_interrupts();
+    return true;
+}
+
+void blkpool_init(blkpool_t *pool, int block_size, int per_chunk)
+{
+    assertf(block_size >= (int)sizeof(void*), "blkpool_init: invalid block size: %d", block_size);
+    assertf(per_chunk > 0, "blkpool_init: invalid number of blocks per chunk: %d", per_chunk);
+    *pool = (blkpool_t){
+        .block_size = (block_size + 7) & ~7,
+        .chunk_blocks = per_chunk,
+    };
+}
+
+void blkpool_reserve(blkpool_t *pool, int count)
+{
+    assertf(blkpool_can_grow(), "blkpool_reserve: must be called with interrupts enabled");
+    while ((int)(pool->capacity - pool->used) < count) {
+        bool ok = blkpool_grow(pool);
+        assertf(ok, "blkpool_reserve: out of memory (%d blocks of %d bytes)",
+            count, (int)pool->block_size);
+    }
+}
+
+void *blkpool_alloc(blkpool_t *pool)
+{
+    assertf(pool->block_size, "blkpool_alloc: pool not initialized");
+    while (1) {
+        disable_interrupts();
+        void *block = pool->free_list;
+        if (block) {
+            pool->free_list = *(void**)block;
+            pool->used++;
+        }
+        enable_interrupts();
+
+        if (block)
+            return block;
+        if (!blkpool_can_grow() || !blkpool_grow(pool))
+            return NULL;
+    }
+}
+
+void blkpool_free(blkpool_t *pool, void *block)
+{
+    if (!block)
+        return;
+
+    disable_interrupts();
+    assertf(pool->used > 0, "blkpool_free: block %p not allocated from this pool", block);
+    *(void**)block = pool->free_list;
+    pool->free_list = block;
+    pool->used--;
+    enable_interrupts();
+}
+
+void blkpool_close(blkpool_t *pool)
+{
+    disable_interrupts();
+    void *chunk = pool->chunks;
+    pool->chunks = NULL;
+    pool->free_list = NULL;
+    pool->capacity = 0;
+    pool->used = 0;
+    enable_interrupts();
+
+    while (chunk) {
+        void *next = *(void**)chunk;
+        free(chunk);
+        chunk = next;
+    }
+}
@@ -0,0 +1,73 @@
+/**
+ * @file boot_profile.c
+ * @brief Boot time profiler
+ * @ingroup lowlevel
+ */
+#include "boot_profile.h"
+#include "boot_profile_internal.h"
+#include "n64sys.h"
+#include "interrupt.h"
+#include "timer.h"
+#include "debug.h"
+
+/** @brief Value of the COUNT register at the entrypoint (set by entrypoint.S) */
+uint32_t __boot_start_ticks;
+
+static boot_profile_step_t steps[BOOT_PROFILE_MAX_STEPS];  ///< Steps recorded so far
+static int num_steps;                       ///< Number of steps recorded
+static uint32_t last_end;                   ///< End of the last step (ticks since the entrypoint)
+static uint32_t first_frame;                ///< Time of the first frame (0 if not shown yet)
+
+void __boot_profile_record(const char *name, uint32_t start)
+{
+    uint32_t now = TICKS_READ();
+
+    disable_interrupts();
+    if (num_steps < BOOT_PROFILE_MAX_STEPS) {
+        boot_profile_step_t *s = &steps[num_steps++];
+        s->name = name;
+        s->start = start - __boot_start_ticks;
+        s->ticks = now - start;
+        last_end = now - __boot_start_ticks;
+    }
+    enable_interrupts();
+}
+
+/** @brief Record the global constructors step (called by entrypoint.S) */
+void __boot_profile_ctors(uint32_t start)
+{
+    __boot_profile_record("global ctors", start);
+}
+
+void __boot_profile_frame(void)
+{
+    if (!first_frame)
+        first_frame = TICKS_READ() - __boot_start_ticks;
+}
+
+void boot_profile_mark(const char *name)
+{
+    __boot_profile_record(name, __boot_start_ticks + last_end);
+}
+
+int boot_profile_get_steps(const boot_profile_step_t **out)
+{
+    *out = steps;
+    return num_steps;
+}
+
+uint32_t boot_profile_first_frame(void)
+{
+    return first_frame;
+}
+
+void boot_profile_dump(void)
+{
+    debugf("Boot profile (times in microseconds since the entrypoint):\n");
+    debugf("  %-24s %10s %10s\n", "step", "start", "duration");
+    for (int i = 0; i < num_steps; i++)
+        debugf("  %-24s %10lld %10lld\n", steps[i].name,
+            TIMER_MICROS_LL(steps[i].start), TIMER_MICROS_LL(steps[i].ticks));
+    if (first_frame)
+        debugf("  %-24s %10lld\n", "first frame", TIMER_MICROS_LL(first_frame));
+}
@@ -0,0 +1,17 @@
+/**
+ * @file boot_profile_internal.h
+ * @brief Boot time profiler (internal functions)
+ * @ingroup lowlevel
+ */
+#ifndef __LIBDRAGON_BOOT_PROFILE_INTERNAL_H
+#define __LIBDRAGON_BOOT_PROFILE_INTERNAL_H
+
+#include <stdint.h>
+
+/** @brief Record a step of the boot sequence that started at the specified time (see #TICKS_READ) */
+void __boot_profile_record(const char *name, uint32_t start);
+
+/** @brief Record the time of the first frame shown (called by #display_show) */
+void __boot_profile_frame(void);
+
+#endif
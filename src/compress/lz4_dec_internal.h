@@ -65,4 +65,25 @@ void decompress_lz4_init(void *state, FILE *fp);
 ssize_t decompress_lz4_read(void *state, void *buf, size_t len);
 void* decompress_lz4_full(const char *fn, FILE *fp, size_t cmp_size, size_t size);
 
+/**
+ * @brief Schedule the decompression of a block of LZ4 data on the RSP (mem to mem).
+ * 
+ * This function enqueues a rspq command that decompresses a block of LZ4 data
+ * using the RSP. The function returns immediately: use #rspq_syncpoint_new
+ * or #rspq_wait to know when decompression is finished.
+ * 
+ * The source data must have been written back from the CPU cache, and
+ * the CPU cache must not contain dirty lines covering the destination buffer
+ * (or the result). In-place decompression is supported with the same margin
+ * (see #LZ4_DECOMPRESS_INPLACE_MARGIN). Notice that the RSP can write up to 7
+ * bytes past the end of the decompressed data.
+ * 
+ * @param src           Pointer to source buffer (compressed data)
+ * @param src_size      Size of the compressed data in bytes
+ * @param dst           Pointer to destination buffer (8-byte aligned)
+ * @param result        If not NULL, pointer to a 8-byte aligned word where the
+ *                      RSP will write the number of decompressed bytes.
+ */
+void decompress_lz4_rsp(const void *src, int src_size, void *dst, uint32_t *result);
+
 #endif
@@ -0,0 +1,40 @@
+/**
+ * @file lz4_dec_rsp.c
+ * @brief LZ4 decompression on the RSP
+ * @ingroup asset
+ *
+ * This file contains the CPU side of the LZ4 decompression ucode
+ * (rsp_lz4_dec.S). Decompression is scheduled as a rspq command, so
+ * it runs asynchronously and the CPU is free to do other work meanwhile.
+ */
+#include <stdio.h>
+#include "lz4_dec_internal.h"
+#include "rspq.h"
+#include "rsp.h"
+#include "n64sys.h"
+#include "debug.h"
+
+DEFINE_RSP_UCODE(rsp_lz4_dec);
+
+/** @brief ID of the LZ4 overlay (0 if not registered yet) */
+static uint32_t lz4_rsp_ovl_id = 0;
+
+/** @brief Register the LZ4 overlay the first time it is needed */
+static void lz4_rsp_init(void)
+{
+    if (lz4_rsp_ovl_id)
+        return;
+    rspq_init();
+    lz4_rsp_ovl_id = rspq_overlay_register(&rsp_lz4_dec);
+}
+
+void decompress_lz4_rsp(const void *src, int src_size, void *dst, uint32_t *result)
+{
+    assertf(((uint32_t)dst & 7) == 0, "destination buffer must be 8-byte aligned: %p", dst);
+    assertf(((uint32_t)result & 7) == 0, "result pointer must be 8-byte aligned: %p", result);
+    lz4_rsp_init();
+
+    rspq_write(lz4_rsp_ovl_id, 0x0,
+        PhysicalAddr(src), src_size,
+        PhysicalAddr(dst), result ? PhysicalAddr(result) : 0);
+}
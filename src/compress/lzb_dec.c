@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lzb_dec_internal.h"
+#include "ringbuf_internal.h"
+#include "../utils.h"
+
+#ifdef N64
+#include <malloc.h>
+#include "debug.h"
+#include "dragonfs.h"
+#include "dma.h"
+#include "n64sys.h"
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define likely(x)       __builtin_expect(!!(x), 1)
+#define unlikely(x)     __builtin_expect(!!(x), 0)
+#else
+#define likely(x)       (x)
+#define unlikely(x)     (x)
+#endif
+
+_Static_assert(LZB_MAX_OFFSET <= RING_BUFFER_SIZE, "LZB window does not fit the ring buffer");
+
+#ifdef N64
+static void lzb_wait_dma(const void *pIn) {
+   static void *ptr; static bool finished = false;
+   if (pIn == NULL) {
+      finished = false;
+      ptr = NULL;
+      return;
+   }
+   if (finished) return;
+   while (ptr < pIn) {
+      // Check if DMA is finished
+      if (!(*PI_STATUS & 1)) {
+         finished = true;
+         return;
+      }
+      // Read current DMA position. Ignore partial cachelines as they
+      // would create coherency problems if accessed by the CPU.
+      ptr = (void*)((*PI_DRAM_ADDR & ~0xF) | 0x80000000);
+   }
+}
+#else
+static void lzb_wait_dma(const void *pIn) {}
+#endif
+
+/** @brief Unaligned 64-bit type, used for fast copies (LDL/LDR/SDL/SDR on MIPS) */
+typedef uint64_t u_uint64_t __attribute__((aligned(1)));
+
+static int decompress_lzb_mem(const uint8_t *src, int src_size, uint8_t *dst, int dst_size, bool dma_race)
+{
+   const uint8_t *src_end = src + src_size;
+   uint8_t *out = dst;
+   const uint8_t *out_end = dst + dst_size;
+
+   if (dma_race) lzb_wait_dma(NULL);
+   while (src < src_end) {
+      // A command is at most 1+LZB_MAX_LITERALS bytes, plus the overshoot of the fast copy
+      if (dma_race) lzb_wait_dma(src + 1 + LZB_MAX_LITERALS + 8);
+      unsigned int cmd = *src++;
+
+      if (cmd < 0x80) {
+         int n = cmd + 1;
+         if (likely(src + n + 7 <= src_end && out + n + 7 <= out_end)) {
+            // Copy 8 bytes at a time, possibly overshooting. This is safe
+            // also during in-place decompression as we always copy forward
+            // (dst < src), and the inplace margin leaves room for the overshoot.
+            uint8_t *o = out;
+            const uint8_t *i = src;
+            do {
+               *(u_uint64_t*)o = *(u_uint64_t*)i;
+               o += 8; i += 8;
+            } while (o < out + n);
+         } else {
+            if (unlikely(src + n > src_end || out + n > out_end)) return -1;
+            memmove(out, src, n);
+         }
+         out += n;
+         src += n;
+         continue;
+      }
+
+      if (unlikely(src + 2 > src_end)) return -1;
+      int len = (cmd & 0x7F) + LZB_MIN_MATCH;
+      int offset = ((src[0] << 8) | src[1]) + 1;
+      src += 2;
+
+      const uint8_t *match = out - offset;
+      if (unlikely(match < dst)) return -1;
+
+      if (likely(offset >= 8 && out + len + 7 <= out_end)) {
+         // Each 8-byte copy reads data at least 8 bytes behind, so this is
+         // correct even if the match overlaps the bytes being written.
+         uint8_t *o = out;
+         do {
+            *(u_uint64_t*)o = *(u_uint64_t*)match;
+            o += 8; match += 8;
+         } while (o < out + len);
+         out += len;
+      } else {
+         if (unlikely(out + len > out_end)) return -1;
+         while (len--)
+            *out++ = *match++;
+      }
+   }
+
+   return out - dst;
+}
+
+int decompress_lzb_full_mem(const uint8_t *src, int src_size, uint8_t *dst, int dst_size)
+{
+   return decompress_lzb_mem(src, src_size, dst, dst_size, false);
+}
+
+void* decompress_lzb_full(const char *fn, FILE *fp, size_t cmp_size, size_t size)
+{
+   int bufsize = size + LZB_DECOMPRESS_INPLACE_MARGIN(cmp_size);
+   int cmp_offset = bufsize - cmp_size;
+   if (cmp_offset & 1) {
+      cmp_offset++;
+      bufsize++;
+   }
+   if (bufsize & 15) {
+      // In case we need to call invalidate (see below), we need an aligned buffer
+      bufsize += 16 - (bufsize & 15);
+   }
+
+   void *s = memalign(16, bufsize);
+   assertf(s, "asset_load: out of memory");
+   int n;
+
+   #ifdef N64
+   if (fn && strncmp(fn, "rom:/", 5) == 0) {
+      // Invalidate the portion of the buffer where we are going to load
+      // the compressed data, then start an asynchronous DMA transfer and
+      // decompress as the data flows in (see decompress_lz4_full).
+      int align_cmp_offset = cmp_offset & ~15;
+      data_cache_hit_invalidate(s+align_cmp_offset, bufsize-align_cmp_offset);
+      uint32_t addr = dfs_rom_addr(fn+5) & 0x1FFFFFFF;
+      dma_read_async(s+cmp_offset, addr+16, cmp_size);
+      n = decompress_lzb_mem(s+cmp_offset, cmp_size, s, size, true); (void)n;
+   #else
+   if (false) {
+   #endif
+   } else {
+      fread(s+cmp_offset, 1, cmp_size, fp);
+      n = decompress_lzb_mem(s+cmp_offset, cmp_size, s, size, false); (void)n;
+   }
+   assertf(n == size, "asset: decompression error on file %s: corrupted? (%d/%d)", fn, n, size);
+   void *ptr = realloc(s, size); (void)ptr;
+   assertf(s == ptr, "asset: realloc moved the buffer"); // guaranteed by newlib
+   return ptr;
+}
+
+/**
+ * @brief State of the LZB algorithm (streaming version).
+ */
+typedef struct lzb_state_s {
+   uint8_t buf[128] __attribute__((aligned(8)));     ///< File buffer
+   FILE *fp;                        ///< File pointer to read from
+   int buf_idx;                     ///< Current index in the file buffer
+   int buf_size;                    ///< Size of the file buffer
+   bool eof;                        ///< True if we reached the end of the file
+   int lit_len;                     ///< Number of literals left to copy
+   int match_len;                   ///< Number of bytes left to copy from the ring buffer
+   int match_off;                   ///< Distance in the ring buffer to copy from
+   decompress_ringbuf_t ringbuf;    ///< Ring buffer
+} lzb_state_t;
+
+#ifdef N64
+_Static_assert(sizeof(lzb_state_t) == DECOMPRESS_LZB_STATE_SIZE, "decompress_lzb_state_t size mismatch");
+#endif
+
+static void lzb_refill(lzb_state_t *lzb)
+{
+   lzb->buf_size = fread(lzb->buf, 1, sizeof(lzb->buf), lzb->fp);
+   lzb->buf_idx = 0;
+   lzb->eof = (lzb->buf_size == 0);
+}
+
+static uint8_t lzb_readbyte(lzb_state_t *lzb)
+{
+   if (lzb->buf_idx >= lzb->buf_size)
+      lzb_refill(lzb);
+   return lzb->buf[lzb->buf_idx++];
+}
+
+static void lzb_read(lzb_state_t *lzb, void *buf, size_t len)
+{
+   while (len > 0 && !lzb->eof) {
+      if (lzb->buf_idx >= lzb->buf_size) {
+         lzb_refill(lzb);
+         continue;
+      }
+      int n = MIN(len, lzb->buf_size - lzb->buf_idx);
+      memcpy(buf, lzb->buf + lzb->buf_idx, n);
+      buf += n;
+      len -= n;
+      lzb->buf_idx += n;
+   }
+}
+
+void decompress_lzb_init(void *state, FILE *fp)
+{
+   lzb_state_t *lzb = (lzb_state_t*)state;
+   lzb->fp = fp;
+   lzb->eof = false;
+   lzb->buf_idx = 0;
+   lzb->buf_size = 0;
+   lzb->lit_len = 0;
+   lzb->match_len = 0;
+   lzb->match_off = 0;
+   __ringbuf_init(&lzb->ringbuf);
+}
+
+ssize_t decompress_lzb_read(void *state, void *buf, size_t len)
+{
+   lzb_state_t *lzb = (lzb_state_t*)state;
+   void *buf_orig = buf;
+   int n;
+
+   while (len > 0) {
+      if (lzb->lit_len) {
+         n = MIN(lzb->lit_len, len);
+         lzb_read(lzb, buf, n);
+         __ringbuf_write(&lzb->ringbuf, buf, n);
+         lzb->lit_len -= n;
+      } else if (lzb->match_len) {
+         n = MIN(lzb->match_len, len);
+         __ringbuf_copy(&lzb->ringbuf, lzb->match_off, buf, n);
+         lzb->match_len -= n;
+      } else {
+         // Read next command
+         unsigned int cmd = lzb_readbyte(lzb);
+         if (lzb->eof)
+            break;
+         if (cmd < 0x80) {
+            lzb->lit_len = cmd + 1;
+         } else {
+            lzb->match_len = (cmd & 0x7F) + LZB_MIN_MATCH;
+            lzb->match_off = lzb_readbyte(lzb) << 8;
+            lzb->match_off |= lzb_readbyte(lzb);
+            lzb->match_off += 1;
+         }
+         continue;
+      }
+      buf += n;
+      len -= n;
+   }
+
+   return buf - buf_orig;
+}
@@ -0,0 +1,58 @@
+#ifndef LIBDRAGON_COMPRESS_LZB_DEC_INTERNAL_H
+#define LIBDRAGON_COMPRESS_LZB_DEC_INTERNAL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief LZB: a byte-oriented LZ77 format (compression level 3).
+ *
+ * LZB is a minimal LZ77 variant designed to be as fast as possible to decode
+ * on the VR4300: the stream is a sequence of byte-aligned commands, with no
+ * bit-level I/O and no variable-length integers:
+ *
+ *  * 0x00-0x7F: literal run. Copy the next (cmd+1) bytes to the output.
+ *  * 0x80-0xFF: match. Copy ((cmd & 0x7F) + #LZB_MIN_MATCH) bytes from
+ *    the previous output, at a distance specified by the next two bytes
+ *    (big-endian, plus 1).
+ *
+ * The maximum match distance is #LZB_MAX_OFFSET, so that a stream can be
+ * decoded with the same ring buffer used by the other streaming decoders.
+ */
+#define LZB_MIN_MATCH       4
+#define LZB_MAX_MATCH       (0x7F + LZB_MIN_MATCH)     ///< Longest match in a single command
+#define LZB_MAX_LITERALS    0x80                       ///< Longest literal run in a single command
+#define LZB_MAX_OFFSET      (16 * 1024)                ///< Maximum match distance
+
+/**
+ * @brief Calculate the margin required for in-place decompression.
+ *
+ * The worst case for LZB is a run of literals, that expands by one
+ * byte every #LZB_MAX_LITERALS bytes. The decoder also copies in 8-byte
+ * chunks and can write up to 7 bytes past the end of each command.
+ *
+ * See #LZ4_DECOMPRESS_INPLACE_MARGIN for an example of use.
+ */
+#define LZB_DECOMPRESS_INPLACE_MARGIN(compressed_size)    (((compressed_size) >> 7) + 32)
+
+/**
+ * @brief Decompress a block of LZB data (mem to mem).
+ *
+ * In-place decompression is supported: see #LZB_DECOMPRESS_INPLACE_MARGIN.
+ *
+ * @param src           Pointer to source buffer (compressed data)
+ * @param src_size      Size of the compressed data in bytes
+ * @param dst           Pointer to destination buffer (decompressed data)
+ * @param dst_size      Size of the destination buffer in bytes
+ * @return int          Number of bytes decompressed, or -1 on error.
+ */
+int decompress_lzb_full_mem(const uint8_t *src, int src_size, uint8_t *dst, int dst_size);
+
+#define DECOMPRESS_LZB_STATE_SIZE  (16544)
+
+void decompress_lzb_init(void *state, FILE *fp);
+ssize_t decompress_lzb_read(void *state, void *buf, size_t len);
+void* decompress_lzb_full(const char *fn, FILE *fp, size_t cmp_size, size_t size);
+
+#endif
@@ -13,6 +13,9 @@
 #ifdef N64
 #include <malloc.h>
 #include "debug.h"
+#include "dma.h"
+#include "dragonfs.h"
+#include "n64sys.h"
 #else
 #include <stdlib.h>
 #endif
@@ -50,9 +53,12 @@ CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 
 typedef struct {
 
-	// File pointer to read from.
+	// File pointer to read from, or memory buffer (in-place decompression).
 
-	FILE *fp;
+	union {
+		FILE *fp;
+		const uint8_t *mem;
+	};
 
 	// Internal cache of bytes read from the input stream.
 
@@ -65,6 +71,10 @@ typedef struct {
 	uint64_t bit_buffer;
 	int bits;
 
+	// Bytes left in the memory buffer, or -1 if reading from fp.
+
+	int mem_left;
+
 } BitStreamReader;
 
 // Initialize bit stream reader structure.
@@ -76,6 +86,16 @@ static void bit_stream_reader_init(BitStreamReader *reader, FILE *fp)
 	reader->buf_size = 0;
 	reader->bits = 0;
 	reader->bit_buffer = 0;
+	reader->mem_left = -1;
+}
+
+// Initialize bit stream reader structure to read from a memory buffer.
+
+static void bit_stream_reader_init_mem(BitStreamReader *reader, const uint8_t *mem, int size)
+{
+	bit_stream_reader_init(reader, NULL);
+	reader->mem = mem;
+	reader->mem_left = size;
 }
 
 // Refill the bit buffer with other 64 bits from the input stream.
@@ -83,7 +103,18 @@ static void bit_stream_reader_init(BitStreamReader *reader, FILE *fp)
 static int refill_bits(BitStreamReader *reader)
 {
 	if (reader->buf_idx >= reader->buf_size) {
-		reader->buf_size = fread(reader->buf, 1, sizeof(reader->buf), reader->fp);
+		if (reader->mem_left < 0) {
+			reader->buf_size = fread(reader->buf, 1, sizeof(reader->buf), reader->fp);
+		} else {
+			// Copying from memory into the cache (rather than reading the
+			// buffer directly) is what makes in-place decompression possible:
+			// input bytes are consumed in chunks, so the output can safely
+			// overwrite them.
+			reader->buf_size = reader->mem_left < (int)sizeof(reader->buf) ? reader->mem_left : (int)sizeof(reader->buf);
+			memcpy(reader->buf, reader->mem, reader->buf_size);
+			reader->mem += reader->buf_size;
+			reader->mem_left -= reader->buf_size;
+		}
 		reader->buf_idx = 0;
 	}
 
@@ -386,16 +417,11 @@ static void display_tree(TreeElement *tree, unsigned int node, int offset)
 // from the root node until we reach a leaf.  The leaf value is
 // returned.
 
-static int read_from_tree(BitStreamReader *reader, TreeElement *tree)
+static int walk_tree(BitStreamReader *reader, TreeElement *tree, TreeElement code)
 {
-	TreeElement code;
 	int bit;
 	uint64_t bits=0; int n=0, used=0;
 
-	// Start from root.
-
-	code = tree[0];
-
 	while ((code & TREE_NODE_LEAF) == 0) {
 
 		if (used == n) {
@@ -420,6 +446,87 @@ static int read_from_tree(BitStreamReader *reader, TreeElement *tree)
 	return (int) (code & ~TREE_NODE_LEAF);
 }
 
+static int read_from_tree(BitStreamReader *reader, TreeElement *tree)
+{
+	// Start from root.
+
+	return walk_tree(reader, tree, tree[0]);
+}
+
+// Lookup tables used to speed up decoding.
+//
+// A table is indexed by the next table_bits bits of the input stream.
+// Each entry contains either the decoded code and its length in bits, or
+// (for codes longer than table_bits) the tree node from where the bit-by-bit
+// walk must continue after skipping table_bits bits.
+
+#define TABLE_SUBTREE       0x8000
+#define TABLE_LEN_SHIFT     10
+#define TABLE_CODE_MASK     ((1 << TABLE_LEN_SHIFT) - 1)
+
+static void fill_table(uint16_t *table, int table_bits, TreeElement *tree,
+                       TreeElement code, int depth, unsigned int prefix)
+{
+	if (code & TREE_NODE_LEAF) {
+		// Leaf: all the entries that start with this prefix decode
+		// to this code.
+		uint16_t entry = (depth << TABLE_LEN_SHIFT) | (code & ~TREE_NODE_LEAF);
+		unsigned int first = prefix << (table_bits - depth);
+		unsigned int count = 1 << (table_bits - depth);
+
+		for (unsigned int i = 0; i < count; ++i) {
+			table[first + i] = entry;
+		}
+		return;
+	}
+
+	if (depth == table_bits) {
+		table[prefix] = TABLE_SUBTREE | code;
+		return;
+	}
+
+	fill_table(table, table_bits, tree, tree[code], depth + 1, prefix << 1);
+	fill_table(table, table_bits, tree, tree[code + 1], depth + 1, (prefix << 1) | 1);
+}
+
+// Build the lookup table for the given tree.
+
+static void build_table(uint16_t *table, int table_bits, TreeElement *tree)
+{
+	fill_table(table, table_bits, tree, tree[0], 0, 0);
+}
+
+// Read a code from the input stream, using the lookup table built by
+// build_table() for the given tree.
+
+static int read_from_table(BitStreamReader *reader, TreeElement *tree,
+                           uint16_t *table, int table_bits)
+{
+	int n;
+	uint64_t bits = peek_bits(reader, &n);
+
+	// If the bit buffer is almost empty, walk the tree, which takes
+	// care of refilling it.
+
+	if (__builtin_expect(n < table_bits, 0)) {
+		return read_from_tree(reader, tree);
+	}
+
+	uint16_t entry = table[bits >> (64 - table_bits)];
+
+	if (__builtin_expect((entry & TABLE_SUBTREE) == 0, 1)) {
+		if (skip_bits(reader, entry >> TABLE_LEN_SHIFT) < 0)
+			return -1;
+		return entry & TABLE_CODE_MASK;
+	}
+
+	// Long code: continue walking the tree from the node in the table.
+
+	if (skip_bits(reader, table_bits) < 0)
+		return -1;
+	return walk_tree(reader, tree, entry & ~TABLE_SUBTREE);
+}
+
 
 
 
@@ -524,6 +631,13 @@ CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 
 #define MAX_TEMP_CODES       20
 
+// Number of bits used to index the lookup tables of the code and offset
+// trees. Most codes are shorter than this, and can be decoded with
+// a single lookup.
+
+#define CODE_TABLE_BITS      10
+#define OFFSET_TABLE_BITS    8
+
 typedef struct _LHANewDecoder {
 	// Input bit stream.
 
@@ -542,6 +656,11 @@ typedef struct _LHANewDecoder {
 	// encode the temp-table, which is bigger; hence the size.
 
 	TreeElement offset_tree[MAX_TEMP_CODES * 2];
+
+	// Lookup tables for the code and offset trees.
+
+	uint16_t code_table[1 << CODE_TABLE_BITS];
+	uint16_t offset_table[1 << OFFSET_TABLE_BITS];
 } LHANewDecoder;
 
 
@@ -904,6 +1023,11 @@ static int start_new_block(LHANewDecoder *decoder)
 		return 0;
 	}
 
+	// Build the lookup tables used to decode this block.
+
+	build_table(decoder->code_table, CODE_TABLE_BITS, decoder->code_tree);
+	build_table(decoder->offset_table, OFFSET_TABLE_BITS, decoder->offset_tree);
+
 	return 1;
 }
 
@@ -912,7 +1036,8 @@ static int start_new_block(LHANewDecoder *decoder)
 
 static int read_code(LHANewDecoder *decoder)
 {
-	return read_from_tree(&decoder->bit_stream_reader, decoder->code_tree);
+	return read_from_table(&decoder->bit_stream_reader, decoder->code_tree,
+	                       decoder->code_table, CODE_TABLE_BITS);
 }
 
 // Read an offset distance from the input stream.
@@ -922,8 +1047,8 @@ static int read_offset_code(LHANewDecoder *decoder)
 {
 	int bits, result;
 
-	bits = read_from_tree(&decoder->bit_stream_reader,
-	                      decoder->offset_tree);
+	bits = read_from_table(&decoder->bit_stream_reader, decoder->offset_tree,
+	                       decoder->offset_table, OFFSET_TABLE_BITS);
 
 	if (bits < 0) {
 		return -1;
@@ -1163,6 +1288,49 @@ int decompress_lzh5_pos(void *state) {
 	return decoder->decoded_bytes;
 }
 
+int decompress_lzh5_full_mem(const uint8_t *src, int src_size, uint8_t *dst, int dst_size)
+{
+	LHANewDecoder decoder;
+	lha_lh_new_init(&decoder, NULL);
+	bit_stream_reader_init_mem(&decoder.bit_stream_reader, src, src_size);
+	return lha_lh_new_read_full(&decoder, dst, dst_size);
+}
+
+void* decompress_lzh5_full_inplace(const char *fn, FILE *fp, size_t cmp_size, size_t size, size_t margin)
+{
+	// Reserve one additional byte, in case the compressed data must be
+	// moved forward to match the alignment required by DMA.
+	int bufsize = size + margin + 1;
+	int cmp_offset = bufsize - 1 - cmp_size;
+	void *s = memalign(16, bufsize);
+	assertf(s, "asset_load: out of memory");
+
+	#ifdef N64
+	if (fn && strncmp(fn, "rom:/", 5) == 0) {
+		// Loading from ROM: read all the compressed data with a single DMA
+		// transfer, which is much faster than going through stdio.
+		// The transfer requires the same 2-byte alignment in RAM and ROM.
+		uint32_t addr = (dfs_rom_addr(fn+5) & 0x1FFFFFFF) + 20;
+		if ((cmp_offset ^ addr) & 1) {
+			cmp_offset++;
+		}
+		int align_cmp_offset = cmp_offset & ~15;
+		data_cache_hit_writeback_invalidate(s+align_cmp_offset, bufsize-align_cmp_offset);
+		dma_read(s+cmp_offset, addr, cmp_size);
+	} else
+	#endif
+	{
+		fread(s+cmp_offset, 1, cmp_size, fp);
+	}
+
+	int n = decompress_lzh5_full_mem(s+cmp_offset, cmp_size, s, size); (void)n;
+	assertf(n == size, "asset: decompression error on file %s: corrupted? (%d/%d)", fn, n, size);
+
+	void *ptr = realloc(s, size); (void)ptr;
+	assertf(s == ptr, "asset: realloc moved the buffer"); // guaranteed by newlib
+	return ptr;
+}
+
 void* decompress_lzh5_full(const char *fn, FILE *fp, size_t cmp_size, size_t size)
 {
 	void *s = memalign(16, size);
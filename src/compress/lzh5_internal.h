@@ -14,7 +14,7 @@ extern "C" {
  * Note that this can still be allocated on the stack, as the stack size
  * configured by libdragon is 64KB.
  */
-#define DECOMPRESS_LZH5_STATE_SIZE    18688
+#define DECOMPRESS_LZH5_STATE_SIZE    21248
 
 void decompress_lzh5_init(void *state, FILE *fp);
 ssize_t decompress_lzh5_read(void *state, void *buf, size_t len);
@@ -39,6 +39,44 @@ int decompress_lzh5_pos(void *state);
  */
 void* decompress_lzh5_full(const char *fn, FILE *fp, size_t cmp_size, size_t size);
 
+/**
+ * @brief Decompress a full LZH5 file from a memory buffer.
+ * 
+ * The source buffer can overlap with the end of the destination buffer
+ * (in-place decompression), provided that the distance between the end
+ * of the decompressed data and the end of the compressed data is at least
+ * the margin computed at compression time (see #decompress_lzh5_full_inplace).
+ * 
+ * @param src       Pointer to the compressed data
+ * @param src_size  Size of the compressed data in bytes
+ * @param dst       Destination buffer
+ * @param dst_size  Size of the decompressed data in bytes
+ * @return          Number of bytes decompressed
+ */
+int decompress_lzh5_full_mem(const uint8_t *src, int src_size, uint8_t *dst, int dst_size);
+
+/**
+ * @brief Decompress a full LZH5 file in-place.
+ * 
+ * This works like #decompress_lzh5_full, but the compressed data is first
+ * read at the end of the destination buffer, and then decompressed in-place.
+ * The buffer must be larger than the decompressed data by a margin that
+ * depends on the specific compressed stream, and is computed by the
+ * compressor (see lzh5_inplace_margin in tools/common/lzh5_compress.c).
+ * 
+ * Reading the compressed data in one go is faster than letting the decoder
+ * read it in small chunks, especially from ROM where a single DMA transfer
+ * is used.
+ * 
+ * @param fn        Filename of the file being decompressed, if known
+ * @param fp        File pointer to the compressed file
+ * @param cmp_size  Length of the compressed file
+ * @param size      Length of the file after decompression
+ * @param margin    In-place decompression margin
+ * @return          Buffer that contains the decompressed file
+ */
+void* decompress_lzh5_full_inplace(const char *fn, FILE *fp, size_t cmp_size, size_t size, size_t margin);
+
 #ifdef __cplusplus
 }
 #endif
@@ -43,10 +43,21 @@
 static void __console_render(void);
 
 /** @brief Size of the console buffer in bytes */
-#define CONSOLE_SIZE        ((sizeof(char) * CONSOLE_WIDTH * CONSOLE_HEIGHT) + sizeof(char))
+#define CONSOLE_SIZE        (sizeof(char) * CONSOLE_WIDTH * CONSOLE_HEIGHT)
 
-/** @brief The console buffer */
+_Static_assert(CONSOLE_HEIGHT <= 32, "the dirty row masks must fit in 32 bits");
+
+/**
+ * @brief The console buffer
+ *
+ * The buffer is a ring of #CONSOLE_HEIGHT lines: scrolling just moves the first
+ * line (#console_first_line) instead of moving the whole buffer.
+ */
 static char *render_buffer = 0;
+/** @brief Physical line of the buffer shown on the first row of the screen */
+static int console_first_line;
+/** @brief Position of the cursor, in characters from the top left of the screen */
+static int console_pos;
 /** 
  * @brief Internal state of the render mode
  * @see #RENDER_AUTOMATIC and #RENDER_MANUAL
@@ -55,6 +66,30 @@ static int render_now;
 /** @brief True if the console output is sent to debug channel as well */
 static bool console_redirect_debug = true;
 
+/** @brief Maximum number of display buffers tracked by the RDP renderer */
+#define RDP_MAX_BUFFERS     4
+
+/** @brief State of the RDP renderer (see #RENDER_RDP) */
+static struct {
+    /** @brief Display surfaces drawn so far */
+    surface_t *surface[RDP_MAX_BUFFERS];
+    /** @brief Console contents last drawn on each surface */
+    char *shown[RDP_MAX_BUFFERS];
+    /** @brief Rows changed since the last render on each surface (one bit per row) */
+    uint32_t dirty[RDP_MAX_BUFFERS];
+    /** @brief Copy of the font colored with the foreground color */
+    sprite_t *font;
+    /** @brief Font the copy was made from */
+    sprite_t *font_src;
+    /** @brief Foreground color of the copy */
+    uint32_t font_color;
+    /** @brief Glyphs to draw in the current render */
+    rdp_sprite_tile_t *tiles;
+} rdp_console;
+
+/** @brief Get the current font and colors (see graphics.c) */
+extern sprite_t *__graphics_get_font( uint32_t *fg, uint32_t *bg );
+
 /**
  * @brief Set the console rendering mode
  *
@@ -65,8 +100,14 @@ static bool console_redirect_debug = true;
  * console_render().  This is to allow a rendering interface somewhat analogous
  * to curses
  *
+ * With the #RENDER_RDP flag, the console is drawn by the RDP: glyphs are
+ * rendered as textured rectangles, and only the rows that changed since the
+ * last render on the same display buffer are redrawn. This is fast enough to
+ * show live logs during gameplay. #rdp_init must have been called.
+ *
  * @param[in] mode
- *            Render mode (#RENDER_AUTOMATIC or #RENDER_MANUAL)
+ *            Render mode (#RENDER_AUTOMATIC or #RENDER_MANUAL), optionally
+ *            combined with #RENDER_RDP
  */
 void console_set_render_mode(int mode)
 {
@@ -75,11 +116,60 @@ void console_set_render_mode(int mode)
 }
 
 /**
- * @brief Macro to move the console up one line
+ * @brief Get a row of the screen from the ring of lines
+ *
+ * @param[in] y
+ *            Row of the screen
+ *
+ * @return Pointer to the #CONSOLE_WIDTH characters of the row
+ */
+static inline char *__console_row(int y)
+{
+    y += console_first_line;
+    if(y >= CONSOLE_HEIGHT) { y -= CONSOLE_HEIGHT; }
+    return render_buffer + y * CONSOLE_WIDTH;
+}
+
+/**
+ * @brief Mark rows of the screen as changed for the RDP renderer
+ *
+ * @param[in] mask
+ *            Rows changed (one bit per row)
+ */
+static void __console_mark_dirty(uint32_t mask)
+{
+    for(int i = 0; i < RDP_MAX_BUFFERS; i++)
+    {
+        rdp_console.dirty[i] |= mask;
+    }
+}
+
+/**
+ * @brief Move the console up one line
+ *
+ * The first line is recycled as the new last line, so this costs a single line.
+ */
+static void __console_scroll(void)
+{
+    memset(__console_row(0), 0, CONSOLE_WIDTH);
+    if(++console_first_line == CONSOLE_HEIGHT) { console_first_line = 0; }
+    console_pos -= CONSOLE_WIDTH;
+
+    /* Every row of the screen shows different text now */
+    __console_mark_dirty(~0u);
+}
+
+/**
+ * @brief Write a character at the cursor position
+ *
+ * @param[in] c
+ *            Character to write
  */
-#define move_buffer() \
-    memmove(render_buffer, render_buffer + (sizeof(char) * CONSOLE_WIDTH), CONSOLE_SIZE - (CONSOLE_WIDTH * sizeof(char))); \
-    pos -= CONSOLE_WIDTH;
+static inline void __console_putc(char c)
+{
+    __console_row(console_pos / CONSOLE_WIDTH)[console_pos % CONSOLE_WIDTH] = c;
+    console_pos++;
+}
 
 /**
  * @brief Newlib hook to allow printf/iprintf to appear on console
@@ -93,7 +183,7 @@ void console_set_render_mode(int mode)
  */
 static int __console_write( char *buf, unsigned int len )
 {
-    int pos = strlen(render_buffer);
+    int first_row = console_pos / CONSOLE_WIDTH;
 
     /* Redirect to stderr if requested for debugging purposes */
     if (console_redirect_debug)
@@ -102,10 +192,10 @@ static int __console_write( char *buf, unsigned int len )
     /* Copy over to screen buffer */
     for(int x = 0; x < len; x++)
     {
-        if(pos == CONSOLE_WIDTH * CONSOLE_HEIGHT)
+        if(console_pos == CONSOLE_WIDTH * CONSOLE_HEIGHT)
         {
             /* Need to scroll the buffer */
-            move_buffer();
+            __console_scroll();
         }
 
         switch(buf[x])
@@ -113,53 +203,55 @@ static int __console_write( char *buf, unsigned int len )
             case '\r':
             case '\n':
                 /* Add enough space to get to next line */
-                if(!(pos % CONSOLE_WIDTH))
+                if(!(console_pos % CONSOLE_WIDTH))
                 {
-                    render_buffer[pos++] = ' ';
+                    __console_putc(' ');
                 }
 
-                while(pos % CONSOLE_WIDTH)
+                while(console_pos % CONSOLE_WIDTH)
                 {
-                    render_buffer[pos++] = ' ';
+                    __console_putc(' ');
                 }
 
                 /* Make sure we don't run down the end */
-                if(pos == CONSOLE_WIDTH * CONSOLE_HEIGHT)
+                if(console_pos == CONSOLE_WIDTH * CONSOLE_HEIGHT)
                 {
-                    move_buffer();
+                    __console_scroll();
                 }
 
                 break;
             case '\t':
                 /* Add enough spaces to go to the next tab stop */
-                if(!(pos % TAB_WIDTH))
+                if(!(console_pos % TAB_WIDTH))
                 {
-                    render_buffer[pos++] = ' ';
+                    __console_putc(' ');
                 }
 
-                while(pos % TAB_WIDTH)
+                while(console_pos % TAB_WIDTH)
                 {
-                    render_buffer[pos++] = ' ';
+                    __console_putc(' ');
                 }
 
                 /* Make sure we don't run down the end */
-                if(pos == CONSOLE_WIDTH * CONSOLE_HEIGHT)
+                if(console_pos == CONSOLE_WIDTH * CONSOLE_HEIGHT)
                 {
-                    move_buffer();
+                    __console_scroll();
                 }
                 break;
             default:
                 /* Copy character over */
-                render_buffer[pos++] = buf[x];
+                __console_putc(buf[x]);
                 break;
         }
     }
 
-    /* Cap off the end! */
-    render_buffer[pos] = 0;
-    
+    /* Mark the rows written to (a scroll already marked the whole screen) */
+    int last_row = console_pos / CONSOLE_WIDTH;
+    if(last_row == CONSOLE_HEIGHT) { last_row--; }
+    __console_mark_dirty((~0u << first_row) & (~0u >> (31 - last_row)));
+
     /* Out to screen! */
-    if(render_now == RENDER_AUTOMATIC)
+    if(render_now & RENDER_AUTOMATIC)
     {
         __console_render();
     }
@@ -209,6 +301,15 @@ void console_close()
         render_buffer = 0;
     }
 
+    /* Free the RDP renderer state */
+    for(int i = 0; i < RDP_MAX_BUFFERS; i++)
+    {
+        free(rdp_console.shown[i]);
+    }
+    free(rdp_console.font);
+    free(rdp_console.tiles);
+    memset(&rdp_console, 0, sizeof(rdp_console));
+
     /* Unregister ourselves from newlib */
     stdio_t console_calls = { 0, __console_write, 0 };
     unhook_stdio_calls( &console_calls );
@@ -225,7 +326,7 @@ void console_clear()
 
     /* Force fflush not to draw regardless */
     int render = render_now;
-    render_now = RENDER_MANUAL;
+    render_now &= ~RENDER_AUTOMATIC;
 
     /* Flush the stdout so that we don't get data after the clear */
     fflush( stdout );
@@ -235,14 +336,152 @@ void console_clear()
 
     /* Remove all data */
     memset(render_buffer, 0, CONSOLE_SIZE);
+    console_first_line = 0;
+    console_pos = 0;
+    __console_mark_dirty(~0u);
     
     /* Should we display? */
-    if(render_now == RENDER_AUTOMATIC)
+    if(render_now & RENDER_AUTOMATIC)
     {
         __console_render();
     }
 }
 
+/**
+ * @brief Get the slot of a surface in the state of the RDP renderer
+ *
+ * @param[in] dc
+ *            The display surface
+ *
+ * @return The slot, or -1 if there are too many surfaces to track
+ */
+static int __console_rdp_slot(surface_t *dc)
+{
+    for(int i = 0; i < RDP_MAX_BUFFERS; i++)
+    {
+        if(rdp_console.surface[i] == dc) { return i; }
+
+        if(!rdp_console.surface[i])
+        {
+            /* First time on this surface: mark all rows as changed */
+            rdp_console.surface[i] = dc;
+            rdp_console.shown[i] = malloc(CONSOLE_SIZE);
+            memset(rdp_console.shown[i], 0xFF, CONSOLE_SIZE);
+            rdp_console.dirty[i] = ~0u;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Render the console with the RDP
+ *
+ * The font is copied once, colored with the foreground color, so that glyphs can be
+ * drawn in copy mode. Changed rows are cleared with a fill rectangle, then all their
+ * glyphs are drawn with #rdp_draw_sprites_batch, that loads each distinct glyph once.
+ *
+ * @param[in] dc
+ *            The display surface to draw on
+ *
+ * @return False if the RDP renderer cannot be used on this surface
+ */
+static bool __console_render_rdp(surface_t *dc)
+{
+    if(TEX_FORMAT_BITDEPTH(surface_get_format(dc)) != 16) { return false; }
+
+    int slot = __console_rdp_slot(dc);
+    if(slot < 0) { return false; }
+    char *shown = rdp_console.shown[slot];
+    uint32_t *dirty = &rdp_console.dirty[slot];
+
+    uint32_t fg, bg;
+    sprite_t *src = __graphics_get_font(&fg, &bg);
+
+    /* Color a copy of the font; transparent texels are skipped by the alpha compare */
+    if(rdp_console.font_src != src || rdp_console.font_color != fg)
+    {
+        int npix = src->width * src->height;
+        free(rdp_console.font);
+        rdp_console.font = memalign(16, sizeof(sprite_t) + npix * 2);
+        memcpy(rdp_console.font, src, sizeof(sprite_t));
+        rdp_console.font->flags = FMT_RGBA16;
+
+        uint16_t *sdata = (uint16_t *)src->data;
+        uint16_t *ddata = (uint16_t *)rdp_console.font->data;
+        for(int i = 0; i < npix; i++)
+        {
+            ddata[i] = (sdata[i] & 0x1) ? (fg | 1) : 0;
+        }
+        data_cache_hit_writeback(ddata, npix * 2);
+
+        /* The glyphs changed, so redraw everything */
+        rdp_console.font_src = src;
+        rdp_console.font_color = fg;
+        for(int i = 0; i < RDP_MAX_BUFFERS; i++)
+        {
+            if(rdp_console.shown[i]) { memset(rdp_console.shown[i], 0xFF, CONSOLE_SIZE); }
+        }
+        __console_mark_dirty(~0u);
+    }
+
+    if(!rdp_console.tiles)
+    {
+        rdp_console.tiles = malloc(sizeof(rdp_sprite_tile_t) * CONSOLE_WIDTH * CONSOLE_HEIGHT);
+    }
+
+    int fh = src->height / src->vslices;
+    int ntiles = 0;
+
+    rdp_attach(dc);
+    rdp_set_default_clipping();
+    rdp_sync(SYNC_PIPE);
+    rdp_enable_primitive_fill();
+    rdp_set_primitive_color(bg & 0x1 ? bg : 0);
+
+    for(int y = 0; y < CONSOLE_HEIGHT; y++)
+    {
+        if(!(*dirty & (1u << y))) { continue; }
+
+        /* Contents of the row, padded with zeros after the cursor */
+        char row[CONSOLE_WIDTH];
+        int len = console_pos - y * CONSOLE_WIDTH;
+        if(len < 0) { len = 0; }
+        if(len > CONSOLE_WIDTH) { len = CONSOLE_WIDTH; }
+        memcpy(row, __console_row(y), len);
+        memset(row + len, 0, CONSOLE_WIDTH - len);
+
+        char *old = shown + y * CONSOLE_WIDTH;
+        if(memcmp(old, row, CONSOLE_WIDTH) == 0) { continue; }
+        memcpy(old, row, CONSOLE_WIDTH);
+
+        /* Clear the row, and queue its glyphs */
+        int py = VERTICAL_PADDING + 8 * y;
+        rdp_draw_filled_rectangle(0, py, dc->width - 1, py + fh - 1);
+
+        for(int x = 0; x < CONSOLE_WIDTH && row[x]; x++)
+        {
+            if(row[x] == ' ') { continue; }
+            rdp_console.tiles[ntiles++] = (rdp_sprite_tile_t){
+                .tile = row[x], .x = HORIZONTAL_PADDING + 8 * x, .y = py,
+            };
+        }
+    }
+
+    *dirty = 0;
+
+    if(ntiles)
+    {
+        rdp_sync(SYNC_PIPE);
+        rdp_enable_texture_copy();
+        rdp_draw_sprites_batch(0, 0, rdp_console.font, rdp_console.tiles, ntiles, MIRROR_DISABLED);
+    }
+
+    rdp_detach();
+    display_show(dc);
+    return true;
+}
+
 /**
  * @brief Helper function to render the console
  */
@@ -250,35 +489,46 @@ static void __console_render(void)
 {
     if(!render_buffer) { return; }
 
+    /* The RDP renderer needs interrupts to complete the frame */
+    uint32_t c0_status = C0_STATUS();
+    bool can_wait = (c0_status & C0_STATUS_IE) && !(c0_status & (C0_STATUS_EXL|C0_STATUS_ERL));
+
     /* Wait until we get a valid context */
     surface_t *dc = display_get();
 
-    /* Background color! */
-    graphics_fill_screen( dc, 0 );
+    if((render_now & RENDER_RDP) && can_wait && __console_render_rdp(dc)) { return; }
 
-    for(int y = 0; y < CONSOLE_HEIGHT; y++)
+    /* The whole surface is redrawn by the CPU: forget what the RDP drew on it */
+    for(int i = 0; i < RDP_MAX_BUFFERS; i++)
     {
-        for(int x = 0; x < CONSOLE_WIDTH; x++)
+        if(rdp_console.surface[i] == dc)
         {
-            char t_buf = render_buffer[y * CONSOLE_WIDTH + x];
+            memset(rdp_console.shown[i], 0xFF, CONSOLE_SIZE);
+            rdp_console.dirty[i] = ~0u;
+        }
+    }
 
-            if(t_buf == 0)
-            {
-                goto end;
-            }
+    /* Background color! */
+    graphics_fill_screen( dc, 0 );
+
+    for(int y = 0; y * CONSOLE_WIDTH < console_pos; y++)
+    {
+        char *row = __console_row(y);
+        int len = console_pos - y * CONSOLE_WIDTH;
+        if(len > CONSOLE_WIDTH) { len = CONSOLE_WIDTH; }
 
+        for(int x = 0; x < len; x++)
+        {
             /* Draw to the screen using the forecolor and backcolor set in the graphics
              * subsystem */
-            graphics_draw_character( dc, HORIZONTAL_PADDING + 8 * x, VERTICAL_PADDING + 8 * y, t_buf );
+            graphics_draw_character( dc, HORIZONTAL_PADDING + 8 * x, VERTICAL_PADDING + 8 * y, row[x] );
         }
     }
 
-end:;
     /* If the interrupts are disabled, the console wouldn't show to the screen.
      * Since the console is only used for development and emergency context,
      * it is better to force display irrespective of vblank. */
-    uint32_t c0_status = C0_STATUS();
-    if ((c0_status & C0_STATUS_IE) == 0 || ((c0_status & (C0_STATUS_EXL|C0_STATUS_ERL)) != 0))
+    if (!can_wait)
     {
         extern void display_show_force(display_context_t dc);
         display_show_force(dc);
@@ -5,10 +5,16 @@
  */
 
 #include "controller.h"
+#include "mempak.h"
 #include "interrupt.h"
 #include "joybus.h"
 #include "joybus_internal.h"
+#include "boot_profile_internal.h"
 #include "debug.h"
+#include "timer.h"
+#include "n64sys.h"
+#include "regsinternal.h"
+#include "vi.h"
 #include <string.h>
 #include <stdbool.h>
 
@@ -36,6 +42,12 @@
  * return a number signifying the polar direction that the D-Pad is being
  * pressed in.
  *
+ * The background scan identifies the device connected to each port, and
+ * polls GameCube controllers (through an N64 to GameCube adapter) with the
+ * appropriate command, so that the `gc` array returned by the get_keys_*
+ * functions is populated for them as well. The rumble motor of GameCube
+ * controllers can be controlled with #controller_set_gc_rumble.
+ *
  * To perform direct reads to the controllers, call #controller_read.  This will
  * return a structure consisting of all button states on all controllers currently
  * inserted. Note that this function takes about 10% of a frame's worth of time.
@@ -45,9 +57,13 @@
  * #get_accessories_present and #identify_accessory.
  *
  * To enable or disable rumbling on a controller, use #rumble_start and #rumble_stop.
- * These functions will turn rumble on and off at full speed respectively, so if
- * different rumble effects are desired, consider using the @ref timer for accurate
- * timing.
+ * These functions will turn rumble on and off at full speed respectively, and
+ * block until the rumble pak has been written. For variable strength effects,
+ * use #rumble_set_intensity instead: the motor is switched on and off in
+ * background (PWM), once per frame together with the autoscan, or at the
+ * frequency set with #rumble_set_pwm_frequency. Only the changes of the motor
+ * state are written to the rumble pak, without blocking; for GameCube
+ * controllers, the state is sent with the autoscan itself.
  *
  * A mempak attached to a controller can be treated in one of two ways: as a raw binary
  * string, or as a formatted mempak with notes.  The former allows storage of any
@@ -58,6 +74,11 @@
  * #write_mempak_address.  The @ref mempak handles reading and writing from the mempak
  * in a way compatible with official games.
  *
+ * To detect when a mempak (or another accessory) is swapped without blocking,
+ * enable the background accessory queries with #controller_set_accessory_poll,
+ * and check #get_accessories_inserted and #get_accessories_removed after each
+ * #controller_scan.
+ *
  * @{
  */
 
@@ -72,30 +93,474 @@ static volatile bool controller_autoscan_in_progress = false;
 /** @brief True if the module was initialized */
 static bool controller_inited = false;
 
+/** @brief Time at which the sample in #next was read */
+static volatile uint32_t next_ticks;
+/** @brief Time at which the sample in #current was read */
+static uint32_t current_ticks;
+/** @brief Number of polls per frame */
+static int poll_count = 1;
+/** @brief Delay of the first poll after the vblank, in ticks */
+static uint32_t poll_delay = 0;
+/** @brief Scanline of the first poll, or -1 to use #poll_delay */
+static int poll_line = -1;
+/** @brief Timer used for the polls that are not at the vblank */
+static timer_link_t poll_timer;
+/** @brief True if #poll_timer is running */
+static bool poll_timer_active = false;
+/** @brief Polls left in the current frame */
+static int polls_left;
+/** @brief Interval between the polls of a frame, in ticks */
+static uint32_t poll_interval;
+/** @brief Time of the last vblank, to measure the frame time */
+static uint32_t last_vblank_ticks;
+/** @brief Measured time between two vblanks */
+static uint32_t frame_ticks;
+
+/**
+ * @anchor PORT_TYPE
+ * @name Device types identified by the background scan on each port
+ * @{
+ */
+#define PORT_UNKNOWN    0   ///< Nothing identified yet: query the device status
+#define PORT_N64        1   ///< N64 controller (or compatible device)
+#define PORT_GC         2   ///< GameCube controller
+#define PORT_OTHER      3   ///< Device that cannot be polled (eg: VRU): keep querying its status
+/** @} */
+
+/** @brief Mask of the button bits in #SI_condat_gc::data */
+#define GC_BUTTONS_MASK 0x1FFF000000000000ULL
+
+static void __get_accessories_present( struct controller_data *output );
+static int __is_valid_accessory( uint32_t data );
+static void rumble_pwm_step( void );
+
+/** @brief Joybus block querying the status of the devices on all ports */
+static const unsigned long long SI_read_status_block[8] =
+{
+    0xff010300ffffffff,
+    0xff010300ffffffff,
+    0xff010300ffffffff,
+    0xff010300ffffffff,
+    0xfe00000000000000,
+    0,
+    0,
+    1
+};
+
+/** @brief Number of frames between background accessory queries (0: disabled) */
+static int accessory_poll_frames = 0;
+/** @brief Frames left before the next background accessory query */
+static int accessory_poll_countdown;
+/** @brief True if there is a pending background accessory query */
+static volatile bool accessory_poll_in_progress = false;
+/** @brief Accessories found by the last background query */
+static volatile int accessories_next;
+/** @brief Accessories inserted since the last #controller_scan */
+static volatile int accessories_inserted_next;
+/** @brief Accessories removed since the last #controller_scan */
+static volatile int accessories_removed_next;
+/** @brief Accessories inserted before the last #controller_scan */
+static int accessories_inserted;
+/** @brief Accessories removed before the last #controller_scan */
+static int accessories_removed;
+
+/** @brief Device type on each port (see @ref PORT_TYPE) */
+static volatile uint8_t port_type[4];
+/** @brief Device types used to build the autoscan block in flight */
+static uint8_t poll_type[4];
+/** @brief Offset of each channel in the autoscan block in flight */
+static uint8_t poll_offset[4];
+/** @brief Rumble state of the GameCube controllers */
+static uint8_t gc_rumble[4];
+
+/** @brief Rumble intensity of each controller set with #rumble_set_intensity */
+static uint8_t rumble_intensity[4];
+/** @brief PWM accumulator of each controller */
+static uint16_t rumble_acc[4];
+/** @brief Controllers whose rumble is driven by the PWM (bit per controller) */
+static uint8_t rumble_pwm_mask;
+/** @brief Motor state requested by the PWM (bit per controller) */
+static uint8_t rumble_on;
+/** @brief Controllers whose motor state must be written to the rumble pak */
+static uint8_t rumble_dirty;
+/** @brief Controllers with a rumble pak write in flight */
+static uint8_t rumble_busy;
+/** @brief Timer stepping the PWM, if a frequency was set */
+static timer_link_t rumble_timer;
+/** @brief True if #rumble_timer is running */
+static bool rumble_timer_active = false;
+
+/**
+ * @brief Identify a device from its reply to the status command
+ *
+ * @param[in] id
+ *            The device identifier (first two bytes of the reply)
+ *
+ * @return The port type (see @ref PORT_TYPE)
+ */
+static int controller_port_type( uint16_t id )
+{
+    if( id & 0x0800 ) { return PORT_GC; }
+    if( id == 0x0001 ) { return PORT_OTHER; }
+    return PORT_N64;
+}
+
 static void controller_interrupt_update(uint64_t *output, void *ctx)
 {
-    memcpy((void*)&next, output, sizeof(struct controller_data));
+    const uint8_t *out = (const uint8_t *)output;
+    struct controller_data data;
+    memset(&data, 0, sizeof(data));
+
+    for( int ch = 0; ch < 4; ch++ )
+    {
+        const uint8_t *slot = out + poll_offset[ch];
+        int err = slot[2] >> 6;
+
+        switch( poll_type[ch] )
+        {
+            case PORT_N64:
+                memcpy(&data.c[ch], slot, sizeof(struct SI_condat));
+                break;
+            case PORT_GC:
+                /* 03 08 40 03 xx: the reply follows the 3-byte command */
+                err = slot[1] >> 6;
+                data.c[ch].err = err;
+                memcpy(&data.gc[ch], slot + 5, sizeof(struct SI_condat_gc));
+                break;
+            default:
+                /* ff 01 03 00: status reply, switch to the identified device */
+                data.c[ch].err = err;
+                if( err == ERROR_NONE ) { port_type[ch] = controller_port_type( (slot[4] << 8) | slot[5] ); }
+                continue;
+        }
+
+        /* The device stopped replying: identify it again at the next poll */
+        if( err != ERROR_NONE ) { port_type[ch] = PORT_UNKNOWN; }
+    }
+
+    memcpy((void*)&next, &data, sizeof(struct controller_data));
+    next_ticks = TICKS_READ();
     controller_autoscan_in_progress = false;
 }
 
-static void controller_interrupt(void) 
+/**
+ * @brief Build the autoscan block according to the device on each port
+ *
+ * N64 controllers are read with command 0x01, GameCube controllers with
+ * command 0x40 (which also sets their rumble state), and all the other
+ * ports are sent a status query to identify the device.
+ *
+ * @param[out] block
+ *             Joybus block to fill
+ */
+static void controller_build_poll_block( uint8_t *block )
 {
-    static const unsigned long long SI_read_con_block[8] =
+    static const uint8_t n64_read[8] = { 0xff, 0x01, 0x04, 0x01, 0xff, 0xff, 0xff, 0xff };
+    static const uint8_t gc_read[5] = { 0x03, 0x08, 0x40, 0x03, 0x00 };
+    static const uint8_t status[8] = { 0xff, 0x01, 0x03, 0x00, 0xff, 0xff, 0xff, 0xff };
+    int pos = 0;
+
+    memset(block, 0, JOYBUS_BLOCK_SIZE);
+    for( int ch = 0; ch < 4; ch++ )
     {
-        0xff010401ffffffff,
-        0xff010401ffffffff,
-        0xff010401ffffffff,
-        0xff010401ffffffff,
-        0xfe00000000000000,
-        0,
-        0,
-        1
-    };
-    
+        poll_type[ch] = port_type[ch];
+        poll_offset[ch] = pos;
+        switch( poll_type[ch] )
+        {
+            case PORT_N64:
+                memcpy(&block[pos], n64_read, sizeof(n64_read));
+                pos += sizeof(n64_read);
+                break;
+            case PORT_GC:
+                memcpy(&block[pos], gc_read, sizeof(gc_read));
+                block[pos + 4] = gc_rumble[ch];
+                memset(&block[pos + 5], 0xff, sizeof(struct SI_condat_gc));
+                pos += sizeof(gc_read) + sizeof(struct SI_condat_gc);
+                break;
+            default:
+                memcpy(&block[pos], status, sizeof(status));
+                pos += sizeof(status);
+                break;
+        }
+    }
+    block[pos] = 0xfe;
+    block[JOYBUS_BLOCK_SIZE - 1] = 0x01;
+}
+
+/**
+ * @brief Start a background read of the controllers, unless one is already in progress
+ *
+ * The read is queued with high priority, so that it is not delayed by
+ * pending accessory transfers.
+ */
+static void controller_poll(void)
+{
+    uint64_t block[JOYBUS_BLOCK_DWORDS];
+
     if (!controller_autoscan_in_progress) {    
         controller_autoscan_in_progress = true;
-        joybus_exec_async(SI_read_con_block, controller_interrupt_update, NULL);
+        controller_build_poll_block((uint8_t *)block);
+        joybus_exec_async_prio(block, controller_interrupt_update, NULL, JOYBUS_PRIO_HIGH);
+    }
+}
+
+/**
+ * @brief Completion of the background accessory query
+ *
+ * Compares the accessories with the previous query, and records which
+ * ones were inserted and removed. The cached filesystem of a mempak that
+ * was removed or inserted is dropped.
+ */
+static void controller_accessory_update(uint64_t *output, void *ctx)
+{
+    const struct controller_data *out = (const struct controller_data *)output;
+    int present = 0;
+
+    for( int ch = 0; ch < 4; ch++ )
+    {
+        if( out->c[ch].err == ERROR_NONE && __is_valid_accessory( out->c[ch].data ) )
+        {
+            present |= CONTROLLER_1_INSERTED >> (ch * 4);
+        }
+    }
+
+    int changed = present ^ accessories_next;
+    for( int ch = 0; ch < 4; ch++ )
+    {
+        if( changed & (CONTROLLER_1_INSERTED >> (ch * 4)) )
+        {
+            invalidate_mempak_cache( ch );
+            /* A new rumble pak must be sent the current motor state */
+            rumble_dirty |= rumble_pwm_mask & (1 << ch);
+        }
+    }
+
+    accessories_inserted_next |= changed & present;
+    accessories_removed_next |= changed & ~present;
+    accessories_next = present;
+    accessory_poll_in_progress = false;
+}
+
+/** @brief Start a background accessory query, if it is time to do so */
+static void controller_accessory_poll(void)
+{
+    if( accessory_poll_frames == 0 || --accessory_poll_countdown > 0 ) { return; }
+    accessory_poll_countdown = accessory_poll_frames;
+
+    if( !accessory_poll_in_progress )
+    {
+        accessory_poll_in_progress = true;
+        joybus_exec_async( SI_read_status_block, controller_accessory_update, NULL );
+    }
+}
+
+/** @brief Timer callback for the scheduled polls */
+static void controller_poll_timer(int ovfl)
+{
+    controller_poll();
+    if (--polls_left == 0) {
+        stop_timer(&poll_timer);
+        poll_timer_active = false;
+    } else {
+        /* The first poll was after the delay, the next ones are spaced by the interval */
+        poll_timer.set = poll_interval;
+    }
+}
+
+static void controller_interrupt(void) 
+{
+    uint32_t now = TICKS_READ();
+    frame_ticks = TICKS_DISTANCE(last_vblank_ticks, now);
+    last_vblank_ticks = now;
+
+    controller_accessory_poll();
+    if( !rumble_timer_active ) { rumble_pwm_step(); }
+
+    /* Default schedule: one poll at each vblank */
+    if (poll_count == 1 && poll_delay == 0 && poll_line < 0) {
+        controller_poll();
+        return;
+    }
+
+    /* Restart the schedule at each vblank, so that it stays in phase with the video */
+    if (poll_timer_active) {
+        stop_timer(&poll_timer);
+        poll_timer_active = false;
+    }
+
+    uint32_t delay = poll_delay;
+    if (poll_line >= 0) {
+        /* Convert the scanline to the delay from the vblank interrupt (in half-lines) */
+        uint32_t halflines = (*VI_V_SYNC & 0x3FF) + 1;
+        uint32_t dist = (poll_line * 2 + halflines - (*VI_V_INTR & 0x3FF)) % halflines;
+        delay = (uint64_t)dist * frame_ticks / halflines;
+    }
+
+    polls_left = poll_count;
+    poll_interval = frame_ticks / poll_count;
+    if (delay == 0) {
+        controller_poll();
+        if (--polls_left == 0) return;
+        delay = poll_interval;
+    }
+    if (delay >= frame_ticks) return;
+
+    start_timer(&poll_timer, delay, TF_CONTINUOUS, controller_poll_timer);
+    poll_timer_active = true;
+}
+
+/**
+ * @brief Configure when the controllers are polled in background
+ *
+ * By default, the controllers are polled once per frame, at the vblank. As the
+ * application usually reads the controllers at the start of its frame, this
+ * makes the input up to one frame old. This function allows to poll the
+ * controllers later (closer to the application reading them), or several times
+ * per frame: #controller_scan always picks the most recent sample.
+ *
+ * @note The timer subsystem must be initialized (#timer_init) to use a
+ *       schedule other than the default one.
+ *
+ * @param[in] delay_ticks
+ *            Delay of the first poll after the vblank, in ticks (see #TIMER_TICKS).
+ *            For instance, to poll N ms before a logic tick aligned to the vblank,
+ *            use the frame time minus N ms. It must be less than the frame time.
+ * @param[in] polls_per_frame
+ *            Number of polls per frame. The polls after the first one are spaced
+ *            by the frame time divided by this number.
+ */
+void controller_set_poll_schedule( uint32_t delay_ticks, int polls_per_frame )
+{
+    assertf(polls_per_frame >= 1, "invalid number of polls per frame: %d", polls_per_frame);
+    disable_interrupts();
+    poll_delay = delay_ticks;
+    poll_count = polls_per_frame;
+    poll_line = -1;
+    enable_interrupts();
+}
+
+/**
+ * @brief Configure the controllers to be polled when the video reaches a scanline
+ *
+ * This is like #controller_set_poll_schedule, but the first poll happens
+ * when the specified line is being scanned out (see #display_get_scanline).
+ * The timing is derived from the measured frame time, so it is approximate.
+ *
+ * @param[in] line
+ *            Scanline of the first poll
+ * @param[in] polls_per_frame
+ *            Number of polls per frame
+ */
+void controller_set_poll_line( int line, int polls_per_frame )
+{
+    assertf(line >= 0, "invalid poll line: %d", line);
+    assertf(polls_per_frame >= 1, "invalid number of polls per frame: %d", polls_per_frame);
+    disable_interrupts();
+    poll_line = line;
+    poll_count = polls_per_frame;
+    poll_delay = 0;
+    enable_interrupts();
+}
+
+/**
+ * @brief Query the accessories in background, to detect when they are swapped
+ *
+ * By default, the accessories (eg: mempaks) are only queried on request,
+ * with blocking functions like #get_accessories_present. This function
+ * makes the background scan query them every few frames as well, with a
+ * separate joybus transaction that does not delay the controller reads.
+ * The accessories inserted and removed are then reported by
+ * #get_accessories_inserted and #get_accessories_removed, and the mempak
+ * filesystem functions trust their cache without querying the mempak.
+ *
+ * An accessory swapped between two queries is not detected, so the
+ * interval should be short compared to the time a player takes to swap
+ * a mempak (30 frames is a good value).
+ *
+ * @param[in] frames
+ *            Number of frames between two queries, or 0 to disable them
+ */
+void controller_set_accessory_poll( int frames )
+{
+    assertf(frames >= 0, "invalid accessory poll interval: %d", frames);
+    disable_interrupts();
+    if( frames && !accessory_poll_frames )
+    {
+        /* The state is unknown until the first query: report what it finds */
+        accessories_next = 0;
+        accessories_inserted_next = accessories_removed_next = 0;
+        for( int ch = 0; ch < 4; ch++ ) { invalidate_mempak_cache( ch ); }
     }
+    accessory_poll_frames = frames;
+    accessory_poll_countdown = 1;
+    enable_interrupts();
+}
+
+/**
+ * @brief Get the accessories found by the last background query
+ *
+ * This does not block: it returns the result of the background queries
+ * enabled with #controller_set_accessory_poll, in the same format of
+ * #get_accessories_present.
+ *
+ * @return A bitmask representing accessories recognized, or -1 if the
+ *         background queries are disabled
+ */
+int controller_get_accessories( void )
+{
+    return accessory_poll_frames ? accessories_next : -1;
+}
+
+/**
+ * @brief Get the accessories inserted before the last #controller_scan
+ *
+ * The accessories are detected by the background queries enabled with
+ * #controller_set_accessory_poll. Like #get_keys_down, this reports the
+ * changes between the last two calls to #controller_scan.
+ *
+ * @return A bitmask of the ports where an accessory was inserted (see
+ *         #CONTROLLER_1_INSERTED)
+ */
+int get_accessories_inserted( void )
+{
+    return accessories_inserted;
+}
+
+/**
+ * @brief Get the accessories removed before the last #controller_scan
+ *
+ * See #get_accessories_inserted.
+ *
+ * @return A bitmask of the ports where an accessory was removed (see
+ *         #CONTROLLER_1_INSERTED)
+ */
+int get_accessories_removed( void )
+{
+    return accessories_removed;
+}
+
+/**
+ * @brief Get the time at which the current controller state was read
+ *
+ * This refers to the state returned by #get_keys_held and the other
+ * functions, as of the last #controller_scan. It can be compared with the
+ * time a frame is shown to measure the input latency.
+ *
+ * @return The time of the sample, in ticks (see #TICKS_READ)
+ */
+uint32_t controller_get_sample_ticks( void )
+{
+    return current_ticks;
+}
+
+/** @brief Reset the controller state, before starting the background scan */
+static void controller_reset_state( void )
+{
+    memset(&prev, 0, sizeof(struct controller_data));
+    memset(&current, 0, sizeof(struct controller_data));
+    memset((void*)&next, 0, sizeof(struct controller_data));
+    memset(gc_rumble, 0, sizeof(gc_rumble));
+    rumble_pwm_mask = rumble_on = rumble_dirty = 0;
 }
 
 /** 
@@ -108,11 +573,57 @@ static void controller_interrupt(void)
  */
 void controller_init( void )
 {
-    memset(&prev, 0, sizeof(struct controller_data));
-    memset(&current, 0, sizeof(struct controller_data));
-    memset((void*)&next, 0, sizeof(struct controller_data));
+    uint32_t t0 = TICKS_READ();
+    controller_reset_state();
+
+    /* Identify the devices before the first background scan */
+    struct controller_data status;
+    __get_accessories_present( &status );
+    for( int ch = 0; ch < 4; ch++ )
+    {
+        port_type[ch] = status.c[ch].err == ERROR_NONE ?
+            controller_port_type( status.c[ch].data >> 16 ) : PORT_UNKNOWN;
+    }
+
     register_VI_handler(controller_interrupt);
     controller_inited = true;
+    __boot_profile_record( "controller_init", t0 );
+}
+
+/**
+ * @brief Initialize the controller subsystem, without blocking.
+ *
+ * This is like #controller_init, but it does not wait for a joybus roundtrip
+ * to identify the devices connected to the ports: they are identified by
+ * the first background scan instead. This makes the initialization
+ * instantaneous, at the cost of reporting no controller for the first
+ * frame or two after boot.
+ */
+void controller_init_async( void )
+{
+    controller_reset_state();
+    for( int ch = 0; ch < 4; ch++ ) { port_type[ch] = PORT_UNKNOWN; }
+
+    register_VI_handler(controller_interrupt);
+    controller_inited = true;
+}
+
+/**
+ * @brief Set the rumble state of a GameCube controller
+ *
+ * The rumble state is sent to the controller with each background scan,
+ * so it takes effect at the next poll. It has no effect if the device on
+ * the port is not a GameCube controller.
+ *
+ * @param[in] controller
+ *            The controller (0-3) to change
+ * @param[in] rumble
+ *            True to start the rumble motor, false to stop it
+ */
+void controller_set_gc_rumble( int controller, bool rumble )
+{
+    assertf( controller >= 0 && controller <= 3, "invalid controller %d", controller );
+    gc_rumble[controller] = rumble ? 1 : 0;
 }
 
 /**
@@ -244,6 +755,10 @@ void controller_scan( void )
 
     disable_interrupts();
     memcpy(&current, (void*)&next, sizeof(struct controller_data));
+    current_ticks = next_ticks;
+    accessories_inserted = accessories_inserted_next;
+    accessories_removed = accessories_removed_next;
+    accessories_inserted_next = accessories_removed_next = 0;
     enable_interrupts();
 }
 
@@ -264,6 +779,8 @@ struct controller_data get_keys_down( void )
     for(int i = 0; i < 4; i++)
     {
         ret.c[i].data = (current.c[i].data) & ~(prev.c[i].data);
+        /* Keep the analog values of GameCube controllers */
+        ret.gc[i].data = ((current.gc[i].data) & ~(prev.gc[i].data) & GC_BUTTONS_MASK) | (current.gc[i].data & ~GC_BUTTONS_MASK);
     }
 
     return ret;
@@ -287,6 +804,8 @@ struct controller_data get_keys_up( void )
     for(int i = 0; i < 4; i++)
     {
         ret.c[i].data = ~(current.c[i].data) & (prev.c[i].data);
+        /* Keep the analog values of GameCube controllers */
+        ret.gc[i].data = (~(current.gc[i].data) & (prev.gc[i].data) & GC_BUTTONS_MASK) | (current.gc[i].data & ~GC_BUTTONS_MASK);
     }
 
     return ret;
@@ -310,6 +829,8 @@ struct controller_data get_keys_held( void )
     for(int i = 0; i < 4; i++)
     {
         ret.c[i].data = (current.c[i].data) & (prev.c[i].data);
+        /* Keep the analog values of GameCube controllers */
+        ret.gc[i].data = ((current.gc[i].data) & (prev.gc[i].data) & GC_BUTTONS_MASK) | (current.gc[i].data & ~GC_BUTTONS_MASK);
     }
 
     return ret;
@@ -407,22 +928,20 @@ int get_dpad_direction( int controller )
 void execute_raw_command( int controller, int command, int bytesout, int bytesin, unsigned char *out, unsigned char *in )
 {
     unsigned long long SI_debug[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
-    unsigned long long SI_read_controllers_block[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
-    uint8_t *data = (uint8_t *)SI_read_controllers_block;
+    joybus_block_t blk;
+    uint8_t tx[JOYBUS_BLOCK_SIZE];
 
     // Room for command itself
-    data[controller + 0] = bytesout + 1;
-    data[controller + 1] = bytesin;
-    data[controller + 2] = command;
+    tx[0] = command;
+    memcpy( &tx[1], out, bytesout );
 
-    memcpy( &data[controller + 3], out, bytesout );
-    memset( &data[controller + 3 + bytesout], 0xFF, bytesin );
-    data[controller + 3 + bytesout + bytesin] = 0xFE;
+    joybus_block_init( &blk );
+    int rx = joybus_block_add( &blk, controller, tx, bytesout + 1, bytesin );
+    assertf( rx >= 0, "raw command does not fit in a joybus block" );
 
-    joybus_exec(SI_read_controllers_block,SI_debug);
+    joybus_exec( blk.data, SI_debug );
 
-    data = (uint8_t *)SI_debug;
-    memcpy( in, &data[controller + 3 + bytesout], bytesin );
+    memcpy( in, (uint8_t *)SI_debug + rx, bytesin );
 }
 
 /**
@@ -492,18 +1011,6 @@ static int __is_valid_accessory( uint32_t data )
  */
 static void __get_accessories_present( struct controller_data *output )
 {
-    static const unsigned long long SI_read_status_block[8] =
-    {
-        0xff010300ffffffff,
-        0xff010300ffffffff,
-        0xff010300ffffffff,
-        0xff010300ffffffff,
-        0xfe00000000000000,
-        0,
-        0,
-        1
-    };
-
     joybus_exec( SI_read_status_block, output );
 }
 
@@ -536,6 +1043,35 @@ int get_accessories_present(struct controller_data *out)
     return ret;
 }
 
+/**
+ * @brief CRC of the address bits 8-15 of a mempak address
+ *
+ * Each entry is the XOR of the CRC terms of the bits set in the index.
+ */
+static const uint8_t __address_crc_hi[256] = {
+    0x00, 0x16, 0x19, 0x0F, 0x07, 0x11, 0x1E, 0x08, 0x0E, 0x18, 0x17, 0x01, 0x09, 0x1F, 0x10, 0x06,
+    0x1C, 0x0A, 0x05, 0x13, 0x1B, 0x0D, 0x02, 0x14, 0x12, 0x04, 0x0B, 0x1D, 0x15, 0x03, 0x0C, 0x1A,
+    0x0D, 0x1B, 0x14, 0x02, 0x0A, 0x1C, 0x13, 0x05, 0x03, 0x15, 0x1A, 0x0C, 0x04, 0x12, 0x1D, 0x0B,
+    0x11, 0x07, 0x08, 0x1E, 0x16, 0x00, 0x0F, 0x19, 0x1F, 0x09, 0x06, 0x10, 0x18, 0x0E, 0x01, 0x17,
+    0x1A, 0x0C, 0x03, 0x15, 0x1D, 0x0B, 0x04, 0x12, 0x14, 0x02, 0x0D, 0x1B, 0x13, 0x05, 0x0A, 0x1C,
+    0x06, 0x10, 0x1F, 0x09, 0x01, 0x17, 0x18, 0x0E, 0x08, 0x1E, 0x11, 0x07, 0x0F, 0x19, 0x16, 0x00,
+    0x17, 0x01, 0x0E, 0x18, 0x10, 0x06, 0x09, 0x1F, 0x19, 0x0F, 0x00, 0x16, 0x1E, 0x08, 0x07, 0x11,
+    0x0B, 0x1D, 0x12, 0x04, 0x0C, 0x1A, 0x15, 0x03, 0x05, 0x13, 0x1C, 0x0A, 0x02, 0x14, 0x1B, 0x0D,
+    0x01, 0x17, 0x18, 0x0E, 0x06, 0x10, 0x1F, 0x09, 0x0F, 0x19, 0x16, 0x00, 0x08, 0x1E, 0x11, 0x07,
+    0x1D, 0x0B, 0x04, 0x12, 0x1A, 0x0C, 0x03, 0x15, 0x13, 0x05, 0x0A, 0x1C, 0x14, 0x02, 0x0D, 0x1B,
+    0x0C, 0x1A, 0x15, 0x03, 0x0B, 0x1D, 0x12, 0x04, 0x02, 0x14, 0x1B, 0x0D, 0x05, 0x13, 0x1C, 0x0A,
+    0x10, 0x06, 0x09, 0x1F, 0x17, 0x01, 0x0E, 0x18, 0x1E, 0x08, 0x07, 0x11, 0x19, 0x0F, 0x00, 0x16,
+    0x1B, 0x0D, 0x02, 0x14, 0x1C, 0x0A, 0x05, 0x13, 0x15, 0x03, 0x0C, 0x1A, 0x12, 0x04, 0x0B, 0x1D,
+    0x07, 0x11, 0x1E, 0x08, 0x00, 0x16, 0x19, 0x0F, 0x09, 0x1F, 0x10, 0x06, 0x0E, 0x18, 0x17, 0x01,
+    0x16, 0x00, 0x0F, 0x19, 0x11, 0x07, 0x08, 0x1E, 0x18, 0x0E, 0x01, 0x17, 0x1F, 0x09, 0x06, 0x10,
+    0x0A, 0x1C, 0x13, 0x05, 0x0D, 0x1B, 0x14, 0x02, 0x04, 0x12, 0x1D, 0x0B, 0x03, 0x15, 0x1A, 0x0C,
+};
+
+/** @brief CRC of the address bits 5-7 of a mempak address */
+static const uint8_t __address_crc_lo[8] = {
+    0x00, 0x15, 0x1F, 0x0A, 0x0B, 0x1E, 0x14, 0x01,
+};
+
 /**
  * @brief Calculate the 5 bit CRC on a mempak address
  *
@@ -549,30 +1085,38 @@ int get_accessories_present(struct controller_data *out)
  */
 static uint16_t __calc_address_crc( uint16_t address )
 {
-    /* CRC table */
-    uint16_t xor_table[16] = { 0x0, 0x0, 0x0, 0x0, 0x0, 0x15, 0x1F, 0x0B, 0x16, 0x19, 0x07, 0x0E, 0x1C, 0x0D, 0x1A, 0x01 };
-    uint16_t crc = 0;
-
     /* Make sure we have a valid address */
     address &= ~0x1F;
 
-    /* Go through each bit in the address, and if set, xor the right value into the output */
-    for( int i = 15; i >= 5; i-- )
-    {
-        /* Is this bit set? */
-        if( ((address >> i) & 0x1) )
-        {
-           crc ^= xor_table[i];
-        }
-    }
-
-    /* Just in case */
-    crc &= 0x1F;
+    /* The CRC is linear, so it is the XOR of the CRCs of the two parts */
+    uint16_t crc = __address_crc_hi[address >> 8] ^ __address_crc_lo[(address >> 5) & 0x7];
 
     /* Create a new address with the CRC appended */
     return address | crc;
 }
 
+/**
+ * @brief Table of the CRC-8 (poly 0x85) of every byte value
+ */
+static const uint8_t __data_crc_table[256] = {
+    0x00, 0x85, 0x8F, 0x0A, 0x9B, 0x1E, 0x14, 0x91, 0xB3, 0x36, 0x3C, 0xB9, 0x28, 0xAD, 0xA7, 0x22,
+    0xE3, 0x66, 0x6C, 0xE9, 0x78, 0xFD, 0xF7, 0x72, 0x50, 0xD5, 0xDF, 0x5A, 0xCB, 0x4E, 0x44, 0xC1,
+    0x43, 0xC6, 0xCC, 0x49, 0xD8, 0x5D, 0x57, 0xD2, 0xF0, 0x75, 0x7F, 0xFA, 0x6B, 0xEE, 0xE4, 0x61,
+    0xA0, 0x25, 0x2F, 0xAA, 0x3B, 0xBE, 0xB4, 0x31, 0x13, 0x96, 0x9C, 0x19, 0x88, 0x0D, 0x07, 0x82,
+    0x86, 0x03, 0x09, 0x8C, 0x1D, 0x98, 0x92, 0x17, 0x35, 0xB0, 0xBA, 0x3F, 0xAE, 0x2B, 0x21, 0xA4,
+    0x65, 0xE0, 0xEA, 0x6F, 0xFE, 0x7B, 0x71, 0xF4, 0xD6, 0x53, 0x59, 0xDC, 0x4D, 0xC8, 0xC2, 0x47,
+    0xC5, 0x40, 0x4A, 0xCF, 0x5E, 0xDB, 0xD1, 0x54, 0x76, 0xF3, 0xF9, 0x7C, 0xED, 0x68, 0x62, 0xE7,
+    0x26, 0xA3, 0xA9, 0x2C, 0xBD, 0x38, 0x32, 0xB7, 0x95, 0x10, 0x1A, 0x9F, 0x0E, 0x8B, 0x81, 0x04,
+    0x89, 0x0C, 0x06, 0x83, 0x12, 0x97, 0x9D, 0x18, 0x3A, 0xBF, 0xB5, 0x30, 0xA1, 0x24, 0x2E, 0xAB,
+    0x6A, 0xEF, 0xE5, 0x60, 0xF1, 0x74, 0x7E, 0xFB, 0xD9, 0x5C, 0x56, 0xD3, 0x42, 0xC7, 0xCD, 0x48,
+    0xCA, 0x4F, 0x45, 0xC0, 0x51, 0xD4, 0xDE, 0x5B, 0x79, 0xFC, 0xF6, 0x73, 0xE2, 0x67, 0x6D, 0xE8,
+    0x29, 0xAC, 0xA6, 0x23, 0xB2, 0x37, 0x3D, 0xB8, 0x9A, 0x1F, 0x15, 0x90, 0x01, 0x84, 0x8E, 0x0B,
+    0x0F, 0x8A, 0x80, 0x05, 0x94, 0x11, 0x1B, 0x9E, 0xBC, 0x39, 0x33, 0xB6, 0x27, 0xA2, 0xA8, 0x2D,
+    0xEC, 0x69, 0x63, 0xE6, 0x77, 0xF2, 0xF8, 0x7D, 0x5F, 0xDA, 0xD0, 0x55, 0xC4, 0x41, 0x4B, 0xCE,
+    0x4C, 0xC9, 0xC3, 0x46, 0xD7, 0x52, 0x58, 0xDD, 0xFF, 0x7A, 0x70, 0xF5, 0x64, 0xE1, 0xEB, 0x6E,
+    0xAF, 0x2A, 0x20, 0xA5, 0x34, 0xB1, 0xBB, 0x3E, 0x1C, 0x99, 0x93, 0x16, 0x87, 0x02, 0x08, 0x8D,
+};
+
 /**
  * @brief Calculate the 8 bit CRC over a 32-byte block of data
  *
@@ -588,32 +1132,78 @@ static uint8_t __calc_data_crc( uint8_t *data )
 {
     uint8_t ret = 0;
 
-    for( int i = 0; i <= 32; i++ )
+    for( int i = 0; i < 32; i++ )
     {
-        for( int j = 7; j >= 0; j-- )
-        {
-            int tmp = 0;
+        ret = __data_crc_table[ret ^ data[i]];
+    }
 
-            if( ret & 0x80 )
-            {
-                tmp = 0x85;
-            }
+    return ret;
+}
 
-            ret <<= 1;
+/**
+ * @brief Prepare the joybus block to read or write 32 bytes of an accessory
+ *
+ * @param[out] block
+ *             64-byte joybus block to prepare
+ * @param[in]  controller
+ *             Which controller to access (0-3)
+ * @param[in]  address
+ *             A 32 byte aligned offset within the accessory
+ * @param[in]  data
+ *             32 bytes of data to write, or NULL to read
+ */
+static void __mempak_build_block( uint8_t *block, int controller, uint16_t address, const uint8_t *data )
+{
+    joybus_block_t blk;
+    uint8_t tx[35];
 
-            if( i < 32 )
-            {
-                if( data[i] & (0x01 << j) )
-                {
-                    ret |= 0x1;
-                }
-            }
+    /* Calculate CRC on address */
+    uint16_t crc_address = __calc_address_crc( address );
+    tx[0] = data ? 0x03 : 0x02;
+    tx[1] = (crc_address >> 8) & 0xFF;
+    tx[2] = crc_address & 0xFF;
+
+    /* Place the data to be written, and leave room for the CRC (plus the
+       data when reading) to come back */
+    if( data ) { memcpy( &tx[3], data, 32 ); }
+
+    joybus_block_init( &blk );
+    joybus_block_add( &blk, controller, tx, data ? 35 : 3, data ? 1 : 33 );
+    memcpy( block, blk.data, JOYBUS_BLOCK_SIZE );
+}
 
-            ret ^= tmp;
-        }
-    }
+/**
+ * @brief Validate the joybus block returned by an accessory read or write
+ *
+ * @param[in] output
+ *            64-byte joybus block returned by the SI
+ * @param[in] controller
+ *            Which controller was accessed (0-3)
+ *
+ * @retval 0  if the access was successful
+ * @retval -2 if there was no mempak present in the controller
+ * @retval -3 if the mempak returned invalid data
+ */
+static int __mempak_check_block( const uint8_t *output, int controller )
+{
+    /* Validate CRC */
+    uint8_t crc = __calc_data_crc( (uint8_t*)&output[controller + 5] );
 
-    return ret;
+    if( crc == output[controller + 5 + 32] )
+    {
+        /* Data was transferred successfully */
+        return 0;
+    }
+    else if( crc == (output[controller + 5 + 32] ^ 0xFF) )
+    {
+        /* Pak not present! */
+        return -2;
+    }
+    else
+    {
+        /* Pak returned bad data */
+        return -3;
+    }
 }
 
 /**
@@ -638,57 +1228,17 @@ int read_mempak_address( int controller, uint16_t address, uint8_t *data )
 {
     uint8_t output[64];
     uint8_t SI_read_mempak_block[64];
-    int ret;
 
     /* Controller must be in range */
     if( controller < 0 || controller > 3 ) { return -1; }
 
-    /* Last byte must be 0x01 to signal to the SI to process data */
-    memset( SI_read_mempak_block, 0, 64 );
-    SI_read_mempak_block[56] = 0xfe;
-    SI_read_mempak_block[63] = 0x01;
-
-    /* Start command at the correct channel to read from the right mempak */
-    SI_read_mempak_block[controller]     = 0x03;
-    SI_read_mempak_block[controller + 1] = 0x21;
-    SI_read_mempak_block[controller + 2] = 0x02;
-
-    /* Calculate CRC on address */
-    uint16_t read_address = __calc_address_crc( address );
-    SI_read_mempak_block[controller + 3] = (read_address >> 8) & 0xFF;
-    SI_read_mempak_block[controller + 4] = read_address & 0xFF;
-
-    /* Leave room for 33 bytes (32 bytes + CRC) to come back */
-    memset( &SI_read_mempak_block[controller + 5], 0xFF, 33 );
-
+    __mempak_build_block( SI_read_mempak_block, controller, address, NULL );
     joybus_exec( SI_read_mempak_block, &output );
 
     /* Copy data correctly out of command */
     memcpy( data, &output[controller + 5], 32 );
 
-    /* Validate CRC */
-    uint8_t crc = __calc_data_crc( &output[controller + 5] );
-
-    if( crc == output[controller + 5 + 32] )
-    {
-        /* Data was read successfully */
-        ret = 0;
-    }
-    else
-    {
-        if( crc == (output[controller + 5 + 32] ^ 0xFF) )
-        {
-            /* Pak not present! */
-            ret = -2;
-        }
-        else
-        {
-            /* Pak returned bad data */
-            ret = -3;
-        }
-    }
-
-    return ret;
+    return __mempak_check_block( output, controller );
 }
 
 /**
@@ -712,57 +1262,159 @@ int write_mempak_address( int controller, uint16_t address, uint8_t *data )
 {
     uint8_t output[64];
     uint8_t SI_write_mempak_block[64];
-    int ret;
 
     /* Controller must be in range */
     if( controller < 0 || controller > 3 ) { return -1; }
 
-    /* Last byte must be 0x01 to signal to the SI to process data */
-    memset( SI_write_mempak_block, 0, 64 );
-    SI_write_mempak_block[56] = 0xfe;
-    SI_write_mempak_block[63] = 0x01;
-
-    /* Start command at the correct channel to write from the right mempak */
-    SI_write_mempak_block[controller]     = 0x23;
-    SI_write_mempak_block[controller + 1] = 0x01;
-    SI_write_mempak_block[controller + 2] = 0x03;
-
-    /* Calculate CRC on address */
-    uint16_t write_address = __calc_address_crc( address );
-    SI_write_mempak_block[controller + 3] = (write_address >> 8) & 0xFF;
-    SI_write_mempak_block[controller + 4] = write_address & 0xFF;
+    __mempak_build_block( SI_write_mempak_block, controller, address, data );
+    joybus_exec( SI_write_mempak_block, &output );
 
-    /* Place the data to be written */
-    memcpy( &SI_write_mempak_block[controller + 5], data, 32 );
+    return __mempak_check_block( output, controller );
+}
 
-    /* Leave room for CRC to come back */
-    SI_write_mempak_block[controller + 5 + 32] = 0xFF;
+/** @brief Submit the next 32-byte chunk of an asynchronous accessory request */
+static void __accessory_async_submit( accessory_request_t *req );
 
-    joybus_exec( SI_write_mempak_block, &output );
+/**
+ * @brief Joybus completion callback of an asynchronous accessory request
+ *
+ * Called under interrupt when a chunk is done: it validates it, and either
+ * submits the next chunk or completes the request.
+ */
+static void __accessory_async_callback( uint64_t *out, void *ctx )
+{
+    accessory_request_t *req = ctx;
+    const uint8_t *output = (const uint8_t*)out;
+    uint8_t *chunk = req->data + req->cur * 32;
 
-    /* Calculate CRC on output */
-    uint8_t crc = __calc_data_crc( &output[controller + 5] );
+    if( !req->write ) { memcpy( chunk, &output[req->controller + 5], 32 ); }
 
-    if( crc == output[controller + 5 + 32] )
-    {
-        /* Data was written successfully */
-        ret = 0;
-    }
-    else
+    int ret = __mempak_check_block( output, req->controller );
+    if( ret == 0 && ++req->cur < req->num_chunks )
     {
-        if( crc == (output[controller + 5 + 32] ^ 0xFF) )
-        {
-            /* Pak not present! */
-            ret = -2;
-        }
-        else
-        {
-            /* Pak returned bad data */
-            ret = -3;
-        }
+        __accessory_async_submit( req );
+        return;
     }
 
-    return ret;
+    req->result = ret;
+    req->done = true;
+    if( req->callback ) { req->callback( req, req->ctx ); }
+}
+
+static void __accessory_async_submit( accessory_request_t *req )
+{
+    uint8_t block[64];
+
+    __mempak_build_block( block, req->controller, req->address + req->cur * 32,
+                          req->write ? req->data + req->cur * 32 : NULL );
+    joybus_exec_async( block, __accessory_async_callback, req );
+}
+
+/** @brief Start an asynchronous accessory read or write (see #accessory_read_async) */
+static void __accessory_async_start( int controller, uint16_t address, uint8_t *data, int len, bool write,
+                                       accessory_request_t *req, accessory_callback_t cb, void *ctx )
+{
+    assertf( controller >= 0 && controller <= 3, "invalid controller %d", controller );
+    assertf( (address & 31) == 0 && (len & 31) == 0 && len > 0,
+        "accessory address (%04x) and length (%d) must be multiple of 32", address, len );
+
+    req->controller = controller;
+    req->address = address;
+    req->data = data;
+    req->num_chunks = len / 32;
+    req->cur = 0;
+    req->write = write;
+    req->callback = cb;
+    req->ctx = ctx;
+    req->result = 0;
+    req->done = false;
+
+    __accessory_async_submit( req );
+}
+
+/**
+ * @brief Read data from an accessory, without blocking
+ *
+ * The data is read in 32-byte chunks, each one with its own joybus
+ * transaction, that are interleaved with the other joybus traffic (like
+ * the controller scanning). This function returns immediately: completion
+ * can be polled with #accessory_request_done, or notified with a callback.
+ *
+ * @param[in]  controller
+ *             Which controller to read the data from (0-3)
+ * @param[in]  address
+ *             A 32 byte aligned offset to read from on the accessory
+ * @param[out] data
+ *             Buffer to place the data read from the accessory
+ * @param[in]  len
+ *             Number of bytes to read (multiple of 32)
+ * @param[out] req
+ *             Request to initialize. It must stay valid until it is completed.
+ * @param[in]  cb
+ *             Callback called under interrupt when the request is completed (or NULL)
+ * @param[in]  ctx
+ *             Opaque pointer passed to the callback
+ */
+void accessory_read_async( int controller, uint16_t address, uint8_t *data, int len,
+                           accessory_request_t *req, accessory_callback_t cb, void *ctx )
+{
+    __accessory_async_start( controller, address, data, len, false, req, cb, ctx );
+}
+
+/**
+ * @brief Write data to an accessory, without blocking
+ *
+ * See #accessory_read_async. The data must stay valid until the request
+ * is completed.
+ *
+ * @param[in]  controller
+ *             Which controller to write the data to (0-3)
+ * @param[in]  address
+ *             A 32 byte aligned offset to write to on the accessory
+ * @param[in]  data
+ *             Buffer to source the data to write to the accessory
+ * @param[in]  len
+ *             Number of bytes to write (multiple of 32)
+ * @param[out] req
+ *             Request to initialize. It must stay valid until it is completed.
+ * @param[in]  cb
+ *             Callback called under interrupt when the request is completed (or NULL)
+ * @param[in]  ctx
+ *             Opaque pointer passed to the callback
+ */
+void accessory_write_async( int controller, uint16_t address, const uint8_t *data, int len,
+                            accessory_request_t *req, accessory_callback_t cb, void *ctx )
+{
+    __accessory_async_start( controller, address, (uint8_t*)data, len, true, req, cb, ctx );
+}
+
+/**
+ * @brief Check if an asynchronous accessory request is completed
+ *
+ * @param[in] req
+ *            Request started with #accessory_read_async or #accessory_write_async
+ *
+ * @return true if the request is completed, and #accessory_request_t::result is valid
+ */
+bool accessory_request_done( accessory_request_t *req )
+{
+    return req->done;
+}
+
+/**
+ * @brief Wait for an asynchronous accessory request to complete
+ *
+ * @note This function requires interrupts to be enabled.
+ *
+ * @param[in] req
+ *            Request started with #accessory_read_async or #accessory_write_async
+ *
+ * @return The result of the request (see #accessory_request_t::result)
+ */
+int accessory_request_wait( accessory_request_t *req )
+{
+    while( !req->done ) { ; }
+    return req->result;
 }
 
 /**
@@ -808,6 +1460,9 @@ int identify_accessory( int controller )
     uint8_t data[32];
     struct controller_data output;
 
+    /* The accessory might have changed, so drop the cached mempak filesystem */
+    invalidate_mempak_cache( controller );
+
     /* Grab the actual accessory data */
     __get_accessories_present( &output );
 
@@ -853,6 +1508,163 @@ int identify_accessory( int controller )
     return ACCESSORY_NONE;
 }
 
+/** @brief Queue the writes of the motor state changes that are not in flight yet */
+static void rumble_flush( void );
+
+/** @brief Completion of the write of a motor state to a rumble pak */
+static void rumble_write_done( uint64_t *out, void *ctx )
+{
+    int controller = (intptr_t)ctx;
+
+    /* Without a rumble pak the write fails: the state will be written again
+       when an accessory is inserted (if the accessory poll is enabled), or
+       at the next change */
+    rumble_busy &= ~(1 << controller);
+    rumble_flush();
+}
+
+static void rumble_flush( void )
+{
+    uint8_t block[64];
+    uint8_t data[32];
+
+    for( int ch = 0; ch < 4; ch++ )
+    {
+        uint8_t bit = 1 << ch;
+        if( !(rumble_dirty & bit) || (rumble_busy & bit) ) { continue; }
+
+        bool on = rumble_on & bit;
+        switch( port_type[ch] )
+        {
+            case PORT_N64:
+                rumble_dirty &= ~bit;
+                rumble_busy |= bit;
+                memset( data, on ? 0x01 : 0x00, 32 );
+                __mempak_build_block( block, ch, 0xC000, data );
+                joybus_exec_async( block, rumble_write_done, (void*)(intptr_t)ch );
+                break;
+            case PORT_GC:
+                /* Sent with the next autoscan */
+                rumble_dirty &= ~bit;
+                gc_rumble[ch] = on ? 1 : 0;
+                break;
+            default:
+                /* Wait until the device is identified */
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Advance the rumble PWM by one step
+ *
+ * Each step adds the intensity to the accumulator of the controller, and
+ * turns the motor on when it overflows, so that the motor is on for
+ * intensity/255 of the steps. Called under interrupt.
+ */
+static void rumble_pwm_step( void )
+{
+    if( !rumble_pwm_mask ) { return; }
+
+    for( int ch = 0; ch < 4; ch++ )
+    {
+        uint8_t bit = 1 << ch;
+        if( !(rumble_pwm_mask & bit) ) { continue; }
+
+        rumble_acc[ch] += rumble_intensity[ch];
+        bool on = rumble_acc[ch] >= 255;
+        if( on ) { rumble_acc[ch] -= 255; }
+
+        if( on != !!(rumble_on & bit) )
+        {
+            rumble_on ^= bit;
+            rumble_dirty |= bit;
+        }
+    }
+    rumble_flush();
+}
+
+/** @brief Timer callback of the rumble PWM */
+static void rumble_pwm_timer( int ovfl )
+{
+    rumble_pwm_step();
+}
+
+/** @brief Stop driving the rumble of a controller with the PWM */
+static void rumble_pwm_release( int controller )
+{
+    if( controller < 0 || controller > 3 ) { return; }
+    disable_interrupts();
+    rumble_pwm_mask &= ~(1 << controller);
+    rumble_dirty &= ~(1 << controller);
+    enable_interrupts();
+}
+
+/**
+ * @brief Set the rumble intensity of a controller
+ *
+ * The motor of the rumble pak can only be turned on or off: the intensity
+ * is obtained by switching it at each step of a PWM, which runs in background
+ * at each frame (or at the frequency set with #rumble_set_pwm_frequency).
+ * The rumble pak is written only when the motor state changes, through the
+ * joybus queue, so this never blocks. With a GameCube controller, the state
+ * is sent with the background scan instead.
+ *
+ * Calling #rumble_start or #rumble_stop returns the controller to direct
+ * control.
+ *
+ * @param[in] controller
+ *            The controller (0-3) whose rumble pak should be driven
+ * @param[in] intensity
+ *            Intensity, from 0 (stopped) to 255 (full speed)
+ */
+void rumble_set_intensity( int controller, uint8_t intensity )
+{
+    assertf( controller >= 0 && controller <= 3, "invalid controller %d", controller );
+    disable_interrupts();
+    if( !(rumble_pwm_mask & (1 << controller)) )
+    {
+        /* Write the state at the first step, whatever the pak is doing */
+        rumble_acc[controller] = 0;
+        rumble_on &= ~(1 << controller);
+        rumble_dirty |= 1 << controller;
+        rumble_pwm_mask |= 1 << controller;
+    }
+    rumble_intensity[controller] = intensity;
+    enable_interrupts();
+}
+
+/**
+ * @brief Set the frequency of the rumble PWM
+ *
+ * By default, the PWM of #rumble_set_intensity advances once per frame,
+ * at the vblank, which is enough for the inertia of the motor to smooth
+ * most intensities. A higher frequency gives finer steps, but each change
+ * of the motor state costs a joybus transfer (in background).
+ *
+ * @note The timer subsystem must be initialized (#timer_init) to use
+ *       a frequency other than the default one.
+ *
+ * @param[in] hz
+ *            Number of PWM steps per second, or 0 to step once per frame
+ */
+void rumble_set_pwm_frequency( int hz )
+{
+    assertf( hz >= 0, "invalid rumble PWM frequency: %d", hz );
+    disable_interrupts();
+    if( rumble_timer_active )
+    {
+        stop_timer( &rumble_timer );
+        rumble_timer_active = false;
+    }
+    if( hz )
+    {
+        start_timer( &rumble_timer, TICKS_PER_SECOND / hz, TF_CONTINUOUS, rumble_pwm_timer );
+        rumble_timer_active = true;
+    }
+    enable_interrupts();
+}
+
 /**
  * @brief Turn rumble on for a particular controller
  *
@@ -863,6 +1675,8 @@ void rumble_start( int controller )
 {
     uint8_t data[32];
 
+    rumble_pwm_release( controller );
+
     /* Unsure of why we have to do this multiple times */
     memset( data, 0x01, 32 );
     write_mempak_address( controller, 0xC000, data );
@@ -880,6 +1694,8 @@ void rumble_stop( int controller )
 {
     uint8_t data[32];
 
+    rumble_pwm_release( controller );
+
     /* Unsure of why we have to do this multiple times */
     memset( data, 0x00, 32 );
     write_mempak_address( controller, 0xC000, data );
@@ -0,0 +1,234 @@
+/**
+ * @file cpu_profile.c
+ * @brief Sampling CPU profiler
+ * @ingroup cpu_profile
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "cpu_profile.h"
+#include "n64sys.h"
+#include "timer.h"
+#include "backtrace.h"
+#include "interrupt.h"
+#include "usb.h"
+#include "debug.h"
+#include "utils.h"
+
+/**
+ * @defgroup cpu_profile Sampling CPU profiler
+ * @ingroup lowlevel
+ * @brief Statistical profiler of the code running on the CPU.
+ *
+ * The profiler interrupts the CPU at a fixed frequency via a continuous
+ * timer (see @ref timer), and records the call stack of the interrupted
+ * code, obtained by walking the stack through the interrupt frame with
+ * #backtrace. The samples are accumulated in RAM, and sent to the PC via
+ * USB with #cpu_profile_dump (which can be called periodically, eg: once
+ * per second, to profile long sessions of real gameplay).
+ *
+ * On the PC, the n64prof tool symbolizes the samples using the symbol table
+ * generated by n64sym (the same used by #backtrace_symbols), and prints a flat
+ * profile, a call graph, or folded stacks for flame graphs:
+ *
+ * @code{.sh}
+ *      n64prof game.sym profile-*.bin
+ * @endcode
+ *
+ * Walking the stack is relatively expensive, so a sampling frequency of
+ * 1000 Hz or less is advised. Use a depth of 1 to only record the
+ * interrupted function (flat profile). Notice that code running with
+ * interrupts disabled cannot be sampled: it will be accounted to the code
+ * that reenables interrupts.
+ *
+ * Samples are stored in two buffers: while one is being filled by the timer
+ * interrupt, the other one is sent via USB. The format of a sample file is
+ * a sequence of big-endian 32-bit words:
+ *
+ *  * #CPU_PROFILE_MAGIC
+ *  * #CPU_PROFILE_VERSION
+ *  * Sampling period in ticks
+ *  * Number of words of sample data that follow the header
+ *  * Number of samples dropped since the previous dump
+ *  * Sample data: for each sample, the number N of frames, followed by
+ *    N addresses, starting from the interrupted PC up to the outermost
+ *    caller.
+ * @{
+ */
+
+/** @brief Number of words in the header of each buffer */
+#define HEADER_WORDS    5
+
+/** @brief Start of the interrupt handler (see inthandler.S) */
+extern uint32_t inthandler[];
+/** @brief End of the interrupt handler (see inthandler.S) */
+extern uint32_t inthandler_end[];
+
+/** @brief Sample buffers (the header is filled only when dumping) */
+static uint32_t *prof_buf[2];
+/** @brief Size of each sample buffer, in words (including the header) */
+static int prof_buf_words;
+/** @brief Index of the buffer being filled by the timer */
+static int prof_cur;
+/** @brief Write position in the current buffer, in words */
+static int prof_pos;
+/** @brief Number of frames recorded per sample */
+static int prof_depth;
+/** @brief Sampling timer */
+static timer_link_t *prof_timer;
+/** @brief Sampling period in ticks */
+static uint32_t prof_period;
+/** @brief Number of samples recorded */
+static uint32_t prof_samples;
+/** @brief Number of samples dropped since the last dump */
+static uint32_t prof_dropped;
+/** @brief Total number of samples dropped */
+static uint32_t prof_dropped_total;
+
+/**
+ * @brief Timer callback: record the call stack of the interrupted code
+ */
+static void cpu_profile_sample(int ovfl)
+{
+    /* Walk the stack from here. The frames up to the interrupt handler
+       belong to the timer code; the ones after it are the interrupted code. */
+    void *bt[CPU_PROFILE_MAX_DEPTH + 8];
+    int n = backtrace(bt, prof_depth + 8);
+
+    int first = -1;
+    for (int i = 0; i < n; i++) {
+        if ((uint32_t*)bt[i] >= inthandler && (uint32_t*)bt[i] < inthandler_end) {
+            first = i + 1;
+            break;
+        }
+    }
+    if (first < 0 || first >= n)
+        return;
+
+    int depth = MIN(n - first, prof_depth);
+    if (prof_pos + 1 + depth > prof_buf_words) {
+        prof_dropped++;
+        prof_dropped_total++;
+        return;
+    }
+
+    uint32_t *buf = prof_buf[prof_cur];
+    buf[prof_pos++] = depth;
+    for (int i = 0; i < depth; i++)
+        buf[prof_pos++] = (uint32_t)bt[first + i];
+    prof_samples++;
+}
+
+/**
+ * @brief Start sampling the CPU
+ *
+ * The timer subsystem must be initialized. Calling this function while the
+ * profiler is already running changes the sampling parameters, discarding
+ * the samples not dumped yet.
+ *
+ * @param[in] hz            Sampling frequency (eg: 1000)
+ * @param[in] depth         Number of stack frames to record per sample
+ *                          (1 to #CPU_PROFILE_MAX_DEPTH). Use 1 for a flat
+ *                          profile, or more to also get a call graph.
+ * @param[in] buffer_size   Size in bytes of each of the two sample buffers.
+ *                          Samples are dropped if the buffer fills before
+ *                          #cpu_profile_dump is called.
+ */
+void cpu_profile_start(int hz, int depth, int buffer_size)
+{
+    assertf(hz > 0, "invalid sampling frequency: %d", hz);
+    assertf(depth >= 1 && depth <= CPU_PROFILE_MAX_DEPTH, "invalid sampling depth: %d (max: %d)", depth, CPU_PROFILE_MAX_DEPTH);
+    assertf(buffer_size >= 1024, "profile buffer too small: %d", buffer_size);
+
+    cpu_profile_close();
+
+    prof_buf_words = buffer_size / 4;
+    for (int i = 0; i < 2; i++) {
+        prof_buf[i] = malloc(prof_buf_words * 4);
+        assertf(prof_buf[i], "out of memory allocating profile buffers");
+    }
+    prof_cur = 0;
+    prof_pos = HEADER_WORDS;
+    prof_depth = depth;
+    prof_samples = prof_dropped = prof_dropped_total = 0;
+
+    prof_period = TICKS_PER_SECOND / hz;
+    prof_timer = new_timer(prof_period, TF_CONTINUOUS, cpu_profile_sample);
+}
+
+/**
+ * @brief Stop sampling the CPU
+ *
+ * The samples recorded so far are kept, and can still be sent with
+ * #cpu_profile_dump.
+ */
+void cpu_profile_stop(void)
+{
+    if (prof_timer) {
+        delete_timer(prof_timer);
+        prof_timer = NULL;
+    }
+}
+
+/**
+ * @brief Send the samples recorded so far via USB, and empty the buffer
+ *
+ * The samples are sent as a single binary message (DATATYPE_RAWBINARY),
+ * that the USB loader saves to a file on the PC. Each file is self-contained,
+ * so that multiple dumps can be given to the n64prof tool at once. Sampling
+ * continues in the other buffer while the data is being sent.
+ */
+void cpu_profile_dump(void)
+{
+    if (!prof_buf[0])
+        return;
+
+    /* Swap the buffers, so that the timer can keep sampling */
+    disable_interrupts();
+    uint32_t *buf = prof_buf[prof_cur];
+    int words = prof_pos;
+    uint32_t dropped = prof_dropped;
+    prof_cur ^= 1;
+    prof_pos = HEADER_WORDS;
+    prof_dropped = 0;
+    enable_interrupts();
+
+    if (words == HEADER_WORDS && !dropped)
+        return;
+
+    buf[0] = CPU_PROFILE_MAGIC;
+    buf[1] = CPU_PROFILE_VERSION;
+    buf[2] = prof_period;
+    buf[3] = words - HEADER_WORDS;
+    buf[4] = dropped;
+    usb_write(DATATYPE_RAWBINARY, buf, words * 4);
+}
+
+/**
+ * @brief Get the statistics of the profiler
+ *
+ * @param[out] stats    Structure that will be filled with the statistics
+ */
+void cpu_profile_get_stats(cpu_profile_stats_t *stats)
+{
+    disable_interrupts();
+    stats->samples = prof_samples;
+    stats->dropped = prof_dropped_total;
+    stats->buffered_words = prof_buf[0] ? prof_pos - HEADER_WORDS : 0;
+    enable_interrupts();
+}
+
+/**
+ * @brief Stop sampling and free the buffers
+ *
+ * Samples not yet sent with #cpu_profile_dump are discarded.
+ */
+void cpu_profile_close(void)
+{
+    cpu_profile_stop();
+    for (int i = 0; i < 2; i++) {
+        free(prof_buf[i]);
+        prof_buf[i] = NULL;
+    }
+}
+
+/** @} */
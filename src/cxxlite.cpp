@@ -0,0 +1,94 @@
+/**
+ * @file cxxlite.cpp
+ * @brief Lightweight C++ runtime, without exceptions and RTTI
+ * @ingroup system
+ *
+ * This file is built into a separate library (libdragoncxxlite.a), that
+ * n64.mk links before libstdc++ when N64_CXX_LITE is set. It replaces the
+ * parts of the C++ runtime that would otherwise pull in the exception
+ * machinery (unwinder, personality routine, typeinfo, demangler) even if
+ * the program is compiled with -fno-exceptions:
+ *
+ *  * operator new and delete, which would throw std::bad_alloc.
+ *  * The std::__throw_* helpers called by the standard library headers
+ *    (eg: std::vector::at), which report the error on the exception
+ *    screen instead of throwing.
+ *  * __cxa_pure_virtual, which would call std::terminate.
+ *  * __cxa_atexit: destructors of global objects are registered at boot
+ *    by the global constructors, but a N64 program never exits, so they
+ *    are not recorded at all, saving time and heap at boot.
+ */
+#include <cstdlib>
+#include <cstdarg>
+#include <cstdio>
+#include <new>
+#include <bits/functexcept.h>
+#include "exception_internal.h"
+
+/** @brief Report a C++ error that would have been an exception */
+__attribute__((noreturn))
+static void cxxlite_fail(const char *exctype, const char *what)
+{
+    __inspector_cppexception(exctype, what);
+}
+
+/// @cond
+void* operator new(std::size_t size)
+{
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) cxxlite_fail("std::bad_alloc", "out of memory");
+    return ptr;
+}
+
+void* operator new[](std::size_t size)                                  { return operator new(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept    { return malloc(size ? size : 1); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept  { return malloc(size ? size : 1); }
+void operator delete(void *ptr) noexcept                                { free(ptr); }
+void operator delete[](void *ptr) noexcept                              { free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept                   { free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept                 { free(ptr); }
+void operator delete(void *ptr, const std::nothrow_t&) noexcept         { free(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t&) noexcept       { free(ptr); }
+
+namespace std {
+    void __throw_bad_exception()                    { cxxlite_fail("std::bad_exception", "bad exception"); }
+    void __throw_bad_alloc()                        { cxxlite_fail("std::bad_alloc", "out of memory"); }
+    void __throw_bad_array_new_length()             { cxxlite_fail("std::bad_array_new_length", "bad array new length"); }
+    void __throw_bad_cast()                         { cxxlite_fail("std::bad_cast", "bad cast"); }
+    void __throw_bad_typeid()                       { cxxlite_fail("std::bad_typeid", "bad typeid"); }
+    void __throw_bad_function_call()                { cxxlite_fail("std::bad_function_call", "bad function call"); }
+    void __throw_logic_error(const char *what)      { cxxlite_fail("std::logic_error", what); }
+    void __throw_domain_error(const char *what)     { cxxlite_fail("std::domain_error", what); }
+    void __throw_invalid_argument(const char *what) { cxxlite_fail("std::invalid_argument", what); }
+    void __throw_length_error(const char *what)     { cxxlite_fail("std::length_error", what); }
+    void __throw_out_of_range(const char *what)     { cxxlite_fail("std::out_of_range", what); }
+    void __throw_runtime_error(const char *what)    { cxxlite_fail("std::runtime_error", what); }
+    void __throw_range_error(const char *what)      { cxxlite_fail("std::range_error", what); }
+    void __throw_overflow_error(const char *what)   { cxxlite_fail("std::overflow_error", what); }
+    void __throw_underflow_error(const char *what)  { cxxlite_fail("std::underflow_error", what); }
+    void __throw_system_error(int)                  { cxxlite_fail("std::system_error", "system error"); }
+
+    void __throw_out_of_range_fmt(const char *fmt, ...)
+    {
+        // The format uses %zu and %lu to report the index and the size
+        char buf[128];
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        cxxlite_fail("std::out_of_range", buf);
+    }
+}
+
+extern "C" {
+    void __cxa_pure_virtual(void)
+    {
+        cxxlite_fail(NULL, "Pure virtual function called");
+    }
+
+    int __cxa_atexit(void (*func)(void*), void *arg, void *dso_handle)
+    {
+        return 0;
+    }
+}
+/// @endcond
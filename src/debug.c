@@ -21,8 +21,11 @@
 #include "usb.h"
 #include "utils.h"
 #include "interrupt.h"
+#include "timer.h"
+#include "idle.h"
 #include "backtrace.h"
 #include "exception_internal.h"
+#include "debug_internal.h"
 #include "libcart/cart.h"
 #include "fatfs/ff.h"
 #include "fatfs/ffconf.h"
@@ -47,6 +50,10 @@
  *    cartridge (#DEBUG_FEATURE_LOG_SD).
  *    On N64, logging can simply be performed by writing to stderr,
  *    for instance through the #debugf macro.
+ *    Once the timer subsystem is initialized, USB logging is buffered in
+ *    RAM and sent in the background by a timer, so that logging does not
+ *    stall the application while the PC receives the data. If the buffer
+ *    fills up, new messages are dropped (see #debug_get_usblog_stats).
  *
  *  * External filesystems. In addition to the read-only filesystem
  *    stored within the ROM image (dragonfs), these debugging features
@@ -67,6 +74,24 @@ static int enabled_features = 0;
 /** @brief open log file to SD */
 static FILE *sdlog_file = NULL;
 
+/** @brief Size of the write-back cache of the SD log (multiple of the sector size) */
+#define SDLOG_CACHE_SIZE         (16*1024)
+/** @brief Maximum time the SD log is kept in the cache, checked at each write */
+#define SDLOG_FLUSH_PERIOD       TICKS_FROM_MS(1000)
+
+/** @brief log file on the SD filesystem, accessed directly via FatFs */
+static FIL sdlog_fil;
+/** @brief write-back cache of the SD log (NULL if the log goes through #sdlog_file) */
+static uint8_t *sdlog_cache = NULL;
+/** @brief bytes in the write-back cache */
+static int sdlog_cached = 0;
+/** @brief time of the last flush with sync of the SD log */
+static uint32_t sdlog_flush_ticks;
+/** @brief true after a crash: writes to the SD log are not cached anymore */
+static bool sdlog_writethrough = false;
+/** @brief true while a write to the SD log is in progress */
+static bool sdlog_in_write = false;
+
 /** @brief prefix used to address SD filesystem */
 static char sdfs_prefix[16];
 static char sdfs_logic_drive[3] = { 0 };
@@ -124,9 +149,385 @@ static void isviewer_write(const uint8_t *data, int len)
 	}
 }
 
+/** Size of the USB log buffer (must be a power of two) */
+#define USBLOG_BUFFER_SIZE       16384
+/** Maximum number of bytes sent via USB by each run of the drain timer */
+#define USBLOG_CHUNK_SIZE        512
+/** Period of the USB log drain timer */
+#define USBLOG_PERIOD            TICKS_FROM_MS(2)
+
+/** Buffer of log data waiting to be sent via USB */
+static uint8_t *usblog_buf = NULL;
+/** Number of bytes ever written into the buffer */
+static volatile uint32_t usblog_head = 0;
+/** Number of bytes ever sent from the buffer */
+static volatile uint32_t usblog_tail = 0;
+/** Timer draining the buffer (NULL if logging is synchronous) */
+static timer_link_t *usblog_timer = NULL;
+/** True if the timer subsystem is initialized */
+static bool usblog_timer_ready = false;
+/** Bytes dropped that have not been reported in the log yet */
+static uint32_t usblog_dropped_pending = 0;
+/** Statistics of the USB log */
+static debug_usblog_stats_t usblog_stats;
+
+/** Send some data from the buffer. Returns false if nothing could be sent. */
+static bool usblog_drain(int max_bytes)
+{
+	// Avoid reentrant calls, and calls while the main code is using USB
+	static bool in_drain = false;
+	if (in_drain || !usb_canwrite()) return false;
+	in_drain = true;
+
+	disable_interrupts();
+	uint32_t dropped = usblog_dropped_pending;
+	usblog_dropped_pending = 0;
+	uint32_t tail = usblog_tail;
+	uint32_t avail = usblog_head - tail;
+	enable_interrupts();
+
+	if (dropped) {
+		char msg[64];
+		int n = snprintf(msg, sizeof(msg), "\n[debug: %lu bytes of log dropped]\n", dropped);
+		usb_write(DATATYPE_TEXT, msg, n);
+	}
+
+	// Send a contiguous chunk, that does not wrap around the buffer
+	uint32_t offset = tail & (USBLOG_BUFFER_SIZE - 1);
+	uint32_t n = MIN(avail, MIN((uint32_t)max_bytes, USBLOG_BUFFER_SIZE - offset));
+	if (n) {
+		usb_write(DATATYPE_TEXT, usblog_buf + offset, n);
+		usblog_tail = tail + n;
+	}
+
+	in_drain = false;
+	return n > 0 || dropped > 0;
+}
+
+/** Size of the binary log buffer, in words */
+#define BINLOG_BUFFER_WORDS      2048
+/** Maximum size of the arguments of a binary log record, in bytes */
+#define BINLOG_MAX_PAYLOAD       256
+/** Maximum size of a binary log message sent via USB, in bytes */
+#define BINLOG_CHUNK_SIZE        1024
+/** Magic of the binary log messages ("BLOG") */
+#define BINLOG_MAGIC             0x424C4F47
+/** Version of the binary log messages */
+#define BINLOG_VERSION           1
+/** Number of words in the header of a binary log record */
+#define BINLOG_RECORD_HEADER     3
+
+/** Buffer of binary log records waiting to be sent via USB */
+static uint32_t *binlog_buf = NULL;
+/** Write position in the binary log buffer, in words */
+static uint32_t binlog_head = 0;
+/** Read position in the binary log buffer, in words */
+static uint32_t binlog_tail = 0;
+/** Words used in the binary log buffer (including the padding at the end) */
+static volatile uint32_t binlog_used = 0;
+/** Binary log records dropped that have not been reported yet */
+static uint32_t binlog_dropped_pending = 0;
+
+/** Append a record to the binary log buffer */
+static void binlog_push(const uint32_t *rec, int nwords)
+{
+	disable_interrupts();
+	uint32_t head = binlog_head;
+	// Records never wrap around: if a record does not fit at the end of the
+	// buffer, the rest of the buffer is skipped with a null format.
+	uint32_t pad = head + nwords > BINLOG_BUFFER_WORDS ? BINLOG_BUFFER_WORDS - head : 0;
+	if (binlog_used + pad + nwords > BINLOG_BUFFER_WORDS) {
+		binlog_dropped_pending++;
+		usblog_stats.binlog_dropped++;
+	} else {
+		if (pad) {
+			binlog_buf[head] = 0;
+			head = 0;
+		}
+		memcpy(binlog_buf + head, rec, nwords * 4);
+		binlog_head = (head + nwords) % BINLOG_BUFFER_WORDS;
+		binlog_used += pad + nwords;
+		usblog_stats.binlog_records++;
+	}
+	enable_interrupts();
+}
+
+/** Send a message with some binary log records. Returns false if nothing could be sent. */
+static bool binlog_drain(void)
+{
+	static bool in_drain = false;
+	static uint32_t msg[BINLOG_CHUNK_SIZE / 4] __attribute__((aligned(8)));
+	if (in_drain || !binlog_buf || !usb_canwrite()) return false;
+	in_drain = true;
+
+	disable_interrupts();
+	uint32_t used = binlog_used;
+	uint32_t dropped = binlog_dropped_pending;
+	binlog_dropped_pending = 0;
+	enable_interrupts();
+
+	// Copy whole records into the message, as long as they fit. Producers
+	// only write outside of the used area, so it can be read freely.
+	uint32_t tail = binlog_tail, consumed = 0;
+	int n = 4;
+	while (consumed < used) {
+		if (binlog_buf[tail] == 0) {
+			consumed += BINLOG_BUFFER_WORDS - tail;
+			tail = 0;
+			continue;
+		}
+		int words = BINLOG_RECORD_HEADER + (binlog_buf[tail + 2] + 3) / 4;
+		if (n + words > BINLOG_CHUNK_SIZE / 4) break;
+		memcpy(msg + n, binlog_buf + tail, words * 4);
+		n += words;
+		consumed += words;
+		tail = (tail + words) % BINLOG_BUFFER_WORDS;
+	}
+
+	if (n > 4 || dropped) {
+		msg[0] = BINLOG_MAGIC;
+		msg[1] = BINLOG_VERSION;
+		msg[2] = n - 4;
+		msg[3] = dropped;
+		usb_write(DATATYPE_RAWBINARY, msg, n * 4);
+	}
+
+	disable_interrupts();
+	binlog_tail = tail;
+	binlog_used -= consumed;
+	enable_interrupts();
+
+	in_drain = false;
+	return n > 4 || dropped;
+}
+
+/** Timer callback: send a chunk of the buffered log */
+static void usblog_timer_callback(int ovfl)
+{
+	usblog_drain(USBLOG_CHUNK_SIZE);
+	binlog_drain();
+}
+
+/** Idle task: send a chunk of the buffered log, if there is time for it */
+static void usblog_idle(void *ctx, uint32_t budget)
+{
+	if (budget >= USBLOG_PERIOD / 2)
+		usblog_timer_callback(0);
+}
+
+/** Send all the buffered log synchronously */
+static void usblog_flush(void)
+{
+	while (usblog_buf && usblog_head != usblog_tail)
+		if (!usblog_drain(USBLOG_BUFFER_SIZE))
+			break;
+	while (binlog_buf && binlog_used)
+		if (!binlog_drain())
+			break;
+}
+
+/** Start draining the log in background, if possible */
+static void usblog_timer_start(void)
+{
+	if (usblog_timer || !usblog_timer_ready || !(enabled_features & DEBUG_FEATURE_LOG_USB))
+		return;
+	if (!usblog_buf) {
+		usblog_buf = malloc(USBLOG_BUFFER_SIZE);
+		if (!usblog_buf) return;
+	}
+	if (!binlog_buf) {
+		binlog_buf = malloc(BINLOG_BUFFER_WORDS * 4);
+		if (!binlog_buf) return;
+	}
+	usblog_timer = new_timer(USBLOG_PERIOD, TF_CONTINUOUS, usblog_timer_callback);
+	// The drain has no deadline, so let the timer coalesce with others
+	timer_set_slack(usblog_timer, USBLOG_PERIOD);
+	// Also use the time spent in long waits
+	idle_register(usblog_idle, NULL);
+}
+
+/** Stop draining the log in background, sending what is left */
+static void usblog_timer_stop(void)
+{
+	if (!usblog_timer)
+		return;
+	idle_unregister(usblog_idle, NULL);
+	delete_timer(usblog_timer);
+	usblog_timer = NULL;
+	usblog_flush();
+}
+
 static void usblog_write(const uint8_t *data, int len)
 {
-	usb_write(DATATYPE_TEXT, data, len);
+	usblog_stats.bytes_written += len;
+
+	// Without the background timer, write synchronously
+	if (!usblog_timer) {
+		usb_write(DATATYPE_TEXT, data, len);
+		return;
+	}
+
+	// Copy the data in the buffer. Messages that do not fit are dropped
+	// entirely, so that the log is never interleaved with partial lines.
+	disable_interrupts();
+	uint32_t head = usblog_head;
+	if (len > USBLOG_BUFFER_SIZE - (head - usblog_tail)) {
+		usblog_dropped_pending += len;
+		usblog_stats.bytes_dropped += len;
+		usblog_stats.writes_dropped++;
+	} else {
+		uint32_t offset = head & (USBLOG_BUFFER_SIZE - 1);
+		uint32_t n = MIN((uint32_t)len, USBLOG_BUFFER_SIZE - offset);
+		memcpy(usblog_buf + offset, data, n);
+		memcpy(usblog_buf, data + n, len - n);
+		usblog_head = head + len;
+	}
+	uint32_t buffered = usblog_head - usblog_tail;
+	if (buffered > usblog_stats.max_buffered)
+		usblog_stats.max_buffered = buffered;
+	enable_interrupts();
+}
+
+void __debug_timer_init(void)
+{
+	usblog_timer_ready = true;
+	usblog_timer_start();
+}
+
+void __debug_timer_close(void)
+{
+	usblog_timer_stop();
+	usblog_timer_ready = false;
+}
+
+static void sdlog_flush(bool sync);
+
+void __debug_flush_sync(void)
+{
+	// Stop the background drain, but do not delete the timer as this might
+	// be called in a fatal context (eg: from an exception handler).
+	timer_link_t *timer = usblog_timer;
+	usblog_timer = NULL;
+	if (timer)
+		usblog_flush();
+
+	// Write the cached SD log, unless the crash happened while writing it,
+	// in which case the filesystem state is unknown.
+	if (sdlog_cache && !sdlog_in_write) {
+		sdlog_flush(true);
+		sdlog_writethrough = true;
+	}
+}
+
+void debug_binlogf(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+
+	// Without the background timer, there is no binary channel: just
+	// format the message as usual.
+	if (!usblog_timer) {
+		vfprintf(stderr, fmt, args);
+		va_end(args);
+		return;
+	}
+
+	uint32_t rec[BINLOG_RECORD_HEADER + BINLOG_MAX_PAYLOAD / 4];
+	uint8_t *p = (uint8_t*)(rec + BINLOG_RECORD_HEADER);
+	uint8_t *end = p + BINLOG_MAX_PAYLOAD;
+
+	// Walk the format string just enough to know the size of each argument,
+	// and store the arguments as they are. Strings are copied, as the host
+	// cannot read them from the ELF file.
+	for (const char *f = fmt; *f && p + 8 <= end; f++) {
+		if (*f != '%') continue;
+		f++;
+		while (*f && strchr("-+ #0", *f)) f++;
+		if (*f == '*') { int v = va_arg(args, int); memcpy(p, &v, 4); p += 4; f++; }
+		while (*f >= '0' && *f <= '9') f++;
+		if (*f == '.') {
+			f++;
+			if (*f == '*') { int v = va_arg(args, int); memcpy(p, &v, 4); p += 4; f++; }
+			while (*f >= '0' && *f <= '9') f++;
+		}
+		// Only long long and intmax_t are 64-bit; long is 32-bit
+		bool is64 = false;
+		for (int longs = 0; *f && strchr("hlLqjzt", *f); f++) {
+			if (*f == 'l' && ++longs == 2) is64 = true;
+			if (*f == 'q' || *f == 'j') is64 = true;
+		}
+		if (p + 8 > end) break;
+		switch (*f) {
+		case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+			if (is64) {
+				long long v = va_arg(args, long long);
+				memcpy(p, &v, 8); p += 8;
+			} else {
+				int v = va_arg(args, int);
+				memcpy(p, &v, 4); p += 4;
+			}
+			break;
+		case 'p': {
+			void *v = va_arg(args, void*);
+			memcpy(p, &v, 4); p += 4;
+			break;
+		}
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+			double v = va_arg(args, double);
+			memcpy(p, &v, 8); p += 8;
+			break;
+		}
+		case 's': {
+			const char *s = va_arg(args, const char*);
+			if (!s) s = "(null)";
+			uint32_t len = strnlen(s, end - p - 4);
+			memcpy(p, &len, 4);
+			memcpy(p + 4, s, len);
+			p += 4 + ROUND_UP(len, 4);
+			break;
+		}
+		case 0:
+			f--;
+			break;
+		default:
+			// %% or unsupported conversion (eg: %n): no argument
+			break;
+		}
+	}
+	va_end(args);
+
+	uint32_t size = p - (uint8_t*)(rec + BINLOG_RECORD_HEADER);
+	rec[0] = (uint32_t)fmt;
+	rec[1] = TICKS_READ();
+	rec[2] = size;
+	binlog_push(rec, BINLOG_RECORD_HEADER + (size + 3) / 4);
+}
+
+void debug_get_usblog_stats(debug_usblog_stats_t *stats)
+{
+	disable_interrupts();
+	*stats = usblog_stats;
+	stats->buffered = usblog_head - usblog_tail;
+	enable_interrupts();
+}
+
+/**
+ * @brief Write the cached SD log to the file
+ *
+ * @param sync      If true, also update the directory entry and the FAT, so
+ *                  that the log is readable even if the program never exits.
+ */
+static void sdlog_flush(bool sync)
+{
+	if (sdlog_cached) {
+		UINT written;
+		f_write(&sdlog_fil, sdlog_cache, sdlog_cached, &written);
+		sdlog_cached = 0;
+	}
+	if (sync) {
+		f_sync(&sdlog_fil);
+		sdlog_flush_ticks = TICKS_READ();
+	}
 }
 
 static void sdlog_write(const uint8_t *data, int len)
@@ -134,12 +535,28 @@ static void sdlog_write(const uint8_t *data, int len)
 	// Avoid reentrant calls. If the SD card code for any reason generates
 	// an exception, the exception handler will try to log more, which would
 	// cause reentrant calls, that might corrupt the filesystem.
-	static bool in_write = false;
-	if (in_write) return;
+	if (sdlog_in_write) return;
 
-	in_write = true;
-	fwrite(data, 1, len, sdlog_file);
-	in_write = false;
+	sdlog_in_write = true;
+	if (!sdlog_cache) {
+		fwrite(data, 1, len, sdlog_file);
+	} else {
+		// Accumulate the log in RAM, and write it in big chunks, to avoid
+		// a read-modify-write of a sector (and possibly a FAT update) for
+		// each line.
+		while (len > 0) {
+			int n = MIN(len, SDLOG_CACHE_SIZE - sdlog_cached);
+			memcpy(sdlog_cache + sdlog_cached, data, n);
+			sdlog_cached += n;
+			data += n;
+			len -= n;
+			if (sdlog_cached == SDLOG_CACHE_SIZE)
+				sdlog_flush(false);
+		}
+		if (sdlog_writethrough || TICKS_SINCE(sdlog_flush_ticks) > SDLOG_FLUSH_PERIOD)
+			sdlog_flush(true);
+	}
+	sdlog_in_write = false;
 }
 
 /*********************************************************************
@@ -277,9 +694,37 @@ static fat_disk_t fat_disk_sd =
 
 /** Maximum number of FAT files that can be concurrently opened */
 #define MAX_FAT_FILES 4
+/** Initial size of the cluster link map table of O_FASTSEEK files, in DWORDs */
+#define FAT_CLMT_INITIAL_SIZE 32
 static FIL fat_files[MAX_FAT_FILES] = {0};
 static DIR find_dir;
 
+/**
+ * Build the cluster link map table of a file, so that seeking does not need
+ * to walk the FAT chain. If this fails, the file is just accessed normally.
+ */
+static void __fat_create_linkmap(FIL *f)
+{
+	int size = FAT_CLMT_INITIAL_SIZE;
+	while (1) {
+		DWORD *tbl = malloc(size * sizeof(DWORD));
+		if (!tbl)
+			break;
+		tbl[0] = size;
+		f->cltbl = tbl;
+		FRESULT res = f_lseek(f, CREATE_LINKMAP);
+		if (res == FR_OK)
+			return;
+		/* If the table was too small, FatFs stored the required size */
+		size = tbl[0];
+		f->cltbl = NULL;
+		free(tbl);
+		if (res != FR_NOT_ENOUGH_CORE)
+			break;
+	}
+	debugf("[debug] fat: cannot create the link map, fast seek disabled\n");
+}
+
 static void *__fat_open(char *name, int flags)
 {
 	int i;
@@ -314,6 +759,9 @@ static void *__fat_open(char *name, int flags)
 		fat_files[i].obj.fs = NULL;
 		return NULL;
 	}
+
+	if ((flags & O_FASTSEEK) && (flags & O_ACCMODE) == O_RDONLY)
+		__fat_create_linkmap(&fat_files[i]);
 	return &fat_files[i];
 }
 
@@ -333,15 +781,89 @@ static int __fat_fstat(void *file, struct stat *st)
 	return 0;
 }
 
-static int __fat_read(void *file, uint8_t *ptr, int len)
+static int __fat_read_buffered(FIL *f, uint8_t *ptr, int len)
 {
 	UINT read;
-	FRESULT res = f_read(file, ptr, len, &read);
+	FRESULT res = f_read(f, ptr, len, &read);
 	if (res != FR_OK)
 		debugf("[debug] fat: error reading file: %d\n", res);
 	return read;
 }
 
+/**
+ * Read whole sectors of a file with a link map (see O_FASTSEEK), issuing one
+ * disk read for each run of contiguous clusters. FatFs would instead split
+ * the transfer at each cluster boundary. The file position must be sector
+ * aligned, and len a multiple of the sector size.
+ */
+static int __fat_read_direct(FIL *f, uint8_t *ptr, int len)
+{
+	FATFS *fs = f->obj.fs;
+	int total = 0;
+
+	while (len > 0) {
+		FSIZE_t pos = f_tell(f);
+		DWORD sect = pos / FF_MAX_SS;
+		DWORD clst = sect / fs->csize;
+		sect %= fs->csize;
+
+		/* Find the run that contains the cluster: the table is a list
+		   of (length, first cluster) pairs, terminated by 0. */
+		DWORD *tbl = f->cltbl + 1;
+		while (tbl[0] && clst >= tbl[0]) {
+			clst -= tbl[0];
+			tbl += 2;
+		}
+		if (!tbl[0])
+			break;
+
+		DWORD run = (tbl[0] - clst) * fs->csize - sect;
+		DWORD count = len / FF_MAX_SS;
+		if (count > run) count = run;
+		LBA_t lba = fs->database + (LBA_t)fs->csize * (tbl[1] + clst - 2) + sect;
+
+		if (disk_read(fs->pdrv, ptr, lba, count) != RES_OK) {
+			debugf("[debug] fat: error reading file at sector %ld\n", (long)lba);
+			break;
+		}
+		ptr += count * FF_MAX_SS;
+		len -= count * FF_MAX_SS;
+		total += count * FF_MAX_SS;
+		f_lseek(f, pos + count * FF_MAX_SS);
+	}
+	return total;
+}
+
+static int __fat_read(void *file, uint8_t *ptr, int len)
+{
+	FIL *f = file;
+	if (!f->cltbl)
+		return __fat_read_buffered(f, ptr, len);
+
+	FSIZE_t remaining = f_size(f) - f_tell(f);
+	if (len > remaining) len = remaining;
+
+	/* Read up to the next sector boundary via the file buffer, then the
+	   whole sectors directly, and finally the tail via the buffer again */
+	int head = (FF_MAX_SS - f_tell(f) % FF_MAX_SS) % FF_MAX_SS;
+	if (head > len) head = len;
+	int total = head ? __fat_read_buffered(f, ptr, head) : 0;
+	if (total < head)
+		return total;
+
+	int body = (len - total) & ~(FF_MAX_SS - 1);
+	if (body) {
+		int n = __fat_read_direct(f, ptr + total, body);
+		total += n;
+		if (n < body)
+			return total;
+	}
+
+	if (total < len)
+		total += __fat_read_buffered(f, ptr + total, len - total);
+	return total;
+}
+
 static int __fat_write(void *file, uint8_t *ptr, int len)
 {
 	UINT written;
@@ -353,7 +875,11 @@ static int __fat_write(void *file, uint8_t *ptr, int len)
 
 static int __fat_close(void *file)
 {
-	FRESULT res = f_close(file);
+	FIL *f = file;
+	DWORD *cltbl = f->cltbl;
+	FRESULT res = f_close(f);
+	free(cltbl);
+	f->cltbl = NULL;
 	if (res != FR_OK)
 		return -1;
 	return 0;
@@ -495,6 +1021,7 @@ bool debug_init_usblog(void)
 	hook_init_once();
 	debug_writer[0] = usblog_write;
 	enabled_features |= DEBUG_FEATURE_LOG_USB;
+	usblog_timer_start();
 	return true;
 }
 
@@ -510,6 +1037,30 @@ bool debug_init_isviewer(void)
 
 bool debug_init_sdlog(const char *fn, const char *openfmt)
 {
+	// Files on the SD filesystem are accessed directly via FatFs, with a
+	// write-back cache. Other files go through stdio.
+	int prefix_len = strlen(sdfs_prefix);
+	if ((enabled_features & DEBUG_FEATURE_FILE_SD) && !sdlog_file && !sdlog_cache &&
+		prefix_len && strncmp(fn, sdfs_prefix, prefix_len) == 0 &&
+		(strcmp(openfmt, "a") == 0 || strcmp(openfmt, "w") == 0))
+	{
+		BYTE mode = FA_WRITE | (openfmt[0] == 'a' ? FA_OPEN_APPEND : FA_CREATE_ALWAYS);
+		uint8_t *cache = malloc(SDLOG_CACHE_SIZE);
+		if (!cache)
+			return false;
+		if (f_open(&sdlog_fil, fn + prefix_len, mode) != FR_OK) {
+			free(cache);
+			return false;
+		}
+		sdlog_cache = cache;
+		sdlog_cached = 0;
+		sdlog_flush_ticks = TICKS_READ();
+
+		hook_init_once();
+		debug_writer[2] = sdlog_write;
+		return true;
+	}
+
 	sdlog_file = fopen(fn, openfmt);
 	if (!sdlog_file)
 		return false;
@@ -551,6 +1102,13 @@ void debug_close_sdfs(void)
 {
 	if (enabled_features & DEBUG_FEATURE_FILE_SD)
 	{
+		if (sdlog_cache) {
+			debug_writer[2] = NULL;
+			sdlog_flush(false);
+			f_close(&sdlog_fil);
+			free(sdlog_cache);
+			sdlog_cache = NULL;
+		}
 		detach_filesystem(sdfs_prefix);
 		f_mount(NULL, sdfs_logic_drive, 0);
 	}
@@ -560,6 +1118,10 @@ void debug_assert_func_f(const char *file, int line, const char *func, const cha
 {
 	disable_interrupts();
 
+	// Interrupts will not be reenabled, so send the buffered log now, and
+	// write the assertion synchronously.
+	__debug_flush_sync();
+
 	// As first step, immediately print the assertion on stderr. This is
 	// very likely to succeed as it should not cause any further allocations
 	// and we would display the assertion immediately on logs.
@@ -654,6 +1216,11 @@ void debug_backtrace(void)
 #else
 
 #include <stdlib.h>
+#include "debug_internal.h"
+
+void __debug_timer_init(void) {}
+void __debug_timer_close(void) {}
+void __debug_flush_sync(void) {}
 
 void debug_assert_func(...) {
 	abort();
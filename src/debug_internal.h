@@ -0,0 +1,21 @@
+#ifndef __LIBDRAGON_DEBUG_INTERNAL_H
+#define __LIBDRAGON_DEBUG_INTERNAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Notify the debug library that the timer subsystem was initialized */
+void __debug_timer_init(void);
+
+/** @brief Notify the debug library that the timer subsystem is being closed */
+void __debug_timer_close(void);
+
+/** @brief Send buffered logs, and switch to synchronous logging (for fatal errors) */
+void __debug_flush_sync(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -16,6 +16,11 @@
 #include "debug.h"
 #include "surface.h"
 #include "rsp.h"
+#include "rdp.h"
+#include "kernel.h"
+#include "prof_zone.h"
+#include "boot_profile_internal.h"
+#include "usb.h"
 
 /** @brief Maximum number of video backbuffers */
 #define NUM_BUFFERS         32
@@ -38,6 +43,67 @@ static int now_showing = -1;
 static uint32_t drawing_mask = 0;
 /** @brief Bitmask of surfaces that are ready to be shown */
 static volatile uint32_t ready_mask = 0;
+/** @brief Threads waiting in #display_get for a buffer to be released */
+static kwaitq_t display_waitq;
+/** @brief Size of the surfaces returned by the next #display_get (dynamic resolution) */
+static uint32_t __render_width, __render_height;
+/** @brief Size of the framebuffer currently programmed in the VI */
+static uint32_t vi_width, vi_height;
+/** @brief Dynamic resolution governor (or NULL) */
+static display_governor_t governor = NULL;
+/** @brief Time of the last #display_get, to measure frame time for the governor */
+static uint32_t last_get_ticks;
+/** @brief Size in pixels of the square tiles used to track dirty regions */
+#define DIRTY_TILE          16
+/** @brief Maximum number of tile rows (720 / 16) */
+#define DIRTY_MAX_ROWS      45
+/** @brief True if partial updates are enabled (see #display_set_partial_updates) */
+static bool partial_updates = false;
+/** @brief Dirty tiles of each buffer, one 64-bit mask per row of tiles */
+static uint64_t (*dirty)[DIRTY_MAX_ROWS] = NULL;
+/** @brief Sequence number of the last #display_show of each buffer (0 = never shown) */
+static uint32_t shown_seq[NUM_BUFFERS];
+/** @brief Sequence number of the last #display_show */
+static uint32_t last_seq = 0;
+/** @brief Minimum number of vblanks between two frames */
+static uint32_t refresh_divisor = 1;
+/** @brief Presentation mode of the ready frames */
+static display_present_mode_t present_mode = DISPLAY_PRESENT_FIFO;
+/** @brief Number of vblanks since the last frame was shown */
+static uint32_t vblanks_since_flip = 0;
+/** @brief Frame pacing statistics */
+static display_stats_t stats;
+/** @brief True if the buffers are cleared by the RDP in #display_get */
+static bool auto_clear = false;
+/** @brief Color used to clear the buffers (see #display_set_auto_clear) */
+static uint32_t auto_clear_color;
+/** @brief Maximum number of vblank callbacks */
+#define MAX_VBLANK_CALLBACKS    4
+/** @brief Callbacks registered with #display_on_vblank */
+static struct {
+    display_vblank_cb_t cb;
+    void *arg;
+} vblank_cbs[MAX_VBLANK_CALLBACKS];
+/** @brief VI timing, updated at each vblank */
+static display_vi_timing_t vi_timing;
+/** @brief Size in pixels of the square tiles compared by #DISPLAY_CAPTURE_DELTA */
+#define CAPTURE_TILE        16
+/** @brief Number of captured frames between two full frames in delta mode */
+#define CAPTURE_KEY_INTERVAL    60
+/** @brief State of the USB capture (see #display_capture_start) */
+static struct {
+    uint32_t divisor;       ///< Capture one frame every divisor (0 = capture disabled)
+    uint32_t flags;         ///< DISPLAY_CAPTURE_* flags
+    uint32_t counter;       ///< Frames shown since the last captured one
+    int pending;            ///< Index of the surface to send, or -1
+    uint32_t seq;           ///< Number of frames sent
+    uint32_t skipped;       ///< Number of frames skipped
+    uint8_t *half;          ///< Downsampled frame (#DISPLAY_CAPTURE_HALF)
+    uint8_t *prev;          ///< Previous frame sent (#DISPLAY_CAPTURE_DELTA)
+    uint8_t *delta;         ///< Encoded delta frame (#DISPLAY_CAPTURE_DELTA)
+    uint32_t prev_width;    ///< Width of the frame in prev (0 = none)
+    uint32_t prev_height;   ///< Height of the frame in prev
+} capture = { .pending = -1 };
 
 /** @brief Get the next buffer index (with wraparound) */
 static inline int buffer_next(int idx) {
@@ -54,24 +120,68 @@ static inline int buffer_next(int idx) {
  */
 static void __display_callback()
 {
+    uint32_t now = TICKS_READ();
+    if (vi_timing.vblank_count)
+        vi_timing.frame_ticks = TICKS_DISTANCE(vi_timing.vblank_ticks, now);
+    vi_timing.vblank_ticks = now;
+    vi_timing.vblank_count++;
+
     /* Least significant bit of the current line register indicates
        if the currently displayed field is odd or even. */
     bool field = (*VI_V_CURRENT) & 1;
     bool interlaced = (*VI_CTRL) & (VI_CTRL_SERRATE);
 
     /* Check if the next buffer is ready to be displayed, otherwise just
-       leave up the current frame */
+       leave up the current frame. With a refresh divisor, each frame is
+       left up for at least that many vblanks. */
     int next = buffer_next(now_showing);
-    if (ready_mask & (1 << next)) {
-        now_showing = next;
-        ready_mask &= ~(1 << next);
+    if (++vblanks_since_flip >= refresh_divisor) {
+        if (ready_mask & (1 << next)) {
+            /* In latest-frame-wins mode, skip to the last of the consecutive
+               ready frames, recycling the older ones without showing them */
+            if (present_mode == DISPLAY_PRESENT_LATEST) {
+                while (buffer_next(next) != now_showing && (ready_mask & (1 << buffer_next(next)))) {
+                    ready_mask &= ~(1 << next);
+                    stats.frames_dropped++;
+                    next = buffer_next(next);
+                }
+            }
+            now_showing = next;
+            ready_mask &= ~(1 << next);
+            vblanks_since_flip = 0;
+            stats.frames_shown++;
+            vi_timing.flip_ticks = now;
+            vi_timing.flip_count = vi_timing.vblank_count;
+
+            /* Reprogram the scaling if the frame was rendered at a different size */
+            surface_t *surf = &surfaces[now_showing];
+            if (surf->width != vi_width || surf->height != vi_height) {
+                vi_width = surf->width;
+                vi_height = surf->height;
+                vi_write_safe(VI_WIDTH, vi_width);
+                vi_write_safe(VI_X_SCALE, VI_X_SCALE_SET(vi_width));
+                vi_write_safe(VI_Y_SCALE, VI_Y_SCALE_SET(vi_height));
+            }
+        } else if (drawing_mask) {
+            /* A frame is being drawn but was not ready in time */
+            stats.vblanks_missed++;
+        }
     }
 
-    vi_write_dram_register(__safe_buffer[now_showing] + (interlaced && !field ? __width * __bitdepth : 0));
+    vi_write_dram_register(__safe_buffer[now_showing] + (interlaced && !field ? surfaces[now_showing].stride : 0));
+
+    /* Run the callbacks after the flip, so that they see the new frame */
+    for (int i = 0; i < MAX_VBLANK_CALLBACKS; i++)
+        if (vblank_cbs[i].cb)
+            vblank_cbs[i].cb(vblank_cbs[i].arg);
+
+    /* Wake up threads waiting for a buffer in display_get */
+    kwaitq_wake_all(&display_waitq);
 }
 
 void display_init( resolution_t res, bitdepth_t bit, uint32_t num_buffers, gamma_t gamma, filter_options_t filters )
 {
+    uint32_t t0 = TICKS_READ();
     uint32_t tv_type = get_tv_type();
     uint32_t control = !sys_bbplayer()? VI_PIXEL_ADVANCE_DEFAULT : VI_PIXEL_ADVANCE_BBPLAYER;
 
@@ -205,6 +315,9 @@ void display_init( resolution_t res, bitdepth_t bit, uint32_t num_buffers, gamma
     __width = res.width;
     __height = res.height;
     __bitdepth = ( bit == DEPTH_16_BPP ) ? 2 : 4;
+    __render_width = vi_width = __width;
+    __render_height = vi_height = __height;
+    governor = NULL;
 
     surfaces = malloc(sizeof(surface_t) * __buffers);
 
@@ -226,6 +339,11 @@ void display_init( resolution_t res, bitdepth_t bit, uint32_t num_buffers, gamma
     now_showing = 0;
     drawing_mask = 0;
     ready_mask = 0;
+    vblanks_since_flip = 0;
+    memset(&stats, 0, sizeof(stats));
+    memset(&vi_timing, 0, sizeof(vi_timing));
+    memset(shown_seq, 0, sizeof(shown_seq));
+    last_seq = 0;
 
     /* Show our screen normally. If display is already active, do that during vblank
        to avoid confusing the VI chip with in-frame modifications. */
@@ -238,10 +356,13 @@ void display_init( resolution_t res, bitdepth_t bit, uint32_t num_buffers, gamma
     /* Set which line to call back on in order to flip screens */
     register_VI_handler( __display_callback );
     set_VI_interrupt( 1, VI_V_CURRENT_VBLANK );
+    __boot_profile_record( "display_init", t0 );
 }
 
 void display_close()
 {
+    display_capture_stop();
+
     /* Can't have the video interrupt happening here */
     disable_interrupts();
 
@@ -255,6 +376,11 @@ void display_close()
     __width = 0;
     __height = 0;
 
+    free(dirty);
+    dirty = NULL;
+    partial_updates = false;
+    auto_clear = false;
+
     /* If display is active, wait for vblank before touching the registers */
     if( vi_is_active() ) { vi_wait_for_vblank(); }
 
@@ -276,10 +402,176 @@ void display_close()
     enable_interrupts();
 }
 
+/**
+ * @brief Bring a buffer up to date with the last shown frame, before drawing on it
+ *
+ * The buffer contains the frame it was last drawn with. The regions drawn in
+ * the frames that were shown afterwards are copied from the newest of them,
+ * so that the application only needs to redraw what changes in the new frame.
+ *
+ * @param[in] idx
+ *            Index of the buffer
+ */
+static void __display_refresh_clean(int idx)
+{
+    /* Find the newest shown frame, and what changed since this buffer was drawn */
+    uint64_t changed[DIRTY_MAX_ROWS] = {0};
+    int src = -1;
+    for (int i = 0; i < __buffers; i++) {
+        if (i == idx || (drawing_mask & (1 << i)) || shown_seq[i] <= shown_seq[idx])
+            continue;
+        if (src < 0 || shown_seq[i] > shown_seq[src])
+            src = i;
+        for (int r = 0; r < DIRTY_MAX_ROWS; r++)
+            changed[r] |= dirty[i][r];
+    }
+    memset(dirty[idx], 0, sizeof(dirty[idx]));
+    if (src < 0 || surfaces[src].stride != surfaces[idx].stride)
+        return;
+
+    /* Copy the changed tiles, merging horizontal runs */
+    int stride = surfaces[idx].stride;
+    int height = surfaces[idx].height;
+    int tile_bytes = DIRTY_TILE * __bitdepth;
+    for (int r = 0; r < DIRTY_MAX_ROWS && r * DIRTY_TILE < height; r++) {
+        uint64_t mask = changed[r];
+        while (mask) {
+            int t0 = __builtin_ctzll(mask);
+            int t1 = t0;
+            while (t1 < 64 && (mask & (1ull << t1))) t1++;
+            mask &= ~((t1 == 64 ? ~0ull : (1ull << t1) - 1) & ~((1ull << t0) - 1));
+
+            int x0 = t0 * tile_bytes;
+            int len = MIN(t1 * tile_bytes, stride) - x0;
+            int y1 = MIN((r + 1) * DIRTY_TILE, height);
+            for (int y = r * DIRTY_TILE; y < y1 && len > 0; y++)
+                memcpy(surfaces[idx].buffer + y * stride + x0, surfaces[src].buffer + y * stride + x0, len);
+        }
+    }
+}
+
+/** @brief Downsample a frame by 2 into the capture buffer */
+static void capture_half(const uint8_t *src, int stride, int bpp, int width, int height)
+{
+    for (int y = 0; y < height; y++) {
+        const uint8_t *s = src + y * 2 * stride;
+        if (bpp == 2) {
+            uint16_t *d = (uint16_t*)(capture.half + y * width * 2);
+            for (int x = 0; x < width; x++) d[x] = ((const uint16_t*)s)[x*2];
+        } else {
+            uint32_t *d = (uint32_t*)(capture.half + y * width * 4);
+            for (int x = 0; x < width; x++) d[x] = ((const uint32_t*)s)[x*2];
+        }
+    }
+}
+
+/** @brief Encode the tiles of a frame that changed since the previous one */
+static int capture_delta(const uint8_t *src, int stride, int bpp, int width, int height)
+{
+    int tiles_x = (width + CAPTURE_TILE - 1) / CAPTURE_TILE;
+    int tiles_y = (height + CAPTURE_TILE - 1) / CAPTURE_TILE;
+    uint32_t *bitmap = (uint32_t*)capture.delta;
+    int bitmap_words = (tiles_x * tiles_y + 31) / 32;
+    memset(bitmap, 0, bitmap_words * 4);
+    uint8_t *out = capture.delta + bitmap_words * 4;
+    int prev_stride = width * bpp;
+
+    for (int ty = 0; ty < tiles_y; ty++) {
+        int rows = MIN(CAPTURE_TILE, height - ty * CAPTURE_TILE);
+        for (int tx = 0; tx < tiles_x; tx++) {
+            int row_bytes = MIN(CAPTURE_TILE, width - tx * CAPTURE_TILE) * bpp;
+            const uint8_t *s = src + ty * CAPTURE_TILE * stride + tx * CAPTURE_TILE * bpp;
+            uint8_t *p = capture.prev + ty * CAPTURE_TILE * prev_stride + tx * CAPTURE_TILE * bpp;
+
+            int y = 0;
+            while (y < rows && memcmp(s + y * stride, p + y * prev_stride, row_bytes) == 0)
+                y++;
+            if (y == rows)
+                continue;
+
+            int t = ty * tiles_x + tx;
+            bitmap[t / 32] |= 0x80000000 >> (t & 31);
+            for (y = 0; y < rows; y++) {
+                memcpy(out, s + y * stride, row_bytes);
+                memcpy(p + y * prev_stride, s + y * stride, row_bytes);
+                out += row_bytes;
+            }
+        }
+    }
+    /* Keep the payload size a multiple of 8, as the USB transfers are padded */
+    return ROUND_UP(out - capture.delta, 8);
+}
+
+/** @brief Send over USB the frame marked by #display_show for capture */
+static void capture_send(void)
+{
+    disable_interrupts();
+    int i = capture.pending;
+    capture.pending = -1;
+    /* Skip the frame if the buffer was recycled in the meantime */
+    bool valid = i >= 0 && !(drawing_mask & (1 << i));
+    enable_interrupts();
+    if (!valid) return;
+
+    if (!usb_canwrite()) {
+        capture.skipped++;
+        return;
+    }
+
+    surface_t *surf = &surfaces[i];
+    int bpp = TEX_FORMAT_BITDEPTH(surface_get_format(surf)) / 8;
+    int width = surf->width, height = surf->height, stride = surf->stride;
+    const uint8_t *frame = surf->buffer;
+    uint32_t flags = capture.flags & DISPLAY_CAPTURE_HALF;
+    int size = stride * height;
+
+    if (capture.flags & (DISPLAY_CAPTURE_HALF | DISPLAY_CAPTURE_DELTA)) {
+        /* Process the frame via the cache, which is much faster than uncached reads */
+        frame = CachedAddr(frame);
+        data_cache_hit_writeback_invalidate((void*)frame, size);
+    }
+    if (capture.flags & DISPLAY_CAPTURE_HALF) {
+        width /= 2; height /= 2;
+        capture_half(frame, stride, bpp, width, height);
+        frame = capture.half;
+        stride = width * bpp;
+        size = stride * height;
+    }
+    if (capture.flags & DISPLAY_CAPTURE_DELTA) {
+        if (width == capture.prev_width && height == capture.prev_height &&
+            capture.seq % CAPTURE_KEY_INTERVAL != 0) {
+            size = capture_delta(frame, stride, bpp, width, height);
+            frame = capture.delta;
+            flags |= DISPLAY_CAPTURE_DELTA;
+        } else {
+            for (int y = 0; y < height; y++)
+                memcpy(capture.prev + y * width * bpp, frame + y * stride, width * bpp);
+            capture.prev_width = width;
+            capture.prev_height = height;
+        }
+    }
+
+    static uint32_t header[8] __attribute__((aligned(8)));
+    header[0] = DISPLAY_CAPTURE_MAGIC;
+    header[1] = DISPLAY_CAPTURE_VERSION;
+    header[2] = capture.seq++;
+    header[3] = flags;
+    header[4] = width;
+    header[5] = height;
+    header[6] = (bpp << 16) | stride;
+    header[7] = size;
+    usb_write(DATATYPE_RAWBINARY, header, sizeof(header));
+    if (size)
+        usb_write(DATATYPE_RAWBINARY, frame, size);
+}
+
 surface_t* display_try_get(void)
 {
     surface_t* retval = NULL;
-    int next;
+    int next, refresh = -1;
+
+    if (capture.pending >= 0)
+        capture_send();
 
     /* Can't have the video interrupt happening here */
     disable_interrupts();
@@ -296,6 +588,19 @@ surface_t* display_try_get(void)
         if (((drawing_mask | ready_mask) & (1 << next)) == 0)  {
             retval = &surfaces[next];
             drawing_mask |= 1 << next;
+
+            /* Apply the current render size (the buffer is allocated for the full size) */
+            surface_t old = *retval;
+            retval->width = __render_width;
+            retval->height = __render_height;
+            retval->stride = __render_width * __bitdepth;
+
+            if (partial_updates && !auto_clear) {
+                if (old.stride == retval->stride && old.height == retval->height)
+                    refresh = next;
+                else
+                    memset(dirty[next], 0xFF, sizeof(dirty[next]));
+            }
             break;
         }
         next = buffer_next(next);
@@ -303,6 +608,14 @@ surface_t* display_try_get(void)
 
     enable_interrupts();
 
+    /* Copy the clean regions outside of the critical section */
+    if (refresh >= 0)
+        __display_refresh_clean(refresh);
+
+    /* Queue the clear to the RDP, so that it runs in the background */
+    if (retval && auto_clear)
+        rdp_clear_surface(retval, auto_clear_color);
+
     /* Possibility of returning nothing, or a valid display context */
     return retval;
 }
@@ -313,11 +626,29 @@ surface_t* display_get(void)
     // it is common for display to become ready again after RSP+RDP
     // have finished processing the previous frame's commands.
     surface_t* disp;
+    if (capture.pending >= 0)
+        capture_send();
+    uint32_t t0 = TICKS_READ();
+
+    // Let the governor pick the size of the next frame from the frame time
+    if (governor) {
+        uint32_t w = __render_width, h = __render_height;
+        governor(TICKS_DISTANCE(last_get_ticks, t0), &w, &h);
+        display_set_render_size(MIN(w, __width), MIN(h, __height));
+    }
+    last_get_ticks = t0;
+
     RSP_WAIT_LOOP(200) {
+         uint32_t seq = kwaitq_seq(&display_waitq);
          if ((disp = display_try_get())) {
              break;
          }
+         // Buffers are released by the vblank interrupt: if the kernel is
+         // active, let other threads run until then.
+         kwaitq_wait(&display_waitq, seq);
     }
+    stats.wait_ticks = TICKS_SINCE(t0);
+    stats.wait_ticks_total += stats.wait_ticks;
     return disp;
 }
 
@@ -342,6 +673,15 @@ void display_show( surface_t* surf )
 
     drawing_mask &= ~(1 << i);
     ready_mask |= 1 << i;
+    shown_seq[i] = ++last_seq;
+    if (capture.divisor && ++capture.counter >= capture.divisor) {
+        capture.counter = 0;
+        if (capture.pending >= 0)
+            capture.skipped++;
+        capture.pending = i;
+    }
+    prof_zone_frame();
+    __boot_profile_frame();
 
     enable_interrupts();
 }
@@ -363,6 +703,7 @@ void display_show_force( display_context_t disp )
     /* Can't have the video interrupt screwing this up */
     disable_interrupts();
     display_show(disp);
+    vblanks_since_flip = refresh_divisor;
     __display_callback();
     enable_interrupts();
 }
@@ -386,3 +727,169 @@ uint32_t display_get_num_buffers(void)
 {
     return __buffers;
 }
+
+void display_set_frame_pacing(uint32_t divisor, display_present_mode_t mode)
+{
+    assertf(divisor >= 1, "invalid refresh divisor: %ld", divisor);
+
+    disable_interrupts();
+    refresh_divisor = divisor;
+    present_mode = mode;
+    enable_interrupts();
+}
+
+void display_get_stats(display_stats_t *out)
+{
+    disable_interrupts();
+    *out = stats;
+    out->queue_depth = __builtin_popcount(ready_mask);
+    enable_interrupts();
+}
+
+void display_reset_stats(void)
+{
+    disable_interrupts();
+    memset(&stats, 0, sizeof(stats));
+    enable_interrupts();
+}
+
+void display_set_auto_clear(bool enable, uint32_t color)
+{
+    auto_clear = enable;
+    auto_clear_color = color;
+}
+
+void display_get_vi_timing(display_vi_timing_t *out)
+{
+    disable_interrupts();
+    *out = vi_timing;
+    enable_interrupts();
+}
+
+uint32_t display_get_scanline(void)
+{
+    return *VI_V_CURRENT >> 1;
+}
+
+void display_on_vblank(display_vblank_cb_t cb, void *arg)
+{
+    disable_interrupts();
+    for (int i = 0; i < MAX_VBLANK_CALLBACKS; i++) {
+        if (!vblank_cbs[i].cb) {
+            vblank_cbs[i].arg = arg;
+            vblank_cbs[i].cb = cb;
+            enable_interrupts();
+            return;
+        }
+    }
+    enable_interrupts();
+    assertf(0, "too many vblank callbacks (max %d)", MAX_VBLANK_CALLBACKS);
+}
+
+void display_remove_vblank(display_vblank_cb_t cb, void *arg)
+{
+    disable_interrupts();
+    for (int i = 0; i < MAX_VBLANK_CALLBACKS; i++) {
+        if (vblank_cbs[i].cb == cb && vblank_cbs[i].arg == arg) {
+            vblank_cbs[i].cb = NULL;
+            vblank_cbs[i].arg = NULL;
+        }
+    }
+    enable_interrupts();
+}
+
+void display_set_render_size(uint32_t width, uint32_t height)
+{
+    assertf(width > 0 && width <= __width && height > 0 && height <= __height,
+        "invalid render size %ldx%ld (display is %ldx%ld)", width, height, __width, __height);
+    if (__bitdepth == 2)
+        width &= ~3;
+    else
+        width &= ~1;
+    __render_width = MAX(width, 4);
+    __render_height = height;
+}
+
+void display_set_governor(display_governor_t gov)
+{
+    governor = gov;
+    last_get_ticks = TICKS_READ();
+}
+
+void display_set_partial_updates(bool enable)
+{
+    disable_interrupts();
+    if (enable && !dirty) {
+        dirty = malloc(sizeof(*dirty) * __buffers);
+        /* Each buffer starts as a copy of nothing: assume all is dirty */
+        memset(dirty, 0xFF, sizeof(*dirty) * __buffers);
+    }
+    partial_updates = enable;
+    enable_interrupts();
+}
+
+void display_mark_dirty(surface_t *surf, int x, int y, int width, int height)
+{
+    if (!partial_updates) return;
+
+    int i = surf - surfaces;
+    if (i < 0 || i >= __buffers) return;
+
+    /* Clip to the surface */
+    if (x < 0) { width += x; x = 0; }
+    if (y < 0) { height += y; y = 0; }
+    if (x + width > surf->width) width = surf->width - x;
+    if (y + height > surf->height) height = surf->height - y;
+    if (width <= 0 || height <= 0) return;
+
+    int t0 = x / DIRTY_TILE, t1 = MIN((x + width - 1) / DIRTY_TILE, 63);
+    uint64_t mask = ((t1 == 63 ? ~0ull : (1ull << (t1 + 1)) - 1)) & ~((1ull << t0) - 1);
+    for (int r = y / DIRTY_TILE; r <= (y + height - 1) / DIRTY_TILE && r < DIRTY_MAX_ROWS; r++)
+        dirty[i][r] |= mask;
+}
+
+void display_capture_start(uint32_t divisor, uint32_t flags)
+{
+    assertf(surfaces, "display not initialized");
+    assertf(divisor >= 1, "invalid capture divisor: %ld", divisor);
+    display_capture_stop();
+
+    /* The buffers are allocated for the full resolution, to also fit the
+       frames rendered at a smaller size (see #display_set_render_size) */
+    int size = __width * __height * __bitdepth;
+    if (flags & DISPLAY_CAPTURE_HALF) {
+        size /= 4;
+        capture.half = memalign(16, size);
+        assertf(capture.half, "out of memory allocating the capture buffer");
+    }
+    if (flags & DISPLAY_CAPTURE_DELTA) {
+        int tiles = ((__width + CAPTURE_TILE - 1) / CAPTURE_TILE) * ((__height + CAPTURE_TILE - 1) / CAPTURE_TILE);
+        capture.prev = memalign(16, size);
+        capture.delta = memalign(16, (tiles + 31) / 32 * 4 + size + 8);
+        assertf(capture.prev && capture.delta, "out of memory allocating the capture buffers");
+        capture.prev_width = capture.prev_height = 0;
+    }
+
+    disable_interrupts();
+    capture.flags = flags;
+    capture.counter = 0;
+    capture.seq = 0;
+    capture.skipped = 0;
+    capture.pending = -1;
+    capture.divisor = divisor;
+    enable_interrupts();
+}
+
+uint32_t display_capture_stop(void)
+{
+    disable_interrupts();
+    capture.divisor = 0;
+    capture.pending = -1;
+    enable_interrupts();
+
+    free(capture.half);
+    free(capture.prev);
+    free(capture.delta);
+    capture.half = capture.prev = capture.delta = NULL;
+    return capture.skipped;
+}
@@ -4,10 +4,14 @@
  * @ingroup dma
  */
 #include <stdbool.h>
+#include <malloc.h>
 #include "n64types.h"
 #include "n64sys.h"
 #include "interrupt.h"
 #include "debug.h"
+#include "dma.h"
+#include "kernel.h"
+#include "idle.h"
 #include "regsinternal.h"
 
 /**
@@ -41,6 +45,10 @@
 #define PI_STATUS_IO_BUSY  ( 1 << 1 )
 /** @brief PI Error */
 #define PI_STATUS_ERROR    ( 1 << 2 )
+/** @brief PI Interrupt pending (read) */
+#define PI_STATUS_INTERRUPT ( 1 << 3 )
+/** @brief PI Clear interrupt (write) */
+#define PI_CLEAR_INTERRUPT ( 1 << 1 )
 /** @} */
 
 /** @brief Structure used to interact with the PI registers */
@@ -365,7 +373,10 @@ void dma_read_async(void *ram_pointer, unsigned long pi_address, unsigned long l
  */
 void dma_wait(void)
 {
-    while (__dma_busy()) {}
+    while (__dma_busy()) {
+        kthread_yield();
+        idle_run(IDLE_POLL_BUDGET);
+    }
 }
 
 
@@ -419,6 +430,361 @@ void dma_write(const void * ram_address, unsigned long rom_address, unsigned lon
     dma_wait();
 }
 
+/**
+ * @brief Get the current timings of the PI bus for the ROM
+ *
+ * @return The current timings (as set by the IPL, unless changed with
+ *         #dma_set_speed_profile)
+ */
+dma_speed_profile_t dma_get_speed_profile(void)
+{
+    return (dma_speed_profile_t){
+        .latency = PI_regs->dom1_latency,
+        .pulse_width = PI_regs->dom1_pulse_width,
+        .page_size = PI_regs->dom1_page_size,
+        .release = PI_regs->dom1_release,
+    };
+}
+
+/**
+ * @brief Change the timings of the PI bus for the ROM
+ *
+ * Tighter timings make all the transfers from ROM faster (eg: #dfs_read and
+ * #asset_load), but they are only supported by some cartridges: with a
+ * profile that the cartridge cannot keep up with, the data read is
+ * corrupted. Use #dma_speed_test to check a profile first.
+ *
+ * The new timings are applied after the current transfer (if any) is finished.
+ *
+ * @param[in] profile
+ *            New timings (eg: #DMA_SPEED_PROFILE_FAST)
+ */
+void dma_set_speed_profile(dma_speed_profile_t profile)
+{
+    disable_interrupts();
+    while (__dma_busy()) ;
+    PI_regs->dom1_latency = profile.latency;
+    PI_regs->dom1_pulse_width = profile.pulse_width;
+    PI_regs->dom1_page_size = profile.page_size;
+    PI_regs->dom1_release = profile.release;
+    enable_interrupts();
+}
+
+/** @brief Read a ROM region and compute its checksum, measuring the time taken */
+static uint32_t dma_speed_checksum(uint32_t *buf, uint32_t pi_address, int len, uint32_t *ticks)
+{
+    data_cache_hit_writeback_invalidate(buf, len);
+    uint32_t t0 = TICKS_READ();
+    dma_read(buf, pi_address, len);
+    *ticks = TICKS_SINCE(t0);
+
+    uint32_t sum = 0;
+    for (int i = 0; i < len / 4; i++)
+        sum = ((sum << 5) | (sum >> 27)) ^ buf[i];
+    return sum;
+}
+
+/**
+ * @brief Check whether the cartridge supports a speed profile, and measure its throughput
+ *
+ * This function reads a ROM region with the current timings, then several
+ * times with the specified ones, and compares the checksums of the data.
+ * The current timings are restored before returning, so that the profile
+ * can then be activated with #dma_set_speed_profile if the test succeeds:
+ *
+ * @code{.c}
+ *      // Use a region of at least a few KiB of data, not just zeroes
+ *      uint32_t rom = dfs_rom_addr("level1.dat");
+ *      if (dma_speed_test(DMA_SPEED_PROFILE_FAST, rom, 64*1024) > 0)
+ *          dma_set_speed_profile(DMA_SPEED_PROFILE_FAST);
+ * @endcode
+ *
+ * The region should be representative of the data that will be read (for
+ * instance, far from the beginning of a big ROM), to exercise the address
+ * lines of the cartridge. Other transfers from ROM should not be in
+ * progress during the test, as they would be done with the tested timings.
+ *
+ * @param[in] profile
+ *            Timings to test
+ * @param[in] pi_address
+ *            ROM address of the region to read (multiple of 8)
+ * @param[in] len
+ *            Length of the region in bytes (multiple of 16)
+ *
+ * @return The throughput measured with the specified timings, in KiB/s,
+ *         or -1 if the data was corrupted
+ */
+int dma_speed_test(dma_speed_profile_t profile, uint32_t pi_address, int len)
+{
+    assertf(len > 0 && (len & 15) == 0, "invalid length: %d", len);
+    assertf((pi_address & 7) == 0, "invalid PI address: %08lx", pi_address);
+    uint32_t *buf = memalign(16, len);
+    assertf(buf, "out of memory");
+
+    dma_speed_profile_t cur = dma_get_speed_profile();
+    uint32_t ticks, best = ~0u;
+    uint32_t ref = dma_speed_checksum(buf, pi_address, len, &ticks);
+
+    bool ok = true;
+    dma_set_speed_profile(profile);
+    for (int i = 0; i < 4 && ok; i++) {
+        ok = dma_speed_checksum(buf, pi_address, len, &ticks) == ref;
+        if (ticks < best) best = ticks;
+    }
+    dma_set_speed_profile(cur);
+    free(buf);
+
+    if (!ok) return -1;
+    return (uint64_t)len * TICKS_PER_SECOND / 1024 / (best ? best : 1);
+}
+
+/** @brief Maximum number of requests in the DMA queue */
+#define DMA_QUEUE_SIZE      32
+
+/** @brief A request in the DMA queue */
+typedef struct dma_request_s {
+    struct dma_request_s *next;     ///< Next request in the queue (sorted by priority)
+    void *ram_address;              ///< RDRAM address
+    uint32_t pi_address;            ///< PI address
+    uint32_t len;                   ///< Length of the transfer in bytes
+    bool write;                     ///< True for RDRAM->PI, false for PI->RDRAM
+    int priority;                   ///< Priority of the request
+    dma_callback_t cb;              ///< Completion callback
+    void *ctx;                      ///< Opaque context for the callback
+} dma_request_t;
+
+/** @brief Storage for the requests in the queue */
+static dma_request_t dma_queue_pool[DMA_QUEUE_SIZE];
+/** @brief Free requests */
+static dma_request_t *dma_queue_free;
+/** @brief Pending requests, sorted by priority. The first one might be in flight. */
+static dma_request_t *dma_queue_head;
+/** @brief Number of requests in the queue (including the one in flight) */
+static volatile int dma_queue_count;
+/** @brief True if the transfer of the first request in the queue has been started */
+static bool dma_queue_inflight;
+/** @brief True if the queue has been initialized */
+static bool dma_queue_initialized;
+
+/**
+ * @brief Remove the first request from the queue, returning a copy of it.
+ *
+ * Must be called with interrupts disabled.
+ */
+static dma_request_t dma_queue_pop(void)
+{
+    dma_request_t *req = dma_queue_head;
+    dma_request_t done = *req;
+
+    dma_queue_head = req->next;
+    req->next = dma_queue_free;
+    dma_queue_free = req;
+    dma_queue_count--;
+    dma_queue_inflight = false;
+    return done;
+}
+
+/**
+ * @brief Start the transfer of the first request in the queue, if the PI is free.
+ *
+ * Must be called with interrupts disabled. If the PI is busy with a DMA
+ * transfer not issued by the queue, the request will be started by the PI
+ * interrupt raised at the end of that transfer.
+ */
+static void dma_queue_kick(void)
+{
+    while (!dma_queue_inflight && dma_queue_head) {
+        if (PI_regs->status & PI_STATUS_DMA_BUSY)
+            return;
+        // Wait for any I/O access to finish: no interrupt is raised for these.
+        while (__dma_busy()) {}
+
+        // Acknowledge any stale PI interrupt (from a transfer not issued by the
+        // queue), so that the next one is guaranteed to signal the end of this request.
+        PI_regs->status = PI_CLEAR_INTERRUPT;
+
+        dma_request_t *req = dma_queue_head;
+        dma_queue_inflight = true;
+        if (req->write)
+            dma_write_raw_async(req->ram_address, req->pi_address, req->len);
+        else
+            dma_read_async(req->ram_address, req->pi_address, req->len);
+
+        if (PI_regs->status & (PI_STATUS_DMA_BUSY | PI_STATUS_INTERRUPT))
+            return;
+
+        // Very short misaligned reads are fully performed by dma_read_async
+        // via CPU I/O, without starting a DMA: complete them right away.
+        dma_request_t done = dma_queue_pop();
+        if (done.cb) done.cb(done.ctx);
+    }
+}
+
+/**
+ * @brief PI interrupt handler: complete the current request and start the next one.
+ *
+ * The PI serializes transfers and #dma_queue_kick only starts a request when
+ * the PI is idle, so the first PI interrupt after a request has been started
+ * always signals its completion.
+ */
+static void dma_queue_interrupt(void)
+{
+    if (!dma_queue_inflight) {
+        dma_queue_kick();
+        return;
+    }
+
+    dma_request_t done = dma_queue_pop();
+
+    // Start the next transfer before running the callback, so that the PI
+    // keeps working meanwhile.
+    dma_queue_kick();
+    if (done.cb) done.cb(done.ctx);
+}
+
+/** @brief Initialize the DMA queue the first time it is used */
+static void dma_queue_init(void)
+{
+    dma_queue_free = NULL;
+    for (int i = DMA_QUEUE_SIZE-1; i >= 0; i--) {
+        dma_queue_pool[i].next = dma_queue_free;
+        dma_queue_free = &dma_queue_pool[i];
+    }
+    dma_queue_head = NULL;
+    dma_queue_count = 0;
+    dma_queue_inflight = false;
+    register_PI_handler(dma_queue_interrupt);
+    dma_queue_initialized = true;
+}
+
+/** @brief Insert a request in the DMA queue */
+static void dma_queue_submit(bool write, void *ram_address, unsigned long pi_address,
+    unsigned long len, int priority, dma_callback_t cb, void *ctx)
+{
+    assert(len > 0);
+
+    if (!dma_queue_free) {
+        // The queue is drained by the PI interrupt, wait for a free slot.
+        assertf(get_interrupts_state() == INTERRUPTS_ENABLED,
+            "DMA queue full with interrupts disabled");
+        while (dma_queue_count == DMA_QUEUE_SIZE) {}
+    }
+
+    disable_interrupts();
+    if (!dma_queue_initialized)
+        dma_queue_init();
+
+    dma_request_t *req = dma_queue_free;
+    dma_queue_free = req->next;
+    req->ram_address = ram_address;
+    req->pi_address = pi_address;
+    req->len = len;
+    req->write = write;
+    req->priority = priority;
+    req->cb = cb;
+    req->ctx = ctx;
+
+    // Insert after all the requests with the same or higher priority (so that
+    // the order is FIFO within the same priority). Never insert before the
+    // request in flight.
+    dma_request_t **prev = &dma_queue_head;
+    if (dma_queue_inflight)
+        prev = &dma_queue_head->next;
+    while (*prev && (*prev)->priority >= priority)
+        prev = &(*prev)->next;
+    req->next = *prev;
+    *prev = req;
+    dma_queue_count++;
+
+    dma_queue_kick();
+    enable_interrupts();
+}
+
+/**
+ * @brief Queue a read from a peripheral through PI DMA
+ *
+ * This function adds a transfer to the DMA queue and returns immediately.
+ * Queued transfers are started back-to-back from the PI interrupt handler, in
+ * priority order (FIFO among requests with the same priority). When a transfer
+ * is finished, the callback is invoked from the PI interrupt handler.
+ *
+ * Alignment constraints are the same of #dma_read_async. Like the other DMA
+ * functions, the cache is not managed: the buffer must be invalidated before
+ * queueing the request, and not accessed until the callback is invoked.
+ *
+ * Queued transfers coexist with the blocking and async DMA functions: a
+ * blocking #dma_read simply waits for the transfer in flight (if any) and
+ * goes ahead of all queued requests, so it can be used for latency-critical
+ * reads such as audio streaming.
+ *
+ * @param[out] ram_address
+ *             Pointer to a buffer in RDRAM to place read data
+ * @param[in]  pi_address
+ *             Memory address of the peripheral to read from
+ * @param[in]  len
+ *             Length in bytes to read into ram_address
+ * @param[in]  priority
+ *             Priority of the request (higher values are serviced first,
+ *             see #DMA_PRIORITY_NORMAL)
+ * @param[in]  cb
+ *             Callback invoked at the end of the transfer (can be NULL)
+ * @param[in]  ctx
+ *             Opaque context passed to the callback
+ */
+void dma_read_queue(void *ram_address, unsigned long pi_address, unsigned long len,
+    int priority, dma_callback_t cb, void *ctx)
+{
+    assert(((PhysicalAddr(ram_address) ^ pi_address) & 1) == 0);
+    dma_queue_submit(false, ram_address, pi_address, len, priority, cb, ctx);
+}
+
+/**
+ * @brief Queue a write to a peripheral through PI DMA
+ *
+ * This is the write counterpart of #dma_read_queue. Alignment constraints
+ * are the same of #dma_write_raw_async. The buffer must have been written
+ * back from the cache before queueing the request.
+ *
+ * @param[in]  ram_address
+ *             Pointer to a buffer to read data from (must be 8-byte aligned)
+ * @param[in]  pi_address
+ *             Memory address of the peripheral to write to (must be 2-byte aligned)
+ * @param[in]  len
+ *             Length in bytes to write into pi_address (must be multiple of 2)
+ * @param[in]  priority
+ *             Priority of the request (higher values are serviced first)
+ * @param[in]  cb
+ *             Callback invoked at the end of the transfer (can be NULL)
+ * @param[in]  ctx
+ *             Opaque context passed to the callback
+ */
+void dma_write_queue(const void *ram_address, unsigned long pi_address, unsigned long len,
+    int priority, dma_callback_t cb, void *ctx)
+{
+    dma_queue_submit(true, (void*)ram_address, pi_address, len, priority, cb, ctx);
+}
+
+/**
+ * @brief Return the number of queued DMA transfers not completed yet
+ *
+ * @return Number of requests submitted with #dma_read_queue or #dma_write_queue
+ *         whose callback has not been invoked yet.
+ */
+int dma_queue_pending(void)
+{
+    return dma_queue_count;
+}
+
+/**
+ * @brief Wait until all queued DMA transfers are finished.
+ */
+void dma_queue_wait(void)
+{
+    assertf(!dma_queue_count || get_interrupts_state() == INTERRUPTS_ENABLED,
+        "dma_queue_wait called with interrupts disabled");
+    while (dma_queue_count) {}
+}
+
 /**
  * @brief Read a 32 bit integer from a peripheral using the CPU.
  *
@@ -6,12 +6,16 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <malloc.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include "libdragon.h"
 #include "system.h"
 #include "dfsinternal.h"
 #include "rompak_internal.h"
+#include "boot_profile_internal.h"
+#include "asset_internal.h"
 
 /**
  * @defgroup dfs DragonFS
@@ -36,18 +40,30 @@
  *
  * DFS files have a maximum size of 256 MiB.  Directories can have an unlimited
  * number of files in them.  Each token (separated by a / in the path) can be 243 characters
- * maximum.  Directories can be 100 levels deep at maximum.  There can be 4 files open
+ * maximum.  Directories can be 100 levels deep at maximum.  Up to 4096 files can be open
  * simultaneously.
  *
  * When DFS is initialized, it will register itself with newlib using 'rom:/' as a prefix.
  * Files can be accessed either with standard POSIX functions (open, fopen) using the 'rom:/'
  * prefix or the lower-level DFS API calls without prefix. In most cases, it is not necessary
  * to use the DFS API directly, given that the standard C functions are more comprehensive.
- * Files can be opened using both sets of API calls simultaneously as long as no more than
- * four files are open at any one time.
+ * Files can be opened using both sets of API calls simultaneously.
+ *
+ * Large reads into a buffer with compatible alignment are performed with a single
+ * DMA transfer directly into the destination buffer. When using stdio, notice that
+ * FILE buffering adds a memory copy of all the data: for files that are mostly
+ * read in large chunks, disable it with `setvbuf(f, NULL, _IONBF, 0)` so that
+ * fread goes straight to DragonFS. Small reads are still cached by DragonFS
+ * itself (see #dfs_set_cache_size).
  * 
- * DragonFS does not support file compression; if you want to compress your assets,
- * use the asset API (#asset_load / #asset_fopen).
+ * Files can be compressed within the filesystem by mkdfs (see the `-c` flag), in
+ * which case they are decompressed transparently while being read, with the same
+ * algorithms used by the asset API (levels 2 and 3 must be initialized with
+ * #asset_init_compression). Compressed files are read sequentially by the CPU:
+ * seeking backward restarts decompression from the beginning of the file, and
+ * they cannot be accessed directly in ROM (#dfs_rom_addr, #dfs_map).
+ * Alternatively, the asset API (#asset_load / #asset_fopen) supports files
+ * compressed by mkasset, including seekable ones.
  * 
  * @{
  */
@@ -78,14 +94,62 @@ enum
 
 /** @brief Base filesystem pointer */
 static uint32_t base_ptr = 0;
-/** @brief Open file tracking */
-static open_file_t open_files[MAX_OPEN_FILES];
+/** @brief Number of bits of a file handle used for the index in the open file pool */
+#define DFS_HANDLE_SLOT_BITS    12
+/** @brief Mask to extract the index in the open file pool from a file handle */
+#define DFS_HANDLE_SLOT_MASK    ((1 << DFS_HANDLE_SLOT_BITS) - 1)
+/** @brief Mask of the generation counter of a file handle (keeps handles positive) */
+#define DFS_HANDLE_GEN_MASK     ((1 << (31 - DFS_HANDLE_SLOT_BITS)) - 1)
+
+/** @brief Open file tracking (pool of open file structures, indexed by handle slot) */
+static open_file_t **open_files = NULL;
+/** @brief Number of slots in the open file pool */
+static int open_files_size = 0;
+/** @brief Index of the first free slot in the open file pool (-1 if none) */
+static int free_file_slot = -1;
 /** @brief Directory pointer stack */
 static uint32_t directories[MAX_DIRECTORY_DEPTH];
 /** @brief Depth into directory pointer stack */
 static uint32_t directory_top = 0;
 /** @brief Pointer to next directory entry set when doing a directory walk */
 static directory_entry_t *next_entry = 0;
+/** @brief Minimum length of a misaligned read for it to bypass the file cache */
+#define DFS_DIRECT_READ_MIN     256
+
+/** @brief Maximum read cache size for newly opened files (see #dfs_set_default_cache_size) */
+static uint32_t default_cache_size = DFS_MIN_CACHE_SIZE;
+/** @brief Location of the slots of the path hash index (0 if the filesystem has none) */
+static uint32_t hash_index = 0;
+/** @brief Mask to apply to a hash to get a slot of the path hash index */
+static uint32_t hash_index_mask = 0;
+
+/** @brief An event recorded by the access tracer (see #dfs_trace_start) */
+typedef struct
+{
+    /** @brief Timestamp (in ticks) */
+    uint32_t ticks;
+    /** @brief Offset within the file */
+    uint32_t offset;
+    /** @brief Number of bytes accessed (0 for an open) */
+    uint32_t len;
+    /** @brief Index of the file in #trace_paths */
+    int path;
+} trace_event_t;
+
+/** @brief True if the access tracer is recording */
+static bool trace_enabled = false;
+/** @brief Events recorded by the access tracer */
+static trace_event_t *trace_events = NULL;
+/** @brief Maximum number of events that can be recorded */
+static int trace_max_events = 0;
+/** @brief Number of recorded events */
+static int trace_num_events = 0;
+/** @brief Number of events that did not fit in the trace buffer */
+static int trace_dropped = 0;
+/** @brief Paths of the traced files, in order of first access */
+static char **trace_paths = NULL;
+/** @brief Number of traced files */
+static int trace_num_paths = 0;
 
 /**
  * @brief Read a sector from cartspace
@@ -106,24 +170,215 @@ static inline void grab_sector(void *cart_loc, void *ram_loc)
     dma_read((void *)(((uint32_t)ram_loc) & 0x1FFFFFFF), (uint32_t)cart_loc, SECTOR_SIZE);
 }
 
+/**
+ * @brief Read a small block of data from cartspace
+ *
+ * @param[in]  cart_loc
+ *             Pointer to cartridge location
+ * @param[out] ram_loc
+ *             Pointer to RAM buffer to place the read data
+ * @param[in]  len
+ *             Number of bytes to read
+ */
+static inline void grab_data(uint32_t cart_loc, void *ram_loc, int len)
+{
+    data_cache_hit_writeback_invalidate(ram_loc, len);
+    dma_read(ram_loc, cart_loc, len);
+}
+
+/**
+ * @brief Return the index of a path in the trace, adding it if required
+ *
+ * @param[in] path
+ *            Path of the file being accessed
+ *
+ * @return Index of the path in #trace_paths, or -1 if out of memory.
+ */
+static int trace_path_id(const char *path)
+{
+    /* Paths are stored relative to the root, as expected by mkdfs manifests */
+    while(*path == '/')
+    {
+        path++;
+    }
+
+    for(int i = 0; i < trace_num_paths; i++)
+    {
+        if(!strcmp(trace_paths[i], path))
+        {
+            return i;
+        }
+    }
+
+    char **paths = realloc(trace_paths, (trace_num_paths + 1) * sizeof(char*));
+    if(!paths)
+    {
+        return -1;
+    }
+    trace_paths = paths;
+    trace_paths[trace_num_paths] = strdup(path);
+    return trace_num_paths++;
+}
+
+/**
+ * @brief Record an access in the trace
+ *
+ * @param[in] path
+ *            Index of the path (as returned by #trace_path_id)
+ * @param[in] offset
+ *            Offset within the file
+ * @param[in] len
+ *            Number of bytes accessed
+ */
+static void trace_record(int path, uint32_t offset, uint32_t len)
+{
+    if(!trace_enabled || path < 0)
+    {
+        return;
+    }
+
+    if(trace_num_events == trace_max_events)
+    {
+        trace_dropped++;
+        return;
+    }
+
+    trace_event_t *ev = &trace_events[trace_num_events++];
+    ev->ticks = TICKS_READ();
+    ev->offset = offset;
+    ev->len = len;
+    ev->path = path;
+}
+
+/**
+ * @brief Grow the pool of open file structures
+ *
+ * The pool starts with #MAX_OPEN_FILES slots and doubles every time it is
+ * full. Slots are allocated in chunks that are never freed or moved, so
+ * pointers to open file structures stay valid.
+ *
+ * @return true if the pool was grown, false if out of memory or slots.
+ */
+static bool grow_file_pool(void)
+{
+    int new_size = open_files_size ? open_files_size * 2 : MAX_OPEN_FILES;
+    if(new_size > DFS_HANDLE_SLOT_MASK + 1)
+    {
+        new_size = DFS_HANDLE_SLOT_MASK + 1;
+    }
+    if(new_size <= open_files_size)
+    {
+        return false;
+    }
+
+    open_file_t **table = realloc(open_files, new_size * sizeof(open_file_t*));
+    if(!table)
+    {
+        return false;
+    }
+    open_files = table;
+
+    int count = new_size - open_files_size;
+    open_file_t *chunk = memalign(16, count * sizeof(open_file_t));
+    if(!chunk)
+    {
+        return false;
+    }
+    memset(chunk, 0, count * sizeof(open_file_t));
+
+    /* Link the new slots in the free list, lowest index first */
+    for(int i = count - 1; i >= 0; i--)
+    {
+        open_files[open_files_size + i] = &chunk[i];
+        chunk[i].next_free = free_file_slot;
+        free_file_slot = open_files_size + i;
+    }
+    open_files_size = new_size;
+
+    return true;
+}
+
 /**
  * @brief Find a free open file structure
  *
+ * The structure is removed from the pool and assigned a new handle.
+ *
  * @return A pointer to an open file structure or NULL if no more open file structures.
  */
 static open_file_t *find_free_file()
 {
-    for(int i = 0; i < MAX_OPEN_FILES; i++)
+    /* Ensure we always open with a unique handle */
+    static uint32_t next_generation = 1;
+
+    if(free_file_slot < 0 && !grow_file_pool())
     {
-        if(!open_files[i].handle)
-        {
-            /* Found one! */
-            return &open_files[i];
-        }
+        /* No free files */
+        return 0;
     }
 
-    /* No free files */
-    return 0;
+    int slot = free_file_slot;
+    open_file_t *file = open_files[slot];
+    free_file_slot = file->next_free;
+
+    /* The handle encodes the slot index (for O(1) lookups) and a generation
+       counter, so that stale handles of closed files are not accepted. */
+    file->handle = (next_generation << DFS_HANDLE_SLOT_BITS) | slot;
+    next_generation = (next_generation + 1) & DFS_HANDLE_GEN_MASK;
+    if(!next_generation)
+    {
+        next_generation = 1;
+    }
+
+    return file;
+}
+
+/** @brief Decompression state of a compressed file (see #FLAGS_COMPRESSED) */
+typedef struct dfs_decomp_s
+{
+    /** @brief Stream of the compressed data, read by the decompressor */
+    FILE *fp;
+    /** @brief Decompression algorithm */
+    asset_compression_t *algo;
+    /** @brief Offset of the compressed data in the file (after the header) */
+    uint32_t data_loc;
+    /** @brief Current location in the decompressed data */
+    uint32_t loc;
+    /** @brief Location in the decompressed data reached by the decompressor */
+    uint32_t dec_loc;
+    /** @brief Size of the decompressed data */
+    uint32_t size;
+    /** @brief State of the decompressor */
+    uint8_t state[] __attribute__((aligned(8)));
+} dfs_decomp_t;
+
+static int decomp_open(open_file_t *file);
+
+/**
+ * @brief Release an open file structure back to the pool
+ *
+ * @param[in] file
+ *            The open file structure
+ */
+static void release_file(open_file_t *file)
+{
+    int slot = file->handle & DFS_HANDLE_SLOT_MASK;
+
+    if(file->cache && file->cache != file->cached_data)
+    {
+        free(file->cache);
+    }
+
+    if(file->decomp)
+    {
+        fclose(file->decomp->fp);
+        free(file->decomp);
+    }
+
+    /* Closing the handle is easy as zeroing out the file */
+    memset(file, 0, sizeof(open_file_t));
+
+    file->next_free = free_file_slot;
+    free_file_slot = slot;
 }
 
 /**
@@ -138,17 +393,14 @@ static open_file_t *find_open_file(uint32_t x)
 {
     if(x == 0) { return 0; }
 
-    for(int i = 0; i < MAX_OPEN_FILES; i++)
+    int slot = x & DFS_HANDLE_SLOT_MASK;
+    if(slot >= open_files_size || open_files[slot]->handle != x)
     {
-        if(open_files[i].handle == x)
-        {
-            /* Found it! */
-            return &open_files[i];
-        }
+        /* Couldn't find handle */
+        return 0;
     }
 
-    /* Couldn't find handle */
-    return 0;
+    return open_files[slot];
 }
 
 /**
@@ -465,6 +717,89 @@ static directory_entry_t *find_dirent(char *name, directory_entry_t *cur_node)
     return 0;
 }
 
+/**
+ * @brief Check whether a path can be looked up in the path hash index
+ *
+ * The index only contains normalized full paths, so relative paths (when
+ * the current directory is not the root) and paths with empty, "." or ".."
+ * components must go through #recurse_path.
+ *
+ * @param[in] path
+ *            Path to check (without leading slashes)
+ *
+ * @return true if the path can be looked up in the index
+ */
+static bool hash_index_supports(const char *path)
+{
+    while(1)
+    {
+        const char *end = strchr(path, '/');
+        int len = end ? end - path : strlen(path);
+
+        if(len == 0 || len > MAX_FILENAME_LEN ||
+           (len == 1 && path[0] == '.') ||
+           (len == 2 && path[0] == '.' && path[1] == '.'))
+        {
+            return false;
+        }
+
+        if(!end) { return true; }
+        path = end + 1;
+    }
+}
+
+/**
+ * @brief Find a file using the path hash index
+ *
+ * @param[in]  path
+ *             Full path of the file (without leading slashes)
+ * @param[out] dirent
+ *             Directory entry of the file
+ *
+ * @return DFS_ESUCCESS if the file was found, or DFS_ENOFILE if it does not exist.
+ */
+static int hash_index_find(const char *path, directory_entry_t **dirent)
+{
+    int len = strlen(path);
+    uint32_t hash = hash_index_path(path);
+
+    for(uint32_t i = hash & hash_index_mask; ; i = (i + 1) & hash_index_mask)
+    {
+        hash_index_slot_t slot __attribute__((aligned(16)));
+        grab_data(hash_index + i * sizeof(hash_index_slot_t), &slot, sizeof(slot));
+
+        if(!slot.dirent)
+        {
+            /* Reached an empty slot: the file does not exist */
+            return DFS_ENOFILE;
+        }
+
+        if(slot.hash == hash)
+        {
+            /* Compare the full path, to rule out hash collisions */
+            char buf[MAX_FILENAME_LEN+1] __attribute__((aligned(16)));
+            int n = len + 1;
+            const char *p = path;
+            bool match = true;
+            uint32_t loc = slot.path + base_ptr;
+
+            while(n > 0 && match)
+            {
+                int chunk = n < sizeof(buf) ? n : sizeof(buf);
+                grab_data(loc, buf, chunk);
+                match = memcmp(buf, p, chunk) == 0;
+                loc += chunk; p += chunk; n -= chunk;
+            }
+
+            if(match)
+            {
+                *dirent = (directory_entry_t *)(slot.dirent + base_ptr);
+                return DFS_ESUCCESS;
+            }
+        }
+    }
+}
+
 /**
  * @brief Walk a path string, either changing directories or finding the right path
  *
@@ -622,6 +957,35 @@ static int recurse_path(const char * const path, int mode, directory_entry_t **d
     return ret;
 }
 
+/**
+ * @brief Find the directory entry of a file given its path
+ *
+ * Uses the path hash index if available (and applicable to the path),
+ * otherwise walks the directory tree.
+ *
+ * @param[in]  path
+ *             Relative or absolute path of the file
+ * @param[out] dirent
+ *             Directory entry of the file
+ *
+ * @return DFS_ESUCCESS on success, or a negative error on failure.
+ */
+static int find_file(const char * const path, directory_entry_t **dirent)
+{
+    if(hash_index && (path[0] == '/' || directory_top == 0))
+    {
+        const char *p = path;
+        while(*p == '/') { p++; }
+
+        if(hash_index_supports(p))
+        {
+            return hash_index_find(p, dirent);
+        }
+    }
+
+    return recurse_path(path, WALK_OPEN, dirent, TYPE_FILE);
+}
+
 /**
  * @brief Helper functioner to initialize the filesystem
  *
@@ -643,7 +1007,27 @@ static int __dfs_init(uint32_t base_fs_loc)
         base_ptr = base_fs_loc;
         clear_directory();
 
-        memset(open_files, 0, sizeof(open_files));
+        /* Check if there is a path hash index (not present in old images) */
+        hash_index = 0;
+        if(id_node.file_pointer)
+        {
+            hash_index_header_t header __attribute__((aligned(16)));
+            grab_data(base_fs_loc + id_node.file_pointer, &header, sizeof(header));
+            if(header.magic == HASH_INDEX_MAGIC && header.num_slots)
+            {
+                hash_index = base_fs_loc + id_node.file_pointer + sizeof(header);
+                hash_index_mask = header.num_slots - 1;
+            }
+        }
+
+        /* Close all the files that were left open */
+        for(int i = 0; i < open_files_size; i++)
+        {
+            if(open_files[i]->handle)
+            {
+                release_file(open_files[i]);
+            }
+        }
 
         /* Good FS */
         return DFS_ESUCCESS;
@@ -752,6 +1136,67 @@ int dfs_dir_findnext(char *buf)
     return get_flags(&t_node);
 }
 
+/**
+ * @brief Read all the entries of a directory, with their metadata
+ *
+ * This walks the directory sectors once, returning for each entry the
+ * information that would otherwise require a #dfs_dir_findnext followed
+ * by a lookup of the entry (eg: #dfs_open + #dfs_size, or #dfs_rom_addr).
+ * Unlike #dfs_dir_findfirst, it does not change the state of the
+ * #dfs_dir_findnext iteration.
+ *
+ * Like snprintf, the function returns the total number of entries in the
+ * directory, even if only the first @p max_entries are stored: to list a
+ * directory of unknown size, call it once with no buffer to count the
+ * entries, and then again with a buffer big enough.
+ *
+ * @param[in]  path
+ *             Path of the directory to read
+ * @param[out] entries
+ *             Array of entries to fill (can be NULL if @p max_entries is 0)
+ * @param[in]  max_entries
+ *             Maximum number of entries to store in the array
+ *
+ * @return The number of entries in the directory or a negative value on error.
+ */
+int dfs_dir_read(const char * const path, dfs_dirent_t *entries, int max_entries)
+{
+    if(max_entries < 0 || (max_entries && !entries))
+    {
+        return DFS_EBADINPUT;
+    }
+
+    directory_entry_t *dirent;
+    int ret = recurse_path(path, WALK_OPEN, &dirent, TYPE_DIR);
+
+    if(ret != DFS_ESUCCESS)
+    {
+        return ret;
+    }
+
+    int count = 0;
+    while(dirent)
+    {
+        directory_entry_t t_node;
+        grab_sector(dirent, &t_node);
+
+        if(count < max_entries)
+        {
+            dfs_dirent_t *e = &entries[count];
+            uint32_t flags = get_flags(&t_node);
+            strcpy(e->name, t_node.path);
+            e->flags = flags;
+            e->size = FILETYPE(flags) == FLAGS_FILE ? get_size(&t_node) : 0;
+            e->rom_addr = FILETYPE(flags) == FLAGS_FILE ? get_start_location(&t_node) : 0;
+        }
+
+        count++;
+        dirent = get_next_entry(&t_node);
+    }
+
+    return count;
+}
+
 /**
  * @brief Open a file given a path
  *
@@ -766,20 +1211,9 @@ int dfs_dir_findnext(char *buf)
  */
 int dfs_open(const char * const path)
 {
-    /* Ensure we always open with a unique handle */
-    static uint32_t next_handle = 1;
-
-    /* Try to find a free slot */
-    open_file_t *file = find_free_file();
-
-    if(!file)
-    {
-        return DFS_ENFILE;        
-    }
-
     /* Try to find file */
     directory_entry_t *dirent;
-    int ret = recurse_path(path, WALK_OPEN, &dirent, TYPE_FILE);
+    int ret = find_file(path, &dirent);
 
     if(ret != DFS_ESUCCESS)
     {
@@ -787,16 +1221,45 @@ int dfs_open(const char * const path)
         return ret;
     }
 
+    /* Try to find a free slot */
+    open_file_t *file = find_free_file();
+
+    if(!file)
+    {
+        return DFS_ENFILE;        
+    }
+
     /* We now have the pointer to the file entry */
     directory_entry_t t_node;
     grab_sector(dirent, &t_node);
 
     /* Set up file handle */
-    file->handle = next_handle++;
     file->size = get_size(&t_node);
     file->loc = 0;
     file->cart_start_loc = get_start_location(&t_node);
     file->cached_loc = 0xFFFFFFFF;
+    file->cached_size = 0;
+    file->cache = file->cached_data;
+    file->cache_max = default_cache_size;
+    file->readahead = DFS_MIN_CACHE_SIZE;
+    file->trace_path = -1;
+    file->decomp = NULL;
+
+    if(trace_enabled)
+    {
+        file->trace_path = trace_path_id(path);
+        trace_record(file->trace_path, 0, 0);
+    }
+
+    if(get_flags(&t_node) & FLAGS_COMPRESSED)
+    {
+        ret = decomp_open(file);
+        if(ret != DFS_ESUCCESS)
+        {
+            release_file(file);
+            return ret;
+        }
+    }
 
     return file->handle;
 }
@@ -818,8 +1281,7 @@ int dfs_close(uint32_t handle)
         return DFS_EBADHANDLE;
     }
 
-    /* Closing the handle is easy as zeroing out the file */
-    memset(file, 0, sizeof(open_file_t));
+    release_file(file);
 
     return DFS_ESUCCESS;
 }
@@ -845,45 +1307,49 @@ int dfs_seek(uint32_t handle, int offset, int origin)
         return DFS_EBADHANDLE;
     }
 
+    /* Compressed files are seeked within the decompressed data */
+    uint32_t *loc = file->decomp ? &file->decomp->loc : &file->loc;
+    uint32_t size = file->decomp ? file->decomp->size : file->size;
+
     switch(origin)
     {
         case SEEK_SET:
             /* From the beginning */
             if(offset < 0)
             { 
-                file->loc = 0; 
+                *loc = 0; 
             }
             else
             {
-                file->loc = offset;
+                *loc = offset;
             }
 
             break;
         case SEEK_CUR:
         {
             /* From the current position */
-            int new_offset = (int)file->loc + offset;
+            int new_offset = (int)*loc + offset;
 
             if(new_offset < 0)
             {
                 new_offset = 0;
             }
 
-            file->loc = new_offset;
+            *loc = new_offset;
 
             break;
         }
         case SEEK_END:
         {
             /* From the end of the file */
-            int new_offset = (int)file->size + offset;
+            int new_offset = (int)size + offset;
 
             if(new_offset < 0)
             {
                 new_offset = 0;
             }
 
-            file->loc = new_offset;
+            *loc = new_offset;
 
             break;
         }
@@ -893,9 +1359,9 @@ int dfs_seek(uint32_t handle, int offset, int origin)
     }
 
     /* Lets get some bounds checking */
-    if(file->loc > file->size)
+    if(*loc > size)
     {
-        file->loc = file->size;
+        *loc = size;
     }
 
     return DFS_ESUCCESS;
@@ -919,67 +1385,121 @@ int dfs_tell(uint32_t handle)
         return DFS_EBADHANDLE;
     }
 
-    return file->loc;
+    return file->decomp ? file->decomp->loc : file->loc;
 }
 
 /**
- * @brief Read data from a file
+ * @brief Refill the read cache of a file at its current location
  *
- * @param[out] buf
- *             Buffer to read into
- * @param[in]  size
- *             Size of each element to read
- * @param[in]  count
- *             Number of elements to read
- * @param[in]  handle
- *             A valid file handle as returned from #dfs_open.
+ * The amount of data read ahead doubles each time the file is accessed
+ * sequentially (up to the maximum cache size of the file), and goes back
+ * to #DFS_MIN_CACHE_SIZE on a random access.
  *
- * @return The actual number of bytes read or a negative value on failure.
+ * @param[in] file
+ *            The open file
  */
-int dfs_read(void * const buf, int size, int count, uint32_t handle)
+static void cache_refill(open_file_t *file)
 {
-    /* This is where we do all the work */
-    open_file_t *file = find_open_file(handle);
+    /* We need to read from a 8-byte aligned location, so calculate it */
+    uint32_t loc = file->loc & ~7;
 
-    if(!file)
+    if (loc == file->cached_loc + file->cached_size)
     {
-        return DFS_EBADHANDLE;
+        file->readahead *= 2;
+        if (file->readahead > file->cache_max)
+            file->readahead = file->cache_max;
     }
-
-    /* What are they doing? */
-    if(!buf)
+    else
     {
-        return DFS_EBADINPUT;
+        file->readahead = DFS_MIN_CACHE_SIZE;
     }
 
-    int to_read = size * count;
-    int did_read = 0;
-
-    /* Bounds check to make sure we don't read past the end */
-    if(file->loc + to_read > file->size)
+    if (file->readahead > DFS_MIN_CACHE_SIZE && file->cache == file->cached_data)
     {
-        /* It will, lets shorten it */
-        to_read = file->size - file->loc;
+        /* First time we read ahead more than the embedded buffer: allocate the
+           full cache. If we are out of memory, just keep the embedded buffer. */
+        uint8_t *cache = memalign(16, file->cache_max);
+        if (cache)
+        {
+            file->cache = cache;
+        }
+        else
+        {
+            file->cache_max = file->readahead = DFS_MIN_CACHE_SIZE;
+        }
     }
 
-    if (!to_read)
-        return 0;
+    /* Don't read past the end of the file (rounding up to keep the length even) */
+    uint32_t len = file->readahead;
+    if (len > ((file->size - loc + 7) & ~7))
+        len = (file->size - loc + 7) & ~7;
 
-    /* Fast-path. If possibly, we want to DMA directly into the destination
-     * buffer, without using any intermediate buffers. The rules are convoluted
-     * because we try to squeeze maximum performance here and thus we rely also
-     * on undocumented behaviors of PI DMA.
+    /* Invalidate the cached data. No need to writeback here because
+       the buffer is 16-byte aligned and its size is a multiple of 16 bytes,
+       so the cachelines are not shared with other variables. */
+    data_cache_hit_invalidate(file->cache, (len + 15) & ~15);
+
+    dma_read((void *)(((uint32_t)file->cache) & 0x1FFFFFFF),
+        file->cart_start_loc + loc, len);
+
+    file->cached_loc = loc;
+    file->cached_size = len;
+}
+
+/**
+ * @brief Read data stored in a file
+ *
+ * This reads the data as stored in ROM: for compressed files, it returns
+ * the compressed data, and it is used as the input of the decompressor.
+ *
+ * @param[in]  file
+ *             The open file
+ * @param[out] buf
+ *             Buffer to read into
+ * @param[in]  to_read
+ *             Number of bytes to read
+ *
+ * @return The actual number of bytes read.
+ */
+static int read_raw(open_file_t *file, void * const buf, int to_read)
+{
+    int did_read = 0;
+
+    /* Bounds check to make sure we don't read past the end */
+    if(file->loc + to_read > file->size)
+    {
+        /* It will, lets shorten it */
+        to_read = file->size - file->loc;
+    }
+
+    if (!to_read)
+        return 0;
+
+    trace_record(file->trace_path, file->loc, to_read);
+
+    /* Fast-path. If possibly, we want to DMA directly into the destination
+     * buffer, without using any intermediate buffers. The rules are convoluted
+     * because we try to squeeze maximum performance here and thus we rely also
+     * on undocumented behaviors of PI DMA.
      * The rules we follow are:
      *
      *   * The RDRAM destination pointer must be 8-bytes aligned.
      *   * The ROM location must be 2-bytes aligned.
      *   * The length must be either less than 0x7F (all values accepted),
      *     or even.
+     *
+     * Large reads are also performed directly when the RDRAM pointer and the
+     * ROM location just have the same 2-byte alignment: dma_read realigns
+     * the transfer by moving the first and last few bytes with the CPU,
+     * which is much cheaper than going through the cache and memcpy'ing
+     * everything (eg: large freads into a misaligned buffer).
      */
     bool rom_aligned = (file->loc & 1) == 0;
     bool ram_aligned = ((uint32_t)buf & 7) == 0;
     bool len_aligned = (to_read < 0x7F) || ((to_read & 1) == 0);
-    if (rom_aligned && ram_aligned && len_aligned)
+    bool same_parity = (((uint32_t)buf ^ (file->cart_start_loc + file->loc)) & 1) == 0;
+    if ((rom_aligned && ram_aligned && len_aligned) ||
+        (same_parity && to_read >= DFS_DIRECT_READ_MIN))
     {
         /* 16-byte alignment: we can simply invalidate the buffer.
          * 8-byte alignment: we need to also writeback in case the partial
@@ -998,32 +1518,22 @@ int dfs_read(void * const buf, int size, int count, uint32_t handle)
 
     /* Something we can actually increment! */
     uint8_t *data = buf;
-    const int CACHED_SIZE = sizeof(file->cached_data);
 
     /* Loop in, reading data in the cached buffer */
     while(to_read)
     {
-        /* Check if we need to read into the cached buffer */
-        if (file->loc < file->cached_loc || file->loc >= file->cached_loc+CACHED_SIZE)
+        /* Check if we need to refill the cached buffer */
+        if (file->loc < file->cached_loc || file->loc >= file->cached_loc+file->cached_size)
         {
-            /* We need to read from a 8-byte aligned location, so calculate it */
-            file->cached_loc = file->loc & ~7;
-
-            /* Invalidate the cached data. No need to writeback here because
-               CACHE_SIZE is a multiple of 16 bytes and the data is aligned,
-               so the cachelines are not shared with other variables. */
-            data_cache_hit_invalidate(file->cached_data, CACHED_SIZE);
-
-            dma_read((void *)(((uint32_t)file->cached_data) & 0x1FFFFFFF),
-                file->cart_start_loc + file->cached_loc, CACHED_SIZE);
+            cache_refill(file);
         }
 
         /* Pull as much data as we can from the current buffer */
-        int copy = file->cached_loc+CACHED_SIZE - file->loc;
+        int copy = file->cached_loc+file->cached_size - file->loc;
         if (copy > to_read)
             copy = to_read;
 
-        memcpy(data, file->cached_data + (file->loc - file->cached_loc), copy);
+        memcpy(data, file->cache + (file->loc - file->cached_loc), copy);
 
         file->loc += copy;
         data += copy;
@@ -1034,6 +1544,499 @@ int dfs_read(void * const buf, int size, int count, uint32_t handle)
     return did_read;
 }
 
+/** @brief funopen read callback of the stream of compressed data */
+static int decomp_readfn(void *cookie, char *buf, int len)
+{
+    return read_raw(cookie, buf, len);
+}
+
+/** @brief funopen seek callback of the stream of compressed data */
+static fpos_t decomp_seekfn(void *cookie, fpos_t pos, int whence)
+{
+    open_file_t *file = cookie;
+    int newpos = pos;
+
+    if(whence == SEEK_CUR)
+    {
+        newpos += file->loc;
+    }
+    else if(whence == SEEK_END)
+    {
+        newpos += file->size;
+    }
+    if(newpos < 0 || newpos > (int)file->size)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    file->loc = newpos;
+    return newpos;
+}
+
+/**
+ * @brief Set up the decompression of a compressed file
+ *
+ * The file contents are a compressed asset (see asset_internal.h): parse its
+ * header, and initialize the decompressor to read from the following data.
+ *
+ * @param[in] file
+ *            The open file, positioned at the beginning
+ *
+ * @return DFS_ESUCCESS on success or a negative value on error.
+ */
+static int decomp_open(open_file_t *file)
+{
+    asset_header_t header;
+    if(read_raw(file, &header, sizeof(header)) != sizeof(header) ||
+       memcmp(header.magic, ASSET_MAGIC, 3) != 0 || header.version != '2')
+    {
+        return DFS_EBADFS;
+    }
+
+    asset_compression_t *algo = __asset_get_compression(header.algo);
+    assertf(algo, "dfs: compression level %d not initialized. Call asset_init_compression(%d) at initialization time", header.algo, header.algo);
+    if(!algo || (header.flags & ASSET_FLAG_SEEKABLE))
+    {
+        /* mkdfs never creates seekable assets */
+        return DFS_EBADFS;
+    }
+    if(header.flags & ASSET_FLAG_INPLACE)
+    {
+        /* Skip the in-place decompression margin, only used by asset_load */
+        file->loc += 4;
+    }
+
+    dfs_decomp_t *dec = malloc(sizeof(dfs_decomp_t) + algo->state_size);
+    if(!dec)
+    {
+        return DFS_ENFILE;
+    }
+
+    /* The decompressor reads the compressed data via stdio. Disable buffering:
+       the decompressors have their own buffer, and DragonFS caches reads. */
+    dec->fp = funopen(file, decomp_readfn, NULL, decomp_seekfn, NULL);
+    if(!dec->fp)
+    {
+        free(dec);
+        return DFS_ENFILE;
+    }
+    setbuf(dec->fp, NULL);
+
+    dec->algo = algo;
+    dec->data_loc = file->loc;
+    dec->loc = 0;
+    dec->dec_loc = 0;
+    dec->size = header.orig_size;
+    algo->decompress_init(dec->state, dec->fp);
+
+    file->decomp = dec;
+    return DFS_ESUCCESS;
+}
+
+/**
+ * @brief Read data from a compressed file, at the current location
+ *
+ * Decompression is sequential, so reaching the current location might
+ * require to decompress and discard the data before it (after a forward
+ * seek), or to restart from the beginning of the file (after a backward seek).
+ *
+ * @param[in]  file
+ *             The open file
+ * @param[out] buf
+ *             Buffer to read into
+ * @param[in]  to_read
+ *             Number of bytes to read
+ *
+ * @return The actual number of bytes read or a negative value on failure.
+ */
+static int decomp_read(open_file_t *file, uint8_t *buf, int to_read)
+{
+    dfs_decomp_t *dec = file->decomp;
+
+    if(dec->loc + to_read > dec->size)
+    {
+        to_read = dec->size - dec->loc;
+    }
+    if(!to_read)
+    {
+        return 0;
+    }
+
+    if(dec->loc < dec->dec_loc)
+    {
+        fseek(dec->fp, dec->data_loc, SEEK_SET);
+        dec->algo->decompress_init(dec->state, dec->fp);
+        dec->dec_loc = 0;
+    }
+
+    while(dec->dec_loc < dec->loc)
+    {
+        uint8_t tmp[256];
+        int skip = dec->loc - dec->dec_loc;
+        int n = dec->algo->decompress_read(dec->state, tmp, skip < (int)sizeof(tmp) ? skip : (int)sizeof(tmp));
+        if(n <= 0)
+        {
+            return DFS_EBADFS;
+        }
+        dec->dec_loc += n;
+    }
+
+    int did_read = 0;
+    while(did_read < to_read)
+    {
+        int n = dec->algo->decompress_read(dec->state, buf + did_read, to_read - did_read);
+        if(n <= 0)
+        {
+            break;
+        }
+        did_read += n;
+    }
+
+    dec->dec_loc += did_read;
+    dec->loc = dec->dec_loc;
+    return did_read ? did_read : DFS_EBADFS;
+}
+
+/**
+ * @brief Read data from a file
+ *
+ * @param[out] buf
+ *             Buffer to read into
+ * @param[in]  size
+ *             Size of each element to read
+ * @param[in]  count
+ *             Number of elements to read
+ * @param[in]  handle
+ *             A valid file handle as returned from #dfs_open.
+ *
+ * @return The actual number of bytes read or a negative value on failure.
+ */
+int dfs_read(void * const buf, int size, int count, uint32_t handle)
+{
+    open_file_t *file = find_open_file(handle);
+
+    if(!file)
+    {
+        return DFS_EBADHANDLE;
+    }
+
+    /* What are they doing? */
+    if(!buf)
+    {
+        return DFS_EBADINPUT;
+    }
+
+    if(file->decomp)
+    {
+        return decomp_read(file, buf, size * count);
+    }
+
+    return read_raw(file, buf, size * count);
+}
+
+/** @brief Maximum number of pending #dfs_read_async requests */
+#define DFS_ASYNC_QUEUE_SIZE    16
+
+/** @brief A pending asynchronous read request */
+typedef struct
+{
+    /** @brief Number of bytes to transfer */
+    int len;
+    /** @brief Completion callback */
+    dfs_read_cb_t cb;
+    /** @brief Opaque context for the callback */
+    void *ctx;
+    /** @brief True if this slot is in use */
+    volatile bool used;
+} dfs_async_req_t;
+
+/** @brief Pending asynchronous reads */
+static dfs_async_req_t async_reqs[DFS_ASYNC_QUEUE_SIZE];
+/** @brief Number of pending asynchronous reads */
+static volatile int async_count = 0;
+
+/** @brief DMA queue callback: complete an asynchronous read */
+static void async_done(void *ctx)
+{
+    dfs_async_req_t *req = ctx;
+    dfs_read_cb_t cb = req->cb;
+    void *cb_ctx = req->ctx;
+    int len = req->len;
+
+    req->used = false;
+    async_count--;
+    if (cb)
+        cb(cb_ctx, len);
+}
+
+/**
+ * @brief Start an asynchronous read from a file
+ *
+ * This function queues a PI DMA transfer from the file into the destination
+ * buffer and returns immediately. When the transfer is finished, the callback
+ * is invoked with the number of bytes read. Requests are submitted to the
+ * DMA queue with #DMA_PRIORITY_NORMAL (see #dma_read_queue), so they are
+ * processed in FIFO order; if too many reads are pending, this function
+ * waits for the oldest one to complete.
+ *
+ * The current position in the file is advanced immediately, so that multiple
+ * reads can be queued back to back (eg: for streaming).
+ *
+ * The transfer goes directly into the destination buffer, so it can be
+ * performed via DMA only under the same conditions of the fast-path of
+ * #dfs_read: the buffer must be 8-byte aligned, the position in the file
+ * must be even, and the length must be even or less than 127 bytes. If any
+ * of these is not met, or the file is compressed, the read is performed
+ * synchronously via #dfs_read and the callback is invoked before returning.
+ *
+ * @note The callback is normally invoked from the PI interrupt handler, so
+ *       it must be short and cannot wait for other interrupts. The buffer
+ *       contents must not be accessed until the callback has been invoked.
+ *
+ * @param[in]  handle
+ *             A valid file handle as returned from #dfs_open.
+ * @param[out] buf
+ *             Buffer to read into
+ * @param[in]  len
+ *             Number of bytes to read
+ * @param[in]  cb
+ *             Callback invoked when the read has completed (can be NULL)
+ * @param[in]  ctx
+ *             Opaque context passed to the callback
+ *
+ * @return The number of bytes that will be read or a negative value on failure.
+ */
+int dfs_read_async(uint32_t handle, void *buf, int len, dfs_read_cb_t cb, void *ctx)
+{
+    open_file_t *file = find_open_file(handle);
+
+    if(!file)
+    {
+        return DFS_EBADHANDLE;
+    }
+
+    if(!buf || len < 0)
+    {
+        return DFS_EBADINPUT;
+    }
+
+    if(file->decomp)
+    {
+        /* Compressed files are decompressed by the CPU: read synchronously */
+        int n = dfs_read(buf, 1, len, handle);
+        if (n >= 0 && cb)
+            cb(ctx, n);
+        return n;
+    }
+
+    /* Bounds check to make sure we don't read past the end */
+    if(file->loc + len > file->size)
+    {
+        len = file->size - file->loc;
+    }
+
+    bool rom_aligned = (file->loc & 1) == 0;
+    bool ram_aligned = ((uint32_t)buf & 7) == 0;
+    bool len_aligned = (len < 0x7F) || ((len & 1) == 0);
+    if (!len || !rom_aligned || !ram_aligned || !len_aligned)
+    {
+        /* Slow path: read synchronously */
+        int n = len ? dfs_read(buf, 1, len, handle) : 0;
+        if (n >= 0 && cb)
+            cb(ctx, n);
+        return n;
+    }
+
+    /* Prepare the cache for the transfer (see dfs_read) */
+    if ((((uint32_t)buf | len) & 15) == 0)
+        data_cache_hit_invalidate(buf, len);
+    else
+        data_cache_hit_writeback_invalidate(buf, len);
+
+    /* Wait for a free slot. Requests are completed by the PI interrupt. */
+    if (async_count == DFS_ASYNC_QUEUE_SIZE)
+    {
+        assertf(get_interrupts_state() == INTERRUPTS_ENABLED,
+            "dfs_read_async: queue full with interrupts disabled");
+        while (async_count == DFS_ASYNC_QUEUE_SIZE) {}
+    }
+
+    disable_interrupts();
+    dfs_async_req_t *req = async_reqs;
+    while (req->used)
+        req++;
+    req->used = true;
+    req->len = len;
+    req->cb = cb;
+    req->ctx = ctx;
+    async_count++;
+    enable_interrupts();
+
+    trace_record(file->trace_path, file->loc, len);
+    dma_read_queue(buf, file->cart_start_loc + file->loc, len,
+        DMA_PRIORITY_NORMAL, async_done, req);
+
+    file->loc += len;
+    return len;
+}
+
+/**
+ * @brief Return the number of asynchronous reads not completed yet
+ *
+ * @return Number of requests queued with #dfs_read_async whose
+ *         callback has not been invoked yet.
+ */
+int dfs_read_async_pending(void)
+{
+    return async_count;
+}
+
+/**
+ * @brief Set the maximum read cache size of an open file
+ *
+ * Reads that cannot be performed with a direct DMA into the destination buffer
+ * (eg: small or unaligned reads) go through a per-file read cache. The cache
+ * starts at #DFS_MIN_CACHE_SIZE bytes and grows (up to the specified
+ * size) when the file is read sequentially, so that parsers reading a file
+ * field by field trigger fewer DMA transfers. The memory for caches larger
+ * than #DFS_MIN_CACHE_SIZE is allocated from the heap on first use.
+ *
+ * This function can only be called before the first read from the file.
+ *
+ * @param[in] handle
+ *            A valid file handle as returned from #dfs_open.
+ * @param[in] size
+ *            Maximum cache size in bytes (rounded up to a multiple of 16).
+ *            Values smaller than #DFS_MIN_CACHE_SIZE disable read-ahead.
+ *
+ * @return DFS_ESUCCESS on success or a negative value on error.
+ */
+int dfs_set_cache_size(uint32_t handle, int size)
+{
+    open_file_t *file = find_open_file(handle);
+
+    if(!file)
+    {
+        return DFS_EBADHANDLE;
+    }
+
+    if(file->cache != file->cached_data)
+    {
+        /* The cache was already allocated */
+        return DFS_EBADINPUT;
+    }
+
+    file->cache_max = size < DFS_MIN_CACHE_SIZE ? DFS_MIN_CACHE_SIZE : (size + 15) & ~15;
+    return DFS_ESUCCESS;
+}
+
+/**
+ * @brief Set the default maximum read cache size of files
+ *
+ * This setting applies to all files opened afterwards, including those
+ * opened through the standard C library (fopen("rom:/...")). See
+ * #dfs_set_cache_size for more information.
+ *
+ * @param[in] size
+ *            Maximum cache size in bytes. The default is #DFS_MIN_CACHE_SIZE,
+ *            which disables read-ahead.
+ */
+void dfs_set_default_cache_size(int size)
+{
+    default_cache_size = size < DFS_MIN_CACHE_SIZE ? DFS_MIN_CACHE_SIZE : (size + 15) & ~15;
+}
+
+/**
+ * @brief Start recording file accesses
+ *
+ * The access tracer records all the opens and reads performed on DragonFS
+ * (including those done through stdio, and direct ROM accesses via
+ * #dfs_rom_addr and #dfs_map), with the file path, the byte range and a
+ * timestamp. Use #dfs_trace_dump to write out the trace, for instance after
+ * the game has booted or a level has been loaded.
+ *
+ * Starting a new trace discards the previous one.
+ *
+ * @param[in] max_events
+ *            Maximum number of events to record. Events beyond this
+ *            limit are dropped (and counted).
+ */
+void dfs_trace_start(int max_events)
+{
+    dfs_trace_stop();
+
+    for(int i = 0; i < trace_num_paths; i++)
+    {
+        free(trace_paths[i]);
+    }
+    free(trace_paths);
+    free(trace_events);
+    trace_paths = NULL;
+    trace_num_paths = 0;
+
+    trace_events = malloc(max_events * sizeof(trace_event_t));
+    assertf(trace_events, "dfs_trace_start: out of memory");
+    trace_max_events = max_events;
+    trace_num_events = 0;
+    trace_dropped = 0;
+
+    /* Files opened before starting the trace are not traced, as their
+       paths are not known. */
+    for(int i = 0; i < open_files_size; i++)
+    {
+        open_files[i]->trace_path = -1;
+    }
+
+    trace_enabled = true;
+}
+
+/**
+ * @brief Stop recording file accesses
+ *
+ * The recorded trace is kept until the next call to #dfs_trace_start.
+ */
+void dfs_trace_stop(void)
+{
+    trace_enabled = false;
+}
+
+/**
+ * @brief Write the recorded access trace
+ *
+ * The output is a valid mkdfs manifest: events are written as comments,
+ * followed by the list of accessed files in order of first access. Feed
+ * it to mkdfs with `--manifest` to lay out the files in the order in which
+ * they are loaded, so that loading reads the ROM sequentially.
+ *
+ * To get the trace over the USB debug channel, pass stderr (after
+ * initializing it with #debug_init_usblog).
+ *
+ * @param[in] out
+ *            Stream to write the trace to
+ */
+void dfs_trace_dump(FILE *out)
+{
+    uint32_t t0 = trace_num_events ? trace_events[0].ticks : 0;
+
+    fprintf(out, "# DragonFS trace: %d events (%d dropped), %d files\n",
+        trace_num_events, trace_dropped, trace_num_paths);
+    fprintf(out, "#   time (us)     offset     length  path\n");
+    for(int i = 0; i < trace_num_events; i++)
+    {
+        trace_event_t *ev = &trace_events[i];
+        fprintf(out, "# %11lld %10lu %10lu  %s%s\n",
+            TIMER_MICROS_LL(ev->ticks - t0), ev->offset, ev->len,
+            trace_paths[ev->path], ev->len ? "" : " (open)");
+    }
+
+    fprintf(out, "# Load order (mkdfs manifest):\n");
+    for(int i = 0; i < trace_num_paths; i++)
+    {
+        fprintf(out, "%s\n", trace_paths[i]);
+    }
+}
+
 /**
  * @brief Return the file size of an open file
  *
@@ -1052,7 +2055,7 @@ int dfs_size(uint32_t handle)
         return DFS_EBADHANDLE;
     }
 
-    return file->size;
+    return file->decomp ? file->decomp->size : file->size;
 }
 
 /**
@@ -1069,6 +2072,9 @@ int dfs_size(uint32_t handle)
  * @param[in] path
  *            Name of the file
  *
+ * Compressed files (see #FLAGS_COMPRESSED) cannot be accessed directly
+ * in ROM: this function asserts on them.
+ *
  * @return A pointer to the physical address of the file body, or 0
  *         if the file was not found.
  * 
@@ -1077,7 +2083,7 @@ uint32_t dfs_rom_addr(const char *path)
 {
     /* Try to find file */
     directory_entry_t *dirent;
-    int ret = recurse_path(path, WALK_OPEN, &dirent, TYPE_FILE);
+    int ret = find_file(path, &dirent);
 
     if(ret != DFS_ESUCCESS)
     {
@@ -1089,10 +2095,200 @@ uint32_t dfs_rom_addr(const char *path)
     directory_entry_t t_node;
     grab_sector(dirent, &t_node);
 
+    if(get_flags(&t_node) & FLAGS_COMPRESSED)
+    {
+        assertf(0, "dfs_rom_addr: file %s is compressed in the filesystem, so it cannot be accessed directly in ROM.\n"
+            "Exclude it from compression when running mkdfs (--no-compress)", path);
+        return 0;
+    }
+
+    /* The caller will access the file directly in ROM */
+    if(trace_enabled)
+    {
+        trace_record(trace_path_id(path), 0, get_size(&t_node));
+    }
+
     /* Return the starting location in ROM */
     return get_start_location(&t_node);
 }
 
+/**
+ * @brief Map a file as a read-only region of PI space
+ *
+ * This function returns the physical address in PI space and the size of
+ * a file, so that it can be accessed like a read-only memory region with
+ * #dfs_map_read (or directly with the DMA functions), without opening a
+ * handle. This is useful to read tables or other data structures in place
+ * from ROM, fetching only the required portions.
+ *
+ * @param[in]  path
+ *             Name of the file
+ * @param[out] rom_addr
+ *             Physical address of the file body in PI space
+ * @param[out] size
+ *             Size of the file in bytes
+ *
+ * @return DFS_ESUCCESS on success or a negative value on error
+ *         (#DFS_ECOMPRESSED if the file is compressed, see #FLAGS_COMPRESSED).
+ */
+int dfs_map(const char *path, uint32_t *rom_addr, int *size)
+{
+    if(!rom_addr || !size)
+    {
+        return DFS_EBADINPUT;
+    }
+
+    directory_entry_t *dirent;
+    int ret = find_file(path, &dirent);
+
+    if(ret != DFS_ESUCCESS)
+    {
+        return ret;
+    }
+
+    directory_entry_t t_node;
+    grab_sector(dirent, &t_node);
+
+    if(get_flags(&t_node) & FLAGS_COMPRESSED)
+    {
+        return DFS_ECOMPRESSED;
+    }
+
+    *rom_addr = get_start_location(&t_node);
+    *size = get_size(&t_node);
+
+    if(trace_enabled)
+    {
+        trace_record(trace_path_id(path), 0, *size);
+    }
+    return DFS_ESUCCESS;
+}
+
+/**
+ * @brief Read a window of a file mapped with #dfs_map
+ *
+ * The window is clamped to the end of the file. The data is transferred
+ * via DMA directly into the destination buffer whenever possible; when
+ * the buffer and the file offset have different parity (which the PI
+ * cannot handle), the data goes through a small bounce buffer.
+ * Cache coherency of the destination buffer is handled internally.
+ *
+ * @param[in]  rom_addr
+ *             Physical address of the file, as returned by #dfs_map
+ * @param[in]  size
+ *             Size of the file, as returned by #dfs_map
+ * @param[in]  offset
+ *             Offset within the file of the window to read
+ * @param[out] buf
+ *             Destination buffer
+ * @param[in]  len
+ *             Length of the window in bytes
+ *
+ * @return The number of bytes read or a negative value on failure.
+ */
+int dfs_map_read(uint32_t rom_addr, int size, int offset, void *buf, int len)
+{
+    if(!buf || offset < 0 || len < 0 || offset > size)
+    {
+        return DFS_EBADINPUT;
+    }
+
+    if(len > size - offset)
+    {
+        len = size - offset;
+    }
+    if(!len)
+    {
+        return 0;
+    }
+
+    uint32_t addr = rom_addr + offset;
+
+    if(((addr ^ (uint32_t)buf) & 1) == 0)
+    {
+        grab_data(addr, buf, len);
+        return len;
+    }
+
+    /* Different parity: bounce through an aligned buffer */
+    uint8_t bounce[256] __attribute__((aligned(16)));
+    uint8_t *data = buf;
+    int left = len;
+    while(left)
+    {
+        int chunk = left < (int)sizeof(bounce) - 16 ? left : (int)sizeof(bounce) - 16;
+        int misalign = addr & 7;
+        grab_data(addr - misalign, bounce, (chunk + misalign + 1) & ~1);
+        memcpy(data, bounce + misalign, chunk);
+        addr += chunk;
+        data += chunk;
+        left -= chunk;
+    }
+
+    return len;
+}
+
+/**
+ * @brief Start an asynchronous read of a window of a file mapped with #dfs_map
+ *
+ * This works like #dfs_map_read, but the transfer is submitted to the DMA
+ * queue (see #dma_read_queue) and the function returns immediately. The
+ * destination buffer must not be accessed until the callback is invoked.
+ *
+ * No bounce buffer is used, so the destination buffer must have the same
+ * 2-byte alignment as the ROM address of the window.
+ *
+ * @param[in]  rom_addr
+ *             Physical address of the file, as returned by #dfs_map
+ * @param[in]  size
+ *             Size of the file, as returned by #dfs_map
+ * @param[in]  offset
+ *             Offset within the file of the window to read
+ * @param[out] buf
+ *             Destination buffer
+ * @param[in]  len
+ *             Length of the window in bytes
+ * @param[in]  priority
+ *             Priority of the DMA request (see #DMA_PRIORITY_NORMAL)
+ * @param[in]  cb
+ *             Callback invoked when the transfer is finished (can be NULL)
+ * @param[in]  ctx
+ *             Opaque context passed to the callback
+ *
+ * @return The number of bytes that will be read or a negative value on failure.
+ */
+int dfs_map_read_async(uint32_t rom_addr, int size, int offset, void *buf, int len,
+    int priority, dma_callback_t cb, void *ctx)
+{
+    if(!buf || offset < 0 || len < 0 || offset > size)
+    {
+        return DFS_EBADINPUT;
+    }
+
+    uint32_t addr = rom_addr + offset;
+    if(((addr ^ (uint32_t)buf) & 1) != 0)
+    {
+        return DFS_EBADINPUT;
+    }
+
+    if(len > size - offset)
+    {
+        len = size - offset;
+    }
+    if(!len)
+    {
+        if(cb)
+        {
+            cb(ctx);
+        }
+        return 0;
+    }
+
+    data_cache_hit_writeback_invalidate(buf, len);
+    dma_read_queue(buf, addr, len, priority, cb, ctx);
+    return len;
+}
+
 /**
  * @brief Return whether the end of file has been reached
  *
@@ -1111,7 +2307,7 @@ int dfs_eof(uint32_t handle)
         return DFS_EBADHANDLE;
     }
 
-    if(file->loc == file->size)
+    if(file->decomp ? file->decomp->loc == file->decomp->size : file->loc == file->size)
     {
         /* Yup, eof */
         return 1;
@@ -1218,6 +2414,27 @@ static int __read( void *file, uint8_t *ptr, int len )
     return dfs_read( ptr, 1, len, (uint32_t)file );
 }
 
+/**
+ * @brief Newlib-compatible asynchronous read
+ *
+ * @param[in]  file
+ *             File pointer as returned by #__open
+ * @param[out] ptr
+ *             Pointer to buffer to read to
+ * @param[in]  len
+ *             Length in bytes to read
+ * @param[in]  cb
+ *             Completion callback
+ * @param[in]  ctx
+ *             Opaque context for the callback
+ *
+ * @return The amount of data that will be read.
+ */
+static int __read_async( void *file, uint8_t *ptr, int len, void (*cb)(void *ctx, int len), void *ctx )
+{
+    return dfs_read_async( (uint32_t)file, ptr, len, cb, ctx );
+}
+
 /**
  * @brief Newlib-compatible close
  *
@@ -1249,11 +2466,11 @@ static int __findfirst( char *path, dir_t *dir )
     int flags = dfs_dir_findfirst( path, dir->d_name );
     if( flags < 0 ) { return -1; }
 
-    if( flags == FLAGS_FILE )
+    if( FILETYPE(flags) == FLAGS_FILE )
     {
         dir->d_type = DT_REG;
     }
-    else if( flags == FLAGS_DIR )
+    else if( FILETYPE(flags) == FLAGS_DIR )
     {
         dir->d_type = DT_DIR;
     }
@@ -1283,11 +2500,11 @@ static int __findnext( dir_t *dir )
     int flags = dfs_dir_findnext( dir->d_name );
     if( flags < 0 ) { return -1; }
 
-    if( flags == FLAGS_FILE )
+    if( FILETYPE(flags) == FLAGS_FILE )
     {
         dir->d_type = DT_REG;
     }
-    else if( flags == FLAGS_DIR )
+    else if( FILETYPE(flags) == FLAGS_DIR )
     {
         dir->d_type = DT_DIR;
     }
@@ -1316,7 +2533,8 @@ static filesystem_t dragon_fs = {
     __close,
     0,
     __findfirst,
-    __findnext
+    __findnext,
+    __read_async
 };
 
 /**
@@ -1370,6 +2588,8 @@ static void __dfs_check_emulation(void)
  */
 int dfs_init(uint32_t base_fs_loc)
 {
+    uint32_t t0 = TICKS_READ();
+
     /* Detect if we are running on emulator accurate enough to emulate DragonFS. */
     __dfs_check_emulation();
 
@@ -1400,6 +2620,7 @@ int dfs_init(uint32_t base_fs_loc)
     /* Succeeded, push our filesystem into newlib */
     attach_filesystem( "rom:/", &dragon_fs );
 
+    __boot_profile_record( "dfs_init", t0 );
     return DFS_ESUCCESS;
 }
 
@@ -1415,6 +2636,7 @@ const char *dfs_strerror(int error)
     case DFS_EBADINPUT:  return "Invalid argument";
     case DFS_ENFILE:     return "No free file handles";
     case DFS_EBADHANDLE: return "Bad file handle";
+    case DFS_ECOMPRESSED: return "File is compressed";
     default:             return "Unknown error";
     }
 }
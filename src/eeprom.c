@@ -6,8 +6,39 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
 #include "eeprom.h"
 #include "joybus.h"
+#include "joybus_internal.h"
+#include "eeprom_internal.h"
+#include "debug.h"
+
+/**
+ * @brief Maximum number of pending asynchronous EEPROM accesses.
+ *
+ * Each pending access holds one of these slots until its joybus
+ * reply is received.
+ */
+#define EEPROM_ASYNC_SLOTS 8
+
+/** @brief Pending asynchronous EEPROM access */
+typedef struct eeprom_async_slot_s
+{
+    /** @brief Destination buffer for reads (NULL for writes) */
+    uint8_t * dest;
+    /** @brief User completion callback */
+    eeprom_callback_t callback;
+    /** @brief Opaque pointer passed to the callback */
+    void * ctx;
+    /** @brief True while the access is in flight */
+    volatile bool busy;
+} eeprom_async_slot_t;
+
+/** @brief Pool of pending asynchronous EEPROM accesses */
+static eeprom_async_slot_t eeprom_async_slots[EEPROM_ASYNC_SLOTS];
+/** @brief Index of the next slot to allocate in #eeprom_async_slots */
+static int eeprom_async_next = 0;
 
 /**
  * @brief Read the status of the EEPROM.
@@ -107,6 +138,35 @@ void eeprom_read( uint8_t block, uint8_t * dest )
     memcpy( dest, &output[1], EEPROM_BLOCK_SIZE );
 }
 
+/**
+ * @brief Prepare the joybus block that writes a block to EEPROM.
+ *
+ * @param[out] input
+ *             Joybus input block to prepare
+ * @param[in]  block
+ *             Block to write data to
+ * @param[in]  src
+ *             Source buffer for the eight bytes of data to write to EEPROM.
+ */
+static void eeprom_write_block_init( uint64_t * input, uint8_t block, const uint8_t * src )
+{
+    static const uint64_t blank[JOYBUS_BLOCK_DWORDS] =
+    {
+        0x000000000a010500,
+        0x0000000000000000,
+        0xfffe000000000000,
+        0,
+        0,
+        0,
+        0,
+        1
+    };
+
+    memcpy( input, blank, JOYBUS_BLOCK_SIZE );
+    input[0] |= block;
+    memcpy( &input[1], src, EEPROM_BLOCK_SIZE );
+}
+
 /**
  * @brief Write a block to EEPROM.
  *
@@ -119,25 +179,129 @@ void eeprom_read( uint8_t block, uint8_t * dest )
  * @return the EEPROM status byte
  */
 uint8_t eeprom_write( uint8_t block, const uint8_t * src )
+{
+    uint64_t input[JOYBUS_BLOCK_DWORDS];
+    uint64_t output[JOYBUS_BLOCK_DWORDS];
+
+    eeprom_write_block_init( input, block, src );
+
+    joybus_exec( input, output );
+
+    return output[2] >> 56;
+}
+
+/**
+ * @brief Write a block to EEPROM, without waiting for completion.
+ *
+ * @param[in] block
+ *            Block to write data to. Joybus accesses EEPROM in 8-byte blocks.
+ * @param[in] src
+ *            Source buffer for the eight bytes of data to write to EEPROM.
+ *            It is copied before returning.
+ * @param[in] callback
+ *            Joybus completion callback (see #joybus_exec_async)
+ * @param[in] ctx
+ *            Opaque pointer passed to the callback
+ */
+void __eeprom_write_async( uint8_t block, const uint8_t * src, void (*callback)(uint64_t *output, void *ctx), void *ctx )
+{
+    uint64_t input[JOYBUS_BLOCK_DWORDS];
+
+    eeprom_write_block_init( input, block, src );
+
+    joybus_exec_async( input, callback, ctx );
+}
+
+/**
+ * @brief Allocate a slot to track an asynchronous EEPROM access.
+ *
+ * Slots are handed out in a round-robin fashion; since joybus commands
+ * complete in order, the oldest slot is always the first to be released.
+ */
+static eeprom_async_slot_t * eeprom_async_alloc( uint8_t * dest, eeprom_callback_t callback, void * ctx )
+{
+    eeprom_async_slot_t * slot = &eeprom_async_slots[eeprom_async_next];
+    assertf( !slot->busy, "too many pending asynchronous EEPROM accesses" );
+    eeprom_async_next = (eeprom_async_next + 1) % EEPROM_ASYNC_SLOTS;
+
+    slot->dest = dest;
+    slot->callback = callback;
+    slot->ctx = ctx;
+    slot->busy = true;
+    return slot;
+}
+
+/**
+ * @brief Joybus completion callback for asynchronous EEPROM accesses.
+ */
+static void eeprom_async_done( uint64_t * output, void * ctx )
+{
+    eeprom_async_slot_t * slot = ctx;
+    uint8_t status = 0;
+
+    if ( slot->dest ) memcpy( slot->dest, &output[1], EEPROM_BLOCK_SIZE );
+    else status = output[2] >> 56;
+
+    eeprom_callback_t callback = slot->callback;
+    void * cb_ctx = slot->ctx;
+    slot->busy = false;
+    if ( callback ) callback( status, cb_ctx );
+}
+
+/**
+ * @brief Read a block from EEPROM, without waiting for completion.
+ *
+ * The read is queued on the joybus and this function returns immediately.
+ * The destination buffer must stay valid until the callback is invoked.
+ *
+ * @param[in]  block
+ *             Block to read data from. Joybus accesses EEPROM in 8-byte blocks.
+ * @param[out] dest
+ *             Destination buffer for the eight bytes read from EEPROM.
+ * @param[in]  callback
+ *             Function called (under interrupt) when the read is done.
+ *             Can be NULL.
+ * @param[in]  ctx
+ *             Opaque pointer passed to the callback
+ */
+void eeprom_read_async( uint8_t block, uint8_t * dest, eeprom_callback_t callback, void * ctx )
 {
     uint64_t input[JOYBUS_BLOCK_DWORDS] =
     {
-        0x000000000a010500 | block,
-        0x0000000000000000,
-        0xfffe000000000000,
+        0x0000000002080400 | block,
+        0xffffffffffffffff,
+        0xfe00000000000000,
         0,
         0,
         0,
         0,
         1
     };
-    uint64_t output[JOYBUS_BLOCK_DWORDS];
 
-    memcpy( &input[1], src, EEPROM_BLOCK_SIZE );
-
-    joybus_exec( input, output );
+    assert( dest != NULL );
+    joybus_exec_async( input, eeprom_async_done, eeprom_async_alloc( dest, callback, ctx ) );
+}
 
-    return output[2] >> 56;
+/**
+ * @brief Write a block to EEPROM, without waiting for completion.
+ *
+ * The write is queued on the joybus and this function returns immediately,
+ * so that saving does not stall the calling thread. The source data is
+ * copied before returning.
+ *
+ * @param[in] block
+ *            Block to write data to. Joybus accesses EEPROM in 8-byte blocks.
+ * @param[in] src
+ *            Source buffer for the eight bytes of data to write to EEPROM.
+ * @param[in] callback
+ *            Function called (under interrupt) with the EEPROM status byte
+ *            when the write is done. Can be NULL.
+ * @param[in] ctx
+ *            Opaque pointer passed to the callback
+ */
+void eeprom_write_async( uint8_t block, const uint8_t * src, eeprom_callback_t callback, void * ctx )
+{
+    __eeprom_write_async( block, src, eeprom_async_done, eeprom_async_alloc( NULL, callback, ctx ) );
 }
 
 /**
@@ -9,6 +9,7 @@
 #include "libdragon.h"
 #include "system.h"
 #include "utils.h"
+#include "eeprom_internal.h"
 
 /**
  * @brief EEPROM Filesystem file descriptor.
@@ -64,29 +65,94 @@ static eepfs_file_t * eepfs_files = NULL;
  */
 static uint16_t eepfs_files_checksum = 0;
 
+/**
+ * @brief The signature block of the filesystem.
+ * 
+ * Generated by #eepfs_init (see #eepfs_generate_signature), so that
+ * #eepfs_verify_signature only needs to read the first block of EEPROM.
+ */
+static uint64_t eepfs_signature = 0;
+
+/** @brief Maximum number of EEPROM blocks (16k EEPROM) */
+#define EEPFS_MAX_BLOCKS 256
+
+/**
+ * @brief RAM shadow of the EEPROM contents.
+ * 
+ * Allocated by #eepfs_init. Blocks are loaded on first access
+ * (see #eepfs_shadow_valid), and writes only go to EEPROM for
+ * the blocks whose contents actually changed (see #eepfs_shadow_dirty).
+ */
+static uint8_t * eepfs_shadow = NULL;
+
+/** @brief Bitmap of the blocks of #eepfs_shadow that mirror EEPROM */
+static uint32_t eepfs_shadow_valid[EEPFS_MAX_BLOCKS / 32];
+
+/** @brief Bitmap of the blocks of #eepfs_shadow still to be written to EEPROM */
+static volatile uint32_t eepfs_shadow_dirty[EEPFS_MAX_BLOCKS / 32];
+
+/** @brief True if writes are deferred until #eepfs_flush or #eepfs_flush_async */
+static bool eepfs_deferred = false;
+
+/** @brief True while #eepfs_flush_async is writing blocks in background */
+static volatile bool eepfs_flushing = false;
+
+/** @brief Test a bit of a block bitmap */
+#define BLOCK_TEST(bitmap, block)   ((bitmap)[(block) / 32] & (1u << ((block) % 32)))
+/** @brief Set a bit of a block bitmap */
+#define BLOCK_SET(bitmap, block)    ((bitmap)[(block) / 32] |= (1u << ((block) % 32)))
+/** @brief Clear a bit of a block bitmap */
+#define BLOCK_CLEAR(bitmap, block)  ((bitmap)[(block) / 32] &= ~(1u << ((block) % 32)))
+
+/** @brief Table of the CRC-16/CCITT (poly 0x1021) of every byte value */
+static const uint16_t crc16_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0,
+};
+
 /**
  * @brief Calculates a CRC-16 checksum from an array of bytes.
  * 
  * CRC-16/CCITT-FALSE, CRC-16/IBM-3740:
  * poly=0x1021, init=0xFFFF, xorout=0x0000
- * 
- * @see https://stackoverflow.com/a/23726131
  */
 static uint16_t calculate_crc16(const uint8_t * data, size_t len)
 {
-    uint8_t x;
     uint16_t crc = 0xFFFF;
 
     while ( len-- )
     {
-        x = crc >> 8 ^ *(data++);
-        x ^= x>>4;
-        crc = (
-            (crc << 8) ^ 
-            ((uint16_t)(x << 12)) ^ 
-            ((uint16_t)(x << 5)) ^ 
-            ((uint16_t)x)
-        );
+        crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ *(data++)];
     }
 
     return crc;
@@ -204,6 +270,118 @@ static const eepfs_file_t * eepfs_get_file(int handle)
     return NULL;
 }
 
+/**
+ * @brief Reads a range of blocks through the EEPROM shadow.
+ * 
+ * @param[out] dest
+ *             Buffer to read into
+ * @param[in]  start_block
+ *             First block to read
+ * @param[in]  num_bytes
+ *             Number of bytes to read
+ */
+static void eepfs_shadow_read(uint8_t * dest, size_t start_block, size_t num_bytes)
+{
+    for ( size_t block = start_block; num_bytes > 0; ++block )
+    {
+        uint8_t * shadow = eepfs_shadow + block * EEPROM_BLOCK_SIZE;
+        const size_t n = MIN(num_bytes, EEPROM_BLOCK_SIZE);
+
+        if ( !BLOCK_TEST(eepfs_shadow_valid, block) )
+        {
+            eeprom_read(block, shadow);
+            BLOCK_SET(eepfs_shadow_valid, block);
+        }
+
+        memcpy(dest, shadow, n);
+        dest += n;
+        num_bytes -= n;
+    }
+}
+
+/**
+ * @brief Writes a range of blocks into the EEPROM shadow.
+ * 
+ * Only the blocks whose contents change are marked as dirty.
+ * Unless writes are deferred, they are then written to EEPROM.
+ * 
+ * @param[in] src
+ *            Buffer of data to be written
+ * @param[in] start_block
+ *            First block to write
+ * @param[in] num_bytes
+ *            Number of bytes to write
+ */
+static void eepfs_shadow_write(const uint8_t * src, size_t start_block, size_t num_bytes)
+{
+    for ( size_t block = start_block; num_bytes > 0; ++block )
+    {
+        uint8_t * shadow = eepfs_shadow + block * EEPROM_BLOCK_SIZE;
+        const size_t n = MIN(num_bytes, EEPROM_BLOCK_SIZE);
+
+        /* A partial block needs the rest of its current contents */
+        if ( n < EEPROM_BLOCK_SIZE && !BLOCK_TEST(eepfs_shadow_valid, block) )
+        {
+            eeprom_read(block, shadow);
+            BLOCK_SET(eepfs_shadow_valid, block);
+        }
+
+        if ( !BLOCK_TEST(eepfs_shadow_valid, block) || memcmp(shadow, src, n) != 0 )
+        {
+            disable_interrupts();
+            memcpy(shadow, src, n);
+            BLOCK_SET(eepfs_shadow_valid, block);
+            BLOCK_SET(eepfs_shadow_dirty, block);
+            enable_interrupts();
+        }
+
+        src += n;
+        num_bytes -= n;
+    }
+
+    if ( !eepfs_deferred )
+    {
+        eepfs_flush();
+    }
+}
+
+/**
+ * @brief Finds the next dirty block, and marks it as clean.
+ * 
+ * Must be called with interrupts disabled.
+ * 
+ * @return The block number, or -1 if there are no dirty blocks
+ */
+static int eepfs_next_dirty_block(void)
+{
+    for ( int i = 0; i < EEPFS_MAX_BLOCKS / 32; ++i )
+    {
+        if ( eepfs_shadow_dirty[i] )
+        {
+            const int block = i * 32 + __builtin_ctz(eepfs_shadow_dirty[i]);
+            BLOCK_CLEAR(eepfs_shadow_dirty, block);
+            return block;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Joybus callback of the background flush: writes the next dirty block.
+ * 
+ * Called under interrupt when the previous block write is done.
+ */
+static void eepfs_flush_async_next(uint64_t * output, void * ctx)
+{
+    const int block = eepfs_next_dirty_block();
+    if ( block < 0 )
+    {
+        eepfs_flushing = false;
+        return;
+    }
+    __eeprom_write_async(block, eepfs_shadow + block * EEPROM_BLOCK_SIZE, eepfs_flush_async_next, NULL);
+}
+
 /**
  * @brief Initializes the EEPROM filesystem.
  * 
@@ -303,9 +481,20 @@ int eepfs_init(const eepfs_entry_t * entries, size_t count)
         return EEPFS_EBADFS;
     }
 
+    /* Allocate the shadow of the EEPROM contents, loaded on demand */
+    eepfs_shadow = malloc(total_blocks * EEPROM_BLOCK_SIZE);
+    if ( eepfs_shadow == NULL )
+    {
+        eepfs_close();
+        return EEPFS_ENOMEM;
+    }
+    memset(eepfs_shadow_valid, 0, sizeof(eepfs_shadow_valid));
+    memset((void *)eepfs_shadow_dirty, 0, sizeof(eepfs_shadow_dirty));
+
     /* Calculate and store the CRC-16 checksum for the declared entries */
     const size_t entries_size = sizeof(eepfs_entry_t) * count;
     eepfs_files_checksum = calculate_crc16((void *)entries, entries_size);
+    eepfs_signature = eepfs_generate_signature();
 
     return EEPFS_ESUCCESS;
 }
@@ -327,10 +516,17 @@ int eepfs_close(void)
         return EEPFS_EBADFS;
     }
 
+    /* Make sure that the pending writes are not lost */
+    eepfs_flush();
+    free(eepfs_shadow);
+    eepfs_shadow = NULL;
+    eepfs_deferred = false;
+
     /* Clear the file descriptor table */
     free(eepfs_files);
     eepfs_files = NULL;
     eepfs_files_checksum = 0;
+    eepfs_signature = 0;
     eepfs_files_count = 0;
 
     return EEPFS_ESUCCESS;
@@ -364,8 +560,7 @@ int eepfs_read(const char * path, void * dest, size_t size)
         return EEPFS_EBADINPUT;
     }
 
-    const size_t start_bytes = file->start_block * EEPROM_BLOCK_SIZE;
-    eeprom_read_bytes(dest, start_bytes, file->num_bytes);
+    eepfs_shadow_read(dest, file->start_block, file->num_bytes);
 
     return EEPFS_ESUCCESS;
 }
@@ -373,8 +568,10 @@ int eepfs_read(const char * path, void * dest, size_t size)
 /**
  * @brief Writes an entire file to the EEPROM filesystem.
  * 
+ * Only the 8-byte blocks whose contents changed are written to EEPROM.
  * Each EEPROM block write takes approximately 15 milliseconds;
- * this operation may block for a while!
+ * this operation may block for a while, unless writes are deferred
+ * (see #eepfs_set_deferred).
  *
  * @param[in] path
  *            Path of file in EEPROM filesystem to write to
@@ -401,8 +598,7 @@ int eepfs_write(const char * path, const void * src, size_t size)
         return EEPFS_EBADINPUT;
     }
 
-    const size_t start_bytes = file->start_block * EEPROM_BLOCK_SIZE;
-    eeprom_write_bytes(src, start_bytes, file->num_bytes);
+    eepfs_shadow_write(src, file->start_block, file->num_bytes);
 
     return EEPFS_ESUCCESS;
 }
@@ -434,17 +630,11 @@ int eepfs_erase(const char * path)
         return EEPFS_ENOFILE;
     }
 
+    /* Write the blocks in with zeroes (whole blocks, as files are block-aligned) */
     const size_t num_blocks = DIVIDE_CEIL(file->num_bytes, EEPROM_BLOCK_SIZE);
-    size_t current_block = file->start_block;
-
-    /* eeprom_buf is initialized to all zeroes */
-    const uint8_t eeprom_buf[EEPROM_BLOCK_SIZE] = {0};
-
-    /* Write the blocks in with zeroes */
-    while ( current_block < file->start_block + num_blocks )
-    {
-        eeprom_write(current_block++, eeprom_buf);
-    }
+    uint8_t zeroes[num_blocks * EEPROM_BLOCK_SIZE];
+    memset(zeroes, 0, sizeof(zeroes));
+    eepfs_shadow_write(zeroes, file->start_block, sizeof(zeroes));
 
     return EEPFS_ESUCCESS;
 }
@@ -474,16 +664,20 @@ int eepfs_erase(const char * path)
  */
 bool eepfs_verify_signature(void)
 {
-    /* Generate the expected signature for the filesystem */
-    const uint64_t signature = eepfs_generate_signature();
-
-    /* Read the signature block out of EEPROM */
+    /* Read the signature block out of EEPROM (only once, via the shadow) */
     uint8_t eeprom_buf[EEPROM_BLOCK_SIZE];
-    eeprom_read(0, eeprom_buf);
+    if ( eepfs_shadow == NULL )
+    {
+        eeprom_read(0, eeprom_buf);
+    }
+    else
+    {
+        eepfs_shadow_read(eeprom_buf, 0, EEPROM_BLOCK_SIZE);
+    }
 
     /* If the signatures don't match, we can be pretty sure
        that the data in EEPROM is not the expected filesystem */
-    return memcmp(eeprom_buf, (uint8_t *)&signature, EEPROM_BLOCK_SIZE) == 0;
+    return memcmp(eeprom_buf, (uint8_t *)&eepfs_signature, EEPROM_BLOCK_SIZE) == 0;
 }
 
 /**
@@ -505,9 +699,13 @@ bool eepfs_verify_signature(void)
  */
 void eepfs_wipe(void)
 {
+    /* Everything is rewritten, so pending writes are irrelevant */
+    while ( eepfs_flushing ) { /* wait for the background flush */ }
+    memset((void *)eepfs_shadow_dirty, 0, sizeof(eepfs_shadow_dirty));
+    memset(eepfs_shadow_valid, 0, sizeof(eepfs_shadow_valid));
+
     /* Write the filesystem signature into the first block */
-    const uint64_t signature = eepfs_generate_signature();
-    eeprom_write(0, (uint8_t *)&signature);
+    eeprom_write(0, (uint8_t *)&eepfs_signature);
 
     /* eeprom_buf is initialized to all zeroes */
     const uint8_t eeprom_buf[EEPROM_BLOCK_SIZE] = {0};
@@ -522,3 +720,112 @@ void eepfs_wipe(void)
     }
 }
 
+/**
+ * @brief Enables or disables deferred writes.
+ * 
+ * By default, #eepfs_write and #eepfs_erase write the changed blocks to
+ * EEPROM before returning. With deferred writes, they only update the RAM
+ * shadow of the EEPROM contents: the changed blocks are then written by
+ * #eepfs_flush, or in background by #eepfs_flush_async. Successive writes
+ * to the same file before a flush are coalesced.
+ * 
+ * Disabling deferred writes flushes the pending ones.
+ * 
+ * @param[in] deferred
+ *            True to defer writes, false to write immediately
+ */
+void eepfs_set_deferred(bool deferred)
+{
+    eepfs_deferred = deferred;
+    if ( !deferred )
+    {
+        eepfs_flush();
+    }
+}
+
+/**
+ * @brief Writes all the pending blocks to EEPROM.
+ * 
+ * Waits for a background flush to finish first, if one is in progress.
+ * Each EEPROM block write takes approximately 15 milliseconds.
+ * 
+ * @return The number of blocks written
+ */
+int eepfs_flush(void)
+{
+    int count = 0;
+
+    if ( eepfs_shadow == NULL )
+    {
+        return 0;
+    }
+
+    while ( eepfs_flushing ) { /* wait for the background flush */ }
+
+    while ( true )
+    {
+        disable_interrupts();
+        const int block = eepfs_next_dirty_block();
+        enable_interrupts();
+        if ( block < 0 )
+        {
+            break;
+        }
+        eeprom_write(block, eepfs_shadow + block * EEPROM_BLOCK_SIZE);
+        ++count;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Writes the pending blocks to EEPROM in background.
+ * 
+ * The blocks are written one at a time under interrupt, so this function
+ * returns immediately and the flush runs across the next frames. Blocks
+ * changed while the flush is in progress are written as well. Use
+ * #eepfs_flush_pending to check when it is done.
+ * 
+ * @note This function requires interrupts to be enabled to make progress.
+ */
+void eepfs_flush_async(void)
+{
+    if ( eepfs_shadow == NULL )
+    {
+        return;
+    }
+
+    disable_interrupts();
+    if ( !eepfs_flushing )
+    {
+        const int block = eepfs_next_dirty_block();
+        if ( block >= 0 )
+        {
+            eepfs_flushing = true;
+            __eeprom_write_async(block, eepfs_shadow + block * EEPROM_BLOCK_SIZE, eepfs_flush_async_next, NULL);
+        }
+    }
+    enable_interrupts();
+}
+
+/**
+ * @brief Returns whether there are writes not yet done to EEPROM.
+ * 
+ * @retval true if there are dirty blocks, or a background flush is in progress
+ * @retval false if the EEPROM is up to date
+ */
+bool eepfs_flush_pending(void)
+{
+    if ( eepfs_flushing )
+    {
+        return true;
+    }
+    for ( int i = 0; i < EEPFS_MAX_BLOCKS / 32; ++i )
+    {
+        if ( eepfs_shadow_dirty[i] )
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,174 @@
+/**
+ * @file framepipe.c
+ * @brief Frame pipeline: overlap the CPU and the RSP/RDP across frames
+ * @ingroup display
+ */
+#include <string.h>
+#include "framepipe.h"
+#include "display.h"
+#include "rdp.h"
+#include "rspq.h"
+#include "interrupt.h"
+#include "n64sys.h"
+#include "debug.h"
+
+/** @brief Size of the pages of the per-frame block arenas */
+#define FRAME_PIPELINE_ARENA_PAGE_SIZE      4096
+
+/** @brief A frame in flight */
+typedef struct {
+    surface_t *surf;                ///< Display buffer of the frame
+    rspq_block_arena_t *arena;      ///< Arena for the blocks of the frame (allocated on first use)
+    uint32_t end_ticks;             ///< Time of #frame_pipeline_end
+    volatile bool busy;             ///< True from #frame_pipeline_end until the frame is done
+} fp_frame_t;
+
+/** @brief Frames in flight */
+static fp_frame_t fp_frames[FRAME_PIPELINE_MAX_FRAMES];
+/** @brief Number of frames in flight (0 if not initialized) */
+static int fp_num_frames;
+/** @brief Index of the current frame */
+static int fp_cur;
+/** @brief Flags given to #frame_pipeline_init */
+static uint32_t fp_flags;
+/** @brief True between #frame_pipeline_begin and #frame_pipeline_end */
+static bool fp_in_frame;
+/** @brief Time of the last #frame_pipeline_begin (after waiting) */
+static uint32_t fp_begin_ticks;
+/** @brief Statistics (updated also by the completion callback) */
+static frame_pipeline_stats_t fp_stats;
+
+/** @brief Called in interrupt context when the RSP/RDP is done with a frame */
+static void frame_pipeline_done(void *arg)
+{
+    fp_frame_t *f = arg;
+    uint32_t ticks = TICKS_SINCE(f->end_ticks);
+    fp_stats.draw_ticks += ticks;
+    if (ticks > fp_stats.draw_max_ticks) fp_stats.draw_max_ticks = ticks;
+    fp_stats.completed++;
+
+    display_show(f->surf);
+    f->surf = NULL;
+    f->busy = false;
+}
+
+/** @brief Wait until a frame is done */
+static void frame_pipeline_wait_frame(fp_frame_t *f)
+{
+    if (!f->busy)
+        return;
+    assertf(get_interrupts_state() == INTERRUPTS_ENABLED,
+        "frame_pipeline: cannot wait for a frame with interrupts disabled");
+    rspq_flush();
+    while (f->busy) { ; }
+}
+
+void frame_pipeline_init(int num_frames, uint32_t flags)
+{
+    assertf(num_frames >= 1 && num_frames <= FRAME_PIPELINE_MAX_FRAMES,
+        "frame_pipeline: invalid number of frames: %d (max: %d)", num_frames, FRAME_PIPELINE_MAX_FRAMES);
+
+    frame_pipeline_close();
+    fp_num_frames = num_frames;
+    fp_flags = flags;
+    fp_cur = 0;
+    fp_in_frame = false;
+    frame_pipeline_reset_stats();
+}
+
+surface_t* frame_pipeline_begin(void)
+{
+    assertf(fp_num_frames, "frame_pipeline_init not called");
+    assertf(!fp_in_frame, "frame_pipeline_begin called twice without frame_pipeline_end");
+
+    uint32_t t0 = TICKS_READ();
+    fp_frame_t *f = &fp_frames[fp_cur];
+    frame_pipeline_wait_frame(f);
+    if (f->arena)
+        rspq_block_arena_reset(f->arena);
+    f->surf = display_get();
+
+    uint32_t ticks = TICKS_SINCE(t0);
+    fp_stats.wait_ticks += ticks;
+    if (ticks > fp_stats.wait_max_ticks) fp_stats.wait_max_ticks = ticks;
+
+    if (fp_flags & FRAME_PIPELINE_RDP)
+        rdp_attach(f->surf);
+
+    fp_in_frame = true;
+    fp_begin_ticks = TICKS_READ();
+    return f->surf;
+}
+
+void frame_pipeline_end(void)
+{
+    assertf(fp_in_frame, "frame_pipeline_end called without frame_pipeline_begin");
+    fp_frame_t *f = &fp_frames[fp_cur];
+
+    f->end_ticks = TICKS_READ();
+    uint32_t ticks = TICKS_DISTANCE(fp_begin_ticks, f->end_ticks);
+    fp_stats.cpu_ticks += ticks;
+    if (ticks > fp_stats.cpu_max_ticks) fp_stats.cpu_max_ticks = ticks;
+    fp_stats.frames++;
+
+    // The callback might run right away, if the RSP is already idle
+    f->busy = true;
+    if (fp_flags & FRAME_PIPELINE_RDP) {
+        rdp_detach_async(frame_pipeline_done, f);
+    } else {
+        rspq_syncpoint_on_done(rspq_syncpoint_new(), frame_pipeline_done, f);
+        rspq_flush();
+    }
+
+    fp_in_frame = false;
+    fp_cur = (fp_cur + 1) % fp_num_frames;
+}
+
+rspq_block_arena_t* frame_pipeline_arena(void)
+{
+    assertf(fp_in_frame, "frame_pipeline_arena must be called between frame_pipeline_begin and frame_pipeline_end");
+    fp_frame_t *f = &fp_frames[fp_cur];
+    if (!f->arena)
+        f->arena = rspq_block_arena_new(FRAME_PIPELINE_ARENA_PAGE_SIZE);
+    return f->arena;
+}
+
+int frame_pipeline_index(void)
+{
+    return fp_cur;
+}
+
+void frame_pipeline_wait(void)
+{
+    for (int i = 0; i < fp_num_frames; i++)
+        frame_pipeline_wait_frame(&fp_frames[i]);
+}
+
+void frame_pipeline_get_stats(frame_pipeline_stats_t *stats)
+{
+    disable_interrupts();
+    *stats = fp_stats;
+    enable_interrupts();
+}
+
+void frame_pipeline_reset_stats(void)
+{
+    disable_interrupts();
+    memset(&fp_stats, 0, sizeof(fp_stats));
+    enable_interrupts();
+}
+
+void frame_pipeline_close(void)
+{
+    if (!fp_num_frames)
+        return;
+    assertf(!fp_in_frame, "frame_pipeline_close called during a frame");
+
+    frame_pipeline_wait();
+    for (int i = 0; i < fp_num_frames; i++) {
+        if (fp_frames[i].arena)
+            rspq_block_arena_free(fp_frames[i].arena);
+    }
+    memset(fp_frames, 0, sizeof(fp_frames));
+    fp_num_frames = 0;
+}
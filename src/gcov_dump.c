@@ -0,0 +1,184 @@
+/**
+ * @file gcov_dump.c
+ * @brief Profile data (gcov) for profile-guided optimization
+ * @ingroup gcov_dump
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gcov_dump.h"
+#include "usb.h"
+#include "debug.h"
+
+/**
+ * @defgroup gcov_dump Profile-guided optimization
+ * @ingroup lowlevel
+ * @brief Collection of the gcov profile counters on the console.
+ *
+ * Profile-guided optimization (PGO) lets the compiler lay out branches and
+ * take inlining decisions according to the code paths that are actually hot.
+ * On the VR4300 (an in-order CPU, with small caches) this makes a real
+ * difference. The profile is collected on the console, running the real game:
+ *
+ *  1. Build the ROM with the profile counters, by setting N64_PGO to
+ *     "generate" (or running "make pgo-generate"). With this setting, the
+ *     compiler puts the descriptors of the counters in a section of the ROM
+ *     (-fprofile-info-section), instead of registering them at boot, as there
+ *     is no filesystem to write them to at exit.
+ *  2. Play the game, then call #gcov_dump_file (eg: on the SD card mounted
+ *     with #debug_init_sdfs) or #gcov_dump_usb. The counters are written
+ *     as a gcov stream, which encodes all the .gcda files.
+ *  3. Run "make pgo-use": it merges the stream into the .gcda files next to
+ *     the objects (with gcov-tool merge-stream), and rebuilds everything with
+ *     -fprofile-use. The stream is read from the file named by N64_PGO_DATA
+ *     (default: gcov.bin). With USB, concatenate the messages saved by the
+ *     loader into that file.
+ *
+ * @code{.c}
+ *      debug_init_sdfs("sd:/", -1);
+ *      [...]
+ *      gcov_dump_file("sd:/gcov.bin");
+ * @endcode
+ *
+ * The counters are only updated by the code compiled with N64_PGO set:
+ * libdragon itself is not instrumented. Dumping multiple times accumulates
+ * the counters (merge-stream adds them to the existing .gcda files), so the
+ * dump should be done once per session. Without N64_PGO, the dump functions
+ * do nothing.
+ * @{
+ */
+
+/// @cond
+// Freestanding gcov interface (libgcov, GCC 12+). These are weak so that the
+// dump functions can be linked (and do nothing) when libgcov is not.
+struct gcov_info;
+extern void __gcov_info_to_gcda(const struct gcov_info *info,
+    void (*filename_fn)(const char *, void *),
+    void (*dump_fn)(const void *, unsigned, void *),
+    void *(*allocate_fn)(unsigned, void *), void *arg) __attribute__((weak));
+extern void __gcov_filename_to_gcfn(const char *filename,
+    void (*dump_fn)(const void *, unsigned, void *), void *arg) __attribute__((weak));
+
+// Descriptors of the instrumented objects, gathered by n64.ld
+extern const struct gcov_info *const __gcov_info_start[];
+extern const struct gcov_info *const __gcov_info_end[];
+/// @endcond
+
+/** @brief State of a dump */
+typedef struct {
+    FILE *f;            ///< Output file (or NULL for USB)
+    uint8_t *buf;       ///< Data of the current object (for USB)
+    int size;           ///< Bytes in buf
+    int cap;            ///< Capacity of buf
+    void *blocks;       ///< Blocks allocated by libgcov, linked via their first word
+    bool error;         ///< True if a write failed
+} gcov_dump_t;
+
+/** @brief Output callback of libgcov */
+static void gcov_write(const void *data, unsigned len, void *arg)
+{
+    gcov_dump_t *d = arg;
+    if (d->f) {
+        if (fwrite(data, 1, len, d->f) != len)
+            d->error = true;
+        return;
+    }
+    if (d->size + (int)len > d->cap) {
+        d->cap = (d->size + len) * 2;
+        d->buf = realloc(d->buf, d->cap);
+        assertf(d->buf, "gcov_dump: out of memory");
+    }
+    memcpy(d->buf + d->size, data, len);
+    d->size += len;
+}
+
+/** @brief Filename callback of libgcov: encode the name in the stream */
+static void gcov_filename(const char *fn, void *arg)
+{
+    __gcov_filename_to_gcfn(fn, gcov_write, arg);
+}
+
+/** @brief Allocation callback of libgcov (the blocks are freed after each object) */
+static void *gcov_allocate(unsigned len, void *arg)
+{
+    gcov_dump_t *d = arg;
+    void **block = malloc(sizeof(void*) + len);
+    assertf(block, "gcov_dump: out of memory");
+    block[0] = d->blocks;
+    d->blocks = block;
+    return block + 1;
+}
+
+/** @brief Return the number of instrumented objects (0 if libgcov is not linked) */
+static int gcov_count(void)
+{
+    const struct gcov_info *const *info = __gcov_info_start;
+    // Prevent the compiler from assuming that the two arrays are different objects
+    __asm__ ("" : "+r"(info));
+    return __gcov_info_to_gcda ? __gcov_info_end - info : 0;
+}
+
+/** @brief Run libgcov over all instrumented objects */
+static void gcov_dump(gcov_dump_t *d)
+{
+    const struct gcov_info *const *info = __gcov_info_start;
+    const struct gcov_info *const *end = info + gcov_count();
+
+    for (; info != end; info++) {
+        __gcov_info_to_gcda(*info, gcov_filename, gcov_write, gcov_allocate, d);
+
+        if (!d->f && d->size) {
+            usb_write(DATATYPE_RAWBINARY, d->buf, d->size);
+            d->size = 0;
+        }
+        while (d->blocks) {
+            void *next = *(void**)d->blocks;
+            free(d->blocks);
+            d->blocks = next;
+        }
+    }
+    free(d->buf);
+}
+
+/**
+ * @brief Write the profile counters to a file, as a gcov stream
+ *
+ * The stream contains the counters of all the objects compiled with
+ * N64_PGO set to "generate". It can be merged into the .gcda files with
+ * "gcov-tool merge-stream" (see "make pgo-use").
+ *
+ * @param fn        Name of the file (eg: "sd:/gcov.bin")
+ * @return True if the file was written, false on error (or when the ROM
+ *         was not built with the profile counters)
+ */
+bool gcov_dump_file(const char *fn)
+{
+    if (!gcov_count())
+        return false;
+
+    gcov_dump_t d = { .f = fopen(fn, "wb") };
+    if (!d.f)
+        return false;
+    gcov_dump(&d);
+    if (fclose(d.f) != 0)
+        d.error = true;
+    return !d.error;
+}
+
+/**
+ * @brief Send the profile counters via USB, as a gcov stream
+ *
+ * The stream is sent as a sequence of binary messages (DATATYPE_RAWBINARY),
+ * one per instrumented object, that the USB loader saves to files on the PC.
+ * Concatenated in order, they form the same stream written by #gcov_dump_file.
+ */
+void gcov_dump_usb(void)
+{
+    if (!gcov_count())
+        return;
+
+    gcov_dump_t d = { 0 };
+    gcov_dump(&d);
+}
+
+/** @} */
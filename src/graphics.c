@@ -13,6 +13,10 @@
 #include "font.h"
 #include "surface.h"
 #include "sprite_internal.h"
+#include "rdp_internal.h"
+#include "rspq.h"
+#include "utils.h"
+#include "debug.h"
 
 /**
  * @defgroup graphics 2D Graphics
@@ -41,6 +45,15 @@
  * #graphics_make_color and #graphics_convert_color are also compatible with both
  * hardware and software graphics routines.
  *
+ * When the RDP is attached to the display context (see #rdp_attach), the
+ * opaque lines and boxes (#graphics_draw_line, #graphics_draw_lines and
+ * #graphics_draw_box) are drawn by the RDP instead, and the render modes and
+ * colors set with the @ref rdp functions are restored afterwards.  Since the
+ * RDP draws asynchronously, the next software drawing on the context waits
+ * for the RSP to be done first, so that the drawing order is kept; batching
+ * the accelerated drawing, before or after the software drawing, avoids the
+ * stalls.
+ *
  * @{
  */
 
@@ -54,6 +67,33 @@ static struct {
     int font_height;
 } sprite_font = { .sprite = NULL };
 
+/**
+ * @brief Cache of the current font, pre-rasterized for the current colors.
+ *
+ * Glyphs are decoded from the font sprite only when the font, the bitdepth or
+ * the colors change. With an opaque background, each glyph is stored as colored
+ * pixels that can be blitted a row at a time. With a transparent background,
+ * each glyph row is stored as a bitmask of the foreground pixels.
+ */
+static struct {
+    /** @brief Font sprite the cache was built from (NULL if invalid) */
+    sprite_t *sprite;
+    /** @brief Bytes per pixel the cache was built for */
+    int bpp;
+    /** @brief Foreground color the cache was built for */
+    uint32_t fg;
+    /** @brief Background color the cache was built for */
+    uint32_t bg;
+    /** @brief True if the background is transparent (use masks) */
+    bool trans;
+    /** @brief Number of glyphs in the cache */
+    int count;
+    /** @brief Colored pixels of each glyph (opaque background) */
+    uint8_t *pixels;
+    /** @brief Foreground mask of each glyph row (transparent background) */
+    uint32_t *masks;
+} glyph_cache = { .sprite = NULL };
+
 
 /**
  * @brief Macro to set a pixel to a certain color in a buffer
@@ -93,12 +133,82 @@ static struct {
 /**
  * @brief Get the correct video buffer given a display context
  *
+ * If drawing was queued to the RDP, this waits for it to be done first.
+ *
  * @param[in] disp
  *            The current display context
  *
  * @return A pointer to the current drawing surface for the display context
  */
-#define __get_buffer( disp ) ((disp)->buffer)
+#define __get_buffer( disp ) (__graphics_cpu_sync(), (disp)->buffer)
+
+/** @brief True if drawing was queued to the RDP, which might not be done yet */
+static bool rdp_pending = false;
+
+/**
+ * @brief Wait for the drawing queued to the RDP, before drawing in software
+ */
+static inline void __graphics_cpu_sync( void )
+{
+    if( rdp_pending )
+    {
+        rspq_wait();
+        rdp_pending = false;
+    }
+}
+
+/**
+ * @brief Fill a span of pixels with a color
+ *
+ * The bulk of the span is written with 64-bit stores; only the unaligned
+ * head and tail are written one pixel at a time.
+ *
+ * @param[out] dst
+ *             Pointer to the first pixel of the span
+ * @param[in]  bytes
+ *             Length of the span in bytes
+ * @param[in]  bpp
+ *             Bytes per pixel (2 or 4)
+ * @param[in]  c64
+ *             The pixel color replicated over 64 bits
+ */
+static inline void __fill_span( void *dst, int bytes, int bpp, uint64_t c64 )
+{
+    uint8_t *p = dst;
+    uint8_t *end = p + bytes;
+
+    if( bpp == 2 )
+    {
+        while( ((uint32_t)p & 7) && p < end ) { *(uint16_t *)p = c64; p += 2; }
+        while( p + 8 <= end ) { *(uint64_t *)p = c64; p += 8; }
+        while( p < end ) { *(uint16_t *)p = c64; p += 2; }
+    }
+    else
+    {
+        while( ((uint32_t)p & 7) && p < end ) { *(uint32_t *)p = c64; p += 4; }
+        while( p + 8 <= end ) { *(uint64_t *)p = c64; p += 8; }
+        while( p < end ) { *(uint32_t *)p = c64; p += 4; }
+    }
+}
+
+/**
+ * @brief Replicate a 16-bit or 32-bit color over 64 bits
+ *
+ * @param[in] bpp
+ *            Bytes per pixel (2 or 4)
+ * @param[in] color
+ *            The color, in the low bits
+ *
+ * @return The color replicated over 64 bits
+ */
+static inline uint64_t __color64( int bpp, uint32_t color )
+{
+    if( bpp == 2 )
+    {
+        color = (color & 0xFFFF) * 0x10001;
+    }
+    return ((uint64_t)color << 32) | color;
+}
 
 /**
  * @brief Generic foreground color
@@ -113,6 +223,9 @@ static uint32_t f_color = 0xFFFFFFFF;
  */
 static uint32_t b_color = 0x00000000;
 
+/** @brief Blend mode of #graphics_draw_sprite_trans */
+static graphics_blend_mode_t blend_mode = GRAPHICS_BLEND_AUTO;
+
 /**
  * @brief Return a packed 32-bit representation of an RGBA color
  *
@@ -241,6 +354,7 @@ static int __is_transparent( int bitdepth, uint32_t color )
 void graphics_draw_pixel( surface_t* disp, int x, int y, uint32_t color )
 {
     if( disp == 0 ) { return; }
+    display_mark_dirty( disp, x, y, 1, 1 );
     int pix_stride = TEX_FORMAT_BYTES2PIX(surface_get_format(disp), disp->stride);
 
     if( TEX_FORMAT_BITDEPTH(surface_get_format( disp )) == 16 )
@@ -272,6 +386,7 @@ void graphics_draw_pixel( surface_t* disp, int x, int y, uint32_t color )
 void graphics_draw_pixel_trans( surface_t* disp, int x, int y, uint32_t color )
 {
     if( disp == 0 ) { return; }
+    display_mark_dirty( disp, x, y, 1, 1 );
     int pix_stride = TEX_FORMAT_BYTES2PIX(surface_get_format(disp), disp->stride);
 
     if( TEX_FORMAT_BITDEPTH(surface_get_format( disp )) == 16 )
@@ -322,6 +437,8 @@ void graphics_draw_pixel_trans( surface_t* disp, int x, int y, uint32_t color )
  * @note This function does not support transparency for speed purposes.  To draw
  * a transparent or translucent line, use #graphics_draw_line_trans.
  *
+ * When the RDP is attached to @p disp, the line is drawn by the RDP.
+ *
  * @param[in] disp
  *            The currently active display context.
  * @param[in] x0
@@ -338,6 +455,14 @@ void graphics_draw_pixel_trans( surface_t* disp, int x, int y, uint32_t color )
  */
 void graphics_draw_line( surface_t* disp, int x0, int y0, int x1, int y1, uint32_t color )
 {
+	if( __rdp_is_attached( disp ) )
+	{
+		__rdp_accel_line( x0, y0, x1, y1, color );
+		__rdp_accel_end();
+		rdp_pending = true;
+		return;
+	}
+
 	int dy = y1 - y0;
 	int dx = x1 - x0;
 	int sx, sy;
@@ -394,6 +519,50 @@ void graphics_draw_line( surface_t* disp, int x0, int y0, int x1, int y1, uint32
 	}
 }
 
+/**
+ * @brief Draw many lines to a given display context
+ *
+ * This is equivalent to calling #graphics_draw_line for each line, but
+ * faster when the lines are drawn by the RDP: the render modes are switched
+ * once for all the horizontal and vertical lines, and once for all the others
+ * (so the lines are not guaranteed to be drawn in order).
+ *
+ * @param[in] disp
+ *            The currently active display context.
+ * @param[in] xy
+ *            Coordinates of the lines, as x0,y0,x1,y1 (4 values per line).
+ * @param[in] num_lines
+ *            Number of lines
+ * @param[in] color
+ *            The 32-bit RGBA color to draw to the screen.  Use #graphics_convert_color
+ *            or #graphics_make_color to generate this value.
+ */
+void graphics_draw_lines( surface_t* disp, const int *xy, int num_lines, uint32_t color )
+{
+    if( !__rdp_is_attached( disp ) )
+    {
+        for( int i = 0; i < num_lines; i++, xy += 4 )
+        {
+            graphics_draw_line( disp, xy[0], xy[1], xy[2], xy[3], color );
+        }
+        return;
+    }
+
+    /* Rectangles in fill mode first, then triangles */
+    for( int i = 0; i < num_lines; i++ )
+    {
+        const int *l = xy + i * 4;
+        if( l[0] == l[2] || l[1] == l[3] ) { __rdp_accel_line( l[0], l[1], l[2], l[3], color ); }
+    }
+    for( int i = 0; i < num_lines; i++ )
+    {
+        const int *l = xy + i * 4;
+        if( l[0] != l[2] && l[1] != l[3] ) { __rdp_accel_line( l[0], l[1], l[2], l[3], color ); }
+    }
+    __rdp_accel_end();
+    rdp_pending = true;
+}
+
 /**
  * @brief Draw a line to a given display context with alpha support
  *
@@ -478,6 +647,8 @@ void graphics_draw_line_trans( surface_t* disp, int x0, int y0, int x1, int y1,
  * @note This function does not support transparency for speed purposes.  To draw
  * a transparent or translucent box, use #graphics_draw_box_trans.
  *
+ * When the RDP is attached to @p disp, the box is drawn by the RDP.
+ *
  * @param[in] disp
  *            The currently active display context.
  * @param[in] x
@@ -496,30 +667,30 @@ void graphics_draw_box( surface_t* disp, int x, int y, int width, int height, ui
 {
     if( disp == 0 ) { return; }
 
-    int pix_stride = TEX_FORMAT_BYTES2PIX(surface_get_format(disp), disp->stride);
-    if( TEX_FORMAT_BITDEPTH(surface_get_format( disp )) == 16 )
-    {
-        uint16_t *buffer16 = (uint16_t *)__get_buffer( disp );
+    /* Clip the box against the surface once */
+    if( x < 0 ) { width += x; x = 0; }
+    if( y < 0 ) { height += y; y = 0; }
+    if( x + width > (int)disp->width ) { width = disp->width - x; }
+    if( y + height > (int)disp->height ) { height = disp->height - y; }
+    if( width <= 0 || height <= 0 ) { return; }
 
-        for(int j = y; j < y + height; j++)
-        {
-            for(int i = x; i < x + width; i++)
-            {
-                __set_pixel( buffer16, i, j, color );
-            }
-        }
-    }
-    else
+    if( __rdp_is_attached( disp ) )
     {
-        uint32_t *buffer32 = (uint32_t *)__get_buffer( disp );
+        __rdp_accel_box( x, y, width, height, color );
+        __rdp_accel_end();
+        rdp_pending = true;
+        return;
+    }
+    display_mark_dirty( disp, x, y, width, height );
 
-        for(int j = y; j < y + height; j++)
-        {
-            for(int i = x; i < x + width; i++)
-            {
-                __set_pixel( buffer32, i, j, color );
-            }
-        }
+    int bpp = TEX_FORMAT_BITDEPTH(surface_get_format( disp )) / 8;
+    uint64_t c64 = __color64( bpp, color );
+    uint8_t *row = (uint8_t *)__get_buffer( disp ) + y * disp->stride + x * bpp;
+
+    for( int j = 0; j < height; j++ )
+    {
+        __fill_span( row, width * bpp, bpp, c64 );
+        row += disp->stride;
     }
 }
 
@@ -546,6 +717,7 @@ void graphics_draw_box( surface_t* disp, int x, int y, int width, int height, ui
 void graphics_draw_box_trans( surface_t* disp, int x, int y, int width, int height, uint32_t color )
 {
     if( disp == 0 ) { return; }
+    display_mark_dirty( disp, x, y, width, height );
 
     int pix_stride = TEX_FORMAT_BYTES2PIX(surface_get_format(disp), disp->stride);
     if( TEX_FORMAT_BITDEPTH(surface_get_format( disp )) == 16 )
@@ -622,12 +794,25 @@ void graphics_fill_screen( surface_t* disp, uint32_t c )
 {
     if( disp == 0 ) { return; }
 
-    int len = TEX_FORMAT_PIX2BYTES(surface_get_format(disp), disp->width * disp->height) / 8;
+    display_mark_dirty( disp, 0, 0, disp->width, disp->height );
 
+    int bpp = TEX_FORMAT_BITDEPTH(surface_get_format( disp )) / 8;
+    int row_bytes = disp->width * bpp;
     uint64_t c64 = ((uint64_t)c << 32) | c;
-    uint64_t *buffer = (uint64_t *)__get_buffer(disp);
-    for( int i = 0; i < len; i++ )
-        buffer[i] = c64;
+
+    /* Contiguous surfaces can be filled as a single span */
+    if( disp->stride == row_bytes )
+    {
+        __fill_span( __get_buffer(disp), row_bytes * disp->height, bpp, c64 );
+        return;
+    }
+
+    uint8_t *row = (uint8_t *)__get_buffer(disp);
+    for( int j = 0; j < disp->height; j++ )
+    {
+        __fill_span( row, row_bytes, bpp, c64 );
+        row += disp->stride;
+    }
 }
 
 /**
@@ -662,100 +847,189 @@ void graphics_set_font_sprite( sprite_t *font )
 }
 
 /**
- * @brief Draw a character to the screen using the built-in font
+ * @brief Get the current text colors and font
  *
- * Draw a character from the built-in font to the screen.  This function does not support alpha blending, 
- * only binary transparency.  If the background color is fully transparent, the font is drawn with no
- * background.  Otherwise, the font is drawn on a fully colored background.  The foreground and background
- * can be set using #graphics_set_color.
+ * The default font is selected if no font matching the display bitdepth was set.
  *
- * @param[in] disp
- *            The currently active display context.
- * @param[in] x
- *            The X coordinate to place the top left pixel of the character drawn.
- * @param[in] y
- *            The Y coordinate to place the top left pixel of the character drawn.
- * @param[in] ch
- *            The ASCII character to draw to the screen.
+ * NOTE: this is currently not part of the public API as we use it only
+ * internally (RDP console rendering).
+ *
+ * @param[out] fg
+ *             Current foreground color
+ * @param[out] bg
+ *             Current background color
+ *
+ * @return The current font sprite
  */
-void graphics_draw_character( surface_t* disp, int x, int y, char ch )
+sprite_t *__graphics_get_font( uint32_t *fg, uint32_t *bg )
 {
-    if( disp == 0 ) { return; }
+    int bpp = display_get_bitdepth();
+    if( sprite_font.sprite == NULL || bpp*8 != TEX_FORMAT_BITDEPTH(sprite_get_format(sprite_font.sprite)) )
+    {
+        graphics_set_default_font();
+    }
 
-    int pix_stride = TEX_FORMAT_BYTES2PIX(surface_get_format(disp), disp->stride);
-    int depth = display_get_bitdepth();
+    *fg = f_color;
+    *bg = b_color;
+    return sprite_font.sprite;
+}
 
+/**
+ * @brief Rebuild the glyph cache if the font, bitdepth or colors changed
+ *
+ * @param[in] bpp
+ *            Bytes per pixel of the destination (2 or 4)
+ */
+static void __glyph_cache_update( int bpp )
+{
     // setting default font if none was set previously
-    if( sprite_font.sprite == NULL || depth*8 != TEX_FORMAT_BITDEPTH(sprite_get_format(sprite_font.sprite)) )
+    if( sprite_font.sprite == NULL || bpp*8 != TEX_FORMAT_BITDEPTH(sprite_get_format(sprite_font.sprite)) )
     {
         graphics_set_default_font();
     }
 
-    /* Figure out if they want the background to be transparent */
-    int trans = __is_transparent( depth, b_color );
-
-    const int sx = ( ch % sprite_font.sprite->hslices ) * sprite_font.font_width;
-    const int sy = ( ch / sprite_font.sprite->hslices ) * sprite_font.font_height;
-    const int ex = sx + sprite_font.font_width;
-    const int ey = sy + sprite_font.font_height;
+    int trans = __is_transparent( bpp, b_color );
+    if( glyph_cache.sprite == sprite_font.sprite && glyph_cache.bpp == bpp &&
+        glyph_cache.fg == f_color && glyph_cache.trans == trans &&
+        (trans || glyph_cache.bg == b_color) )
+    {
+        return;
+    }
 
-    const int tx = x - sx;
-    const int ty = y - sy;
+    sprite_t *font = sprite_font.sprite;
+    int fw = sprite_font.font_width;
+    int fh = sprite_font.font_height;
+    assertf( fw <= 32, "font too wide for the glyph cache: %d", fw );
+
+    free( glyph_cache.pixels );
+    free( glyph_cache.masks );
+    glyph_cache.pixels = NULL;
+    glyph_cache.masks = NULL;
+
+    glyph_cache.sprite = font;
+    glyph_cache.bpp = bpp;
+    glyph_cache.fg = f_color;
+    glyph_cache.bg = b_color;
+    glyph_cache.trans = trans;
+    glyph_cache.count = font->hslices * font->vslices;
+
+    if( trans )
+        glyph_cache.masks = malloc( glyph_cache.count * fh * sizeof(uint32_t) );
+    else
+        glyph_cache.pixels = malloc( glyph_cache.count * fw * fh * bpp );
 
-    if( depth == 2 )
+    for( int g = 0; g < glyph_cache.count; g++ )
     {
-        uint16_t *buffer = (uint16_t *)__get_buffer( disp );
-        uint16_t *sp_data = (uint16_t *)sprite_font.sprite->data;
+        const int sx = ( g % font->hslices ) * fw;
+        const int sy = ( g / font->hslices ) * fh;
 
-        for( int yp = sy; yp < ey; yp++ )
+        for( int yp = 0; yp < fh; yp++ )
         {
-            const register int run = yp * sprite_font.sprite->width;
-
-            for( int xp = sx; xp < ex; xp++ )
+            uint32_t mask = 0;
+            for( int xp = 0; xp < fw; xp++ )
             {
-                const char c = sp_data[xp + run];
+                int idx = (sx + xp) + (sy + yp) * font->width;
+                bool set = bpp == 2 ? (((uint16_t *)font->data)[idx] & 0x1) : (((uint32_t *)font->data)[idx] & 0xFF);
+
                 if( trans )
                 {
-                    if( ( c & 0x1 ) != 0x0 )
-                    {
-                        __set_pixel( buffer, tx + xp, ty + yp, f_color );
-                    }
+                    if( set ) { mask |= 1 << xp; }
+                }
+                else if( bpp == 2 )
+                {
+                    ((uint16_t *)glyph_cache.pixels)[(g * fh + yp) * fw + xp] = set ? f_color : b_color;
                 }
                 else
                 {
-                    __set_pixel( buffer, tx + xp, ty + yp, ( ( c & 0x1 ) != 0x0 ) ? f_color : b_color );
+                    ((uint32_t *)glyph_cache.pixels)[(g * fh + yp) * fw + xp] = set ? f_color : b_color;
                 }
             }
+            if( trans ) { glyph_cache.masks[g * fh + yp] = mask; }
         }
     }
-    else
-    {
-        uint32_t *buffer = (uint32_t *)__get_buffer( disp );
-        uint32_t *sp_data = (uint32_t *)sprite_font.sprite->data;
+}
 
-        for( int yp = sy; yp < ey; yp++ )
+/**
+ * @brief Draw a glyph from the glyph cache, clipped to the surface
+ *
+ * @param[in] disp
+ *            The currently active display context.
+ * @param[in] x
+ *            The X coordinate to place the top left pixel of the character drawn.
+ * @param[in] y
+ *            The Y coordinate to place the top left pixel of the character drawn.
+ * @param[in] g
+ *            Index of the glyph
+ */
+static void __draw_glyph( surface_t* disp, int x, int y, int g )
+{
+    if( g < 0 || g >= glyph_cache.count ) { return; }
+
+    const int fw = sprite_font.font_width;
+    const int fh = sprite_font.font_height;
+    const int bpp = glyph_cache.bpp;
+
+    /* Clip the glyph against the surface */
+    int x0 = MAX( 0, -x ), x1 = MIN( fw, (int)disp->width - x );
+    int y0 = MAX( 0, -y ), y1 = MIN( fh, (int)disp->height - y );
+    if( x0 >= x1 || y0 >= y1 ) { return; }
+    display_mark_dirty( disp, x + x0, y + y0, x1 - x0, y1 - y0 );
+
+    uint8_t *dst = (uint8_t *)__get_buffer( disp ) + (y + y0) * disp->stride + x * bpp;
+
+    if( !glyph_cache.trans )
+    {
+        const uint8_t *src = glyph_cache.pixels + ((g * fh + y0) * fw ) * bpp;
+        for( int yp = y0; yp < y1; yp++ )
         {
-            const register int run = yp * sprite_font.sprite->width;
+            memcpy( dst + x0 * bpp, src + x0 * bpp, (x1 - x0) * bpp );
+            dst += disp->stride;
+            src += fw * bpp;
+        }
+        return;
+    }
 
-            for( int xp = sx; xp < ex; xp++ )
+    const uint32_t *masks = &glyph_cache.masks[g * fh];
+    for( int yp = y0; yp < y1; yp++ )
+    {
+        uint32_t mask = masks[yp] >> x0;
+        for( int xp = x0; mask && xp < x1; xp++, mask >>= 1 )
+        {
+            if( mask & 1 )
             {
-                const char c = sp_data[xp + run];
-                if( trans )
-                {
-                    if( ( c & 0xFF ) != 0x00 )
-                    {
-                        __set_pixel( buffer, tx + xp, ty + yp, f_color );
-                    }
-                }
-                else
-                {
-                    __set_pixel( buffer, tx + xp, ty + yp, ( ( c & 0xFF ) != 0x00 ) ? f_color : b_color );
-                }
+                if( bpp == 2 ) { ((uint16_t *)dst)[xp] = glyph_cache.fg; }
+                else { ((uint32_t *)dst)[xp] = glyph_cache.fg; }
             }
         }
+        dst += disp->stride;
     }
 }
 
+/**
+ * @brief Draw a character to the screen using the built-in font
+ *
+ * Draw a character from the built-in font to the screen.  This function does not support alpha blending, 
+ * only binary transparency.  If the background color is fully transparent, the font is drawn with no
+ * background.  Otherwise, the font is drawn on a fully colored background.  The foreground and background
+ * can be set using #graphics_set_color.
+ *
+ * @param[in] disp
+ *            The currently active display context.
+ * @param[in] x
+ *            The X coordinate to place the top left pixel of the character drawn.
+ * @param[in] y
+ *            The Y coordinate to place the top left pixel of the character drawn.
+ * @param[in] ch
+ *            The ASCII character to draw to the screen.
+ */
+void graphics_draw_character( surface_t* disp, int x, int y, char ch )
+{
+    if( disp == 0 ) { return; }
+
+    __glyph_cache_update( display_get_bitdepth() );
+    __draw_glyph( disp, x, y, ch );
+}
+
 /**
  * @brief Draw a null terminated string to a display context
  *
@@ -785,6 +1059,9 @@ void graphics_draw_text( surface_t* disp, int x, int y, const char * const msg )
     int ty = y;
     const char *text = (const char *)msg;
 
+    /* Check the font and colors once for the whole string */
+    __glyph_cache_update( display_get_bitdepth() );
+
     while( *text )
     {
         switch( *text )
@@ -801,7 +1078,7 @@ void graphics_draw_text( surface_t* disp, int x, int y, const char * const msg )
                 tx += sprite_font.font_width * 5;
                 break;
             default:
-                graphics_draw_character( disp, tx, ty, *text );
+                __draw_glyph( disp, tx, ty, *text );
                 tx += sprite_font.font_width;
                 break;
         }
@@ -945,39 +1222,26 @@ void graphics_draw_sprite_stride( surface_t* disp, int x, int y, sprite_t *sprit
         ey = disp->height - ty;
     }
 
-    int pix_stride = TEX_FORMAT_BYTES2PIX(surface_get_format(disp), disp->stride);
+    display_mark_dirty( disp, tx + sx, ty + sy, ex - sx, ey - sy );
+
     int depth = TEX_FORMAT_BITDEPTH(surface_get_format( disp ));
 
     /* Only display sprite if it matches the bitdepth */
-    if( depth == 16 && TEX_FORMAT_BITDEPTH(sprite_get_format(sprite)) == 16 )
-    {
-        uint16_t *buffer = (uint16_t *)__get_buffer( disp );
-        uint16_t *sp_data = (uint16_t *)sprite->data;
+    if( depth != TEX_FORMAT_BITDEPTH(sprite_get_format(sprite)) ) { return; }
+    if( depth != 16 && depth != 32 ) { return; }
+    if( sx >= ex ) { return; }
 
-        for( int yp = sy; yp < ey; yp++ )
-        {
-            const register int run = yp * sprite->width;
+    /* Copy each clipped row at once (memcpy uses wide copies for aligned spans) */
+    int bpp = depth / 8;
+    int sp_stride = sprite->width * bpp;
+    uint8_t *dst = (uint8_t *)__get_buffer( disp ) + (ty + sy) * disp->stride + (tx + sx) * bpp;
+    const uint8_t *src = (const uint8_t *)sprite->data + sy * sp_stride + sx * bpp;
 
-            for( int xp = sx; xp < ex; xp++ )
-            {
-                __set_pixel( buffer, tx + xp, ty + yp, sp_data[xp + run] );
-            }
-        }
-    }
-    else if( depth == 32 && TEX_FORMAT_BITDEPTH(sprite_get_format(sprite)) == 32 )
+    for( int yp = sy; yp < ey; yp++ )
     {
-        uint32_t *buffer = (uint32_t *)__get_buffer( disp );
-        uint32_t *sp_data = (uint32_t *)sprite->data;
-
-        for( int yp = sy; yp < ey; yp++ )
-        {
-            const register int run = yp * sprite->width;
-
-            for( int xp = sx; xp < ex; xp++ )
-            {
-                __set_pixel( buffer, tx + xp, ty + yp, sp_data[xp + run] );
-            }
-        }
+        memcpy( dst, src, (ex - sx) * bpp );
+        dst += disp->stride;
+        src += sp_stride;
     }
 }
 
@@ -1007,6 +1271,79 @@ void graphics_draw_sprite_trans( surface_t* disp, int x, int y, sprite_t *sprite
     graphics_draw_sprite_trans_stride( disp, x, y, sprite, -1 );
 }
 
+/**
+ * @brief Blend a 32-bit sprite pixel over a 32-bit buffer pixel
+ *
+ * @param[in] cur_color
+ *            The current color in the buffer
+ * @param[in] new_color
+ *            The sprite color, with its alpha
+ *
+ * @return The mixed color (always opaque)
+ */
+static inline uint32_t __blend32( uint32_t cur_color, uint32_t new_color )
+{
+    /* Transparencies */
+    uint32_t st = new_color & 0xFF;
+    uint32_t ct = 255 - st;
+
+    uint32_t r = ((((cur_color >> 24) & 0xFF) * ct) + (((new_color >> 24) & 0xFF) * st)) >> 8;
+    uint32_t g = ((((cur_color >> 16) & 0xFF) * ct) + (((new_color >> 16) & 0xFF) * st)) >> 8;
+    uint32_t b = ((((cur_color >>  8) & 0xFF) * ct) + (((new_color >>  8) & 0xFF) * st)) >> 8;
+
+    /* Since we are doing mixing anyway */
+    return (r << 24) | (g << 16) | (b << 8) | 0xFF;
+}
+
+/** @brief Pixel operation: copy the sprite pixel */
+#define __OP_OPAQUE( dst, src )     (dst) = (src)
+/** @brief Pixel operation: copy the sprite pixel if the alpha bit is set (16 bpp) */
+#define __OP_TEST16( dst, src )     if( (src) & 0x1 ) { (dst) = (src); }
+/** @brief Pixel operation: copy the sprite pixel if it is not fully transparent (32 bpp) */
+#define __OP_TEST32( dst, src )     if( (src) & 0xFF ) { (dst) = (src); }
+/** @brief Pixel operation: blend the sprite pixel using its alpha (32 bpp) */
+#define __OP_BLEND32( dst, src )    (dst) = __blend32( (dst), (src) )
+
+/**
+ * @brief Define a kernel drawing a clipped sprite rectangle with a pixel operation
+ *
+ * Each kernel is specialized for a bitdepth and a blend mode, so that
+ * its inner loop has no branches other than the ones of the operation itself.
+ */
+#define __DEFINE_BLIT_TRANS( name, type, op ) \
+static void name( type *buffer, int pix_stride, const type *sp_data, int sp_width, \
+                  int tx, int ty, int sx, int sy, int ex, int ey ) \
+{ \
+    for( int yp = sy; yp < ey; yp++ ) \
+    { \
+        type *dst = buffer + (ty + yp) * pix_stride + tx; \
+        const type *src = sp_data + yp * sp_width; \
+        for( int xp = sx; xp < ex; xp++ ) { op( dst[xp], src[xp] ); } \
+    } \
+}
+
+__DEFINE_BLIT_TRANS( __blit_opaque16, uint16_t, __OP_OPAQUE )
+__DEFINE_BLIT_TRANS( __blit_test16,   uint16_t, __OP_TEST16 )
+__DEFINE_BLIT_TRANS( __blit_opaque32, uint32_t, __OP_OPAQUE )
+__DEFINE_BLIT_TRANS( __blit_test32,   uint32_t, __OP_TEST32 )
+__DEFINE_BLIT_TRANS( __blit_blend32,  uint32_t, __OP_BLEND32 )
+
+/**
+ * @brief Set the blend mode used by #graphics_draw_sprite_trans
+ *
+ * By default (#GRAPHICS_BLEND_AUTO), 16 bpp sprites are drawn with an alpha test on
+ * the alpha bit, and 32 bpp sprites are alpha blended. When it is known that a sprite
+ * does not need blending, a cheaper mode can be selected: for instance, particles with
+ * binary alpha can use #GRAPHICS_BLEND_ALPHA_TEST even on 32 bpp.
+ *
+ * @param[in] mode
+ *            The blend mode to use for the following draws
+ */
+void graphics_set_blend_mode( graphics_blend_mode_t mode )
+{
+    blend_mode = mode;
+}
+
 /**
  * @brief Draw a sprite from a spritemap to a display context
  *
@@ -1025,6 +1362,9 @@ void graphics_draw_sprite_trans( surface_t* disp, int x, int y, sprite_t *sprite
  * *---*---*---*
  * </pre>
  *
+ * The pixels are combined with the display context according to the blend mode
+ * (see #graphics_set_blend_mode).
+ *
  * @note This function supports alpha blending and is much slower for 32-bit sprites. 
  * If you do not need alpha blending support, please see #graphics_draw_sprite_stride.
  *
@@ -1117,72 +1457,29 @@ void graphics_draw_sprite_trans_stride( surface_t* disp, int x, int y, sprite_t
         ey = disp->height - ty;
     }
 
+    display_mark_dirty( disp, tx + sx, ty + sy, ex - sx, ey - sy );
+
     int pix_stride = TEX_FORMAT_BYTES2PIX(surface_get_format(disp), disp->stride);
     int depth = TEX_FORMAT_BITDEPTH(surface_get_format( disp ));
 
-    /* Only display sprite if it matches the bitdepth */
+    /* Only display sprite if it matches the bitdepth. The blend mode is
+     * resolved here, so that each kernel has no branches but its own. */
     if( depth == 16 && TEX_FORMAT_BITDEPTH(sprite_get_format(sprite)) == 16 )
     {
-        uint16_t *buffer = (uint16_t *)__get_buffer( disp );
-        uint16_t *sp_data = (uint16_t *)sprite->data;
+        void (*blit)( uint16_t *, int, const uint16_t *, int, int, int, int, int, int, int ) =
+            blend_mode == GRAPHICS_BLEND_OPAQUE ? __blit_opaque16 : __blit_test16;
 
-        for( int yp = sy; yp < ey; yp++ )
-        {
-            const register int run = yp * sprite->width;
-
-            for( int xp = sx; xp < ex; xp++ )
-            {
-                /* Only display the pixel if alpha bit is set */
-                if( !__is_transparent( 2, sp_data[xp + run] ) )
-                {
-                    __set_pixel( buffer, tx + xp, ty + yp, sp_data[xp + run] );
-                }
-            }
-        }
+        blit( (uint16_t *)__get_buffer( disp ), pix_stride, (uint16_t *)sprite->data, sprite->width,
+              tx, ty, sx, sy, ex, ey );
     }
     else if( depth == 32 && TEX_FORMAT_BITDEPTH(sprite_get_format(sprite)) == 32 )
     {
-        uint32_t *buffer = (uint32_t *)__get_buffer( disp );
-        uint32_t *sp_data = (uint32_t *)sprite->data;
-
-        for( int yp = sy; yp < ey; yp++ )
-        {
-            const int run = yp * sprite->width;
-
-            for( int xp = sx; xp < ex; xp++ )
-            {
-                /* Get 32bit representations */
-                uint8_t *new_color = (uint8_t *)(&sp_data[xp + run]);
-                uint32_t cur_color = __get_pixel( buffer, tx + xp, ty + yp );
-
-                /* Get current color */
-                uint32_t cr = (cur_color >> 24) & 0xFF;
-                uint32_t cg = (cur_color >> 16) & 0xFF;
-                uint32_t cb = (cur_color >> 8) & 0xFF;
-
-                /* Get new color */
-                uint32_t sr = new_color[0];
-                uint32_t sg = new_color[1];
-                uint32_t sb = new_color[2];
+        void (*blit)( uint32_t *, int, const uint32_t *, int, int, int, int, int, int, int ) =
+            blend_mode == GRAPHICS_BLEND_OPAQUE ? __blit_opaque32 :
+            blend_mode == GRAPHICS_BLEND_ALPHA_TEST ? __blit_test32 : __blit_blend32;
 
-                /* Transparencies */
-                uint32_t st = new_color[3];
-                uint32_t ct = 255 - st;
-
-                /* Mixed color */
-                uint32_t mixed_color;
-                uint8_t *final_color = (uint8_t *)(&mixed_color);
-
-                final_color[0] = ((cr * ct) + (sr * st)) >> 8;
-                final_color[1] = ((cg * ct) + (sg * st)) >> 8;
-                final_color[2] = ((cb * ct) + (sb * st)) >> 8;
-
-                /* Since we are doing mixing anyway */
-                final_color[3] = 255;
-
-                __set_pixel( buffer, tx + xp, ty + yp, mixed_color );
-            }
-        }
+        blit( (uint32_t *)__get_buffer( disp ), pix_stride, (uint32_t *)sprite->data, sprite->width,
+              tx, ty, sx, sy, ex, ey );
     }
 }
 
@@ -0,0 +1,431 @@
+/**
+ * @file heap_profile.c
+ * @brief Heap allocation profiler
+ * @ingroup heap_profile
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <reent.h>
+#include "heap_profile.h"
+#include "backtrace.h"
+#include "interrupt.h"
+#include "usb.h"
+#include "debug.h"
+#include "utils.h"
+
+/**
+ * @defgroup heap_profile Heap allocation profiler
+ * @ingroup lowlevel
+ * @brief Attribution of the heap memory to the code that allocated it.
+ *
+ * The heap profiler tracks all the blocks allocated via malloc, calloc,
+ * realloc and memalign (including C++ new), and attributes them to their
+ * call site, identified by a short call stack. This allows to find out which
+ * code is using the memory, and to spot leaks and sources of fragmentation.
+ *
+ * The profiler is opt-in: the allocation functions must be wrapped at link
+ * time, by setting N64_HEAP_PROFILE in the Makefile of the project (after
+ * including n64.mk):
+ *
+ * @code{.mk}
+ *      include $(N64_INST)/include/n64.mk
+ *      N64_HEAP_PROFILE = true
+ * @endcode
+ *
+ * Then, tracking is started at runtime with #heap_profile_init; the blocks
+ * allocated before are not tracked.
+ *
+ * @code{.c}
+ *      backtrace_cache_init(1);        // Faster stack walk
+ *      heap_profile_init(4, 4096, 512);
+ *      [...]
+ *      heap_profile_dump();
+ * @endcode
+ *
+ * The statistics of each call site can be read with #heap_profile_get_sites,
+ * or sent to the PC via USB with #heap_profile_dump. The n64prof tool
+ * symbolizes the dumps using the symbol table generated by n64sym, and
+ * prints the call sites sorted by live memory:
+ *
+ * @code{.sh}
+ *      n64prof game.sym heap-*.bin
+ * @endcode
+ *
+ * Each allocation walks a few frames of the stack (see #backtrace), so it
+ * is a good idea to keep the depth small, and to call #backtrace_cache_init
+ * to avoid accessing the ROM while doing so. Allocations done internally
+ * by newlib (eg: stdio buffers) do not go through the wrapped functions,
+ * and thus are not tracked.
+ *
+ * Each dump is self-contained, and is a sequence of big-endian 32-bit words:
+ *
+ *  * #HEAP_PROFILE_MAGIC
+ *  * #HEAP_PROFILE_VERSION
+ *  * Bytes currently allocated
+ *  * Blocks currently allocated
+ *  * Peak of the bytes allocated
+ *  * Number of call sites
+ *  * Number of allocations not tracked because the tables were full
+ *  * Call sites: for each one, the fields of #heap_profile_site_t (live
+ *    bytes, live blocks, peak bytes, allocations, total bytes), followed
+ *    by the number N of frames and by N addresses.
+ * @{
+ */
+
+/** @brief Number of words in the header of each dump */
+#define HEADER_WORDS        7
+/** @brief Number of words in each call site of a dump (except the call stack) */
+#define SITE_WORDS          6
+/** @brief Empty slot in the hash table of the call sites */
+#define NO_SITE             0xFFFF
+
+/** @brief An allocated block */
+typedef struct {
+    void *ptr;                  ///< Address of the block (NULL if the slot is empty)
+    uint32_t size;              ///< Requested size of the block
+    uint32_t site;              ///< Index of the call site that allocated the block
+} heap_block_t;
+
+/** @brief Hash table of the allocated blocks (linear probing). NULL if the profiler is not running */
+static heap_block_t *blocks;
+/** @brief Number of slots in the blocks table, minus one */
+static uint32_t blocks_mask;
+/** @brief Maximum number of blocks that can be tracked */
+static uint32_t block_max;
+/** @brief Statistics of each call site */
+static heap_profile_site_t *site_stats;
+/** @brief Hash of the call stack of each call site */
+static uint32_t *site_hashes;
+/** @brief Hash table of the call sites (indices in site_stats, or NO_SITE) */
+static uint16_t *site_index;
+/** @brief Number of slots in the site_index table, minus one */
+static uint32_t site_index_mask;
+/** @brief Number of call sites seen */
+static int site_count;
+/** @brief Maximum number of call sites */
+static int site_max;
+/** @brief Number of frames recorded for each call site */
+static int prof_depth;
+/** @brief Buffer used to build the dumps sent via USB */
+static uint32_t *msg_buf;
+/** @brief Global statistics */
+static heap_profile_stats_t heap_stats;
+
+/** @brief Hash an address of a block */
+static inline uint32_t hash_ptr(void *ptr)
+{
+    uint32_t h = (uint32_t)ptr * 2654435761u;
+    return h ^ (h >> 15);
+}
+
+/** @brief Find the call site with the specified call stack, creating it if needed */
+static int site_find(uint32_t hash, void **callstack, int depth)
+{
+    uint32_t i = hash & site_index_mask;
+    while (site_index[i] != NO_SITE) {
+        int idx = site_index[i];
+        heap_profile_site_t *s = &site_stats[idx];
+        if (site_hashes[idx] == hash && s->depth == depth &&
+            memcmp(s->callstack, callstack, depth * sizeof(void*)) == 0)
+            return idx;
+        i = (i + 1) & site_index_mask;
+    }
+
+    if (site_count == site_max)
+        return -1;
+    int idx = site_count++;
+    heap_profile_site_t *s = &site_stats[idx];
+    memset(s, 0, sizeof(heap_profile_site_t));
+    s->depth = depth;
+    memcpy(s->callstack, callstack, depth * sizeof(void*));
+    site_hashes[idx] = hash;
+    site_index[i] = idx;
+    heap_stats.num_sites = site_count;
+    return idx;
+}
+
+/**
+ * @brief Record an allocated block
+ *
+ * This must be called directly by the wrappers of the allocation functions,
+ * as the call stack is walked from here skipping exactly two frames.
+ */
+__attribute__((noinline))
+static void heap_profile_record(void *ptr, uint32_t size)
+{
+    // Skip this function and the wrapper
+    void *bt[HEAP_PROFILE_MAX_DEPTH + 2];
+    int depth = backtrace(bt, prof_depth + 2) - 2;
+    if (depth < 0) depth = 0;
+
+    uint32_t hash = depth;
+    for (int i = 0; i < depth; i++)
+        hash = (hash ^ (uint32_t)bt[i + 2]) * 16777619u;
+
+    disable_interrupts();
+    if (blocks) {
+        int site = heap_stats.live_blocks < block_max ? site_find(hash, bt + 2, depth) : -1;
+        if (site < 0) {
+            heap_stats.dropped++;
+        } else {
+            uint32_t i = hash_ptr(ptr) & blocks_mask;
+            while (blocks[i].ptr)
+                i = (i + 1) & blocks_mask;
+            blocks[i] = (heap_block_t){ .ptr = ptr, .size = size, .site = site };
+
+            heap_profile_site_t *s = &site_stats[site];
+            s->live_bytes += size;
+            s->live_blocks++;
+            s->allocs++;
+            s->total_bytes += size;
+            s->peak_bytes = MAX(s->peak_bytes, s->live_bytes);
+            heap_stats.live_bytes += size;
+            heap_stats.live_blocks++;
+            heap_stats.peak_bytes = MAX(heap_stats.peak_bytes, heap_stats.live_bytes);
+        }
+    }
+    enable_interrupts();
+}
+
+/** @brief Forget a block that is being freed (if it was tracked) */
+static void heap_profile_forget(void *ptr)
+{
+    disable_interrupts();
+    if (blocks) {
+        uint32_t i = hash_ptr(ptr) & blocks_mask;
+        while (blocks[i].ptr && blocks[i].ptr != ptr)
+            i = (i + 1) & blocks_mask;
+
+        if (blocks[i].ptr) {
+            heap_profile_site_t *s = &site_stats[blocks[i].site];
+            s->live_bytes -= blocks[i].size;
+            s->live_blocks--;
+            heap_stats.live_bytes -= blocks[i].size;
+            heap_stats.live_blocks--;
+
+            // Backward shift deletion: move back the following blocks of the
+            // same cluster, unless their home slot is after the hole.
+            for (uint32_t j = (i + 1) & blocks_mask; blocks[j].ptr; j = (j + 1) & blocks_mask) {
+                uint32_t k = hash_ptr(blocks[j].ptr) & blocks_mask;
+                bool stays = (i < j) ? (k > i && k <= j) : (k > i || k <= j);
+                if (!stays) {
+                    blocks[i] = blocks[j];
+                    i = j;
+                }
+            }
+            blocks[i].ptr = NULL;
+        }
+    }
+    enable_interrupts();
+}
+
+/** @cond */
+/* Wrappers of the allocation functions, enabled by N64_HEAP_PROFILE (see n64.mk).
+   They call the reentrant versions of newlib directly (like the original
+   functions do), so that this file can be linked even without wrapping. */
+void *__wrap_malloc(size_t size)
+{
+    void *ptr = _malloc_r(_REENT, size);
+    if (ptr && blocks)
+        heap_profile_record(ptr, size);
+    return ptr;
+}
+
+void *__wrap_calloc(size_t num, size_t size)
+{
+    void *ptr = _calloc_r(_REENT, num, size);
+    if (ptr && blocks)
+        heap_profile_record(ptr, num * size);
+    return ptr;
+}
+
+void *__wrap_memalign(size_t align, size_t size)
+{
+    void *ptr = _memalign_r(_REENT, align, size);
+    if (ptr && blocks)
+        heap_profile_record(ptr, size);
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    void *newptr = _realloc_r(_REENT, ptr, size);
+    if (blocks && (newptr || !size)) {
+        // The old block is gone (it might be the same address as the new one)
+        if (ptr)
+            heap_profile_forget(ptr);
+        if (newptr)
+            heap_profile_record(newptr, size);
+    }
+    return newptr;
+}
+
+void __wrap_free(void *ptr)
+{
+    if (ptr && blocks)
+        heap_profile_forget(ptr);
+    _free_r(_REENT, ptr);
+}
+/** @endcond */
+
+/**
+ * @brief Start tracking the heap allocations
+ *
+ * The allocation functions must be wrapped by setting N64_HEAP_PROFILE in
+ * the Makefile (see @ref heap_profile). Calling this function while the
+ * profiler is running restarts it, discarding the statistics.
+ *
+ * @param[in] depth         Number of stack frames that identify a call site
+ *                          (1 to #HEAP_PROFILE_MAX_DEPTH). Use 1 to only
+ *                          record the function calling malloc.
+ * @param[in] max_blocks    Maximum number of allocated blocks that can be
+ *                          tracked at the same time (12 bytes each, plus
+ *                          the empty slots of the hash table).
+ * @param[in] max_sites     Maximum number of different call sites (up to
+ *                          65535).
+ */
+void heap_profile_init(int depth, int max_blocks, int max_sites)
+{
+    assertf(depth >= 1 && depth <= HEAP_PROFILE_MAX_DEPTH, "invalid depth: %d (max: %d)", depth, HEAP_PROFILE_MAX_DEPTH);
+    assertf(max_blocks > 0, "invalid number of blocks: %d", max_blocks);
+    assertf(max_sites > 0 && max_sites < NO_SITE, "invalid number of call sites: %d", max_sites);
+
+    // With wrapping enabled, this reference to malloc is redirected to the wrapper
+    void *(*volatile malloc_func)(size_t) = malloc;
+    assertf(malloc_func == __wrap_malloc,
+        "the heap profiler requires N64_HEAP_PROFILE=true in the Makefile");
+
+    heap_profile_close();
+
+    // Keep the hash tables at most half full
+    uint32_t blocks_size = 1, index_size = 1;
+    while (blocks_size < max_blocks * 2)
+        blocks_size <<= 1;
+    while (index_size < max_sites * 2)
+        index_size <<= 1;
+
+    heap_block_t *new_blocks = calloc(blocks_size, sizeof(heap_block_t));
+    site_stats = malloc(max_sites * sizeof(heap_profile_site_t));
+    site_hashes = malloc(max_sites * sizeof(uint32_t));
+    site_index = malloc(index_size * sizeof(uint16_t));
+    msg_buf = malloc((HEADER_WORDS + max_sites * (SITE_WORDS + depth)) * 4);
+    assertf(new_blocks && site_stats && site_hashes && site_index && msg_buf,
+        "out of memory allocating the heap profiler tables");
+    memset(site_index, 0xFF, index_size * sizeof(uint16_t));
+
+    blocks_mask = blocks_size - 1;
+    site_index_mask = index_size - 1;
+    block_max = max_blocks;
+    site_max = max_sites;
+    site_count = 0;
+    prof_depth = depth;
+    memset(&heap_stats, 0, sizeof(heap_stats));
+
+    // Start tracking
+    disable_interrupts();
+    blocks = new_blocks;
+    enable_interrupts();
+}
+
+/**
+ * @brief Stop tracking the heap allocations and free the tables
+ */
+void heap_profile_close(void)
+{
+    disable_interrupts();
+    heap_block_t *old_blocks = blocks;
+    blocks = NULL;
+    enable_interrupts();
+
+    free(old_blocks);
+    free(site_stats);
+    free(site_hashes);
+    free(site_index);
+    free(msg_buf);
+    site_stats = NULL;
+    site_hashes = NULL;
+    site_index = NULL;
+    msg_buf = NULL;
+}
+
+/**
+ * @brief Get the global statistics of the heap profiler
+ *
+ * @param[out] out      Structure that will be filled with the statistics
+ */
+void heap_profile_get_stats(heap_profile_stats_t *out)
+{
+    disable_interrupts();
+    *out = heap_stats;
+    enable_interrupts();
+}
+
+/**
+ * @brief Get the statistics of the call sites, sorted by live bytes
+ *
+ * @param[out] out          Array that will be filled with the call sites
+ *                          that currently use more memory
+ * @param[in] max_count     Size of the array
+ * @return                  Number of call sites written to the array
+ */
+int heap_profile_get_sites(heap_profile_site_t *out, int max_count)
+{
+    int n = 0;
+    disable_interrupts();
+    if (blocks) {
+        // Insertion sort, keeping the biggest max_count sites
+        for (int i = 0; i < site_count; i++) {
+            heap_profile_site_t *s = &site_stats[i];
+            int j = n < max_count ? n++ : max_count;
+            while (j > 0 && out[j-1].live_bytes < s->live_bytes) {
+                if (j < max_count)
+                    out[j] = out[j-1];
+                j--;
+            }
+            if (j < max_count)
+                out[j] = *s;
+        }
+    }
+    enable_interrupts();
+    return n;
+}
+
+/**
+ * @brief Send the statistics of all the call sites via USB
+ *
+ * The statistics are sent as a single binary message (DATATYPE_RAWBINARY),
+ * that the USB loader saves to a file on the PC. Each dump is a snapshot of
+ * the heap at the time of the call, and can be analyzed with n64prof.
+ */
+void heap_profile_dump(void)
+{
+    if (!blocks)
+        return;
+
+    disable_interrupts();
+    uint32_t *w = msg_buf + HEADER_WORDS;
+    for (int i = 0; i < site_count; i++) {
+        heap_profile_site_t *s = &site_stats[i];
+        *w++ = s->live_bytes;
+        *w++ = s->live_blocks;
+        *w++ = s->peak_bytes;
+        *w++ = s->allocs;
+        *w++ = s->total_bytes;
+        *w++ = s->depth;
+        for (int j = 0; j < s->depth; j++)
+            *w++ = (uint32_t)s->callstack[j];
+    }
+    msg_buf[0] = HEAP_PROFILE_MAGIC;
+    msg_buf[1] = HEAP_PROFILE_VERSION;
+    msg_buf[2] = heap_stats.live_bytes;
+    msg_buf[3] = heap_stats.live_blocks;
+    msg_buf[4] = heap_stats.peak_bytes;
+    msg_buf[5] = site_count;
+    msg_buf[6] = heap_stats.dropped;
+    enable_interrupts();
+
+    usb_write(DATATYPE_RAWBINARY, msg_buf, (w - msg_buf) * 4);
+}
+
+/** @} */
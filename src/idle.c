@@ -0,0 +1,127 @@
+/**
+ * @file idle.c
+ * @brief Background work run while waiting for the hardware
+ * @ingroup idle
+ */
+#include <stdbool.h>
+#include "idle.h"
+#include "interrupt.h"
+#include "cop0.h"
+#include "debug.h"
+
+/**
+ * @defgroup idle Idle tasks
+ * @ingroup lowlevel
+ * @brief Background work run while waiting for the hardware.
+ *
+ * Many functions of libdragon wait for the hardware by polling its
+ * registers: #wait_ticks (and #wait_ms), #dma_wait, #rsp_wait, and in general
+ * all loops built with #RSP_WAIT_LOOP (eg: #display_get, #rspq_wait). Idle
+ * tasks registered with #idle_register are run from these loops, so that the
+ * time spent waiting is used for deferred work (eg: flushing logs,
+ * prefetching assets, compacting pools) instead of being burned.
+ *
+ * @code{.c}
+ *      void prefetch_step(void *ctx, uint32_t budget) {
+ *          // Do the next step only if it fits in the budget
+ *          if (budget >= TICKS_FROM_MS(1)/2)
+ *              prefetch_next_chunk(ctx);
+ *      }
+ *
+ *      idle_register(prefetch_step, &prefetch_state);
+ * @endcode
+ *
+ * The tasks receive a budget in ticks: the remaining time for #wait_ticks,
+ * or #IDLE_POLL_BUDGET for the loops that cannot know how long they will
+ * wait. A task that runs past the budget delays the end of the wait, but
+ * does not break it.
+ *
+ * Idle tasks never run from interrupt handlers or with interrupts disabled,
+ * so they can use the heap and the blocking functions of libdragon. While a
+ * task runs, the waits it performs do not run the idle tasks again.
+ * @{
+ */
+
+/** @brief Maximum number of idle tasks */
+#define IDLE_MAX_TASKS          8
+
+/** @brief A registered idle task */
+typedef struct {
+    idle_func_t func;           ///< Function of the task
+    void *ctx;                  ///< Context passed to the function
+} idle_task_t;
+
+/** @brief Registered idle tasks */
+static idle_task_t idle_tasks[IDLE_MAX_TASKS];
+/** @brief Number of registered idle tasks */
+static int idle_num_tasks = 0;
+/** @brief Index of the task to run first, so that all tasks get their turn */
+static int idle_next = 0;
+/** @brief True while the idle tasks are running, to prevent recursion */
+static bool idle_running = false;
+
+/**
+ * @brief Register a task to run while waiting for the hardware
+ *
+ * @param[in] func      Function of the task
+ * @param[in] ctx       Opaque pointer passed to the function
+ */
+void idle_register(idle_func_t func, void *ctx)
+{
+    assertf(idle_num_tasks < IDLE_MAX_TASKS, "too many idle tasks (max: %d)", IDLE_MAX_TASKS);
+    disable_interrupts();
+    idle_tasks[idle_num_tasks++] = (idle_task_t){ func, ctx };
+    enable_interrupts();
+}
+
+/**
+ * @brief Unregister a task registered with #idle_register
+ *
+ * @param[in] func      Function of the task
+ * @param[in] ctx       Context of the task
+ */
+void idle_unregister(idle_func_t func, void *ctx)
+{
+    disable_interrupts();
+    for (int i = 0; i < idle_num_tasks; i++) {
+        if (idle_tasks[i].func == func && idle_tasks[i].ctx == ctx) {
+            idle_tasks[i] = idle_tasks[--idle_num_tasks];
+            break;
+        }
+    }
+    enable_interrupts();
+}
+
+/**
+ * @brief Run the idle tasks, for at most the specified number of ticks
+ *
+ * Each task runs at most once, starting from the one after the last that
+ * ran in the previous call. This is called by the wait loops of libdragon,
+ * and can be called by custom wait loops as well. It does nothing if there
+ * are no tasks, or if called from an interrupt handler, with interrupts
+ * disabled, or from an idle task.
+ *
+ * @param[in] budget    Number of ticks the tasks may run for
+ */
+void idle_run(uint32_t budget)
+{
+    if (!idle_num_tasks || idle_running || budget == 0)
+        return;
+    if (!(C0_STATUS() & C0_STATUS_IE) || (C0_STATUS() & C0_STATUS_EXL))
+        return;
+
+    idle_running = true;
+    uint32_t t0 = TICKS_READ();
+    for (int n = idle_num_tasks; n > 0; n--) {
+        uint32_t elapsed = TICKS_READ() - t0;
+        if (elapsed >= budget)
+            break;
+        if (idle_next >= idle_num_tasks)
+            idle_next = 0;
+        idle_task_t task = idle_tasks[idle_next++];
+        task.func(task.ctx, budget - elapsed);
+    }
+    idle_running = false;
+}
+
+/** @} */
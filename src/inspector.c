@@ -2,6 +2,7 @@
 #include "debug.h"
 #include "controller.h"
 #include "exception_internal.h"
+#include "debug_internal.h"
 #include "system.h"
 #include "utils.h"
 #include "backtrace.h"
@@ -424,6 +425,9 @@ static void inspector(exception_t* ex, enum Mode mode) {
     if (in_inspector) abort();
     in_inspector = true;
 
+    // Send any log still buffered, and switch to synchronous logging
+    __debug_flush_sync();
+
 	display_close();
 	display_init(RESOLUTION_640x240, DEPTH_16_BPP, 2, GAMMA_NONE, FILTERS_RESAMPLE);
 
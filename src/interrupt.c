@@ -3,10 +3,21 @@
  * @brief Interrupt Controller
  * @ingroup interrupt
  */
-#include <malloc.h>
+#include <string.h>
 #include "libdragon.h"
 #include "regsinternal.h"
 
+#ifndef INTERRUPT_PROFILE
+/**
+ * @brief Enable the profiler of disabled-interrupts sections.
+ *
+ * Build libdragon with `-DINTERRUPT_PROFILE=1` to measure how long
+ * interrupts stay disabled (see #interrupt_profile_dump). This adds some
+ * overhead to each outermost #disable_interrupts / #enable_interrupts pair.
+ */
+#define INTERRUPT_PROFILE 0
+#endif
+
 /**
  * @defgroup interrupt Interrupt Controller
  * @ingroup lowlevel
@@ -25,6 +36,16 @@
  * Each of the N64-generated interrupts is maskable using the various
  * set accessors.
  *
+ * Up to #MAX_INTERRUPT_HANDLERS handlers can be registered for each
+ * interrupt source. The time spent in each handler is accounted, and can
+ * be inspected with #interrupt_get_handler_stats to find out which handlers
+ * take most of the interrupt time.
+ *
+ * When libdragon is built with #INTERRUPT_PROFILE, the duration of each
+ * section of code with interrupts disabled is also measured, together with
+ * the address of the #disable_interrupts call that started it. This allows to
+ * find the code that delays interrupts the most: see #interrupt_profile_dump.
+ *
  * Interrupts can be enabled or disabled as a whole on the N64 using
  * #enable_interrupts and #disable_interrupts.  It is assumed that
  * once the interrupt system is activated, these will always be called
@@ -121,16 +142,84 @@ static int __interrupt_sr = 0;
 /** @brief tick at which interrupts were disabled. */
 uint32_t interrupt_disabled_tick = 0;
 
+#if INTERRUPT_PROFILE
+/** @brief Address of the call to #disable_interrupts that disabled interrupts */
+static void *__interrupt_disabled_caller;
+/** @brief Profile of the disabled-interrupts sections */
+static interrupt_profile_t __interrupt_profile;
+
 /**
- * @brief Structure of an interrupt callback
+ * @brief Account a disabled-interrupts section that just ended
+ *
+ * Called by #enable_interrupts with interrupts still disabled.
+ *
+ * @param[in] caller    Address of the call to #disable_interrupts
+ * @param[in] ticks     Duration of the section
  */
-typedef struct callback_link
+static void __interrupt_profile_record(void *caller, uint32_t ticks)
 {
-    /** @brief Callback function */
-    void (*callback)();
-    /** @brief Pointer to next callback */
-    struct callback_link * next;
-} _callback_link;
+    interrupt_profile_t *p = &__interrupt_profile;
+
+    if (ticks > p->max_ticks) {
+        p->max_ticks = ticks;
+        p->max_caller = caller;
+    }
+
+    int bucket = ticks ? 31 - __builtin_clz(ticks) : 0;
+    if (bucket >= INTERRUPT_PROFILE_HISTOGRAM_BUCKETS)
+        bucket = INTERRUPT_PROFILE_HISTOGRAM_BUCKETS-1;
+    p->histogram[bucket]++;
+
+    /* Find the caller. If the table is full, evict the caller with the
+       shortest worst case, so that the worst offenders are kept. */
+    interrupt_profile_caller_t *c = NULL, *min = NULL;
+    for (int i = 0; i < p->num_callers; i++) {
+        if (p->callers[i].caller == caller) {
+            c = &p->callers[i];
+            break;
+        }
+        if (!min || p->callers[i].max_ticks < min->max_ticks)
+            min = &p->callers[i];
+    }
+    if (!c) {
+        if (p->num_callers < INTERRUPT_PROFILE_MAX_CALLERS)
+            c = &p->callers[p->num_callers++];
+        else if (ticks > min->max_ticks)
+            c = min;
+        else
+            return;
+        memset(c, 0, sizeof(*c));
+        c->caller = caller;
+    }
+
+    c->count++;
+    c->total_ticks += ticks;
+    if (ticks > c->max_ticks)
+        c->max_ticks = ticks;
+}
+#endif
+
+/** @brief Maximum number of handlers that can be registered for each interrupt source */
+#define MAX_INTERRUPT_HANDLERS 8
+
+/**
+ * @brief Handlers registered for an interrupt source
+ *
+ * The callbacks are packed at the start of the array (the first NULL entry
+ * terminates it), so that dispatching an interrupt reads a couple of
+ * consecutive cache lines, instead of chasing a pointer per handler. The
+ * accounting is kept in a separate array, so that it does not dilute the
+ * callbacks in the cache.
+ */
+typedef struct
+{
+    /** @brief Registered callbacks, most recently registered first */
+    void (*callback[MAX_INTERRUPT_HANDLERS])();
+    /** @brief Number of calls of each callback */
+    uint32_t count[MAX_INTERRUPT_HANDLERS];
+    /** @brief Total ticks spent in each callback */
+    uint64_t ticks[MAX_INTERRUPT_HANDLERS];
+} interrupt_handlers_t;
 
 /** @brief Static structure to address AI registers */
 static volatile struct AI_regs_s * const AI_regs = (struct AI_regs_s *)0xa4500000;
@@ -145,22 +234,13 @@ static volatile struct SI_regs_s * const SI_regs = (struct SI_regs_s *)0xa480000
 /** @brief Static structure to address SP registers */
 static volatile struct SP_regs_s * const SP_regs = (struct SP_regs_s *)0xa4040000;
 
-/** @brief Linked list of AI callbacks */
-struct callback_link * AI_callback = 0;
-/** @brief Linked list of VI callbacks */
-struct callback_link * VI_callback = 0;
-/** @brief Linked list of PI callbacks */
-struct callback_link * PI_callback = 0;
-/** @brief Linked list of DP callbacks */
-struct callback_link * DP_callback = 0;
-/** @brief Linked list of SI callbacks */
-struct callback_link * SI_callback = 0;
-/** @brief Linked list of SP callbacks */
-struct callback_link * SP_callback = 0;
-/** @brief Linked list of TI callbacks */
-struct callback_link * TI_callback = 0;
-/** @brief Linked list of CART callbacks */
-struct callback_link * CART_callback = 0;
+/** @brief Names of the interrupt sources, for error messages */
+static const char *__interrupt_source_names[INTERRUPT_NUM_SOURCES] = {
+    "SP", "SI", "AI", "VI", "PI", "DP", "TI", "CART"
+};
+
+/** @brief Handlers registered for each interrupt source */
+static interrupt_handlers_t __interrupt_handlers[INTERRUPT_NUM_SOURCES] __attribute__((aligned(16)));
 
 /** @brief Maximum number of reset handlers that can be registered. */
 #define MAX_RESET_HANDLERS 4
@@ -171,94 +251,140 @@ static void (*__prenmi_handlers[MAX_RESET_HANDLERS])(void);
 static uint32_t __prenmi_tick;
 
 /** 
- * @brief Call each callback in a linked list of callbacks
+ * @brief Call each callback registered for an interrupt source
  *
- * @param[in] head
- *            Pointer to the head of a callback linke list
+ * @param[in] source
+ *            Interrupt source
  */
-static void __call_callback( struct callback_link * head )
+static void __call_callback( interrupt_source_t source )
 {
-    /* Call each registered callback */
-    while( head )
-    {
-        if( head->callback )
-        {
-        	head->callback();
-        }
+    interrupt_handlers_t *h = &__interrupt_handlers[source];
 
-        /* Go to next */
-	    head=head->next;
+    /* Call each registered callback, accounting the time spent in it */
+    for( int i = 0; i < MAX_INTERRUPT_HANDLERS && h->callback[i]; i++ )
+    {
+        uint32_t t0 = TICKS_READ();
+        h->callback[i]();
+        h->ticks[i] += TICKS_SINCE(t0);
+        h->count[i]++;
     }
 }
 
 /**
- * @brief Add a callback to a linked list of callbacks
+ * @brief Register a callback for an interrupt source
+ *
+ * The callback is added at the beginning of the handlers, so that it is
+ * called before the ones registered earlier.
  *
- * @param[in,out] head
- *                Pointer to the head of a linked list to add to
- * @param[in]     callback
- *                Function to call when executing callbacks in this linked list
+ * @param[in] source
+ *            Interrupt source
+ * @param[in] callback
+ *            Function to call when the interrupt triggers
  */
-static void __register_callback( struct callback_link ** head, void (*callback)() )
+static void __register_callback( interrupt_source_t source, void (*callback)() )
 {
-    if( head )
+    interrupt_handlers_t *h = &__interrupt_handlers[source];
+
+    disable_interrupts();
+    assertf(!h->callback[MAX_INTERRUPT_HANDLERS-1],
+        "too many %s interrupt handlers (max: %d)", __interrupt_source_names[source], MAX_INTERRUPT_HANDLERS);
+
+    /* Make room at the beginning, keeping the accounting with its handler */
+    for( int i = MAX_INTERRUPT_HANDLERS-1; i > 0; i-- )
     {
-        /* Add to beginning of linked list */
-        struct callback_link *next = *head;
-        (*head) = malloc(sizeof(struct callback_link));
+        h->callback[i] = h->callback[i-1];
+        h->count[i] = h->count[i-1];
+        h->ticks[i] = h->ticks[i-1];
+    }
+    h->callback[0] = callback;
+    h->count[0] = 0;
+    h->ticks[0] = 0;
+    enable_interrupts();
+}
+
+/**
+ * @brief Unregister a callback for an interrupt source
+ *
+ * @param[in] source
+ *            Interrupt source
+ * @param[in] callback
+ *            Function to search for and remove from the handlers
+ */
+static void __unregister_callback( interrupt_source_t source, void (*callback)() )
+{
+    interrupt_handlers_t *h = &__interrupt_handlers[source];
 
-        if( *head )
+    disable_interrupts();
+    for( int i = 0; i < MAX_INTERRUPT_HANDLERS && h->callback[i]; i++ )
+    {
+        if( h->callback[i] == callback )
         {
-            (*head)->next=next;
-            (*head)->callback=callback;
+            /* Compact the remaining handlers */
+            for( ; i < MAX_INTERRUPT_HANDLERS-1; i++ )
+            {
+                h->callback[i] = h->callback[i+1];
+                h->count[i] = h->count[i+1];
+                h->ticks[i] = h->ticks[i+1];
+            }
+            h->callback[MAX_INTERRUPT_HANDLERS-1] = NULL;
+            break;
         }
     }
+    enable_interrupts();
 }
 
 /**
- * @brief Remove a callback from a linked list of callbacks
+ * @brief Get the accounting of the handlers registered for an interrupt source
+ *
+ * For each registered handler (in calling order), this reports how many
+ * times it was called and the total number of ticks spent in it, since it
+ * was registered or since the last call to #interrupt_reset_handler_stats.
+ * This helps finding out which handlers take most of the interrupt time.
+ *
+ * @param[in]  source
+ *             Interrupt source
+ * @param[out] stats
+ *             Array that will be filled with the accounting of each handler
+ * @param[in]  max_stats
+ *             Size of the @p stats array
  *
- * @param[in,out] head
- *                Pointer to the head of a linked list to remove from
- * @param[in]     callback
- *                Function to search for and remove from callback list
+ * @return The number of entries written to @p stats
  */
-static void __unregister_callback( struct callback_link ** head, void (*callback)() )
+int interrupt_get_handler_stats( interrupt_source_t source, interrupt_handler_stats_t *stats, int max_stats )
 {
-    if( head )
+    assertf(source >= 0 && source < INTERRUPT_NUM_SOURCES, "invalid interrupt source: %d", source);
+    interrupt_handlers_t *h = &__interrupt_handlers[source];
+    int n = 0;
+
+    disable_interrupts();
+    for( int i = 0; i < MAX_INTERRUPT_HANDLERS && h->callback[i] && n < max_stats; i++ )
     {
-        /* Try to find callback this matches */
-        struct callback_link *last = 0;
-        struct callback_link *cur  = *head;
+        stats[n].callback = h->callback[i];
+        stats[n].count = h->count[i];
+        stats[n].ticks = h->ticks[i];
+        n++;
+    }
+    enable_interrupts();
+    return n;
+}
 
-        while( cur )
+/**
+ * @brief Reset the accounting of all the interrupt handlers
+ *
+ * See #interrupt_get_handler_stats.
+ */
+void interrupt_reset_handler_stats( void )
+{
+    disable_interrupts();
+    for( int s = 0; s < INTERRUPT_NUM_SOURCES; s++ )
+    {
+        for( int i = 0; i < MAX_INTERRUPT_HANDLERS; i++ )
         {
-            if( cur->callback == callback )
-            {
-                /* We found it!  Try to remove it from the list */
-                if( last )
-                {
-                    /* This is somewhere in the linked list */
-                    last->next = cur->next;
-                }
-                else
-                {
-                    /* This is the first node */
-                    *head = cur->next;
-                }
-
-                /* Free memory */
-                free( cur );
-
-                /* Exit early */
-                break;
-            }
-
-            /* Go to next entry */
-            last = cur;
-            cur = cur->next;
+            __interrupt_handlers[s].count[i] = 0;
+            __interrupt_handlers[s].ticks[i] = 0;
         }
     }
+    enable_interrupts();
 }
 
 /**
@@ -276,7 +402,7 @@ void __MI_handler(void)
         /* Clear interrupt */
         SP_regs->status=SP_CLEAR_INTERRUPT;
 
-        __call_callback(SP_callback);
+        __call_callback(INTERRUPT_SP);
     }
 
     if( status & MI_INTR_SI )
@@ -284,7 +410,7 @@ void __MI_handler(void)
         /* Clear interrupt */
         SI_regs->status=SI_CLEAR_INTERRUPT;
 
-        __call_callback(SI_callback);
+        __call_callback(INTERRUPT_SI);
     }
 
     if( status & MI_INTR_AI )
@@ -292,7 +418,7 @@ void __MI_handler(void)
         /* Clear interrupt */
     	AI_regs->status=AI_CLEAR_INTERRUPT;
 
-	    __call_callback(AI_callback);
+	    __call_callback(INTERRUPT_AI);
     }
 
     if( status & MI_INTR_VI )
@@ -300,7 +426,7 @@ void __MI_handler(void)
         /* Clear interrupt */
     	VI_regs->cur_line=VI_regs->cur_line;
 
-    	__call_callback(VI_callback);
+    	__call_callback(INTERRUPT_VI);
     }
 
     if( status & MI_INTR_PI )
@@ -308,7 +434,7 @@ void __MI_handler(void)
         /* Clear interrupt */
         PI_regs->status=PI_CLEAR_INTERRUPT;
 
-        __call_callback(PI_callback);
+        __call_callback(INTERRUPT_PI);
     }
 
     if( status & MI_INTR_DP )
@@ -316,7 +442,7 @@ void __MI_handler(void)
         /* Clear interrupt */
         MI_regs->mode=DP_CLEAR_INTERRUPT;
 
-        __call_callback(DP_callback);
+        __call_callback(INTERRUPT_DP);
     }
 }
 
@@ -326,7 +452,7 @@ void __MI_handler(void)
 void __TI_handler(void)
 {
 	/* NOTE: the timer interrupt is already acknowledged in inthandler.S */
-    __call_callback(TI_callback);
+    __call_callback(INTERRUPT_TI);
 }
 
 /**
@@ -335,7 +461,7 @@ void __TI_handler(void)
 void __CART_handler(void)
 {
     /* Call the registered callbacks */
-    __call_callback(CART_callback);
+    __call_callback(INTERRUPT_CART);
 
     #ifndef NDEBUG
      /* CART interrupts must be acknowledged by handlers. If the handler fails
@@ -383,7 +509,7 @@ void __RESET_handler( void )
  */
 void register_AI_handler( void (*callback)() )
 {
-    __register_callback(&AI_callback,callback);
+    __register_callback(INTERRUPT_AI,callback);
 }
 
 /**
@@ -394,7 +520,7 @@ void register_AI_handler( void (*callback)() )
  */
 void unregister_AI_handler( void (*callback)() )
 {
-    __unregister_callback(&AI_callback,callback);
+    __unregister_callback(INTERRUPT_AI,callback);
 }
 
 /**
@@ -405,7 +531,7 @@ void unregister_AI_handler( void (*callback)() )
  */
 void register_VI_handler( void (*callback)() )
 {
-    __register_callback(&VI_callback,callback);
+    __register_callback(INTERRUPT_VI,callback);
 }
 
 /**
@@ -416,7 +542,7 @@ void register_VI_handler( void (*callback)() )
  */
 void unregister_VI_handler( void (*callback)() )
 {
-    __unregister_callback(&VI_callback,callback);
+    __unregister_callback(INTERRUPT_VI,callback);
 }
 
 /**
@@ -427,7 +553,7 @@ void unregister_VI_handler( void (*callback)() )
  */
 void register_PI_handler( void (*callback)() )
 {
-    __register_callback(&PI_callback,callback);
+    __register_callback(INTERRUPT_PI,callback);
 }
 
 /**
@@ -438,7 +564,7 @@ void register_PI_handler( void (*callback)() )
  */
 void unregister_PI_handler( void (*callback)() )
 {
-    __unregister_callback(&PI_callback,callback);
+    __unregister_callback(INTERRUPT_PI,callback);
 }
 
 /**
@@ -449,7 +575,7 @@ void unregister_PI_handler( void (*callback)() )
  */
 void register_DP_handler( void (*callback)() )
 {
-    __register_callback(&DP_callback,callback);
+    __register_callback(INTERRUPT_DP,callback);
 }
 
 /**
@@ -460,7 +586,7 @@ void register_DP_handler( void (*callback)() )
  */
 void unregister_DP_handler( void (*callback)() )
 {
-    __unregister_callback(&DP_callback,callback);
+    __unregister_callback(INTERRUPT_DP,callback);
 }
 
 /**
@@ -471,7 +597,7 @@ void unregister_DP_handler( void (*callback)() )
  */
 void register_SI_handler( void (*callback)() )
 {
-    __register_callback(&SI_callback,callback);
+    __register_callback(INTERRUPT_SI,callback);
 }
 
 /**
@@ -482,7 +608,7 @@ void register_SI_handler( void (*callback)() )
  */
 void unregister_SI_handler( void (*callback)() )
 {
-    __unregister_callback(&SI_callback,callback);
+    __unregister_callback(INTERRUPT_SI,callback);
 }
 
 /**
@@ -493,7 +619,7 @@ void unregister_SI_handler( void (*callback)() )
  */
 void register_SP_handler( void (*callback)() )
 {
-    __register_callback(&SP_callback,callback);
+    __register_callback(INTERRUPT_SP,callback);
 }
 
 /**
@@ -504,7 +630,7 @@ void register_SP_handler( void (*callback)() )
  */
 void unregister_SP_handler( void (*callback)() )
 {
-    __unregister_callback(&SP_callback,callback);
+    __unregister_callback(INTERRUPT_SP,callback);
 }
 
 
@@ -528,7 +654,7 @@ void unregister_SP_handler( void (*callback)() )
  */
 void register_TI_handler( void (*callback)() )
 {
-    __register_callback(&TI_callback,callback);
+    __register_callback(INTERRUPT_TI,callback);
 }
 
 /**
@@ -543,7 +669,7 @@ void register_TI_handler( void (*callback)() )
  */
 void unregister_TI_handler( void (*callback)() )
 {
-    __unregister_callback(&TI_callback,callback);
+    __unregister_callback(INTERRUPT_TI,callback);
 }
 
 /**
@@ -565,7 +691,7 @@ void unregister_TI_handler( void (*callback)() )
  */
 void register_CART_handler( void (*callback)() )
 {
-    __register_callback(&CART_callback,callback);
+    __register_callback(INTERRUPT_CART,callback);
 }
 
 /**
@@ -576,7 +702,7 @@ void register_CART_handler( void (*callback)() )
  */
 void unregister_CART_handler( void (*callback)() )
 {
-    __unregister_callback(&CART_callback,callback);
+    __unregister_callback(INTERRUPT_CART,callback);
 }
 
 /**
@@ -884,6 +1010,9 @@ void disable_interrupts()
         __interrupt_sr = sr;
 
         interrupt_disabled_tick = TICKS_READ();
+        #if INTERRUPT_PROFILE
+        __interrupt_disabled_caller = __builtin_return_address(0);
+        #endif
     }
 
     /* Ensure that we remember nesting levels */
@@ -910,6 +1039,13 @@ void enable_interrupts()
 
     if( __interrupt_depth == 0 )
     {
+        #if INTERRUPT_PROFILE
+        /* Account the section, unless interrupts were already disabled
+           (eg: within an interrupt handler) */
+        if( __interrupt_sr & C0_STATUS_IE )
+            __interrupt_profile_record(__interrupt_disabled_caller, TICKS_SINCE(interrupt_disabled_tick));
+        #endif
+
         /* Restore the interrupt state that was active when interrupts got
            disabled.
            This is important to be done this way, as opposed to simply or-ing
@@ -980,4 +1116,91 @@ uint32_t exception_reset_time( void )
 
 
 
+/**
+ * @brief Get the profile of the disabled-interrupts sections
+ *
+ * The profile reports the longest sections of code executed with interrupts
+ * disabled, since boot or the last call to #interrupt_profile_reset.
+ * Sections started within interrupt handlers are not accounted, as
+ * interrupts are disabled there anyway.
+ *
+ * This requires libdragon to be built with #INTERRUPT_PROFILE. Otherwise,
+ * the profile is always empty.
+ *
+ * @param[out] profile   Structure that will be filled with the profile
+ */
+void interrupt_profile_get( interrupt_profile_t *profile )
+{
+#if INTERRUPT_PROFILE
+    disable_interrupts();
+    *profile = __interrupt_profile;
+    enable_interrupts();
+#else
+    memset(profile, 0, sizeof(*profile));
+#endif
+}
+
+/**
+ * @brief Reset the profile of the disabled-interrupts sections
+ *
+ * See #interrupt_profile_get.
+ */
+void interrupt_profile_reset( void )
+{
+#if INTERRUPT_PROFILE
+    disable_interrupts();
+    memset(&__interrupt_profile, 0, sizeof(__interrupt_profile));
+    enable_interrupts();
+#endif
+}
+
+/**
+ * @brief Dump the profile of the disabled-interrupts sections to the debug log
+ *
+ * This prints the histogram of the durations, and the worst offenders sorted
+ * by their longest section, with their symbolized address. See
+ * #interrupt_profile_get.
+ */
+void interrupt_profile_dump( void )
+{
+#if INTERRUPT_PROFILE
+    static interrupt_profile_t p;
+    interrupt_profile_get(&p);
+
+    debugf("Disabled interrupts profile: longest %ld us\n", TIMER_MICROS(p.max_ticks));
+    for (int i = 0; i < INTERRUPT_PROFILE_HISTOGRAM_BUCKETS; i++) {
+        if (p.histogram[i])
+            debugf("    >= %7ld us: %lu\n", TIMER_MICROS(1u << i), p.histogram[i]);
+    }
+
+    /* Sort the callers by longest section (insertion sort, the table is small) */
+    for (int i = 1; i < p.num_callers; i++) {
+        interrupt_profile_caller_t c = p.callers[i];
+        int j = i;
+        for (; j > 0 && p.callers[j-1].max_ticks < c.max_ticks; j--)
+            p.callers[j] = p.callers[j-1];
+        p.callers[j] = c;
+    }
+
+    debugf("Worst offenders:\n");
+    for (int i = 0; i < p.num_callers; i++) {
+        interrupt_profile_caller_t *c = &p.callers[i];
+        debugf("    max %6ld us, avg %6ld us, count %6lu: ",
+            TIMER_MICROS(c->max_ticks), TIMER_MICROS(c->total_ticks / c->count), c->count);
+
+        void cb(void *arg, backtrace_frame_t *frame) {
+            if (!frame->is_inline)
+                backtrace_frame_print_compact(frame, stderr, 60);
+        }
+        /* Point within the call instruction, rather than at its return address */
+        void *addr = (void*)((uint32_t)c->caller - 8);
+        if (!backtrace_symbols_cb(&addr, 1, 0, cb, NULL))
+            debugf("%p", c->caller);
+        debugf("\n");
+    }
+#else
+    debugf("Disabled interrupts profile not available: build libdragon with INTERRUPT_PROFILE=1\n");
+#endif
+}
+
 /** @} */
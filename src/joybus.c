@@ -11,6 +11,7 @@
 #include "interrupt.h"
 #include "joybus.h"
 #include "joybus_internal.h"
+#include "kernel.h"
 #include "n64sys.h"
 #include "regsinternal.h"
 
@@ -39,9 +40,10 @@
  * Internally, the JoyBus subsystem communicates with the PIF controller via
  * the SI DMA, via the JoyBus protocol which is a standard master/slave
  * binary protocol. Each message of the protocol is a block of 64 bytes, and
- * can contain multiple commands. Currently, there are no macros or functions
- * to help composing a JoyBus message, so higher-level libraries currently
- * hard code the binary messages. 
+ * can contain multiple commands, one for each channel (port). Messages can be
+ * composed with #joybus_block_init and #joybus_block_add, which pack as many
+ * commands as fit in a single block; some higher-level libraries instead hard
+ * code the binary messages.
  * 
  * All communications is made asynchronously because SI DMA is quite slow:
  * its completion is bound to the PIF actually processing the data, rather than
@@ -84,13 +86,20 @@ static void * const PIF_RAM = (void *)0x1fc007c0;
 /**
  * @brief A message to be sent to JoyBus, with its completion callback. 
  */
-typedef struct {
+typedef struct joybus_msg_s {
     uint64_t input[JOYBUS_BLOCK_DWORDS] __attribute__((aligned(16)));  ///< input message
     void (*callback)(uint64_t *output, void *ctx);                     ///< callback for completion
     void *context;                                                     ///< callback context
+    struct joybus_msg_s *next;                                         ///< next message in the same list
 } joybus_msg_t;
 
-#define MAX_JOYBUS_MSGS            8    ///< Maximum number of pending joybus messages
+/** @brief A FIFO list of pending joybus messages */
+typedef struct {
+    joybus_msg_t *head;                                                ///< first message (next to be sent)
+    joybus_msg_t *tail;                                                ///< last message
+} joybus_queue_t;
+
+#define MAX_JOYBUS_MSGS            32   ///< Maximum number of pending joybus messages
 
 /**
  * @anchor JOYBUS_STATE
@@ -107,12 +116,14 @@ typedef struct {
 static uint64_t joybus_outbuf[JOYBUS_BLOCK_DWORDS] __attribute__((aligned(16)));
 /** @brief Joybus current state (either #JOYBUS_STATE_IDLE, #JOYBUS_STATE_SENDING or #JOYBUS_STATE_RECEIVING) */
 static volatile int joybus_state;
-/** @brief Joybus pending messages (ring buffer) */
+/** @brief Pool of joybus messages */
 static joybus_msg_t joybus_msgs[MAX_JOYBUS_MSGS];
-/** @brief Pending messages write index */
-static volatile int msgs_widx;
-/** @brief Pending messages read index */
-static volatile int msgs_ridx;
+/** @brief Free messages in #joybus_msgs */
+static joybus_msg_t *msgs_free;
+/** @brief Pending messages, one FIFO per priority class (see #joybus_prio_t) */
+static joybus_queue_t msgs_queue[JOYBUS_PRIO_COUNT];
+/** @brief Message being currently exchanged with the PIF (NULL if idle) */
+static joybus_msg_t *msg_cur;
 
 static void si_interrupt(void);
 
@@ -130,9 +141,15 @@ void __joybus_init(void)
     extern void __init_interrupts(void);
     __init_interrupts();
 
-    // Initialize the message ring buffer
-    msgs_widx = 0;
-    msgs_ridx = 0;
+    // Initialize the message pool and the pending queues
+    msgs_free = NULL;
+    for (int i = MAX_JOYBUS_MSGS - 1; i >= 0; i--) {
+        joybus_msgs[i].next = msgs_free;
+        msgs_free = &joybus_msgs[i];
+    }
+    for (int i = 0; i < JOYBUS_PRIO_COUNT; i++)
+        msgs_queue[i].head = msgs_queue[i].tail = NULL;
+    msg_cur = NULL;
     joybus_state = JOYBUS_STATE_IDLE;
 
     // Acknowledge any pending SI interrupt
@@ -189,14 +206,20 @@ static void joybus_msg_recv(joybus_msg_t *msg) {
  * @note This function must be called with interrupts disabled.
  */
 static void joybus_poll(void) {
-    // If the ring buffer is not empty, fetch the first message and send it
-    if (msgs_ridx != msgs_widx) {
-        joybus_msg_t *msg = &joybus_msgs[msgs_ridx];
-        joybus_msg_send(msg);
-        return;
+    // Fetch the first message of the highest priority non-empty queue and send it
+    for (int i = 0; i < JOYBUS_PRIO_COUNT; i++) {
+        joybus_queue_t *q = &msgs_queue[i];
+        if (q->head) {
+            msg_cur = q->head;
+            q->head = msg_cur->next;
+            if (!q->head) q->tail = NULL;
+            joybus_msg_send(msg_cur);
+            return;
+        }
     }
 
-    // Queue is empty, switch to idle state
+    // Queues are empty, switch to idle state
+    msg_cur = NULL;
     joybus_state = JOYBUS_STATE_IDLE;
 }
 
@@ -209,18 +232,21 @@ static void si_interrupt(void) {
     switch (joybus_state) {
     case JOYBUS_STATE_SENDING:
         // Message sending complete. Start receiving the reply
-        msg = &joybus_msgs[msgs_ridx];
-        joybus_msg_recv(msg);
+        joybus_msg_recv(msg_cur);
         return;
 
     case JOYBUS_STATE_RECEIVING:
-        // Reply received. Call the callback
-        msg = &joybus_msgs[msgs_ridx];
-        if (msg->callback)
-            msg->callback(joybus_outbuf, msg->context);
-
-        // Increment read pointer and poll for new messages
-        msgs_ridx = (msgs_ridx + 1) % MAX_JOYBUS_MSGS;
+        // Reply received. Release the message first, so that the callback
+        // is free to schedule new messages, then call the callback.
+        msg = msg_cur;
+        void (*callback)(uint64_t *output, void *ctx) = msg->callback;
+        void *context = msg->context;
+        msg->next = msgs_free;
+        msgs_free = msg;
+        if (callback)
+            callback(joybus_outbuf, context);
+
+        // Poll for new messages
         joybus_poll();
         return;
 
@@ -242,8 +268,13 @@ static void si_interrupt(void) {
  * the output is ready to be processed.
  * 
  * It is possible to schedule multiple joybus messages by calling this
- * function multiple times. They will be automatically executed in order.
- * The maximum number of pending messages at any given time is #MAX_JOYBUS_MSGS.
+ * function multiple times. Messages of the same priority class are executed
+ * in order; pending messages of a higher priority class (see #joybus_prio_t)
+ * are sent before any pending message of a lower class, so that for instance
+ * a controller read does not have to wait for a long accessory transfer to
+ * complete. The message being currently exchanged with the PIF is never
+ * interrupted. The maximum number of pending messages at any given time
+ * is #MAX_JOYBUS_MSGS.
  * 
  * @note The callback function will be called under interrupt. 
  * 
@@ -261,33 +292,54 @@ static void si_interrupt(void) {
  *                          Can be NULL if no callback is required.
  * @param[in]   ctx         Context opaque pointer to pass to the callback.
  *                          Can be NULL if no context is required.
+ * @param[in]   prio        Priority class of the message
  */
-void joybus_exec_async(const void * input, void (*callback)(uint64_t *output, void *ctx), void *ctx)
+void joybus_exec_async_prio(const void * input, void (*callback)(uint64_t *output, void *ctx), void *ctx, joybus_prio_t prio)
 {
-    // Make sure that the task queue is not full. If it is, just assert for now.
+    assert(prio >= 0 && prio < JOYBUS_PRIO_COUNT);
+
+    disable_interrupts();
+
+    // Make sure that the message pool is not exhausted. If it is, just assert for now.
     // It is not easy to understand what we should do when the queue is full;
     // blocking would be an option, but if we are under interrupt, we would be
     // deadlocking. So punt for now: we can revisit this later.
-    assertf((msgs_widx + 1) % MAX_JOYBUS_MSGS != msgs_ridx,
-        "joybus task queue is full");
-
-    disable_interrupts();
+    assertf(msgs_free != NULL, "joybus task queue is full");
 
-    // Write the new task into the ring buffer.
-    joybus_msg_t *msg = &joybus_msgs[msgs_widx];
+    // Allocate the new task from the pool and fill it.
+    joybus_msg_t *msg = msgs_free;
+    msgs_free = msg->next;
     memcpy(msg->input, input, JOYBUS_BLOCK_SIZE);
     msg->callback = callback;
     msg->context = ctx;
-
-    // Increment the write index. If the joybus subsystem is idle, poll immediately
-    // so that we can begin sending the message.
-    msgs_widx = (msgs_widx + 1) % MAX_JOYBUS_MSGS;
+    msg->next = NULL;
+
+    // Append it to the queue of its priority class. If the joybus subsystem
+    // is idle, poll immediately so that we can begin sending the message.
+    joybus_queue_t *q = &msgs_queue[prio];
+    if (q->tail) q->tail->next = msg;
+    else q->head = msg;
+    q->tail = msg;
     if (joybus_state == JOYBUS_STATE_IDLE)
         joybus_poll();
 
     enable_interrupts();
 }
 
+/**
+ * @brief Execute an asynchronous joybus message with normal priority.
+ * 
+ * See #joybus_exec_async_prio for details.
+ * 
+ * @param[in]   input       The input block (must be of JOYBUS_BLOCK_SIZE bytes).
+ * @param[in]   callback    A callback completion function (can be NULL).
+ * @param[in]   ctx         Context opaque pointer to pass to the callback.
+ */
+void joybus_exec_async(const void * input, void (*callback)(uint64_t *output, void *ctx), void *ctx)
+{
+    joybus_exec_async_prio(input, callback, ctx, JOYBUS_PRIO_NORMAL);
+}
+
 /**
  * @brief Write a 64-byte block of data to the PIF and read the 64-byte result.
  * 
@@ -305,15 +357,20 @@ void joybus_exec_async(const void * input, void (*callback)(uint64_t *output, vo
  */
 void joybus_exec( const void * input, void * output )
 {
+    static kwaitq_t exec_waitq;
     volatile bool done = false;
 
     void callback(uint64_t *out, void *ctx) {
         memcpy(output, out, JOYBUS_BLOCK_SIZE);
         done = true;
+        kwaitq_wake_all(&exec_waitq);
     }
 
     joybus_exec_async(input, callback, NULL);
-    while (!done) {
+    for (;;) {
+        uint32_t seq = kwaitq_seq(&exec_waitq);
+        if (done) break;
+
         // We want the blocking function to also work with interrupts disabled.
         // So while we spin loop, poll SI interrupts manually in case they
         // are disabled.
@@ -324,7 +381,69 @@ void joybus_exec( const void * input, void * output )
             si_interrupt();
         }
         enable_interrupts();
+
+        // If the kernel is active, switch to other threads until the SI
+        // interrupt completes the transfer. Otherwise, this returns
+        // immediately and we keep polling.
+        kwaitq_wait(&exec_waitq, seq);
     }
 }
 
+/**
+ * @brief Initialize an empty joybus block
+ *
+ * @param[out] blk
+ *             Block to initialize
+ */
+void joybus_block_init( joybus_block_t *blk )
+{
+    memset( blk->data, 0, JOYBUS_BLOCK_SIZE );
+    blk->data[JOYBUS_BLOCK_SIZE - 1] = 0x01;
+    blk->pos = 0;
+    blk->channel = 0;
+}
+
+/**
+ * @brief Append a command to a joybus block
+ *
+ * Each command is sent to its own channel, in increasing order, so
+ * the channels of the commands added to a block must be increasing.
+ * The channels that are skipped take one byte each.
+ *
+ * @param[in,out] blk
+ *                Block to append the command to
+ * @param[in]     channel
+ *                Channel of the command (0-3 for the controller ports)
+ * @param[in]     tx
+ *                Bytes to send (the command byte followed by its arguments)
+ * @param[in]     txlen
+ *                Number of bytes to send
+ * @param[in]     rxlen
+ *                Number of bytes expected in the reply
+ *
+ * @return The offset of the reply within the output block, or -1 if the
+ *         command does not fit in the block, or if its channel was already used.
+ */
+int joybus_block_add( joybus_block_t *blk, int channel, const void *tx, int txlen, int rxlen )
+{
+    /* Room for the skipped channels, the lengths, the data, and the end marker */
+    int pos = blk->pos + channel - blk->channel;
+    if( channel < blk->channel || pos + 2 + txlen + rxlen + 1 > JOYBUS_BLOCK_SIZE - 1 ) { return -1; }
+
+    /* Skipped channels are already zero (see joybus_block_init) */
+    uint8_t *data = blk->data;
+    data[pos++] = txlen;
+    data[pos++] = rxlen;
+    memcpy( &data[pos], tx, txlen );
+    pos += txlen;
+    memset( &data[pos], 0xFF, rxlen );
+    int rx = pos;
+    pos += rxlen;
+    data[pos] = 0xFE;
+
+    blk->pos = pos;
+    blk->channel = channel + 1;
+    return rx;
+}
+
 /** @} */ /* joybus */
@@ -9,6 +9,20 @@
 
 #include <stdint.h>
 
+/**
+ * @brief Priority classes of joybus messages.
+ *
+ * Pending messages of a lower value are sent first.
+ *
+ * @see #joybus_exec_async_prio
+ */
+typedef enum {
+    JOYBUS_PRIO_HIGH = 0,       ///< Latency-sensitive messages (eg: controller polling)
+    JOYBUS_PRIO_NORMAL,         ///< Default class (eg: accessory and save transfers)
+    JOYBUS_PRIO_COUNT           ///< Number of priority classes
+} joybus_prio_t;
+
+void joybus_exec_async_prio(const void * input, void (*callback)(uint64_t *output, void *ctx), void *ctx, joybus_prio_t prio);
 void joybus_exec_async(const void * input, void (*callback)(uint64_t *output, void *ctx), void *ctx);
 
 #endif
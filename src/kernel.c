@@ -0,0 +1,377 @@
+/**
+ * @file kernel.c
+ * @brief Cooperative multitasking kernel
+ * @ingroup kernel
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include "kernel.h"
+#include "interrupt.h"
+#include "cop0.h"
+#include "cop1.h"
+#include "debug.h"
+
+/**
+ * @defgroup kernel Multitasking kernel
+ * @ingroup lowlevel
+ * @brief Lightweight cooperative threads and wait queues.
+ *
+ * The kernel allows to run multiple threads of execution, each with its
+ * own stack. Scheduling is cooperative: a thread runs until it calls
+ * #kthread_yield, blocks on a wait queue, or terminates. Threads are never
+ * preempted, so there is no need for locking between them, and interrupt
+ * handlers are not affected at all by the kernel.
+ *
+ * Call #kernel_init once to turn the current code into the main thread,
+ * then create other threads with #kthread_new (eg: a loader thread that
+ * decompresses assets, or a thread running game AI). The blocking functions
+ * of libdragon (eg: #dma_wait, #rspq_syncpoint_wait, #joybus_exec,
+ * #display_get) automatically give the CPU to other threads while waiting,
+ * so a thread blocked on the hardware does not prevent the others from
+ * running. When the kernel is not initialized, they keep busy-waiting as
+ * usual.
+ *
+ * A wait queue (#kwaitq_t) is used to block threads until an event happens,
+ * usually signaled by an interrupt handler with #kwaitq_wake_all. Waiting
+ * follows a simple pattern that avoids losing wake-ups happening between the
+ * check of the condition and the call to #kwaitq_wait:
+ *
+ * @code{.c}
+ *      // Equivalent to KWAITQ_WAIT_UNTIL(&q, done)
+ *      for (;;) {
+ *          uint32_t seq = kwaitq_seq(&q);
+ *          if (done) break;
+ *          kwaitq_wait(&q, seq);
+ *      }
+ * @endcode
+ *
+ * When no thread is ready to run, the CPU idles with interrupts enabled
+ * until an interrupt wakes a thread up.
+ *
+ * Threads can only be switched when interrupts are enabled: when called
+ * with interrupts disabled or from an interrupt handler, #kthread_yield and
+ * #kwaitq_wait return immediately, so that callers fall back to busy-waiting.
+ * @{
+ */
+
+/** @brief Thread is ready to run (or running) */
+#define KTHREAD_READY       0
+/** @brief Thread is blocked on a wait queue */
+#define KTHREAD_BLOCKED     1
+/** @brief Thread has terminated, and is waiting to be joined */
+#define KTHREAD_DONE        2
+
+/** @brief Size of the frame pushed by __kthread_switch (see inthandler.S) */
+#define KTHREAD_FRAME_SIZE  192
+/** @brief Offset of the saved S0 register in the switch frame */
+#define KTHREAD_FRAME_S0    0
+/** @brief Offset of the saved RA register in the switch frame */
+#define KTHREAD_FRAME_RA    72
+/** @brief Offset of the saved FCR31 register in the switch frame */
+#define KTHREAD_FRAME_FC31  176
+
+/** @brief A thread */
+struct kthread_s {
+    uint32_t sp;                ///< Saved stack pointer while not running
+    const char *name;           ///< Name of the thread (for debugging)
+    void *stack;                ///< Stack memory (NULL for the main thread)
+    int (*entry)(void *arg);    ///< Entry point
+    void *arg;                  ///< Argument of the entry point
+    int state;                  ///< State of the thread (KTHREAD_READY, etc.)
+    int result;                 ///< Value returned by the thread
+    kthread_t *next;            ///< Next thread in the ready list or in a wait queue
+    kwaitq_t joinq;             ///< Threads waiting for this one to terminate
+};
+
+/** @brief Switch context (see inthandler.S) */
+extern void __kthread_switch(uint32_t *old_sp, uint32_t new_sp);
+/** @brief Entry point of new threads (see inthandler.S) */
+extern void __kthread_trampoline(void);
+
+/** @brief The main thread */
+static kthread_t th_main;
+/** @brief The currently running thread (NULL if the kernel is not initialized) */
+static kthread_t *th_cur;
+/** @brief Threads ready to run, in FIFO order */
+static kthread_t *ready_head, *ready_tail;
+
+/** @brief Append a thread to the ready list. Interrupts must be disabled. */
+static void ready_push(kthread_t *th)
+{
+    th->state = KTHREAD_READY;
+    th->next = NULL;
+    if (ready_tail)
+        ready_tail->next = th;
+    else
+        ready_head = th;
+    ready_tail = th;
+}
+
+/**
+ * @brief Switch to the next ready thread.
+ *
+ * Must be called with interrupts disabled exactly once (that is, by the
+ * kernel itself). The current thread must have been already put on the
+ * ready list or on a wait queue. If no thread is ready, the CPU idles with
+ * interrupts enabled until one is woken up.
+ */
+static void kernel_schedule(void)
+{
+    kthread_t *prev = th_cur;
+
+    while (!ready_head) {
+        enable_interrupts();
+        disable_interrupts();
+        MEMORY_BARRIER();
+    }
+
+    kthread_t *next = ready_head;
+    ready_head = next->next;
+    if (!ready_head)
+        ready_tail = NULL;
+    next->next = NULL;
+
+    if (next != prev) {
+        th_cur = next;
+        __kthread_switch(&prev->sp, next->sp);
+    }
+}
+
+/**
+ * @brief Check whether the current thread can be switched out right now
+ *
+ * This requires interrupts to be enabled, which also excludes interrupt
+ * handlers (where the IE bit is clear even if #disable_interrupts was not
+ * called).
+ */
+static bool kernel_can_switch(void)
+{
+    return th_cur && (C0_STATUS() & C0_STATUS_IE);
+}
+
+/**
+ * @brief C entry point of a new thread, called by __kthread_trampoline
+ *
+ * @param[in] th    The new thread
+ */
+void __kthread_start(kthread_t *th)
+{
+    /* The thread was switched in by kernel_schedule, which runs with interrupts
+       disabled: balance that call. */
+    enable_interrupts();
+    kthread_exit(th->entry(th->arg));
+}
+
+/**
+ * @brief Initialize the multitasking kernel
+ *
+ * The code calling this function becomes the main thread, which keeps
+ * running on the current stack. Other threads can then be created with
+ * #kthread_new.
+ */
+void kernel_init(void)
+{
+    assertf(!th_cur, "kernel already initialized");
+    memset(&th_main, 0, sizeof(th_main));
+    th_main.name = "main";
+    th_main.state = KTHREAD_READY;
+    th_cur = &th_main;
+}
+
+/**
+ * @brief Check whether the kernel is initialized
+ *
+ * @return true if #kernel_init was called
+ */
+bool kernel_active(void)
+{
+    return th_cur != NULL;
+}
+
+/**
+ * @brief Create a new thread
+ *
+ * The thread is ready to run, and will start executing @p entry the next
+ * time the current thread yields the CPU. When @p entry returns, the thread
+ * terminates as if #kthread_exit was called with the returned value.
+ *
+ * The stack must be large enough for the thread itself, plus the frames
+ * of the interrupt handlers, that run on the stack of the interrupted
+ * thread.
+ *
+ * @param[in] name          Name of the thread (for debugging)
+ * @param[in] stack_size    Size of the stack in bytes (at least #KTHREAD_MIN_STACK_SIZE)
+ * @param[in] entry         Entry point of the thread
+ * @param[in] arg           Argument passed to the entry point
+ * @return                  The new thread. It must be freed with #kthread_join.
+ */
+kthread_t *kthread_new(const char *name, int stack_size, int (*entry)(void *arg), void *arg)
+{
+    assertf(th_cur, "kernel not initialized");
+    assertf(stack_size >= KTHREAD_MIN_STACK_SIZE, "stack too small for thread %s: %d", name, stack_size);
+    stack_size = (stack_size + 15) & ~15;
+
+    kthread_t *th = malloc(sizeof(kthread_t));
+    assertf(th, "out of memory creating thread %s", name);
+    memset(th, 0, sizeof(kthread_t));
+    th->name = name;
+    th->entry = entry;
+    th->arg = arg;
+    th->stack = memalign(16, stack_size);
+    assertf(th->stack, "out of memory allocating stack for thread %s", name);
+
+    /* Prepare the initial frame popped by __kthread_switch, keeping the 32
+       bytes of argument slots required by the ABI above it. */
+    uint8_t *frame = (uint8_t*)th->stack + stack_size - 32 - KTHREAD_FRAME_SIZE;
+    memset(frame, 0, KTHREAD_FRAME_SIZE);
+    *(uint64_t*)(frame + KTHREAD_FRAME_S0) = (uint32_t)th;
+    *(uint64_t*)(frame + KTHREAD_FRAME_RA) = (uint32_t)__kthread_trampoline;
+    *(uint32_t*)(frame + KTHREAD_FRAME_FC31) = C1_FCR31();
+    th->sp = (uint32_t)frame;
+
+    disable_interrupts();
+    ready_push(th);
+    enable_interrupts();
+    return th;
+}
+
+/**
+ * @brief Return the currently running thread
+ *
+ * @return The current thread, or NULL if the kernel is not initialized
+ */
+kthread_t *kthread_current(void)
+{
+    return th_cur;
+}
+
+/**
+ * @brief Return the name of a thread
+ *
+ * @param[in] th    Thread
+ * @return          Name given to #kthread_new
+ */
+const char *kthread_name(kthread_t *th)
+{
+    return th->name;
+}
+
+/**
+ * @brief Give the CPU to other threads that are ready to run
+ *
+ * The current thread is put at the end of the ready list, so all the other
+ * ready threads run before it resumes. If no other thread is ready, or if
+ * interrupts are disabled, this function returns immediately.
+ */
+void kthread_yield(void)
+{
+    if (!kernel_can_switch() || !ready_head)
+        return;
+
+    disable_interrupts();
+    ready_push(th_cur);
+    kernel_schedule();
+    enable_interrupts();
+}
+
+/**
+ * @brief Terminate the current thread
+ *
+ * The thread resources are freed by #kthread_join. The main thread cannot
+ * terminate.
+ *
+ * @param[in] result    Value returned to #kthread_join
+ */
+void kthread_exit(int result)
+{
+    assertf(th_cur != &th_main, "the main thread cannot exit");
+    assertf(kernel_can_switch(), "thread %s exiting with interrupts disabled", th_cur->name);
+
+    disable_interrupts();
+    th_cur->result = result;
+    th_cur->state = KTHREAD_DONE;
+    kwaitq_wake_all(&th_cur->joinq);
+    kernel_schedule();
+    __builtin_unreachable();
+}
+
+/**
+ * @brief Wait for a thread to terminate, and free it
+ *
+ * @param[in] th    Thread to wait for (cannot be the current thread)
+ * @return          The value returned by the thread entry point, or passed
+ *                  to #kthread_exit
+ */
+int kthread_join(kthread_t *th)
+{
+    assertf(th != th_cur, "thread %s cannot join itself", th->name);
+    assertf(kernel_can_switch(), "deadlock: interrupts are disabled");
+
+    KWAITQ_WAIT_UNTIL(&th->joinq, th->state == KTHREAD_DONE);
+
+    int result = th->result;
+    free(th->stack);
+    free(th);
+    return result;
+}
+
+/**
+ * @brief Block the current thread until the queue is woken
+ *
+ * @p seq must be read with #kwaitq_seq before checking the condition being
+ * waited for: if the queue was woken after that, this function returns
+ * immediately, so that wake-ups are never lost. Like all wait functions,
+ * this can return even if the condition is still false, so the caller must
+ * check it again (see #KWAITQ_WAIT_UNTIL).
+ *
+ * If the kernel is not initialized or interrupts are disabled, this function
+ * returns immediately, so the caller busy-waits.
+ *
+ * @param[in] q     Wait queue
+ * @param[in] seq   Value previously returned by #kwaitq_seq
+ */
+void kwaitq_wait(kwaitq_t *q, uint32_t seq)
+{
+    if (!kernel_can_switch())
+        return;
+
+    disable_interrupts();
+    if (q->seq == seq) {
+        kthread_t *th = th_cur;
+        th->state = KTHREAD_BLOCKED;
+        th->next = NULL;
+        if (q->tail)
+            q->tail->next = th;
+        else
+            q->head = th;
+        q->tail = th;
+        kernel_schedule();
+    }
+    enable_interrupts();
+}
+
+/**
+ * @brief Wake all the threads waiting on a queue
+ *
+ * The woken threads are put on the ready list, and will run the next time
+ * the current thread yields the CPU. This function can be called from
+ * interrupt handlers.
+ *
+ * @param[in] q     Wait queue
+ */
+void kwaitq_wake_all(kwaitq_t *q)
+{
+    disable_interrupts();
+    q->seq++;
+    kthread_t *th = q->head;
+    q->head = q->tail = NULL;
+    while (th) {
+        kthread_t *next = th->next;
+        ready_push(th);
+        th = next;
+    }
+    enable_interrupts();
+}
+
+/** @} */
@@ -94,6 +94,17 @@ static void __cart_dma_rd(void *dram, uint32_t cart, uint32_t size)
     dma_wait();
 }
 
+/* Read from a cart memory buffer into a DRAM address with the same 2-byte
+   alignment. dma_read_async realigns the transfer moving the first/last
+   bytes with the CPU, so this avoids bouncing through __cart_buf. Only usable
+   on memory-mapped buffers (not on FIFO registers). */
+static void __cart_dma_rd_unaligned(void *dram, uint32_t cart, uint32_t size)
+{
+    data_cache_hit_writeback_invalidate(dram, size);
+    dma_read_async(dram, cart, size);
+    dma_wait();
+}
+
 static void __cart_dma_wr(const void *dram, uint32_t cart, uint32_t size)
 {
     data_cache_hit_writeback((void *)dram, size);
@@ -468,11 +479,15 @@ int ci_card_rd_dram(void *dram, uint32_t lba, uint32_t count)
             __ci_sync();
             CART_ABORT();
         }
-        if ((long)addr & 7)
+        if ((long)addr & 1)
         {
             __cart_dma_rd(__cart_buf, CI_BUFFER_REG, 512);
             __cart_buf_wr(addr);
         }
+        else if ((long)addr & 7)
+        {
+            __cart_dma_rd_unaligned(addr, CI_BUFFER_REG, 512);
+        }
         else
         {
             __cart_dma_rd(addr, CI_BUFFER_REG, 512);
@@ -1691,7 +1706,7 @@ int sc_card_rd_dram(void *dram, uint32_t lba, uint32_t count)
         io_write(SC_DATA1_REG, n);
         io_write(SC_COMMAND_REG, SC_SD_READ);
         if (__sc_sync()) CART_ABORT();
-        if ((long)addr & 7)
+        if ((long)addr & 1)
         {
             for (i = 0; i < n; i++)
             {
@@ -1700,6 +1715,11 @@ int sc_card_rd_dram(void *dram, uint32_t lba, uint32_t count)
                 addr += 512;
             }
         }
+        else if ((long)addr & 7)
+        {
+            __cart_dma_rd_unaligned(addr, SC_BUFFER_REG, 512*n);
+            addr += 512*n;
+        }
         else
         {
             __cart_dma_rd(addr, SC_BUFFER_REG, 512*n);
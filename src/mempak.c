@@ -45,6 +45,30 @@
 #define BLOCK_VALID_LAST    0x7F
 /** @} */
 
+/**
+ * @brief Cached filesystem structures of a mempak
+ *
+ * The header, the TOC and the note table are read and validated once, and
+ * then kept here until the mempak is removed (see #invalidate_mempak_cache).
+ * Writes through the filesystem functions update the cache.
+ */
+typedef struct
+{
+    /** @brief True if #toc and #toc_data refer to the inserted mempak */
+    bool valid;
+    /** @brief Sector of the valid TOC (1 or 2) */
+    int toc;
+    /** @brief Contents of the valid TOC */
+    uint8_t toc_data[MEMPAK_BLOCK_SIZE];
+    /** @brief True if #notes refers to the inserted mempak */
+    bool notes_valid;
+    /** @brief Note table (sectors 3 and 4) */
+    uint8_t notes[2 * MEMPAK_BLOCK_SIZE];
+} mempak_cache_t;
+
+/** @brief Cache of the mempak of each controller */
+static mempak_cache_t mempak_cache[4];
+
 /**
  * @brief Read a sector from a mempak
  *
@@ -102,6 +126,13 @@ int write_mempak_sector( int controller, int sector, uint8_t *sector_data )
     if( sector < 0 || sector >= 128 ) { return -1; }
     if( sector_data == 0 ) { return -1; }
 
+    /* Raw writes to the filesystem structures make the cache stale */
+    if( controller >= 0 && controller < 4 )
+    {
+        if( sector <= 2 ) { mempak_cache[controller].valid = false; }
+        else if( sector <= 4 ) { mempak_cache[controller].notes_valid = false; }
+    }
+
     /* Sectors are 256 bytes, a mempak writes 32 bytes at a time */
     for( int i = 0; i < 8; i++ )
     {
@@ -658,6 +689,27 @@ static int __get_valid_toc( int controller )
     /* We will need only one sector at a time */
     uint8_t data[MEMPAK_BLOCK_SIZE];
 
+    if( controller < 0 || controller > 3 ) { return -2; }
+
+    /* As long as a pak is inserted, trust the cached TOC. This costs a single
+       joybus transaction, instead of reading and validating three sectors.
+       With the background accessory queries, the cache is dropped as soon as
+       the pak is removed, so it can be trusted without any transaction. */
+    mempak_cache_t *cache = &mempak_cache[controller];
+    if( cache->valid )
+    {
+        int present = controller_get_accessories();
+        if( present < 0 ) { present = get_accessories_present( NULL ); }
+        if( present & (CONTROLLER_1_INSERTED >> (controller * 4)) )
+        {
+            return cache->toc;
+        }
+        invalidate_mempak_cache( controller );
+    }
+
+    /* The note table might belong to another mempak as well */
+    cache->notes_valid = false;
+
     /* First check to see that the header block is valid */
     if( read_mempak_sector( controller, 0, data ) )
     {
@@ -695,14 +747,144 @@ static int __get_valid_toc( int controller )
         else
         {
             /* Found a good TOC! */
-            return 2;
+            cache->toc = 2;
         }
     }
     else
     {
         /* Found a good TOC! */
-        return 1;
+        cache->toc = 1;
+    }
+
+    memcpy( cache->toc_data, data, MEMPAK_BLOCK_SIZE );
+    cache->valid = true;
+    return cache->toc;
+}
+
+/**
+ * @brief Get the contents of the valid TOC
+ *
+ * Must be called after a successful #__get_valid_toc.
+ *
+ * @param[in]  controller
+ *             The controller (0-3) of the mempak
+ * @param[out] sector
+ *             Buffer to place the 256 bytes of the TOC
+ */
+static void __read_toc( int controller, uint8_t *sector )
+{
+    memcpy( sector, mempak_cache[controller].toc_data, MEMPAK_BLOCK_SIZE );
+}
+
+/**
+ * @brief Write both copies of the TOC, starting from the alternate one
+ *
+ * @param[in] controller
+ *            The controller (0-3) of the mempak
+ * @param[in] toc
+ *            Sector of the valid TOC (1 or 2)
+ * @param[in] sector
+ *            New contents of the TOC, with the checksum already updated
+ *
+ * @retval 0 if the TOC was written successfully
+ * @retval -2 if the mempak was bad or not present
+ */
+static int __write_toc( int controller, int toc, uint8_t *sector )
+{
+    if( __write_toc( controller, toc, sector ) )
+    {
+        /* Failed to write the TOC */
+        return -2;
+    }
+
+    /* Both copies are now identical, keep the cache in sync */
+    mempak_cache_t *cache = &mempak_cache[controller];
+    memcpy( cache->toc_data, sector, MEMPAK_BLOCK_SIZE );
+    cache->toc = toc;
+    cache->valid = true;
+    return 0;
+}
+
+/**
+ * @brief Read an entry of the note table
+ *
+ * The whole note table is read at once the first time, so that listing
+ * all the notes only reads the mempak once.
+ *
+ * @param[in]  controller
+ *             The controller (0-3) of the mempak
+ * @param[in]  entry
+ *             The entry index (0-15) to read
+ * @param[out] data
+ *             Buffer to place the 32 bytes of the entry
+ *
+ * @retval 0 if the entry was read successfully
+ * @retval -2 if the mempak was bad or not present
+ */
+static int __read_note_entry( int controller, int entry, uint8_t *data )
+{
+    mempak_cache_t *cache = &mempak_cache[controller];
+
+    if( !cache->notes_valid )
+    {
+        if( read_mempak_sector( controller, 3, cache->notes ) ||
+            read_mempak_sector( controller, 4, cache->notes + MEMPAK_BLOCK_SIZE ) )
+        {
+            /* Couldn't read note database */
+            return -2;
+        }
+        cache->notes_valid = true;
     }
+
+    memcpy( data, cache->notes + entry * 32, 32 );
+    return 0;
+}
+
+/**
+ * @brief Write an entry of the note table
+ *
+ * @param[in] controller
+ *            The controller (0-3) of the mempak
+ * @param[in] entry
+ *            The entry index (0-15) to write
+ * @param[in] data
+ *            The 32 bytes of the entry
+ *
+ * @retval 0 if the entry was written successfully
+ * @retval -2 if the mempak was bad or not present
+ */
+static int __write_note_entry( int controller, int entry, uint8_t *data )
+{
+    mempak_cache_t *cache = &mempak_cache[controller];
+
+    if( write_mempak_address( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry * 32), data ) )
+    {
+        /* Couldn't update note database, its state is unknown */
+        cache->notes_valid = false;
+        return -2;
+    }
+
+    if( cache->notes_valid ) { memcpy( cache->notes + entry * 32, data, 32 ); }
+    return 0;
+}
+
+/**
+ * @brief Invalidate the cached filesystem structures of a mempak
+ *
+ * The mempak filesystem functions cache the TOC and the note table of the
+ * mempak of each controller, and drop the cache when they find that the
+ * mempak was removed. This function must be called if the mempak might have
+ * been swapped between two calls, or modified with #write_mempak_address.
+ * #identify_accessory calls this function.
+ *
+ * @param[in] controller
+ *            The controller (0-3) of the mempak
+ */
+void invalidate_mempak_cache( int controller )
+{
+    if( controller < 0 || controller > 3 ) { return; }
+    mempak_cache[controller].valid = false;
+    mempak_cache[controller].notes_valid = false;
 }
 
 /**
@@ -768,7 +950,7 @@ int get_mempak_entry( int controller, int entry, entry_structure_t *entry_data )
 
     /* Entries are spread across two sectors, but we can luckly grab just one
        with a single mempak read */
-    if( read_mempak_address( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry * 32), data ) )
+    if( __read_note_entry( controller, entry, data ) )
     {
         /* Couldn't read note database */
         return -2;
@@ -781,11 +963,7 @@ int get_mempak_entry( int controller, int entry, entry_structure_t *entry_data )
     }
 
     /* Grab the TOC sector */
-    if( read_mempak_sector( controller, toc, data ) )
-    {
-        /* Couldn't read TOC */
-        return -2;
-    }
+    __read_toc( controller, data );
 
     /* Get the length of the entry */
     int blocks = __get_num_pages( data, entry_data->inode );
@@ -829,11 +1007,7 @@ int get_mempak_free_space( int controller )
     }
 
     /* Grab the valid TOC to get free space */
-    if( read_mempak_sector( controller, toc, data ) )
-    {
-        /* Couldn't read TOC */
-        return -2;
-    }
+    __read_toc( controller, data );
 
     return __get_free_space( data );
 }
@@ -965,11 +1139,7 @@ int read_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *d
     }
 
     /* Grab the valid TOC to get free space */
-    if( read_mempak_sector( controller, toc, tocdata ) )
-    {
-        /* Couldn't read TOC */
-        return -2;
-    }
+    __read_toc( controller, tocdata );
 
     /* Now loop through blocks and grab each one */
     for( int i = 0; i < entry->blocks; i++ )
@@ -993,7 +1163,8 @@ int read_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *d
  * Given a mempak entry structure with a valid region, name and block count, writes the
  * entry and associated data to the mempak.  This function will not overwrite any existing
  * user data.  To update an existing entry, use #delete_mempak_entry followed by
- * #write_mempak_entry_data with the same entry structure.
+ * #write_mempak_entry_data with the same entry structure, or #update_mempak_entry_data
+ * to rewrite it in place if the size does not change.
  *
  * @param[in] controller
  *            The controller (0-3) to write the entry and data to
@@ -1029,11 +1200,7 @@ int write_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *
     }
 
     /* Grab the valid TOC to get free space */
-    if( read_mempak_sector( controller, toc, sector ) )
-    {
-        /* Couldn't read TOC */
-        return -2;
-    }
+    __read_toc( controller, sector );
 
     /* Verify that we have enough free space */
     if( __get_free_space( sector ) < entry->blocks )
@@ -1097,7 +1264,7 @@ int write_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *
     {
         entry_structure_t tmp_entry;
 
-        if( read_mempak_address( controller, (3 * MEMPAK_BLOCK_SIZE) + (i * 32), tmp_data ) )
+        if( __read_note_entry( controller, i, tmp_data ) )
         {
             /* Couldn't read note database */
             return -2;
@@ -1122,17 +1289,9 @@ int write_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *
     /* Update CRC on newly updated TOC */
     sector[1] = __get_toc_checksum( sector );
 
-    /* Write back to alternate TOC first before erasing the known valid one */
-    if( write_mempak_sector( controller, ( toc == 1 ) ? 2 : 1, sector ) )
+    if( __write_toc( controller, toc, sector ) )
     {
-        /* Failed to write alternate TOC */
-        return -2;
-    }
-
-    /* Write back to good TOC now that alternate is updated */
-    if( write_mempak_sector( controller, toc, sector ) )
-    {
-        /* Failed to write alternate TOC */
+        /* Failed to write the TOC */
         return -2;
     }
 
@@ -1140,7 +1299,7 @@ int write_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *
     __write_note( entry, tmp_data );
 
     /* Store entry to empty slot on mempak */
-    if( write_mempak_address( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry->entry_id * 32), tmp_data ) )
+    if( __write_note_entry( controller, entry->entry_id, tmp_data ) )
     {
         /* Couldn't update note database */
         return -2;
@@ -1149,6 +1308,83 @@ int write_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *
     return 0;
 }
 
+/**
+ * @brief Update the data of an existing mempak entry, writing only what changed
+ *
+ * Given a valid mempak entry fetched by #get_mempak_entry, overwrites its data in
+ * place, keeping its blocks. The data is compared in 32-byte chunks (the unit of
+ * mempak transfers) with the current contents, and only the chunks that differ
+ * are written. The current contents are taken from @p old_data if available (for
+ * instance, the buffer filled by a previous #read_mempak_entry_data), otherwise
+ * each chunk is read back from the mempak before deciding whether to write it.
+ *
+ * @param[in] controller
+ *            The controller (0-3) to write the entry data to
+ * @param[in] entry
+ *            The entry structure associated with the data to be updated
+ * @param[in] data
+ *            The new data of the entry (entry->blocks * #MEMPAK_BLOCK_SIZE bytes)
+ * @param[in] old_data
+ *            The current data of the entry, or NULL to read it back from the mempak
+ *
+ * @return The number of bytes written to the mempak (multiple of 32), or:
+ * @retval -1 if input parameters were out of bounds or the entry was corrupted somehow
+ * @retval -2 if the mempak was not present or bad
+ * @retval -3 if the data couldn't be read or written
+ */
+int update_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *data, const uint8_t *old_data )
+{
+    int toc;
+    int written = 0;
+    uint8_t tocdata[MEMPAK_BLOCK_SIZE];
+    uint8_t chunk[32];
+
+    /* Some serious sanity checking */
+    if( entry == 0 || data == 0 ) { return -1; }
+    if( entry->valid == 0 ) { return -1; }
+    if( entry->blocks == 0 || entry->blocks > 123 ) { return -1; }
+    if( entry->inode < BLOCK_VALID_FIRST || entry->inode > BLOCK_VALID_LAST ) { return -1; }
+
+    /* Grab the TOC sector so we can get to the individual blocks the data comprises of */
+    if( (toc = __get_valid_toc( controller )) <= 0 )
+    {
+        /* Bad mempak or was removed, return */
+        return -2;
+    }
+
+    __read_toc( controller, tocdata );
+
+    for( int i = 0; i < entry->blocks; i++ )
+    {
+        int block = __get_note_block( tocdata, entry->inode, i );
+        if( block < BLOCK_VALID_FIRST ) { return -1; }
+
+        for( int j = 0; j < MEMPAK_BLOCK_SIZE; j += 32 )
+        {
+            int offset = i * MEMPAK_BLOCK_SIZE + j;
+            uint16_t address = block * MEMPAK_BLOCK_SIZE + j;
+            const uint8_t *old = old_data ? old_data + offset : chunk;
+
+            if( !old_data && read_mempak_address( controller, address, chunk ) )
+            {
+                /* Couldn't read back the current contents */
+                return -3;
+            }
+
+            if( memcmp( old, data + offset, 32 ) == 0 ) { continue; }
+
+            if( write_mempak_address( controller, address, data + offset ) )
+            {
+                /* Couldn't write a chunk */
+                return -3;
+            }
+            written += 32;
+        }
+    }
+
+    return written;
+}
+
 /**
  * @brief Delete a mempak entry and associated data
  *
@@ -1176,8 +1412,15 @@ int delete_mempak_entry( int controller, entry_structure_t *entry )
     if( entry->entry_id > 15 ) { return -1; }
     if( entry->inode < BLOCK_VALID_FIRST || entry->inode > BLOCK_VALID_LAST ) { return -1; }
 
+    /* Grab the first valid TOC entry */
+    if( (toc = __get_valid_toc( controller )) <= 0 )
+    {
+        /* Bad mempak or was removed, return */
+        return -2;
+    }
+
     /* Ensure that the entry passed in matches what's on the mempak */
-    if( read_mempak_address( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry->entry_id * 32), data ) )
+    if( __read_note_entry( controller, entry->entry_id, data ) )
     {
         /* Couldn't read note database */
         return -2;
@@ -1197,25 +1440,14 @@ int delete_mempak_entry( int controller, entry_structure_t *entry )
 
     /* The entry matches, so blank it */
     memset( data, 0, 32 );
-    if( write_mempak_address( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry->entry_id * 32), data ) )
+    if( __write_note_entry( controller, entry->entry_id, data ) )
     {
         /* Couldn't update note database */
         return -2;
     }
 
-    /* Grab the first valid TOC entry */
-    if( (toc = __get_valid_toc( controller )) <= 0 )
-    {
-        /* Bad mempak or was removed, return */
-        return -2;
-    }
-
     /* Grab the valid TOC to erase sectors */
-    if( read_mempak_sector( controller, toc, data ) )
-    {
-        /* Couldn't read TOC */
-        return -2;
-    }
+    __read_toc( controller, data );
 
     /* Erase all blocks out of the TOC */
     int tally = 0;
@@ -1254,17 +1486,9 @@ int delete_mempak_entry( int controller, entry_structure_t *entry )
     /* Update CRC on newly updated TOC */
     data[1] = __get_toc_checksum( data );
 
-    /* Write back to alternate TOC first before erasing the known valid one */
-    if( write_mempak_sector( controller, ( toc == 1 ) ? 2 : 1, data ) )
-    {
-        /* Failed to write alternate TOC */
-        return -2;
-    }
-
-    /* Write back to good TOC now that alternate is updated */
-    if( write_mempak_sector( controller, toc, data ) )
+    if( __write_toc( controller, toc, data ) )
     {
-        /* Failed to write alternate TOC */
+        /* Failed to write the TOC */
         return -2;
     }
 
@@ -8,6 +8,8 @@
 #include <assert.h>
 #include <malloc.h>
 #include "n64sys.h"
+#include "exception.h"
+#include "idle.h"
 #include "utils.h"
 
 /**
@@ -86,10 +88,34 @@ void sys_set_boot_cic(int bc)
     } \
 })
 
+/** @brief Size of the data cache in bytes */
+#define DCACHE_SIZE         (8*1024)
+/** @brief Size of the instruction cache in bytes */
+#define ICACHE_SIZE         (16*1024)
+
+/**
+ * @brief Helper macro to perform an index cache operation over the whole cache
+ *
+ * @param[in] op
+ *            Operation to perform (must be an index operation)
+ * @param[in] linesize
+ *            Size of a cacheline in bytes
+ * @param[in] cachesize
+ *            Size of the cache in bytes
+ */
+#define cache_op_all(op, linesize, cachesize) ({ \
+    for (int i = 0; i < (cachesize); i += (linesize)) \
+        asm ("\tcache %0,(%1)\n"::"i" (op), "r" (KSEG0_START_ADDR+i)); \
+})
+
 /**
  * @brief Force a data cache writeback over a memory region
  *
  * Use this to force cached memory to be written to RDRAM.
+ * 
+ * For regions larger than the data cache, the whole cache is written back
+ * and invalidated via index operations instead, which is faster than going
+ * through the region one line at a time.
  *
  * @param[in] addr
  *            Pointer to memory in question
@@ -98,10 +124,20 @@ void sys_set_boot_cic(int bc)
  */
 void data_cache_hit_writeback(volatile const void * addr, unsigned long length)
 {
+    if (length > DCACHE_SIZE) {
+        cache_op_all(0x01, 16, DCACHE_SIZE);
+        return;
+    }
     cache_op(0x19, 16);
 }
 
-/** @brief Underlying implementation of data_cache_hit_invalidate */
+/** 
+ * @brief Underlying implementation of data_cache_hit_invalidate
+ * 
+ * There is no index fast path here: the only D-cache index operation
+ * that invalidates lines also writes them back, which would overwrite the
+ * data written into the region by DMA.
+ */
 void __data_cache_hit_invalidate(volatile void * addr, unsigned long length)
 {
     cache_op(0x11, 16);
@@ -111,6 +147,9 @@ void __data_cache_hit_invalidate(volatile void * addr, unsigned long length)
  * @brief Force a data cache writeback invalidate over a memory region
  *
  * Use this to force cached memory to be written to RDRAM and then cache updated.
+ * 
+ * For regions larger than the data cache, the whole cache is written back
+ * and invalidated via index operations instead.
  *
  * @param[in] addr
  *            Pointer to memory in question
@@ -119,6 +158,10 @@ void __data_cache_hit_invalidate(volatile void * addr, unsigned long length)
  */
 void data_cache_hit_writeback_invalidate(volatile void * addr, unsigned long length)
 {
+    if (length > DCACHE_SIZE) {
+        cache_op_all(0x01, 16, DCACHE_SIZE);
+        return;
+    }
     cache_op(0x15, 16);
 }
 
@@ -143,8 +186,7 @@ void data_cache_index_writeback_invalidate(volatile void * addr, unsigned long l
  */
 void data_cache_writeback_invalidate_all(void)
 {
-    // TODO: do an index op instead for better performance
-    data_cache_hit_writeback_invalidate(KSEG0_START_ADDR, get_memory_size());
+    cache_op_all(0x01, 16, DCACHE_SIZE);
 }
 
 /**
@@ -166,6 +208,9 @@ void inst_cache_hit_writeback(volatile const void * addr, unsigned long length)
  * @brief Force an instruction cache invalidate over a memory region
  *
  * Use this to force the N64 to update cache from RDRAM.
+ * 
+ * For regions larger than the instruction cache, the whole cache is
+ * invalidated via index operations instead.
  *
  * @param[in] addr
  *            Pointer to memory in question
@@ -174,6 +219,10 @@ void inst_cache_hit_writeback(volatile const void * addr, unsigned long length)
  */
 void inst_cache_hit_invalidate(volatile void * addr, unsigned long length)
 {
+    if (length > ICACHE_SIZE) {
+        cache_op_all(0x00, 32, ICACHE_SIZE);
+        return;
+    }
     cache_op(0x10, 32);
 }
 
@@ -198,8 +247,7 @@ void inst_cache_index_invalidate(volatile void * addr, unsigned long length)
  */
 void inst_cache_invalidate_all(void)
 {
-    // TODO: do an index op instead for better performance
-    inst_cache_hit_invalidate(KSEG0_START_ADDR, get_memory_size());
+    cache_op_all(0x00, 32, ICACHE_SIZE);
 }
 
 /**
@@ -326,9 +374,96 @@ tv_type_t get_tv_type()
     return *((uint32_t *) TV_TYPE_LOC);
 }
 
+/**
+ * @brief Last value returned by #get_ticks64
+ *
+ * 64-bit loads and stores are single instructions on the VR4300, so they
+ * cannot be interrupted halfway. Reset by #timer_init, together with the
+ * hardware counter.
+ */
+volatile uint64_t __ticks64_last = 0;
+
+/**
+ * @brief Read the number of ticks since system startup, as a 64-bit monotonic clock
+ *
+ * The 32-bit hardware counter (see #TICKS_READ) is extended to 64 bits by
+ * comparing it with the previous reading: the clock does not wrap in practice
+ * (it would take thousands of years). Reading the clock costs a few
+ * instructions, and needs no locking: it can be called with interrupts
+ * disabled, and from interrupt handlers.
+ *
+ * The clock must be read at least once per wrap-around of the hardware
+ * counter (about 91 seconds), to notice it. When the timer module is
+ * initialized, it does so by itself; otherwise, reading the clock once per
+ * frame is more than enough.
+ *
+ * @note #timer_init resets the hardware counter, and this clock with it.
+ *
+ * @return The number of ticks since system startup (or since #timer_init)
+ */
+uint64_t get_ticks64(void)
+{
+    uint64_t last = __ticks64_last;
+    uint32_t now = TICKS_READ();
+    uint64_t ticks = (last & ~0xFFFFFFFFull) | now;
+    if (now < (uint32_t)last)
+        ticks += 1ull << 32;
+    // If an interrupt read the clock between the load and the store, this
+    // may store an older value than the interrupt did. That is harmless, as
+    // the value stored just needs to be in the past.
+    __ticks64_last = ticks;
+    return ticks;
+}
+
+/**
+ * @brief Convert a number of ticks to microseconds
+ *
+ * @param[in] ticks
+ *            Number of ticks (eg: a difference between two #get_ticks64 readings)
+ *
+ * @return The number of microseconds, rounded down
+ */
+uint64_t ticks_to_us(uint64_t ticks)
+{
+    // Split into seconds and remainder, so that the product cannot overflow
+    uint32_t tps = TICKS_PER_SECOND;
+    return ticks / tps * 1000000 + ticks % tps * 1000000 / tps;
+}
+
+/**
+ * @brief Convert a number of ticks to nanoseconds
+ *
+ * @param[in] ticks
+ *            Number of ticks (eg: a difference between two #get_ticks64 readings)
+ *
+ * @return The number of nanoseconds, rounded down
+ */
+uint64_t ticks_to_ns(uint64_t ticks)
+{
+    uint32_t tps = TICKS_PER_SECOND;
+    return ticks / tps * 1000000000 + ticks % tps * 1000000000 / tps;
+}
+
+/**
+ * @brief Convert a number of microseconds to ticks
+ *
+ * @param[in] us
+ *            Number of microseconds
+ *
+ * @return The number of ticks, rounded down
+ */
+uint64_t ticks_from_us(uint64_t us)
+{
+    uint32_t tps = TICKS_PER_SECOND;
+    return us / 1000000 * tps + us % 1000000 * tps / 1000000;
+}
+
 /**
  * @brief Spin wait until the number of ticks have elapsed
  *
+ * While waiting, the idle tasks are run with the remaining time as budget
+ * (see #idle_register).
+ *
  * @param[in] wait
  *            Number of ticks to wait
  *            Maximum accepted value is 0xFFFFFFFF ticks
@@ -336,7 +471,9 @@ tv_type_t get_tv_type()
 void wait_ticks( unsigned long wait )
 {
     unsigned int initial_tick = TICKS_READ();
-    while( TICKS_READ() - initial_tick < wait );
+    unsigned int elapsed;
+    while( (elapsed = TICKS_READ() - initial_tick) < wait )
+        idle_run( wait - elapsed );
 }
 
 /**
@@ -391,6 +528,84 @@ __attribute__((constructor)) void __init_cop1()
     C1_WRITE_FCR31(fcr31);
 }
 
+/** @brief Number of FPU exceptions resumed by #__cop1_fault */
+static volatile uint32_t cop1_trap_count;
+
+void cop1_set_flush_to_zero(bool enable)
+{
+    uint32_t fcr31 = C1_FCR31();
+    if (enable) fcr31 |= C1_FCR31_FS;
+    else        fcr31 &= ~C1_FCR31_FS;
+    C1_WRITE_FCR31(fcr31);
+}
+
+uint32_t cop1_get_trap_count(void)
+{
+    return cop1_trap_count;
+}
+
+/**
+ * @brief Flush a FPR to zero if it contains a denormalized number
+ *
+ * @param regs      Exception frame
+ * @param reg       Index of the register (singles are in the lower 32 bits)
+ * @param dbl       True if the register is read as a double
+ * @return True if the register was flushed
+ */
+static bool cop1_flush_denormal(reg_block_t *regs, int reg, bool dbl)
+{
+    uint64_t fpr = regs->fpr[reg];
+    if (dbl) {
+        if ((fpr & 0x7FF0000000000000ull) || !(fpr & 0x000FFFFFFFFFFFFFull))
+            return false;
+        fpr &= 0x8000000000000000ull;
+    } else {
+        if ((fpr & 0x7F800000) || !(fpr & 0x007FFFFF))
+            return false;
+        fpr &= ~0x7FFFFFFFull;
+    }
+    regs->fpr[reg] = fpr;
+    return true;
+}
+
+/**
+ * @brief Handle a FPU exception caused by a denormalized operand
+ *
+ * This is called by the exception handler (inthandler.S) for floating point
+ * exceptions. If the exception is an unimplemented operation caused by
+ * a denormalized operand and flush-to-zero is enabled, the operand is flushed
+ * to zero in the exception frame so that the instruction can run again.
+ *
+ * @param regs      Exception frame
+ * @return True if the exception was handled (execution can resume), false
+ *         if this is a real crash.
+ */
+bool __cop1_fault(reg_block_t *regs)
+{
+    if (!(regs->fc31 & C1_CAUSE_NOT_IMPLEMENTED) || !(regs->fc31 & C1_FCR31_FS))
+        return false;
+
+    uint32_t epc = regs->epc + (regs->cr & C0_CAUSE_BD ? 4 : 0);
+    uint32_t op = *(uint32_t*)epc;
+    uint32_t fmt = (op >> 21) & 0x1F, funct = op & 0x3F;
+
+    /* Only COP1 arithmetic instructions on singles (16) or doubles (17) */
+    if ((op >> 26) != 0x11 || (fmt != 16 && fmt != 17))
+        return false;
+
+    /* add/sub/mul/div and compares read ft as well */
+    bool binary = funct <= 3 || funct >= 48;
+    bool flushed = cop1_flush_denormal(regs, (op >> 11) & 0x1F, fmt == 17);
+    if (binary)
+        flushed |= cop1_flush_denormal(regs, (op >> 16) & 0x1F, fmt == 17);
+    if (!flushed)
+        return false;
+
+    regs->fc31 &= ~C1_CAUSE_MASK;
+    cop1_trap_count++;
+    return true;
+}
+
 /** @} */
 
 /* Inline instantiations */
@@ -0,0 +1,51 @@
+/**
+ * @file overlay.c
+ * @brief Code overlays
+ * @ingroup lowlevel
+ */
+#include "overlay.h"
+#include "n64sys.h"
+#include "dma.h"
+#include "debug.h"
+
+/** @brief Start of the RAM region where overlays are loaded (set by the linker) */
+extern char __overlay_start[];
+/** @brief End of the RAM region where overlays are loaded (set by the linker) */
+extern char __overlay_end[];
+
+/** @brief Load address of the overlay currently loaded (NULL if none) */
+static void *cur_overlay;
+
+/** @brief Convert a load address (as set by the linker) into a PI address */
+#define ROM_ADDR(lma)   (0x10001000 + ((char*)(lma) - __libdragon_text_start))
+
+__attribute__((noinline))
+void __overlay_load(const char *name, void *load_start, void *load_stop)
+{
+    if (cur_overlay == load_start)
+        return;
+
+    // The caller would be overwritten while running
+    void *caller = __builtin_return_address(0);
+    assertf(!((char*)caller >= __overlay_start && (char*)caller < __overlay_end),
+        "overlay_load(%s) called from code within an overlay", name);
+
+    int size = (char*)load_stop - (char*)load_start;
+    assertf(size <= __overlay_end - __overlay_start,
+        "overlay %s does not fit the overlay region", name);
+
+    // Discard any cacheline of the previous overlay, including dirty ones
+    // of its data: they must not be written back over the new overlay.
+    cur_overlay = NULL;
+    if (size > 0) {
+        data_cache_hit_invalidate(__overlay_start, (size + 15) & ~15);
+        dma_read(__overlay_start, ROM_ADDR(load_start), size);
+        inst_cache_hit_invalidate(__overlay_start, size);
+    }
+    cur_overlay = load_start;
+}
+
+bool __overlay_is_loaded(void *load_start)
+{
+    return cur_overlay == load_start;
+}
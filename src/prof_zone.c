@@ -0,0 +1,308 @@
+/**
+ * @file prof_zone.c
+ * @brief Timeline profiler
+ * @ingroup prof_zone
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "prof_zone.h"
+#include "n64sys.h"
+#include "interrupt.h"
+#include "usb.h"
+#include "debug.h"
+#include "utils.h"
+
+/**
+ * @defgroup prof_zone Timeline profiler
+ * @ingroup lowlevel
+ * @brief Instrumentation of the code with named zones, shown on a timeline.
+ *
+ * The timeline profiler records timestamped events: zones of code delimited
+ * by #prof_zone_begin and #prof_zone_end, and instant events recorded with
+ * #prof_zone_mark on the track of a processor (CPU, RSP or RDP). Some events
+ * are recorded automatically by libdragon: #display_show marks the frame
+ * boundaries, while RSP syncpoints and RDP SYNC_FULL mark their completion
+ * on their own tracks.
+ *
+ * @code{.c}
+ *      prof_zone_init(4096);
+ *      while (1) {
+ *          prof_zone_begin("physics");
+ *          update_physics();
+ *          prof_zone_end();
+ *
+ *          prof_zone_begin("render");
+ *          render();
+ *          prof_zone_end();
+ *
+ *          prof_zone_flush();
+ *      }
+ * @endcode
+ *
+ * Events are stored in a ring buffer, and sent to the PC via USB with
+ * #prof_zone_flush, that should be called once per frame. The n64trace tool
+ * converts the received messages into a JSON trace that can be opened with
+ * chrome://tracing or Perfetto:
+ *
+ * @code{.sh}
+ *      n64trace trace-*.bin > trace.json
+ * @endcode
+ *
+ * Events can be recorded from interrupt handlers too. Zones must be properly
+ * nested: this is automatically true for zones opened in interrupt
+ * handlers, but not for zones in different threads (see @ref kernel).
+ * When the profiler is not initialized, recording an event costs just a
+ * function call.
+ *
+ * Each message is self-contained, and is a sequence of big-endian 32-bit
+ * words:
+ *
+ *  * #PROF_ZONE_MAGIC
+ *  * #PROF_ZONE_VERSION
+ *  * Timer frequency in ticks per second
+ *  * Number of events
+ *  * Number of strings in the string table
+ *  * Number of events dropped since the previous message
+ *  * Events: for each one, the timestamp in ticks, and a word containing
+ *    the event type (bits 24-31), the track (bits 16-23) and the index of
+ *    the name in the string table (bits 0-15, 0xFFFF if there is no name).
+ *  * String table: for each string, its length in bytes, followed by the
+ *    characters padded to a multiple of 4 bytes.
+ * @{
+ */
+
+/** @brief Number of words in the header of each message */
+#define HEADER_WORDS        6
+/** @brief Maximum number of different names per message */
+#define MAX_NAMES           256
+/** @brief Maximum length of a name (longer names are truncated) */
+#define MAX_NAME_LEN        63
+/** @brief Index of a missing name in the string table */
+#define NO_NAME             0xFFFF
+
+/** @brief An event in the ring buffer */
+typedef struct {
+    uint32_t ticks;             ///< Timestamp (TICKS_READ)
+    const char *name;           ///< Name of the event (NULL if none)
+    uint8_t type;               ///< Type of the event (#prof_event_type_t)
+    uint8_t track;              ///< Track of the event (#prof_track_t)
+} prof_event_t;
+
+/** @brief Ring buffer of events */
+static prof_event_t *ring;
+/** @brief Capacity of the ring buffer (power of two) */
+static uint32_t ring_size;
+/** @brief Number of events ever written in the ring buffer */
+static volatile uint32_t ring_head;
+/** @brief Number of events ever read from the ring buffer */
+static volatile uint32_t ring_tail;
+/** @brief Buffer used to build the messages sent via USB */
+static uint32_t *msg_buf;
+/** @brief Nesting level of the zones on the CPU track */
+static int zone_depth;
+/** @brief Number of events recorded */
+static uint32_t num_events;
+/** @brief Number of events dropped since the last flush */
+static uint32_t num_dropped;
+/** @brief Total number of events dropped */
+static uint32_t num_dropped_total;
+
+/** @brief Record an event in the ring buffer */
+static void prof_zone_record(prof_event_type_t type, prof_track_t track, const char *name)
+{
+    if (!ring)
+        return;
+
+    /* Disabling interrupts is enough to make the write atomic with respect
+       to interrupt handlers recording their own events. The timestamp is
+       read here, so that events in the ring are always in time order. */
+    disable_interrupts();
+    uint32_t head = ring_head;
+    if (head - ring_tail >= ring_size) {
+        num_dropped++;
+        num_dropped_total++;
+    } else {
+        prof_event_t *ev = &ring[head & (ring_size - 1)];
+        ev->ticks = TICKS_READ();
+        ev->name = name;
+        ev->type = type;
+        ev->track = track;
+        MEMORY_BARRIER();
+        ring_head = head + 1;
+        num_events++;
+    }
+    enable_interrupts();
+}
+
+/**
+ * @brief Initialize the timeline profiler
+ *
+ * @param[in] capacity  Number of events that can be buffered between two
+ *                      calls to #prof_zone_flush (rounded up to a power
+ *                      of two). Events are dropped when the buffer is full.
+ */
+void prof_zone_init(int capacity)
+{
+    assertf(capacity > 0 && capacity <= 65536, "invalid capacity: %d", capacity);
+    prof_zone_close();
+
+    ring_size = 1;
+    while (ring_size < capacity)
+        ring_size <<= 1;
+
+    ring = malloc(ring_size * sizeof(prof_event_t));
+    msg_buf = malloc((HEADER_WORDS + ring_size * 2) * 4 + MAX_NAMES * (4 + MAX_NAME_LEN + 1));
+    assertf(ring && msg_buf, "out of memory allocating the profiler buffers");
+
+    ring_head = ring_tail = 0;
+    zone_depth = 0;
+    num_events = num_dropped = num_dropped_total = 0;
+}
+
+/**
+ * @brief Close the timeline profiler and free the buffers
+ *
+ * Events not yet sent with #prof_zone_flush are discarded.
+ */
+void prof_zone_close(void)
+{
+    disable_interrupts();
+    prof_event_t *old_ring = ring;
+    ring = NULL;
+    enable_interrupts();
+
+    free(old_ring);
+    free(msg_buf);
+    msg_buf = NULL;
+}
+
+/**
+ * @brief Begin a zone on the CPU track
+ *
+ * @param[in] name      Name of the zone. It must be a constant string, or
+ *                      anyway a string that is valid until the next
+ *                      #prof_zone_flush.
+ */
+void prof_zone_begin(const char *name)
+{
+    if (!ring)
+        return;
+    assertf(zone_depth < PROF_ZONE_MAX_DEPTH, "too many nested zones (opening %s)", name);
+    zone_depth++;
+    prof_zone_record(PROF_EVENT_BEGIN, PROF_TRACK_CPU, name);
+}
+
+/**
+ * @brief End the innermost zone on the CPU track
+ */
+void prof_zone_end(void)
+{
+    if (!ring)
+        return;
+    assertf(zone_depth > 0, "prof_zone_end called without a matching prof_zone_begin");
+    zone_depth--;
+    prof_zone_record(PROF_EVENT_END, PROF_TRACK_CPU, NULL);
+}
+
+/**
+ * @brief Record an instant event on a track
+ *
+ * @param[in] track     Track of the event
+ * @param[in] name      Name of the event (see #prof_zone_begin)
+ */
+void prof_zone_mark(prof_track_t track, const char *name)
+{
+    prof_zone_record(PROF_EVENT_MARK, track, name);
+}
+
+/**
+ * @brief Record the boundary between two frames
+ *
+ * This is called automatically by #display_show.
+ */
+void prof_zone_frame(void)
+{
+    prof_zone_record(PROF_EVENT_FRAME, PROF_TRACK_CPU, NULL);
+}
+
+/**
+ * @brief Send the events recorded so far via USB
+ *
+ * The events are sent as a single binary message (DATATYPE_RAWBINARY),
+ * that the USB loader saves to a file on the PC. Events can keep being
+ * recorded (also by interrupt handlers) while the message is being sent.
+ */
+void prof_zone_flush(void)
+{
+    if (!ring)
+        return;
+
+    /* Only this function advances the tail, so the events between the tail
+       and the current head cannot be overwritten while we read them. */
+    uint32_t tail = ring_tail;
+    uint32_t head = ring_head;
+    disable_interrupts();
+    uint32_t dropped = num_dropped;
+    num_dropped = 0;
+    enable_interrupts();
+
+    if (head == tail && !dropped)
+        return;
+
+    /* Convert the events, building the string table of the names used */
+    const char *names[MAX_NAMES];
+    uint16_t hash[MAX_NAMES * 2];
+    int num_names = 0;
+    memset(hash, 0xFF, sizeof(hash));
+
+    uint32_t *w = msg_buf + HEADER_WORDS;
+    for (uint32_t i = tail; i != head; i++) {
+        prof_event_t *ev = &ring[i & (ring_size - 1)];
+        uint32_t sidx = NO_NAME;
+        if (ev->name) {
+            uint32_t h = ((uint32_t)ev->name >> 2) & (MAX_NAMES * 2 - 1);
+            while (hash[h] != NO_NAME && names[hash[h]] != ev->name)
+                h = (h + 1) & (MAX_NAMES * 2 - 1);
+            if (hash[h] == NO_NAME && num_names < MAX_NAMES) {
+                names[num_names] = ev->name;
+                hash[h] = num_names++;
+            }
+            sidx = hash[h];
+        }
+        *w++ = ev->ticks;
+        *w++ = (ev->type << 24) | (ev->track << 16) | sidx;
+    }
+    ring_tail = head;
+
+    for (int i = 0; i < num_names; i++) {
+        int len = MIN((int)strlen(names[i]), MAX_NAME_LEN);
+        *w++ = len;
+        memset(w, 0, ROUND_UP(len, 4));
+        memcpy(w, names[i], len);
+        w += ROUND_UP(len, 4) / 4;
+    }
+
+    msg_buf[0] = PROF_ZONE_MAGIC;
+    msg_buf[1] = PROF_ZONE_VERSION;
+    msg_buf[2] = TICKS_PER_SECOND;
+    msg_buf[3] = head - tail;
+    msg_buf[4] = num_names;
+    msg_buf[5] = dropped;
+    usb_write(DATATYPE_RAWBINARY, msg_buf, (w - msg_buf) * 4);
+}
+
+/**
+ * @brief Get the statistics of the timeline profiler
+ *
+ * @param[out] stats    Structure that will be filled with the statistics
+ */
+void prof_zone_get_stats(prof_zone_stats_t *stats)
+{
+    disable_interrupts();
+    stats->events = num_events;
+    stats->dropped = num_dropped_total;
+    stats->buffered = ring_head - ring_tail;
+    enable_interrupts();
+}
+
+/** @} */
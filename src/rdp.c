@@ -4,14 +4,21 @@
  * @ingroup rdp
  */
 #include <stdint.h>
+#include <stdlib.h>
 #include <malloc.h>
 #include <string.h>
 #include "n64sys.h"
 #include "interrupt.h"
 #include "display.h"
 #include "rdp.h"
+#include "rdp_internal.h"
+#include "graphics.h"
+#include "rsp.h"
+#include "rspq.h"
 #include "sprite.h"
+#include "prof_zone.h"
 #include "debug.h"
+#include "utils.h"
 
 /**
  * @defgroup rdp Hardware Display Interface
@@ -39,35 +46,67 @@
  * additional software graphics manipulation can take place using functions from the
  * @ref graphics.
  *
- * Careful use of the #rdp_sync operation is required for proper rasterization.  Before
- * performing settings changes such as clipping changes or setting up texture or solid
- * fill modes, code should perform a #SYNC_PIPE.  A #SYNC_PIPE should be performed again
- * before any new texture load.  This is to ensure that the last texture operation is
- * completed before attempting to change texture memory.  Careful execution of texture
- * operations can allow code to skip some sync operations.  Be careful with excessive
- * sync operations as it can stall the pipeline and cause triangles/rectangles to be
- * drawn on the next display context instead of the current.
+ * The RDP needs sync operations between a primitive and a command that changes
+ * a resource the primitive might still be using: a #SYNC_PIPE before changing the
+ * render modes or colors, a #SYNC_LOAD before loading a texture into TMEM, and a
+ * #SYNC_TILE before changing a tile descriptor.  By default, this module tracks the
+ * resources used by the pending primitives and inserts the minimum required syncs
+ * automatically, so calling #rdp_sync is not necessary (and redundant calls are
+ * skipped).  Use #rdp_set_autosync to turn this off and issue the syncs by hand, or
+ * to check that the manual syncs are correct.  Be careful with excessive sync
+ * operations as they stall the pipeline.
+ *
+ * Commands are not sent to the RDP directly by the CPU, but go through the RSP
+ * queue (see rspq.h), via an overlay (rsp_rdp.S) that forwards them to the RDP.
+ * This means that all the functions return immediately, while rendering
+ * happens asynchronously, interleaved with the other RSP commands. It also means
+ * that RDP commands can be recorded into rspq blocks (see #rspq_block_begin)
+ * and played back later. Call #rspq_flush if the commands must be sent right away.
  *
  * #rdp_detach will automatically perform a #SYNC_FULL to ensure that everything
  * has been completed in the RDP.  This call generates an interrupt when complete which
  * signals the main thread that it is safe to detach.  Consequently, interrupts must be
  * enabled for proper operation.  This also means that code should under normal circumstances
- * never use #SYNC_FULL.
+ * never use #SYNC_FULL. To keep the CPU running while the RDP finishes, use
+ * #rdp_detach_async instead, which invokes a callback once the surface is ready.
  * @{
  */
 
-/** @brief Size of the internal ringbuffer that holds pending RDP commands */
-#define RINGBUFFER_SIZE  4096
+/**
+ * @brief ID of the RDP overlay in the RSP queue
+ *
+ * The overlay is registered with a static ID, so that the ID of each command
+ * matches the RDP command it sends (see rsp_rdp.S). IDs 0x2 and 0x3 are
+ * reserved by rspq for this.
+ */
+#define RDP_OVERLAY_ID      (0x2 << 28)
+
+/** @brief Command of the RDP overlay that sends a fill triangle (RDP command 0x08) */
+#define RDP_CMD_TRIANGLE    0x00
+/** @brief Command of the RDP overlay that sends a fill triangle, given its vertices */
+#define RDP_CMD_TRIANGLE_SETUP  0x01
 
-/** 
- * @brief Size of the slack are of the ring buffer
+/** @brief Size of each of the two RDRAM buffers the RSP writes the RDP commands into
  *
- * Data can be written into the slack area of the ring buffer by functions creating RDP commands.
- * However, when sending a completed command to the RDP, if the buffer has advanced into the slack,
- * it will be cleared and the pointer reset to start.  This is to stop any commands from being
- * split in the middle during wraparound.
+ * NOTE: keep in sync with rsp_rdp.S
  */
-#define RINGBUFFER_SLACK 1024
+#define RDP_BUFFER_SIZE     4096
+
+/** @brief RDP overlay ucode (rsp_rdp.S) */
+DEFINE_RSP_UCODE(rsp_rdp);
+
+/** @brief Saved state of the RDP overlay. This reflects the state defined in rsp_rdp.S */
+typedef struct
+{
+    /** @brief Physical addresses of the RDRAM buffers */
+    uint32_t buffers[2];
+    /** @brief Address where the next command will be written */
+    uint32_t cur;
+    /** @brief End of the current buffer */
+    uint32_t end;
+    /** @brief Byte offset of the current buffer within buffers (0 or 4) */
+    uint32_t buf_idx;
+} rdp_overlay_state_t;
 
 /**
  * @brief Cached sprite structure
@@ -86,24 +125,104 @@ typedef struct
     uint16_t real_width;
     /** @brief Height of the texture rounded up to next power of 2 */
     uint16_t real_height;
+    /** @brief Sprite currently resident in TMEM for this slot (NULL if none) */
+    sprite_t *sprite;
+    /** @brief Sub-rectangle of the resident sprite (sl, tl, sh, th) */
+    int16_t rect[4];
+    /** @brief Mirror setting the resident texture was loaded with */
+    mirror_t mirror;
+    /** @brief Offset of the resident texture in TMEM */
+    uint16_t tmem_addr;
+    /** @brief Size of the resident texture in TMEM, in bytes */
+    uint16_t tmem_size;
 } sprite_cache;
 
-/** @brief Ringbuffer where partially assembled commands will be placed before sending to the RDP */
-static uint32_t rdp_ringbuffer[RINGBUFFER_SIZE / 4];
-/** @brief Start of the command in the ringbuffer */
-static uint32_t rdp_start = 0;
-/** @brief End of the command in the ringbuffer */
-static uint32_t rdp_end = 0;
+/** @brief RDRAM buffers where the RSP writes the RDP commands (uncached) */
+static void *rdp_buffers[2];
+
+/** @brief Surface the RDP is attached to (to track the regions drawn on it) */
+static surface_t *attached_surface = NULL;
 
 /** @brief The current cache flushing strategy */
 static flush_t flush_strategy = FLUSH_STRATEGY_AUTOMATIC;
 
-/** @brief Interrupt wait flag */
-static volatile uint32_t wait_intr = 0;
+/** @brief Maximum number of detaches that can be pending at the same time */
+#define RDP_MAX_PENDING_DETACH   8
+
+/** @brief A pending detach, completed by the interrupt of its SYNC_FULL */
+typedef struct
+{
+    /** @brief Callback to invoke when the RDP is done (or NULL) */
+    void (*cb)(void *arg);
+    /** @brief Argument of the callback */
+    void *arg;
+} rdp_detach_t;
+
+/** @brief Ring of the pending detaches, in the order of their SYNC_FULL */
+static rdp_detach_t pending_detach[RDP_MAX_PENDING_DETACH];
+/** @brief Number of detaches requested so far */
+static volatile uint32_t detach_requested = 0;
+/** @brief Number of detaches completed so far by the RDP */
+static volatile uint32_t detach_completed = 0;
 
 /** @brief Array of cached textures in RDP TMEM indexed by the RDP texture slot */
 static sprite_cache cache[8];
 
+/** @brief Statistics of the TMEM residency cache */
+static rdp_texture_stats_t texture_stats;
+
+/** @brief Autosync resource: tile descriptor @p n (0-7) */
+#define AUTOSYNC_TILE(n)    (1 << (n))
+/** @brief Autosync resource: all the tile descriptors */
+#define AUTOSYNC_TILES      0xFF
+/** @brief Autosync resource: TMEM */
+#define AUTOSYNC_TMEM       0x100
+/** @brief Autosync resource: the render modes and colors */
+#define AUTOSYNC_PIPE       0x200
+/** @brief All the autosync resources */
+#define AUTOSYNC_ALL        (AUTOSYNC_TILES | AUTOSYNC_TMEM | AUTOSYNC_PIPE)
+
+/** @brief Current automatic sync mode */
+static rdp_autosync_t autosync_mode = RDP_AUTOSYNC_ON;
+
+/** @brief Resources that might be in use by the primitives sent since the last syncs */
+static uint32_t autosync_state = AUTOSYNC_ALL;
+
+/** @brief Value of #__rspq_epoch seen by the last command */
+static uint32_t autosync_epoch = 0;
+
+/** @brief Incremented by rspq whenever the commands stop being written in sequence */
+extern uint32_t __rspq_epoch;
+
+/** @brief Render state set by the public functions, restored after the accelerated drawing */
+static struct
+{
+    /** @brief Last other modes set (both words zero if never set) */
+    uint32_t modes[2];
+    /** @brief Last primitive (fill) color set */
+    uint32_t prim_color;
+    /** @brief Last blend color set */
+    uint32_t blend_color;
+} render_state;
+
+/** @brief Render modes used by the accelerated drawing of the graphics module */
+typedef enum
+{
+    /** @brief Not drawing: the render state is the one set by the public functions */
+    ACCEL_NONE,
+    /** @brief Fill mode, for rectangles */
+    ACCEL_FILL,
+    /** @brief Blend fill mode, for triangles */
+    ACCEL_BLEND
+} accel_mode_t;
+
+/** @brief Current mode of the accelerated drawing */
+static accel_mode_t accel_mode = ACCEL_NONE;
+/** @brief Color set for the current mode of the accelerated drawing */
+static uint32_t accel_color;
+/** @brief Render state changed by the accelerated drawing (bit 0: fill color, bit 1: blend color) */
+static uint32_t accel_dirty;
+
 /**
  * @brief RDP interrupt handler
  *
@@ -112,8 +231,15 @@ static sprite_cache cache[8];
  */
 static void __rdp_interrupt()
 {
-    /* Flag that the interrupt happened */
-    wait_intr++;
+    prof_zone_mark( PROF_TRACK_RDP, "sync_full" );
+
+    /* Ignore SYNC_FULL that were not sent by a detach */
+    if( detach_completed == detach_requested ) { return; }
+
+    /* Complete the oldest pending detach */
+    rdp_detach_t *d = &pending_detach[detach_completed % RDP_MAX_PENDING_DETACH];
+    detach_completed++;
+    if( d->cb ) { d->cb( d->arg ); }
 }
 
 /**
@@ -168,85 +294,156 @@ static inline uint32_t __rdp_log2( uint32_t number )
 }
 
 /**
- * @brief Return the size of the current command buffered in the ring buffer
+ * @brief Send a RDP command made of two words
  *
- * @return The size of the command in bytes
+ * @param[in] w0
+ *            First word of the command, including the RDP command ID
+ * @param[in] w1
+ *            Second word of the command
  */
-static inline uint32_t __rdp_ringbuffer_size( void )
+static inline void __rdp_write2( uint32_t w0, uint32_t w1 )
 {
-    /* Normal length */
-    return rdp_end - rdp_start;
+    rspq_write( RDP_OVERLAY_ID, ((w0 >> 24) & 0x3F) - 0x20, w0 & 0x00FFFFFF, w1 );
 }
 
 /**
- * @brief Queue 32 bits of a command to the ring buffer
+ * @brief Send a RDP command made of four words
  *
- * @param[in] data
- *            32 bits of data to be queued at the end of the current command
+ * @param[in] w0
+ *            First word of the command, including the RDP command ID
+ * @param[in] w1
+ *            Second word of the command
+ * @param[in] w2
+ *            Third word of the command
+ * @param[in] w3
+ *            Fourth word of the command
  */
-static void __rdp_ringbuffer_queue( uint32_t data )
+static inline void __rdp_write4( uint32_t w0, uint32_t w1, uint32_t w2, uint32_t w3 )
 {
-    /* Only add commands if we have room */
-    if( __rdp_ringbuffer_size() + sizeof(uint32_t) >= RINGBUFFER_SIZE ) { return; }
-
-    /* Add data to queue to be sent to RDP */
-    rdp_ringbuffer[rdp_end / 4] = data;
-    rdp_end += 4;
+    rspq_write( RDP_OVERLAY_ID, ((w0 >> 24) & 0x3F) - 0x20, w0 & 0x00FFFFFF, w1, w2, w3 );
 }
 
 /**
- * @brief Send a completed command to the RDP that is queued in the ring buffer
+ * @brief Refresh the autosync state, if the commands stopped being written in sequence
  *
- * Given a validly constructred command in the ring buffer, this command will prepare the
- * memory region in the ring buffer to be sent to the RDP and then start a DMA transfer,
- * kicking off execution of the command in the RDP.  After calling this function, it is
- * safe to start writing to the ring buffer again.
+ * Commands recorded into a block run after unknown commands, and running a
+ * block (or switching to highpri mode) sends commands that were not tracked,
+ * so the state is reset to the conservative assumption that everything is in use.
  */
-static void __rdp_ringbuffer_send( void )
+static inline void __rdp_autosync_refresh( void )
 {
-    /* Don't send nothingness */
-    if( __rdp_ringbuffer_size() == 0 ) { return; }
-
-    /* Ensure the cache is fixed up */
-    data_cache_hit_writeback_invalidate(&rdp_ringbuffer[rdp_start / 4], __rdp_ringbuffer_size());
-    
-    /* Best effort to be sure we can write once we disable interrupts */
-    while( (((volatile uint32_t *)0xA4100000)[3] & 0x600) ) ;
-
-    /* Make sure another thread doesn't attempt to render */
-    disable_interrupts();
-
-    /* Clear XBUS/Flush/Freeze */
-    ((uint32_t *)0xA4100000)[3] = 0x15;
-    MEMORY_BARRIER();
-
-    /* Don't saturate the RDP command buffer.  Another command could have been written
-     * since we checked before disabling interrupts, but it is unlikely, so we probably
-     * won't stall in this critical section long. */
-    while( (((volatile uint32_t *)0xA4100000)[3] & 0x600) ) ;
+    if( autosync_epoch != __rspq_epoch )
+    {
+        autosync_epoch = __rspq_epoch;
+        autosync_state = AUTOSYNC_ALL;
+    }
+}
 
-    /* Send start and end of buffer location to kick off the command transfer */
-    MEMORY_BARRIER();
-    ((volatile uint32_t *)0xA4100000)[0] = ((uint32_t)rdp_ringbuffer | 0xA0000000) + rdp_start;
-    MEMORY_BARRIER();
-    ((volatile uint32_t *)0xA4100000)[1] = ((uint32_t)rdp_ringbuffer | 0xA0000000) + rdp_end;
-    MEMORY_BARRIER();
+/**
+ * @brief Mark resources as in use by the primitive being sent
+ *
+ * @param[in] res
+ *            Resources used (AUTOSYNC_* flags)
+ */
+static inline void __rdp_autosync_use( uint32_t res )
+{
+    __rdp_autosync_refresh();
+    autosync_state |= res;
+}
 
-    /* We are good now */
-    enable_interrupts();
+/**
+ * @brief Send the syncs needed before changing the specified resources
+ *
+ * @param[in] res
+ *            Resources about to be changed (AUTOSYNC_* flags)
+ */
+static void __rdp_autosync_insert( uint32_t res )
+{
+    uint32_t pending = autosync_state & res;
 
-    /* Commands themselves can't wrap around */
-    if( rdp_end > (RINGBUFFER_SIZE - RINGBUFFER_SLACK) )
+    /* A sync waits for all the primitives that use its class of resources, so it
+     * frees the whole class. SYNC_PIPE waits for the pipeline to drain, which
+     * covers the tiles and TMEM too. */
+    if( pending & AUTOSYNC_PIPE )
     {
-        /* Wrap around before a command can be split */
-        rdp_start = 0;
-        rdp_end = 0;
+        __rdp_write2( 0xE7000000, 0x00000000 );
+        autosync_state = 0;
+        return;
     }
-    else
+    if( pending & AUTOSYNC_TMEM )
     {
-        /* Advance the start to not allow clobbering current command */
-        rdp_start = rdp_end;
+        __rdp_write2( 0xE6000000, 0x00000000 );
+        autosync_state &= ~AUTOSYNC_TMEM;
     }
+    if( pending & AUTOSYNC_TILES )
+    {
+        __rdp_write2( 0xE8000000, 0x00000000 );
+        autosync_state &= ~AUTOSYNC_TILES;
+    }
+}
+
+/**
+ * @brief Handle a command that changes resources, on behalf of the caller
+ *
+ * Depending on the mode, the required syncs are inserted, or checked to
+ * have been issued with #rdp_sync.
+ *
+ * @param[in] res
+ *            Resources about to be changed (AUTOSYNC_* flags)
+ */
+static void __rdp_autosync_change( uint32_t res )
+{
+    __rdp_autosync_refresh();
+    if( !(autosync_state & res) ) { return; }
+
+    switch( autosync_mode )
+    {
+        case RDP_AUTOSYNC_ON:
+            __rdp_autosync_insert( res );
+            break;
+        case RDP_AUTOSYNC_VERIFY:
+            assertf( 0, "missing RDP sync: %s",
+                (autosync_state & res & AUTOSYNC_PIPE) ? "SYNC_PIPE before changing the render modes" :
+                (autosync_state & res & AUTOSYNC_TMEM) ? "SYNC_LOAD before loading a texture" :
+                "SYNC_TILE before changing a tile" );
+            break;
+        case RDP_AUTOSYNC_OFF:
+            break;
+    }
+}
+
+/**
+ * @brief Handle a command that changes resources, within a compound function
+ *
+ * Functions that send multiple primitives (eg: #rdp_draw_surface) must sync
+ * between them by themselves, also in #RDP_AUTOSYNC_VERIFY mode.
+ *
+ * @param[in] res
+ *            Resources about to be changed (AUTOSYNC_* flags)
+ *
+ * @return False in #RDP_AUTOSYNC_OFF mode, where the caller must send its
+ *         own syncs, as it did before autosync.
+ */
+static bool __rdp_autosync_internal( uint32_t res )
+{
+    __rdp_autosync_refresh();
+    if( autosync_mode == RDP_AUTOSYNC_OFF ) { return false; }
+    __rdp_autosync_insert( res );
+    return true;
+}
+
+/**
+ * @brief Send a set other modes command
+ *
+ * @param[in] w0
+ *            First word of the command
+ * @param[in] w1
+ *            Second word of the command
+ */
+static void __rdp_set_other_modes( uint32_t w0, uint32_t w1 )
+{
+    __rdp_autosync_change( AUTOSYNC_PIPE );
+    __rdp_write2( w0, w1 );
 }
 
 /**
@@ -257,9 +454,34 @@ void rdp_init( void )
     /* Default to flushing automatically */
     flush_strategy = FLUSH_STRATEGY_AUTOMATIC;
 
-    /* Set the ringbuffer up */
-    rdp_start = 0;
-    rdp_end = 0;
+    /* The state of the RDP is unknown */
+    autosync_state = AUTOSYNC_ALL;
+
+    /* Nothing is resident in TMEM yet */
+    rdp_invalidate_texture_cache();
+    rdp_reset_texture_stats();
+
+    /* Allocate the buffers where the RSP will write the commands */
+    rdp_buffers[0] = malloc_uncached( RDP_BUFFER_SIZE );
+    rdp_buffers[1] = malloc_uncached( RDP_BUFFER_SIZE );
+    assertf( rdp_buffers[0] && rdp_buffers[1], "rdp_init: out of memory" );
+
+    /* Start with the second buffer marked as full, so that the first command
+     * switches to the first one, writing DP_START */
+    rdp_overlay_state_t *state = rspq_overlay_get_state( &rsp_rdp );
+    state->buffers[0] = PhysicalAddr( rdp_buffers[0] );
+    state->buffers[1] = PhysicalAddr( rdp_buffers[1] );
+    state->cur = 0;
+    state->end = 0;
+    state->buf_idx = 4;
+    data_cache_hit_writeback_invalidate( state, sizeof(rdp_overlay_state_t) );
+
+    /* Make sure the RDP reads commands from RDRAM: clear XBUS/Flush/Freeze */
+    ((volatile uint32_t *)0xA4100000)[3] = 0x15;
+    MEMORY_BARRIER();
+
+    rspq_init();
+    rspq_overlay_register_static( &rsp_rdp, RDP_OVERLAY_ID );
 
     /* Set up interrupt for SYNC_FULL */
     register_DP_handler( __rdp_interrupt );
@@ -274,10 +496,29 @@ void rdp_init( void )
  */
 void rdp_close( void )
 {
+    /* Wait for the RSP to be done with the RDP buffers */
+    rspq_wait();
+    rspq_overlay_unregister( RDP_OVERLAY_ID );
+    free_uncached( rdp_buffers[0] );
+    free_uncached( rdp_buffers[1] );
+
     set_DP_interrupt( 0 );
     unregister_DP_handler( __rdp_interrupt );
 }
 
+/** @brief Pack a vertex in the format of #RDP_CMD_TRIANGLE_SETUP (X and Y in signed 13.2) */
+static inline uint32_t __rdp_vertex( float x, float y )
+{
+    return ( (int)( x * 4.0f ) << 16 ) | ( (int)( y * 4.0f ) & 0xFFFF );
+}
+
+/** @brief Set the RDP color image to the specified surface */
+static void __rdp_set_color_image( surface_t *surface )
+{
+    __rdp_write2( 0xFF000000 | ((TEX_FORMAT_BITDEPTH(surface_get_format(surface)) == 16) ? 0x00100000 : 0x00180000) | (surface->width - 1),
+                  PhysicalAddr(surface->buffer) );
+}
+
 /**
  * @brief Attach the RDP to a surface
  *
@@ -298,11 +539,51 @@ void rdp_close( void )
 void rdp_attach( surface_t* surface )
 {
     if( surface == 0 ) { return; }
+    attached_surface = surface;
 
     /* Set the rasterization buffer */
-    __rdp_ringbuffer_queue( 0xFF000000 | ((TEX_FORMAT_BITDEPTH(surface_get_format(surface)) == 16) ? 0x00100000 : 0x00180000) | (surface->width - 1) );
-    __rdp_ringbuffer_queue( PhysicalAddr(surface->buffer) );
-    __rdp_ringbuffer_send();
+    __rdp_autosync_change( AUTOSYNC_PIPE );
+    __rdp_set_color_image( surface );
+}
+
+/**
+ * @brief Detach the RDP from the current surface, without waiting for the
+ *        RDP to finish writing to it.
+ *
+ * @note This function requires interrupts to be enabled to operate properly.
+ *
+ * This function queues a #SYNC_FULL and returns immediately. The callback
+ * is invoked (from the interrupt handler) when all the RDP rendering operations
+ * queued before have completed, and the surface can be used by the CPU or shown
+ * with #display_show. Up to 8 detaches can be pending at the same time; if there
+ * are more, this function waits for the oldest one to complete.
+ *
+ * @param[in] cb
+ *            Callback to invoke when the RDP is done with the surface (or NULL)
+ * @param[in] arg
+ *            Argument passed to the callback
+ */
+void rdp_detach_async( void (*cb)(void *arg), void *arg )
+{
+    attached_surface = NULL;
+
+    /* If too many detaches are pending, wait for the RDP to catch up */
+    if( detach_requested - detach_completed >= RDP_MAX_PENDING_DETACH )
+    {
+        assertf( INTERRUPTS_ENABLED == get_interrupts_state(),
+            "rdp_detach_async: too many pending detaches with interrupts disabled" );
+        rspq_flush();
+        while( detach_requested - detach_completed >= RDP_MAX_PENDING_DETACH ) { ; }
+    }
+
+    rdp_detach_t *d = &pending_detach[detach_requested % RDP_MAX_PENDING_DETACH];
+    d->cb = cb;
+    d->arg = arg;
+    detach_requested++;
+
+    /* Force the RDP to rasterize everything and then interrupt us */
+    rdp_sync( SYNC_FULL );
+    rspq_flush();
 }
 
 /**
@@ -316,20 +597,14 @@ void rdp_attach( surface_t* surface )
  */
 void rdp_detach( void )
 {
-    /* Wait for SYNC_FULL to finish */
-    wait_intr = 0;
-
-    /* Force the RDP to rasterize everything and then interrupt us */
-    rdp_sync( SYNC_FULL );
+    rdp_detach_async( NULL, NULL );
 
     if( INTERRUPTS_ENABLED == get_interrupts_state() )
     {
         /* Only wait if interrupts are enabled */
-        while( !wait_intr ) { ; }
+        uint32_t target = detach_requested;
+        while( (int32_t)(detach_completed - target) < 0 ) { ; }
     }
-
-    /* Set back to zero for next detach */
-    wait_intr = 0;
 }
 
 /**
@@ -342,28 +617,60 @@ void rdp_detach( void )
  * a sync operation if the data you need is not yet available in the
  * pipeline.
  *
+ * With autosync on (the default), the syncs are inserted automatically,
+ * and this function skips the sync if no primitive sent since the last one
+ * can be using the resources that it protects. #SYNC_FULL is always sent.
+ *
  * @param[in] sync
  *            The sync operation to perform on the RDP
  */
 void rdp_sync( sync_t sync )
 {
-    switch( sync )
-    {
-        case SYNC_FULL:
-            __rdp_ringbuffer_queue( 0xE9000000 );
-            break;
-        case SYNC_PIPE:
-            __rdp_ringbuffer_queue( 0xE7000000 );
-            break;
-        case SYNC_TILE:
-            __rdp_ringbuffer_queue( 0xE8000000 );
-            break;
-        case SYNC_LOAD:
-            __rdp_ringbuffer_queue( 0xE6000000 );
-            break;
-    }
-    __rdp_ringbuffer_queue( 0x00000000 );
-    __rdp_ringbuffer_send();
+    static const uint32_t res[] = {
+        [SYNC_FULL] = AUTOSYNC_ALL,
+        [SYNC_PIPE] = AUTOSYNC_ALL,
+        [SYNC_TILE] = AUTOSYNC_TILES,
+        [SYNC_LOAD] = AUTOSYNC_TMEM,
+    };
+    static const uint32_t cmd[] = {
+        [SYNC_FULL] = 0xE9000000,
+        [SYNC_PIPE] = 0xE7000000,
+        [SYNC_TILE] = 0xE8000000,
+        [SYNC_LOAD] = 0xE6000000,
+    };
+
+    __rdp_autosync_refresh();
+    if( sync != SYNC_FULL && autosync_mode == RDP_AUTOSYNC_ON && !(autosync_state & res[sync]) ) { return; }
+
+    __rdp_write2( cmd[sync], 0x00000000 );
+    autosync_state &= ~res[sync];
+}
+
+/**
+ * @brief Set the automatic sync mode
+ *
+ * By default (#RDP_AUTOSYNC_ON), the module keeps track of the resources used by
+ * the primitives sent to the RDP (render modes, tile descriptors and TMEM), and
+ * sends the minimum syncs required before the commands that change them.
+ * Calls to #rdp_sync that are not required are skipped.
+ *
+ * With #RDP_AUTOSYNC_OFF, only the syncs requested with #rdp_sync are sent, as
+ * in older versions of this module. #RDP_AUTOSYNC_VERIFY sends the same syncs,
+ * but asserts when one is missing; it can be used to check the manual syncs
+ * of existing code before turning autosync on.
+ *
+ * The tracking happens on the CPU, as the commands are written. After a block
+ * is recorded or run (see #rspq_block_run), or after a highpri section, the
+ * state of the RDP is unknown, so all resources are assumed to be in use, and
+ * the first commands of a block always sync. Commands sent to the RDP by other
+ * means than this module are not tracked.
+ *
+ * @param[in] mode
+ *            The new mode
+ */
+void rdp_set_autosync( rdp_autosync_t mode )
+{
+    autosync_mode = mode;
 }
 
 /**
@@ -380,10 +687,10 @@ void rdp_sync( sync_t sync )
  */
 void rdp_set_clipping( uint32_t tx, uint32_t ty, uint32_t bx, uint32_t by )
 {
+    /* The scissor does not affect primitives already in the pipeline, so it needs no sync */
     /* Convert pixel space to screen space in command */
-    __rdp_ringbuffer_queue( 0xED000000 | (tx << 14) | (ty << 2) );
-    __rdp_ringbuffer_queue( (bx << 14) | (by << 2) );
-    __rdp_ringbuffer_send();
+    __rdp_write2( 0xED000000 | (tx << 14) | (ty << 2),
+                  (bx << 14) | (by << 2) );
 }
 
 /**
@@ -403,9 +710,9 @@ void rdp_set_default_clipping( void )
 void rdp_enable_primitive_fill( void )
 {
     /* Set other modes to fill and other defaults */
-    __rdp_ringbuffer_queue( 0xEFB000FF );
-    __rdp_ringbuffer_queue( 0x00004000 );
-    __rdp_ringbuffer_send();
+    render_state.modes[0] = 0xEFB000FF;
+    render_state.modes[1] = 0x00004000;
+    __rdp_set_other_modes( render_state.modes[0], render_state.modes[1] );
 }
 
 /**
@@ -415,9 +722,9 @@ void rdp_enable_primitive_fill( void )
  */
 void rdp_enable_blend_fill( void )
 {
-    __rdp_ringbuffer_queue( 0xEF0000FF );
-    __rdp_ringbuffer_queue( 0x80000000 );
-    __rdp_ringbuffer_send();
+    render_state.modes[0] = 0xEF0000FF;
+    render_state.modes[1] = 0x80000000;
+    __rdp_set_other_modes( render_state.modes[0], render_state.modes[1] );
 }
 
 /**
@@ -429,9 +736,9 @@ void rdp_enable_blend_fill( void )
 void rdp_enable_texture_copy( void )
 {
     /* Set other modes to copy and other defaults */
-    __rdp_ringbuffer_queue( 0xEFA000FF );
-    __rdp_ringbuffer_queue( 0x00004001 );
-    __rdp_ringbuffer_send();
+    render_state.modes[0] = 0xEFA000FF;
+    render_state.modes[1] = 0x00004001;
+    __rdp_set_other_modes( render_state.modes[0], render_state.modes[1] );
 }
 
 /**
@@ -466,17 +773,6 @@ static uint32_t __rdp_load_texture( uint32_t texslot, uint32_t texloc, mirror_t
     assertf( bitdepth == 2 || bitdepth == 4, "unsupported bitdepth (%d) for sprite", bitdepth );
     bitdepth /= 8;
 
-    /* Invalidate data associated with sprite in cache */
-    if( flush_strategy == FLUSH_STRATEGY_AUTOMATIC )
-    {
-        data_cache_hit_writeback_invalidate( sprite->data, sprite->width * sprite->height * bitdepth );
-    }
-
-    /* Point the RDP at the actual sprite data */
-    __rdp_ringbuffer_queue( 0xFD000000 | ((bitdepth == 2) ? 0x00100000 : 0x00180000) | (sprite->width - 1) );
-    __rdp_ringbuffer_queue( (uint32_t)sprite->data );
-    __rdp_ringbuffer_send();
-
     /* Figure out the s,t coordinates of the sprite we are copying out of */
     int twidth = sh - sl + 1;
     int theight = th - tl + 1;
@@ -489,28 +785,104 @@ static uint32_t __rdp_load_texture( uint32_t texslot, uint32_t texloc, mirror_t
 
     /* Because we are dividing by 8, we want to round up if we have a remainder */
     int round_amount = (real_width % 8) ? 1 : 0;
+    uint32_t tmem_size = ((real_width / 8) + round_amount) * 8 * real_height * bitdepth;
+
+    sprite_cache *c = &cache[texslot & 0x7];
+
+    /* Save sprite width and height for managed sprite commands */
+    c->width = twidth - 1;
+    c->height = theight - 1;
+    c->s = sl;
+    c->t = tl;
+    c->real_width = real_width;
+    c->real_height = real_height;
+
+    /* Skip the load if this same texture is still resident in TMEM. The format
+     * is part of the sprite, which is compared by pointer. */
+    if( c->sprite == sprite && c->tmem_addr == texloc && c->mirror == mirror_enabled &&
+        c->rect[0] == sl && c->rect[1] == tl && c->rect[2] == sh && c->rect[3] == th )
+    {
+        texture_stats.hits++;
+        return tmem_size;
+    }
+    texture_stats.misses++;
+
+    /* The load overwrites the TMEM area of any other texture it overlaps */
+    for( int i = 0; i < 8; i++ )
+    {
+        if( cache[i].sprite && texloc < cache[i].tmem_addr + cache[i].tmem_size &&
+            cache[i].tmem_addr < texloc + tmem_size )
+        {
+            cache[i].sprite = NULL;
+        }
+    }
+
+    c->sprite = sprite;
+    c->rect[0] = sl;
+    c->rect[1] = tl;
+    c->rect[2] = sh;
+    c->rect[3] = th;
+    c->mirror = mirror_enabled;
+    c->tmem_addr = texloc;
+    c->tmem_size = tmem_size;
+
+    /* Invalidate data associated with sprite in cache */
+    if( flush_strategy == FLUSH_STRATEGY_AUTOMATIC )
+    {
+        data_cache_hit_writeback_invalidate( sprite->data, sprite->width * sprite->height * bitdepth );
+    }
+
+    /* Point the RDP at the actual sprite data */
+    __rdp_write2( 0xFD000000 | ((bitdepth == 2) ? 0x00100000 : 0x00180000) | (sprite->width - 1),
+                  (uint32_t)sprite->data );
 
     /* Instruct the RDP to copy the sprite data out */
-    __rdp_ringbuffer_queue( 0xF5000000 | ((bitdepth == 2) ? 0x00100000 : 0x00180000) | 
-                                       (((((real_width / 8) + round_amount) * bitdepth) & 0x1FF) << 9) | ((texloc / 8) & 0x1FF) );
-    __rdp_ringbuffer_queue( ((texslot & 0x7) << 24) | (mirror_enabled != MIRROR_DISABLED ? 0x40100 : 0) | (hbits << 14 ) | (wbits << 4) );
-    __rdp_ringbuffer_send();
+    __rdp_autosync_change( AUTOSYNC_TILE(texslot & 0x7) );
+    __rdp_write2( 0xF5000000 | ((bitdepth == 2) ? 0x00100000 : 0x00180000) | 
+                  (((((real_width / 8) + round_amount) * bitdepth) & 0x1FF) << 9) | ((texloc / 8) & 0x1FF),
+                  ((texslot & 0x7) << 24) | (mirror_enabled != MIRROR_DISABLED ? 0x40100 : 0) | (hbits << 14 ) | (wbits << 4) );
 
     /* Copying out only a chunk this time */
-    __rdp_ringbuffer_queue( 0xF4000000 | (((sl << 2) & 0xFFF) << 12) | ((tl << 2) & 0xFFF) );
-    __rdp_ringbuffer_queue( (((sh << 2) & 0xFFF) << 12) | ((th << 2) & 0xFFF) );
-    __rdp_ringbuffer_send();
+    __rdp_autosync_change( AUTOSYNC_TMEM );
+    __rdp_write2( 0xF4000000 | (((sl << 2) & 0xFFF) << 12) | ((tl << 2) & 0xFFF),
+                  (((sh << 2) & 0xFFF) << 12) | ((th << 2) & 0xFFF) );
+    __rdp_autosync_use( AUTOSYNC_TILE(texslot & 0x7) );
 
-    /* Save sprite width and height for managed sprite commands */
-    cache[texslot & 0x7].width = twidth - 1;
-    cache[texslot & 0x7].height = theight - 1;
-    cache[texslot & 0x7].s = sl;
-    cache[texslot & 0x7].t = tl;
-    cache[texslot & 0x7].real_width = real_width;
-    cache[texslot & 0x7].real_height = real_height;
-    
     /* Return the amount of texture memory consumed by this texture */
-    return ((real_width / 8) + round_amount) * 8 * real_height * bitdepth;
+    return tmem_size;
+}
+
+/**
+ * @brief Forget the textures resident in RDP TMEM
+ *
+ * Loads are skipped when the same sub-rectangle of the same sprite is already
+ * resident in the requested texture slot and TMEM offset. Call this function
+ * after modifying the pixels of a sprite that might be resident, or after
+ * changing TMEM contents without going through #rdp_load_texture.
+ */
+void rdp_invalidate_texture_cache( void )
+{
+    for( int i = 0; i < 8; i++ ) { cache[i].sprite = NULL; }
+}
+
+/**
+ * @brief Get the statistics of the TMEM residency cache
+ *
+ * @param[out] stats
+ *            Filled with the number of loads skipped and performed since the
+ *            last call to #rdp_reset_texture_stats
+ */
+void rdp_get_texture_stats( rdp_texture_stats_t *stats )
+{
+    *stats = texture_stats;
+}
+
+/**
+ * @brief Reset the statistics of the TMEM residency cache
+ */
+void rdp_reset_texture_stats( void )
+{
+    memset( &texture_stats, 0, sizeof(texture_stats) );
 }
 
 /**
@@ -580,15 +952,10 @@ uint32_t rdp_load_texture_stride( uint32_t texslot, uint32_t texloc, mirror_t mi
 }
 
 /**
- * @brief Draw a textured rectangle with a scaled texture
+ * @brief Draw a textured rectangle with a scaled texture, in fixed point
  *
- * Given an already loaded texture, this function will draw a rectangle textured with the loaded texture
- * at a scale other than 1.  This allows rectangles to be drawn with stretched or squashed textures.
- * If the rectangle is larger than the texture after scaling, it will be tiled or mirrored based on the
- * mirror setting given in the load texture command.
- *
- * Before using this command to draw a textured rectangle, use #rdp_enable_texture_copy to set the RDP
- * up in texture mode.
+ * This is the same as #rdp_draw_textured_rectangle_scaled, with the scaling
+ * factors in 16.16 fixed point, so that no floating point math is needed.
  *
  * @param[in] texslot
  *            The texture slot that the texture was previously loaded into (0-7)
@@ -601,31 +968,31 @@ uint32_t rdp_load_texture_stride( uint32_t texslot, uint32_t texloc, mirror_t mi
  * @param[in] by
  *            The pixel Y location of the bottom right of the rectangle
  * @param[in] x_scale
- *            Horizontal scaling factor
+ *            Horizontal scaling factor (must be positive)
  * @param[in] y_scale
- *            Vertical scaling factor
+ *            Vertical scaling factor (must be positive)
  * @param[in] mirror
  *            Whether the texture should be mirrored
  */
-void rdp_draw_textured_rectangle_scaled( uint32_t texslot, int tx, int ty, int bx, int by, double x_scale, double y_scale,  mirror_t mirror)
+void rdp_draw_textured_rectangle_scaled_fx( uint32_t texslot, int tx, int ty, int bx, int by, fx16_t x_scale, fx16_t y_scale, mirror_t mirror )
 {
     uint16_t s = cache[texslot & 0x7].s << 5;
     uint16_t t = cache[texslot & 0x7].t << 5;
     uint32_t width = cache[texslot & 0x7].width;
     uint32_t height = cache[texslot & 0x7].height;
-   
+
     /* Cant display < 0, so must clip size and move S,T coord accordingly */
     if( tx < 0 )
     {
-        if ( tx < -(width * x_scale) ) { return; }
-        s += (int)(((double)((-tx) << 5)) * (1.0 / x_scale));
+        if ( (int64_t)(-tx) << FX16_FRAC > (int64_t)width * x_scale ) { return; }
+        s += (int)(((int64_t)(-tx) << (5 + FX16_FRAC)) / x_scale);
         tx = 0;
     }
 
     if( ty < 0 )
     {
-        if ( ty < -(height * y_scale) ) { return; }
-        t += (int)(((double)((-ty) << 5)) * (1.0 / y_scale));
+        if ( (int64_t)(-ty) << FX16_FRAC > (int64_t)height * y_scale ) { return; }
+        t += (int)(((int64_t)(-ty) << (5 + FX16_FRAC)) / y_scale);
         ty = 0;
     }
 
@@ -640,19 +1007,51 @@ void rdp_draw_textured_rectangle_scaled( uint32_t texslot, int tx, int ty, int b
     }	
 
     /* Calculate the scaling constants based on a 6.10 fixed point system */
-    int xs = (int)((1.0 / x_scale) * 4096.0);
-    int ys = (int)((1.0 / y_scale) * 1024.0);
-
-    /* Set up rectangle position in screen space */
-    __rdp_ringbuffer_queue( 0xE4000000 | (bx << 14) | (by << 2) );
-    __rdp_ringbuffer_queue( ((texslot & 0x7) << 24) | (tx << 14) | (ty << 2) );
-
-    /* Set up texture position and scaling to 1:1 copy */
-    __rdp_ringbuffer_queue( (s << 16) | t );
-    __rdp_ringbuffer_queue( (xs & 0xFFFF) << 16 | (ys & 0xFFFF) );
+    int xs = (int)(((int64_t)4096 << FX16_FRAC) / x_scale);
+    int ys = (int)(((int64_t)1024 << FX16_FRAC) / y_scale);
+
+    /* Set up rectangle position in screen space, and texture position
+     * and scaling to 1:1 copy */
+    __rdp_write4( 0xE4000000 | (bx << 14) | (by << 2),
+                  ((texslot & 0x7) << 24) | (tx << 14) | (ty << 2),
+                  (s << 16) | t,
+                  (xs & 0xFFFF) << 16 | (ys & 0xFFFF) );
+    __rdp_autosync_use( AUTOSYNC_PIPE | AUTOSYNC_TMEM | AUTOSYNC_TILE(texslot & 0x7) );
+
+    if( attached_surface ) { display_mark_dirty( attached_surface, tx, ty, bx - tx + 1, by - ty + 1 ); }
+}
 
-    /* Send command */
-    __rdp_ringbuffer_send();
+/**
+ * @brief Draw a textured rectangle with a scaled texture
+ *
+ * Given an already loaded texture, this function will draw a rectangle textured with the loaded texture
+ * at a scale other than 1.  This allows rectangles to be drawn with stretched or squashed textures.
+ * If the rectangle is larger than the texture after scaling, it will be tiled or mirrored based on the
+ * mirror setting given in the load texture command.
+ *
+ * Before using this command to draw a textured rectangle, use #rdp_enable_texture_copy to set the RDP
+ * up in texture mode.
+ *
+ * @param[in] texslot
+ *            The texture slot that the texture was previously loaded into (0-7)
+ * @param[in] tx
+ *            The pixel X location of the top left of the rectangle
+ * @param[in] ty
+ *            The pixel Y location of the top left of the rectangle
+ * @param[in] bx
+ *            The pixel X location of the bottom right of the rectangle
+ * @param[in] by
+ *            The pixel Y location of the bottom right of the rectangle
+ * @param[in] x_scale
+ *            Horizontal scaling factor
+ * @param[in] y_scale
+ *            Vertical scaling factor
+ * @param[in] mirror
+ *            Whether the texture should be mirrored
+ */
+void rdp_draw_textured_rectangle_scaled( uint32_t texslot, int tx, int ty, int bx, int by, double x_scale, double y_scale,  mirror_t mirror)
+{
+    rdp_draw_textured_rectangle_scaled_fx( texslot, tx, ty, bx, by, FX16(x_scale), FX16(y_scale), mirror );
 }
 
 /**
@@ -681,7 +1080,7 @@ void rdp_draw_textured_rectangle_scaled( uint32_t texslot, int tx, int ty, int b
 void rdp_draw_textured_rectangle( uint32_t texslot, int tx, int ty, int bx, int by, mirror_t mirror )
 {
     /* Simple wrapper */
-    rdp_draw_textured_rectangle_scaled( texslot, tx, ty, bx, by, 1.0, 1.0, mirror );
+    rdp_draw_textured_rectangle_scaled_fx( texslot, tx, ty, bx, by, FX16_ONE, FX16_ONE, mirror );
 }
 
 /**
@@ -704,7 +1103,7 @@ void rdp_draw_textured_rectangle( uint32_t texslot, int tx, int ty, int bx, int
 void rdp_draw_sprite( uint32_t texslot, int x, int y, mirror_t mirror )
 {
     /* Just draw a rectangle the size of the sprite */
-    rdp_draw_textured_rectangle_scaled( texslot, x, y, x + cache[texslot & 0x7].width, y + cache[texslot & 0x7].height, 1.0, 1.0, mirror );
+    rdp_draw_textured_rectangle_scaled_fx( texslot, x, y, x + cache[texslot & 0x7].width, y + cache[texslot & 0x7].height, FX16_ONE, FX16_ONE, mirror );
 }
 
 /**
@@ -729,13 +1128,212 @@ void rdp_draw_sprite( uint32_t texslot, int x, int y, mirror_t mirror )
  *            Whether the texture should be mirrored
  */
 void rdp_draw_sprite_scaled( uint32_t texslot, int x, int y, double x_scale, double y_scale, mirror_t mirror )
+{
+    rdp_draw_sprite_scaled_fx( texslot, x, y, FX16(x_scale), FX16(y_scale), mirror );
+}
+
+/**
+ * @brief Draw a texture to the screen as a scaled sprite, in fixed point
+ *
+ * This is the same as #rdp_draw_sprite_scaled, with the scaling factors in
+ * 16.16 fixed point, so that no floating point math is needed.
+ *
+ * @param[in] texslot
+ *            The texture slot that the texture was previously loaded into (0-7)
+ * @param[in] x
+ *            The pixel X location of the top left of the sprite
+ * @param[in] y
+ *            The pixel Y location of the top left of the sprite
+ * @param[in] x_scale
+ *            Horizontal scaling factor (must be positive)
+ * @param[in] y_scale
+ *            Vertical scaling factor (must be positive)
+ * @param[in] mirror
+ *            Whether the texture should be mirrored
+ */
+void rdp_draw_sprite_scaled_fx( uint32_t texslot, int x, int y, fx16_t x_scale, fx16_t y_scale, mirror_t mirror )
 {
     /* Since we want to still view the whole sprite, we must resize the rectangle area too */
-    int new_width = (int)(((double)cache[texslot & 0x7].width * x_scale) + 0.5);
-    int new_height = (int)(((double)cache[texslot & 0x7].height * y_scale) + 0.5);
-    
+    int new_width = (int)(((int64_t)cache[texslot & 0x7].width * x_scale + (FX16_ONE >> 1)) >> FX16_FRAC);
+    int new_height = (int)(((int64_t)cache[texslot & 0x7].height * y_scale + (FX16_ONE >> 1)) >> FX16_FRAC);
+
     /* Draw a rectangle the size of the new sprite */
-    rdp_draw_textured_rectangle_scaled( texslot, x, y, x + new_width, y + new_height, x_scale, y_scale, mirror );
+    rdp_draw_textured_rectangle_scaled_fx( texslot, x, y, x + new_width, y + new_height, x_scale, y_scale, mirror );
+}
+
+/**
+ * @brief Draw a surface to the screen, in copy mode
+ *
+ * The surface is loaded into TMEM in chunks, each drawn with a textured
+ * rectangle, so there is no limit on its size. TMEM slot 0 is used, and
+ * the texture cache is invalidated.
+ *
+ * Before using this command, use #rdp_enable_texture_copy to set the RDP
+ * up in copy mode. The surface must be 16-bit, and in the same format of
+ * the attached surface, as copy mode does not convert pixels.
+ *
+ * @param[in] x
+ *            The pixel X location of the top left of the surface
+ * @param[in] y
+ *            The pixel Y location of the top left of the surface
+ * @param[in] src
+ *            The surface to draw
+ */
+void rdp_draw_surface( int x, int y, surface_t *src )
+{
+    rdp_draw_surface_region( x, y, src, 0, 0, src->width, src->height );
+}
+
+/**
+ * @brief Draw a rectangular region of a surface to the screen, in copy mode
+ *
+ * This is the same as #rdp_draw_surface, but only the region of @p src
+ * starting at (@p sx, @p sy) and of the specified size is drawn. The region
+ * can start at any pixel: unlike a sub-surface (#surface_make_sub), it does
+ * not need to be aligned.
+ *
+ * @param[in] x
+ *            The pixel X location of the top left of the region on the screen
+ * @param[in] y
+ *            The pixel Y location of the top left of the region on the screen
+ * @param[in] src
+ *            The surface to draw
+ * @param[in] sx
+ *            The pixel X location of the top left of the region in the surface
+ * @param[in] sy
+ *            The pixel Y location of the top left of the region in the surface
+ * @param[in] width
+ *            Width of the region in pixels
+ * @param[in] height
+ *            Height of the region in pixels
+ */
+void rdp_draw_surface_region( int x, int y, surface_t *src, int sx, int sy, int width, int height )
+{
+    tex_format_t fmt = surface_get_format( src );
+    assertf( TEX_FORMAT_BITDEPTH(fmt) == 16, "unsupported format for copy mode: %s", tex_format_name(fmt) );
+    assertf( x >= 0 && y >= 0, "surface out of screen: %d,%d", x, y );
+    assertf( sx >= 0 && sy >= 0 && sx + width <= src->width && sy + height <= src->height,
+        "region out of surface: %d,%d %dx%d", sx, sy, width, height );
+    if( width <= 0 || height <= 0 ) { return; }
+
+    if( flush_strategy == FLUSH_STRATEGY_AUTOMATIC )
+    {
+        data_cache_hit_writeback( (uint8_t*)src->buffer + sy * src->stride, src->stride * height );
+    }
+    rdp_invalidate_texture_cache();
+
+    /* Split in chunks that fit TMEM: up to 256 pixels wide (512 bytes per line) */
+    int cw = MIN( width, 256 );
+    int line = ROUND_UP( cw * 2, 8 );
+    int ch = 4096 / line;
+
+    __rdp_write2( 0xFD000000 | (fmt << 19) | (src->stride / 2 - 1), (uint32_t)src->buffer );
+    __rdp_autosync_internal( AUTOSYNC_TILE(0) );
+    __rdp_write2( 0xF5000000 | (fmt << 19) | ((line / 8) << 9), 0 );
+
+    for( int t = sy; t < sy + height; t += ch )
+    {
+        for( int s = sx; s < sx + width; s += cw )
+        {
+            int sh = MIN( s + cw, sx + width ) - 1;
+            int th = MIN( t + ch, sy + height ) - 1;
+
+            /* Wait for the previous rectangle to be done with TMEM */
+            if( !__rdp_autosync_internal( AUTOSYNC_TMEM ) ) { __rdp_write2( 0xE7000000, 0 ); }
+            __rdp_write2( 0xF4000000 | (s << 14) | (t << 2), (sh << 14) | (th << 2) );
+
+            /* In copy mode, the rectangle is inclusive and S advances by 4 pixels per cycle */
+            int tx = x + s - sx, ty = y + t - sy;
+            int bx = x + sh - sx, by = y + th - sy;
+            __rdp_write4( 0xE4000000 | (bx << 14) | (by << 2),
+                          (tx << 14) | (ty << 2),
+                          ((s << 5) << 16) | (t << 5),
+                          (4 << 10) << 16 | (1 << 10) );
+            __rdp_autosync_use( AUTOSYNC_PIPE | AUTOSYNC_TMEM | AUTOSYNC_TILE(0) );
+        }
+    }
+
+    if( attached_surface ) { display_mark_dirty( attached_surface, x, y, width, height ); }
+}
+
+/** @brief Sort tiles by slice offset (used by #rdp_draw_sprites_batch) */
+static int __rdp_tile_compare( const void *a, const void *b )
+{
+    return ((const rdp_sprite_tile_t *)a)->tile - ((const rdp_sprite_tile_t *)b)->tile;
+}
+
+/**
+ * @brief Draw many tiles of a spritemap
+ *
+ * This function draws a batch of slices of a spritemap (see #rdp_load_texture_stride),
+ * for instance the visible part of a tilemap, loading each slice into RDP TMEM only once.
+ * It is equivalent to, but much faster than, calling #rdp_load_texture_stride and
+ * #rdp_draw_sprite for each tile.
+ *
+ * If the whole spritemap fits in TMEM and mirroring is disabled, it is loaded once and
+ * all the tiles are drawn from it. Otherwise, the tiles are sorted by slice, so that each
+ * slice is loaded once and then drawn at all its positions. Because of this, the tiles
+ * are not guaranteed to be drawn in the order they are specified, and should not overlap.
+ *
+ * Before using this command, use #rdp_enable_texture_copy to set the RDP up in texture mode.
+ * The texture slot is left with the last loaded slice.
+ *
+ * @param[in] texslot
+ *            The RDP texture slot to load the slices into (0-7)
+ * @param[in] texloc
+ *            The RDP TMEM offset to place the slices at
+ * @param[in] sprite
+ *            Pointer to the spritemap to load the slices from
+ * @param[in,out] tiles
+ *            Array of tiles to draw. It is sorted in place by slice if needed.
+ * @param[in] count
+ *            Number of tiles in the array
+ * @param[in] mirror
+ *            Whether the tiles should be mirrored
+ */
+void rdp_draw_sprites_batch( uint32_t texslot, uint32_t texloc, sprite_t *sprite, rdp_sprite_tile_t *tiles, int count, mirror_t mirror )
+{
+    if( !sprite || count <= 0 ) { return; }
+
+    sprite_cache *c = &cache[texslot & 0x7];
+    int twidth = sprite->width / sprite->hslices;
+    int theight = sprite->height / sprite->vslices;
+
+    /* Check whether the whole spritemap fits in TMEM, as loaded by __rdp_load_texture */
+    int bitdepth = TEX_FORMAT_BITDEPTH(sprite_get_format(sprite)) / 8;
+    uint32_t real_width = __rdp_round_to_power( sprite->width );
+    uint32_t real_height = __rdp_round_to_power( sprite->height );
+    uint32_t size = ((real_width + 7) / 8) * 8 * real_height * bitdepth;
+
+    if( mirror == MIRROR_DISABLED && sprite->width <= 256 && sprite->height <= 256 && texloc + size <= 4096 )
+    {
+        /* Load it once, and select each slice via the texture coordinates */
+        if( !__rdp_autosync_internal( AUTOSYNC_TMEM | AUTOSYNC_TILE(texslot & 0x7) ) ) { rdp_sync( SYNC_PIPE ); }
+        rdp_load_texture( texslot, texloc, mirror, sprite );
+
+        for( int i = 0; i < count; i++ )
+        {
+            c->s = (tiles[i].tile % sprite->hslices) * twidth;
+            c->t = (tiles[i].tile / sprite->hslices) * theight;
+            c->width = twidth - 1;
+            c->height = theight - 1;
+            rdp_draw_sprite( texslot, tiles[i].x, tiles[i].y, mirror );
+        }
+        return;
+    }
+
+    /* Group the tiles by slice, and load each slice once */
+    qsort( tiles, count, sizeof(rdp_sprite_tile_t), __rdp_tile_compare );
+
+    for( int i = 0; i < count; i++ )
+    {
+        if( i == 0 || tiles[i].tile != tiles[i-1].tile )
+        {
+            if( !__rdp_autosync_internal( AUTOSYNC_TMEM | AUTOSYNC_TILE(texslot & 0x7) ) ) { rdp_sync( SYNC_PIPE ); }
+            rdp_load_texture_stride( texslot, texloc, mirror, sprite, tiles[i].tile );
+        }
+        rdp_draw_sprite( texslot, tiles[i].x, tiles[i].y, mirror );
+    }
 }
 
 /**
@@ -752,9 +1350,10 @@ void rdp_draw_sprite_scaled( uint32_t texslot, int x, int y, double x_scale, dou
 void rdp_set_primitive_color( uint32_t color )
 {
     /* Set packed color */
-    __rdp_ringbuffer_queue( 0xF7000000 );
-    __rdp_ringbuffer_queue( color );
-    __rdp_ringbuffer_send();
+    render_state.prim_color = color;
+    __rdp_autosync_change( AUTOSYNC_PIPE );
+    __rdp_write2( 0xF7000000,
+                  color );
 }
 
 /**
@@ -767,9 +1366,10 @@ void rdp_set_primitive_color( uint32_t color )
  */
 void rdp_set_blend_color( uint32_t color )
 {
-    __rdp_ringbuffer_queue( 0xF9000000 );
-    __rdp_ringbuffer_queue( color );
-    __rdp_ringbuffer_send();
+    render_state.blend_color = color;
+    __rdp_autosync_change( AUTOSYNC_PIPE );
+    __rdp_write2( 0xF9000000,
+                  color );
 }
 
 /**
@@ -798,9 +1398,50 @@ void rdp_draw_filled_rectangle( int tx, int ty, int bx, int by )
     if( tx < 0 ) { tx = 0; }
     if( ty < 0 ) { ty = 0; }
 
-    __rdp_ringbuffer_queue( 0xF6000000 | ( bx << 14 ) | ( by << 2 ) ); 
-    __rdp_ringbuffer_queue( ( tx << 14 ) | ( ty << 2 ) );
-    __rdp_ringbuffer_send();
+    __rdp_write2( 0xF6000000 | ( bx << 14 ) | ( by << 2 ),
+                  ( tx << 14 ) | ( ty << 2 ) );
+    __rdp_autosync_use( AUTOSYNC_PIPE );
+
+    if( attached_surface ) { display_mark_dirty( attached_surface, tx, ty, bx - tx + 1, by - ty + 1 ); }
+}
+
+/**
+ * @brief Clear a surface with a solid color
+ *
+ * The clear is queued to the RDP and runs asynchronously, so the surface
+ * must not be written by the CPU until the RDP is done with it (for instance,
+ * after #rdp_detach or #rspq_wait). RDP drawing queued afterwards is correctly
+ * ordered after the clear.
+ *
+ * The surface does not need to be attached, and the attached surface (if any)
+ * is left unchanged. However, this function leaves the RDP in primitive fill
+ * mode, with the clipping set to the cleared surface and the primitive color
+ * set to @p color.
+ *
+ * @param[in] surf
+ *            Surface to clear
+ * @param[in] color
+ *            Color to fill the surface with (see #rdp_set_primitive_color)
+ */
+void rdp_clear_surface( surface_t *surf, uint32_t color )
+{
+    if( !__rdp_autosync_internal( AUTOSYNC_PIPE ) ) { rdp_sync( SYNC_PIPE ); }
+    __rdp_set_color_image( surf );
+    rdp_set_clipping( 0, 0, surf->width, surf->height );
+    rdp_enable_primitive_fill();
+    rdp_set_primitive_color( color );
+
+    /* In fill mode, the bottom right corner is inclusive */
+    __rdp_write2( 0xF6000000 | ( (surf->width - 1) << 14 ) | ( (surf->height - 1) << 2 ),
+                  0 );
+    __rdp_autosync_use( AUTOSYNC_PIPE );
+
+    display_mark_dirty( surf, 0, 0, surf->width, surf->height );
+    if( attached_surface && attached_surface != surf )
+    {
+        __rdp_autosync_internal( AUTOSYNC_PIPE );
+        __rdp_set_color_image( attached_surface );
+    }
 }
 
 /**
@@ -827,43 +1468,186 @@ void rdp_draw_filled_rectangle( int tx, int ty, int bx, int by )
  */
 void rdp_draw_filled_triangle( float x1, float y1, float x2, float y2, float x3, float y3 )
 {
-    float temp_x, temp_y;
-    const float to_fixed_11_2 = 4.0f;
-    const float to_fixed_16_16 = 65536.0f;
-    
-    /* sort vertices by Y ascending to find the major, mid and low edges */
-    if( y1 > y2 ) { temp_x = x2, temp_y = y2; y2 = y1; y1 = temp_y; x2 = x1; x1 = temp_x; }
-    if( y2 > y3 ) { temp_x = x3, temp_y = y3; y3 = y2; y2 = temp_y; x3 = x2; x2 = temp_x; }
-    if( y1 > y2 ) { temp_x = x2, temp_y = y2; y2 = y1; y1 = temp_y; x2 = x1; x1 = temp_x; }
-
-    /* calculate Y edge coefficients in 11.2 fixed format */
-    int yh = y1 * to_fixed_11_2;
-    int ym = (int)( y2 * to_fixed_11_2 ) << 16; // high word
-    int yl = y3 * to_fixed_11_2;
-    
-    /* calculate X edge coefficients in 16.16 fixed format */
-    int xh = x1 * to_fixed_16_16;
-    int xm = x1 * to_fixed_16_16;
-    int xl = x2 * to_fixed_16_16;
-    
-    /* calculate inverse slopes in 16.16 fixed format */
-    int dxhdy = ( y3 == y1 ) ? 0 : ( ( x3 - x1 ) / ( y3 - y1 ) ) * to_fixed_16_16;
-    int dxmdy = ( y2 == y1 ) ? 0 : ( ( x2 - x1 ) / ( y2 - y1 ) ) * to_fixed_16_16;
-    int dxldy = ( y3 == y2 ) ? 0 : ( ( x3 - x2 ) / ( y3 - y2 ) ) * to_fixed_16_16;
-    
-    /* determine the winding of the triangle */
-    int winding = ( x1 * y2 - x2 * y1 ) + ( x2 * y3 - x3 * y2 ) + ( x3 * y1 - x1 * y3 );
-    int flip = ( winding > 0 ? 1 : 0 ) << 23;
-    
-    __rdp_ringbuffer_queue( 0xC8000000 | flip | yl );
-    __rdp_ringbuffer_queue( ym | yh );
-    __rdp_ringbuffer_queue( xl );
-    __rdp_ringbuffer_queue( dxldy );
-    __rdp_ringbuffer_queue( xh );
-    __rdp_ringbuffer_queue( dxhdy );
-    __rdp_ringbuffer_queue( xm );
-    __rdp_ringbuffer_queue( dxmdy );
-    __rdp_ringbuffer_send();
+    /* The edge coefficients are computed by the RSP (see rsp_rdp.S) */
+    rspq_write( RDP_OVERLAY_ID, RDP_CMD_TRIANGLE_SETUP, 0,
+                __rdp_vertex( x1, y1 ), __rdp_vertex( x2, y2 ), __rdp_vertex( x3, y3 ) );
+    __rdp_autosync_use( AUTOSYNC_PIPE );
+
+    if( attached_surface )
+    {
+        int minx = MIN( x1, MIN( x2, x3 ) ), maxx = MAX( x1, MAX( x2, x3 ) );
+        int miny = MIN( y1, MIN( y2, y3 ) ), maxy = MAX( y1, MAX( y2, y3 ) );
+        display_mark_dirty( attached_surface, minx, miny, maxx - minx + 2, maxy - miny + 2 );
+    }
+}
+
+/**
+ * @brief Draw a list of filled triangles
+ *
+ * This is equivalent to calling #rdp_draw_filled_triangle for each triangle,
+ * and has the same requirements.
+ *
+ * @param[in] xy
+ *            Vertices of the triangles, as X,Y pairs in pixels (6 floats per triangle)
+ * @param[in] num_triangles
+ *            Number of triangles
+ */
+void rdp_draw_filled_triangles( const float *xy, int num_triangles )
+{
+    for( int i = 0; i < num_triangles; i++, xy += 6 )
+    {
+        rdp_draw_filled_triangle( xy[0], xy[1], xy[2], xy[3], xy[4], xy[5] );
+    }
+}
+
+/**
+ * @brief Check whether the RDP is attached to a surface
+ *
+ * @param[in] surface
+ *            The surface to check
+ *
+ * @return True if the RDP is attached to @p surface
+ */
+bool __rdp_is_attached( surface_t *surface )
+{
+    return surface && attached_surface == surface;
+}
+
+/**
+ * @brief Switch the accelerated drawing to a render mode and color
+ *
+ * The syncs are inserted also in #RDP_AUTOSYNC_VERIFY mode, as the
+ * caller (graphics.c) does not know about the RDP.
+ *
+ * @param[in] mode
+ *            Render mode
+ * @param[in] color
+ *            Fill color (#ACCEL_FILL) or blend color (#ACCEL_BLEND)
+ */
+static void __rdp_accel_mode( accel_mode_t mode, uint32_t color )
+{
+    if( accel_mode == mode && accel_color == color ) { return; }
+
+    if( !__rdp_autosync_internal( AUTOSYNC_PIPE ) ) { __rdp_write2( 0xE7000000, 0 ); }
+    if( accel_mode != mode )
+    {
+        if( mode == ACCEL_FILL ) { __rdp_write2( 0xEFB000FF, 0x00004000 ); }
+        else                     { __rdp_write2( 0xEF0000FF, 0x80000000 ); }
+        accel_mode = mode;
+    }
+    if( mode == ACCEL_FILL ) { __rdp_write2( 0xF7000000, color ); accel_dirty |= 1; }
+    else                     { __rdp_write2( 0xF9000000, color ); accel_dirty |= 2; }
+    accel_color = color;
+}
+
+/**
+ * @brief Draw a filled box with the RDP, for the graphics module
+ *
+ * The box must be already clipped to the attached surface.
+ *
+ * @param[in] x
+ *            X coordinate of the top left of the box
+ * @param[in] y
+ *            Y coordinate of the top left of the box
+ * @param[in] width
+ *            Width of the box in pixels
+ * @param[in] height
+ *            Height of the box in pixels
+ * @param[in] color
+ *            Color of the box, in the format of the attached surface (see #graphics_convert_color)
+ */
+void __rdp_accel_box( int x, int y, int width, int height, uint32_t color )
+{
+    __rdp_accel_mode( ACCEL_FILL, color );
+
+    /* In fill mode, the bottom right corner is inclusive */
+    __rdp_write2( 0xF6000000 | ( (x + width - 1) << 14 ) | ( (y + height - 1) << 2 ),
+                  ( x << 14 ) | ( y << 2 ) );
+    __rdp_autosync_use( AUTOSYNC_PIPE );
+
+    display_mark_dirty( attached_surface, x, y, width, height );
+}
+
+/**
+ * @brief Draw a line with the RDP, for the graphics module
+ *
+ * Horizontal and vertical lines are drawn as boxes. Other lines are drawn
+ * as a parallelogram (two triangles), one pixel thick along the minor axis,
+ * that covers the pixels closest to the line: the same of a Bresenham line,
+ * except for rounding at the midpoints.
+ *
+ * @param[in] x0
+ *            X coordinate of the start of the line
+ * @param[in] y0
+ *            Y coordinate of the start of the line
+ * @param[in] x1
+ *            X coordinate of the end of the line
+ * @param[in] y1
+ *            Y coordinate of the end of the line
+ * @param[in] color
+ *            Color of the line, in the format of the attached surface (see #graphics_convert_color)
+ */
+void __rdp_accel_line( int x0, int y0, int x1, int y1, uint32_t color )
+{
+    if( x0 == x1 || y0 == y1 )
+    {
+        int tx = MAX( MIN( x0, x1 ), 0 ), ty = MAX( MIN( y0, y1 ), 0 );
+        int bx = MIN( MAX( x0, x1 ), (int)attached_surface->width - 1 );
+        int by = MIN( MAX( y0, y1 ), (int)attached_surface->height - 1 );
+        if( tx <= bx && ty <= by ) { __rdp_accel_box( tx, ty, bx - tx + 1, by - ty + 1, color ); }
+        return;
+    }
+
+    /* The blend color is always RGBA32, and opaque like the pixels written by the CPU */
+    if( TEX_FORMAT_BITDEPTH(surface_get_format( attached_surface )) == 16 )
+    {
+        color = color_to_packed32( color_from_packed16( color & 0xFFFF ) );
+    }
+    __rdp_accel_mode( ACCEL_BLEND, color | 0xFF );
+
+    /* Go along the major axis in increasing order. The minor coordinate of the
+     * line is (v0 + 0.5) + m * (u - u0 - 0.5), at the center of each pixel. */
+    bool xmajor = abs( x1 - x0 ) >= abs( y1 - y0 );
+    int u0 = xmajor ? x0 : y0, u1 = xmajor ? x1 : y1;
+    int v0 = xmajor ? y0 : x0, v1 = xmajor ? y1 : x1;
+    if( u0 > u1 ) { int t = u0; u0 = u1; u1 = t; t = v0; v0 = v1; v1 = t; }
+
+    float m = (float)( v1 - v0 ) / ( u1 - u0 );
+    float ua = u0, ub = u1 + 1;
+    float va = v0 + 0.5f - m * 0.5f, vb = va + m * ( ub - ua );
+
+    float q[8];
+    if( xmajor )
+    {
+        q[0] = ua; q[1] = va - 0.5f; q[2] = ub; q[3] = vb - 0.5f;
+        q[4] = ub; q[5] = vb + 0.5f; q[6] = ua; q[7] = va + 0.5f;
+    }
+    else
+    {
+        q[0] = va - 0.5f; q[1] = ua; q[2] = vb - 0.5f; q[3] = ub;
+        q[4] = vb + 0.5f; q[5] = ub; q[6] = va + 0.5f; q[7] = ua;
+    }
+    rdp_draw_filled_triangle( q[0], q[1], q[2], q[3], q[4], q[5] );
+    rdp_draw_filled_triangle( q[0], q[1], q[4], q[5], q[6], q[7] );
+}
+
+/**
+ * @brief Restore the render state changed by the accelerated drawing
+ *
+ * The other modes and the colors set by the public functions are sent
+ * again, so that drawing with them can continue as if the graphics module
+ * did not use the RDP.
+ */
+void __rdp_accel_end( void )
+{
+    if( accel_mode == ACCEL_NONE ) { return; }
+
+    if( !__rdp_autosync_internal( AUTOSYNC_PIPE ) ) { __rdp_write2( 0xE7000000, 0 ); }
+    if( render_state.modes[0] ) { __rdp_write2( render_state.modes[0], render_state.modes[1] ); }
+    if( accel_dirty & 1 ) { __rdp_write2( 0xF7000000, render_state.prim_color ); }
+    if( accel_dirty & 2 ) { __rdp_write2( 0xF9000000, render_state.blend_color ); }
+    accel_mode = ACCEL_NONE;
+    accel_dirty = 0;
 }
 
 /**
@@ -0,0 +1,17 @@
+#ifndef __LIBDRAGON_RDP_INTERNAL_H
+#define __LIBDRAGON_RDP_INTERNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <surface.h>
+
+/** @brief Return true if the RDP is attached to the specified surface */
+bool __rdp_is_attached(surface_t *surface);
+/** @brief Draw a filled box with the RDP, in the color format of the attached surface (already clipped) */
+void __rdp_accel_box(int x, int y, int width, int height, uint32_t color);
+/** @brief Draw a line with the RDP, in the color format of the attached surface */
+void __rdp_accel_line(int x0, int y0, int x1, int y1, uint32_t color);
+/** @brief Restore the render modes and colors changed by the accelerated drawing */
+void __rdp_accel_end(void);
+
+#endif
@@ -7,9 +7,7 @@
 #include "n64sys.h"
 #include "dma.h"
 #include "debug.h"
-#include <stdalign.h>
 #include <string.h>
-#include <stdlib.h>
 
 #define TOC_MAGIC    0x544F4330         ///< Magic ID "TOC0"
 
@@ -30,6 +28,18 @@ typedef struct {
     char name[];            ///< Name of the file
 } entry_t;
 
+/** @brief Maximum size of the TOC (header and entries). NOTE: keep in sync with n64tool */
+#define TOC_MAX_SIZE        1024
+/** @brief Maximum number of entries in the TOC */
+#define TOC_MAX_ENTRIES     ((TOC_MAX_SIZE - sizeof(header_t)) / 8)
+
+/** @brief Copy of the TOC in RAM, read at the first lookup */
+static uint8_t toc_data[TOC_MAX_SIZE] __attribute__((aligned(16)));
+/** @brief Size of each file, computed from the offsets of the TOC */
+static uint32_t toc_file_size[TOC_MAX_ENTRIES];
+/** @brief State of #toc_data: 0 = not read yet, 1 = valid, -1 = no or corrupted TOC */
+static int toc_state = 0;
+
 static bool extension_match(const char *ext, const char *name)
 {
     int ext_len = strlen(ext);
@@ -40,34 +50,78 @@ static bool extension_match(const char *ext, const char *name)
     return strcmp(ext, name + name_len - ext_len) == 0;
 }
 
-uint32_t rompak_search_ext(const char *ext)
+/** @brief Get the i-th entry of the TOC in RAM */
+static inline entry_t *toc_entry(int i)
 {
-    static bool rompak_corrupted = false;
+    header_t *header = (header_t*)toc_data;
+    return (entry_t*)(toc_data + sizeof(header_t) + i * header->entry_size);
+}
 
-    if (rompak_corrupted || io_read(TOC_ADDR) != TOC_MAGIC) {
-        return 0;
+/** @brief Read the TOC into RAM (once), and compute the size of the files */
+static bool toc_load(void)
+{
+    if (toc_state)
+        return toc_state > 0;
+
+    toc_state = -1;
+    if (io_read(TOC_ADDR) != TOC_MAGIC)
+        return false;
+
+    // The TOC is read with a single DMA transfer. Notice that this function
+    // can be called by the exception handler (via backtrace), so it
+    // does not allocate memory.
+    data_cache_hit_writeback_invalidate(toc_data, sizeof(toc_data));
+    dma_read(toc_data, TOC_ADDR, sizeof(toc_data));
+
+    // These asserts protect against a miscompiled TOC, eg: little-endian /
+    // big-endian mistakes.
+    header_t *header = (header_t*)toc_data;
+    if (header->entry_size <= sizeof(entry_t) || header->entry_size & 3 ||
+        header->num_entries > TOC_MAX_ENTRIES ||
+        sizeof(header_t) + header->num_entries * header->entry_size > TOC_MAX_SIZE) {
+        assertf(header->entry_size > sizeof(entry_t) && (header->entry_size & 3) == 0,
+            "Corrupted rompak TOC: invalid entry size (0x%lx)", header->entry_size);
+        assertf(0, "Corrupted rompak TOC: too many entries (0x%lx of 0x%lx bytes)", header->num_entries, header->entry_size);
+        return false;
     }
 
-    header_t header;
-    data_cache_hit_writeback_invalidate(&header, sizeof(header_t));
-    dma_read(&header, TOC_ADDR, sizeof(header_t));
-
-    // These asserts prevent a miscompiled TOC from causing a hard-to-diagnose
-    // stack overflow because of alloca. The number 1024 is arbitrary, we just
-    // want to protect against important corruptions (eg: little-endian / big-endian mistakes).
-    if (header.entry_size >= 1024 || header.num_entries >= 1024) {
-        rompak_corrupted = true;
-        assertf(header.entry_size < 1024, "Corrupted rompak TOC: entry size too big (0x%lx)", header.entry_size);
-        assertf(header.num_entries < 1024, "Corrupted rompak TOC: too many entries (0x%lx)", header.num_entries);
+    // The TOC does not store the size of the files, so consider each file
+    // extending up to the next one in the ROM (this might include padding).
+    // The size of the last file is unknown.
+    for (int i = 0; i < header->num_entries; i++) {
+        entry_t *entry = toc_entry(i);
+        entry->name[header->entry_size - sizeof(entry_t) - 1] = 0;
+        uint32_t next = 0;
+        for (int j = 0; j < header->num_entries; j++) {
+            uint32_t off = toc_entry(j)->offset;
+            if (off > entry->offset && (!next || off < next))
+                next = off;
+        }
+        toc_file_size[i] = next ? next - entry->offset : 0;
     }
 
-    entry_t *entry = alloca(header.entry_size);
-    for (int i=0; i < header.num_entries; i++) {
-        data_cache_hit_writeback_invalidate(entry, header.entry_size);
-        dma_read(entry, TOC_ADDR + sizeof(header_t) + i*header.entry_size, header.entry_size);
+    toc_state = 1;
+    return true;
+}
+
+uint32_t rompak_search_ext(const char *ext)
+{
+    return rompak_lookup_ext(ext, NULL);
+}
+
+uint32_t rompak_lookup_ext(const char *ext, uint32_t *size)
+{
+    if (size) *size = 0;
+    if (!toc_load())
+        return 0;
 
-        if (extension_match(ext, entry->name))
+    header_t *header = (header_t*)toc_data;
+    for (int i=0; i < header->num_entries; i++) {
+        entry_t *entry = toc_entry(i);
+        if (extension_match(ext, entry->name)) {
+            if (size) *size = toc_file_size[i];
             return 0x10000000 + entry->offset;
+        }
     }
 
     return 0;
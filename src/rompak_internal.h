@@ -43,6 +43,26 @@
  */
 uint32_t rompak_search_ext(const char *ext);
 
+/**
+ * @brief Search a file in the rompak by extension, returning also its size
+ *
+ * This is like #rompak_search_ext, but also returns the size of the file.
+ * The TOC only records the offsets of the files, so the size is computed
+ * as the distance to the next file in the ROM: it can include some padding.
+ * The size of the last file of the ROM is not known, and is returned as 0.
+ *
+ * The TOC is read from ROM the first time a file is searched, so following
+ * searches do not access the ROM.
+ *
+ * @param ext     Extension to search for (will be matched case sensitively).
+ *                This extension must contain the dot, e.g. ".bin".
+ * @param size    If not NULL, receives the size of the file in bytes (or 0,
+ *                if unknown)
+ * @return        Physical address of the file in the ROM, or 0 if the file
+ *                doesn't exist or the TOC is not present.
+ */
+uint32_t rompak_lookup_ext(const char *ext, uint32_t *size);
+
 /** @} */
 
 #endif
@@ -17,6 +17,7 @@
 #include "regsinternal.h"
 #include "n64sys.h"
 #include "interrupt.h"
+#include "rsp_internal.h"
 
 /**
  * RSP crash handler ucode (rsp_crash.S)
@@ -61,6 +62,11 @@ void rsp_load(rsp_ucode_t *ucode) {
     }
 }
 
+rsp_ucode_t *__rsp_get_current_ucode(void)
+{
+    return cur_ucode;
+}
+
 void rsp_load_code(void* start, unsigned long size, unsigned int imem_offset)
 {
     assert(((uint32_t)start % 8) == 0);
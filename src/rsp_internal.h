@@ -0,0 +1,18 @@
+#ifndef __LIBDRAGON_RSP_INTERNAL_H
+#define __LIBDRAGON_RSP_INTERNAL_H
+
+#include "rsp.h"
+
+/** @brief Return the ucode loaded by the last #rsp_load (NULL if IMEM was modified since) */
+rsp_ucode_t *__rsp_get_current_ucode(void);
+
+/**
+ * @brief Return the ucode whose code is running in IMEM
+ *
+ * This resolves the rspq ucode to the overlay currently loaded in IMEM, by
+ * peeking at the rspq state in DMEM. Any other ucode is returned unchanged.
+ * The function does not halt the RSP, so it can be called while it runs.
+ */
+rsp_ucode_t *__rspq_get_running_ucode(rsp_ucode_t *ucode);
+
+#endif
@@ -0,0 +1,311 @@
+/**
+ * @file rsp_profile.c
+ * @brief Sampling RSP profiler
+ * @ingroup rsp_profile
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "rsp_profile.h"
+#include "rsp_internal.h"
+#include "n64sys.h"
+#include "timer.h"
+#include "interrupt.h"
+#include "usb.h"
+#include "debug.h"
+
+/**
+ * @defgroup rsp_profile Sampling RSP profiler
+ * @ingroup lowlevel
+ * @brief Statistical profiler of the ucode running on the RSP.
+ *
+ * The RSP has no performance counters, but its program counter (SP_PC) can
+ * be read by the CPU at any time, without disturbing it. The profiler reads
+ * it at a fixed frequency via a continuous timer (see @ref timer), and
+ * counts how many times each IMEM address was found running, building a
+ * histogram for each ucode. Hot loops and stalls show up as the addresses
+ * with most samples.
+ *
+ * Samples are attributed to the ucode loaded with #rsp_load. When the
+ * running ucode is the rspq engine, they are attributed to the overlay that
+ * is loaded in IMEM at the time of the sample (the code of rsp_queue.S itself
+ * is linked into each overlay, so it is accounted to the overlay too). While
+ * no overlay is loaded, samples go to the rsp_queue ucode. Samples taken
+ * while the RSP is halted are only counted as idle time.
+ *
+ * The histograms are sent to the PC via USB with #rsp_profile_dump (which
+ * can be called periodically, eg: once per second). On the PC, the
+ * n64rspprof tool symbolizes them using the ELF files of the ucodes, that
+ * the build system leaves next to the object files (eg: build/rsp_mixer.elf):
+ *
+ * @code{.sh}
+ *      n64rspprof build/rsp_*.elf rspprof-*.bin
+ * @endcode
+ *
+ * Each sample costs a timer interrupt, so the frequency is a tradeoff
+ * between precision and CPU time taken from the game: 10000 Hz is a good
+ * starting point. Notice that the sampling is periodic, so a RSP loop that
+ * runs in lockstep with the timer might be under or over represented;
+ * profiling over a longer time mitigates this.
+ *
+ * The format of a sample file is a sequence of big-endian 32-bit words:
+ *
+ *  * #RSP_PROFILE_MAGIC
+ *  * #RSP_PROFILE_VERSION
+ *  * Sampling period in ticks
+ *  * Number of samples taken while the RSP was running
+ *  * Number of samples taken while the RSP was halted
+ *  * Number of samples dropped since the previous dump
+ *  * Number of ucodes that follow
+ *  * For each ucode: its name (32 bytes, zero padded; empty if unknown),
+ *    the number N of sampled addresses, followed by N pairs (IMEM address,
+ *    number of samples).
+ * @{
+ */
+
+/** @brief Number of words in the header of a dump */
+#define HEADER_WORDS        7
+/** @brief Size of the name of a ucode in a dump, in words */
+#define NAME_WORDS          8
+
+/** @brief Histogram of the samples of a ucode */
+typedef struct {
+    rsp_ucode_t *ucode;                             ///< Ucode (NULL if unknown)
+    uint32_t samples;                               ///< Total number of samples
+    uint32_t counts[RSP_PROFILE_IMEM_SLOTS];        ///< Samples per IMEM address
+} rsp_histogram_t;
+
+/** @brief Histograms (two sets: one being filled, and one being dumped) */
+static rsp_histogram_t *prof_hist[2];
+/** @brief Number of histograms in use in each set */
+static int prof_num_hist[2];
+/** @brief Number of histograms in each set */
+static int prof_max_hist;
+/** @brief Index of the set being filled by the timer */
+static int prof_cur;
+/** @brief Sampling timer */
+static timer_link_t *prof_timer;
+/** @brief Sampling period in ticks */
+static uint32_t prof_period;
+/** @brief Total number of samples while running */
+static uint32_t prof_samples;
+/** @brief Total number of samples while halted */
+static uint32_t prof_idle;
+/** @brief Total number of samples dropped */
+static uint32_t prof_dropped;
+/** @brief Samples while halted since the last dump */
+static uint32_t prof_idle_dump;
+/** @brief Samples dropped since the last dump */
+static uint32_t prof_dropped_dump;
+
+/**
+ * @brief Timer callback: record the current PC of the RSP
+ */
+static void rsp_profile_sample(int ovfl)
+{
+    if (*SP_STATUS & SP_STATUS_HALTED) {
+        prof_idle++;
+        prof_idle_dump++;
+        return;
+    }
+
+    uint32_t pc = *SP_PC & 0xFFC;
+    rsp_ucode_t *ucode = __rspq_get_running_ucode(__rsp_get_current_ucode());
+
+    rsp_histogram_t *hist = prof_hist[prof_cur];
+    int n = prof_num_hist[prof_cur];
+    int i = 0;
+    while (i < n && hist[i].ucode != ucode)
+        i++;
+    if (i == n) {
+        if (n == prof_max_hist) {
+            prof_dropped++;
+            prof_dropped_dump++;
+            return;
+        }
+        hist[i].ucode = ucode;
+        prof_num_hist[prof_cur]++;
+    }
+
+    hist[i].counts[pc / 4]++;
+    hist[i].samples++;
+    prof_samples++;
+}
+
+/**
+ * @brief Start sampling the RSP
+ *
+ * The timer subsystem must be initialized. Calling this function while the
+ * profiler is already running changes the sampling parameters, discarding
+ * the samples not dumped yet.
+ *
+ * @param[in] hz            Sampling frequency (eg: 10000)
+ * @param[in] max_ucodes    Maximum number of different ucodes (or rspq
+ *                          overlays) that can be sampled between two calls
+ *                          to #rsp_profile_dump. Each one takes 8 KiB of RAM.
+ */
+void rsp_profile_start(int hz, int max_ucodes)
+{
+    assertf(hz > 0, "invalid sampling frequency: %d", hz);
+    assertf(max_ucodes > 0, "invalid number of ucodes: %d", max_ucodes);
+
+    rsp_profile_close();
+
+    prof_max_hist = max_ucodes;
+    for (int i = 0; i < 2; i++) {
+        prof_hist[i] = calloc(max_ucodes, sizeof(rsp_histogram_t));
+        assertf(prof_hist[i], "out of memory allocating RSP profile histograms");
+        prof_num_hist[i] = 0;
+    }
+    prof_cur = 0;
+    prof_samples = prof_idle = prof_dropped = 0;
+    prof_idle_dump = prof_dropped_dump = 0;
+
+    prof_period = TICKS_PER_SECOND / hz;
+    prof_timer = new_timer(prof_period, TF_CONTINUOUS, rsp_profile_sample);
+}
+
+/**
+ * @brief Stop sampling the RSP
+ *
+ * The samples recorded so far are kept, and can still be sent with
+ * #rsp_profile_dump.
+ */
+void rsp_profile_stop(void)
+{
+    if (prof_timer) {
+        delete_timer(prof_timer);
+        prof_timer = NULL;
+    }
+}
+
+/**
+ * @brief Send the histograms recorded so far via USB, and clear them
+ *
+ * The histograms are sent as a single binary message (DATATYPE_RAWBINARY),
+ * that the USB loader saves to a file on the PC. Each file is self-contained,
+ * so that multiple dumps can be given to the n64rspprof tool at once.
+ * Sampling continues in the other set of histograms while the data is
+ * being sent.
+ */
+void rsp_profile_dump(void)
+{
+    if (!prof_hist[0])
+        return;
+
+    /* Swap the histograms, so that the timer can keep sampling */
+    disable_interrupts();
+    rsp_histogram_t *hist = prof_hist[prof_cur];
+    int n = prof_num_hist[prof_cur];
+    uint32_t idle = prof_idle_dump;
+    uint32_t dropped = prof_dropped_dump;
+    prof_cur ^= 1;
+    prof_idle_dump = prof_dropped_dump = 0;
+    enable_interrupts();
+
+    if (!n && !idle && !dropped)
+        return;
+
+    int words = HEADER_WORDS;
+    uint32_t samples = 0;
+    for (int i = 0; i < n; i++) {
+        words += NAME_WORDS + 1;
+        for (int j = 0; j < RSP_PROFILE_IMEM_SLOTS; j++)
+            if (hist[i].counts[j]) words += 2;
+        samples += hist[i].samples;
+    }
+
+    uint32_t *buf = malloc(words * 4);
+    assertf(buf, "out of memory allocating RSP profile dump");
+    uint32_t *p = buf;
+    *p++ = RSP_PROFILE_MAGIC;
+    *p++ = RSP_PROFILE_VERSION;
+    *p++ = prof_period;
+    *p++ = samples;
+    *p++ = idle;
+    *p++ = dropped;
+    *p++ = n;
+    for (int i = 0; i < n; i++) {
+        memset(p, 0, NAME_WORDS * 4);
+        if (hist[i].ucode && hist[i].ucode->name)
+            strncpy((char*)p, hist[i].ucode->name, NAME_WORDS * 4 - 1);
+        p += NAME_WORDS;
+        uint32_t *count = p++;
+        *count = 0;
+        for (int j = 0; j < RSP_PROFILE_IMEM_SLOTS; j++) {
+            if (hist[i].counts[j]) {
+                *p++ = j * 4;
+                *p++ = hist[i].counts[j];
+                (*count)++;
+            }
+        }
+    }
+    usb_write(DATATYPE_RAWBINARY, buf, words * 4);
+    free(buf);
+
+    /* Clear the histograms for the next swap */
+    memset(hist, 0, n * sizeof(rsp_histogram_t));
+    disable_interrupts();
+    prof_num_hist[prof_cur ^ 1] = 0;
+    enable_interrupts();
+}
+
+/**
+ * @brief Get the histogram of the samples of a ucode
+ *
+ * This returns the samples recorded since the last #rsp_profile_dump, and
+ * can be used to analyze the profile on the console itself.
+ *
+ * @param[in] ucode     Ucode (or rspq overlay) to inspect
+ * @param[out] counts   Array that will be filled with the number of samples
+ *                      of each IMEM address (index: address / 4)
+ * @return              Total number of samples of the ucode
+ */
+uint32_t rsp_profile_get_histogram(rsp_ucode_t *ucode, uint32_t counts[RSP_PROFILE_IMEM_SLOTS])
+{
+    uint32_t samples = 0;
+    memset(counts, 0, RSP_PROFILE_IMEM_SLOTS * 4);
+
+    disable_interrupts();
+    if (prof_hist[0]) {
+        rsp_histogram_t *hist = prof_hist[prof_cur];
+        for (int i = 0; i < prof_num_hist[prof_cur]; i++) {
+            if (hist[i].ucode == ucode) {
+                memcpy(counts, hist[i].counts, RSP_PROFILE_IMEM_SLOTS * 4);
+                samples = hist[i].samples;
+                break;
+            }
+        }
+    }
+    enable_interrupts();
+    return samples;
+}
+
+/**
+ * @brief Get the statistics of the profiler
+ *
+ * @param[out] stats    Structure that will be filled with the statistics
+ */
+void rsp_profile_get_stats(rsp_profile_stats_t *stats)
+{
+    disable_interrupts();
+    stats->samples = prof_samples;
+    stats->idle = prof_idle;
+    stats->dropped = prof_dropped;
+    enable_interrupts();
+}
+
+/**
+ * @brief Stop sampling and free the histograms
+ *
+ * Samples not yet sent with #rsp_profile_dump are discarded.
+ */
+void rsp_profile_close(void)
+{
+    rsp_profile_stop();
+    for (int i = 0; i < 2; i++) {
+        free(prof_hist[i]);
+        prof_hist[i] = NULL;
+    }
+}
+
+/** @} */
@@ -0,0 +1,54 @@
+/**
+ * @file rspjob.c
+ * @brief Parallel-for jobs on the RSP
+ * @ingroup rsp
+ *
+ * This file contains the CPU side of the parallel-for command of
+ * rsp_job.inc.
+ */
+#include "rspjob.h"
+#include "rspq.h"
+#include "n64sys.h"
+#include "debug.h"
+
+/** @brief Index of the parallel-for command in the overlays */
+#define RSPJOB_CMD_PARALLEL_FOR     0x0
+
+void rspjob_kernel_init(rspjob_kernel_t *kernel, uint32_t ovl_id, int index, int in_size, int out_size)
+{
+    assertf(index >= 0 && index < 256, "rspjob: invalid kernel index: %d", index);
+    assertf(in_size >= 0 && in_size <= RSPJOB_TILE_SIZE && (in_size & 7) == 0,
+        "rspjob: input element size must be a multiple of 8, at most %d: %d", RSPJOB_TILE_SIZE, in_size);
+    assertf(out_size >= 0 && out_size <= RSPJOB_TILE_SIZE && (out_size & 7) == 0,
+        "rspjob: output element size must be a multiple of 8, at most %d: %d", RSPJOB_TILE_SIZE, out_size);
+    assertf(in_size || out_size, "rspjob: a kernel needs an input or an output");
+
+    kernel->ovl_id = ovl_id;
+    kernel->index = index;
+    kernel->in_size = in_size;
+    kernel->out_size = out_size;
+    kernel->tile = RSPJOB_TILE_SIZE / (in_size > out_size ? in_size : out_size);
+}
+
+void rspjob_parallel_for(const rspjob_kernel_t *kernel, const void *in, void *out, int count, uint32_t arg)
+{
+    assertf(!kernel->in_size || (in && ((uint32_t)in & 7) == 0), "rspjob: input array must be 8-byte aligned: %p", in);
+    assertf(!kernel->out_size || (out && ((uint32_t)out & 7) == 0), "rspjob: output array must be 8-byte aligned: %p", out);
+    if (count <= 0)
+        return;
+
+    // Split the array into full tiles, plus a partial one at the end
+    int tile = kernel->tile;
+    int num_tiles = (count + tile - 1) / tile;
+    int last = count % tile;
+    assertf(num_tiles < (1 << 24), "rspjob: too many elements: %d", count);
+
+    rspq_write(kernel->ovl_id, RSPJOB_CMD_PARALLEL_FOR,
+        out ? PhysicalAddr(out) : 0,
+        in ? PhysicalAddr(in) : 0,
+        (kernel->index << 24) | num_tiles,
+        ((kernel->in_size * tile) << 16) | (kernel->out_size * tile),
+        (tile << 16) | last,
+        ((kernel->in_size * last) << 16) | (kernel->out_size * last),
+        arg);
+}
@@ -0,0 +1,74 @@
+/**
+ * @file rspmem.c
+ * @brief Bulk memory copy and fill on the RSP
+ * @ingroup rsp
+ *
+ * This file contains the CPU side of the memory ucode (rsp_mem.S).
+ */
+#include <stdbool.h>
+#include "rspmem.h"
+#include "rspq.h"
+#include "rsp.h"
+#include "n64sys.h"
+#include "debug.h"
+
+DEFINE_RSP_UCODE(rsp_mem);
+
+/** @brief ID of the overlay (0 if not registered yet) */
+static uint32_t rspmem_ovl_id = 0;
+
+/** @brief Check whether a pointer is in the cached segment (KSEG0) */
+static inline bool rspmem_is_cached(const void *ptr)
+{
+    return ((uint32_t)ptr & 0xE0000000) == 0x80000000;
+}
+
+/** @brief Register the overlay the first time it is needed */
+static void rspmem_init(void)
+{
+    if (rspmem_ovl_id)
+        return;
+    rspq_init();
+    rspmem_ovl_id = rspq_overlay_register(&rsp_mem);
+}
+
+/** @brief Check and prepare the destination buffer of a command */
+static uint32_t rspmem_dst(void *dst, int size)
+{
+    assertf(((uint32_t)dst & 7) == 0, "rspmem: destination must be 8-byte aligned: %p", dst);
+    assertf(size >= 0 && (size & 7) == 0, "rspmem: size must be a multiple of 8: %d", size);
+    if (rspmem_is_cached(dst)) {
+        assertf((((uint32_t)dst | size) & 15) == 0,
+            "rspmem: cached destination must be 16-byte aligned, with a size multiple of 16: %p (%d)", dst, size);
+        data_cache_hit_writeback_invalidate(dst, size);
+    }
+    return PhysicalAddr(dst);
+}
+
+void rspmem_copy(void *dst, const void *src, int size)
+{
+    assertf(((uint32_t)src & 7) == 0, "rspmem: source must be 8-byte aligned: %p", src);
+    uint32_t dst_addr = rspmem_dst(dst, size);
+    if (size == 0)
+        return;
+    if (rspmem_is_cached(src))
+        data_cache_hit_writeback(src, size);
+
+    rspmem_init();
+    rspq_write(rspmem_ovl_id, 0x0, dst_addr, PhysicalAddr(src), size);
+}
+
+void rspmem_fill32(void *dst, uint32_t pattern, int size)
+{
+    uint32_t dst_addr = rspmem_dst(dst, size);
+    if (size == 0)
+        return;
+
+    rspmem_init();
+    rspq_write(rspmem_ovl_id, 0x1, dst_addr, pattern, size);
+}
+
+void rspmem_fill(void *dst, uint8_t value, int size)
+{
+    rspmem_fill32(dst, value * 0x01010101u, size);
+}
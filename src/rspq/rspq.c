@@ -61,7 +61,9 @@
  *    one, the RSP loads the new overlay into IMEM/DMEM. Before doing so, it
  *    also saves the current overlay's state back into RDRAM (this is a portion
  *    of DMEM specified by the overlay itself as "state", that is preserved
- *    across overlay switching).
+ *    across overlay switching). Overlays that track changes to their state
+ *    (see RSPQ_MarkStateDirty in rsp_queue.inc) skip the save if no command
+ *    changed it since the overlay was loaded.
  * 5. The RSP uses the command index to fetch the "command descriptor", a small
  *    structure that contains a pointer to the function in IMEM that executes
  *    the command, and the size of the command in word.
@@ -96,6 +98,16 @@
  *     accesses between volatile pointers, though non-volatile accesses can
  *     be reordered freely also across volatile ones).
  *
+ * When RSPQ_DMEM_PREFETCH is enabled (rspq_constants.h), step 1 is mostly
+ * performed in background: the DMEM buffer is split in two halves, and
+ * when the read pointer reaches the second half, the RSP moves the second half
+ * into the first one, and starts an asynchronous DMA to fetch the next
+ * portion into the second half while it runs the commands in the first half.
+ * A command that extends into the second half waits for the DMA to finish
+ * before being executed. Since the prefetched portion is read from RDRAM
+ * exactly as in step 1, commands not yet written by the CPU are still
+ * seen as 0x00 and handled as described in step 3.
+ *
  * ## Internal commands
  *
  * To manage the queue and implement all the various features, rspq reserves
@@ -106,7 +118,8 @@
  * ## Buffer swapping
  * 
  * Internally, double buffering is used to implement the queue. The size of
- * each of the buffers is RSPQ_DRAM_LOWPRI_BUFFER_SIZE. When a buffer is full,
+ * each of the buffers is RSPQ_DRAM_LOWPRI_BUFFER_SIZE by default, and can be
+ * configured with #rspq_init_ex. When a buffer is full,
  * the queue engine writes a RSPQ_CMD_JUMP command with the address of the
  * other buffer, to tell the RSP to jump there when it is done. 
  * 
@@ -115,7 +128,10 @@
  * keep track when the RSP has finished processing a buffer, so that we know
  * it becomes free again for more commands.
  * 
- * This logic is implemented in #rspq_next_buffer.
+ * This logic is implemented in #rspq_next_buffer. If the other buffer is not
+ * free yet, the CPU must wait for the RSP: these stalls are counted in the
+ * statistics returned by #rspq_buffer_get_stats, and can be reduced by using
+ * larger buffers.
  *
  * ## Blocks
  * 
@@ -164,12 +180,52 @@
  * Some careful tricks are necessary to allow multiple highpri queues to be
  * pending, see #rspq_highpri_begin for details.
  * 
+ * Overlay commands that take a long time can poll for highpri requests via
+ * the rspq_poll_highpri macro (rsp_queue.inc), so that the switch does not
+ * need to wait for the command to finish.
+ * 
+ * Both the first command of the highpri queue and the final RSPQ_CMD_SWAP_BUFFERS
+ * also generate an SP interrupt. This is used by #rspq_sp_interrupt to measure
+ * the latency of the highpri queue (see #rspq_highpri_get_stats).
+ * 
+ * ## Interrupt-context writers
+ *
+ * The queue itself can only be written by the main thread. To allow
+ * interrupt handlers (eg: timer or audio callbacks) to schedule RSP commands,
+ * #rspq_isr_write writes the command into a small side queue
+ * (#rspq_isr_slots), made of fixed-size slots. A writer reserves a slot
+ * by incrementing #rspq_isr_wptr (interrupts are disabled only for the
+ * reservation itself), then copies the command and finally publishes it by
+ * writing its size, which is the slot's first word. This is the same
+ * protocol used by the main queue: a slot is not visible until its first
+ * word is written.
+ *
+ * The main thread merges the published slots into the lowpri queue, in
+ * reservation order, every time #rspq_flush or #rspq_syncpoint_new are
+ * called (outside of blocks and highpri mode). 
+ *
+ * ## Profiling
+ * 
+ * When RSPQ_PROFILE is enabled, the RSP reads the DP_CLOCK counter at the
+ * start of each iteration of the main loop, and sends a "sample" with the
+ * ID of the command just completed and the elapsed cycles to a ring buffer
+ * in RDRAM, via an async DMA. DMEM is a very scarce resource (the mixer
+ * overlay for instance uses almost all of it), so the samples are not
+ * accumulated by the RSP but by the CPU, which reads the ring buffer in
+ * #rspq_profile_drain.
+ * 
+ * Each sample contains a sequence number, so that the CPU can tell whether
+ * a slot of the ring buffer has been written yet without any explicit
+ * synchronization with the RSP.
+ * 
  */
 
 #include "rsp.h"
 #include "rspq.h"
 #include "rspq_constants.h"
+#include "rsp_internal.h"
 #include "interrupt.h"
+#include "prof_zone.h"
 #include "utils.h"
 #include "n64sys.h"
 #include "debug.h"
@@ -177,6 +233,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdio.h>
+#include <stddef.h>
 #include <malloc.h>
 
 /**
@@ -275,7 +333,17 @@ enum {
      * interrupt to be processed (coalescing interrupts would cause syncpoints
      * to be missed).
      */
-    RSPQ_CMD_TEST_WRITE_STATUS = 0x08
+    RSPQ_CMD_TEST_WRITE_STATUS = 0x08,
+
+    /**
+     * @brief RSPQ command: list of DMA transfers
+     * 
+     * This command runs a list of DMA transfers (scatter/gather), described
+     * by an array of #rspq_dma_desc_t in RDRAM. The transfers are issued
+     * back-to-back, and the RSP waits for their completion only at the end.
+     * See #rspq_dma_list.
+     */
+    RSPQ_CMD_DMA_LIST          = 0x09
 };
 
 
@@ -329,16 +397,58 @@ typedef struct rspq_overlay_header_t {
     uint16_t state_start;       ///< Start of the portion of DMEM used as "state"
     uint16_t state_size;        ///< Size of the portion of DMEM used as "state"
     uint16_t command_base;      ///< Primary overlay ID used for this overlay
-    uint16_t reserved;          ///< Unused
+    uint16_t state_dirty;       ///< Non-zero if the state must be saved when the overlay is unloaded
     uint16_t commands[];
 } rspq_overlay_header_t;
 
 /** @brief A pre-built block of commands */
 typedef struct rspq_block_s {
     uint32_t nesting_level;     ///< Nesting level of the block
+    rspq_block_arena_t *arena;  ///< Arena the block was allocated from (or NULL for heap)
     uint32_t cmds[];            ///< Block contents (commands)
 } rspq_block_t;
 
+/** @brief A frame of a capture (see #rspq_capture_start) */
+typedef struct {
+    uint32_t offset;            ///< Offset of the first word of the frame in the capture
+    uint32_t size;              ///< Number of words of the frame, including the final RET
+    uint32_t syncpoints;        ///< Number of syncpoints created during the frame
+} rspq_capture_frame_t;
+
+/** @brief A capture of the lowpri command stream (see #rspq_capture_start) */
+typedef struct rspq_capture_s {
+    uint32_t *words;            ///< Captured command words
+    int num_words;              ///< Number of words in use
+    int max_words;              ///< Capacity of words
+    rspq_capture_frame_t *frames;   ///< Completed frames
+    int num_frames;             ///< Number of completed frames
+    int max_frames;             ///< Capacity of frames
+    int frame_start;            ///< Offset of the frame being captured
+    uint32_t frame_syncpoints;  ///< Syncpoints created in the frame being captured
+    bool overflow;              ///< True if the capacity was exhausted (capture stopped)
+    uint8_t overlay_table[RSPQ_OVERLAY_TABLE_SIZE]; ///< Overlay IDs at the start of the capture
+} rspq_capture_t;
+
+/** @brief Nesting level used to run a captured frame (see #rspq_capture_replay) */
+#define RSPQ_CAPTURE_NESTING_LEVEL     (RSPQ_MAX_BLOCK_NESTING_LEVEL-1)
+/** @brief Magic number of a capture file ("RQC1", see #rspq_capture_save) */
+#define RSPQ_CAPTURE_MAGIC             0x52514331
+
+/** @brief A page of memory of a block arena */
+typedef struct rspq_block_arena_page_s {
+    struct rspq_block_arena_page_s *next;   ///< Next page in the arena (or NULL)
+    uint32_t padding[3];                    ///< Keep data aligned to 16 bytes
+    uint8_t data[];                         ///< Page contents
+} rspq_block_arena_page_t;
+
+/** @brief A memory arena where blocks can be allocated */
+typedef struct rspq_block_arena_s {
+    int page_size;                          ///< Size of each page (in bytes)
+    rspq_block_arena_page_t *first;         ///< First page of the arena
+    rspq_block_arena_page_t *cur;           ///< Page currently used for allocations
+    int cur_offset;                         ///< First free byte in the current page
+} rspq_block_arena_t;
+
 /** @brief RSPQ overlays */
 rsp_ucode_t *rspq_overlay_ucodes[RSPQ_MAX_OVERLAY_COUNT];
 
@@ -383,6 +493,13 @@ typedef struct rsp_queue_s {
     uint32_t rspq_dram_highpri_addr;     ///< Address of the highpri queue  (special slot in the pointer stack)
     uint32_t rspq_dram_addr;             ///< Current RDRAM address being processed
     int16_t current_ovl;                 ///< Current overlay index
+    uint16_t padding;                    ///< Padding (the following fields are 8-byte aligned for DMA)
+    uint32_t ovl_switch_count;           ///< Number of overlay switches (see #rspq_overlay_stats_next_frame)
+    uint32_t ovl_switch_bytes;           ///< Bytes transferred by DMA for overlay switches
+#if RSPQ_PROFILE
+    uint32_t rspq_profile_rdram;         ///< RDRAM ring buffer for profile samples (0 = profiling disabled)
+    uint32_t rspq_profile_idx;           ///< Sequence number of the next profile sample
+#endif
 } __attribute__((aligned(16), packed)) rsp_queue_t;
 
 /** @brief Address of the RSPQ data header in DMEM (see #rsp_queue_t) */
@@ -444,19 +561,123 @@ static bool rspq_initialized = 0;
 static rspq_block_t *rspq_block;
 /** @brief Size of the current block memory buffer (in 32-bit words). */
 static int rspq_block_size;
+/** @brief Arena used to allocate the current block, or NULL for the heap. */
+static rspq_block_arena_t *rspq_block_arena;
+
+/**
+ * @brief Incremented whenever the commands stop being written in sequence
+ *
+ * This happens when switching between the lowpri queue, the highpri queue and
+ * a block being recorded, and when running a block. Modules that track the
+ * state left by their previous commands (eg: the RDP autosync) must assume it
+ * unknown after a change.
+ */
+uint32_t __rspq_epoch;
+
+/** @brief Buffer switch statistics (see #rspq_buffer_get_stats) */
+static rspq_buffer_stats_t rspq_buffer_stats;
+
+/** @brief Capture in progress, if any (see #rspq_capture_start) */
+static rspq_capture_t *rspq_capture;
+/** @brief First word of the lowpri queue not yet copied into the capture */
+static volatile uint32_t *rspq_capture_ptr;
 
 /** @brief ID that will be used for the next syncpoint that will be created. */
 static int rspq_syncpoints_genid;
 /** @brief ID of the last syncpoint reached by RSP. */
 static volatile int rspq_syncpoints_done;
 
+/** @brief State of the highpri latency tracking (see #rspq_highpri_get_stats) */
+typedef enum {
+    RSPQ_HIGHPRI_IDLE,                  ///< No highpri queue pending
+    RSPQ_HIGHPRI_REQUESTED,             ///< Highpri requested, lowpri not yet yielded
+    RSPQ_HIGHPRI_RUNNING,               ///< Highpri queue being run by the RSP
+} rspq_highpri_state_t;
+
+/** @brief Highpri latency tracking: current state */
+static volatile rspq_highpri_state_t rspq_highpri_state;
+/** @brief Highpri latency tracking: CPU ticks at which highpri mode was requested */
+static uint32_t rspq_highpri_req_ticks;
+/** @brief Highpri latency tracking: accumulated statistics */
+static struct {
+    int count;                          ///< Number of completed highpri sequences
+    uint32_t yield_min, yield_max;      ///< Min/max request to yield latency
+    uint64_t yield_total;               ///< Sum of all request to yield latencies
+    uint32_t done_min, done_max;        ///< Min/max request to completion latency
+    uint64_t done_total;                ///< Sum of all request to completion latencies
+} rspq_highpri_stats;
+
+/** @brief A callback registered via #rspq_syncpoint_on_done */
+typedef struct {
+    rspq_syncpoint_t sync_id;           ///< Syncpoint to wait for
+    void (*cb)(void *ctx);              ///< Callback (NULL = free entry)
+    void *ctx;                          ///< Opaque context passed to the callback
+} rspq_syncpoint_cb_t;
+
+/** @brief Pending syncpoint callbacks */
+static rspq_syncpoint_cb_t rspq_syncpoint_cbs[RSPQ_MAX_SYNCPOINT_CALLBACKS];
+
+/** @brief A slot of the side queue written by #rspq_isr_write */
+typedef struct {
+    volatile uint32_t size;                     ///< Size of the command in words (0 = slot not published)
+    uint32_t cmd[RSPQ_MAX_SHORT_COMMAND_SIZE];  ///< Command words
+} rspq_isr_slot_t;
+
+/** @brief Side queue for commands written from interrupt context */
+static rspq_isr_slot_t rspq_isr_slots[RSPQ_ISR_QUEUE_SLOTS];
+/** @brief Index of the next slot to reserve (see #rspq_isr_write) */
+static volatile uint32_t rspq_isr_wptr;
+/** @brief Index of the next slot to merge into the lowpri queue */
+static volatile uint32_t rspq_isr_rptr;
+
 /** @brief True if the RSP queue engine is running in the RSP. */
 static bool rspq_is_running;
 
 /** @brief Dummy state used for overlay 0 */
 static uint64_t dummy_overlay_state;
 
+/** @brief Header of overlay 0, loaded in DMEM when no overlay is loaded */
+static rspq_overlay_header_t dummy_header __attribute__((aligned(8))) = {
+    .state_start = 0,
+    .state_size = 7,
+    .command_base = 0
+};
+
+/** @brief Overlay switch statistics of the last frame, written by RSP via DMA */
+static rspq_overlay_stats_t rspq_ovl_stats __attribute__((aligned(16)));
+/** @brief Zero words used to reset the overlay switch statistics in DMEM */
+static const uint32_t rspq_ovl_stats_zero[4] __attribute__((aligned(16)));
+
+/** @brief Ring buffer where the RSP writes profile samples (see #RSPQ_PROFILE) */
+static volatile uint32_t *rspq_profile_ring;
+/** @brief Sequence number of the next profile sample to read from the ring buffer */
+static uint32_t rspq_profile_seq;
+/** @brief Profile data accumulated so far */
+static rspq_profile_data_t rspq_profile_data;
+
 static void rspq_flush_internal(void);
+static void rspq_capture_sync(void);
+
+/** @brief Record the yield latency of the current highpri sequence */
+static void rspq_highpri_yield(uint32_t now)
+{
+    uint32_t lat = now - rspq_highpri_req_ticks;
+    if (lat < rspq_highpri_stats.yield_min) rspq_highpri_stats.yield_min = lat;
+    if (lat > rspq_highpri_stats.yield_max) rspq_highpri_stats.yield_max = lat;
+    rspq_highpri_stats.yield_total += lat;
+    rspq_highpri_state = RSPQ_HIGHPRI_RUNNING;
+}
+
+/** @brief Record the completion latency of the current highpri sequence */
+static void rspq_highpri_done(uint32_t now)
+{
+    uint32_t lat = now - rspq_highpri_req_ticks;
+    if (lat < rspq_highpri_stats.done_min) rspq_highpri_stats.done_min = lat;
+    if (lat > rspq_highpri_stats.done_max) rspq_highpri_stats.done_max = lat;
+    rspq_highpri_stats.done_total += lat;
+    rspq_highpri_stats.count++;
+    rspq_highpri_state = RSPQ_HIGHPRI_IDLE;
+}
 
 /** @brief RSP interrupt handler, used for syncpoints. */
 static void rspq_sp_interrupt(void) 
@@ -469,24 +690,75 @@ static void rspq_sp_interrupt(void)
     if (status & SP_STATUS_SIG_SYNCPOINT) {
         wstatus |= SP_WSTATUS_CLEAR_SIG_SYNCPOINT;
         ++rspq_syncpoints_done;
+        prof_zone_mark(PROF_TRACK_RSP, "syncpoint");
     }
 
     MEMORY_BARRIER();
 
     if (wstatus)
         *SP_STATUS = wstatus;
+
+    // Track the highpri latency. The RSP generates an interrupt both when it
+    // starts running a highpri queue and when it goes back to lowpri. If the
+    // highpri queue is very short, we might see both events at once.
+    if (rspq_highpri_state != RSPQ_HIGHPRI_IDLE) {
+        uint32_t now = TICKS_READ();
+        if (rspq_highpri_state == RSPQ_HIGHPRI_REQUESTED) {
+            if (status & SP_STATUS_SIG_HIGHPRI_RUNNING) {
+                rspq_highpri_yield(now);
+            } else if (!(status & SP_STATUS_SIG_HIGHPRI_REQUESTED)) {
+                rspq_highpri_yield(now);
+                rspq_highpri_done(now);
+            }
+        } else if (!(status & (SP_STATUS_SIG_HIGHPRI_RUNNING | SP_STATUS_SIG_HIGHPRI_REQUESTED))) {
+            rspq_highpri_done(now);
+        }
+    }
+
+    // Run the callbacks of the syncpoints that have been reached
+    if (wstatus & SP_WSTATUS_CLEAR_SIG_SYNCPOINT) {
+        for (int i = 0; i < RSPQ_MAX_SYNCPOINT_CALLBACKS; i++) {
+            rspq_syncpoint_cb_t *scb = &rspq_syncpoint_cbs[i];
+            if (scb->cb && rspq_syncpoint_check(scb->sync_id)) {
+                void (*cb)(void*) = scb->cb;
+                scb->cb = NULL;
+                cb(scb->ctx);
+            }
+        }
+    }
+}
+
+/** @brief Return the name of an overlay given its index */
+static const char* rspq_get_ovl_name(int ovl_idx)
+{
+    if (ovl_idx == 0)
+        return "builtin";
+    else if (ovl_idx < RSPQ_MAX_OVERLAY_COUNT && rspq_overlay_ucodes[ovl_idx])
+        return rspq_overlay_ucodes[ovl_idx]->name;
+    else
+        return "?";
 }
 
 /** @brief Extract the current overlay index and name from the RSP queue state */
 static void rspq_get_current_ovl(rsp_queue_t *rspq, int *ovl_idx, const char **ovl_name)
 {
     *ovl_idx = rspq->current_ovl / sizeof(rspq_overlay_t);
-    if (*ovl_idx == 0)
-        *ovl_name = "builtin";
-    else if (*ovl_idx < RSPQ_MAX_OVERLAY_COUNT && rspq_overlay_ucodes[*ovl_idx])
-        *ovl_name = rspq_overlay_ucodes[*ovl_idx]->name;
-    else
-        *ovl_name = "?";
+    *ovl_name = rspq_get_ovl_name(*ovl_idx);
+}
+
+_Static_assert(((RSPQ_DATA_ADDRESS + offsetof(rsp_queue_t, current_ovl)) & 3) == 0);
+
+rsp_ucode_t *__rspq_get_running_ucode(rsp_ucode_t *ucode)
+{
+    if (ucode != &rsp_queue)
+        return ucode;
+
+    // Read the whole word: the CPU can only do 32-bit accesses to DMEM.
+    uint32_t w = SP_DMEM[(RSPQ_DATA_ADDRESS + offsetof(rsp_queue_t, current_ovl)) / 4];
+    int ovl_idx = (int16_t)(w >> 16) / (int)sizeof(rspq_overlay_t);
+    if (ovl_idx > 0 && ovl_idx < RSPQ_MAX_OVERLAY_COUNT && rspq_overlay_ucodes[ovl_idx])
+        return rspq_overlay_ucodes[ovl_idx];
+    return ucode;
 }
 
 /** @brief RSPQ crash handler. This shows RSPQ-specific info the in RSP crash screen. */
@@ -588,6 +860,7 @@ static void rspq_switch_context(rspq_ctx_t *new)
     rspq_ctx = new;
     rspq_cur_pointer = rspq_ctx ? rspq_ctx->cur : NULL;
     rspq_cur_sentinel = rspq_ctx ? rspq_ctx->sentinel : NULL;
+    __rspq_epoch++;
 }
 
 /** @brief Switch the current write buffer */
@@ -623,12 +896,6 @@ static void rspq_start(void)
     data_cache_hit_writeback(&rspq_data, sizeof(rsp_queue_t));
     rsp_load_data(&rspq_data, sizeof(rsp_queue_t), RSPQ_DATA_ADDRESS);
 
-    static rspq_overlay_header_t dummy_header = (rspq_overlay_header_t){
-        .state_start = 0,
-        .state_size = 7,
-        .command_base = 0
-    };
-
     uint32_t rspq_data_size = rsp_queue_data_end - rsp_queue_data_start;
     rsp_load_data(&dummy_header, sizeof(dummy_header), rspq_data_size);
 
@@ -673,22 +940,40 @@ static void rspq_close_context(rspq_ctx_t *ctx)
 }
 
 void rspq_init(void)
+{
+    rspq_init_ex(NULL);
+}
+
+void rspq_init_ex(const rspq_config_t *config)
 {
     // Do nothing if rspq_init has already been called
     if (rspq_initialized)
         return;
 
+    int lowpri_size = config && config->lowpri_buffer_size ? config->lowpri_buffer_size : RSPQ_DRAM_LOWPRI_BUFFER_SIZE;
+    int highpri_size = config && config->highpri_buffer_size ? config->highpri_buffer_size : RSPQ_DRAM_HIGHPRI_BUFFER_SIZE;
+    assertf(lowpri_size >= 2*RSPQ_MAX_COMMAND_SIZE && highpri_size >= 2*RSPQ_MAX_COMMAND_SIZE,
+        "rspq buffers must be at least %d words (lowpri: %d, highpri: %d)",
+        2*RSPQ_MAX_COMMAND_SIZE, lowpri_size, highpri_size);
+
     rspq_ctx = NULL;
     rspq_cur_pointer = NULL;
     rspq_cur_sentinel = NULL;
 
+    memset(rspq_syncpoint_cbs, 0, sizeof(rspq_syncpoint_cbs));
+    rspq_highpri_state = RSPQ_HIGHPRI_IDLE;
+    rspq_highpri_reset_stats();
+    rspq_buffer_reset_stats();
+    memset(rspq_isr_slots, 0, sizeof(rspq_isr_slots));
+    rspq_isr_wptr = rspq_isr_rptr = 0;
+
     // Allocate RSPQ contexts
-    rspq_init_context(&lowpri, RSPQ_DRAM_LOWPRI_BUFFER_SIZE);
+    rspq_init_context(&lowpri, lowpri_size);
     lowpri.sp_status_bufdone = SP_STATUS_SIG_BUFDONE_LOW;
     lowpri.sp_wstatus_set_bufdone = SP_WSTATUS_SET_SIG_BUFDONE_LOW;
     lowpri.sp_wstatus_clear_bufdone = SP_WSTATUS_CLEAR_SIG_BUFDONE_LOW;
 
-    rspq_init_context(&highpri, RSPQ_DRAM_HIGHPRI_BUFFER_SIZE);
+    rspq_init_context(&highpri, highpri_size);
     highpri.sp_status_bufdone = SP_STATUS_SIG_BUFDONE_HIGH;
     highpri.sp_wstatus_set_bufdone = SP_WSTATUS_SET_SIG_BUFDONE_HIGH;
     highpri.sp_wstatus_clear_bufdone = SP_WSTATUS_CLEAR_SIG_BUFDONE_HIGH;
@@ -746,6 +1031,11 @@ void rspq_close(void)
     rspq_close_context(&highpri);
     rspq_close_context(&lowpri);
 
+    if (rspq_profile_ring) {
+        free_uncached((void*)rspq_profile_ring);
+        rspq_profile_ring = NULL;
+    }
+
     set_SP_interrupt(0);
     unregister_SP_handler(rspq_sp_interrupt);
 }
@@ -974,6 +1264,83 @@ void rspq_overlay_unregister(uint32_t overlay_id)
     rspq_update_tables(false);
 }
 
+void rspq_overlay_reload(uint32_t overlay_id, rsp_ucode_t *overlay_ucode)
+{
+    assertf(overlay_id != 0, "Overlay 0 cannot be reloaded!");
+    assertf(rspq_ctx == &lowpri, "rspq_overlay_reload cannot be called in highpri mode or while recording a block");
+
+    uint32_t unshifted_id = overlay_id >> 28;
+    uint32_t overlay_index = rspq_data.tables.overlay_table[unshifted_id] / sizeof(rspq_overlay_t);
+    assertf(overlay_index != 0, "No overlay is registered at id %#lx!", overlay_id);
+    rsp_ucode_t *old_ucode = rspq_overlay_ucodes[overlay_index];
+
+    uint32_t rspq_text_size = rsp_queue_text_end - rsp_queue_text_start;
+    uint32_t rspq_data_size = rsp_queue_data_end - rsp_queue_data_start;
+
+    // The new ucode usually comes from a buffer just written by the CPU
+    data_cache_hit_writeback_invalidate(overlay_ucode->code, (uint8_t*)overlay_ucode->code_end - overlay_ucode->code);
+    data_cache_hit_writeback_invalidate(overlay_ucode->data, (uint8_t*)overlay_ucode->data_end - overlay_ucode->data);
+
+    assertf(memcmp(rsp_queue_text_start, overlay_ucode->code, rspq_text_size) == 0,
+        "Common code of overlay %s does not match!", overlay_ucode->name);
+    assertf(memcmp(rsp_queue_data_start, overlay_ucode->data, rspq_data_size) == 0,
+        "Common data of overlay %s does not match!", overlay_ucode->name);
+
+    void *overlay_code = overlay_ucode->code + rspq_text_size;
+    void *overlay_data = overlay_ucode->data + rspq_data_size;
+
+    rspq_overlay_header_t *old_header = (rspq_overlay_header_t*)(old_ucode->data + rspq_data_size);
+    rspq_overlay_header_t *overlay_header = (rspq_overlay_header_t*)overlay_data;
+    uint32_t slot_count = (rspq_overlay_get_command_count(old_header) + 15) / 16;
+    assertf((rspq_overlay_get_command_count(overlay_header) + 15) / 16 <= slot_count,
+        "Overlay %s has more commands than the one it replaces (%s)", overlay_ucode->name, old_ucode->name);
+
+    // Wait for the RSP to go idle, so that DMEM can be accessed directly
+    rspq_wait();
+    rsp_wait();
+
+    rsp_queue_t dmem_data __attribute__((aligned(16)));
+    rsp_read_data(&dmem_data, sizeof(rsp_queue_t), RSPQ_DATA_ADDRESS);
+
+    // Carry over the saved state, if its size did not change. If the overlay
+    // is loaded, the current state is in DMEM, otherwise it is in RDRAM.
+    void *old_state = rspq_overlay_get_state(old_ucode);
+    void *new_state = rspq_overlay_get_state(overlay_ucode);
+    bool keep_state = old_header->state_size == overlay_header->state_size;
+    bool is_loaded = dmem_data.current_ovl == overlay_index * sizeof(rspq_overlay_t);
+    if (keep_state) {
+        if (is_loaded)
+            rsp_read_data(new_state, old_header->state_size + 1, old_header->state_start & 0xFFF);
+        else
+            memcpy(UncachedAddr(new_state), UncachedAddr(old_state), old_header->state_size + 1);
+    } else {
+        debugf("rspq: state of overlay %s changed size, it has been reset\n", overlay_ucode->name);
+    }
+
+    // Point the descriptor to the new ucode
+    rspq_overlay_t *overlay = &rspq_data.tables.overlay_descriptors[overlay_index];
+    overlay->code = PhysicalAddr(overlay_code);
+    overlay->data = PhysicalAddr(overlay_data);
+    overlay->state = PhysicalAddr(new_state);
+    overlay->code_size = ((uint8_t*)overlay_ucode->code_end - overlay_ucode->code) - rspq_text_size - 1;
+    overlay->data_size = ((uint8_t*)overlay_ucode->data_end - overlay_ucode->data) - rspq_data_size - 1;
+
+    overlay_header->command_base = unshifted_id << 5;
+    data_cache_hit_writeback_invalidate(overlay_header, sizeof(rspq_overlay_header_t));
+    rspq_overlay_ucodes[overlay_index] = overlay_ucode;
+
+    // Update the tables in DMEM. If the old code is loaded, unload it (its
+    // state has already been saved), so that the next command loads the new one.
+    dmem_data.tables = rspq_data.tables;
+    if (is_loaded) {
+        dmem_data.current_ovl = 0;
+        data_cache_hit_writeback(&dummy_header, sizeof(dummy_header));
+        rsp_load_data(&dummy_header, sizeof(dummy_header), rspq_data_size);
+    }
+    data_cache_hit_writeback(&dmem_data, sizeof(rsp_queue_t));
+    rsp_load_data(&dmem_data, sizeof(rsp_queue_t), RSPQ_DATA_ADDRESS);
+}
+
 /**
  * @brief Switch to the next write buffer for the current RSP queue.
  * 
@@ -988,6 +1355,32 @@ void rspq_overlay_unregister(uint32_t overlay_id)
  * we need to switch buffer (double buffering strategy), making sure the
  * other buffer has been already fully executed by the RSP.
  */
+/** @brief Allocate memory for a block chunk, from the current arena or the heap */
+static void* rspq_block_alloc(int size)
+{
+    rspq_block_arena_t *arena = rspq_block_arena;
+    if (!arena)
+        return malloc_uncached(size);
+
+    size = ROUND_UP(size, 16);
+    assertf(size <= arena->page_size, "block chunk too big for arena: %d", size);
+    if (arena->cur_offset + size > arena->page_size) {
+        // Move to the next page, reusing the pages allocated before
+        // the last reset, if any.
+        if (!arena->cur->next) {
+            rspq_block_arena_page_t *page = malloc_uncached(sizeof(rspq_block_arena_page_t) + arena->page_size);
+            page->next = NULL;
+            arena->cur->next = page;
+        }
+        arena->cur = arena->cur->next;
+        arena->cur_offset = 0;
+    }
+
+    void *ptr = arena->cur->data + arena->cur_offset;
+    arena->cur_offset += size;
+    return ptr;
+}
+
 __attribute__((noinline))
 void rspq_next_buffer(void) {
     // If we're creating a block
@@ -998,7 +1391,7 @@ void rspq_next_buffer(void) {
         if (rspq_block_size < RSPQ_BLOCK_MAX_SIZE) rspq_block_size *= 2;
 
         // Allocate a new chunk of the block and switch to it.
-        uint32_t *rspq2 = malloc_uncached(rspq_block_size*sizeof(uint32_t));
+        uint32_t *rspq2 = rspq_block_alloc(rspq_block_size*sizeof(uint32_t));
         volatile uint32_t *prev = rspq_switch_buffer(rspq2, rspq_block_size, true);
 
         // Terminate the previous chunk with a JUMP op to the new chunk.
@@ -1012,21 +1405,35 @@ void rspq_next_buffer(void) {
     // so that the kernel can switch away while waiting. Even
     // if the overhead of an interrupt is obviously higher.
     MEMORY_BARRIER();
+    rspq_buffer_stats.switches++;
     if (!(*SP_STATUS & rspq_ctx->sp_status_bufdone)) {
+        uint32_t t0 = TICKS_READ();
         rspq_flush_internal();
         RSP_WAIT_LOOP(200) {
             if (*SP_STATUS & rspq_ctx->sp_status_bufdone)
                 break;
         }
+        uint32_t elapsed = TICKS_READ() - t0;
+        rspq_buffer_stats.stalls++;
+        rspq_buffer_stats.stall_ticks += elapsed;
+        if (elapsed > rspq_buffer_stats.stall_max)
+            rspq_buffer_stats.stall_max = elapsed;
     }
     MEMORY_BARRIER();
     *SP_STATUS = rspq_ctx->sp_wstatus_clear_bufdone;
     MEMORY_BARRIER();
 
+    // Copy the commands of the full buffer into the capture, if any. The
+    // epilog written below is not part of the stream.
+    if (rspq_ctx == &lowpri)
+        rspq_capture_sync();
+
     // Switch current buffer
     rspq_ctx->buf_idx = 1-rspq_ctx->buf_idx;
     uint32_t *new = rspq_ctx->buffers[rspq_ctx->buf_idx];
     volatile uint32_t *prev = rspq_switch_buffer(new, rspq_ctx->buf_size, true);
+    if (rspq_ctx == &lowpri)
+        rspq_capture_ptr = new;
 
     // Terminate the previous buffer with an op to set SIG_BUFDONE
     // (to notify when the RSP finishes the buffer), plus a jump to
@@ -1063,14 +1470,79 @@ static void rspq_flush_internal(void)
     MEMORY_BARRIER();
 }
 
+bool rspq_isr_write(uint32_t ovl_id, uint32_t cmd_id, const uint32_t *args, int nargs)
+{
+    assertf(nargs <= RSPQ_MAX_SHORT_COMMAND_SIZE, "command too big for rspq_isr_write: %d words", nargs);
+
+    // Reserve a slot. Interrupts are disabled just for the reservation, so
+    // that writers from nested contexts get different slots.
+    disable_interrupts();
+    uint32_t wptr = rspq_isr_wptr;
+    if (wptr - rspq_isr_rptr >= RSPQ_ISR_QUEUE_SLOTS) {
+        enable_interrupts();
+        return false;
+    }
+    rspq_isr_wptr = wptr + 1;
+    enable_interrupts();
+
+    rspq_isr_slot_t *slot = &rspq_isr_slots[wptr & (RSPQ_ISR_QUEUE_SLOTS-1)];
+    slot->cmd[0] = ovl_id + (cmd_id<<24);
+    if (nargs > 0) slot->cmd[0] |= args[0];
+    for (int i = 1; i < nargs; i++)
+        slot->cmd[i] = args[i];
+
+    // Publish the slot by writing its size as last
+    MEMORY_BARRIER();
+    slot->size = nargs > 0 ? nargs : 1;
+    return true;
+}
+
+/** @brief Move the commands published by #rspq_isr_write into the lowpri queue */
+static void rspq_isr_merge(void)
+{
+    if (rspq_ctx != &lowpri) return;
+
+    while (1) {
+        rspq_isr_slot_t *slot = &rspq_isr_slots[rspq_isr_rptr & (RSPQ_ISR_QUEUE_SLOTS-1)];
+        int size = slot->size;
+        if (!size) break;
+        MEMORY_BARRIER();
+
+        rspq_write_t w = rspq_write_begin(0, 0, size);
+        for (int i = 0; i < size; i++)
+            rspq_write_arg(&w, slot->cmd[i]);
+        rspq_write_end(&w);
+
+        // Release the slot. The size must be cleared before the read
+        // pointer is incremented, so that a writer never sees a free
+        // slot still marked as published.
+        slot->size = 0;
+        MEMORY_BARRIER();
+        rspq_isr_rptr++;
+    }
+}
+
 void rspq_flush(void)
 {
     // If we are recording a block, flushes can be ignored.
     if (rspq_block) return;
 
+    rspq_isr_merge();
     rspq_flush_internal();
 }
 
+/**
+ * @brief Check whether a highpri sequence can be started from interrupt context.
+ *
+ * This is not possible while the main thread is itself in highpri mode, or
+ * while it is recording a block. Used by the mixer managed mode
+ * (see #mixer_set_managed).
+ */
+bool __rspq_highpri_available(void)
+{
+    return rspq_ctx == &lowpri && !rspq_block;
+}
+
 void rspq_highpri_begin(void)
 {
     assertf(rspq_ctx != &highpri, "already in highpri mode");
@@ -1107,8 +1579,21 @@ void rspq_highpri_begin(void)
     // add a command in case the previous epilog was skipped. Otherwise,
     // a dummy SIG_HIGHPRI_REQUESTED could stay on and eventually highpri
     // mode would enter once again.
+    // We also generate an interrupt, to track the latency of the yield
+    // (see rspq_sp_interrupt).
     rspq_append1(rspq_cur_pointer, RSPQ_CMD_WRITE_STATUS,
-        SP_WSTATUS_CLEAR_SIG_HIGHPRI_REQUESTED | SP_WSTATUS_SET_SIG_HIGHPRI_RUNNING);
+        SP_WSTATUS_CLEAR_SIG_HIGHPRI_REQUESTED | SP_WSTATUS_SET_SIG_HIGHPRI_RUNNING | SP_WSTATUS_SET_INTR);
+
+    // Start tracking the latency, unless a previous highpri sequence is
+    // still pending: in that case, the two sequences will be merged by the
+    // RSP and are tracked as one.
+    disable_interrupts();
+    if (rspq_highpri_state == RSPQ_HIGHPRI_IDLE) {
+        rspq_highpri_req_ticks = TICKS_READ();
+        rspq_highpri_state = RSPQ_HIGHPRI_REQUESTED;
+    }
+    enable_interrupts();
+
     MEMORY_BARRIER();
     *SP_STATUS = SP_WSTATUS_SET_SIG_HIGHPRI_REQUESTED;
     rspq_flush_internal();
@@ -1125,7 +1610,7 @@ void rspq_highpri_end(void)
     rspq_append1(rspq_cur_pointer, RSPQ_CMD_JUMP, PhysicalAddr(rspq_cur_pointer+1));
     rspq_append3(rspq_cur_pointer, RSPQ_CMD_SWAP_BUFFERS,
         RSPQ_LOWPRI_CALL_SLOT<<2, RSPQ_HIGHPRI_CALL_SLOT<<2,
-        SP_WSTATUS_CLEAR_SIG_HIGHPRI_RUNNING);
+        SP_WSTATUS_CLEAR_SIG_HIGHPRI_RUNNING | SP_WSTATUS_SET_INTR);
     rspq_flush_internal();
     rspq_switch_context(&lowpri);
 }
@@ -1140,15 +1625,54 @@ void rspq_highpri_sync(void)
     }
 }
 
+void rspq_highpri_get_stats(rspq_highpri_stats_t *stats)
+{
+    disable_interrupts();
+    int count = rspq_highpri_stats.count;
+    stats->count = count;
+    stats->yield_min = count ? rspq_highpri_stats.yield_min : 0;
+    stats->yield_max = rspq_highpri_stats.yield_max;
+    stats->yield_avg = count ? rspq_highpri_stats.yield_total / count : 0;
+    stats->done_min = count ? rspq_highpri_stats.done_min : 0;
+    stats->done_max = rspq_highpri_stats.done_max;
+    stats->done_avg = count ? rspq_highpri_stats.done_total / count : 0;
+    enable_interrupts();
+}
+
+void rspq_highpri_reset_stats(void)
+{
+    disable_interrupts();
+    memset(&rspq_highpri_stats, 0, sizeof(rspq_highpri_stats));
+    rspq_highpri_stats.yield_min = rspq_highpri_stats.done_min = UINT32_MAX;
+    enable_interrupts();
+}
+
+void rspq_buffer_get_stats(rspq_buffer_stats_t *stats)
+{
+    *stats = rspq_buffer_stats;
+}
+
+void rspq_buffer_reset_stats(void)
+{
+    memset(&rspq_buffer_stats, 0, sizeof(rspq_buffer_stats));
+}
+
 void rspq_block_begin(void)
+{
+    rspq_block_begin_arena(NULL);
+}
+
+void rspq_block_begin_arena(rspq_block_arena_t *arena)
 {
     assertf(!rspq_block, "a block was already being created");
     assertf(rspq_ctx != &highpri, "cannot create a block in highpri mode");
 
     // Allocate a new block (at minimum size) and initialize it.
+    rspq_block_arena = arena;
     rspq_block_size = RSPQ_BLOCK_MIN_SIZE;
-    rspq_block = malloc_uncached(sizeof(rspq_block_t) + rspq_block_size*sizeof(uint32_t));
+    rspq_block = rspq_block_alloc(sizeof(rspq_block_t) + rspq_block_size*sizeof(uint32_t));
     rspq_block->nesting_level = 0;
+    rspq_block->arena = arena;
 
     // Switch to the block buffer. From now on, all rspq_writes will
     // go into the block.
@@ -1170,11 +1694,15 @@ rspq_block_t* rspq_block_end(void)
     // Return the created block
     rspq_block_t *b = rspq_block;
     rspq_block = NULL;
+    rspq_block_arena = NULL;
     return b;
 }
 
 void rspq_block_free(rspq_block_t *block)
 {
+    // Blocks allocated in an arena are released by rspq_block_arena_reset
+    if (block->arena) return;
+
     // Start from the commands in the first chunk of the block
     int size = RSPQ_BLOCK_MIN_SIZE;
     void *start = block;
@@ -1206,6 +1734,93 @@ void rspq_block_free(rspq_block_t *block)
     }
 }
 
+rspq_block_param_t rspq_block_param(void)
+{
+    assertf(rspq_block, "rspq_block_param can only be called while creating a block");
+
+    // Commands are always written fully within the current chunk (the
+    // sentinel guarantees enough room), so the next command will start
+    // exactly at the current write pointer.
+    return (rspq_block_param_t){ .cmd = rspq_cur_pointer };
+}
+
+void rspq_block_patch(rspq_block_param_t param, int word, uint32_t value)
+{
+    assertf(param.cmd, "invalid block parameter");
+
+    // Block memory is uncached, so the RSP will see the new value
+    // without any cache writeback. Preserve the command ID byte in
+    // the first word.
+    if (word == 0)
+        value = (param.cmd[0] & 0xFF000000) | (value & 0x00FFFFFF);
+    param.cmd[word] = value;
+}
+
+void rspq_block_get_stats(rspq_block_t *block, rspq_block_stats_t *stats)
+{
+    memset(stats, 0, sizeof(rspq_block_stats_t));
+
+    // Walk the chunks like rspq_block_free does
+    int size = RSPQ_BLOCK_MIN_SIZE;
+    uint32_t *start = block->cmds;
+    while (1) {
+        uint32_t *ptr = start + size;
+        while (*--ptr == 0x00) {}
+        uint32_t cmd = *ptr;
+
+        int used = ptr - start + 1;
+        stats->chunks++;
+        stats->bytes_used += used * sizeof(uint32_t);
+        stats->bytes_wasted += (size - used) * sizeof(uint32_t);
+
+        if (cmd>>24 == RSPQ_CMD_RET)
+            return;
+        assertf(cmd>>24 == RSPQ_CMD_JUMP, "invalid terminator command in block: %08lx\n", cmd);
+
+        start = UncachedAddr(0x80000000 | (cmd & 0xFFFFFF));
+        if (size < RSPQ_BLOCK_MAX_SIZE) size *= 2;
+    }
+}
+
+rspq_block_arena_t* rspq_block_arena_new(int page_size)
+{
+    // Each page must be able to contain at least the biggest chunk. Chunk
+    // sizes are doubled until they exceed RSPQ_BLOCK_MAX_SIZE, so they
+    // are always smaller than twice that.
+    int min_size = ROUND_UP(sizeof(rspq_block_t) + RSPQ_BLOCK_MAX_SIZE*2*sizeof(uint32_t), 16);
+    if (page_size < min_size) page_size = min_size;
+
+    rspq_block_arena_t *arena = malloc(sizeof(rspq_block_arena_t));
+    arena->page_size = ROUND_UP(page_size, 16);
+    arena->first = malloc_uncached(sizeof(rspq_block_arena_page_t) + arena->page_size);
+    arena->first->next = NULL;
+    arena->cur = arena->first;
+    arena->cur_offset = 0;
+    return arena;
+}
+
+void rspq_block_arena_reset(rspq_block_arena_t *arena)
+{
+    assertf(!rspq_block || rspq_block->arena != arena, "cannot reset an arena while creating a block in it");
+
+    // Keep all the pages, so that they are reused by the next allocations.
+    arena->cur = arena->first;
+    arena->cur_offset = 0;
+}
+
+void rspq_block_arena_free(rspq_block_arena_t *arena)
+{
+    assertf(!rspq_block || rspq_block->arena != arena, "cannot free an arena while creating a block in it");
+
+    rspq_block_arena_page_t *page = arena->first;
+    while (page) {
+        rspq_block_arena_page_t *next = page->next;
+        free_uncached(page);
+        page = next;
+    }
+    free(arena);
+}
+
 void rspq_block_run(rspq_block_t *block)
 {
     // TODO: add support for block execution in highpri mode. This would be
@@ -1219,6 +1834,12 @@ void rspq_block_run(rspq_block_t *block)
     // which is used as stack slot in the RSP to save the current
     // pointer position.
     rspq_int_write(RSPQ_CMD_CALL, PhysicalAddr(block->cmds), block->nesting_level << 2);
+    __rspq_epoch++;
+
+    // A captured frame is replayed as a block (see rspq_capture_replay), so
+    // it must be able to call the blocks called here.
+    assertf(!rspq_capture || rspq_block || block->nesting_level < RSPQ_CAPTURE_NESTING_LEVEL,
+        "block nesting level too deep to be captured");
 
     // If this is CALL within the creation of a block, update
     // the nesting level. A block's nesting level must be bigger
@@ -1239,9 +1860,13 @@ rspq_syncpoint_t rspq_syncpoint_new(void)
 {   
     assertf(!rspq_block, "cannot create syncpoint in a block");
     assertf(rspq_ctx != &highpri, "cannot create syncpoint in highpri mode");
+    rspq_isr_merge();
     rspq_int_write(RSPQ_CMD_TEST_WRITE_STATUS, 
         SP_WSTATUS_SET_INTR | SP_WSTATUS_SET_SIG_SYNCPOINT,
         SP_STATUS_SIG_SYNCPOINT);
+    prof_zone_mark(PROF_TRACK_CPU, "syncpoint_new");
+    if (rspq_capture)
+        rspq_capture->frame_syncpoints++;
     return ++rspq_syncpoints_genid;
 }
 
@@ -1262,15 +1887,64 @@ void rspq_syncpoint_wait(rspq_syncpoint_t sync_id)
     // Make sure the RSP is running, otherwise we might be blocking forever.
     rspq_flush_internal();
 
-    // Spinwait until the the syncpoint is reached.
-    // TODO: with the kernel, it will be possible to wait for the RSP interrupt
-    // to happen, without spinwaiting.
+    // Wait until the the syncpoint is reached. RSP_WAIT_LOOP gives the CPU
+    // to other threads meanwhile, if the kernel is active.
     RSP_WAIT_LOOP(200) {
         if (rspq_syncpoint_check(sync_id))
             break;
     }
 }
 
+void rspq_syncpoint_on_done(rspq_syncpoint_t sync_id, void (*cb)(void *ctx), void *ctx)
+{
+    assertf(cb, "callback cannot be NULL");
+
+    disable_interrupts();
+
+    // If the syncpoint was already reached, run the callback immediately.
+    // Interrupts are disabled, so this is consistent with callbacks called
+    // by the interrupt handler.
+    if (rspq_syncpoint_check(sync_id)) {
+        cb(ctx);
+        enable_interrupts();
+        return;
+    }
+
+    int i;
+    for (i = 0; i < RSPQ_MAX_SYNCPOINT_CALLBACKS; i++) {
+        if (!rspq_syncpoint_cbs[i].cb) {
+            rspq_syncpoint_cbs[i] = (rspq_syncpoint_cb_t){ .sync_id = sync_id, .cb = cb, .ctx = ctx };
+            break;
+        }
+    }
+    enable_interrupts();
+    assertf(i < RSPQ_MAX_SYNCPOINT_CALLBACKS, "too many pending syncpoint callbacks");
+
+    // Make sure the RSP is running, so that the syncpoint is eventually reached
+    rspq_flush();
+}
+
+void rspq_overlay_stats_next_frame(void)
+{
+    assertf(!rspq_block, "cannot collect overlay statistics while creating a block");
+
+    // Copy the counters into RDRAM, and then reset them. Both DMA transfers
+    // are done by the RSP in order with the other commands, so no switch
+    // can be lost between them.
+    rspq_dma_to_rdram(&rspq_ovl_stats, RSPQ_DATA_ADDRESS + offsetof(rsp_queue_t, ovl_switch_count),
+        sizeof(rspq_overlay_stats_t), false);
+    rspq_dma_to_dmem(RSPQ_DATA_ADDRESS + offsetof(rsp_queue_t, ovl_switch_count),
+        (void*)rspq_ovl_stats_zero, sizeof(rspq_overlay_stats_t), false);
+    rspq_flush();
+}
+
+void rspq_overlay_get_stats(rspq_overlay_stats_t *stats)
+{
+    volatile rspq_overlay_stats_t *ustats = UncachedAddr(&rspq_ovl_stats);
+    stats->switches = ustats->switches;
+    stats->bytes = ustats->bytes;
+}
+
 void rspq_signal(uint32_t signal)
 {
     const uint32_t allowed_mask = SP_WSTATUS_CLEAR_SIG0|SP_WSTATUS_SET_SIG0|SP_WSTATUS_CLEAR_SIG1|SP_WSTATUS_SET_SIG1;
@@ -1294,8 +1968,297 @@ void rspq_dma_to_dmem(uint32_t dmem_addr, void *rdram_addr, uint32_t len, bool i
     rspq_dma(rdram_addr, dmem_addr, len - 1, is_async ? 0 : SP_STATUS_DMA_BUSY | SP_STATUS_DMA_FULL);
 }
 
+void rspq_dma_list(rspq_dma_desc_t *list, int count)
+{
+    assertf(count > 0, "empty DMA list");
+    assertf(((uint32_t)list & 7) == 0, "DMA list must be aligned to 8 bytes");
+
+    data_cache_hit_writeback(list, count * sizeof(rspq_dma_desc_t));
+    rspq_int_write(RSPQ_CMD_DMA_LIST, PhysicalAddr(list), count);
+}
+
+/** @brief Read all the profile samples written so far by the RSP, and accumulate them. */
+static void rspq_profile_drain(void)
+{
+    if (!rspq_profile_ring)
+        return;
+
+    while (1) {
+        volatile uint32_t *sample = &rspq_profile_ring[(rspq_profile_seq & (RSPQ_PROFILE_RING_SIZE-1)) * 2];
+
+        // Compare the sequence number of the sample with the expected one. If
+        // it is older, the RSP has not written this sample yet. If it is newer,
+        // the RSP has wrapped around the ring buffer and overwritten samples
+        // that we did not read in time.
+        uint32_t seq = sample[1];
+        int32_t diff = seq - rspq_profile_seq;
+        if (diff < 0)
+            break;
+        rspq_profile_data.dropped_samples += diff;
+
+        uint32_t value = sample[0];
+        rspq_profile_cmd_t *cmd = &rspq_profile_data.commands[value >> 24];
+        cmd->total_cycles += value & 0xFFFFFF;
+        cmd->calls += 1;
+        rspq_profile_data.total_cycles += value & 0xFFFFFF;
+
+        rspq_profile_seq = seq + 1;
+    }
+}
+
+/**
+ * @brief Enqueue a DMA that configures the profiling state in DMEM.
+ * 
+ * @param cfg         Buffer used as DMA source (2 words, must stay untouched
+ *                    until the RSP executes the DMA)
+ * @param rdram_addr  Address of the ring buffer, or 0 to disable profiling
+ */
+static void rspq_profile_configure(uint32_t *cfg, uint32_t rdram_addr)
+{
+    assertf(!rspq_block, "cannot change profiling state while creating a block");
+
+    // Write through the uncached segment, so that the DMA will see the data.
+    volatile uint32_t *ucfg = UncachedAddr(cfg);
+    ucfg[0] = rdram_addr;
+    ucfg[1] = rspq_profile_seq;
+#if RSPQ_PROFILE
+    rspq_dma_to_dmem(RSPQ_DATA_ADDRESS + offsetof(rsp_queue_t, rspq_profile_rdram),
+        cfg, 2*sizeof(uint32_t), false);
+#endif
+}
+
+void rspq_profile_start(void)
+{
+    assertf(RSPQ_PROFILE, "rspq profiling is not available: set RSPQ_PROFILE to 1 in rspq_constants.h");
+
+    if (!rspq_profile_ring) {
+        rspq_profile_ring = malloc_uncached(RSPQ_PROFILE_RING_SIZE * 2 * sizeof(uint32_t));
+        memset((void*)rspq_profile_ring, 0, RSPQ_PROFILE_RING_SIZE * 2 * sizeof(uint32_t));
+        rspq_profile_seq = 1;
+    }
+
+    static uint32_t cfg_start[2] __attribute__((aligned(16)));
+    rspq_profile_configure(cfg_start, PhysicalAddr(rspq_profile_ring));
+    rspq_flush();
+}
+
+void rspq_profile_stop(void)
+{
+    assertf(RSPQ_PROFILE, "rspq profiling is not available: set RSPQ_PROFILE to 1 in rspq_constants.h");
+
+    static uint32_t cfg_stop[2] __attribute__((aligned(16)));
+    rspq_profile_configure(cfg_stop, 0);
+
+    // Wait for the RSP to stop profiling, so that all the samples are
+    // available in the ring buffer, and read them.
+    rspq_wait();
+    rspq_profile_drain();
+}
+
+void rspq_profile_reset(void)
+{
+    rspq_profile_drain();
+    memset(&rspq_profile_data, 0, sizeof(rspq_profile_data));
+}
+
+void rspq_profile_next_frame(void)
+{
+    rspq_profile_drain();
+    rspq_profile_data.frame_count++;
+}
+
+void rspq_profile_get_data(rspq_profile_data_t *data)
+{
+    rspq_profile_drain();
+    memcpy(data, &rspq_profile_data, sizeof(rspq_profile_data_t));
+
+    // Resolve the command IDs into overlay names and indices, using the
+    // current overlay table.
+    for (int i = 0; i < RSPQ_PROFILE_CMD_COUNT; i++) {
+        int id = i >> 4;
+        int ovl_idx = rspq_data.tables.overlay_table[id] / sizeof(rspq_overlay_t);
+
+        // An overlay with more than 16 commands spans multiple consecutive
+        // IDs: find the first one to compute the command index.
+        int base_id = id;
+        while (ovl_idx != 0 && base_id > 1 && rspq_data.tables.overlay_table[base_id-1] == rspq_data.tables.overlay_table[id])
+            base_id--;
+
+        data->commands[i].overlay_name = (id == 0 || ovl_idx != 0) ? rspq_get_ovl_name(ovl_idx) : "?";
+        data->commands[i].overlay_cmd_index = i - (base_id << 4);
+    }
+}
+
+void rspq_profile_dump(void)
+{
+    static rspq_profile_data_t data;
+    rspq_profile_get_data(&data);
+
+    uint32_t frames = data.frame_count ? data.frame_count : 1;
+
+    debugf("RSPQ profile: %lu frames, %llu cycles/frame, %lu dropped samples\n",
+        data.frame_count, data.total_cycles / frames, data.dropped_samples);
+    debugf("%-20s %10s %12s %10s %6s\n", "command", "calls/frame", "cycles/frame", "avg", "%");
+    for (int i = 0; i < RSPQ_PROFILE_CMD_COUNT; i++) {
+        rspq_profile_cmd_t *cmd = &data.commands[i];
+        if (!cmd->calls)
+            continue;
+
+        char name[32];
+        snprintf(name, sizeof(name), "%s:%02x", cmd->overlay_name, cmd->overlay_cmd_index);
+        debugf("%-20s %10lu %12llu %10llu %6.2f\n", name,
+            cmd->calls / frames, cmd->total_cycles / frames,
+            cmd->total_cycles / cmd->calls,
+            data.total_cycles ? (float)cmd->total_cycles * 100.0f / (float)data.total_cycles : 0.0f);
+    }
+}
+
+/** @brief Copy the lowpri commands written since the last call into the capture in progress */
+static void rspq_capture_sync(void)
+{
+    if (!rspq_capture)
+        return;
+
+    // While a block is being created or a highpri sequence is running, the
+    // lowpri write pointer is saved in its context.
+    volatile uint32_t *cur = rspq_ctx == &lowpri ? rspq_cur_pointer : lowpri.cur;
+    int n = cur - rspq_capture_ptr;
+    rspq_capture_t *cap = rspq_capture;
+
+    // Keep room for the RET and padding that terminate the frame
+    if (!cap->overflow && cap->num_words + n + 2 > cap->max_words)
+        cap->overflow = true;
+    if (!cap->overflow) {
+        for (int i = 0; i < n; i++)
+            cap->words[cap->num_words + i] = rspq_capture_ptr[i];
+        cap->num_words += n;
+    }
+    rspq_capture_ptr = cur;
+}
+
+rspq_capture_t* rspq_capture_start(int max_words)
+{
+    assertf(!rspq_capture, "a capture is already in progress");
+    assertf(rspq_ctx == &lowpri && !rspq_block, "cannot start a capture in highpri mode or while creating a block");
+    assertf(max_words >= 2, "invalid capture size: %d", max_words);
+
+    rspq_capture_t *cap = calloc(1, sizeof(rspq_capture_t));
+    cap->words = memalign(16, max_words * sizeof(uint32_t));
+    assertf(cap->words, "out of memory for rspq capture (%d words)", max_words);
+    cap->max_words = max_words;
+    memcpy(cap->overlay_table, rspq_data.tables.overlay_table, sizeof(cap->overlay_table));
+
+    rspq_capture = cap;
+    rspq_capture_ptr = rspq_cur_pointer;
+    return cap;
+}
+
+void rspq_capture_next_frame(void)
+{
+    rspq_capture_t *cap = rspq_capture;
+    if (!cap)
+        return;
+
+    rspq_capture_sync();
+    if (cap->overflow)
+        return;
+
+    // Terminate the frame with a RET, so that it can be called like a block.
+    // Frames start 8-byte aligned, as required by the RSP DMA.
+    cap->words[cap->num_words++] = (RSPQ_CMD_RET << 24) | (RSPQ_CAPTURE_NESTING_LEVEL << 2);
+    if (cap->num_words & 1)
+        cap->words[cap->num_words++] = 0;
+
+    if (cap->num_frames == cap->max_frames) {
+        cap->max_frames = cap->max_frames ? cap->max_frames * 2 : 16;
+        cap->frames = realloc(cap->frames, cap->max_frames * sizeof(rspq_capture_frame_t));
+        assertf(cap->frames, "out of memory for rspq capture");
+    }
+    cap->frames[cap->num_frames++] = (rspq_capture_frame_t){
+        .offset = cap->frame_start,
+        .size = cap->num_words - cap->frame_start,
+        .syncpoints = cap->frame_syncpoints,
+    };
+    cap->frame_start = cap->num_words;
+    cap->frame_syncpoints = 0;
+}
+
+void rspq_capture_stop(void)
+{
+    assertf(rspq_capture, "no capture in progress");
+
+    // Drop the frame in progress, which is incomplete
+    rspq_capture->num_words = rspq_capture->frame_start;
+    rspq_capture = NULL;
+}
+
+int rspq_capture_get_frame_count(rspq_capture_t *cap)
+{
+    return cap->num_frames;
+}
+
+bool rspq_capture_is_truncated(rspq_capture_t *cap)
+{
+    return cap->overflow;
+}
+
+uint32_t rspq_capture_replay(rspq_capture_t *cap, int frame)
+{
+    assertf(cap != rspq_capture, "cannot replay a capture in progress");
+    assertf(rspq_ctx == &lowpri && !rspq_block, "cannot replay a capture in highpri mode or while creating a block");
+    assertf(frame >= 0 && frame < cap->num_frames, "invalid frame: %d (frames: %d)", frame, cap->num_frames);
+    assertf(memcmp(cap->overlay_table, rspq_data.tables.overlay_table, sizeof(cap->overlay_table)) == 0,
+        "overlays were registered or unregistered after the capture");
+
+    rspq_capture_frame_t *f = &cap->frames[frame];
+    data_cache_hit_writeback(cap->words + f->offset, f->size * sizeof(uint32_t));
+
+    rspq_wait();
+    uint32_t t0 = TICKS_READ();
+    rspq_int_write(RSPQ_CMD_CALL, PhysicalAddr(cap->words + f->offset), RSPQ_CAPTURE_NESTING_LEVEL << 2);
+    __rspq_epoch++;
+
+    // The syncpoints of the frame raise their interrupts again: account
+    // for them, so that the new syncpoints get the IDs they are waited on.
+    rspq_syncpoints_genid += f->syncpoints;
+    rspq_wait();
+    return TICKS_READ() - t0;
+}
+
+bool rspq_capture_save(rspq_capture_t *cap, const char *fn)
+{
+    FILE *f = fopen(fn, "wb");
+    if (!f)
+        return false;
+
+    // Header: magic, counts, then the overlay registered at each ID
+    uint32_t header[3] = { RSPQ_CAPTURE_MAGIC, cap->num_frames, cap->num_words };
+    bool ok = fwrite(header, sizeof(header), 1, f) == 1;
+    for (int id = 0; id < RSPQ_OVERLAY_TABLE_SIZE; id++) {
+        char name[32] = {0};
+        int ovl_idx = cap->overlay_table[id] / sizeof(rspq_overlay_t);
+        if (id == 0 || ovl_idx != 0)
+            strncpy(name, rspq_get_ovl_name(ovl_idx), sizeof(name)-1);
+        ok = ok && fwrite(name, sizeof(name), 1, f) == 1;
+    }
+    ok = ok && fwrite(cap->frames, sizeof(rspq_capture_frame_t), cap->num_frames, f) == (size_t)cap->num_frames;
+    ok = ok && fwrite(cap->words, sizeof(uint32_t), cap->num_words, f) == (size_t)cap->num_words;
+    if (fclose(f) != 0)
+        ok = false;
+    return ok;
+}
+
+void rspq_capture_free(rspq_capture_t *cap)
+{
+    assertf(cap != rspq_capture, "cannot free a capture in progress");
+    free(cap->words);
+    free(cap->frames);
+    free(cap);
+}
 
 /* Extern inline instantiations. */
 extern inline rspq_write_t rspq_write_begin(uint32_t ovl_id, uint32_t cmd_id, int size);
 extern inline void rspq_write_arg(rspq_write_t *w, uint32_t value);
 extern inline void rspq_write_end(rspq_write_t *w);
+extern inline rspq_dma_desc_t rspq_dma_desc_to_dmem(uint32_t dmem_addr, void *rdram_addr, uint32_t len);
+extern inline rspq_dma_desc_t rspq_dma_desc_to_rdram(void *rdram_addr, uint32_t dmem_addr, uint32_t len);
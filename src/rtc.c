@@ -8,6 +8,8 @@
 #include <time.h>
 #include "libdragon.h"
 #include "system.h"
+#include "joybus_internal.h"
+#include "boot_profile_internal.h"
 
 /**
  * @defgroup rtc Real-Time Clock Subsystem
@@ -34,6 +36,17 @@
  * To check if the real-time clock supports writes, call #rtc_is_writable.
  * To write a new time to the real-time clock, call #rtc_set.
  *
+ * #rtc_set busy-waits for more than half a second while the RTC processes the
+ * writes. #rtc_set_async and #rtc_get_async perform the same operations
+ * through the joybus queue, with the delays driven by the @ref timer, so
+ * they can be used without affecting the frame rate.
+ *
+ * #rtc_get (and so `time`) does not read the RTC on each call: a software
+ * clock is interpolated with the CPU ticks from the last RTC reading, and it
+ * is resynchronized every second with an asynchronous joybus read. The only
+ * blocking read happens when there is no reading yet (eg: at the first call
+ * after #rtc_init_async).
+ *
  * This subsystem handles decoding and encoding the date/time from its internal
  * format into a struct called #rtc_time_t, which contains integer values for
  * year, month, day-of-month, day-of-week, hour, minute, and second.
@@ -154,17 +167,31 @@
 #define JOYBUS_RTC_CONTROL_MODE_RUN 0x0300
 
 /**
- * @brief Invalidate the most-recent RTC time cache after 1 second.
+ * @brief Resynchronize the software clock with the RTC every second.
+ */
+#define RTC_RESYNC_TICKS (TICKS_PER_SECOND)
+
+/**
+ * @brief Tick counter state (see #timer_ticks) at #rtc_clock_secs.
+ *
+ * Set to 0 when the software clock is not synchronized with the RTC.
  */
-#define RTC_GET_CACHE_INVALIDATE_TICKS (TICKS_PER_SECOND)
+static volatile int64_t rtc_clock_ticks = 0;
 
 /**
- * @brief Tick counter state when #rtc_get cache was last updated.
+ * @brief Time of the software clock at #rtc_clock_ticks, in seconds since 1970.
+ */
+static int64_t rtc_clock_secs = 0;
+
+/**
+ * @brief Incremented whenever the software clock is reset.
  *
- * Set to 0 to manually invalidate the #rtc_get cache.
- * Cache will invalidate every #RTC_GET_CACHE_INVALIDATE_TICKS.
+ * Asynchronous resyncs started before a reset are discarded.
  */
-static int64_t rtc_get_cache_ticks = 0;
+static volatile uint32_t rtc_clock_gen = 0;
+
+/** @brief Whether an asynchronous resync of the software clock is in flight */
+static volatile bool rtc_resync_pending = false;
 
 /**
  * @brief Real-time clock detection values.
@@ -220,6 +247,39 @@ static uint8_t byte_to_bcd(uint8_t byte)
 static const uint8_t DAYS_IN_MONTH[] =
     {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
 
+/** @brief Joybus block that reads the RTC status. */
+static const uint64_t joybus_rtc_status_input[JOYBUS_BLOCK_DWORDS] =
+{
+    0x00000000ff010306,
+    0xfffffffe00000000,
+    0,
+    0,
+    0,
+    0,
+    0,
+    1
+};
+
+/**
+ * @brief Extract the RTC status from the output of #joybus_rtc_status_input.
+ *
+ * @param[in]   output
+ *              Joybus output block
+ *
+ * @return the normalized Joybus real-time clock status response data
+ */
+static uint32_t joybus_rtc_parse_status( const uint64_t * output )
+{
+    const uint8_t * recv_bytes = (const uint8_t *)&output[1];
+
+    return (
+        /* Intentional un-swap of identifier bytes */
+        ((uint32_t)recv_bytes[1] << 16) |
+        ((uint32_t)recv_bytes[0] << 8)  |
+        recv_bytes[2]
+    );
+}
+
 /**
  * @brief Read the status of the Joybus real-time clock.
  *
@@ -234,29 +294,40 @@ static const uint8_t DAYS_IN_MONTH[] =
  */
 static uint32_t joybus_rtc_status( void )
 {
-    const uint64_t input[JOYBUS_BLOCK_DWORDS] =
+    uint64_t output[JOYBUS_BLOCK_DWORDS];
+
+    joybus_exec( joybus_rtc_status_input, output );
+
+    return joybus_rtc_parse_status( output );
+}
+
+/**
+ * @brief Prepare the joybus block that reads a block of the Joybus RTC.
+ *
+ * The block data will be in output[1] and the status byte in the
+ * top byte of output[2].
+ *
+ * @param[out]  input
+ *              Joybus input block to prepare
+ * @param[in]   block
+ *              Which RTC block to read from (0-2)
+ */
+static void joybus_rtc_read_init( uint64_t * input, uint8_t block )
+{
+    assert(block <= 2);
+
+    const uint64_t blank[JOYBUS_BLOCK_DWORDS] =
     {
-        0x00000000ff010306,
-        0xfffffffe00000000,
-        0,
+        0x0000000002090700 | block,
+        0xffffffffffffffff,
+        0xfffe000000000000,
         0,
         0,
         0,
         0,
         1
     };
-    uint64_t output[JOYBUS_BLOCK_DWORDS];
-
-    joybus_exec( input, output );
-
-    uint8_t * recv_bytes = (uint8_t *)&output[1];
-
-    return (
-        /* Intentional un-swap of identifier bytes */
-        ((uint32_t)recv_bytes[1] << 16) |
-        ((uint32_t)recv_bytes[0] << 8)  |
-        recv_bytes[2]
-    );
+    memcpy( input, blank, JOYBUS_BLOCK_SIZE );
 }
 
 /**
@@ -275,21 +346,11 @@ static uint32_t joybus_rtc_status( void )
  */
 static uint8_t joybus_rtc_read( uint8_t block, uint64_t * data )
 {
-    assert(block <= 2);
-
-    uint64_t input[JOYBUS_BLOCK_DWORDS] =
-    {
-        0x0000000002090700 | block,
-        0xffffffffffffffff,
-        0xfffe000000000000,
-        0,
-        0,
-        0,
-        0,
-        1
-    };
+    uint64_t input[JOYBUS_BLOCK_DWORDS];
     uint64_t output[JOYBUS_BLOCK_DWORDS];
 
+    joybus_rtc_read_init( input, block );
+
     joybus_exec( input, output );
 
     *data = output[1];
@@ -298,27 +359,25 @@ static uint8_t joybus_rtc_read( uint8_t block, uint64_t * data )
 }
 
 /**
- * @brief Write a block of data to the Joybus real-time clock.
+ * @brief Prepare the joybus block that writes a block of the Joybus RTC.
  *
- * This is a low-level utility function that is used by
- * #joybus_rtc_write_control and #joybus_rtc_write_time.
+ * The status byte will be in the top byte of output[2].
  *
+ * @param[out]  input
+ *              Joybus input block to prepare
  * @param[in]   block
  *              Which RTC block to write to (0-2)
- *
- * @param[out]  data
+ * @param[in]   data
  *              RTC block data to write
- *
- * @return the status byte from the Joybus real-time clock
  */
-static uint8_t joybus_rtc_write( uint8_t block, const uint64_t * data )
+static void joybus_rtc_write_init( uint64_t * input, uint8_t block, uint64_t data )
 {
     assert(block <= 2);
 
-    uint64_t input[JOYBUS_BLOCK_DWORDS] =
+    const uint64_t blank[JOYBUS_BLOCK_DWORDS] =
     {
         0x000000000A010800 | block,
-        *data,
+        data,
         0xfffe000000000000,
         0,
         0,
@@ -326,8 +385,30 @@ static uint8_t joybus_rtc_write( uint8_t block, const uint64_t * data )
         0,
         1
     };
+    memcpy( input, blank, JOYBUS_BLOCK_SIZE );
+}
+
+/**
+ * @brief Write a block of data to the Joybus real-time clock.
+ *
+ * This is a low-level utility function that is used by
+ * #joybus_rtc_write_control and #joybus_rtc_write_time.
+ *
+ * @param[in]   block
+ *              Which RTC block to write to (0-2)
+ *
+ * @param[out]  data
+ *              RTC block data to write
+ *
+ * @return the status byte from the Joybus real-time clock
+ */
+static uint8_t joybus_rtc_write( uint8_t block, const uint64_t * data )
+{
+    uint64_t input[JOYBUS_BLOCK_DWORDS];
     uint64_t output[JOYBUS_BLOCK_DWORDS];
 
+    joybus_rtc_write_init( input, block, *data );
+
     joybus_exec( input, output );
 
     return output[2] >> 56;
@@ -379,20 +460,15 @@ static void joybus_rtc_read_control( uint16_t * control, uint32_t * calibration
 }
 
 /**
- * @brief Read the current date/time from the Joybus real-time clock.
- *
- * The result of calling this function when the Joybus RTC is not
- * present is undefined and may not be safe. #rtc_get will not
- * call this function if the Joybus RTC was not detected.
+ * @brief Decode the contents of Joybus RTC block 2 into a date/time.
  *
+ * @param[in]   data
+ *              RTC block 2 data
  * @param[out]  rtc_time
  *              Destination pointer for the RTC time data structure
  */
-static void joybus_rtc_read_time( rtc_time_t * rtc_time )
+static void joybus_rtc_decode_time( uint64_t data, rtc_time_t * rtc_time )
 {
-    uint64_t data;
-    joybus_rtc_read( 2, &data );
-
     uint8_t * bytes = (uint8_t *)&data;
 
     rtc_time->sec = bcd_to_byte(bytes[0]);
@@ -406,6 +482,24 @@ static void joybus_rtc_read_time( rtc_time_t * rtc_time )
     rtc_time->year += 1900;
 }
 
+/**
+ * @brief Read the current date/time from the Joybus real-time clock.
+ *
+ * The result of calling this function when the Joybus RTC is not
+ * present is undefined and may not be safe. #rtc_get will not
+ * call this function if the Joybus RTC was not detected.
+ *
+ * @param[out]  rtc_time
+ *              Destination pointer for the RTC time data structure
+ */
+static void joybus_rtc_read_time( rtc_time_t * rtc_time )
+{
+    uint64_t data;
+    joybus_rtc_read( 2, &data );
+
+    joybus_rtc_decode_time( data, rtc_time );
+}
+
 /**
  * @brief Write the control block to the Joybus real-time clock.
  *
@@ -445,6 +539,32 @@ static void joybus_rtc_write_control( uint16_t control, uint32_t calibration )
     joybus_rtc_write( 0, &data );
 }
 
+/**
+ * @brief Encode a date/time into the Joybus RTC block 2 format.
+ *
+ * @param[in]  rtc_time
+ *             Source pointer for the RTC time data structure
+ *
+ * @return the RTC block 2 data
+ */
+static uint64_t joybus_rtc_encode_time( const rtc_time_t * rtc_time )
+{
+    uint64_t data;
+    uint8_t * bytes = (uint8_t *)&data;
+
+    int year = rtc_time->year - 1900;
+    bytes[0] = byte_to_bcd(rtc_time->sec);
+    bytes[1] = byte_to_bcd(rtc_time->min);
+    bytes[2] = byte_to_bcd(rtc_time->hour) + 0x80;
+    bytes[3] = byte_to_bcd(rtc_time->day);
+    bytes[4] = byte_to_bcd(rtc_time->week_day);
+    bytes[5] = byte_to_bcd(rtc_time->month + 1);
+    bytes[6] = byte_to_bcd(year);
+    bytes[7] = byte_to_bcd(year / 100);
+
+    return data;
+}
+
 /**
  * @brief Write a new date/time to the Joybus real-time clock.
  *
@@ -477,22 +597,89 @@ static void joybus_rtc_write_control( uint16_t control, uint32_t calibration )
  */
 static void joybus_rtc_write_time( const rtc_time_t * rtc_time )
 {
-    uint64_t data;
-    uint8_t * bytes = (uint8_t *)&data;
+    uint64_t data = joybus_rtc_encode_time( rtc_time );
+    joybus_rtc_write( 2, &data );
+}
 
-    int year = rtc_time->year - 1900;
-    bytes[0] = byte_to_bcd(rtc_time->sec);
-    bytes[1] = byte_to_bcd(rtc_time->min);
-    bytes[2] = byte_to_bcd(rtc_time->hour) + 0x80;
-    bytes[3] = byte_to_bcd(rtc_time->day);
-    bytes[4] = byte_to_bcd(rtc_time->week_day);
-    bytes[5] = byte_to_bcd(rtc_time->month + 1);
-    bytes[6] = byte_to_bcd(year);
-    bytes[7] = byte_to_bcd(year / 100);
+/**
+ * @brief Steps of the asynchronous RTC state machine.
+ *
+ * Each step names the joybus reply or timer expiration that is being
+ * waited for.
+ */
+typedef enum rtc_async_step_t
+{
+    /** @brief No asynchronous operation in progress */
+    RTC_ASYNC_IDLE = 0,
+    /** @brief Waiting for the block 2 read of #rtc_get_async */
+    RTC_ASYNC_GET_TIME,
+    /** @brief Waiting for the control block read */
+    RTC_ASYNC_SET_READ_CONTROL,
+    /** @brief Waiting for the control block write that stops the clock */
+    RTC_ASYNC_SET_STOP,
+    /** @brief Waiting to check that the clock is stopped */
+    RTC_ASYNC_SET_CHECK_STOPPED,
+    /** @brief Waiting for the block 2 write */
+    RTC_ASYNC_SET_WRITE_TIME,
+    /** @brief Waiting to write the control block that resumes the clock */
+    RTC_ASYNC_SET_RUN,
+    /** @brief Waiting to check that the clock is running again */
+    RTC_ASYNC_SET_CHECK_RUNNING,
+    /** @brief Waiting for the new time to be visible on the SI */
+    RTC_ASYNC_SET_FINISH,
+    /** @brief Waiting for the status reply that detects the RTC */
+    RTC_ASYNC_INIT_STATUS,
+    /** @brief Waiting for the control block read of #rtc_init_async */
+    RTC_ASYNC_INIT_READ_CONTROL,
+    /** @brief Waiting for the control block write that starts the clock */
+    RTC_ASYNC_INIT_RUN,
+    /** @brief Waiting for the control block write to complete */
+    RTC_ASYNC_INIT_FINISH,
+} rtc_async_step_t;
+
+/** @brief State of the asynchronous RTC operation in progress */
+static struct
+{
+    /** @brief Current step */
+    volatile rtc_async_step_t step;
+    /** @brief Calibration data read from the control block */
+    uint32_t calibration;
+    /** @brief Encoded block 2 data being written */
+    uint64_t time_data;
+    /** @brief Date/time being written */
+    rtc_time_t time;
+    /** @brief Destination of #rtc_get_async */
+    rtc_time_t * dest;
+    /** @brief User completion callback */
+    rtc_callback_t callback;
+    /** @brief Opaque pointer passed to the callback */
+    void * ctx;
+} rtc_async;
+
+/** @brief Timer used for the inter-command delays of asynchronous operations */
+static timer_link_t rtc_async_timer;
+
+static void rtc_async_joybus_cb( uint64_t * output, void * ctx );
+static void rtc_async_timer_cb( int ovfl );
 
-    joybus_rtc_write( 2, &data );
+/**
+ * @brief Complete the asynchronous RTC operation in progress.
+ *
+ * @param[in]   success
+ *              Value forwarded to the user callback
+ */
+static void rtc_async_finish( bool success )
+{
+    rtc_callback_t callback = rtc_async.callback;
+    void * ctx = rtc_async.ctx;
+
+    rtc_async.step = RTC_ASYNC_IDLE;
+    if( callback ) callback( success, ctx );
 }
 
+/** @brief Cached result of the RTC detection (see #rtc_present) */
+static rtc_type_t rtc_detected = RTC_UNKNOWN;
+
 /**
  * @brief Determine which RTC type is available (if any).
  *
@@ -506,7 +693,6 @@ static void joybus_rtc_write_time( const rtc_time_t * rtc_time )
  */
 static rtc_type_t rtc_present( void )
 {
-    static rtc_type_t rtc_detected = RTC_UNKNOWN;
     if( rtc_detected != RTC_UNKNOWN )
     {
         return rtc_detected;
@@ -521,6 +707,171 @@ static rtc_type_t rtc_present( void )
     }
 }
 
+/**
+ * @brief Convert a date/time to seconds since 1970-01-01 00:00:00.
+ *
+ * @param[in]   rtc_time
+ *              Source pointer for the RTC time data structure
+ *
+ * @return the number of seconds (negative before 1970)
+ */
+static int64_t rtc_time_to_secs( const rtc_time_t * rtc_time )
+{
+    /* Days from civil date, with years starting in March */
+    int y = rtc_time->year - (rtc_time->month < 2);
+    int m = rtc_time->month + 1;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + rtc_time->day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = (int64_t)era * 146097 + doe - 719468;
+
+    return days * 86400 + rtc_time->hour * 3600 + rtc_time->min * 60 + rtc_time->sec;
+}
+
+/**
+ * @brief Convert seconds since 1970-01-01 00:00:00 to a date/time.
+ *
+ * @param[in]   secs
+ *              Number of seconds
+ * @param[out]  rtc_time
+ *              Destination pointer for the RTC time data structure
+ */
+static void rtc_secs_to_time( int64_t secs, rtc_time_t * rtc_time )
+{
+    int64_t days = secs >= 0 ? secs / 86400 : (secs - 86399) / 86400;
+    int sod = secs - days * 86400;
+
+    /* Civil date from days, with years starting in March */
+    int64_t z = days + 719468;
+    int era = (z >= 0 ? z : z - 146096) / 146097;
+    int doe = z - (int64_t)era * 146097;
+    int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int mp = (5 * doy + 2) / 153;
+    int m = mp < 10 ? mp + 3 : mp - 9;
+
+    rtc_time->year = yoe + era * 400 + (m <= 2);
+    rtc_time->month = m - 1;
+    rtc_time->day = doy - (153 * mp + 2) / 5 + 1;
+    rtc_time->hour = sod / 3600;
+    rtc_time->min = sod / 60 % 60;
+    rtc_time->sec = sod % 60;
+    /* 1970-01-01 was a Thursday */
+    rtc_time->week_day = (days % 7 + 11) % 7;
+}
+
+/**
+ * @brief Current time of the software clock, in seconds since 1970.
+ *
+ * @param[in]   now
+ *              Current tick counter state (see #timer_ticks)
+ */
+static int64_t rtc_clock_now( int64_t now )
+{
+    disable_interrupts();
+    int64_t secs = rtc_clock_secs + (now - rtc_clock_ticks) / TICKS_PER_SECOND;
+    enable_interrupts();
+    return secs;
+}
+
+/**
+ * @brief Synchronize the software clock with a RTC reading.
+ *
+ * The RTC only has a resolution of one second, so the software clock is
+ * kept if it agrees with the reading. If it is one second ahead, it is held
+ * for a second, so that it never goes backwards. In all other cases (or if
+ * forced), it jumps to the reading.
+ *
+ * @param[in]   now
+ *              Tick counter state of the reading
+ * @param[in]   rtc_time
+ *              Time read from the RTC
+ * @param[in]   force
+ *              Always jump to the reading
+ */
+static void rtc_clock_sync( int64_t now, const rtc_time_t * rtc_time, bool force )
+{
+    int64_t secs = rtc_time_to_secs( rtc_time );
+
+    disable_interrupts();
+    int64_t soft = rtc_clock_secs + (now - rtc_clock_ticks) / TICKS_PER_SECOND;
+    if( force || rtc_clock_ticks == 0 || secs > soft || soft - secs > 1 )
+    {
+        rtc_clock_secs = secs;
+        rtc_clock_ticks = now;
+    }
+    else if( soft - secs == 1 )
+    {
+        rtc_clock_secs = soft;
+        rtc_clock_ticks = now;
+    }
+    enable_interrupts();
+}
+
+/**
+ * @brief Reset the software clock, discarding any resync in flight.
+ *
+ * The software clock is not synchronized anymore until the next reading.
+ */
+static void rtc_clock_reset( void )
+{
+    disable_interrupts();
+    rtc_clock_gen++;
+    rtc_clock_ticks = 0;
+    enable_interrupts();
+}
+
+/**
+ * @brief Read the RTC synchronously, and synchronize the software clock.
+ *
+ * This can take a few milliseconds to complete.
+ */
+static void rtc_clock_read( void )
+{
+    rtc_time_t rtc_time;
+    joybus_rtc_read_time( &rtc_time );
+    rtc_clock_sync( timer_ticks(), &rtc_time, true );
+}
+
+/**
+ * @brief Joybus completion callback of the asynchronous resync.
+ *
+ * @param[in]   output
+ *              Joybus output block of the block 2 read
+ * @param[in]   ctx
+ *              Value of #rtc_clock_gen when the resync was started
+ */
+static void rtc_resync_cb( uint64_t * output, void * ctx )
+{
+    rtc_resync_pending = false;
+    /* Discard the reading if the clock was reset in the meantime */
+    if( (uint32_t)(uintptr_t)ctx != rtc_clock_gen ) return;
+
+    rtc_time_t rtc_time;
+    joybus_rtc_decode_time( output[1], &rtc_time );
+    rtc_clock_sync( timer_ticks(), &rtc_time, false );
+}
+
+/**
+ * @brief Start an asynchronous resync of the software clock, if due.
+ *
+ * @param[in]   now
+ *              Current tick counter state (see #timer_ticks)
+ */
+static void rtc_resync_start( int64_t now )
+{
+    if( rtc_resync_pending ) return;
+    if( rtc_clock_ticks != 0 && now - rtc_clock_ticks <= RTC_RESYNC_TICKS ) return;
+    /* The RTC is stopped while being set */
+    if( rtc_async.step != RTC_ASYNC_IDLE ) return;
+
+    uint64_t input[JOYBUS_BLOCK_DWORDS];
+    rtc_resync_pending = true;
+    joybus_rtc_read_init( input, 2 );
+    joybus_exec_async( input, rtc_resync_cb, (void *)(uintptr_t)rtc_clock_gen );
+}
+
 /**
  * @brief Hook function for newlib gettimeofday to get the current date/time.
  *
@@ -564,11 +915,12 @@ static time_t newlib_time_hook( void )
  */
 bool rtc_init( void )
 {
+    uint32_t t0 = TICKS_READ();
+
     /* libdragon currently only supports Joybus RTC! */
     if( rtc_present() != RTC_JOYBUS ) return false;
 
-    /* Invalidate the #rtc_get cache */
-    rtc_get_cache_ticks = 0;
+    rtc_clock_reset();
 
     /* Read the calibration data from the control block */
     uint32_t calibration;
@@ -578,9 +930,13 @@ bool rtc_init( void )
     joybus_rtc_write_control( JOYBUS_RTC_CONTROL_MODE_RUN, calibration );
     wait_ms( JOYBUS_RTC_WRITE_BLOCK_DELAY );
 
+    /* Start the software clock */
+    rtc_clock_read();
+
     /* Enable newlib `gettimeofday` integration */
     hook_time_call( &newlib_time_hook );
 
+    __boot_profile_record( "rtc_init", t0 );
     return true;
 }
 
@@ -598,10 +954,13 @@ bool rtc_init( void )
  */
 void rtc_close( void )
 {
+    /* Abort any asynchronous operation waiting for a delay */
+    if( rtc_async.step != RTC_ASYNC_IDLE ) stop_timer( &rtc_async_timer );
+    rtc_async.step = RTC_ASYNC_IDLE;
     /* Disable newlib `gettimeofday` integration */
     unhook_time_call( &newlib_time_hook );
-    /* Invalidate the #rtc_get cache */
-    rtc_get_cache_ticks = 0;
+    /* Stop the software clock */
+    rtc_clock_reset();
 }
 
 /**
@@ -671,18 +1030,15 @@ void rtc_normalize_time( rtc_time_t * rtc_time )
  * If the RTC is not detected or supported, this function will
  * not modify the destination rtc_time parameter.
  *
- * Your code should call this once per frame to update the #rtc_time_t
- * data structure. The RTC Subsystem maintains a cache of the
- * most-recent RTC time that was read and will only perform an
- * actual RTC read command if the cache is invalidated. The
- * destination rtc_time parameter will be updated regardless of
- * the cache validity.
- *
- * Cache will invalidate every #RTC_GET_CACHE_INVALIDATE_TICKS.
- * Calling #rtc_set will also invalidate the cache.
+ * Your code can call this once per frame to update the #rtc_time_t
+ * data structure. The time is computed from a software clock, which is
+ * interpolated with the CPU ticks and resynchronized with the RTC in the
+ * background every #RTC_RESYNC_TICKS, so this function does not wait for
+ * the RTC.
  *
- * If an actual RTC read command is needed, this function can take
- * a few milliseconds to complete.
+ * Only when the software clock has never been synchronized (eg: after
+ * #rtc_init_async, before the first read), this function reads the RTC
+ * synchronously, which can take a few milliseconds.
  *
  * @param[out]  rtc_time
  *              Destination pointer for the RTC time data structure
@@ -694,22 +1050,11 @@ bool rtc_get( rtc_time_t * rtc_time )
     /* libdragon currently only supports getting the time for Joybus RTC! */
     if( rtc_present() != RTC_JOYBUS ) return false;
 
-    /* This should be overwritten the first time this function is called */
-    static rtc_time_t cache_time = { 2000, 0, 1, 0, 0, 0, 6 };
+    if( rtc_clock_ticks == 0 ) rtc_clock_read();
 
-    /* Check if the cached time is still valid */
     int64_t now = timer_ticks();
-    if(
-        rtc_get_cache_ticks == 0 || /* cache manually invalidated */
-        (now - rtc_get_cache_ticks) > RTC_GET_CACHE_INVALIDATE_TICKS
-    )
-    {
-        /* Update the cache */
-        joybus_rtc_read_time( &cache_time );
-        rtc_get_cache_ticks = now;
-    }
-
-    memcpy( rtc_time, &cache_time, sizeof(rtc_time_t) );
+    rtc_resync_start( now );
+    rtc_secs_to_time( rtc_clock_now( now ), rtc_time );
 
     return true;
 }
@@ -734,6 +1079,10 @@ bool rtc_set( rtc_time_t * write_time )
 {
     /* libdragon currently only supports setting the time for Joybus RTC! */
     if( rtc_present() != RTC_JOYBUS ) return false;
+    assertf( rtc_async.step == RTC_ASYNC_IDLE, "an asynchronous RTC operation is in progress" );
+
+    /* Discard any resync in flight: it would read the old time */
+    rtc_clock_reset();
 
     uint32_t calibration;
     /* Read the calibration data from the control block */
@@ -754,11 +1103,293 @@ bool rtc_set( rtc_time_t * write_time )
     /* Wait for the RTC to start running */
     while( joybus_rtc_is_stopped() ) { /* Spinloop */ }
     wait_ms( JOYBUS_RTC_WRITE_FINISHED_DELAY );
-    /* Invalidate the #rtc_get cache */
-    rtc_get_cache_ticks = 0;
+    /* Restart the software clock from the RTC */
+    rtc_clock_read();
+    return true;
+}
+
+/**
+ * @brief Joybus completion callback of the asynchronous RTC state machine.
+ *
+ * @param[in]   output
+ *              Joybus output block of the command that just completed
+ * @param[in]   ctx
+ *              Unused
+ */
+static void rtc_async_joybus_cb( uint64_t * output, void * ctx )
+{
+    uint64_t input[JOYBUS_BLOCK_DWORDS];
+    const int block_delay = TICKS_FROM_MS( JOYBUS_RTC_WRITE_BLOCK_DELAY );
+
+    switch( rtc_async.step )
+    {
+        case RTC_ASYNC_IDLE:
+            /* The operation was aborted by #rtc_close */
+            break;
+
+        case RTC_ASYNC_GET_TIME:
+            joybus_rtc_decode_time( output[1], rtc_async.dest );
+            rtc_clock_sync( timer_ticks(), rtc_async.dest, true );
+            rtc_async_finish( true );
+            break;
+
+        case RTC_ASYNC_SET_READ_CONTROL:
+            /* Prepare the RTC to write the time, preserving the calibration data */
+            rtc_async.calibration = output[1];
+            rtc_async.step = RTC_ASYNC_SET_STOP;
+            joybus_rtc_write_init( input, 0,
+                (uint64_t)JOYBUS_RTC_CONTROL_MODE_SET << 48 | rtc_async.calibration );
+            joybus_exec_async( input, rtc_async_joybus_cb, NULL );
+            break;
+
+        case RTC_ASYNC_SET_STOP:
+            rtc_async.step = RTC_ASYNC_SET_CHECK_STOPPED;
+            start_timer( &rtc_async_timer, block_delay, TF_ONE_SHOT, rtc_async_timer_cb );
+            break;
+
+        case RTC_ASYNC_SET_CHECK_STOPPED:
+            /* Check the RTC status to make sure RTC "set mode" is supported */
+            if( (joybus_rtc_parse_status( output ) & 0xFF) != JOYBUS_RTC_STATUS_STOPPED )
+            {
+                rtc_async_finish( false );
+                break;
+            }
+            rtc_async.step = RTC_ASYNC_SET_WRITE_TIME;
+            joybus_rtc_write_init( input, 2, rtc_async.time_data );
+            joybus_exec_async( input, rtc_async_joybus_cb, NULL );
+            break;
+
+        case RTC_ASYNC_SET_WRITE_TIME:
+            rtc_async.step = RTC_ASYNC_SET_RUN;
+            start_timer( &rtc_async_timer, block_delay, TF_ONE_SHOT, rtc_async_timer_cb );
+            break;
+
+        case RTC_ASYNC_SET_RUN:
+            rtc_async.step = RTC_ASYNC_SET_CHECK_RUNNING;
+            start_timer( &rtc_async_timer, block_delay, TF_ONE_SHOT, rtc_async_timer_cb );
+            break;
+
+        case RTC_ASYNC_SET_CHECK_RUNNING:
+            /* Poll again later if the RTC has not started running yet */
+            if( (joybus_rtc_parse_status( output ) & 0xFF) == JOYBUS_RTC_STATUS_STOPPED )
+            {
+                start_timer( &rtc_async_timer, TICKS_FROM_MS( 1 ), TF_ONE_SHOT, rtc_async_timer_cb );
+                break;
+            }
+            rtc_async.step = RTC_ASYNC_SET_FINISH;
+            start_timer( &rtc_async_timer, TICKS_FROM_MS( JOYBUS_RTC_WRITE_FINISHED_DELAY ),
+                TF_ONE_SHOT, rtc_async_timer_cb );
+            break;
+
+        case RTC_ASYNC_INIT_STATUS:
+            if( (joybus_rtc_parse_status( output ) >> 8) != JOYBUS_RTC_IDENTIFIER )
+            {
+                rtc_detected = RTC_NONE;
+                rtc_async_finish( false );
+                break;
+            }
+            rtc_detected = RTC_JOYBUS;
+            /* Read the calibration data from the control block */
+            rtc_async.step = RTC_ASYNC_INIT_READ_CONTROL;
+            joybus_rtc_read_init( input, 0 );
+            joybus_exec_async( input, rtc_async_joybus_cb, NULL );
+            break;
+
+        case RTC_ASYNC_INIT_READ_CONTROL:
+            /* Put the RTC into normal operating mode */
+            rtc_async.calibration = output[1];
+            rtc_async.step = RTC_ASYNC_INIT_RUN;
+            joybus_rtc_write_init( input, 0,
+                (uint64_t)JOYBUS_RTC_CONTROL_MODE_RUN << 48 | rtc_async.calibration );
+            joybus_exec_async( input, rtc_async_joybus_cb, NULL );
+            break;
+
+        case RTC_ASYNC_INIT_RUN:
+            rtc_async.step = RTC_ASYNC_INIT_FINISH;
+            start_timer( &rtc_async_timer, block_delay, TF_ONE_SHOT, rtc_async_timer_cb );
+            break;
+
+        default:
+            assertf( 0, "unexpected RTC joybus reply in step %d", rtc_async.step );
+    }
+}
+
+/**
+ * @brief Timer callback of the asynchronous RTC state machine.
+ *
+ * Issues the command that was waiting for the inter-command delay.
+ *
+ * @param[in]   ovfl
+ *              Unused
+ */
+static void rtc_async_timer_cb( int ovfl )
+{
+    uint64_t input[JOYBUS_BLOCK_DWORDS];
+
+    switch( rtc_async.step )
+    {
+        case RTC_ASYNC_SET_CHECK_STOPPED:
+        case RTC_ASYNC_SET_CHECK_RUNNING:
+            joybus_exec_async( joybus_rtc_status_input, rtc_async_joybus_cb, NULL );
+            break;
+
+        case RTC_ASYNC_SET_RUN:
+            /* Put the RTC back into normal operating mode */
+            joybus_rtc_write_init( input, 0,
+                (uint64_t)JOYBUS_RTC_CONTROL_MODE_RUN << 48 | rtc_async.calibration );
+            joybus_exec_async( input, rtc_async_joybus_cb, NULL );
+            break;
+
+        case RTC_ASYNC_SET_FINISH:
+            /* Restart the software clock from the time just written. If the
+             * write was ignored, the next resync will correct it. */
+            rtc_clock_sync( timer_ticks(), &rtc_async.time, true );
+            rtc_async_finish( true );
+            break;
+
+        case RTC_ASYNC_INIT_FINISH:
+            /* Enable newlib `gettimeofday` integration */
+            hook_time_call( &newlib_time_hook );
+            rtc_async_finish( true );
+            /* Start the software clock in background */
+            rtc_resync_start( timer_ticks() );
+            break;
+
+        default:
+            assertf( 0, "unexpected RTC timer in step %d", rtc_async.step );
+    }
+}
+
+/**
+ * @brief Read the current date/time from the real-time clock asynchronously.
+ *
+ * This is the non-blocking version of #rtc_get. If the software clock is
+ * synchronized, the destination is updated and the callback is invoked
+ * before this function returns; otherwise the RTC read is queued on
+ * the joybus and the callback is invoked under interrupt when it completes.
+ *
+ * Only one asynchronous RTC operation can be in flight at a time.
+ *
+ * @param[out]  rtc_time
+ *              Destination pointer for the RTC time data structure.
+ *              It must stay valid until the callback is invoked.
+ * @param[in]   callback
+ *              Function called when the read is done. Can be NULL.
+ * @param[in]   ctx
+ *              Opaque pointer passed to the callback
+ *
+ * @return false if the RTC is not present (the callback is not invoked)
+ */
+bool rtc_get_async( rtc_time_t * rtc_time, rtc_callback_t callback, void * ctx )
+{
+    if( rtc_present() != RTC_JOYBUS ) return false;
+    assertf( rtc_async.step == RTC_ASYNC_IDLE, "an asynchronous RTC operation is in progress" );
+
+    rtc_async.callback = callback;
+    rtc_async.ctx = ctx;
+
+    if( rtc_clock_ticks != 0 )
+    {
+        int64_t now = timer_ticks();
+        rtc_resync_start( now );
+        rtc_secs_to_time( rtc_clock_now( now ), rtc_time );
+        rtc_async_finish( true );
+        return true;
+    }
+
+    uint64_t input[JOYBUS_BLOCK_DWORDS];
+    rtc_async.dest = rtc_time;
+    rtc_async.step = RTC_ASYNC_GET_TIME;
+    joybus_rtc_read_init( input, 2 );
+    joybus_exec_async( input, rtc_async_joybus_cb, NULL );
+    return true;
+}
+
+/**
+ * @brief Set the RTC date/time asynchronously.
+ *
+ * This is the non-blocking version of #rtc_set. It performs the same
+ * sequence of control block writes and status checks, but the
+ * inter-command delays (about 570 milliseconds in total) are handled
+ * by the @ref timer instead of busy waits, so the calling thread
+ * can keep rendering frames while the clock is being set.
+ *
+ * The callback is invoked under interrupt once the sequence is finished,
+ * with a success flag that is false if the RTC does not support being set.
+ * Only one asynchronous RTC operation can be in flight at a time, and
+ * #rtc_get / #rtc_set must not be called until it completes.
+ *
+ * @param[in,out] write_time
+ *                Source pointer for the RTC time data structure.
+ *                It is normalized (see #rtc_normalize_time) and copied
+ *                before returning.
+ * @param[in]     callback
+ *                Function called when the time has been set. Can be NULL.
+ * @param[in]     ctx
+ *                Opaque pointer passed to the callback
+ *
+ * @return false if the RTC is not present (the callback is not invoked)
+ */
+bool rtc_set_async( rtc_time_t * write_time, rtc_callback_t callback, void * ctx )
+{
+    if( rtc_present() != RTC_JOYBUS ) return false;
+    assertf( rtc_async.step == RTC_ASYNC_IDLE, "an asynchronous RTC operation is in progress" );
+
+    /* Ensure write_time is a valid RTC date/time */
+    rtc_normalize_time( write_time );
+    /* Discard any resync in flight: it would read the old time. The software
+     * clock keeps running meanwhile, so #rtc_get does not block. */
+    rtc_clock_gen++;
+
+    uint64_t input[JOYBUS_BLOCK_DWORDS];
+    rtc_async.callback = callback;
+    rtc_async.ctx = ctx;
+    rtc_async.time_data = joybus_rtc_encode_time( write_time );
+    rtc_async.time = *write_time;
+    rtc_async.step = RTC_ASYNC_SET_READ_CONTROL;
+    /* Read the calibration data from the control block */
+    joybus_rtc_read_init( input, 0 );
+    joybus_exec_async( input, rtc_async_joybus_cb, NULL );
     return true;
 }
 
+/**
+ * @brief Initialize the RTC subsystem asynchronously.
+ *
+ * This is the non-blocking version of #rtc_init, meant to be called at
+ * boot so that the RTC detection (a joybus roundtrip) and the control block
+ * write (followed by a 20 milliseconds delay) do not delay the first frame.
+ * The RTC is detected and started in the background, and the callback is
+ * invoked under interrupt when done, with a success flag that tells whether
+ * the RTC is present. From then on, the newlib time functions are hooked
+ * as with #rtc_init.
+ *
+ * Only one asynchronous RTC operation can be in flight at a time: other
+ * RTC functions must not be called until the callback is invoked.
+ *
+ * @param[in]   callback
+ *              Function called when the initialization is done. Can be NULL.
+ * @param[in]   ctx
+ *              Opaque pointer passed to the callback
+ */
+void rtc_init_async( rtc_callback_t callback, void * ctx )
+{
+    assertf( rtc_async.step == RTC_ASYNC_IDLE, "an asynchronous RTC operation is in progress" );
+
+    rtc_clock_reset();
+
+    rtc_async.callback = callback;
+    rtc_async.ctx = ctx;
+    if( rtc_detected == RTC_NONE )
+    {
+        rtc_async_finish( false );
+        return;
+    }
+
+    rtc_async.step = RTC_ASYNC_INIT_STATUS;
+    joybus_exec_async( joybus_rtc_status_input, rtc_async_joybus_cb, NULL );
+}
+
 /**
  * @brief Determine whether the RTC supports writing the time.
  *
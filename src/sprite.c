@@ -5,6 +5,11 @@
 #include "sprite_internal.h"
 #include "asset.h"
 #include "utils.h"
+#include "dragonfs.h"
+#include "dma.h"
+#include "rspq.h"
+#include "display.h"
+#include <malloc.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +17,45 @@
 
 static sprite_t *last_spritemap = NULL;
 
+/** @brief Maximum number of LODs of streaming sprites resident in RDRAM at the same time */
+#define LOD_CACHE_SLOTS     32
+
+/** @brief Default memory budget for the LODs of streaming sprites */
+#define LOD_CACHE_DEFAULT_BUDGET    (128*1024)
+
+/** 
+ * @brief Header of a streaming sprite allocation
+ * 
+ * A streaming sprite is allocated with this header in front of it, so
+ * that the ROM address of the file can be found from the sprite pointer.
+ */
+typedef struct {
+    uint32_t rom_addr;          ///< ROM address of the sprite file
+    uint32_t padding[3];        ///< Padding (keep the sprite 16-byte aligned)
+    sprite_t sprite;            ///< Sprite (header, LOD0, extended header and palette)
+} sprite_stream_t;
+
+_Static_assert(sizeof(sprite_stream_t) == 16 + sizeof(sprite_t), "invalid sizeof(sprite_stream_t)");
+
+/** @brief A LOD of a streaming sprite, loaded from ROM */
+typedef struct {
+    sprite_t *sprite;           ///< Sprite owning the LOD (NULL if the slot is free)
+    int level;                  ///< Number of LOD level
+    int size;                   ///< Size of the LOD in bytes
+    uint32_t last_use;          ///< LRU counter value at last access
+    void *pixels;               ///< LOD pixels
+} lod_slot_t;
+
+static lod_slot_t lod_cache[LOD_CACHE_SLOTS];
+static int lod_cache_budget = LOD_CACHE_DEFAULT_BUDGET;
+static int lod_cache_used = 0;
+static uint32_t lod_cache_clock = 0;
+
+static sprite_stream_t *__sprite_stream(sprite_t *sprite)
+{
+    return (sprite_stream_t*)((uint8_t*)sprite - offsetof(sprite_stream_t, sprite));
+}
+
 /** @brief Access the sprite extended structure, or NULL if the structure does not exist */
 __attribute__((noinline))
 sprite_ext_t *__sprite_ext(sprite_t *sprite)
@@ -48,27 +92,336 @@ bool __sprite_upgrade(sprite_t *sprite)
     return false;
 }
 
-sprite_t *sprite_load_buf(void *buf, int sz)
+/** @brief Reverse the mksprite prefilter on the pixels of an image */
+static void __sprite_unfilter_image(uint8_t *pixels, tex_format_t fmt, int width, int height, int filter)
+{
+    int pitch = TEX_FORMAT_PIX2BYTES(fmt, width);
+    int bpp = MAX(1, TEX_FORMAT_BITDEPTH(fmt) / 8);
+    int size = pitch * height;
+
+    switch (filter) {
+    case SPRITE_FILTER_SUB:
+        for (int y=0; y<size; y+=pitch)
+            for (int x=bpp; x<pitch; x++)
+                pixels[y+x] += pixels[y+x-bpp];
+        break;
+    case SPRITE_FILTER_UP:
+        for (int i=pitch; i<size; i++)
+            pixels[i] += pixels[i-pitch];
+        break;
+    default:
+        assertf(0, "invalid sprite filter: %d", filter);
+    }
+}
+
+/** @brief Prefilter of the sprite pixels (one of SPRITE_FILTER_*) */
+static int __sprite_filter(sprite_t *sprite)
+{
+    sprite_ext_t *sx = __sprite_ext(sprite);
+    if (!sx)
+        return SPRITE_FILTER_NONE;
+    return (sx->flags & SPRITE_FLAG_FILTER) >> SPRITE_FLAG_FILTER_SHIFT;
+}
+
+/** 
+ * @brief Reverse the prefilter on all the LODs of a sprite in memory.
+ * 
+ * The filter flag is then cleared, so that this is a no-op if the same
+ * buffer is loaded again. Returns true if the pixels were modified.
+ */
+static bool sprite_unfilter(sprite_t *s)
+{
+    int filter = __sprite_filter(s);
+    if (filter == SPRITE_FILTER_NONE)
+        return false;
+
+    sprite_ext_t *sx = __sprite_ext(s);
+    __sprite_unfilter_image((uint8_t*)s->data, sprite_get_format(s), s->width, s->height, filter);
+    for (int i=0; i<7; i++) {
+        struct sprite_lod_s *lod = &sx->lods[i];
+        if (lod->width)
+            __sprite_unfilter_image((uint8_t*)s + (lod->fmt_file_pos & 0x00FFFFFF),
+                lod->fmt_file_pos >> 24, lod->width, lod->height, filter);
+    }
+    sx->flags &= ~SPRITE_FLAG_FILTER;
+    return true;
+}
+
+/** @brief Validate a sprite in memory. Returns true if the header was modified by the upgrade. */
+static bool sprite_check(sprite_t *s, int sz)
 {
-    sprite_t *s = buf;
     assertf(sz >= sizeof(sprite_t), "Sprite buffer too small (sz=%d)", sz);
-    __sprite_upgrade(s);
+    bool upgraded = __sprite_upgrade(s);
     (void)__sprite_ext(s); // just check if the sprite is valid (the version is checked in __sprite_ext)
+    return upgraded;
+}
+
+sprite_t *sprite_load_buf(void *buf, int sz)
+{
+    sprite_t *s = buf;
+    sprite_check(s, sz);
+    sprite_unfilter(s);
     data_cache_hit_writeback(s, sz);
     return s;
 }
 
+sprite_t *sprite_load_arena(arena_t *arena, const char *fn)
+{
+    int sz;
+    void *buf = asset_load_arena(arena, fn, &sz);
+    return sprite_load_buf(buf, sz);
+}
+
 sprite_t *sprite_load(const char *fn)
 {
     int sz;
-    void *buf = asset_load(fn, &sz);
-    sprite_t *s = sprite_load_buf(buf, sz);
+    // The buffer is returned already written back, so only the header
+    // must be written back again, in case it was upgraded.
+    sprite_t *s = asset_load_writeback(fn, &sz);
+    bool upgraded = sprite_check(s, sz);
+    if (sprite_unfilter(s))
+        data_cache_hit_writeback(s, sz);
+    else if (upgraded)
+        data_cache_hit_writeback(s, sizeof(sprite_t));
+    s->flags |= SPRITE_FLAGS_OWNEDBUFFER;
+    return s;
+}
+
+/**
+ * @brief Convert the main image of a sprite in memory to another format.
+ * 
+ * The extended header and the data that follows it (LODs, palette, frames)
+ * are moved after the converted image. If the image shrinks, it is converted
+ * in place; otherwise, the sprite is copied into a new buffer and the old one
+ * is freed. Returns the converted sprite, and updates *sz.
+ */
+static sprite_t *sprite_convert(sprite_t *s, int *sz, tex_format_t fmt)
+{
+    tex_format_t sfmt = sprite_get_format(s);
+    if (sfmt == fmt)
+        return s;
+    assertf(fmt == FMT_RGBA16 || fmt == FMT_RGBA32,
+        "sprite conversion to %s is not supported", tex_format_name(fmt));
+    assertf(sfmt == FMT_RGBA16 || sfmt == FMT_RGBA32 || sfmt == FMT_CI8 || sfmt == FMT_CI4,
+        "sprite conversion from %s is not supported", tex_format_name(sfmt));
+    const uint16_t *tlut = sprite_get_palette(s);
+
+    int old_off = sizeof(sprite_t) + ROUND_UP(TEX_FORMAT_PIX2BYTES(sfmt, s->width) * s->height, 8);
+    int new_off = sizeof(sprite_t) + ROUND_UP(TEX_FORMAT_PIX2BYTES(fmt, s->width) * s->height, 8);
+    int tail = (s->flags & SPRITE_FLAGS_EXT) ? *sz - old_off : 0;
+    int delta = new_off - old_off;
+    surface_t src = sprite_get_pixels(s);
+    sprite_t *d = s;
+
+    if (delta > 0) {
+        d = memalign(16, new_off + tail);
+        assertf(d, "out of memory converting sprite");
+        memcpy(d, s, sizeof(sprite_t));
+        memcpy((uint8_t*)d + new_off, (uint8_t*)s + old_off, tail);
+        surface_t dst = surface_make_linear(d->data, fmt, s->width, s->height);
+        surface_blit(&dst, &src, 0, 0, tlut, 0);
+        free(s);
+    } else {
+        // Row j of the converted image ends before row j+1 of the original,
+        // so rows can be converted in order, through a temporary row
+        int pitch = TEX_FORMAT_PIX2BYTES(fmt, s->width);
+        surface_t row = surface_make_linear(malloc(pitch), fmt, s->width, 1);
+        for (int j = 0; j < s->height; j++) {
+            surface_t line = surface_make_sub(&src, 0, j, s->width, 1);
+            surface_blit(&row, &line, 0, 0, tlut, 0);
+            memcpy((uint8_t*)d->data + j * pitch, row.buffer, pitch);
+        }
+        free(row.buffer);
+        memmove((uint8_t*)d + new_off, (uint8_t*)s + old_off, tail);
+    }
+    d->flags = (d->flags & ~SPRITE_FLAGS_TEXFORMAT) | fmt;
+
+    // Fix the offsets in the extended header, which are relative to the sprite
+    sprite_ext_t *sx = __sprite_ext(d);
+    if (sx) {
+        for (int i=0; i<7; i++)
+            if (sx->lods[i].width)
+                sx->lods[i].fmt_file_pos += delta;
+        if (sx->pal_file_pos)
+            sx->pal_file_pos += delta;
+        if (delta > 0)
+            sx->flags &= ~SPRITE_FLAG_FITS_TMEM;
+    }
+
+    *sz = new_off + tail;
+    return d;
+}
+
+sprite_t *sprite_load_convert(const char *fn, tex_format_t fmt)
+{
+    if (fmt == FMT_NONE)
+        fmt = display_get_bitdepth() == 2 ? FMT_RGBA16 : FMT_RGBA32;
+
+    int sz;
+    sprite_t *s = asset_load(fn, &sz);
+    sprite_check(s, sz);
+    sprite_unfilter(s);
+    s = sprite_convert(s, &sz, fmt);
     s->flags |= SPRITE_FLAGS_OWNEDBUFFER;
+    data_cache_hit_writeback(s, sz);
+    return s;
+}
+
+static void lod_cache_evict(lod_slot_t *slot)
+{
+    // The RDP might still be reading the pixels
+    rspq_wait();
+    free(slot->pixels);
+    lod_cache_used -= slot->size;
+    memset(slot, 0, sizeof(lod_slot_t));
+}
+
+static void *lod_cache_fetch(sprite_t *sprite, int level, uint32_t file_pos, int size)
+{
+    lod_slot_t *free_slot = NULL;
+    for (int i=0; i<LOD_CACHE_SLOTS; i++) {
+        lod_slot_t *slot = &lod_cache[i];
+        if (slot->sprite == sprite && slot->level == level) {
+            slot->last_use = ++lod_cache_clock;
+            return slot->pixels;
+        }
+        if (!slot->sprite && !free_slot)
+            free_slot = slot;
+    }
+
+    // Evict the least recently used LODs, until there is a free slot and
+    // the budget allows for the new one. A LOD larger than the whole budget
+    // is still loaded, after evicting everything else.
+    while (!free_slot || lod_cache_used + size > lod_cache_budget) {
+        lod_slot_t *lru = NULL;
+        for (int i=0; i<LOD_CACHE_SLOTS; i++)
+            if (lod_cache[i].sprite && (!lru || lod_cache[i].last_use < lru->last_use))
+                lru = &lod_cache[i];
+        if (!lru)
+            break;
+        lod_cache_evict(lru);
+        if (!free_slot)
+            free_slot = lru;
+    }
+
+    int alloc_size = ROUND_UP(size, 16);
+    void *pixels = memalign(16, alloc_size);
+    assertf(pixels, "out of memory loading LOD %d of sprite %p (%d bytes)", level, sprite, size);
+    data_cache_hit_writeback_invalidate(pixels, alloc_size);
+    dma_read(pixels, __sprite_stream(sprite)->rom_addr + file_pos, size);
+    int filter = __sprite_filter(sprite);
+    if (filter != SPRITE_FILTER_NONE) {
+        struct sprite_lod_s *lod = &__sprite_ext(sprite)->lods[level-1];
+        __sprite_unfilter_image(pixels, lod->fmt_file_pos >> 24, lod->width, lod->height, filter);
+        data_cache_hit_writeback(pixels, size);
+    }
+
+    *free_slot = (lod_slot_t){
+        .sprite = sprite,
+        .level = level,
+        .size = size,
+        .last_use = ++lod_cache_clock,
+        .pixels = pixels,
+    };
+    lod_cache_used += size;
+    return pixels;
+}
+
+sprite_t *sprite_load_streaming(const char *fn)
+{
+    if (strstr(fn, ":/")) {
+        assertf(strncmp(fn, "rom:/", 5) == 0, "Cannot open %s: streaming sprites only support files in ROM (rom:/)", fn);
+        fn += 5;
+    }
+
+    int fh = dfs_open(fn);
+    assertf(fh >= 0, "file does not exist: %s", fn);
+    int file_size = dfs_size(fh);
+    uint32_t rom_addr = dfs_rom_addr(fn);
+
+    sprite_t header;
+    dfs_read(&header, 1, sizeof(header), fh);
+    assertf(memcmp(&header, "DCA", 3) != 0, "sprite %s: streaming sprites cannot be compressed (use mksprite -c 0)", fn);
+    __sprite_upgrade(&header);
+
+    // Everything before the first LOD (header, main image, extended header
+    // and atlas frames) stays resident, together with the palette which is
+    // at the end of the file.
+    int resident_size = file_size, pal_size = 0;
+    uint32_t pal_file_pos = 0;
+    if (header.flags & SPRITE_FLAGS_EXT) {
+        int ext_pos = sizeof(sprite_t) + ROUND_UP(TEX_FORMAT_PIX2BYTES(sprite_get_format(&header), header.width) * header.height, 8);
+        sprite_ext_t sx;
+        dfs_seek(fh, ext_pos, SEEK_SET);
+        dfs_read(&sx, 1, sizeof(sx), fh);
+        assertf(sx.version == 4, "Invalid sprite version (%d); please regenerate your asset files", sx.version);
+
+        for (int i=0; i<7; i++)
+            if (sx.lods[i].width)
+                resident_size = MIN(resident_size, sx.lods[i].fmt_file_pos & 0x00FFFFFF);
+        if (sx.pal_file_pos) {
+            pal_file_pos = sx.pal_file_pos;
+            pal_size = file_size - pal_file_pos;
+            resident_size = MIN(resident_size, pal_file_pos);
+        }
+    }
+    dfs_close(fh);
+
+    int alloc_size = ROUND_UP(offsetof(sprite_stream_t, sprite) + resident_size + pal_size, 16);
+    sprite_stream_t *ss = memalign(16, alloc_size);
+    assertf(ss, "out of memory loading sprite %s (%d bytes)", fn, alloc_size);
+    data_cache_hit_writeback_invalidate(ss, alloc_size);
+    ss->rom_addr = rom_addr;
+    sprite_t *s = &ss->sprite;
+    dma_read(s, rom_addr, resident_size);
+    if (pal_size)
+        dma_read((uint8_t*)s + resident_size, rom_addr + pal_file_pos, pal_size);
+
+    // Relocate the palette right after the resident part
+    __sprite_upgrade(s);
+    sprite_ext_t *sx = __sprite_ext(s);
+    if (sx && pal_size)
+        sx->pal_file_pos = resident_size;
+    // Only the main image is unfiltered now: the filter flag is kept, as it
+    // still applies to the other LODs in ROM.
+    int filter = __sprite_filter(s);
+    if (filter != SPRITE_FILTER_NONE)
+        __sprite_unfilter_image((uint8_t*)s->data, sprite_get_format(s), s->width, s->height, filter);
+    s->flags |= SPRITE_FLAGS_STREAMING;
+    data_cache_hit_writeback(s, resident_size + pal_size);
     return s;
 }
 
+void sprite_set_lod_budget(int bytes)
+{
+    assertf(bytes >= 0, "invalid LOD budget: %d", bytes);
+    lod_cache_budget = bytes;
+    // Evict the least recently used LODs until the new budget is honored
+    while (lod_cache_used > lod_cache_budget) {
+        lod_slot_t *lru = NULL;
+        for (int i=0; i<LOD_CACHE_SLOTS; i++)
+            if (lod_cache[i].sprite && (!lru || lod_cache[i].last_use < lru->last_use))
+                lru = &lod_cache[i];
+        lod_cache_evict(lru);
+    }
+}
+
 void sprite_free(sprite_t *s)
 {
+    if (s->flags & SPRITE_FLAGS_STREAMING) {
+        for (int i=0; i<LOD_CACHE_SLOTS; i++)
+            if (lod_cache[i].sprite == s)
+                lod_cache_evict(&lod_cache[i]);
+        if (last_spritemap == s)
+            last_spritemap = NULL;
+        sprite_stream_t *ss = __sprite_stream(s);
+        #ifndef NDEBUG
+        memset(ss, 0, sizeof(sprite_stream_t));
+        #endif
+        free(ss);
+        return;
+    }
+
     if(s->flags & SPRITE_FLAGS_OWNEDBUFFER) {
         #ifndef NDEBUG
         //To help debugging, zero the sprite structure as well
@@ -103,9 +456,15 @@ surface_t sprite_get_lod_pixels(sprite_t *sprite, int num_level) {
     if (lod->width == 0)
         return (surface_t){0};
 
-    // Return the surface that refers to this LOD
+    // Return the surface that refers to this LOD. For streaming sprites,
+    // it is fetched from ROM on first use.
     tex_format_t fmt = lod->fmt_file_pos >> 24;
-    void *pixels = (void*)sprite + (lod->fmt_file_pos & 0x00FFFFFF);
+    void *pixels;
+    if (sprite->flags & SPRITE_FLAGS_STREAMING)
+        pixels = lod_cache_fetch(sprite, num_level, lod->fmt_file_pos & 0x00FFFFFF,
+            TEX_FORMAT_PIX2BYTES(fmt, lod->width) * lod->height);
+    else
+        pixels = (void*)sprite + (lod->fmt_file_pos & 0x00FFFFFF);
     return surface_make_linear(pixels, fmt, lod->width, lod->height);
 }
 
@@ -135,6 +494,34 @@ surface_t sprite_get_tile(sprite_t *sprite, int h, int v) {
         tile_width, tile_height);
 }
 
+static sprite_frame_t *__sprite_frames(sprite_t *sprite, int *num_frames)
+{
+    sprite_ext_t *sx = __sprite_ext(sprite);
+    if (!sx || !(sx->flags & SPRITE_FLAG_HAS_FRAMES)) {
+        *num_frames = 0;
+        return NULL;
+    }
+    *num_frames = sx->num_frames;
+    return (void*)sx + ROUND_UP(sx->size, 8);
+}
+
+int sprite_get_frame_count(sprite_t *sprite) {
+    int num_frames;
+    __sprite_frames(sprite, &num_frames);
+    return num_frames;
+}
+
+surface_t sprite_get_frame(sprite_t *sprite, int idx) {
+    int num_frames;
+    sprite_frame_t *frames = __sprite_frames(sprite, &num_frames);
+    assertf(idx >= 0 && idx < num_frames, "invalid frame index %d (sprite has %d frames)", idx, num_frames);
+
+    surface_t surf = sprite_get_pixels(sprite);
+    return surface_make_sub(&surf,
+        frames[idx].x, frames[idx].y,
+        frames[idx].width, frames[idx].height);
+}
+
 int sprite_get_lod_count(sprite_t *sprite) {
     sprite_ext_t *sx = __sprite_ext(sprite);
     if (!sx)
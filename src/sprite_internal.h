@@ -8,6 +8,13 @@
 #define SPRITE_FLAG_HAS_TEXPARMS            0x0008   ///< Sprite contains texture parameters
 #define SPRITE_FLAG_HAS_DETAIL              0x0010   ///< Sprite contains detail texture
 #define SPRITE_FLAG_FITS_TMEM               0x0020   ///< Set if the sprite does fit TMEM without splitting
+#define SPRITE_FLAG_HAS_FRAMES              0x0040   ///< Sprite is an atlas, and contains a frame table
+#define SPRITE_FLAG_FILTER                  0x0180   ///< Pixel prefilter applied by mksprite (SPRITE_FILTER_*)
+#define SPRITE_FLAG_FILTER_SHIFT            7        ///< Shift of the prefilter within the flags
+
+#define SPRITE_FILTER_NONE                  0        ///< No prefilter
+#define SPRITE_FILTER_SUB                   1        ///< Each byte is stored as the delta from the same byte of the pixel on the left
+#define SPRITE_FILTER_UP                    2        ///< Each byte is stored as the delta from the same byte of the row above
 
 /** 
  * @brief Internal structure used as additional sprite header
@@ -30,7 +37,7 @@ typedef struct sprite_ext_s {
     } lods[7];                  ///< Information on the available LODs (if detail is present, it's always at position 6)
     struct {
         uint16_t flags;             ///< Generic Flags for the sprite
-        uint16_t padding;           ///< Padding
+        uint16_t num_frames;        ///< Number of frames in the atlas frame table (if #SPRITE_FLAG_HAS_FRAMES)
     };
     /// @brief RDP texture parameters
     struct texparms_s {
@@ -53,6 +60,20 @@ typedef struct sprite_ext_s {
 
 _Static_assert(sizeof(sprite_ext_t) == 124, "invalid sizeof(sprite_ext_t)");
 
+/**
+ * @brief A frame of a sprite atlas
+ * 
+ * If the sprite has #SPRITE_FLAG_HAS_FRAMES, an array of sprite_ext_t::num_frames
+ * of these follows the extended header (aligned to 8 bytes). Each frame
+ * is a rectangle within the main image.
+ */
+typedef struct sprite_frame_s {
+    uint16_t x;                 ///< X coordinate of the frame in the atlas
+    uint16_t y;                 ///< Y coordinate of the frame in the atlas
+    uint16_t width;             ///< Width of the frame
+    uint16_t height;            ///< Height of the frame
+} sprite_frame_t;
+
 /** @brief Convert a sprite from the old format with implicit texture format */ 
 bool __sprite_upgrade(sprite_t *sprite);
 
@@ -7,9 +7,32 @@
 #include "surface.h"
 #include "n64sys.h"
 #include "debug.h"
+#include "n64types.h"
+#include "rdp.h"
+#include "utils.h"
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
+/** @brief Size of the smallest size class of a surface pool */
+#define POOL_MIN_CLASS_SIZE     1024
+
+/** @brief Number of size classes of a surface pool (up to 2 MiB) */
+#define POOL_NUM_CLASSES        12
+
+/** @brief A buffer of a surface pool */
+typedef struct surface_pool_block_s {
+    struct surface_pool_block_s *next;  ///< Next block in the same list
+    void *buffer;                       ///< Buffer (64-byte aligned)
+    bool external;                      ///< True if the buffer was lent via #surface_pool_add_buffer
+} surface_pool_block_t;
+
+/** @brief Surface pool (see #surface_pool_t) */
+struct surface_pool_s {
+    surface_pool_block_t *free[POOL_NUM_CLASSES];   ///< Free blocks, per size class
+    surface_pool_block_t *used[POOL_NUM_CLASSES];   ///< Allocated blocks, per size class
+};
+
 const char* tex_format_name(tex_format_t fmt)
 {
     switch (fmt) {
@@ -45,6 +68,21 @@ surface_t surface_alloc(tex_format_t format, uint32_t width, uint32_t height)
     };
 }
 
+surface_t surface_alloc_arena(arena_t *arena, tex_format_t format, uint32_t width, uint32_t height)
+{
+    assertf((format & ~SURFACE_FLAGS_TEXFORMAT) == 0,
+        "invalid surface format: 0x%x (%d)", format, format);
+    void *buffer = arena_alloc_uncached(arena, 64, height * TEX_FORMAT_PIX2BYTES(format, width));
+    assertf(buffer, "surface_alloc_arena: arena full (%ldx%ld surface)", width, height);
+    return (surface_t){ 
+        .flags = format,
+        .width = width,
+        .height = height,
+        .stride = TEX_FORMAT_PIX2BYTES(format, width),
+        .buffer = buffer,
+    };
+}
+
 void surface_free(surface_t *surface)
 {
     if (surface_has_owned_buffer(surface)) {
@@ -71,6 +109,255 @@ surface_t surface_make_sub(surface_t *parent, uint32_t x0, uint32_t y0, uint32_t
     return sub;
 }
 
+/** @brief Size class able to contain the specified size (-1 if too large) */
+static int pool_class(uint32_t size, bool round_up)
+{
+    int cls = 0;
+    while (cls < POOL_NUM_CLASSES && (POOL_MIN_CLASS_SIZE << cls) < size)
+        cls++;
+    if (!round_up && (cls == POOL_NUM_CLASSES || (POOL_MIN_CLASS_SIZE << cls) > size))
+        cls--;
+    return cls < POOL_NUM_CLASSES ? cls : -1;
+}
+
+surface_pool_t *surface_pool_new(void)
+{
+    return calloc(1, sizeof(surface_pool_t));
+}
+
+surface_t surface_pool_alloc(surface_pool_t *pool, tex_format_t format, uint32_t width, uint32_t height)
+{
+    assertf((format & ~SURFACE_FLAGS_TEXFORMAT) == 0,
+        "invalid surface format: 0x%x (%d)", format, format);
+    uint32_t stride = TEX_FORMAT_PIX2BYTES(format, width);
+    int cls = pool_class(height * stride, true);
+    assertf(cls >= 0, "surface too large for a surface pool: %ldx%ld", width, height);
+
+    surface_pool_block_t *b = pool->free[cls];
+    if (b) {
+        pool->free[cls] = b->next;
+    } else {
+        b = malloc(sizeof(surface_pool_block_t));
+        b->buffer = malloc_uncached_aligned(64, POOL_MIN_CLASS_SIZE << cls);
+        b->external = false;
+        assertf(b->buffer, "out of memory allocating a %ldx%ld surface", width, height);
+    }
+    b->next = pool->used[cls];
+    pool->used[cls] = b;
+
+    return surface_make(b->buffer, format, width, height, stride);
+}
+
+void surface_pool_release(surface_pool_t *pool, surface_t *surface)
+{
+    int cls = pool_class(surface->height * surface->stride, true);
+    assertf(cls >= 0, "surface not allocated from this pool: %p", surface->buffer);
+    for (surface_pool_block_t **pb = &pool->used[cls]; *pb; pb = &(*pb)->next) {
+        surface_pool_block_t *b = *pb;
+        if (b->buffer == surface->buffer) {
+            *pb = b->next;
+            b->next = pool->free[cls];
+            pool->free[cls] = b;
+            memset(surface, 0, sizeof(surface_t));
+            return;
+        }
+    }
+    assertf(0, "surface not allocated from this pool: %p", surface->buffer);
+}
+
+void surface_pool_reset(surface_pool_t *pool)
+{
+    for (int cls=0; cls<POOL_NUM_CLASSES; cls++) {
+        while (pool->used[cls]) {
+            surface_pool_block_t *b = pool->used[cls];
+            pool->used[cls] = b->next;
+            b->next = pool->free[cls];
+            pool->free[cls] = b;
+        }
+    }
+}
+
+void surface_pool_add_buffer(surface_pool_t *pool, surface_t *surface)
+{
+    assertf(((uint32_t)surface->buffer & 63) == 0, "buffer must be 64-byte aligned: %p", surface->buffer);
+    // The buffer can serve allocations of the largest class it fully contains
+    int cls = pool_class(surface->height * surface->stride, false);
+    assertf(cls >= 0, "buffer too small for a surface pool: %d bytes", surface->height * surface->stride);
+
+    surface_pool_block_t *b = malloc(sizeof(surface_pool_block_t));
+    b->buffer = surface->buffer;
+    b->external = true;
+    b->next = pool->free[cls];
+    pool->free[cls] = b;
+}
+
+void surface_pool_free(surface_pool_t *pool)
+{
+    surface_pool_reset(pool);
+    for (int cls=0; cls<POOL_NUM_CLASSES; cls++) {
+        while (pool->free[cls]) {
+            surface_pool_block_t *b = pool->free[cls];
+            pool->free[cls] = b->next;
+            if (!b->external)
+                free_uncached(b->buffer);
+            free(b);
+        }
+    }
+    free(pool);
+}
+
+/** @brief Convert a RGBA32 pixel to RGBA16 */
+static inline uint16_t rgba32_to_16(uint32_t c)
+{
+    return ((c >> 16) & 0xF800) | ((c >> 13) & 0x7C0) | ((c >> 10) & 0x3E) | ((c >> 7) & 0x1);
+}
+
+/** @brief Convert a RGBA16 pixel to RGBA32 */
+static inline uint32_t rgba16_to_32(uint16_t c)
+{
+    uint32_t r = (c >> 11) & 0x1F, g = (c >> 6) & 0x1F, b = (c >> 1) & 0x1F;
+    r = (r << 3) | (r >> 2); g = (g << 3) | (g >> 2); b = (b << 3) | (b >> 2);
+    return (r << 24) | (g << 16) | (b << 8) | ((c & 1) ? 0xFF : 0);
+}
+
+/** @brief A blit kernel: convert n pixels from a source row (starting at pixel sx) to dst */
+typedef void (*blit_row_func_t)(void *dst, const uint8_t *row, int sx, int n, const uint16_t *tlut);
+
+static void blit_row_rgba32_rgba16(void *dst, const uint8_t *row, int sx, int n, const uint16_t *tlut)
+{
+    uint16_t *d = dst; const uint32_t *s = (const uint32_t*)row + sx;
+    uint16_t *end = d + n;
+
+    // Reach 8-byte alignment on the destination, then convert 4 pixels
+    // per iteration, with two 64-bit loads and one 64-bit store
+    while (((uint32_t)d & 7) && d < end) *d++ = rgba32_to_16(*s++);
+    while (d + 4 <= end) {
+        uint64_t s0 = *(const u_uint64_t*)(s+0);
+        uint64_t s1 = *(const u_uint64_t*)(s+2);
+        *(uint64_t*)d = ((uint64_t)rgba32_to_16(s0 >> 32) << 48) | ((uint64_t)rgba32_to_16(s0) << 32) |
+                        ((uint64_t)rgba32_to_16(s1 >> 32) << 16) | rgba32_to_16(s1);
+        d += 4; s += 4;
+    }
+    while (d < end) *d++ = rgba32_to_16(*s++);
+}
+
+static void blit_row_rgba16_rgba32(void *dst, const uint8_t *row, int sx, int n, const uint16_t *tlut)
+{
+    uint32_t *d = dst; const uint16_t *s = (const uint16_t*)row + sx;
+    uint32_t *end = d + n;
+
+    while (((uint32_t)d & 7) && d < end) *d++ = rgba16_to_32(*s++);
+    while (d + 4 <= end) {
+        uint64_t s0 = *(const u_uint64_t*)s;
+        ((uint64_t*)d)[0] = ((uint64_t)rgba16_to_32(s0 >> 48) << 32) | rgba16_to_32(s0 >> 32);
+        ((uint64_t*)d)[1] = ((uint64_t)rgba16_to_32(s0 >> 16) << 32) | rgba16_to_32(s0);
+        d += 4; s += 4;
+    }
+    while (d < end) *d++ = rgba16_to_32(*s++);
+}
+
+static void blit_row_ci8_rgba16(void *dst, const uint8_t *row, int sx, int n, const uint16_t *tlut)
+{
+    uint16_t *d = dst; const uint8_t *s = row + sx;
+    uint16_t *end = d + n;
+
+    while (((uint32_t)d & 7) && d < end) *d++ = tlut[*s++];
+    while (d + 4 <= end) {
+        uint32_t s0 = *(const u_uint32_t*)s;
+        *(uint64_t*)d = ((uint64_t)tlut[s0 >> 24] << 48) | ((uint64_t)tlut[(s0 >> 16) & 0xFF] << 32) |
+                        ((uint64_t)tlut[(s0 >> 8) & 0xFF] << 16) | tlut[s0 & 0xFF];
+        d += 4; s += 4;
+    }
+    while (d < end) *d++ = tlut[*s++];
+}
+
+static void blit_row_ci4_rgba16(void *dst, const uint8_t *row, int sx, int n, const uint16_t *tlut)
+{
+    uint16_t *d = dst; const uint8_t *s = row + sx/2;
+    uint16_t *end = d + n;
+
+    // Once the source is on an even pixel, each byte converts to two
+    // destination pixels
+    if ((sx & 1) && d < end) *d++ = tlut[*s++ & 0xF];
+    while (d + 4 <= end) {
+        uint16_t s0 = *(const u_uint16_t*)s;
+        *(u_uint64_t*)d = ((uint64_t)tlut[s0 >> 12] << 48) | ((uint64_t)tlut[(s0 >> 8) & 0xF] << 32) |
+                          ((uint64_t)tlut[(s0 >> 4) & 0xF] << 16) | tlut[s0 & 0xF];
+        d += 4; s += 2;
+    }
+    for (int i = 0; d < end; i++)
+        *d++ = tlut[(i & 1) ? (*s++ & 0xF) : (*s >> 4)];
+}
+
+static void blit_row_ci8_rgba32(void *dst, const uint8_t *row, int sx, int n, const uint16_t *tlut)
+{
+    uint32_t *d = dst; const uint8_t *s = row + sx;
+    for (int i = 0; i < n; i++)
+        d[i] = rgba16_to_32(tlut[s[i]]);
+}
+
+static void blit_row_ci4_rgba32(void *dst, const uint8_t *row, int sx, int n, const uint16_t *tlut)
+{
+    uint32_t *d = dst;
+    for (int i = sx; i < sx + n; i++)
+        *d++ = rgba16_to_32(tlut[(i & 1) ? (row[i/2] & 0xF) : (row[i/2] >> 4)]);
+}
+
+/** @brief Return the kernel converting from src to dst, or NULL if the format pair is not supported */
+static blit_row_func_t blit_row_func(tex_format_t dst, tex_format_t src)
+{
+    switch (src) {
+    case FMT_RGBA32: return dst == FMT_RGBA16 ? blit_row_rgba32_rgba16 : NULL;
+    case FMT_RGBA16: return dst == FMT_RGBA32 ? blit_row_rgba16_rgba32 : NULL;
+    case FMT_CI8:    return dst == FMT_RGBA16 ? blit_row_ci8_rgba16 : dst == FMT_RGBA32 ? blit_row_ci8_rgba32 : NULL;
+    case FMT_CI4:    return dst == FMT_RGBA16 ? blit_row_ci4_rgba16 : dst == FMT_RGBA32 ? blit_row_ci4_rgba32 : NULL;
+    default:         return NULL;
+    }
+}
+
+void surface_blit(surface_t *dst, const surface_t *src, int x, int y, const uint16_t *tlut, uint32_t flags)
+{
+    tex_format_t dfmt = surface_get_format(dst);
+    tex_format_t sfmt = surface_get_format(src);
+
+    // Clip the destination rectangle
+    int x0 = 0, y0 = 0, w = src->width, h = src->height;
+    if (x < 0) { x0 = -x; w += x; x = 0; }
+    if (y < 0) { y0 = -y; h += y; y = 0; }
+    w = MIN(w, (int)dst->width - x);
+    h = MIN(h, (int)dst->height - y);
+    if (w <= 0 || h <= 0)
+        return;
+
+    if (dfmt == sfmt && TEX_FORMAT_BITDEPTH(sfmt) >= 8) {
+        int bpp = TEX_FORMAT_BITDEPTH(sfmt) / 8;
+
+        if ((flags & SURFACE_BLIT_RDP) && bpp == 2 && ((uint32_t)dst->buffer & 63) == 0) {
+            // Same-format 16-bit blits can be done by the RDP in copy mode
+            surface_t sub = surface_make_sub((surface_t*)src, x0, y0, w, h);
+            rdp_attach(dst);
+            rdp_enable_texture_copy();
+            rdp_draw_surface(x, y, &sub);
+            rdp_detach();
+            return;
+        }
+
+        for (int j = 0; j < h; j++)
+            memcpy(dst->buffer + (y + j) * dst->stride + x * bpp,
+                src->buffer + (y0 + j) * src->stride + x0 * bpp, w * bpp);
+        return;
+    }
+
+    blit_row_func_t func = blit_row_func(dfmt, sfmt);
+    assertf(func, "unsupported blit format pair: %s -> %s", tex_format_name(sfmt), tex_format_name(dfmt));
+    assertf(!(sfmt == FMT_CI4 || sfmt == FMT_CI8) || tlut, "a palette is required to blit from %s", tex_format_name(sfmt));
+
+    int dbpp = TEX_FORMAT_BITDEPTH(dfmt) / 8;
+    for (int j = 0; j < h; j++)
+        func(dst->buffer + (y + j) * dst->stride + x * dbpp,
+            src->buffer + (y0 + j) * src->stride, x0, w, tlut);
+}
+
 extern inline surface_t surface_make(void *buffer, tex_format_t format, uint32_t width, uint32_t height, uint32_t stride);
 extern inline tex_format_t surface_get_format(const surface_t *surface);
 extern inline surface_t surface_make_linear(void *buffer, tex_format_t format, uint32_t width, uint32_t height);
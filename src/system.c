@@ -117,6 +117,8 @@ typedef struct
      * (eg. 'rom:/' or 'cf:/') 
      */
     char *prefix;
+    /** @brief Length of the prefix */
+    int prefix_len;
     /** @brief Filesystem callback pointers */
     filesystem_t *fs;
 } fs_mapping_t;
@@ -137,7 +139,8 @@ typedef struct
     void *handle;
     /** @brief The handle assigned by the filesystem code that will be returned
      *         to newlib.  All subsequent newlib calls will use this handle which
-     *         will be used to look up the internal reference. */
+     *         will be used to look up the internal reference.  It encodes the
+     *         index of this structure in `handles` (see #__get_new_handle). */
     int fileno;
 } fs_handle_t;
 
@@ -145,6 +148,8 @@ typedef struct
 static fs_mapping_t filesystems[MAX_FILESYSTEMS] = { { 0 } };
 /** @brief Array of open handles tracked */
 static fs_handle_t handles[MAX_OPEN_HANDLES] = { { 0 } };
+/** @brief Index of the filesystem matched by the last lookup by name (-1 if none) */
+static int last_fs_link = -1;
 /** @brief Current stdio hook structure */
 static stdio_t stdio_hooks = { 0 };
 /** @brief Function to provide the current time */
@@ -271,27 +276,59 @@ static int __strcmp( const char * const a, const char * const b )
     return __strncmp( a, b, -1 );
 }
 
+/** @brief First file handle given out to files (past STDIN, STDOUT, STDERR) */
+#define FIRST_FILE_HANDLE       3
+
 /**
- * @brief Return a unique filesystem handle
+ * @brief Return a unique filesystem handle for an entry of `handles`
+ *
+ * The handle encodes the index of the entry, so that it can be looked up
+ * directly (see #__get_handle), and a generation counter, so that handles
+ * of closed files are not reused for a long time.
+ *
+ * @param[in] slot
+ *            Index of the entry in `handles`
  *
  * @return A unique 32-bit value usable as a filesystem handle
  */
-static int __get_new_handle()
+static int __get_new_handle( int slot )
 {
-    /* Start past STDIN, STDOUT, STDERR file handles */
-    static int handle = 3;
+    static int generation = 0;
     int newhandle;
 
     disable_interrupts();
 
-    /* Always give out a nonzero handle unique to the system */
-    newhandle = handle++;
+    /* Always give out a positive handle */
+    newhandle = FIRST_FILE_HANDLE + slot + generation * MAX_OPEN_HANDLES;
+    if( ++generation > (0x7FFFFFFF - FIRST_FILE_HANDLE) / MAX_OPEN_HANDLES - 1 )
+    {
+        generation = 0;
+    }
 
     enable_interrupts();
 
     return newhandle;
 }
 
+/**
+ * @brief Look up the entry of `handles` of an open file
+ *
+ * @param[in] fileno
+ *            File handle
+ *
+ * @return The entry, or null if the handle is not valid.
+ */
+static inline fs_handle_t *__get_handle( int fileno )
+{
+    if( fileno < FIRST_FILE_HANDLE )
+    {
+        return 0;
+    }
+
+    fs_handle_t *h = &handles[(fileno - FIRST_FILE_HANDLE) % MAX_OPEN_HANDLES];
+    return h->fileno == fileno ? h : 0;
+}
+
 /**
  * @brief Register a filesystem with newlib
  *
@@ -369,6 +406,7 @@ int attach_filesystem( const char * const prefix, filesystem_t *filesystem )
 
     /* Attach the prefix */
     filesystems[handle].prefix = __strdup( prefix );
+    filesystems[handle].prefix_len = len;
 
     /* Attach the inputted filesystem */
     filesystems[handle].fs = filesystem;
@@ -417,7 +455,12 @@ int detach_filesystem( const char * const prefix )
                 /* Now free the memory associated with the prefix and zero out the filesystem */
                 free( filesystems[i].prefix );
                 filesystems[i].prefix = 0;
+                filesystems[i].prefix_len = 0;
                 filesystems[i].fs = 0;
+                if( last_fs_link == i )
+                {
+                    last_fs_link = -1;
+                }
 
                 /* All went well */
                 return 0;
@@ -442,23 +485,9 @@ int detach_filesystem( const char * const prefix )
  */
 static filesystem_t *__get_fs_pointer_by_handle( int fileno )
 {
-    /* Invalid */
-    if( fileno <= 0 )
-    {
-        return 0;
-    }
+    fs_handle_t *h = __get_handle( fileno );
 
-    for( int i = 0; i < MAX_OPEN_HANDLES; i++ )
-    {
-        if( handles[i].fileno == fileno )
-        {
-            /* Found it */
-            return filesystems[handles[i].fs_mapping].fs;
-        }
-    }
-
-    /* Couldn't find it */
-    return 0;
+    return h ? filesystems[h->fs_mapping].fs : 0;
 }
 
 /**
@@ -477,13 +506,22 @@ static int __get_fs_link_by_name( const char * const name )
         return -1;
     }
 
+    /* Most accesses go to the same filesystem: try the last one first */
+    int last = last_fs_link;
+    if( last >= 0 && filesystems[last].prefix &&
+        __strncmp( filesystems[last].prefix, name, filesystems[last].prefix_len ) == 0 )
+    {
+        return last;
+    }
+
     for( int i = 0; i < MAX_FILESYSTEMS; i++ )
     {
         if( filesystems[i].prefix )
         {
-            if( __strncmp( filesystems[i].prefix, name, __strlen( filesystems[i].prefix ) ) == 0 )
+            if( __strncmp( filesystems[i].prefix, name, filesystems[i].prefix_len ) == 0 )
             {
                 /* Found it */
+                last_fs_link = i;
                 return i;
             }
         }
@@ -526,23 +564,9 @@ static filesystem_t *__get_fs_pointer_by_name( const char * const name )
  */
 static void *__get_fs_handle( int fileno )
 {
-    /* Invalid */
-    if( fileno <= 0 )
-    {
-        return 0;
-    }
-
-    for( int i = 0; i < MAX_OPEN_HANDLES; i++ )
-    {
-        if( handles[i].fileno == fileno )
-        {
-            /* Found it */
-            return handles[i].handle;
-        }
-    }
+    fs_handle_t *h = __get_handle( fileno );
 
-    /* Couldn't find it */
-    return 0;
+    return h ? h->handle : 0;
 }
 
 /**
@@ -586,15 +610,10 @@ int close( int fildes )
     }
 
     /* Free the open file handle */
-    for( int i = 0; i < MAX_OPEN_HANDLES; i++)
-    {
-        if( handles[i].fileno == fildes )
-        {
-            handles[i].fs_mapping = 0;
-            handles[i].handle = NULL;
-            handles[i].fileno = 0;
-        }
-    }
+    fs_handle_t *h = __get_handle( fildes );
+    h->fs_mapping = 0;
+    h->handle = NULL;
+    h->fileno = 0;
 
     if( fs->close == 0 )
     {
@@ -849,14 +868,16 @@ int lseek( int file, int ptr, int dir )
  */
 int open( const char *file, int flags, ... )
 {
-    filesystem_t *fs = __get_fs_pointer_by_name( file );
+    int mapping = __get_fs_link_by_name( file );
 
-    if( fs == 0 )
+    if( mapping < 0 )
     {
         errno = EINVAL;
         return -1;
     }
 
+    filesystem_t *fs = filesystems[mapping].fs;
+
     if( fs->open == 0 )
     {
         /* Filesystem doesn't support open */
@@ -880,16 +901,8 @@ int open( const char *file, int flags, ... )
     {
         if( handles[i].fileno == 0 )
         {
-            /* Yes, we have room, try the open */
-            int mapping = __get_fs_link_by_name( file );
-
-            if( mapping < 0 )
-            {
-                errno = EINVAL;
-                return -1;
-            }
-
-            /* Clear errno so we can check whether the fs->open() call sets it. 
+            /* Yes, we have room, try the open.
+               Clear errno so we can check whether the fs->open() call sets it. 
                This is for backward compatibility, because we used not to require
                errno to be set. */
             errno = 0;
@@ -898,12 +911,12 @@ int open( const char *file, int flags, ... )
                open used to mistakenly take a char* instead of a const char*,
                and we don't want to break existing code for filesystem_t.open,
                so filesystem_t.open still takes char* */
-            void *ptr = fs->open( (char *)( file + __strlen( filesystems[mapping].prefix ) ), flags );
+            void *ptr = fs->open( (char *)( file + filesystems[mapping].prefix_len ), flags );
 
             if( ptr )
             {
                 /* Create new internal handle */
-                handles[i].fileno = __get_new_handle();
+                handles[i].fileno = __get_new_handle( i );
                 handles[i].handle = ptr;
                 handles[i].fs_mapping = mapping;
 
@@ -982,6 +995,57 @@ int read( int file, char *ptr, int len )
     }
 }
 
+/**
+ * @brief Start an asynchronous read from a file
+ *
+ * This is an extension to the POSIX API, for filesystems that can transfer
+ * data in background (eg: DragonFS via PI DMA). The function returns
+ * immediately, and the callback is invoked once the data is available in
+ * the buffer, possibly from an interrupt handler. Filesystems that do not
+ * implement asynchronous reads fall back to a blocking read, and the callback
+ * is invoked before returning.
+ *
+ * @note This function bypasses stdio buffering: when used on a FILE, make
+ *       sure that it is unbuffered (see setvbuf).
+ *
+ * @param[in]  file
+ *             File handle
+ * @param[out] ptr
+ *             Data pointer to read data to
+ * @param[in]  len
+ *             Length in bytes of data to read
+ * @param[in]  cb
+ *             Callback invoked when the read has completed (can be NULL)
+ * @param[in]  ctx
+ *             Opaque context passed to the callback
+ *
+ * @return Number of bytes that will be read or a negative value on error.
+ */
+int read_async( int file, void *ptr, int len, void (*cb)(void *ctx, int len), void *ctx )
+{
+    filesystem_t *fs = __get_fs_pointer_by_handle( file );
+    void *handle = __get_fs_handle( file );
+
+    if( fs == 0 )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if( fs->read_async == 0 )
+    {
+        /* Filesystem doesn't support asynchronous reads, do a blocking one */
+        int ret = read( file, ptr, len );
+        if( ret >= 0 && cb )
+        {
+            cb( ctx, ret );
+        }
+        return ret;
+    }
+
+    return fs->read_async( handle, (uint8_t *)ptr, len, cb, ctx );
+}
+
 /**
  * @brief Read a link
  *
@@ -1132,7 +1196,7 @@ int unlink( char *name )
     }
 
     /* Must offset past the prefix */
-    return fs->unlink( name + __strlen( filesystems[mapping].prefix ) );
+    return fs->unlink( name + filesystems[mapping].prefix_len );
 }
 
 /**
@@ -1250,7 +1314,7 @@ int dir_findfirst( const char * const path, dir_t *dir )
         return -1;
     }
 
-    return fs->findfirst( (char *)path + + __strlen( filesystems[mapping].prefix ), dir );
+    return fs->findfirst( (char *)path + + filesystems[mapping].prefix_len, dir );
 }
 
 /**
@@ -0,0 +1,285 @@
+/**
+ * @file tilemap.c
+ * @brief Scrolling tilemaps
+ * @ingroup tilemap
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "tilemap.h"
+#include "rdp.h"
+#include "rspq.h"
+#include "debug.h"
+#include "utils.h"
+
+/**
+ * @defgroup tilemap Scrolling tilemaps
+ * @ingroup display
+ * @brief Tilemaps rendered incrementally into an offscreen surface.
+ *
+ * Drawing a full-screen tilemap tile by tile every frame (eg: with
+ * #graphics_draw_sprite_stride or #rdp_draw_sprites_batch) costs a texture
+ * load and a rectangle per tile. This module keeps the visible part of the
+ * map rendered in an offscreen surface, slightly larger than the view, and
+ * draws the view to the screen with a copy of the surface (#rdp_draw_surface_region).
+ * When the view scrolls, only the rows and columns of tiles that become
+ * visible are rendered, by the CPU.
+ *
+ * @code{.c}
+ *      tilemap_t *tm = tilemap_new(tileset, map, 256, 64, 320, 240);
+ *
+ *      while (1) {
+ *          surface_t *disp = display_get();
+ *          rdp_attach(disp);
+ *          rdp_enable_texture_copy();
+ *
+ *          tilemap_scroll(tm, camera_x, camera_y);
+ *          tilemap_draw(tm, 0, 0);
+ *
+ *          rdp_detach();
+ *          display_show(disp);
+ *      }
+ * @endcode
+ *
+ * The tileset is a 16-bit (#FMT_RGBA16) spritemap: each slice is a tile, and
+ * the cells of the map are slice indices (see #rdp_load_texture_stride), or
+ * #TILEMAP_EMPTY. It must be in the format of the surface it is drawn to, as
+ * the copy does not convert pixels.
+ *
+ * The offscreen surface is a ring of tiles: the view wraps around its edges,
+ * so scrolling never moves pixels, and the view is drawn with at most four
+ * copies (one per side of the wraparound). The surface has a spare row and
+ * column of tiles, that are never visible in the previous frame, so the CPU
+ * can render them while the RDP is still drawing it. Scrolling by more than
+ * one tile per frame waits for the RDP first (see #rspq_wait).
+ * @{
+ */
+
+/** @brief A scrolling tilemap */
+struct tilemap_s {
+    surface_t tiles;            ///< Pixels of the tileset
+    int tile_width;             ///< Width of a tile in pixels
+    int tile_height;            ///< Height of a tile in pixels
+    int tiles_per_row;          ///< Number of tiles in a row of the tileset
+    int num_tiles;              ///< Number of tiles in the tileset
+
+    uint16_t *map;              ///< Cells of the map (tile indices)
+    int map_width;              ///< Width of the map in cells
+    int map_height;             ///< Height of the map in cells
+    int view_width;             ///< Width of the view in pixels
+    int view_height;            ///< Height of the view in pixels
+
+    surface_t buf;              ///< Offscreen ring of rendered tiles
+    int slots_x;                ///< Number of columns of tiles in buf
+    int slots_y;                ///< Number of rows of tiles in buf
+
+    int scroll_x;               ///< Position of the view in the map, in pixels
+    int scroll_y;               ///< Position of the view in the map, in pixels
+    int col0, col1;             ///< Range of rendered columns of cells (col1 excluded)
+    int row0, row1;             ///< Range of rendered rows of cells (row1 excluded)
+};
+
+/** @brief Render a cell of the map into its slot of the offscreen surface */
+static void tilemap_render_cell(tilemap_t *tm, int c, int r)
+{
+    int tw = tm->tile_width, th = tm->tile_height;
+    uint8_t *dst = (uint8_t*)tm->buf.buffer + (r % tm->slots_y) * th * tm->buf.stride
+        + (c % tm->slots_x) * tw * 2;
+
+    uint16_t tile = TILEMAP_EMPTY;
+    if (c < tm->map_width && r < tm->map_height)
+        tile = tm->map[r * tm->map_width + c];
+
+    if (tile == TILEMAP_EMPTY || tile >= tm->num_tiles) {
+        for (int y = 0; y < th; y++, dst += tm->buf.stride)
+            memset(dst, 0, tw * 2);
+        return;
+    }
+
+    const uint8_t *src = (const uint8_t*)tm->tiles.buffer
+        + (tile / tm->tiles_per_row) * th * tm->tiles.stride
+        + (tile % tm->tiles_per_row) * tw * 2;
+    for (int y = 0; y < th; y++, dst += tm->buf.stride, src += tm->tiles.stride)
+        memcpy(dst, src, tw * 2);
+}
+
+/** @brief Render the cells in the specified ranges of columns and rows */
+static void tilemap_render(tilemap_t *tm, int c0, int c1, int r0, int r1)
+{
+    for (int r = r0; r < r1; r++)
+        for (int c = c0; c < c1; c++)
+            tilemap_render_cell(tm, c, r);
+}
+
+/**
+ * @brief Create a tilemap
+ *
+ * The map is not copied: it must stay valid until #tilemap_free. If it is
+ * changed directly, call #tilemap_invalidate (or use #tilemap_set_tile).
+ *
+ * @param tileset       Spritemap with the tiles (#FMT_RGBA16)
+ * @param map           Cells of the map, by rows (tile indices or #TILEMAP_EMPTY)
+ * @param map_width     Width of the map in cells
+ * @param map_height    Height of the map in cells
+ * @param view_width    Width of the view in pixels (eg: the screen width)
+ * @param view_height   Height of the view in pixels (eg: the screen height)
+ * @return The new tilemap, scrolled to the top left corner of the map
+ */
+tilemap_t *tilemap_new(sprite_t *tileset, uint16_t *map, int map_width, int map_height,
+    int view_width, int view_height)
+{
+    assertf(sprite_get_format(tileset) == FMT_RGBA16, "tilemap: tileset must be RGBA16 (is: %s)",
+        tex_format_name(sprite_get_format(tileset)));
+    assertf(map_width > 0 && map_height > 0, "tilemap: invalid map size: %dx%d", map_width, map_height);
+    assertf(view_width > 0 && view_height > 0, "tilemap: invalid view size: %dx%d", view_width, view_height);
+
+    tilemap_t *tm = calloc(1, sizeof(tilemap_t));
+    tm->tiles = sprite_get_pixels(tileset);
+    tm->tile_width = tileset->width / tileset->hslices;
+    tm->tile_height = tileset->height / tileset->vslices;
+    tm->tiles_per_row = tileset->hslices;
+    tm->num_tiles = tileset->hslices * tileset->vslices;
+    tm->map = map;
+    tm->map_width = map_width;
+    tm->map_height = map_height;
+    tm->view_width = view_width;
+    tm->view_height = view_height;
+
+    // The view spans one more tile than its size when it is not aligned,
+    // plus a spare one to render while the previous frame is being drawn
+    tm->slots_x = DIVIDE_CEIL(view_width, tm->tile_width) + 2;
+    tm->slots_y = DIVIDE_CEIL(view_height, tm->tile_height) + 2;
+    tm->buf = surface_alloc(FMT_RGBA16, tm->slots_x * tm->tile_width, tm->slots_y * tm->tile_height);
+    assertf(tm->buf.buffer, "tilemap: out of memory");
+
+    tilemap_scroll(tm, 0, 0);
+    return tm;
+}
+
+/**
+ * @brief Free a tilemap
+ *
+ * The RDP must be done drawing it (eg: after #rspq_wait or #rdp_detach).
+ *
+ * @param tm            Tilemap to free
+ */
+void tilemap_free(tilemap_t *tm)
+{
+    surface_free(&tm->buf);
+    free(tm);
+}
+
+/**
+ * @brief Scroll the view to the specified position
+ *
+ * The tiles that become visible are rendered into the offscreen surface. The
+ * position is clamped, so that the view stays within the map.
+ *
+ * @param tm            Tilemap
+ * @param x             X position of the top left corner of the view in the map, in pixels
+ * @param y             Y position of the top left corner of the view in the map, in pixels
+ */
+void tilemap_scroll(tilemap_t *tm, int x, int y)
+{
+    int tw = tm->tile_width, th = tm->tile_height;
+    x = CLAMP(x, 0, MAX(0, tm->map_width * tw - tm->view_width));
+    y = CLAMP(y, 0, MAX(0, tm->map_height * th - tm->view_height));
+    tm->scroll_x = x;
+    tm->scroll_y = y;
+
+    int c0 = x / tw, c1 = (x + tm->view_width - 1) / tw + 1;
+    int r0 = y / th, r1 = (y + tm->view_height - 1) / th + 1;
+
+    if (c0 >= tm->col1 || c1 <= tm->col0 || r0 >= tm->row1 || r1 <= tm->row0) {
+        // Nothing in common with the rendered cells: render everything
+        if (tm->col1 > tm->col0)
+            rspq_wait();
+        tilemap_render(tm, c0, c1, r0, r1);
+    } else {
+        int new_cols = MAX(0, tm->col0 - c0) + MAX(0, c1 - tm->col1);
+        int new_rows = MAX(0, tm->row0 - r0) + MAX(0, r1 - tm->row1);
+        if (new_cols + new_rows == 0) {
+            tm->col0 = c0; tm->col1 = c1;
+            tm->row0 = r0; tm->row1 = r1;
+            return;
+        }
+
+        // Only the spare row and column are not visible in the previous frame
+        if (new_cols > 1 || new_rows > 1)
+            rspq_wait();
+
+        // New columns, over all the rows of the view
+        tilemap_render(tm, c0, MIN(tm->col0, c1), r0, r1);
+        tilemap_render(tm, MAX(tm->col1, c0), c1, r0, r1);
+
+        // New rows, over the columns that were already rendered
+        int oc0 = MAX(tm->col0, c0), oc1 = MIN(tm->col1, c1);
+        tilemap_render(tm, oc0, oc1, r0, MIN(tm->row0, r1));
+        tilemap_render(tm, oc0, oc1, MAX(tm->row1, r0), r1);
+    }
+
+    tm->col0 = c0; tm->col1 = c1;
+    tm->row0 = r0; tm->row1 = r1;
+}
+
+/**
+ * @brief Change a cell of the map
+ *
+ * If the cell is visible, it is rendered immediately, so the change might
+ * also appear in a frame that the RDP is still drawing.
+ *
+ * @param tm            Tilemap
+ * @param tx            Column of the cell
+ * @param ty            Row of the cell
+ * @param tile          New tile index (or #TILEMAP_EMPTY)
+ */
+void tilemap_set_tile(tilemap_t *tm, int tx, int ty, uint16_t tile)
+{
+    assertf(tx >= 0 && tx < tm->map_width && ty >= 0 && ty < tm->map_height,
+        "tilemap: cell out of the map: %d,%d", tx, ty);
+    tm->map[ty * tm->map_width + tx] = tile;
+    if (tx >= tm->col0 && tx < tm->col1 && ty >= tm->row0 && ty < tm->row1)
+        tilemap_render_cell(tm, tx, ty);
+}
+
+/**
+ * @brief Render again all the visible tiles
+ *
+ * Call this after changing the map directly, or the pixels of the tileset.
+ * It waits for the RDP to finish drawing the previous frames.
+ *
+ * @param tm            Tilemap
+ */
+void tilemap_invalidate(tilemap_t *tm)
+{
+    rspq_wait();
+    tm->col0 = tm->col1 = 0;
+    tm->row0 = tm->row1 = 0;
+    tilemap_scroll(tm, tm->scroll_x, tm->scroll_y);
+}
+
+/**
+ * @brief Draw the view to the attached surface
+ *
+ * The view is copied with #rdp_draw_surface_region, whose requirements apply:
+ * the RDP must be attached to a 16-bit surface, and in copy mode (see
+ * #rdp_enable_texture_copy).
+ *
+ * @param tm            Tilemap
+ * @param x             X position of the view on the attached surface, in pixels
+ * @param y             Y position of the view on the attached surface, in pixels
+ */
+void tilemap_draw(tilemap_t *tm, int x, int y)
+{
+    // Position of the view in the ring, and size of the part before the wraparound
+    int bx = tm->scroll_x % tm->buf.width, by = tm->scroll_y % tm->buf.height;
+    int w0 = MIN(tm->view_width, (int)tm->buf.width - bx);
+    int h0 = MIN(tm->view_height, (int)tm->buf.height - by);
+    int w1 = tm->view_width - w0, h1 = tm->view_height - h0;
+
+    rdp_draw_surface_region(x, y, &tm->buf, bx, by, w0, h0);
+    if (w1) rdp_draw_surface_region(x + w0, y, &tm->buf, 0, by, w1, h0);
+    if (h1) rdp_draw_surface_region(x, y + h0, &tm->buf, bx, 0, w0, h1);
+    if (w1 && h1) rdp_draw_surface_region(x + w0, y + h0, &tm->buf, 0, 0, w1, h1);
+}
+
+/** @} */
@@ -3,10 +3,11 @@
  * @brief Timer Subsystem
  * @ingroup timer
  */
-#include <malloc.h>
 #include "timer.h"
+#include "blkpool.h"
 #include "interrupt.h"
 #include "debug.h"
+#include "debug_internal.h"
 #include "regsinternal.h"
 #include "utils.h"
 
@@ -32,6 +33,24 @@
  * responsibility of the calling code to be freed, regardless of a call to
  * #timer_close.
  *
+ * Running timers are kept in a queue sorted by deadline, so the cost of
+ * starting, stopping and expiring a timer grows only logarithmically with
+ * the number of timers. A timer can be stopped or restarted from any
+ * callback, including its own.
+ *
+ * By default, the timer interrupt is programmed to fire exactly at each
+ * deadline. To reduce the number of interrupts when many timers expire
+ * close to each other, a timer can be given some slack with
+ * #timer_set_slack: it will then fire at any time within the slack window
+ * after its deadline, together with any other timer expiring in the
+ * meantime.
+ *
+ * Code that creates and deletes timers frequently (eg: gameplay code)
+ * can call #timer_pool_init to preallocate a number of timers, so that
+ * #new_timer and #delete_timer do not go through the heap allocator. This
+ * also allows to create and delete timers from interrupt handlers (eg:
+ * from a timer callback).
+ *
  * Because the MIPS internal counter wraps around after ~90 seconds (see
  * TICKS_READ), it's not possible to schedule a timer more than 90 seconds
  * in the future.
@@ -39,166 +58,235 @@
  * @{
  */
 
-/** @brief Internal linked list of timers */
+/**
+ * @brief Queue of the running timers.
+ *
+ * The timers are kept in a pairing heap ordered by deadline, whose nodes
+ * are the timer structures themselves (see #timer_link_t::next,
+ * #timer_link_t::child and #timer_link_t::prev), so that no memory needs
+ * to be allocated under interrupt. The earliest timer is at the root;
+ * insertions cost O(1), and removing a timer costs O(log n) amortized.
+ */
 static timer_link_t *TI_timers = 0;
 
+/** @brief Internal overflow timer (also used to check that the module is initialized) */
+static timer_link_t *TI_overflow = 0;
+
 /** @brief Higher-part of 64-bit tick counter */
 volatile uint32_t ticks64_high;
 
+/** @brief Higher part of the 64-bit clock used for the deadlines in the queue */
+static uint32_t queue_ticks_high;
+/** @brief Last value of the hardware counter read by #timer_queue_ticks */
+static uint32_t queue_ticks_last;
+
+/** @brief Last value of the 64-bit clock (see #get_ticks64) */
+extern volatile uint64_t __ticks64_last;
+
 /** @brief Time at which interrupts were disabled */
 extern volatile uint32_t interrupt_disabled_tick;
 
+/** @brief Pool of the timers allocated by #new_timer and #new_timer_context */
+static blkpool_t timer_pool = BLKPOOL_INIT(timer_link_t, 8);
+
 /** @brief Timer callback expects a context parameter */
 #define TF_CONTEXT     0x20
 
 /** @brief Timer is the special overflow timer. */
 #define TF_OVERFLOW    0x40
 
-/** @brief Timer has been called once in this interrupt. */
-#define TF_CALLED      0x80
+/** @brief Timer is currently in the queue. */
+#define TF_QUEUED      0x80
+
+/**
+ * @brief Read the current time, extended to 64 bits, for the deadlines in the queue.
+ *
+ * Wrap-arounds of the hardware counter are detected by comparing with the
+ * previous reading. This is reliable because the overflow timer makes sure
+ * that the counter is read at least once per wrap-around.
+ *
+ * @note This function must be called with interrupts disabled.
+ */
+static uint64_t timer_queue_ticks(void)
+{
+	uint32_t now = TICKS_READ();
+	if (now < queue_ticks_last)
+		queue_ticks_high++;
+	queue_ticks_last = now;
+	return ((uint64_t)queue_ticks_high << 32) | now;
+}
+
+/** @brief Latest time at which a timer must fire, used as key in the queue */
+static inline uint64_t timer_latest(timer_link_t *timer)
+{
+	return timer->deadline + timer->slack;
+}
 
-/** @brief Update the compare register to match the first expiring timer. */
-__attribute__((noinline))
-static void timer_update_compare(timer_link_t *head, uint32_t now)
+/** @brief Meld two heaps, returning the new root */
+static timer_link_t *timer_heap_meld(timer_link_t *a, timer_link_t *b)
 {
-	uint32_t smallest = 0xFFFFFFFF;
+	if (!a) return b;
+	if (!b) return a;
+	if (timer_latest(b) < timer_latest(a)) {
+		timer_link_t *t = a; a = b; b = t;
+	}
 
-	while (head)
-	{
-		/* See how much time is left before the timer expires. Notice that
-		   the subtraction is also safe with overflows. */
-		uint32_t left = head->left - now;
-		if (left < smallest)
-			smallest = left;
-
-		/* Go to next */
-		head = head->next;
+	/* b becomes the first child of a */
+	b->prev = a;
+	b->next = a->child;
+	if (a->child)
+		a->child->prev = b;
+	a->child = b;
+	return a;
+}
+
+/** @brief Meld a list of sibling heaps into one (two-pass pairing), returning the new root */
+static timer_link_t *timer_heap_merge_pairs(timer_link_t *first)
+{
+	timer_link_t *pairs = NULL;
+
+	/* First pass: meld the siblings in pairs, left to right, collecting the
+	   results in reverse order. */
+	while (first) {
+		timer_link_t *a = first;
+		timer_link_t *b = a->next;
+		first = b ? b->next : NULL;
+		a->next = a->prev = NULL;
+		if (b) b->next = b->prev = NULL;
+		a = timer_heap_meld(a, b);
+		a->next = pairs;
+		pairs = a;
 	}
 
-	/* set compare to shortest time left */
-	C0_WRITE_COMPARE(now + smallest);
+	/* Second pass: meld the results into a single heap, right to left. */
+	timer_link_t *root = NULL;
+	while (pairs) {
+		timer_link_t *next = pairs->next;
+		pairs->next = NULL;
+		root = timer_heap_meld(root, pairs);
+		pairs = next;
+	}
+	if (root)
+		root->prev = root->next = NULL;
+	return root;
 }
 
 /**
- * @brief Process linked list of timers
- *
- * Walk the linked list of timers and call the callbacks of any that
- * have expired.
- *
- * @note This function will remove one-shot timers from the list after
- *       they have fired.
- *
- * @param[in] head
- *            Head of the linked list of timers
+ * @brief Insert a timer in the queue
  *
- * @retval 1 The list needs reprocessing
- * @retval 0 All timer operations were handled successfully
+ * @param[in] timer
+ *            Timer to insert. Its deadline must be set.
  */
-static int __proc_timers(timer_link_t * thead)
+static void timer_queue_insert(timer_link_t *timer)
 {
-	timer_link_t *head = thead;
-	timer_link_t *last = 0;
-	uint32_t start = C0_COMPARE();
-	uint32_t now = TICKS_READ();
+	timer->left = timer->deadline;
+	timer->child = timer->next = timer->prev = NULL;
+	timer->flags |= TF_QUEUED;
+	TI_timers = timer_heap_meld(TI_timers, timer);
+	TI_timers->prev = TI_timers->next = NULL;
+}
 
-	while (head)
-	{
-		/* Consider a timer as expired if its deadline is at the
-		 * COMPARE value (time at which the interrupt triggered) or up to 5
-		 * microseconds after. This 5 microseconds window is useful to cluster
-		 * timers that expire close to each other; eg: if the client creates
-		 * many timers with the same period, they will be created in a fast
-		 * sequence and have a little delay between each other. */
-		if (!(head->flags & TF_CALLED) && 
-			!(head->flags & TF_DISABLED) &&
-			TICKS_DISTANCE(start, head->left) >= 0 && 
-			TICKS_DISTANCE(head->left, now+TIMER_TICKS(5)) >= 0)
-		{
-			/* yes - timed out, do callback */
-			head->ovfl = TICKS_DISTANCE(head->left, now);
-
-			/* invoke the appropriate callback function */
-			if (head->flags & TF_CONTEXT && head->callback_with_context)
-				head->callback_with_context(head->ovfl, head->ctx);
-			else if (head->callback)
-				head->callback(head->ovfl);
-
-			if (head->flags & TF_DISABLED)
-			{
-				/* Timer was disabled during the callback. We need to
-				 * reprocess the list to see if there are other timers
-				 * that need to be called. */
-				return 1;
-			}
-
-			/* reset ticks if continuous */
-			if (head->flags & TF_CONTINUOUS)
-			{
-				head->left += head->set;
-				last = head;
-
-				/* Special case: the internal overflow timer has a period
-				 * of 2**32, so next occurrence will look exactly like the
-				 * current one. Since we're going to reprocess the list, we
-				 * would keep executing it many times until we eventually
-				 * exit the 5 microseconds window.
-				 * So we mark this timer as already called (TF_CALLED) and
-				 * avoid calling it again. 
-				 *
-				 * Notice that we do this only for overflow because other timers
-				 * with a short period might actually be called multiple times
-				 * under interrupt. For instance, if a continuous timer with
-				 * a short period is followed by a very slow one-shot timer,
-				 * when the latter is finished the former might need to fire again.
-				 */
-				if (head->flags & TF_OVERFLOW)
-					head->flags |= TF_CALLED;
-			}
-			else
-			{
-				/* one-shot, remove from list */
-				if (last)
-					last->next = head->next;
-				else
-					TI_timers = head->next;
-			}
-
-			/* Go through timer list again. If the callback was slow, maybe
-			   other timers have expired. */
-			return 1;
-		}
+/**
+ * @brief Remove a timer from the queue
+ *
+ * @param[in] timer
+ *            Timer to remove. It must be in the queue.
+ */
+static void timer_queue_remove(timer_link_t *timer)
+{
+	timer_link_t *sub = timer_heap_merge_pairs(timer->child);
 
-		/* Go to next */
-		last = head;
-		head = head->next;
+	if (timer == TI_timers) {
+		TI_timers = sub;
+	} else {
+		/* Detach the timer from its parent or its previous sibling */
+		if (timer->prev->child == timer)
+			timer->prev->child = timer->next;
+		else
+			timer->prev->next = timer->next;
+		if (timer->next)
+			timer->next->prev = timer->prev;
+		TI_timers = timer_heap_meld(TI_timers, sub);
 	}
 
-	/* Clear the TF_CALLED flag from the overflow timer (if any) */
-	while (thead) {
-		thead->flags &= ~TF_CALLED;
-		thead = thead->next;
-	}
-	return 0;							// exit timer callback
+	timer->child = timer->next = timer->prev = NULL;
+	timer->flags &= ~TF_QUEUED;
+}
+
+/**
+ * @brief Set the deadline of a timer from now and insert it in the queue
+ *
+ * @param[in] timer
+ *            Timer to insert
+ * @param[in] ticks
+ *            Number of ticks before the timer should fire
+ */
+static void timer_queue_start(timer_link_t *timer, int ticks)
+{
+	timer->deadline = timer_queue_ticks() + (int32_t)ticks;
+	timer_queue_insert(timer);
 }
 
 /**
- * @brief Poll the timer list and run callbacks for expired timers
+ * @brief Poll the timer queue and run callbacks for expired timers
  *
  * This function is called by the interrupt handler whenever 
- * compare == count, and also when inserting into or removing
- * from the timers list to improve handling timers with tiny delays
+ * compare == count, and also when inserting into the timers queue
+ * to improve handling timers with tiny delays.
+ *
+ * The queue is sorted by the latest time each timer can fire (its
+ * deadline plus its slack), and the compare register is set to the latest
+ * time of the root. When the interrupt triggers, all timers at the front
+ * of the queue whose deadline has passed are run together.
  */
 static void timer_poll(void)
 {
 	uint32_t loop_count = 0;
-	while (__proc_timers(TI_timers)) {
+
+	while (TI_timers)
+	{
+		timer_link_t *head = TI_timers;
+		uint64_t now = timer_queue_ticks();
+
+		/* Consider a timer as expired if its deadline is now or up to 5
+		 * microseconds after. This 5 microseconds window is useful to cluster
+		 * timers that expire close to each other; eg: if the client creates
+		 * many timers with the same period, they will be created in a fast
+		 * sequence and have a little delay between each other. */
+		if (head->deadline > now + TIMER_TICKS(5))
+		{
+			/* Set compare to the earliest time a timer must fire. If it
+			   was reached in the meantime, go through the queue again. */
+			uint64_t latest = timer_latest(head);
+			C0_WRITE_COMPARE((uint32_t)latest);
+			if (timer_queue_ticks() < latest)
+				break;
+			continue;
+		}
+
 		++loop_count; (void)loop_count; // avoid warning (loop_count is used in assertf)
 		assertf(loop_count < 1000, "timer interrupt is stuck in an infinite loop.\n"
 			"Check continuous timers with a very short period.\n");
-	}
 
-	// Update counter for next interrupt.
-	timer_update_compare(TI_timers, TICKS_READ());
+		/* Remove the timer before calling the callback, so that the callback
+		   is free to stop or restart it. */
+		timer_queue_remove(head);
+		head->ovfl = now - head->deadline;
+
+		/* invoke the appropriate callback function */
+		if (head->flags & TF_CONTEXT && head->callback_with_context)
+			head->callback_with_context(head->ovfl, head->ctx);
+		else if (head->callback)
+			head->callback(head->ovfl);
+
+		/* reschedule if continuous, unless it was stopped or restarted by the callback */
+		if ((head->flags & TF_CONTINUOUS) && !(head->flags & (TF_DISABLED | TF_QUEUED)))
+		{
+			/* The internal overflow timer has a period of 2**31 */
+			head->deadline += (head->flags & TF_OVERFLOW) ? (1ull << 31) : head->set;
+			timer_queue_insert(head);
+		}
+	}
 }
 
 /**
@@ -206,11 +294,36 @@ static void timer_poll(void)
  *
  * This function is the callback of the internal overflow timer, which
  * is configured by timer_init() and is used to create a 64-bit timer
- * accessed by timer_ticks().
+ * accessed by timer_ticks(). It runs twice per wrap-around of the counter,
+ * so that it also keeps the clock of get_ticks64() up to date.
  */
 static void timer_overflow_callback(int ovfl)
 {
-	ticks64_high++;
+	get_ticks64();
+	/* Deadlines are multiples of 2**31: count the ones at a wrap-around */
+	if ((uint32_t)TI_overflow->deadline == 0)
+		ticks64_high++;
+}
+
+/**
+ * @brief Allocate a timer structure from the pool
+ *
+ * @return Pointer to the timer structure, or NULL if out of memory
+ */
+static timer_link_t *timer_alloc(void)
+{
+	return blkpool_alloc(&timer_pool);
+}
+
+/**
+ * @brief Free a timer structure allocated by #timer_alloc
+ *
+ * @param[in] timer
+ *            Timer structure to free
+ */
+static void timer_free(timer_link_t *timer)
+{
+	blkpool_free(&timer_pool, timer);
 }
 
 /**
@@ -225,20 +338,22 @@ static void timer_overflow_callback(int ovfl)
  */
 void timer_init(void)
 {
-	assertf(!TI_timers, "timer module already initialized");
-	/* Create first timer for overflows: expires when counter is 0 and
-	 * has a period of 2**32. */
-	timer_link_t *timer = malloc(sizeof(timer_link_t));
+	assertf(!TI_overflow, "timer module already initialized");
+	/* Create first timer for overflows: expires when counter is 0 or
+	 * 2**31, so it has a period of 2**31. */
+	timer_link_t *timer = timer_alloc();
 	if (timer)
 	{
-		timer->left = 0;
+		timer->deadline = 1ull << 31;
+		timer->slack = 0;
 		timer->set = 0;
 		timer->flags = TF_CONTINUOUS | TF_OVERFLOW;
 		timer->callback = timer_overflow_callback;
 		timer->ctx = NULL;
-		timer->next = NULL;
 
-		TI_timers = timer;
+		TI_timers = NULL;
+		timer_queue_insert(timer);
+		TI_overflow = timer;
 	}
 
 	/* Reset the count and compare registers. Avoid to accidentally trigger
@@ -246,11 +361,17 @@ void timer_init(void)
 	   timer interrupts in COP0. */
 	disable_interrupts();
 	ticks64_high = 0;
+	__ticks64_last = 0;
+	queue_ticks_high = 0;
+	queue_ticks_last = 0;
 	C0_WRITE_COUNT(1);
 	C0_WRITE_COMPARE(0);
 	set_TI_interrupt(1);
 	register_TI_handler(timer_poll);
 	enable_interrupts();
+
+	/* Now the debug library can send logs in background */
+	__debug_timer_init();
 }
 
 /**
@@ -270,24 +391,21 @@ void timer_init(void)
  */
 timer_link_t *new_timer(int ticks, int flags, timer_callback1_t callback)
 {
-	assertf(TI_timers, "timer module not initialized");
-	timer_link_t *timer = malloc(sizeof(timer_link_t));
+	assertf(TI_overflow, "timer module not initialized");
+	timer_link_t *timer = timer_alloc();
 	if (timer)
 	{
 		disable_interrupts();
 
-		uint32_t now = TICKS_READ();
-		timer->left = now + (int32_t)ticks;
 		timer->set = ticks;
+		timer->slack = 0;
 		timer->flags = flags;
 		timer->callback = callback;
 		timer->ctx = NULL;
 
 		if (!(flags & TF_DISABLED))
 		{
-			timer->next = TI_timers;
-			TI_timers = timer;
-			timer_update_compare(TI_timers, now);
+			timer_queue_start(timer, ticks);
 			timer_poll();
 		}
 
@@ -314,24 +432,21 @@ timer_link_t *new_timer(int ticks, int flags, timer_callback1_t callback)
  */
 timer_link_t *new_timer_context(int ticks, int flags, timer_callback2_t callback, void *ctx)
 {
-	assertf(TI_timers, "timer module not initialized");
-	timer_link_t *timer = malloc(sizeof(timer_link_t));
+	assertf(TI_overflow, "timer module not initialized");
+	timer_link_t *timer = timer_alloc();
 	if (timer)
 	{
 		disable_interrupts();
 
-		uint32_t now = TICKS_READ();
-		timer->left = now + (int32_t)ticks;
 		timer->set = ticks;
+		timer->slack = 0;
 		timer->flags = flags | TF_CONTEXT;
 		timer->callback_with_context = callback;
 		timer->ctx = ctx;
 
 		if (!(flags & TF_DISABLED))
 		{
-			timer->next = TI_timers;
-			TI_timers = timer;
-			timer_update_compare(TI_timers, now);
+			timer_queue_start(timer, ticks);
 			timer_poll();
 		}
 
@@ -357,23 +472,20 @@ timer_link_t *new_timer_context(int ticks, int flags, timer_callback2_t callback
  */
 void start_timer(timer_link_t *timer, int ticks, int flags, timer_callback1_t callback)
 {
-	assertf(TI_timers, "timer module not initialized");
+	assertf(TI_overflow, "timer module not initialized");
 	if (timer)
 	{
 		disable_interrupts();
 
-		uint32_t now = TICKS_READ();
-		timer->left = now + (int32_t)ticks;
 		timer->set = ticks;
+		timer->slack = 0;
 		timer->flags = flags;
 		timer->callback = callback;
 		timer->ctx = NULL;
 
 		if (!(flags & TF_DISABLED))
 		{
-			timer->next = TI_timers;
-			TI_timers = timer;
-			timer_update_compare(TI_timers, now);
+			timer_queue_start(timer, ticks);
 			timer_poll();
 		}
 
@@ -399,23 +511,20 @@ void start_timer(timer_link_t *timer, int ticks, int flags, timer_callback1_t ca
  */
 void start_timer_context(timer_link_t *timer, int ticks, int flags, timer_callback2_t callback, void *ctx)
 {
-	assertf(TI_timers, "timer module not initialized");
+	assertf(TI_overflow, "timer module not initialized");
 	if (timer)
 	{
 		disable_interrupts();
 
-		uint32_t now = TICKS_READ();
-		timer->left = now + (int32_t)ticks;
 		timer->set = ticks;
+		timer->slack = 0;
 		timer->flags = flags | TF_CONTEXT;
 		timer->callback_with_context = callback;
 		timer->ctx = ctx;
 
-		if (flags & TF_DISABLED)
+		if (!(flags & TF_DISABLED))
 		{
-			timer->next = TI_timers;
-			TI_timers = timer;
-			timer_update_compare(TI_timers, now);
+			timer_queue_start(timer, ticks);
 			timer_poll();
 		}
 
@@ -435,13 +544,11 @@ void restart_timer(timer_link_t *timer)
 	{
 		disable_interrupts();
 
-		uint32_t now = TICKS_READ();
-		timer->left = now + (int32_t)timer->set;
+		if (timer->flags & TF_QUEUED)
+			timer_queue_remove(timer);
 		timer->flags &= ~TF_DISABLED;
 
-		timer->next = TI_timers;
-		TI_timers = timer;
-		timer_update_compare(TI_timers, now);
+		timer_queue_start(timer, timer->set);
 		timer_poll();
 
 		enable_interrupts();
@@ -462,32 +569,16 @@ void restart_timer(timer_link_t *timer)
  */
 void stop_timer(timer_link_t *timer)
 {
-	timer_link_t *head;
-	timer_link_t *last = 0;
-
-	assertf(TI_timers, "timer module not initialized");
+	assertf(TI_overflow, "timer module not initialized");
 	if (timer)
 	{
 		disable_interrupts();
-		head = TI_timers;
-		while (head)
-		{
-			if (head == timer)
-			{
-				/* remove from list */
-				if (last)
-					last->next = head->next;
-				else
-					TI_timers = head->next;
-
-				break;
-			}
-
-			last = head;
-			head = head->next;
-		}
+		/* Removing a timer can only postpone the earliest deadline, so the
+		   compare register can be left as is: at worst, it will cause a
+		   spurious interrupt that will reprogram it. */
+		if (timer->flags & TF_QUEUED)
+			timer_queue_remove(timer);
 		timer->flags |= TF_DISABLED;
-		timer_update_compare(TI_timers, TICKS_READ());
 		enable_interrupts();
 	}
 }
@@ -502,14 +593,73 @@ void stop_timer(timer_link_t *timer)
  */
 void delete_timer(timer_link_t *timer)
 {
-	assertf(TI_timers, "timer module not initialized");
+	assertf(TI_overflow, "timer module not initialized");
 	if (timer)
 	{
 		stop_timer(timer);
-		free(timer);
+		timer_free(timer);
 	}
 }
 
+/**
+ * @brief Allow a timer to fire late, to coalesce it with other timers
+ *
+ * By default, a timer fires as soon as possible after its deadline. With
+ * some slack, the timer can fire at any time between its deadline and
+ * @p slack ticks after it; the timer interrupt is then scheduled so that
+ * all the timers whose windows overlap expire together, reducing the
+ * number of interrupts. The ovfl argument of the callback still reports
+ * how late the timer fired compared to its deadline.
+ *
+ * The slack is reset to 0 by #start_timer and #start_timer_context, so
+ * this function should be called after starting the timer. It is kept
+ * by #restart_timer and when a continuous timer is rescheduled.
+ *
+ * @param[in] timer
+ *            Timer to configure
+ * @param[in] slack
+ *            Number of ticks the timer is allowed to fire late
+ */
+void timer_set_slack(timer_link_t *timer, int slack)
+{
+	assertf(TI_overflow, "timer module not initialized");
+	assertf(slack >= 0, "invalid timer slack: %d", slack);
+	disable_interrupts();
+	if (timer->flags & TF_QUEUED)
+	{
+		/* Reinsert the timer, as its position in the queue depends on the slack */
+		timer_queue_remove(timer);
+		timer->slack = slack;
+		timer_queue_insert(timer);
+	}
+	else
+		timer->slack = slack;
+	enable_interrupts();
+}
+
+/**
+ * @brief Preallocate a number of timers for #new_timer
+ *
+ * #new_timer and #new_timer_context take their timer structures from a
+ * pool, and #delete_timer puts them back. The pool grows on demand, but
+ * only when the timers are created with interrupts enabled: this function
+ * makes sure that at least @p capacity timers are free, so that they
+ * can be created and deleted from interrupt handlers (eg: from a timer
+ * callback) or in a tight loop without going through the heap allocator.
+ *
+ * The pool is released by #timer_close, so all the timers allocated from it
+ * must have been deleted by then (continuous timers are deleted automatically).
+ *
+ * @param[in] capacity
+ *            Number of timers to preallocate
+ */
+void timer_pool_init(int capacity)
+{
+	assertf(TI_overflow, "timer module not initialized");
+	assertf(capacity > 0, "invalid timer pool capacity: %d", capacity);
+	blkpool_reserve(&timer_pool, capacity);
+}
+
 /**
  * @brief Free and close the timer subsystem
  *
@@ -519,18 +669,18 @@ void delete_timer(timer_link_t *timer)
  */
 void timer_close(void)
 {
-	assertf(TI_timers, "timer module not initialized");
+	assertf(TI_overflow, "timer module not initialized");
+	__debug_timer_close();
 	disable_interrupts();
 	
 	/* Disable generation of timer interrupt. */
 	set_TI_interrupt(0);
 	unregister_TI_handler(timer_poll);
 
-	timer_link_t *head = TI_timers;
-	while (head)
+	while (TI_timers)
 	{
-		timer_link_t *last = head;
-		head = head->next;
+		timer_link_t *last = TI_timers;
+		timer_queue_remove(last);
 
 		if (last->flags & TF_CONTINUOUS)
 		{
@@ -541,10 +691,13 @@ void timer_close(void)
 			 * condition by ensuring that the timer system never frees a 
 			 * one shot timer.
 			 */
-			free(last);
+			timer_free(last);
 		}
 	}
 	TI_timers = 0;
+	TI_overflow = 0;
+
+	blkpool_close(&timer_pool);
 	enable_interrupts();
 }
 
@@ -557,7 +710,7 @@ void timer_close(void)
 long long timer_ticks(void)
 {
 	uint32_t low, high;
-	assertf(TI_timers, "timer module not initialized");
+	assertf(TI_overflow, "timer module not initialized");
 
 	/* Check whether interrupts are enabled or not. We need a different strategy
 	 * to account for race conditions. */
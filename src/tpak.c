@@ -6,7 +6,13 @@
 
 #include "tpak.h"
 #include "controller.h"
+#include "system.h"
+#include "debug.h"
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 /**
  * @defgroup transferpak Transfer Pak interface
@@ -34,6 +40,17 @@
  * Note that these functions do not account for cartridge bank switching.
  * For more information about Game Boy cartridge bank switching, refer to the
  * GBDev Pan Docs at https://gbdev.io/pandocs/
+ *
+ * To dump a whole cartridge, call #tpak_fs_init once to register the
+ * `tpak:/` filesystem, and then open `tpak:/N/rom` or `tpak:/N/ram` (where N
+ * is the controller number) with the standard C file API. These read-only
+ * streams handle the Memory Bank Controller bank switching for the common
+ * cartridge types (ROM only, MBC1, MBC2, MBC3 and MBC5), switch banks only
+ * when the stream crosses a bank boundary, and read ahead in the background
+ * through the asynchronous accessory API, so that the next chunk is already
+ * in flight while the application consumes the current one. Only one stream
+ * per controller can be open at a time, and #tpak_read / #tpak_write should
+ * not be used on that controller while it is open.
  */
 
 /**
@@ -69,6 +86,14 @@
 /** @brief Transfer Pak cartridge bank size (16 KiB) */
 #define TPAK_BANK_SIZE   0x4000
 
+/**
+ * @brief Last bank selected with #tpak_set_bank on each controller (-1 if unknown).
+ *
+ * Used to skip redundant bank switches. Reset by #tpak_init and whenever
+ * the Transfer Pak is powered off.
+ */
+static int tpak_bank_cache[4] = { -1, -1, -1, -1 };
+
 /**
  * @brief Set Transfer Pak or Game Boy cartridge status/control value.
  *
@@ -86,7 +111,17 @@ int tpak_set_value(int controller, uint16_t address, uint8_t value)
 {
     uint8_t block[TPAK_BLOCK_SIZE];
     memset(block, value, TPAK_BLOCK_SIZE);
-    return write_mempak_address(controller, address, block);
+    int result = write_mempak_address(controller, address, block);
+
+    if (controller >= 0 && controller <= 3) {
+        // Keep track of the selected bank. Any failure or power change
+        // leaves it in an unknown state.
+        if (result == 0 && (address & 0xF000) == TPAK_ADDRESS_BANK)
+            tpak_bank_cache[controller] = value;
+        else if (result != 0 || (address & 0xF000) == TPAK_ADDRESS_POWER)
+            tpak_bank_cache[controller] = -1;
+    }
+    return result;
 }
 
 /**
@@ -106,6 +141,8 @@ int tpak_init(int controller)
     int accessory = identify_accessory(controller);
     if (accessory != ACCESSORY_TRANSFERPAK) return TPAK_ERROR_NO_TPAK;
 
+    tpak_bank_cache[controller] = -1;
+
     result = tpak_set_power(controller, true);
     if (result) return result;
 
@@ -154,6 +191,9 @@ int tpak_set_power(int controller, bool power_state)
  *
  * Change the bank of address space that is available for #tpak_read and
  * #tpak_write between Transfer Pak addresses 0xC000 and 0xFFFF.
+ *
+ * The bank selected last is remembered, and selecting it again does not
+ * issue any command to the Transfer Pak.
  * 
  * @param[in] controller
  *            The controller (0-3) with Transfer Pak connected.
@@ -163,6 +203,8 @@ int tpak_set_power(int controller, bool power_state)
  */
 int tpak_set_bank(int controller, int bank)
 {
+    if (controller >= 0 && controller <= 3 && tpak_bank_cache[controller] == bank)
+        return 0;
     return tpak_set_value(controller, TPAK_ADDRESS_BANK, bank);
 }
 
@@ -232,23 +274,23 @@ int tpak_write(int controller, uint16_t address, uint8_t* data, uint16_t size)
     }
 
     uint8_t* cursor = data;
+    accessory_request_t req;
 
-    int bank = address / TPAK_BANK_SIZE;
-    tpak_set_bank(controller, bank);
-
+    // Transfer each bank as a single accessory request: the chunks are
+    // chained under interrupt, without a round trip through this function.
     while(address < end_address)
     {
-        // Check if we need to change the bank.
-        if (address / TPAK_BANK_SIZE > bank) {
-            bank = address / TPAK_BANK_SIZE;
-            tpak_set_bank(controller, bank);
-            adjusted_address = TPAK_ADDRESS_DATA;
-        }
+        int bank = address / TPAK_BANK_SIZE;
+        uint32_t bank_end = (bank + 1) * TPAK_BANK_SIZE;
+        uint32_t len = (end_address < bank_end ? end_address : bank_end) - address;
 
-        write_mempak_address(controller, adjusted_address, cursor);
-        address += TPAK_BLOCK_SIZE;
-        cursor += TPAK_BLOCK_SIZE;
-        adjusted_address += TPAK_BLOCK_SIZE;
+        tpak_set_bank(controller, bank);
+        accessory_write_async(controller, adjusted_address, cursor, len, &req, NULL, NULL);
+        accessory_request_wait(&req);
+
+        address += len;
+        cursor += len;
+        adjusted_address = TPAK_ADDRESS_DATA;
     }
 
     return 0;
@@ -282,23 +324,23 @@ int tpak_read(int controller, uint16_t address, uint8_t* buffer, uint16_t size)
     }
 
     uint8_t* cursor = buffer;
+    accessory_request_t req;
 
-    int bank = address / TPAK_BANK_SIZE;
-    tpak_set_bank(controller, bank);
-
+    // Transfer each bank as a single accessory request: the chunks are
+    // chained under interrupt, without a round trip through this function.
     while(address < end_address)
     {
-        // Check if we need to change the bank.
-        if (address / TPAK_BANK_SIZE > bank) {
-            bank = address / TPAK_BANK_SIZE;
-            tpak_set_bank(controller, bank);
-            adjusted_address = TPAK_ADDRESS_DATA;
-        }
+        int bank = address / TPAK_BANK_SIZE;
+        uint32_t bank_end = (bank + 1) * TPAK_BANK_SIZE;
+        uint32_t len = (end_address < bank_end ? end_address : bank_end) - address;
+
+        tpak_set_bank(controller, bank);
+        accessory_read_async(controller, adjusted_address, cursor, len, &req, NULL, NULL);
+        accessory_request_wait(&req);
 
-        read_mempak_address(controller, adjusted_address, cursor);
-        address += TPAK_BLOCK_SIZE;
-        cursor += TPAK_BLOCK_SIZE;
-        adjusted_address += TPAK_BLOCK_SIZE;
+        address += len;
+        cursor += len;
+        adjusted_address = TPAK_ADDRESS_DATA;
     }
 
     return 0;
@@ -325,3 +367,425 @@ bool tpak_check_header(struct gameboy_cartridge_header* header)
 
     return sum == header->header_checksum;
 }
+
+/**
+ * @name Transfer Pak stream filesystem
+ * @{
+ */
+
+/** @brief Size of the read-ahead buffers of a Transfer Pak stream (must divide the RAM bank size) */
+#define TPAK_STREAM_CHUNK       0x400
+/** @brief Marker for an empty read-ahead buffer */
+#define TPAK_STREAM_EMPTY       0xFFFFFFFF
+/** @brief Game Boy ROM bank size (16 KiB) */
+#define GB_ROM_BANK_SIZE        0x4000
+/** @brief Game Boy external RAM bank size (8 KiB) */
+#define GB_RAM_BANK_SIZE        0x2000
+/** @brief Game Boy address of the external RAM */
+#define GB_ADDRESS_RAM          0xA000
+
+/** @brief Memory Bank Controller families supported by the stream filesystem */
+typedef enum {
+    TPAK_MBC_NONE,          ///< ROM only (with optional RAM)
+    TPAK_MBC1,              ///< MBC1
+    TPAK_MBC2,              ///< MBC2
+    TPAK_MBC3,              ///< MBC3
+    TPAK_MBC5,              ///< MBC5
+} tpak_mbc_t;
+
+/** @brief An open Transfer Pak stream */
+typedef struct {
+    /** @brief Read-ahead buffers */
+    uint8_t buf[2][TPAK_STREAM_CHUNK] __attribute__((aligned(8)));
+    /** @brief Stream offset of the data in each buffer (or #TPAK_STREAM_EMPTY) */
+    uint32_t buf_offset[2];
+    /** @brief Pending (or completed) read of each buffer */
+    accessory_request_t req[2];
+    /** @brief Controller (0-3) */
+    int controller;
+    /** @brief True for the RAM stream, false for the ROM stream */
+    bool ram;
+    /** @brief Memory Bank Controller of the cartridge */
+    tpak_mbc_t mbc;
+    /** @brief Total size of the stream in bytes */
+    uint32_t size;
+    /** @brief Current position in the stream */
+    uint32_t pos;
+    /** @brief Game Boy bank currently selected in the MBC (-1 if unknown) */
+    int mbc_bank;
+    /** @brief Game Boy address where #mbc_bank is visible */
+    uint16_t mbc_base;
+} tpak_stream_t;
+
+/** @brief Open stream of each controller (NULL if none) */
+static tpak_stream_t *tpak_streams[4];
+
+/**
+ * @brief Write a MBC register of the Game Boy cartridge.
+ *
+ * @param[in] controller
+ *            The controller (0-3) with Transfer Pak connected.
+ * @param[in] gb_address
+ *            Game Boy address of the register (must be aligned to 32 bytes)
+ * @param[in] value
+ *            Value to write
+ */
+static void tpak_gb_set_value(int controller, uint16_t gb_address, uint8_t value)
+{
+    tpak_set_bank(controller, gb_address / TPAK_BANK_SIZE);
+    tpak_set_value(controller, TPAK_ADDRESS_DATA + (gb_address % TPAK_BANK_SIZE), value);
+}
+
+/**
+ * @brief Make a ROM bank visible, returning the Game Boy address where it is mapped.
+ */
+static uint16_t tpak_stream_select_rom(tpak_stream_t *s, int bank)
+{
+    int c = s->controller;
+
+    if (bank == 0 && s->mbc != TPAK_MBC1) return 0x0000;
+    if (s->mbc_bank == bank) return s->mbc_base;
+
+    uint16_t base = bank ? 0x4000 : 0x0000;
+    switch (s->mbc) {
+    case TPAK_MBC_NONE:
+        base = bank * GB_ROM_BANK_SIZE;
+        break;
+    case TPAK_MBC1:
+        if (bank == 0) {
+            tpak_gb_set_value(c, 0x6000, 0);
+            tpak_gb_set_value(c, 0x4000, 0);
+        } else if ((bank & 0x1F) == 0) {
+            // Banks 0x20/0x40/0x60 cannot be mapped at 0x4000: use mode 1,
+            // which maps them in the 0x0000 area instead.
+            tpak_gb_set_value(c, 0x4000, bank >> 5);
+            tpak_gb_set_value(c, 0x6000, 1);
+            base = 0x0000;
+        } else {
+            tpak_gb_set_value(c, 0x6000, 0);
+            tpak_gb_set_value(c, 0x2000, bank & 0x1F);
+            tpak_gb_set_value(c, 0x4000, (bank >> 5) & 3);
+        }
+        break;
+    case TPAK_MBC2:
+        tpak_gb_set_value(c, 0x2100, bank & 0xF);
+        break;
+    case TPAK_MBC3:
+        tpak_gb_set_value(c, 0x2000, bank & 0x7F);
+        break;
+    case TPAK_MBC5:
+        tpak_gb_set_value(c, 0x2000, bank & 0xFF);
+        tpak_gb_set_value(c, 0x3000, bank >> 8);
+        break;
+    }
+
+    s->mbc_bank = bank;
+    s->mbc_base = base;
+    return base;
+}
+
+/**
+ * @brief Make a RAM bank visible, returning the Game Boy address where it is mapped.
+ */
+static uint16_t tpak_stream_select_ram(tpak_stream_t *s, int bank)
+{
+    if (s->mbc_bank != bank) {
+        switch (s->mbc) {
+        case TPAK_MBC1:
+            // RAM banking requires mode 1 on MBC1
+            tpak_gb_set_value(s->controller, 0x6000, 1);
+            tpak_gb_set_value(s->controller, 0x4000, bank & 3);
+            break;
+        case TPAK_MBC3:
+        case TPAK_MBC5:
+            tpak_gb_set_value(s->controller, 0x4000, bank);
+            break;
+        default:
+            break;
+        }
+        s->mbc_bank = bank;
+    }
+    return GB_ADDRESS_RAM;
+}
+
+/**
+ * @brief Start reading the chunk at the specified offset into a read-ahead buffer.
+ *
+ * Bank switches are issued only when the chunk is in a different bank than
+ * the previous one. Since joybus messages are executed in order, they are
+ * safely queued after any read which is still in flight.
+ */
+static void tpak_stream_fetch(tpak_stream_t *s, int idx, uint32_t offset)
+{
+    uint32_t bank_size = s->ram ? GB_RAM_BANK_SIZE : GB_ROM_BANK_SIZE;
+    uint32_t len = s->size - offset < TPAK_STREAM_CHUNK ? s->size - offset : TPAK_STREAM_CHUNK;
+
+    // Make sure the buffer is not still being filled
+    if (s->buf_offset[idx] != TPAK_STREAM_EMPTY)
+        accessory_request_wait(&s->req[idx]);
+
+    uint16_t base = s->ram ?
+        tpak_stream_select_ram(s, offset / bank_size) :
+        tpak_stream_select_rom(s, offset / bank_size);
+    uint16_t gb_address = base + offset % bank_size;
+
+    tpak_set_bank(s->controller, gb_address / TPAK_BANK_SIZE);
+    accessory_read_async(s->controller, TPAK_ADDRESS_DATA + (gb_address % TPAK_BANK_SIZE),
+        s->buf[idx], len, &s->req[idx], NULL, NULL);
+    s->buf_offset[idx] = offset;
+}
+
+/**
+ * @brief Open a Transfer Pak stream
+ *
+ * @param[in] name
+ *            Path of the stream: "/N/rom" or "/N/ram", with N the controller (0-3)
+ * @param[in] flags
+ *            Open flags (only read-only access is supported)
+ *
+ * @return A pointer to the stream or NULL on error (errno is set)
+ */
+static void *__tpak_open(char *name, int flags)
+{
+    if ((flags & O_ACCMODE) != O_RDONLY) { errno = EROFS; return NULL; }
+    if (name[0] == '/') name++;
+    if (name[0] < '0' || name[0] > '3' || name[1] != '/') { errno = ENOENT; return NULL; }
+
+    int controller = name[0] - '0';
+    bool ram;
+    if (strcmp(&name[2], "rom") == 0) ram = false;
+    else if (strcmp(&name[2], "ram") == 0) ram = true;
+    else { errno = ENOENT; return NULL; }
+
+    if (tpak_streams[controller]) { errno = EBUSY; return NULL; }
+
+    uint8_t status = tpak_get_status(controller);
+    if ((status & TPAK_STATUS_REMOVED) || !(status & TPAK_STATUS_READY)) { errno = ENODEV; return NULL; }
+
+    struct gameboy_cartridge_header header;
+    if (tpak_get_cartridge_header(controller, &header) != 0 || !tpak_check_header(&header)) {
+        errno = EIO;
+        return NULL;
+    }
+
+    tpak_mbc_t mbc;
+    switch (header.cartridge_type) {
+    case GB_ROM_ONLY: case GB_ROM_RAM: case GB_ROM_RAM_BATTERY:
+        mbc = TPAK_MBC_NONE; break;
+    case GB_MBC1: case GB_MBC1_RAM: case GB_MBC1_RAM_BATTERY:
+        mbc = TPAK_MBC1; break;
+    case GB_MBC2: case GB_MBC2_BATTERY:
+        mbc = TPAK_MBC2; break;
+    case GB_MBC3: case GB_MBC3_RAM: case GB_MBC3_RAM_BATTERY:
+    case GB_MBC3_TIMER_BATTERY: case GB_MBC3_TIMER_RAM_BATTERY:
+        mbc = TPAK_MBC3; break;
+    case GB_MBC5: case GB_MBC5_RAM: case GB_MBC5_RAM_BATTERY:
+    case GB_MBC5_RUMBLE: case GB_MBC5_RUMBLE_RAM: case GB_MBC5_RUMBLE_RAM_BATTERY:
+        mbc = TPAK_MBC5; break;
+    default:
+        errno = ENOTSUP;
+        return NULL;
+    }
+
+    uint32_t size;
+    if (!ram) {
+        switch (header.rom_size_code) {
+        case GB_ROM_1152KB: size = 72 * GB_ROM_BANK_SIZE; break;
+        case GB_ROM_1280KB: size = 80 * GB_ROM_BANK_SIZE; break;
+        case GB_ROM_1536KB: size = 96 * GB_ROM_BANK_SIZE; break;
+        default:
+            if (header.rom_size_code > GB_ROM_8MB) { errno = ENOTSUP; return NULL; }
+            size = 0x8000 << header.rom_size_code;
+            break;
+        }
+    } else if (mbc == TPAK_MBC2) {
+        size = 512;
+    } else {
+        switch (header.ram_size_code) {
+        case GB_RAM_2KB:   size = 2 * 1024; break;
+        case GB_RAM_8KB:   size = 8 * 1024; break;
+        case GB_RAM_32KB:  size = 32 * 1024; break;
+        case GB_RAM_64KB:  size = 64 * 1024; break;
+        case GB_RAM_128KB: size = 128 * 1024; break;
+        default: errno = ENOENT; return NULL;
+        }
+    }
+
+    tpak_stream_t *s = malloc(sizeof(tpak_stream_t));
+    if (!s) { errno = ENOMEM; return NULL; }
+    s->controller = controller;
+    s->ram = ram;
+    s->mbc = mbc;
+    s->size = size;
+    s->pos = 0;
+    s->mbc_bank = -1;
+    s->mbc_base = 0;
+    s->buf_offset[0] = s->buf_offset[1] = TPAK_STREAM_EMPTY;
+
+    // Enable the external RAM
+    if (ram && mbc != TPAK_MBC_NONE) tpak_gb_set_value(controller, 0x0000, 0x0A);
+
+    tpak_streams[controller] = s;
+    tpak_stream_fetch(s, 0, 0);
+    return s;
+}
+
+/**
+ * @brief Get the size of a Transfer Pak stream
+ *
+ * @param[in]  file
+ *             Stream as returned by #__tpak_open
+ * @param[out] st
+ *             Stat structure to populate
+ *
+ * @return 0
+ */
+static int __tpak_fstat(void *file, struct stat *st)
+{
+    tpak_stream_t *s = file;
+
+    memset(st, 0, sizeof(*st));
+    st->st_mode = S_IFREG;
+    st->st_nlink = 1;
+    st->st_size = s->size;
+    return 0;
+}
+
+/**
+ * @brief Seek within a Transfer Pak stream
+ *
+ * @param[in] file
+ *            Stream as returned by #__tpak_open
+ * @param[in] ptr
+ *            Offset to seek to, relative to dir
+ * @param[in] dir
+ *            SEEK_SET, SEEK_CUR or SEEK_END
+ *
+ * @return The new position or a negative value on error
+ */
+static int __tpak_lseek(void *file, int ptr, int dir)
+{
+    tpak_stream_t *s = file;
+    int pos;
+
+    switch (dir) {
+    case SEEK_SET: pos = ptr; break;
+    case SEEK_CUR: pos = s->pos + ptr; break;
+    case SEEK_END: pos = s->size + ptr; break;
+    default: errno = EINVAL; return -1;
+    }
+    if (pos < 0) { errno = EINVAL; return -1; }
+    if ((uint32_t)pos > s->size) pos = s->size;
+    s->pos = pos;
+    return pos;
+}
+
+/**
+ * @brief Read from a Transfer Pak stream
+ *
+ * Whenever a chunk is consumed, the following one is requested in the
+ * background, so that sequential readers overlap their processing with
+ * the Transfer Pak transfers.
+ *
+ * @param[in]  file
+ *             Stream as returned by #__tpak_open
+ * @param[out] ptr
+ *             Buffer to read into
+ * @param[in]  len
+ *             Number of bytes to read
+ *
+ * @return The number of bytes read or a negative value on error
+ */
+static int __tpak_read(void *file, uint8_t *ptr, int len)
+{
+    tpak_stream_t *s = file;
+    int read = 0;
+
+    while (len > 0 && s->pos < s->size) {
+        uint32_t chunk = s->pos & ~(TPAK_STREAM_CHUNK - 1);
+
+        int idx = s->buf_offset[0] == chunk ? 0 : s->buf_offset[1] == chunk ? 1 : -1;
+        if (idx < 0) {
+            // Random access: refill the first buffer
+            idx = 0;
+            tpak_stream_fetch(s, idx, chunk);
+        }
+        if (accessory_request_wait(&s->req[idx]) != 0) {
+            s->buf_offset[idx] = TPAK_STREAM_EMPTY;
+            errno = EIO;
+            return read ? read : -1;
+        }
+
+        // Read ahead the next chunk into the other buffer
+        uint32_t next = chunk + TPAK_STREAM_CHUNK;
+        if (next < s->size && s->buf_offset[idx ^ 1] != next)
+            tpak_stream_fetch(s, idx ^ 1, next);
+
+        uint32_t avail = chunk + TPAK_STREAM_CHUNK - s->pos;
+        if (avail > s->size - s->pos) avail = s->size - s->pos;
+        int n = len < avail ? len : avail;
+        memcpy(ptr, &s->buf[idx][s->pos - chunk], n);
+        ptr += n;
+        len -= n;
+        read += n;
+        s->pos += n;
+    }
+
+    return read;
+}
+
+/**
+ * @brief Close a Transfer Pak stream
+ *
+ * @param[in] file
+ *            Stream as returned by #__tpak_open
+ *
+ * @return 0
+ */
+static int __tpak_close(void *file)
+{
+    tpak_stream_t *s = file;
+
+    for (int i = 0; i < 2; i++)
+        if (s->buf_offset[i] != TPAK_STREAM_EMPTY)
+            accessory_request_wait(&s->req[i]);
+
+    // Disable the external RAM again, to protect it from spurious writes
+    if (s->ram && s->mbc != TPAK_MBC_NONE) tpak_gb_set_value(s->controller, 0x0000, 0x00);
+
+    tpak_streams[s->controller] = NULL;
+    free(s);
+    return 0;
+}
+
+/** @brief Transfer Pak stream filesystem */
+static filesystem_t tpak_fs = {
+    __tpak_open,
+    __tpak_fstat,
+    __tpak_lseek,
+    __tpak_read,
+    0,
+    __tpak_close,
+    0,
+    0,
+    0,
+    0
+};
+
+/**
+ * @brief Register the Transfer Pak stream filesystem.
+ *
+ * After this call, the ROM and the external RAM of the Game Boy cartridge
+ * in the Transfer Pak of controller N can be read sequentially by opening
+ * `tpak:/N/rom` and `tpak:/N/ram` with the standard C file API (eg: fopen).
+ * The Transfer Pak must have been prepared with #tpak_init first.
+ *
+ * @return 0 if successful or a negative value if the filesystem could not
+ *         be registered (see #attach_filesystem).
+ */
+int tpak_fs_init(void)
+{
+    return attach_filesystem("tpak:/", &tpak_fs);
+}
+
+/** @} */
@@ -241,6 +241,7 @@ static s8 usb_cart = CART_NONE;
 static u8 usb_buffer_align[BUFFER_SIZE+16]; // IDO doesn't support GCC's __attribute__((aligned(x))), so this is a workaround
 static u8* usb_buffer;
 static char usb_didtimeout = FALSE;
+static volatile int usb_inuse = 0;
 static int usb_datatype = 0;
 static int usb_datasize = 0;
 static int usb_dataleft = 0;
@@ -370,6 +371,22 @@ static inline void usb_dma_write(void *ram_address, u32 pi_address, size_t size)
 }
 
 
+/*==============================
+    usb_dma_direct
+    Checks whether a buffer can be DMAed directly
+    to the cartridge, without copying it into
+    the aligned USB buffer first.
+    @param  The buffer to check
+    @return 1 if the buffer can be used for DMA, 0 if not
+==============================*/
+
+static inline char usb_dma_direct(const void *ram_address)
+{
+    // PI DMA requires 8-byte aligned RDRAM addresses
+    return (((u32)ram_address) & 7) == 0 && ((u32)ram_address) >= 0x80000000 && ((u32)ram_address) < 0xC0000000;
+}
+
+
 /*********************************
          Timeout helpers
 *********************************/
@@ -559,6 +576,8 @@ char usb_getcart(void)
     usb_write
     Writes data to the USB.
     Will not write if there is data to read from USB
+    If the data is 8-byte aligned, it is DMAed directly
+    to the cartridge without intermediate copies
     @param The DATATYPE that is being sent
     @param A buffer with the data to send
     @param The size of the data being sent
@@ -575,7 +594,24 @@ void usb_write(int datatype, const void* data, int size)
         return;
     
     // Call the correct write function
+    usb_inuse++;
     funcPointer_write(datatype, data, size);
+    usb_inuse--;
+}
+
+
+/*==============================
+    usb_canwrite
+    Checks whether usb_write can be called right now.
+    This is false while another USB operation is in
+    progress (eg: from an interrupt handler), or if
+    there is data to read first.
+    @return 1 if data can be written, 0 if not
+==============================*/
+
+char usb_canwrite(void)
+{
+    return usb_cart != CART_NONE && usb_dataleft == 0 && usb_inuse == 0;
 }
 
 
@@ -606,7 +642,10 @@ u32 usb_poll(void)
         return USBHEADER_CREATE(usb_datatype, usb_dataleft);
         
     // Call the correct read function
-    return funcPointer_poll();
+    usb_inuse++;
+    u32 header = funcPointer_poll();
+    usb_inuse--;
+    return header;
 }
 
 
@@ -635,6 +674,7 @@ void usb_read(void* buffer, int nbytes)
         return;
     
     // Read chunks from ROM
+    usb_inuse++;
     while (left > 0)
     {
         // Ensure we don't read too much data
@@ -661,6 +701,7 @@ void usb_read(void* buffer, int nbytes)
         block = BUFFER_SIZE;
         copystart = 0;
     }
+    usb_inuse--;
 }
 
 
@@ -934,6 +975,13 @@ static void usb_64drive_write(int datatype, const void* data, int size)
     // Set the cartridge to write mode
     usb_64drive_set_writable(TRUE);
 
+    // If the buffer is aligned, DMA it straight to SDRAM
+    if (usb_dma_direct(data))
+    {
+        usb_dma_write((void*)data, pi_address, ALIGN(size, 2));
+        left = 0;
+    }
+
     // Write data to SDRAM until we've finished
     while (left > 0)
     {
@@ -1125,11 +1173,16 @@ static void usb_everdrive_write(int datatype, const void* data, int size)
     {
         int block = left;
         int blocksend, baddr;
+        u8* src = usb_buffer;
         if (block+offset > BUFFER_SIZE)
             block = BUFFER_SIZE-offset;
             
-        // Copy the data to the next available spots in the global buffer
-        memcpy(usb_buffer+offset, (void*)((char*)data+read), block);
+        // Full blocks from an aligned buffer are DMAed directly, otherwise
+        // copy the data to the next available spots in the global buffer
+        if (offset == 0 && block == BUFFER_SIZE && read+block < size && usb_dma_direct((char*)data+read))
+            src = (u8*)data+read;
+        else
+            memcpy(usb_buffer+offset, (void*)((char*)data+read), block);
         
         // Restart the loop to write the CMP signal if we've finished
         if (!wrotecmp && read+block >= size)
@@ -1148,7 +1201,7 @@ static void usb_everdrive_write(int datatype, const void* data, int size)
 
         // Set USB to write mode and send data through USB
         usb_io_write(ED_REG_USBCFG, ED_USBMODE_WRNOP);
-        usb_dma_write(usb_buffer, ED_REG_USBDAT + baddr, blocksend);
+        usb_dma_write(src, ED_REG_USBDAT + baddr, blocksend);
         
         // Set USB to write mode with the new address and wait for USB to end (or stop if it times out)
         usb_io_write(ED_REG_USBCFG, ED_USBMODE_WR | baddr);
@@ -1351,6 +1404,13 @@ static void usb_sc64_write(int datatype, const void* data, int size)
     // Enable SDRAM writes and get previous setting
     writable_restore = usb_sc64_set_writable(TRUE);
 
+    // If the buffer is aligned, DMA it straight to SDRAM
+    if (usb_dma_direct(data))
+    {
+        usb_dma_write((void*)data, pi_address, ALIGN(size, 2));
+        left = 0;
+    }
+
     while (left > 0)
     {
         // Calculate transfer size
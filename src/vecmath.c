@@ -0,0 +1,151 @@
+/**
+ * @file vecmath.c
+ * @brief Batched vector math on the RSP
+ * @ingroup rsp
+ *
+ * This file contains the CPU side of the vector math ucode (rsp_vecmath.S).
+ */
+#include <math.h>
+#include <string.h>
+#include "vecmath.h"
+#include "rspq.h"
+#include "rsp.h"
+#include "n64sys.h"
+#include "debug.h"
+
+DEFINE_RSP_UCODE(rsp_vecmath);
+
+/** @brief Commands of the overlay (see rsp_vecmath.S) */
+enum {
+    VECMATH_CMD_LOAD_MTX    = 0x0,
+    VECMATH_CMD_TRANSFORM   = 0x1,
+    VECMATH_CMD_NORMALIZE   = 0x2,
+    VECMATH_CMD_DOT3        = 0x3,
+    VECMATH_CMD_DOT4        = 0x4,
+    VECMATH_CMD_CROSS       = 0x5,
+    VECMATH_CMD_FROM_FIXED  = 0x6,
+    VECMATH_CMD_TO_FIXED    = 0x7,
+};
+
+/** @brief ID of the overlay (0 if not registered) */
+static uint32_t vecmath_ovl_id = 0;
+
+/** @brief Check the arguments of a command and return the physical address of an array */
+static uint32_t vecmath_array(const void *ptr, int num)
+{
+    assertf(((uint32_t)ptr & 7) == 0, "vecmath: array must be 8-byte aligned: %p", ptr);
+    assertf(num > 0 && num <= 0xFFFF, "vecmath: invalid number of slots: %d", num);
+    return PhysicalAddr(ptr);
+}
+
+void vecmath_init(void)
+{
+    if (vecmath_ovl_id)
+        return;
+    rspq_init();
+
+    // Initialize all the matrices to the identity
+    vecmath_mtx_t *state = UncachedAddr(rspq_overlay_get_state(&rsp_vecmath));
+    static const float identity[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+    vecmath_mtx_t mtx;
+    vecmath_mtx_from_floats(&mtx, identity);
+    for (int i = 0; i < VECMATH_MAX_MATRICES; i++)
+        memcpy(&state[i], &mtx, sizeof(vecmath_mtx_t));
+
+    vecmath_ovl_id = rspq_overlay_register(&rsp_vecmath);
+}
+
+void vecmath_close(void)
+{
+    if (!vecmath_ovl_id)
+        return;
+    rspq_overlay_unregister(vecmath_ovl_id);
+    vecmath_ovl_id = 0;
+}
+
+void vecmath_load_mtx(int idx, const vecmath_mtx_t *mtx)
+{
+    assertf(idx >= 0 && idx < VECMATH_MAX_MATRICES, "vecmath: invalid matrix index: %d", idx);
+    assertf(((uint32_t)mtx & 7) == 0, "vecmath: matrix must be 8-byte aligned: %p", mtx);
+    assertf(vecmath_ovl_id, "vecmath_init() must be called first");
+    rspq_write(vecmath_ovl_id, VECMATH_CMD_LOAD_MTX, idx, PhysicalAddr(mtx));
+}
+
+void vecmath_transform(vecmath_slot_t *dst, int mtx, const vecmath_slot_t *src, int num)
+{
+    assertf(mtx >= 0 && mtx < VECMATH_MAX_MATRICES, "vecmath: invalid matrix index: %d", mtx);
+    assertf(vecmath_ovl_id, "vecmath_init() must be called first");
+    rspq_write(vecmath_ovl_id, VECMATH_CMD_TRANSFORM,
+        vecmath_array(dst, num), vecmath_array(src, num), (mtx << 16) | num);
+}
+
+void vecmath_normalize(vecmath_slot_t *dst, const vecmath_slot_t *src, int num)
+{
+    assertf(vecmath_ovl_id, "vecmath_init() must be called first");
+    rspq_write(vecmath_ovl_id, VECMATH_CMD_NORMALIZE,
+        vecmath_array(dst, num), vecmath_array(src, num), num);
+}
+
+void vecmath_dot3(vecmath_slot_t *dst, const vecmath_slot_t *a, const vecmath_slot_t *b, int num)
+{
+    assertf(vecmath_ovl_id, "vecmath_init() must be called first");
+    rspq_write(vecmath_ovl_id, VECMATH_CMD_DOT3,
+        vecmath_array(dst, num), vecmath_array(a, num), vecmath_array(b, num), num);
+}
+
+void vecmath_dot4(vecmath_slot_t *dst, const vecmath_slot_t *a, const vecmath_slot_t *b, int num)
+{
+    assertf(vecmath_ovl_id, "vecmath_init() must be called first");
+    rspq_write(vecmath_ovl_id, VECMATH_CMD_DOT4,
+        vecmath_array(dst, num), vecmath_array(a, num), vecmath_array(b, num), num);
+}
+
+void vecmath_cross(vecmath_slot_t *dst, const vecmath_slot_t *a, const vecmath_slot_t *b, int num)
+{
+    assertf(vecmath_ovl_id, "vecmath_init() must be called first");
+    rspq_write(vecmath_ovl_id, VECMATH_CMD_CROSS,
+        vecmath_array(dst, num), vecmath_array(a, num), vecmath_array(b, num), num);
+}
+
+void vecmath_from_fixed(vecmath_slot_t *dst, const int32_t *src, int num)
+{
+    assertf(vecmath_ovl_id, "vecmath_init() must be called first");
+    rspq_write(vecmath_ovl_id, VECMATH_CMD_FROM_FIXED,
+        vecmath_array(dst, num), vecmath_array(src, num), num);
+}
+
+void vecmath_to_fixed(int32_t *dst, const vecmath_slot_t *src, int num)
+{
+    assertf(vecmath_ovl_id, "vecmath_init() must be called first");
+    rspq_write(vecmath_ovl_id, VECMATH_CMD_TO_FIXED,
+        vecmath_array(dst, num), vecmath_array(src, num), num);
+}
+
+void vecmath_from_floats(vecmath_slot_t *dst, const float *src, int n)
+{
+    for (int i = 0; i < ((n + 7) & ~7); i++) {
+        int32_t fixed = 0;
+        if (i < n) {
+            // Saturate to the range of 16.16
+            float v = src[i] * 65536.0f;
+            fixed = v >= 2147483647.0f ? INT32_MAX : v <= -2147483648.0f ? INT32_MIN : (int32_t)lrintf(v);
+        }
+        dst[i / 8].i[i % 8] = fixed >> 16;
+        dst[i / 8].f[i % 8] = fixed & 0xFFFF;
+    }
+}
+
+void vecmath_to_floats(float *dst, const vecmath_slot_t *src, int n)
+{
+    for (int i = 0; i < n; i++) {
+        int32_t fixed = ((int32_t)src[i / 8].i[i % 8] << 16) | src[i / 8].f[i % 8];
+        dst[i] = fixed * (1.0f / 65536.0f);
+    }
+}
+
+void vecmath_mtx_from_floats(vecmath_mtx_t *dst, const float m[16])
+{
+    // The columns are stored in order, two per slot: this is the same
+    // layout as an array of 16 floats by columns.
+    vecmath_from_floats(dst->c, m, 16);
+}
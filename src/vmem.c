@@ -0,0 +1,278 @@
+/**
+ * @file vmem.c
+ * @brief Virtual memory mappings via TLB
+ * @ingroup lowlevel
+ */
+#include <malloc.h>
+#include <string.h>
+#include "vmem.h"
+#include "cop0.h"
+#include "n64sys.h"
+#include "dma.h"
+#include "dragonfs.h"
+#include "exception.h"
+#include "interrupt.h"
+#include "debug.h"
+#include "utils.h"
+
+/** @brief Start of the virtual range used for the mappings (in KUSEG) */
+#define VMEM_BASE               0x40000000
+/** @brief End of the virtual range used for the mappings */
+#define VMEM_END                0x80000000
+/** @brief Maximum number of mappings at the same time */
+#define VMEM_MAX_MAPPINGS       16
+/** @brief Number of TLB entries in the VR4300 */
+#define TLB_NUM_ENTRIES         32
+
+/** @brief A mapping of a file or a buffer into virtual memory */
+typedef struct {
+    uint32_t vaddr;             ///< Start of the virtual range (0 if the mapping is free)
+    uint32_t size;              ///< Size of the mapping in bytes
+    uint32_t rom_addr;          ///< PI address of the file (ROM mappings), or 0
+    uint32_t ram_addr;          ///< Physical address of the buffer (RAM mappings)
+} vmem_mapping_t;
+
+static int page_size;                       ///< Size of a page (0 if not initialized)
+static int frame_size;                      ///< Size of a frame (two pages, mapped by one TLB entry)
+static int num_frames;                      ///< Number of frames (and of TLB entries in use)
+static uint8_t *frames;                     ///< Memory of the frames (cached address)
+static uint32_t frame_vaddr[VMEM_MAX_FRAMES];   ///< Virtual address mapped by each TLB entry (0 if none)
+static int next_victim;                     ///< Next TLB entry to evict (FIFO)
+static uint32_t next_vaddr;                 ///< Start of the next virtual range to allocate
+static vmem_mapping_t mappings[VMEM_MAX_MAPPINGS];  ///< Current mappings
+static vmem_stats_t stats;                  ///< Statistics
+
+/**
+ * @brief Write a TLB entry
+ *
+ * Must be called with interrupts disabled.
+ */
+static void tlb_write(int idx, uint32_t pagemask, uint32_t entryhi, uint32_t lo0, uint32_t lo1)
+{
+    C0_WRITE_INDEX(idx);
+    C0_WRITE_PAGEMASK(pagemask);
+    C0_WRITE_ENTRYHI(entryhi);
+    C0_WRITE_ENTRYLO0(lo0);
+    C0_WRITE_ENTRYLO1(lo1);
+    C0_TLBWI();
+}
+
+/**
+ * @brief Invalidate a TLB entry
+ *
+ * The entry is pointed to a unique address in KSEG0, which is never
+ * translated through the TLB, so that it can never match (not even
+ * other invalidated entries, which would be undefined behavior).
+ */
+static void tlb_invalidate(int idx)
+{
+    tlb_write(idx, 0, 0x80000000 + (idx << 24), 0, 0);
+}
+
+/** @brief Build an ENTRYLO value for a page at the specified physical address */
+static uint32_t tlb_entrylo(uint32_t paddr, bool writable)
+{
+    // Cache algorithm 3: cacheable noncoherent (as KSEG0)
+    return ((paddr >> 12) << 6) | (3 << 3) | C0_ENTRYLO_VALID | C0_ENTRYLO_GLOBAL |
+        (writable ? C0_ENTRYLO_DIRTY : 0);
+}
+
+/** @brief Find the mapping that contains a virtual address */
+static vmem_mapping_t *mapping_find(uint32_t vaddr)
+{
+    for (int i = 0; i < VMEM_MAX_MAPPINGS; i++) {
+        vmem_mapping_t *m = &mappings[i];
+        if (m->vaddr && vaddr >= m->vaddr && vaddr < m->vaddr + m->size)
+            return m;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Serve a TLB miss exception (called by inthandler.S)
+ *
+ * @return true if the address belongs to a mapping and the page was mapped
+ *         (execution can resume), false if this is a real crash.
+ */
+bool __vmem_fault(reg_block_t *regs)
+{
+    if (!page_size)
+        return false;
+
+    uint32_t vaddr = C0_BADVADDR();
+    vmem_mapping_t *m = mapping_find(vaddr);
+    if (!m)
+        return false;
+    // ROM mappings are read-only
+    if (m->rom_addr && C0_GET_CAUSE_EXC_CODE(regs->cr) == EXCEPTION_CODE_TLB_STORE_MISS)
+        return false;
+
+    uint32_t vframe = vaddr & ~(frame_size - 1);
+    uint32_t offset = vframe - m->vaddr;
+    int idx = next_victim;
+    next_victim = (next_victim + 1) % num_frames;
+    if (frame_vaddr[idx])
+        stats.evictions++;
+    stats.faults++;
+
+    uint32_t lo0, lo1;
+    if (m->rom_addr) {
+        // Load the frame from ROM. The frame is aligned to its size, so the
+        // cachelines of its previous contents have the same index when
+        // accessed via KSEG0, and can be invalidated from there.
+        uint8_t *frame = frames + idx * frame_size;
+        int len = MIN(frame_size, (int)(m->size - offset));
+        data_cache_hit_invalidate(frame, frame_size);
+        if (page_size < 16*1024)
+            inst_cache_invalidate_all();
+        else
+            inst_cache_hit_invalidate(frame, frame_size);
+        // Interrupts are disabled here, so dma_wait will not try to yield
+        dma_read_async(frame, m->rom_addr + offset, len);
+        dma_wait();
+        if (len < frame_size)
+            memset(UncachedAddr(frame + len), 0, frame_size - len);
+        stats.bytes_loaded += len;
+
+        lo0 = tlb_entrylo(PhysicalAddr(frame), false);
+        lo1 = tlb_entrylo(PhysicalAddr(frame) + page_size, false);
+    } else {
+        // Map the buffer directly. The odd page is left invalid if it is
+        // past the end of the buffer, so that accesses to it crash.
+        // Frames are as big as the data cache at least, and the buffer is
+        // aligned to them, so the virtual range and the buffer share the
+        // same cachelines and need no cache maintenance.
+        uint32_t paddr = m->ram_addr + offset;
+        lo0 = tlb_entrylo(paddr, true);
+        lo1 = (offset + page_size < m->size) ? tlb_entrylo(paddr + page_size, true) : 0;
+    }
+
+    tlb_write(idx, (page_size / 4096 - 1) << 13, vframe, lo0, lo1);
+    frame_vaddr[idx] = vframe;
+    return true;
+}
+
+void vmem_init(int page_size_, int num_frames_)
+{
+    assertf(page_size_ == 4*1024 || page_size_ == 16*1024 || page_size_ == 64*1024 ||
+            page_size_ == 256*1024 || page_size_ == 1024*1024,
+        "invalid page size: %d", page_size_);
+    assertf(num_frames_ >= 1 && num_frames_ <= VMEM_MAX_FRAMES,
+        "invalid number of frames: %d", num_frames_);
+    if (page_size)
+        vmem_close();
+
+    frames = memalign(page_size_ * 2, page_size_ * 2 * num_frames_);
+    assertf(frames, "vmem_init: out of memory (%d bytes)", page_size_ * 2 * num_frames_);
+
+    disable_interrupts();
+    page_size = page_size_;
+    frame_size = page_size_ * 2;
+    num_frames = num_frames_;
+    next_victim = 0;
+    next_vaddr = VMEM_BASE;
+    memset(frame_vaddr, 0, sizeof(frame_vaddr));
+    memset(mappings, 0, sizeof(mappings));
+    memset(&stats, 0, sizeof(stats));
+    // The TLB contents are undefined at boot: clear all the entries
+    for (int i = 0; i < TLB_NUM_ENTRIES; i++)
+        tlb_invalidate(i);
+    enable_interrupts();
+}
+
+void vmem_close(void)
+{
+    if (!page_size)
+        return;
+
+    disable_interrupts();
+    for (int i = 0; i < num_frames; i++)
+        tlb_invalidate(i);
+    page_size = 0;
+    enable_interrupts();
+
+    free(frames);
+    frames = NULL;
+}
+
+/** @brief Allocate a mapping of the specified size */
+static vmem_mapping_t *mapping_alloc(uint32_t size)
+{
+    assertf(page_size, "vmem_init() must be called first");
+    uint32_t vsize = ROUND_UP(size, frame_size);
+    assertf(vsize <= VMEM_END - next_vaddr, "vmem: out of virtual address space (mapping %ld bytes)", size);
+
+    for (int i = 0; i < VMEM_MAX_MAPPINGS; i++) {
+        vmem_mapping_t *m = &mappings[i];
+        if (!m->vaddr) {
+            m->vaddr = next_vaddr;
+            m->size = size;
+            next_vaddr += vsize;
+            return m;
+        }
+    }
+    assertf(0, "vmem: too many mappings (max: %d)", VMEM_MAX_MAPPINGS);
+    return NULL;
+}
+
+const void *vmem_map_rom(const char *fn, int *size)
+{
+    if (strstr(fn, ":/")) {
+        assertf(strncmp(fn, "rom:/", 5) == 0, "Cannot map %s: only files in ROM (rom:/) can be mapped", fn);
+        fn += 5;
+    }
+
+    int fh = dfs_open(fn);
+    assertf(fh >= 0, "file does not exist: %s", fn);
+    int file_size = dfs_size(fh);
+    dfs_close(fh);
+    assertf(file_size > 0, "cannot map an empty file: %s", fn);
+
+    vmem_mapping_t *m = mapping_alloc(file_size);
+    m->rom_addr = (dfs_rom_addr(fn) | 0x10000000) & 0x1FFFFFFF;
+    assertf((m->rom_addr & 1) == 0, "cannot map %s: file is at an odd ROM address", fn);
+    if (size) *size = file_size;
+    return (const void*)m->vaddr;
+}
+
+void *vmem_map_ram(void *buf, int size)
+{
+    assertf(((uint32_t)buf & (frame_size - 1)) == 0,
+        "vmem_map_ram: buffer %p is not aligned to %d bytes", buf, frame_size);
+    assertf(size > 0, "vmem_map_ram: invalid size %d", size);
+
+    vmem_mapping_t *m = mapping_alloc(size);
+    m->rom_addr = 0;
+    m->ram_addr = PhysicalAddr(buf);
+    return (void*)m->vaddr;
+}
+
+void vmem_unmap(const void *ptr)
+{
+    vmem_mapping_t *m = mapping_find((uint32_t)ptr);
+    assertf(m && m->vaddr == (uint32_t)ptr, "vmem_unmap: %p is not a mapping", ptr);
+
+    disable_interrupts();
+    for (int i = 0; i < num_frames; i++) {
+        if (frame_vaddr[i] >= m->vaddr && frame_vaddr[i] < m->vaddr + m->size) {
+            tlb_invalidate(i);
+            frame_vaddr[i] = 0;
+        }
+    }
+    memset(m, 0, sizeof(vmem_mapping_t));
+
+    // Recycle the virtual address space when there are no mappings left
+    bool empty = true;
+    for (int i = 0; i < VMEM_MAX_MAPPINGS; i++)
+        if (mappings[i].vaddr) empty = false;
+    if (empty)
+        next_vaddr = VMEM_BASE;
+    enable_interrupts();
+}
+
+void vmem_get_stats(vmem_stats_t *out)
+{
+    disable_interrupts();
+    *out = stats;
+    enable_interrupts();
+}
@@ -0,0 +1,9 @@
+// Code overlay used by test_overlay (see N64_OVERLAYS in tests/Makefile)
+
+static int counter = 100;
+
+int ovltest1_step(int x)
+{
+	counter += x;
+	return counter;
+}
@@ -0,0 +1,8 @@
+// Code overlay used by test_overlay (see N64_OVERLAYS in tests/Makefile)
+
+static const char message[] = "overlay 2";
+
+const char *ovltest2_message(void)
+{
+	return message;
+}
@@ -0,0 +1,86 @@
+
+void test_arena_alloc(TestContext *ctx) {
+	arena_t arena;
+	arena_init(&arena, 1024);
+	DEFER(arena_close(&arena));
+
+	uint8_t *a = arena_alloc(&arena, 10);
+	uint8_t *b = arena_alloc(&arena, 10);
+	ASSERT(a != NULL && b != NULL, "allocation failed");
+	ASSERT_EQUAL_HEX((uint32_t)a & 15, 0, "allocation is not 16-byte aligned");
+	ASSERT_EQUAL_HEX((uint32_t)b & 15, 0, "allocation is not 16-byte aligned");
+	ASSERT(b >= a + 10, "allocations overlap");
+	ASSERT(arena_contains(&arena, a) && arena_contains(&arena, UncachedAddr(b)), "pointer not in arena");
+
+	uint8_t *c = arena_alloc_aligned(&arena, 128, 4);
+	ASSERT_EQUAL_HEX((uint32_t)c & 127, 0, "allocation is not 128-byte aligned");
+
+	// Reset to a mark releases only the following allocations
+	arena_mark_t mark = arena_mark(&arena);
+	uint8_t *d = arena_alloc(&arena, 100);
+	arena_reset(&arena, mark);
+	uint8_t *e = arena_alloc(&arena, 100);
+	ASSERT(d == e, "memory not reused after reset");
+
+	// A full arena returns NULL, and becomes usable again after a clear
+	ASSERT(arena_alloc(&arena, 1024) == NULL, "allocation bigger than the arena succeeded");
+	ASSERT_EQUAL_UNSIGNED(arena.peak, arena.used, "wrong peak");
+	arena_clear(&arena);
+	ASSERT_EQUAL_UNSIGNED(arena.used, 0, "arena not cleared");
+	ASSERT(arena_alloc(&arena, 1024) == arena.buffer, "full-size allocation failed");
+	ASSERT(arena_alloc(&arena, 1) == NULL, "allocation in a full arena succeeded");
+	ASSERT(!arena_contains(&arena, arena.buffer + 1024), "pointer after the end is in the arena");
+}
+
+void test_arena_uncached(TestContext *ctx) {
+	arena_t arena;
+	arena_init(&arena, 1024);
+	DEFER(arena_close(&arena));
+
+	// Uncached allocations from a cached arena use full cachelines
+	uint8_t *a = arena_alloc(&arena, 4);
+	uint8_t *u = arena_alloc_uncached(&arena, 8, 20);
+	uint8_t *b = arena_alloc(&arena, 4);
+	ASSERT(u == UncachedAddr(u), "pointer is not uncached");
+	ASSERT_EQUAL_HEX((uint32_t)u & 15, 0, "uncached allocation is not cacheline aligned");
+	ASSERT(CachedAddr(u) >= (void*)(a + 16) && (void*)b >= CachedAddr(u) + 32, "uncached allocation shares cachelines");
+
+	// Data written via the uncached pointer are not overwritten by cache writebacks
+	memset(u, 0xAA, 20);
+	memset(a, 0x55, 4); memset(b, 0x55, 4);
+	data_cache_hit_writeback_invalidate(a, 4);
+	data_cache_hit_writeback_invalidate(b, 4);
+	for (int i=0; i<20; i++)
+		ASSERT_EQUAL_HEX(u[i], 0xAA, "uncached data corrupted at %d", i);
+
+	// Uncached arenas return uncached pointers
+	arena_t uarena;
+	arena_init_uncached(&uarena, 256);
+	DEFER(arena_close(&uarena));
+	ASSERT(uarena.flags & ARENA_FLAGS_UNCACHED, "arena is not uncached");
+	void *p = arena_alloc(&uarena, 16);
+	ASSERT(p == UncachedAddr(p), "uncached arena returned a cached pointer");
+
+	// Arenas on external buffers
+	arena_t sub;
+	arena_init_buffer(&sub, u, 20);
+	ASSERT(sub.flags & ARENA_FLAGS_UNCACHED, "arena on uncached buffer is not uncached");
+	ASSERT(arena_alloc_aligned(&sub, 4, 20) == u, "allocation from external buffer failed");
+	arena_close(&sub);
+	ASSERT_EQUAL_HEX(u[0], 0xAA, "external buffer modified");
+}
+
+void test_arena_surface(TestContext *ctx) {
+	arena_t arena;
+	arena_init(&arena, 8192);
+	DEFER(arena_close(&arena));
+
+	arena_alloc(&arena, 4);
+	surface_t s = surface_alloc_arena(&arena, FMT_RGBA16, 32, 16);
+	ASSERT(s.buffer == UncachedAddr(s.buffer), "surface buffer is not uncached");
+	ASSERT_EQUAL_HEX((uint32_t)s.buffer & 63, 0, "surface buffer is not 64-byte aligned");
+	ASSERT(arena_contains(&arena, s.buffer), "surface buffer not in arena");
+	ASSERT_EQUAL_UNSIGNED(s.stride, 64, "wrong stride");
+	ASSERT(!surface_has_owned_buffer(&s), "arena surface owns its buffer");
+	surface_free(&s);
+}
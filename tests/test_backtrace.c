@@ -161,6 +161,50 @@ void test_backtrace_invalidptr(TestContext *ctx)
     if (ctx->result == TEST_FAILED) return;
 }
 
+void test_backtrace_cache(TestContext *ctx)
+{
+    // Symbolization must give the same results with the RAM cache, both with
+    // the full address table and with a sparse index. Run each backtrace twice
+    // so that the second time the symbols come from the LRU cache.
+    const int strides[] = { 1, 16 };
+    for (int i=0; i<2; i++) {
+        ASSERT(backtrace_cache_init(strides[i]), "cannot create the symbol cache");
+        DEFER(backtrace_cache_close());
+        for (int j=0; j<2; j++) {
+            btt_start(ctx, btt_b1, (const char*[]) {
+                "btt_end", "btt_b3", "btt_b2", "btt_b1", "btt_start", NULL
+            });
+            if (ctx->result == TEST_FAILED) return;
+        }
+    }
+}
+
+void test_backtrace_frametab(TestContext *ctx)
+{
+    // The frame table generated by n64sym must agree with the analysis of
+    // the function code, for all the frames of a backtrace.
+    int (*funcs[2])(void) = { btt_b1, btt_c1 };
+    for (int i=0; i<2; i++) {
+        bt_buf_len = 0;
+        funcs[i]();
+        ASSERT(bt_buf_len > 0, "backtrace not called");
+
+        int found = 0;
+        for (int j=0; j<bt_buf_len; j++) {
+            bt_func_t func1, func2;
+            if (!__bt_lookup_func(&func1, bt_buf[j]))
+                continue;
+            ASSERT(__bt_analyze_func(&func2, bt_buf[j], 0, false), "bt_analyze failed");
+            ASSERT_EQUAL_UNSIGNED(func1.type, func2.type, "invalid function type (frame %d)", j);
+            ASSERT_EQUAL_UNSIGNED(func1.stack_size, func2.stack_size, "invalid stack size (frame %d)", j);
+            ASSERT_EQUAL_UNSIGNED(func1.ra_offset, func2.ra_offset, "invalid RA offset (frame %d)", j);
+            ASSERT_EQUAL_UNSIGNED(func1.fp_offset, func2.fp_offset, "invalid FP offset (frame %d)", j);
+            found++;
+        }
+        ASSERT(found >= 3, "frame table not used (%d frames found)", found);
+    }
+}
+
 void test_backtrace_analyze(TestContext *ctx)
 {
     bt_func_t func; bool ret;
@@ -0,0 +1,116 @@
+// Benchmarks of common operations, with regression checks.
+//
+// Each benchmark is timed with TEST_BENCH (see testrom.c), which reports the
+// median and spread over debugf, and compares the median against the
+// baseline in tests/filesystem/bench_baseline.txt.
+
+void test_bench_dfs_read(TestContext *ctx) {
+	static const int sizes[] = { 16, 256, 4096 };
+	uint8_t *buf = malloc(4096 + 16);
+	DEFER(free(buf));
+
+	int fh = dfs_open("random.dat");
+	ASSERT(fh >= 0, "cannot open random.dat");
+	DEFER(dfs_close(fh));
+
+	for (int i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++) {
+		char name[48];
+		int sz = sizes[i];
+
+		// Aligned buffer and ROM offset (the fast DMA path)
+		sprintf(name, "dfs.read.%d", sz);
+		TEST_BENCH(name, 32, ({
+			dfs_seek(fh, 0, SEEK_SET);
+			dfs_read(buf, 1, sz, fh);
+		}));
+
+		// Misaligned buffer and ROM offset (the slow paths of dma_read)
+		sprintf(name, "dfs.read.%d.unaligned", sz);
+		TEST_BENCH(name, 32, ({
+			dfs_seek(fh, 3, SEEK_SET);
+			dfs_read(buf + 1, 1, sz, fh);
+		}));
+	}
+}
+
+void test_bench_asset_load(TestContext *ctx) {
+	// The same data, stored with every compression algorithm
+	static const char *files[] = {
+		"random.dat", "random4x.dat", "random_lzh5.dat", "random_lzb.dat",
+	};
+
+	for (int i=0;i<sizeof(files)/sizeof(files[0]);i++) {
+		char fn[64], name[48];
+		sprintf(fn, "rom:/%s", files[i]);
+		sprintf(name, "asset.load.%s", files[i]);
+		TEST_BENCH(name, 16, ({
+			void *data = asset_load(fn, NULL);
+			free(data);
+		}));
+	}
+}
+
+void test_bench_cache(TestContext *ctx) {
+	static uint8_t buf[8192] __attribute__((aligned(16)));
+
+	disable_interrupts();
+	DEFER(enable_interrupts());
+
+	TEST_BENCH("cache.writeback_invalidate.8k", 64, ({
+		memset(buf, 0xAA, sizeof(buf));
+		data_cache_hit_writeback_invalidate(buf, sizeof(buf));
+	}));
+	TEST_BENCH("cache.invalidate.8k", 64, ({
+		data_cache_hit_invalidate(buf, sizeof(buf));
+	}));
+	TEST_BENCH("cache.writeback_invalidate_all", 64, ({
+		data_cache_writeback_invalidate_all();
+	}));
+	TEST_BENCH("cache.inst_invalidate_all", 64, ({
+		inst_cache_invalidate_all();
+	}));
+}
+
+void test_bench_timer(TestContext *ctx) {
+	timer_init();
+	DEFER(timer_close());
+
+	void cb(int ovfl) {}
+
+	// Creating and deleting timers, with others already in the list
+	timer_link_t *others[8];
+	for (int i=0;i<8;i++)
+		others[i] = new_timer(TICKS_FROM_MS(1000 + i), TF_ONE_SHOT, cb);
+	DEFER(for (int i=0;i<8;i++) delete_timer(others[i]));
+
+	TEST_BENCH("timer.new_delete", 128, ({
+		timer_link_t *t = new_timer(TICKS_FROM_MS(500), TF_ONE_SHOT, cb);
+		delete_timer(t);
+	}));
+
+	timer_link_t t = {0};
+	TEST_BENCH("timer.start_stop", 128, ({
+		start_timer(&t, TICKS_FROM_MS(500), TF_ONE_SHOT, cb);
+		stop_timer(&t);
+	}));
+}
+
+void test_bench_joybus(TestContext *ctx) {
+	// A full blocking roundtrip, querying the controllers on all ports
+	TEST_BENCH("joybus.roundtrip", 32, ({
+		get_controllers_present();
+	}));
+}
+
+void test_bench_rspq_syncpoint(TestContext *ctx) {
+	TEST_RSPQ_PROLOG();
+
+	// Latency of a syncpoint on an idle queue, as seen by the CPU
+	TEST_BENCH("rspq.syncpoint", 64, ({
+		rspq_syncpoint_t sp = rspq_syncpoint_new();
+		rspq_flush();
+		rspq_syncpoint_wait(sp);
+	}));
+
+	TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
@@ -0,0 +1,51 @@
+void test_blkpool(TestContext *ctx) {
+	blkpool_t pool;
+	blkpool_init(&pool, 12, 4);
+	DEFER(blkpool_close(&pool));
+	ASSERT_EQUAL_UNSIGNED(pool.block_size, 16, "block size not rounded to 8 bytes");
+
+	void *blocks[6];
+	for (int i = 0; i < 6; i++) {
+		blocks[i] = blkpool_alloc(&pool);
+		ASSERT(blocks[i] != NULL, "allocation %d failed", i);
+		ASSERT_EQUAL_HEX((uint32_t)blocks[i] & 7, 0, "block is not 8-byte aligned");
+		for (int j = 0; j < i; j++)
+			ASSERT(blocks[i] != blocks[j], "block %d allocated twice", j);
+	}
+	ASSERT_EQUAL_UNSIGNED(pool.capacity, 8, "pool did not grow by chunks");
+	ASSERT_EQUAL_UNSIGNED(pool.used, 6, "wrong number of used blocks");
+
+	// A freed block is the first one to be reused
+	blkpool_free(&pool, blocks[3]);
+	ASSERT(blkpool_alloc(&pool) == blocks[3], "freed block was not reused");
+
+	for (int i = 0; i < 6; i++)
+		blkpool_free(&pool, blocks[i]);
+	ASSERT_EQUAL_UNSIGNED(pool.used, 0, "blocks not freed");
+	ASSERT_EQUAL_UNSIGNED(pool.capacity, 8, "memory released before close");
+}
+
+void test_blkpool_interrupt(TestContext *ctx) {
+	static blkpool_t pool = BLKPOOL_INIT(uint64_t, 2);
+	DEFER(blkpool_close(&pool));
+	blkpool_reserve(&pool, 3);
+	ASSERT_EQUAL_UNSIGNED(pool.capacity, 4, "wrong reserved capacity");
+
+	// With interrupts disabled (as in an interrupt handler), the pool
+	// only hands out the free blocks, without growing.
+	void *blocks[5];
+	disable_interrupts();
+	for (int i = 0; i < 5; i++)
+		blocks[i] = blkpool_alloc(&pool);
+	enable_interrupts();
+
+	for (int i = 0; i < 4; i++)
+		ASSERT(blocks[i] != NULL, "reserved block %d not allocated", i);
+	ASSERT(blocks[4] == NULL, "pool grew with interrupts disabled");
+	ASSERT_EQUAL_UNSIGNED(pool.capacity, 4, "pool grew with interrupts disabled");
+
+	// Back with interrupts enabled, the pool grows again
+	void *b = blkpool_alloc(&pool);
+	ASSERT(b != NULL, "pool did not grow with interrupts enabled");
+	ASSERT_EQUAL_UNSIGNED(pool.capacity, 6, "pool did not grow with interrupts enabled");
+}
@@ -0,0 +1,35 @@
+
+static const boot_profile_step_t *find_boot_step(const boot_profile_step_t *steps, int n, const char *name) {
+	for (int i = 0; i < n; i++)
+		if (strcmp(steps[i].name, name) == 0)
+			return &steps[i];
+	return NULL;
+}
+
+void test_boot_profile(TestContext *ctx) {
+	const boot_profile_step_t *steps;
+	int n = boot_profile_get_steps(&steps);
+
+	// The test ROM runs console_init (which calls display_init) and dfs_init at boot
+	ASSERT(n >= 3, "boot steps not recorded (%d)", n);
+	ASSERT(strcmp(steps[0].name, "global ctors") == 0, "first step is %s", steps[0].name);
+	const boot_profile_step_t *disp = find_boot_step(steps, n, "display_init");
+	const boot_profile_step_t *dfs = find_boot_step(steps, n, "dfs_init");
+	ASSERT(disp && dfs, "init steps not recorded");
+	ASSERT(disp->start >= steps[0].start + steps[0].ticks, "steps overlap");
+	ASSERT(dfs->start >= disp->start + disp->ticks, "steps overlap");
+	ASSERT(dfs->ticks > 0, "dfs_init took no time");
+	ASSERT(boot_profile_first_frame() > disp->start, "first frame not recorded");
+
+	if (n == BOOT_PROFILE_MAX_STEPS)
+		return;
+
+	// A mark spans the time since the end of the previous step
+	wait_ms(2);
+	boot_profile_mark("test");
+	ASSERT_EQUAL_SIGNED(boot_profile_get_steps(&steps), n+1, "mark not recorded");
+	const boot_profile_step_t *prev = &steps[n-1], *mark = &steps[n];
+	ASSERT(strcmp(mark->name, "test") == 0, "wrong name: %s", mark->name);
+	ASSERT_EQUAL_UNSIGNED(mark->start, prev->start + prev->ticks, "mark does not follow the previous step");
+	ASSERT(mark->ticks >= TICKS_FROM_MS(2), "mark too short: %ld", mark->ticks);
+}
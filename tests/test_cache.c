@@ -56,3 +56,50 @@ void test_cache_invalidate(TestContext *ctx) {
 		}
 	}
 }
+
+void test_cache_writeback_large(TestContext *ctx) {
+	// Regions bigger than the data cache are written back via index ops:
+	// check that all the dirty lines of the region reach RDRAM.
+	const int size = 32*1024;
+	uint8_t *buf = memalign(16, size);
+	DEFER(free(buf));
+	uint8_t *ubuf = UncachedAddr(buf);
+
+	memset(ubuf, 0, size);
+	memset(buf, 0x5A, size);
+	data_cache_hit_writeback(buf, size);
+	for (int i=0; i<size; i++)
+		if (ubuf[i] != 0x5A)
+			ASSERT_EQUAL_HEX(ubuf[i], 0x5A, "data not written back at offset %d", i);
+
+	memset(buf, 0xA5, size);
+	data_cache_hit_writeback_invalidate(buf, size);
+	memset(ubuf, 0x33, size);
+	for (int i=0; i<size; i++)
+		if (buf[i] != 0x33)
+			ASSERT_EQUAL_HEX(buf[i], 0x33, "stale cacheline at offset %d", i);
+}
+
+void test_cache_range_bench(TestContext *ctx) {
+	// Compare the cost of writing back a dirty region line by line with
+	// hit ops, against writing back the whole data cache with index ops.
+	// The crossover is expected to be around (but below) the cache size.
+	const int max_size = 64*1024;
+	uint8_t *buf = memalign(16, max_size);
+	DEFER(free(buf));
+
+	for (int size = 1024; size <= max_size; size *= 2) {
+		memset(buf, 0xAA, size);
+		uint32_t t0 = TICKS_READ();
+		for (int i = 0; i < size; i += 8*1024)
+			data_cache_hit_writeback_invalidate(buf + i, size - i < 8*1024 ? size - i : 8*1024);
+		uint32_t hit_ticks = TICKS_READ() - t0;
+
+		memset(buf, 0xAA, size);
+		t0 = TICKS_READ();
+		data_cache_writeback_invalidate_all();
+		uint32_t index_ticks = TICKS_READ() - t0;
+
+		LOG("cache bench: %6d bytes: hit %6ld ticks, index %6ld ticks\n", size, hit_ticks, index_ticks);
+	}
+}
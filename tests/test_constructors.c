@@ -10,4 +10,28 @@ __attribute__((constructor)) void __global_constructor_test()
 void test_constructors(TestContext *ctx) {
 	ASSERT(__global_constructor_test_value == 0xC0C70125, "Global constructors did not get executed!");
 	ASSERT(__global_cpp_constructor_test_value == 0xD0C70125, "Global C++ constructors did not get executed!");
-}
\ No newline at end of file
+}
+static int __ctor_order_log[3];
+static int __ctor_order_count;
+
+__attribute__((constructor(102))) static void __ctor_order_102(void)
+{
+	if (__ctor_order_count < 3) __ctor_order_log[__ctor_order_count++] = 102;
+}
+
+__attribute__((constructor)) static void __ctor_order_default(void)
+{
+	if (__ctor_order_count < 3) __ctor_order_log[__ctor_order_count++] = 0;
+}
+
+__attribute__((constructor(101))) static void __ctor_order_101(void)
+{
+	if (__ctor_order_count < 3) __ctor_order_log[__ctor_order_count++] = 101;
+}
+
+void test_constructors_priority(TestContext *ctx) {
+	ASSERT_EQUAL_SIGNED(__ctor_order_count, 3, "Prioritized constructors did not get executed!");
+	ASSERT_EQUAL_SIGNED(__ctor_order_log[0], 101, "Wrong constructor order");
+	ASSERT_EQUAL_SIGNED(__ctor_order_log[1], 102, "Wrong constructor order");
+	ASSERT_EQUAL_SIGNED(__ctor_order_log[2], 0, "Wrong constructor order");
+}
@@ -21,6 +21,29 @@ void test_cop1_denormalized_float(TestContext *ctx) {
     ASSERT(x == 0.0f, "Denormalized float was not flushed to zero");
 }
 
+void test_cop1_denormalized_operand(TestContext *ctx) {
+    uint32_t fcr31 = C1_FCR31();
+    DEFER(C1_WRITE_FCR31(fcr31));
+    cop1_set_flush_to_zero(true);
+
+    /* Build a denormalized float without any FPU operation */
+    uint32_t bits = 0x00000123;
+    volatile float x; memcpy((void*)&x, &bits, sizeof(float));
+
+    /* Using it as an operand traps: the handler flushes it to zero and resumes */
+    uint32_t traps = cop1_get_trap_count();
+    volatile float y = x * 2.0f;
+    ASSERT(y == 0.0f, "Denormalized operand was not flushed to zero");
+    ASSERT_EQUAL_UNSIGNED(cop1_get_trap_count(), traps + 1, "FPU trap was not counted");
+
+    /* Same for doubles, as second operand */
+    uint64_t dbits = 0x0000000000012345ull;
+    volatile double dx; memcpy((void*)&dx, &dbits, sizeof(double));
+    volatile double dy = 3.0 + dx;
+    ASSERT(dy == 3.0, "Denormalized double operand was not flushed to zero");
+    ASSERT_EQUAL_UNSIGNED(cop1_get_trap_count(), traps + 2, "FPU trap was not counted");
+}
+
 void test_cop1_interrupts(TestContext *ctx) {
    // Test that we can use FPUs in the context of an interrupt handler.
    // This is useful because in general interrupt handlers save FPU registers
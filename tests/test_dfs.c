@@ -67,6 +67,87 @@ void test_dfs_read(TestContext *ctx) {
 	ASSERT_EQUAL_MEM(abuf-2, (uint8_t*)"\xaa\xaa", 2, "buffer underflow #3");	
 }
 
+void test_dfs_fread_unbuffered(TestContext *ctx) {
+	FILE *f = fopen("rom:/counter.dat", "rb");
+	ASSERT(f, "counter.dat not found");
+	DEFER(fclose(f));
+	setvbuf(f, NULL, _IONBF, 0);
+
+	static uint8_t buf[2048] __attribute__((aligned(16)));
+
+	// Check large reads in all combinations of RDRAM and ROM misalignment
+	for (int ram_off=0; ram_off<8; ram_off++) {
+		for (int rom_off=0; rom_off<2; rom_off++) {
+			int len = 1001 + ram_off;
+			memset(buf, 0xAA, sizeof(buf));
+			fseek(f, 17*ram_off + rom_off, SEEK_SET);
+			ASSERT_EQUAL_SIGNED(fread(buf+ram_off, 1, len, f), len, "short read");
+			for (int i=0;i<len;i++)
+				ASSERT_EQUAL_HEX(buf[ram_off+i], (uint8_t)(17*ram_off+rom_off+i),
+					"invalid data at %d [%d/%d]", i, ram_off, rom_off);
+			ASSERT_EQUAL_HEX(buf[ram_off+len], 0xAA, "buffer overflow [%d/%d]", ram_off, rom_off);
+			if (ram_off)
+				ASSERT_EQUAL_HEX(buf[ram_off-1], 0xAA, "buffer underflow [%d/%d]", ram_off, rom_off);
+		}
+	}
+}
+
+void test_dfs_read_cache(TestContext *ctx) {
+	int fh = dfs_open("counter.dat");
+	ASSERT(fh >= 0, "counter.dat not found");
+	DEFER(dfs_close(fh));
+	ASSERT_EQUAL_SIGNED(dfs_set_cache_size(fh, 3000), DFS_ESUCCESS, "cannot set cache size");
+
+	// Read sequentially in small unaligned chunks, so that read-ahead grows
+	uint8_t buf[32];
+	int pos = 0;
+	while (pos < dfs_size(fh)) {
+		int n = dfs_read(buf+1, 1, 13, fh);
+		ASSERT(n > 0, "read error at %d", pos);
+		for (int i=0;i<n;i++)
+			ASSERT_EQUAL_HEX(buf[1+i], (uint8_t)(pos+i), "invalid data at %d", pos+i);
+		pos += n;
+	}
+	ASSERT_EQUAL_SIGNED(pos, 4096, "invalid file length");
+	ASSERT(dfs_eof(fh), "EOF not reached");
+
+	// Once the cache is allocated, its size cannot be changed anymore
+	ASSERT_EQUAL_SIGNED(dfs_set_cache_size(fh, 512), DFS_EBADINPUT, "cache size changed");
+
+	// Random access goes back to small refills
+	for (int i=0;i<64;i++) {
+		int seek = RANDN(4096-16);
+		dfs_seek(fh, seek, SEEK_SET);
+		dfs_read(buf+1, 1, 5, fh);
+		for (int j=0;j<5;j++)
+			ASSERT_EQUAL_HEX(buf[1+j], (uint8_t)(seek+j), "invalid data at %d", seek+j);
+	}
+}
+
+void test_dfs_many_files(TestContext *ctx) {
+	// Open more files than the initial pool size, so that the pool grows
+	int fh[MAX_OPEN_FILES*3];
+	for (int i=0;i<MAX_OPEN_FILES*3;i++) {
+		fh[i] = dfs_open("counter.dat");
+		ASSERT(fh[i] >= 0, "cannot open file #%d (%d)", i, fh[i]);
+		dfs_seek(fh[i], i, SEEK_SET);
+	}
+	for (int i=0;i<MAX_OPEN_FILES*3;i++) {
+		uint8_t v;
+		ASSERT_EQUAL_SIGNED(dfs_read(&v, 1, 1, fh[i]), 1, "cannot read file #%d", i);
+		ASSERT_EQUAL_HEX(v, i, "invalid data in file #%d", i);
+	}
+	for (int i=0;i<MAX_OPEN_FILES*3;i++)
+		ASSERT_EQUAL_SIGNED(dfs_close(fh[i]), DFS_ESUCCESS, "cannot close file #%d", i);
+
+	// Handles of closed files are rejected, even if the slot is reused
+	int fh2 = dfs_open("counter.dat");
+	ASSERT(fh2 >= 0, "cannot reopen file");
+	ASSERT(fh2 != fh[0], "handle reused");
+	ASSERT_EQUAL_SIGNED(dfs_tell(fh[0]), DFS_EBADHANDLE, "stale handle accepted");
+	dfs_close(fh2);
+}
+
 void test_dfs_rom_addr(TestContext *ctx) {
 	int fh = dfs_open("counter.dat");
 	ASSERT(fh >= 0, "counter.dat not found");
@@ -88,3 +169,383 @@ void test_dfs_rom_addr(TestContext *ctx) {
 
 	ASSERT_EQUAL_MEM(buf1, buf2, 128, "DMA ROM access is different");
 }
+
+void test_dfs_dir_read(TestContext *ctx) {
+	int count = dfs_dir_read("/", NULL, 0);
+	ASSERT(count > 0, "cannot read the root directory: %d", count);
+
+	dfs_dirent_t *entries = malloc(count * sizeof(dfs_dirent_t));
+	DEFER(free(entries));
+	ASSERT_EQUAL_SIGNED(dfs_dir_read("/", entries, count), count, "inconsistent number of entries");
+
+	// Same entries, in the same order, of the findfirst/findnext iteration
+	char name[MAX_FILENAME_LEN+1];
+	int flags = dfs_dir_findfirst("/", name);
+	bool found = false;
+	for (int i=0; i<count; i++) {
+		ASSERT(flags != FLAGS_EOF && flags >= 0, "too many entries (%d)", i);
+		ASSERT(!strcmp(entries[i].name, name), "entry %d: invalid name %s (expected %s)", i, entries[i].name, name);
+		ASSERT_EQUAL_HEX(entries[i].flags, flags, "entry %d: invalid flags", i);
+
+		if (!strcmp(name, "counter.dat")) {
+			found = true;
+			ASSERT_EQUAL_UNSIGNED(entries[i].size, 4096, "invalid size of counter.dat");
+			ASSERT_EQUAL_HEX(entries[i].rom_addr, dfs_rom_addr("counter.dat"), "invalid address of counter.dat");
+		}
+		flags = dfs_dir_findnext(name);
+	}
+	ASSERT_EQUAL_SIGNED(flags, FLAGS_EOF, "missing entries");
+	ASSERT(found, "counter.dat not found");
+
+	// Only the requested number of entries are stored
+	dfs_dirent_t first;
+	ASSERT_EQUAL_SIGNED(dfs_dir_read("/", &first, 1), count, "invalid number of entries");
+	ASSERT(!strcmp(first.name, entries[0].name), "invalid first entry");
+
+	ASSERT_EQUAL_SIGNED(dfs_dir_read("/missing", NULL, 0), DFS_ENOFILE, "missing directory found");
+}
+
+void test_dfs_lookup(TestContext *ctx) {
+	// Absolute paths (and relative paths from the root) go through the hash index
+	uint32_t rom = dfs_rom_addr("counter.dat");
+	ASSERT(rom != 0, "counter.dat not found");
+	ASSERT_EQUAL_HEX(dfs_rom_addr("/counter.dat"), rom, "absolute lookup mismatch");
+
+	// Paths with dot components fall back to the directory walk
+	ASSERT_EQUAL_HEX(dfs_rom_addr("./counter.dat"), rom, "dot lookup mismatch");
+	ASSERT_EQUAL_HEX(dfs_rom_addr("/./counter.dat"), rom, "absolute dot lookup mismatch");
+
+	ASSERT_EQUAL_SIGNED(dfs_open("/missing.dat"), DFS_ENOFILE, "missing file found");
+	ASSERT_EQUAL_SIGNED(dfs_open("counter.da"), DFS_ENOFILE, "prefix of a file found");
+	ASSERT_EQUAL_SIGNED(dfs_open("counter.dat2"), DFS_ENOFILE, "extension of a file found");
+
+	int fh = dfs_open("/random.dat");
+	ASSERT(fh >= 0, "random.dat not found");
+	dfs_close(fh);
+}
+
+void test_dfs_map(TestContext *ctx) {
+	uint32_t rom; int size;
+	ASSERT_EQUAL_SIGNED(dfs_map("counter.dat", &rom, &size), DFS_ESUCCESS, "cannot map counter.dat");
+	ASSERT_EQUAL_HEX(rom, dfs_rom_addr("counter.dat"), "invalid mapped address");
+	ASSERT_EQUAL_SIGNED(size, 4096, "invalid mapped size");
+	ASSERT_EQUAL_SIGNED(dfs_map("missing.dat", &rom, &size), DFS_ENOFILE, "missing file mapped");
+
+	uint8_t buf[512] __attribute__((aligned(16)));
+	for (int i=0;i<64;i++) {
+		uint8_t *ubuf = buf + RANDN(16);
+		int offset = RANDN(4096);
+		int len = RANDN(400)+1;
+		memset(buf, 0xAA, sizeof(buf));
+		int n = dfs_map_read(rom, size, offset, ubuf, len);
+		int exp = offset+len > 4096 ? 4096-offset : len;
+		ASSERT_EQUAL_SIGNED(n, exp, "invalid read length");
+		for (int j=0;j<n;j++)
+			ASSERT_EQUAL_HEX(ubuf[j], (uint8_t)(offset+j), "invalid data at %d+%d", offset, j);
+		if (ubuf+n < buf+sizeof(buf))
+			ASSERT_EQUAL_HEX(ubuf[n], 0xAA, "buffer overflow");
+	}
+}
+
+void test_dfs_trace(TestContext *ctx) {
+	dfs_trace_start(16);
+	DEFER(dfs_trace_stop());
+
+	int fh = dfs_open("/counter.dat");
+	ASSERT(fh >= 0, "counter.dat not found");
+	uint8_t buf[16];
+	dfs_read(buf, 1, 16, fh);
+	dfs_close(fh);
+	ASSERT(dfs_rom_addr("random.dat") != 0, "random.dat not found");
+	dfs_trace_stop();
+
+	// Accesses after stopping are not recorded
+	fh = dfs_open("counter.dat");
+	dfs_close(fh);
+
+	char out[1024];
+	FILE *f = fmemopen(out, sizeof(out), "w");
+	dfs_trace_dump(f);
+	fclose(f);
+
+	ASSERT(strstr(out, "# DragonFS trace: 3 events (0 dropped), 2 files\n"), "invalid trace header:\n%s", out);
+	ASSERT(strstr(out, "        16  counter.dat\n"), "read not traced:\n%s", out);
+	ASSERT(strstr(out, "# Load order (mkdfs manifest):\ncounter.dat\nrandom.dat\n"), "invalid load order:\n%s", out);
+}
+
+static volatile int test_dfs_async_done;
+static volatile int test_dfs_async_bytes;
+
+static void test_dfs_async_cb(void *ctx, int len) {
+	test_dfs_async_done |= (uint32_t)ctx;
+	test_dfs_async_bytes += len;
+}
+
+void test_dfs_read_async(TestContext *ctx) {
+	int fh = dfs_open("counter.dat");
+	ASSERT(fh >= 0, "counter.dat not found");
+	DEFER(dfs_close(fh));
+
+	uint8_t expected[1024] __attribute__((aligned(16)));
+	ASSERT_EQUAL_SIGNED(dfs_read(expected, 1, sizeof(expected), fh), sizeof(expected), "short read");
+	dfs_seek(fh, 0, SEEK_SET);
+
+	// Queue multiple reads back to back
+	uint8_t buf[4][256] __attribute__((aligned(16)));
+	test_dfs_async_done = 0;
+	test_dfs_async_bytes = 0;
+	for (int i=0;i<4;i++) {
+		int n = dfs_read_async(fh, buf[i], 256, test_dfs_async_cb, (void*)(1<<i));
+		ASSERT_EQUAL_SIGNED(n, 256, "invalid async read length");
+	}
+	ASSERT_EQUAL_SIGNED(dfs_tell(fh), 1024, "file position not advanced");
+
+	uint32_t t0 = TICKS_READ();
+	while (dfs_read_async_pending() && TICKS_SINCE(t0) < TICKS_FROM_MS(500)) {}
+	ASSERT_EQUAL_SIGNED(dfs_read_async_pending(), 0, "async reads not completed");
+	ASSERT_EQUAL_HEX(test_dfs_async_done, 0xF, "callbacks not invoked");
+	ASSERT_EQUAL_SIGNED(test_dfs_async_bytes, 1024, "invalid callback length");
+	for (int i=0;i<4;i++)
+		ASSERT_EQUAL_MEM(buf[i], expected + i*256, 256, "invalid async read #%d", i);
+
+	// Unaligned buffer: the read is performed synchronously
+	test_dfs_async_done = 0;
+	dfs_seek(fh, 3, SEEK_SET);
+	int n = dfs_read_async(fh, buf[0]+1, 17, test_dfs_async_cb, (void*)1);
+	ASSERT_EQUAL_SIGNED(n, 17, "invalid unaligned async read length");
+	ASSERT_EQUAL_HEX(test_dfs_async_done, 1, "callback not invoked synchronously");
+	ASSERT_EQUAL_MEM(buf[0]+1, expected+3, 17, "invalid unaligned async read");
+}
+
+static void *test_asset_async_data;
+static int test_asset_async_size;
+
+static void test_asset_async_cb(void *ctx, void *data, int size) {
+	test_asset_async_data = data;
+	test_asset_async_size = size;
+}
+
+void test_dfs_asset_load_async(TestContext *ctx) {
+	int size;
+	uint8_t *expected = asset_load("rom:/random.dat", &size);
+	DEFER(free(expected));
+
+	test_asset_async_data = NULL;
+	test_asset_async_size = 0;
+	asset_async_t *req = asset_load_async("rom:/random.dat", test_asset_async_cb, NULL);
+
+	// Use a tiny budget so that the load is split in multiple steps
+	float progress = 0;
+	while (!asset_load_async_poll(req, 1)) {
+		float p = asset_load_async_progress(req);
+		ASSERT(p >= progress && p <= 1.0f, "invalid progress: %f -> %f", progress, p);
+		ASSERT(test_asset_async_data == NULL, "callback called too early");
+		progress = p;
+	}
+	DEFER(free(test_asset_async_data));
+
+	ASSERT(test_asset_async_data != NULL, "callback not called");
+	ASSERT_EQUAL_SIGNED(test_asset_async_size, size, "invalid size");
+	ASSERT_EQUAL_MEM((uint8_t*)test_asset_async_data, expected, size, "invalid data");
+}
+
+void test_dfs_asset_load_writeback(TestContext *ctx) {
+	int size;
+	uint8_t *expected = asset_load("rom:/random.dat", &size);
+	DEFER(free(expected));
+
+	// random4x.dat is random.dat repeated 4 times, so that it is bigger
+	// than the data cache.
+	int cmp_size;
+	uint8_t *data = asset_load_writeback("rom:/random4x.dat", &cmp_size);
+	DEFER(free(data));
+	ASSERT_EQUAL_SIGNED(cmp_size, size*4, "invalid size");
+
+	// Check the data through uncached memory, to verify that it was written back
+	uint8_t *udata = UncachedAddr(data);
+	for (int i=0;i<4;i++)
+		ASSERT_EQUAL_MEM(udata + i*size, expected, size, "invalid data at copy %d", i);
+}
+
+void test_dfs_asset_stats(TestContext *ctx) {
+	asset_stats_enable(true);
+	DEFER(asset_stats_enable(false));
+	asset_stats_reset();
+
+	int size;
+	free(asset_load("rom:/random.dat", &size));
+	free(asset_load("rom:/random4x.dat", NULL));
+	free(asset_load("rom:/random4x.dat", NULL));
+
+	const asset_stats_t *st_raw = NULL, *st_cmp = NULL;
+	for (const asset_stats_t *st = asset_get_stats(NULL); st; st = asset_get_stats(st)) {
+		if (!strcmp(st->filename, "rom:/random.dat")) st_raw = st;
+		if (!strcmp(st->filename, "rom:/random4x.dat")) st_cmp = st;
+	}
+	ASSERT(st_raw, "no stats for random.dat");
+	ASSERT(st_cmp, "no stats for random4x.dat");
+
+	ASSERT_EQUAL_SIGNED(st_raw->algo, 0, "invalid algo");
+	ASSERT_EQUAL_SIGNED(st_raw->num_loads, 1, "invalid number of loads");
+	ASSERT_EQUAL_SIGNED(st_raw->size, size, "invalid size");
+	ASSERT(st_raw->ticks_io > 0, "no I/O time recorded");
+
+	ASSERT_EQUAL_SIGNED(st_cmp->algo, 1, "invalid algo");
+	ASSERT_EQUAL_SIGNED(st_cmp->num_loads, 2, "invalid number of loads");
+	ASSERT_EQUAL_SIGNED(st_cmp->size, size*4, "invalid size");
+	ASSERT(st_cmp->cmp_size < st_cmp->size, "invalid compressed size");
+	ASSERT(st_cmp->ticks_decompress > 0, "no decompression time recorded");
+}
+
+void test_dfs_asset_seek(TestContext *ctx) {
+	int size;
+	uint8_t *expected = asset_load("rom:/random.dat", &size);
+	DEFER(free(expected));
+
+	int cmp_size;
+	FILE *f = asset_fopen("rom:/random_seek.dat", &cmp_size);
+	ASSERT(f, "random_seek.dat not found");
+	DEFER(fclose(f));
+	ASSERT_EQUAL_SIGNED(cmp_size, size, "invalid size");
+
+	// Read at random positions, both forward and backward, also across
+	// block boundaries (blocks are 1 KiB)
+	uint8_t buf[256];
+	for (int i=0;i<64;i++) {
+		int pos = RANDN(size-sizeof(buf));
+		int len = RANDN(sizeof(buf))+1;
+		ASSERT(fseek(f, pos, SEEK_SET) == 0, "fseek failed (pos:%d)", pos);
+		ASSERT_EQUAL_SIGNED(fread(buf, 1, len, f), len, "short read (pos:%d)", pos);
+		ASSERT_EQUAL_MEM(buf, expected+pos, len, "invalid data (pos:%d, len:%d)", pos, len);
+		ASSERT_EQUAL_SIGNED(ftell(f), pos+len, "invalid position");
+	}
+
+	// Seek relative to the end of file
+	ASSERT(fseek(f, -16, SEEK_END) == 0, "fseek from end failed");
+	ASSERT_EQUAL_SIGNED(fread(buf, 1, sizeof(buf), f), 16, "invalid read at end of file");
+	ASSERT_EQUAL_MEM(buf, expected+size-16, 16, "invalid data at end of file");
+}
+
+void test_dfs_asset_stream_pool(TestContext *ctx) {
+	asset_init_compression(2);
+	asset_stream_pool_init(2);
+	DEFER(asset_stream_pool_close());
+
+	int size;
+	uint8_t *expected = asset_load("rom:/random.dat", &size);
+	DEFER(free(expected));
+	uint8_t *data = malloc(size);
+	DEFER(free(data));
+
+	// Open and close streams several times, with states of different sizes
+	// (LZ4 and LZH5), so that pool buffers get reused and grown.
+	static const char *files[] = { "rom:/random4x.dat", "rom:/random_lzh5.dat", "rom:/random_seek.dat" };
+	for (int i=0;i<6;i++) {
+		FILE *f1 = asset_fopen(files[i%3], NULL);
+		DEFER(fclose(f1));
+		FILE *f2 = asset_fopen(files[(i+1)%3], NULL);
+		DEFER(fclose(f2));
+
+		memset(data, 0, size);
+		ASSERT_EQUAL_SIGNED(fread(data, 1, size, f1), size, "short read (%s)", files[i%3]);
+		ASSERT_EQUAL_MEM(data, expected, size, "invalid data (%s)", files[i%3]);
+		memset(data, 0, size);
+		ASSERT_EQUAL_SIGNED(fread(data, 1, size, f2), size, "short read (%s)", files[(i+1)%3]);
+		ASSERT_EQUAL_MEM(data, expected, size, "invalid data (%s)", files[(i+1)%3]);
+	}
+}
+
+void test_dfs_asset_lzh5(TestContext *ctx) {
+	asset_init_compression(2);
+
+	static const char *files[][2] = {
+		{ "rom:/random.dat", "rom:/random_lzh5.dat" },
+		{ "rom:/counter.dat", "rom:/counter_lzh5.dat" },
+	};
+
+	for (int i=0;i<2;i++) {
+		int size, cmp_size;
+		uint8_t *expected = asset_load(files[i][0], &size);
+		DEFER(free(expected));
+
+		// Full decompression (in-place)
+		uint8_t *data = asset_load(files[i][1], &cmp_size);
+		DEFER(free(data));
+		ASSERT_EQUAL_SIGNED(cmp_size, size, "invalid size (%s)", files[i][1]);
+		ASSERT_EQUAL_MEM(data, expected, size, "invalid data (%s)", files[i][1]);
+
+		// Streaming decompression
+		FILE *f = asset_fopen(files[i][1], NULL);
+		DEFER(fclose(f));
+		memset(data, 0, size);
+		ASSERT_EQUAL_SIGNED(fread(data, 1, size, f), size, "short read (%s)", files[i][1]);
+		ASSERT_EQUAL_MEM(data, expected, size, "invalid streamed data (%s)", files[i][1]);
+	}
+}
+
+void test_dfs_asset_lzb(TestContext *ctx) {
+	asset_init_compression(3);
+
+	static const char *files[][2] = {
+		{ "rom:/random.dat", "rom:/random_lzb.dat" },
+		{ "rom:/counter.dat", "rom:/counter_lzb.dat" },
+	};
+
+	for (int i=0;i<2;i++) {
+		int size, cmp_size;
+		uint8_t *expected = asset_load(files[i][0], &size);
+		DEFER(free(expected));
+
+		// Full decompression (in-place)
+		uint8_t *data = asset_load(files[i][1], &cmp_size);
+		DEFER(free(data));
+		ASSERT_EQUAL_SIGNED(cmp_size, size, "invalid size (%s)", files[i][1]);
+		ASSERT_EQUAL_MEM(data, expected, size, "invalid data (%s)", files[i][1]);
+
+		// Streaming decompression
+		FILE *f = asset_fopen(files[i][1], NULL);
+		DEFER(fclose(f));
+		memset(data, 0, size);
+		ASSERT_EQUAL_SIGNED(fread(data, 1, size, f), size, "short read (%s)", files[i][1]);
+		ASSERT_EQUAL_MEM(data, expected, size, "invalid streamed data (%s)", files[i][1]);
+	}
+}
+
+void test_dfs_asset_prefetch(TestContext *ctx) {
+	DEFER(asset_prefetch_clear());
+
+	int size;
+	uint8_t *expected = asset_load("rom:/random.dat", &size);
+	DEFER(free(expected));
+
+	// Prefetch both an uncompressed and a compressed file
+	ASSERT(asset_prefetch("rom:/random.dat", DMA_PRIORITY_LOW), "prefetch failed");
+	ASSERT(asset_prefetch("rom:/random4x.dat", DMA_PRIORITY_LOW), "prefetch of compressed file failed");
+	ASSERT(!asset_prefetch("rom:/missing.dat", DMA_PRIORITY_LOW), "prefetch of missing file succeeded");
+
+	int raw_size, cmp_size;
+	uint8_t *raw = asset_load("rom:/random.dat", &raw_size);
+	DEFER(free(raw));
+	ASSERT_EQUAL_SIGNED(raw_size, size, "invalid size");
+	ASSERT_EQUAL_MEM(raw, expected, size, "invalid data");
+
+	uint8_t *data = asset_load("rom:/random4x.dat", &cmp_size);
+	DEFER(free(data));
+	ASSERT_EQUAL_SIGNED(cmp_size, size*4, "invalid size (compressed)");
+	for (int i=0;i<4;i++)
+		ASSERT_EQUAL_MEM(data + i*size, expected, size, "invalid data at copy %d (compressed)", i);
+
+	// Files that do not fit in the cache are not prefetched
+	asset_prefetch_set_cache_size(size / 2);
+	DEFER(asset_prefetch_set_cache_size(ASSET_PREFETCH_CACHE_SIZE));
+	ASSERT(!asset_prefetch("rom:/random.dat", DMA_PRIORITY_LOW), "prefetch bigger than the cache succeeded");
+
+	// The oldest prefetched files are evicted to make room
+	asset_prefetch_set_cache_size(size + 16);
+	ASSERT(asset_prefetch("rom:/counter.dat", DMA_PRIORITY_LOW), "prefetch failed");
+	wait_ms(10);  // only finished transfers can be evicted
+	ASSERT(asset_prefetch("rom:/random.dat", DMA_PRIORITY_LOW), "prefetch with eviction failed");
+	free(raw);
+	raw = asset_load("rom:/random.dat", NULL);
+	ASSERT_EQUAL_MEM(raw, expected, size, "invalid data after eviction");
+}
@@ -27,3 +27,62 @@ void test_dma_read_misalign(TestContext *ctx) {
 		}
 	}
 }
+
+static volatile int test_dma_queue_order[4];
+static volatile int test_dma_queue_done;
+
+static void test_dma_queue_cb(void *ctx) {
+	test_dma_queue_order[test_dma_queue_done++] = (int)ctx;
+}
+
+void test_dma_queue(TestContext *ctx) {
+	uint32_t rom = dfs_rom_addr("counter.dat");
+	uint8_t rom_copy[4096] __attribute__((aligned(16)));
+	static uint8_t ram[4][1024] __attribute__((aligned(16)));
+
+	data_cache_hit_writeback_invalidate(rom_copy, sizeof(rom_copy));
+	dma_read(rom_copy, rom, sizeof(rom_copy));
+	data_cache_hit_writeback_invalidate(ram, sizeof(ram));
+	test_dma_queue_done = 0;
+
+	// The first request is started immediately. The others are queued and
+	// serviced in priority order, FIFO within the same priority.
+	disable_interrupts();
+	dma_read_queue(ram[0], rom, 1024, DMA_PRIORITY_LOW, test_dma_queue_cb, (void*)0);
+	dma_read_queue(ram[1], rom+1024, 1024, DMA_PRIORITY_LOW, test_dma_queue_cb, (void*)1);
+	dma_read_queue(ram[2], rom+2048, 1024, DMA_PRIORITY_NORMAL, test_dma_queue_cb, (void*)2);
+	dma_read_queue(ram[3], rom+3072, 1024, DMA_PRIORITY_HIGH, test_dma_queue_cb, (void*)3);
+	ASSERT_EQUAL_SIGNED(dma_queue_pending(), 4, "invalid number of pending requests");
+	enable_interrupts();
+
+	dma_queue_wait();
+	ASSERT_EQUAL_SIGNED(test_dma_queue_done, 4, "callbacks not invoked");
+	ASSERT_EQUAL_SIGNED(test_dma_queue_order[0], 0, "invalid completion order");
+	ASSERT_EQUAL_SIGNED(test_dma_queue_order[1], 3, "invalid completion order");
+	ASSERT_EQUAL_SIGNED(test_dma_queue_order[2], 2, "invalid completion order");
+	ASSERT_EQUAL_SIGNED(test_dma_queue_order[3], 1, "invalid completion order");
+
+	for (int i=0;i<4;i++)
+		ASSERT_EQUAL_MEM(ram[i], rom_copy+i*1024, 1024, "invalid data in request %d", i);
+}
+
+void test_dma_speed_profile(TestContext *ctx) {
+	uint32_t rom = dfs_rom_addr("random.dat");
+	dma_speed_profile_t cur = dma_get_speed_profile();
+	DEFER(dma_set_speed_profile(cur));
+
+	dma_set_speed_profile(DMA_SPEED_PROFILE_FAST);
+	dma_speed_profile_t p = dma_get_speed_profile();
+	ASSERT_EQUAL_HEX(p.latency, DMA_SPEED_PROFILE_FAST.latency, "latency not set");
+	ASSERT_EQUAL_HEX(p.pulse_width, DMA_SPEED_PROFILE_FAST.pulse_width, "pulse width not set");
+	ASSERT_EQUAL_HEX(p.page_size, DMA_SPEED_PROFILE_FAST.page_size, "page size not set");
+	ASSERT_EQUAL_HEX(p.release, DMA_SPEED_PROFILE_FAST.release, "release not set");
+	dma_set_speed_profile(cur);
+
+	// The timings set by the IPL always work, and the test restores them
+	int kbps = dma_speed_test(cur, rom, 8192);
+	ASSERT(kbps > 0, "speed test failed with the current timings");
+	p = dma_get_speed_profile();
+	ASSERT_EQUAL_HEX(p.pulse_width, cur.pulse_width, "timings not restored");
+	ASSERT_EQUAL_HEX(p.release, cur.release, "timings not restored");
+}
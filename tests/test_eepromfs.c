@@ -99,3 +99,57 @@ void test_eepromfs(TestContext *ctx) {
     eepfs_wipe();
     ASSERT(eepfs_verify_signature() == true, "expected valid eepfs signature"); 
 }
+
+void test_eepromfs_deferred(TestContext *ctx) {
+    // Skip these tests if no EEPROM is present
+    if (eeprom_total_blocks() == 0) {
+        SKIP("EEPROM not found; skipping eepfs tests");
+    }
+
+    uint8_t file1_src[64] = {0};
+    uint8_t file1_dst[64] = {0};
+
+    const eepfs_entry_t eeprom_files[] = {
+        { "/file1", sizeof(file1_src) },
+    };
+
+    int result = eepfs_init(eeprom_files, 1);
+    ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs init failed");
+    DEFER(eepfs_close());
+    eepfs_wipe();
+
+    eepfs_set_deferred(true);
+    DEFER(eepfs_set_deferred(false));
+
+    // Rewriting the same contents does not dirty anything
+    result = eepfs_write("file1", file1_src, sizeof(file1_src));
+    ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs write failed");
+    ASSERT(!eepfs_flush_pending(), "unchanged write should not be pending");
+
+    // A deferred write is visible through eepfs, but not yet in EEPROM
+    file1_src[3] = 0x12;
+    file1_src[17] = 0x34;
+    eepfs_write("file1", file1_src, sizeof(file1_src));
+    ASSERT(eepfs_flush_pending(), "write should be pending");
+    eepfs_read("file1", file1_dst, sizeof(file1_dst));
+    ASSERT_EQUAL_MEM(file1_dst, file1_src, sizeof(file1_src), "eepfs read does not match the deferred write");
+    eeprom_read_bytes(file1_dst, EEPROM_BLOCK_SIZE, sizeof(file1_dst));
+    ASSERT(file1_dst[3] == 0 && file1_dst[17] == 0, "deferred write reached EEPROM");
+
+    // Only the two changed blocks are written
+    result = eepfs_flush();
+    ASSERT_EQUAL_SIGNED(result, 2, "wrong number of blocks flushed");
+    eeprom_read_bytes(file1_dst, EEPROM_BLOCK_SIZE, sizeof(file1_dst));
+    ASSERT_EQUAL_MEM(file1_dst, file1_src, sizeof(file1_src), "EEPROM does not match after flush");
+
+    // Background flush
+    file1_src[63] = 0x56;
+    eepfs_write("file1", file1_src, sizeof(file1_src));
+    eepfs_flush_async();
+    uint32_t t0 = TICKS_READ();
+    while (eepfs_flush_pending()) {
+        ASSERT(TICKS_SINCE(t0) < TICKS_PER_SECOND, "background flush timed out");
+    }
+    eeprom_read_bytes(file1_dst, EEPROM_BLOCK_SIZE, sizeof(file1_dst));
+    ASSERT_EQUAL_MEM(file1_dst, file1_src, sizeof(file1_src), "EEPROM does not match after background flush");
+}
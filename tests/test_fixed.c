@@ -0,0 +1,21 @@
+void test_fixed(TestContext *ctx) {
+	// Constants are folded, and conversions round as documented
+	ASSERT_EQUAL_SIGNED(FX16(1.5), 0x18000, "wrong 16.16 constant");
+	ASSERT_EQUAL_SIGNED(FX16(-0.25), -0x4000, "wrong negative 16.16 constant");
+	ASSERT_EQUAL_SIGNED(fx16_from_int(-3), -3 * FX16_ONE, "wrong conversion from int");
+	ASSERT_EQUAL_SIGNED(fx16_to_int(FX16(-1.5)), -2, "fx16_to_int does not round down");
+	ASSERT_EQUAL_SIGNED(fx16_round(FX16(2.5)), 3, "fx16_round does not round to nearest");
+
+	ASSERT_EQUAL_SIGNED(fx16_mul(FX16(1.5), FX16(-0.75)), FX16(-1.125), "wrong 16.16 product");
+	ASSERT_EQUAL_SIGNED(fx16_mul(FX16(300), FX16(100)), FX16(30000), "16.16 product overflowed");
+	ASSERT_EQUAL_SIGNED(fx16_div(FX16(3), FX16(-2)), FX16(-1.5), "wrong 16.16 quotient");
+	ASSERT(fx16_to_float(FX16(0.375)) == 0.375f, "wrong conversion to float");
+
+	// 32.32 products are computed by halves: check all sign combinations
+	fx32_t a = FX32(44100.25), b = FX32(-0.5);
+	ASSERT(fx32_mul(a, b) == FX32(-22050.125), "wrong 32.32 product");
+	ASSERT(fx32_mul(b, b) == FX32(0.25), "wrong 32.32 product of negatives");
+	ASSERT(fx32_mul(a, FX32_ONE) == a, "32.32 product by one is not exact");
+	ASSERT(fx32_from_fx16(FX16(-1.5)) == FX32(-1.5), "wrong conversion from 16.16");
+	ASSERT_EQUAL_SIGNED(fx32_to_fx16(FX32(-1.5)), FX16(-1.5), "wrong conversion to 16.16");
+}
@@ -0,0 +1,70 @@
+
+void test_graphics_draw_box(TestContext *ctx) {
+	for (int bpp=2; bpp<=4; bpp+=2) {
+		const int W = 32, H = 8;
+		surface_t surf = surface_alloc(bpp == 2 ? FMT_RGBA16 : FMT_RGBA32, W, H);
+		DEFER(surface_free(&surf));
+		memset(surf.buffer, 0, H * surf.stride);
+
+		// Test all alignments of the span start and length, with clipping
+		// on the left and right edges.
+		for (int x=-3; x<W; x++) {
+			for (int w=1; w<12; w++) {
+				uint32_t color = bpp == 2 ? 0x12341234 : 0x12345678;
+				graphics_draw_box(&surf, x, 2, w, 3, color);
+
+				for (int j=0; j<H; j++) {
+					for (int i=0; i<W; i++) {
+						bool inside = i >= x && i < x+w && j >= 2 && j < 5;
+						uint32_t exp = inside ? (bpp == 2 ? 0x1234 : 0x12345678) : 0;
+						uint32_t pix = bpp == 2 ? ((uint16_t*)surf.buffer)[j*W+i] : ((uint32_t*)surf.buffer)[j*W+i];
+						ASSERT_EQUAL_HEX(pix, exp, "wrong pixel at (%d,%d) (bpp:%d x:%d w:%d)", i, j, bpp, x, w);
+					}
+				}
+
+				graphics_draw_box(&surf, x, 2, w, 3, 0);
+			}
+		}
+	}
+}
+
+void test_graphics_draw_sprite_trans(TestContext *ctx) {
+	const int W = 8, H = 4;
+	sprite_t *spr = malloc(sizeof(sprite_t) + W * H * 4);
+	DEFER(free(spr));
+	memset(spr, 0, sizeof(sprite_t));
+	spr->width = W; spr->height = H;
+	spr->flags = FMT_RGBA32;
+	spr->hslices = 1; spr->vslices = 1;
+	for (int i=0; i<W*H; i++)
+		spr->data[i] = 0x80402000 | (i & 1 ? 0x00 : 0x80);
+
+	surface_t surf = surface_alloc(FMT_RGBA32, 16, 8);
+	DEFER(surface_free(&surf));
+	DEFER(graphics_set_blend_mode(GRAPHICS_BLEND_AUTO));
+
+	for (int mode=GRAPHICS_BLEND_AUTO; mode<=GRAPHICS_BLEND_ALPHA_BLEND; mode++) {
+		for (int i=0; i<16*8; i++) ((uint32_t*)surf.buffer)[i] = 0x204060FF;
+		graphics_set_blend_mode(mode);
+		graphics_draw_sprite_trans(&surf, -2, 1, spr);
+
+		for (int j=0; j<8; j++) {
+			for (int i=0; i<16; i++) {
+				uint32_t exp = 0x204060FF;
+				if (i < W-2 && j >= 1 && j < H+1) {
+					uint32_t src = spr->data[(j-1)*W + i+2];
+					uint32_t a = src & 0xFF;
+					switch (mode) {
+					case GRAPHICS_BLEND_OPAQUE: exp = src; break;
+					case GRAPHICS_BLEND_ALPHA_TEST: if (a) exp = src; break;
+					default:
+						exp = (((0x20*(255-a) + 0x80*a) >> 8) << 24) | (((0x40*(255-a) + 0x40*a) >> 8) << 16) |
+							(((0x60*(255-a) + 0x20*a) >> 8) << 8) | 0xFF;
+						break;
+					}
+				}
+				ASSERT_EQUAL_HEX(((uint32_t*)surf.buffer)[j*16+i], exp, "wrong pixel at (%d,%d) (mode:%d)", i, j, mode);
+			}
+		}
+	}
+}
@@ -0,0 +1,68 @@
+
+static __attribute__((noinline)) void* heapt_alloc(int size) {
+	// Touch the block, so that malloc is not a tail call
+	volatile char *ptr = malloc(size);
+	ptr[0] = 0;
+	return (void*)ptr;
+}
+
+void test_heap_profile_sites(TestContext *ctx) {
+	heap_profile_init(1, 64, 16);
+	DEFER(heap_profile_close());
+
+	void *ptrs[4];
+	for (int i=0; i<4; i++)
+		ptrs[i] = heapt_alloc(100);
+
+	heap_profile_stats_t stats;
+	heap_profile_get_stats(&stats);
+	ASSERT_EQUAL_UNSIGNED(stats.live_bytes, 400, "invalid live bytes");
+	ASSERT_EQUAL_UNSIGNED(stats.live_blocks, 4, "invalid live blocks");
+
+	heap_profile_site_t sites[4];
+	int n = heap_profile_get_sites(sites, 4);
+	ASSERT(n >= 1, "no call sites found");
+	ASSERT_EQUAL_UNSIGNED(sites[0].live_bytes, 400, "invalid live bytes of the call site");
+	ASSERT_EQUAL_UNSIGNED(sites[0].allocs, 4, "invalid allocations of the call site");
+	ASSERT_EQUAL_UNSIGNED(sites[0].depth, 1, "invalid depth of the call site");
+	uint32_t site = (uint32_t)sites[0].callstack[0];
+	ASSERT(site >= (uint32_t)heapt_alloc && site < (uint32_t)heapt_alloc + 0x100,
+		"call site %08lx is not within heapt_alloc (%p)", site, heapt_alloc);
+
+	free(ptrs[0]);
+	free(ptrs[1]);
+	ptrs[2] = realloc(ptrs[2], 300);
+	heap_profile_get_stats(&stats);
+	ASSERT_EQUAL_UNSIGNED(stats.live_bytes, 400, "invalid live bytes after free/realloc");
+	ASSERT_EQUAL_UNSIGNED(stats.live_blocks, 2, "invalid live blocks after free/realloc");
+	ASSERT_EQUAL_UNSIGNED(stats.peak_bytes, 400, "invalid peak bytes");
+
+	free(ptrs[2]);
+	free(ptrs[3]);
+	heap_profile_get_stats(&stats);
+	ASSERT_EQUAL_UNSIGNED(stats.live_bytes, 0, "invalid live bytes after freeing everything");
+	ASSERT_EQUAL_UNSIGNED(stats.live_blocks, 0, "invalid live blocks after freeing everything");
+	ASSERT_EQUAL_UNSIGNED(stats.dropped, 0, "allocations dropped too early");
+}
+
+void test_heap_profile_full(TestContext *ctx) {
+	heap_profile_init(1, 2, 16);
+	DEFER(heap_profile_close());
+
+	// Only two blocks can be tracked: the third one is dropped
+	void *ptrs[3];
+	for (int i=0; i<3; i++)
+		ptrs[i] = heapt_alloc(16);
+
+	heap_profile_stats_t stats;
+	heap_profile_get_stats(&stats);
+	ASSERT_EQUAL_UNSIGNED(stats.live_blocks, 2, "invalid live blocks");
+	ASSERT_EQUAL_UNSIGNED(stats.dropped, 1, "invalid number of dropped allocations");
+
+	// Freeing an untracked block is harmless
+	for (int i=2; i>=0; i--)
+		free(ptrs[i]);
+	heap_profile_get_stats(&stats);
+	ASSERT_EQUAL_UNSIGNED(stats.live_bytes, 0, "invalid live bytes after freeing everything");
+	ASSERT_EQUAL_UNSIGNED(stats.live_blocks, 0, "invalid live blocks after freeing everything");
+}
@@ -0,0 +1,38 @@
+static int idle_calls;
+static uint32_t idle_max_budget;
+
+static void idle_counter(void *ctx, uint32_t budget) {
+	idle_calls++;
+	if (budget > idle_max_budget) idle_max_budget = budget;
+	// Waits done by the task must not run the idle tasks again
+	wait_ticks(10);
+	*(int*)ctx += 1;
+}
+
+void test_idle(TestContext *ctx) {
+	int runs = 0;
+	idle_register(idle_counter, &runs);
+	DEFER(idle_unregister(idle_counter, &runs));
+
+	idle_calls = 0; idle_max_budget = 0;
+	wait_ms(2);
+	ASSERT(idle_calls > 0, "idle task not run by wait_ms");
+	ASSERT(idle_max_budget <= TICKS_FROM_MS(2), "budget larger than the wait: %lu", idle_max_budget);
+	ASSERT_EQUAL_SIGNED(runs, idle_calls, "idle task run recursively");
+
+	// No idle tasks with interrupts disabled
+	idle_calls = 0;
+	disable_interrupts();
+	wait_ms(1);
+	enable_interrupts();
+	ASSERT_EQUAL_SIGNED(idle_calls, 0, "idle task run with interrupts disabled");
+
+	// A zero budget runs nothing
+	idle_run(0);
+	ASSERT_EQUAL_SIGNED(idle_calls, 0, "idle task run without budget");
+
+	idle_unregister(idle_counter, &runs);
+	idle_calls = 0;
+	wait_ms(1);
+	ASSERT_EQUAL_SIGNED(idle_calls, 0, "idle task run after unregister");
+}
@@ -43,3 +43,32 @@ void test_irq_reentrancy(TestContext *ctx) {
 	ASSERT(!fail_order, "invalid order of call of callbacks");
 	ASSERT(!fail_reentrant, "interrupt called while another interrupt was in progress");
 }
+
+void test_irq_handler_stats(TestContext *ctx) {
+	static volatile int calls = 0;
+	void handler(void) {
+		calls++;
+		wait_ticks(100);
+	}
+	void cb(int ovfl) {}
+
+	timer_init();
+	DEFER(timer_close());
+	register_TI_handler(handler);
+	DEFER(unregister_TI_handler(handler));
+	interrupt_reset_handler_stats();
+
+	timer_link_t *t = new_timer(TICKS_FROM_MS(1), TF_ONE_SHOT, cb);
+	DEFER(delete_timer(t));
+	wait_ms(3);
+
+	interrupt_handler_stats_t stats[8];
+	int n = interrupt_get_handler_stats(INTERRUPT_TI, stats, 8);
+
+	// The handler was registered after the timer module, so it is called first
+	ASSERT(n >= 2, "invalid number of TI handlers: %d", n);
+	ASSERT(stats[0].callback == handler, "invalid first TI handler");
+	ASSERT(calls > 0, "TI handler was never called");
+	ASSERT_EQUAL_SIGNED(stats[0].count, calls, "invalid call count for TI handler");
+	ASSERT(stats[0].ticks >= 100 * calls, "invalid ticks accounted for TI handler: %lld", stats[0].ticks);
+}
@@ -0,0 +1,62 @@
+
+void test_kernel_threads(TestContext *ctx) {
+	if (!kernel_active())
+		kernel_init();
+
+	volatile int order[8];
+	volatile int num = 0;
+
+	int thread(void *arg) {
+		for (int i=0; i<3; i++) {
+			order[num++] = (int)arg;
+			kthread_yield();
+		}
+		return (int)arg * 10;
+	}
+
+	kthread_t *t1 = kthread_new("t1", 4096, thread, (void*)1);
+	kthread_t *t2 = kthread_new("t2", 4096, thread, (void*)2);
+	ASSERT_EQUAL_SIGNED(kthread_join(t1), 10, "invalid result of thread t1");
+	ASSERT_EQUAL_SIGNED(kthread_join(t2), 20, "invalid result of thread t2");
+
+	// The threads must have alternated at each yield
+	const int expected[] = { 1, 2, 1, 2, 1, 2 };
+	ASSERT_EQUAL_SIGNED(num, 6, "invalid number of thread iterations");
+	for (int i=0; i<6; i++)
+		ASSERT_EQUAL_SIGNED(order[i], expected[i], "invalid thread order at %d", i);
+}
+
+void test_kernel_waitq(TestContext *ctx) {
+	if (!kernel_active())
+		kernel_init();
+	timer_init();
+	DEFER(timer_close());
+
+	static kwaitq_t q;
+	volatile bool done = false;
+
+	void cb(int ovfl) {
+		done = true;
+		kwaitq_wake_all(&q);
+	}
+
+	int worker(void *arg) {
+		int n = 0;
+		while (!done) {
+			n++;
+			kthread_yield();
+		}
+		return n;
+	}
+
+	timer_link_t t;
+	kthread_t *w = kthread_new("worker", 4096, worker, NULL);
+	start_timer(&t, TIMER_TICKS(2000), TF_ONE_SHOT, cb);
+
+	// Block until the timer fires: meanwhile, the worker thread must run
+	KWAITQ_WAIT_UNTIL(&q, done);
+	ASSERT(done, "main thread woken before the timer fired");
+
+	int n = kthread_join(w);
+	ASSERT(n > 0, "worker thread did not run while the main thread was blocked");
+}
@@ -0,0 +1,25 @@
+
+int ovltest1_step(int x);
+const char *ovltest2_message(void);
+
+void test_overlay(TestContext *ctx) {
+	overlay_load(ovltest1);
+	ASSERT(overlay_is_loaded(ovltest1), "overlay 1 not loaded");
+	ASSERT(!overlay_is_loaded(ovltest2), "overlay 2 loaded");
+	ASSERT_EQUAL_SIGNED(ovltest1_step(1), 101, "wrong result from overlay 1");
+	ASSERT_EQUAL_SIGNED(ovltest1_step(2), 103, "wrong result from overlay 1");
+
+	// Loading an overlay again is a no-op: the data is preserved
+	overlay_load(ovltest1);
+	ASSERT_EQUAL_SIGNED(ovltest1_step(1), 104, "overlay 1 reloaded");
+
+	// Overlays share the same memory: code and rodata are replaced
+	overlay_load(ovltest2);
+	ASSERT(!overlay_is_loaded(ovltest1), "overlay 1 still loaded");
+	ASSERT((void*)ovltest2_message == (void*)ovltest1_step, "overlays do not share the same address");
+	ASSERT(strcmp(ovltest2_message(), "overlay 2") == 0, "wrong result from overlay 2");
+
+	// Reloading an overlay resets its data
+	overlay_load(ovltest1);
+	ASSERT_EQUAL_SIGNED(ovltest1_step(1), 101, "overlay 1 data not reset");
+}
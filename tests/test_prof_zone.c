@@ -0,0 +1,24 @@
+
+void test_prof_zone_buffer(TestContext *ctx) {
+	prof_zone_init(8);
+	DEFER(prof_zone_close());
+
+	prof_zone_stats_t stats;
+	prof_zone_begin("outer");
+	prof_zone_begin("inner");
+	prof_zone_mark(PROF_TRACK_RSP, "mark");
+	prof_zone_end();
+	prof_zone_end();
+	prof_zone_get_stats(&stats);
+	ASSERT_EQUAL_UNSIGNED(stats.events, 5, "invalid number of events");
+	ASSERT_EQUAL_UNSIGNED(stats.buffered, 5, "invalid number of buffered events");
+	ASSERT_EQUAL_UNSIGNED(stats.dropped, 0, "events dropped too early");
+
+	// The buffer holds 8 events: the ones after that are dropped
+	for (int i=0; i<5; i++)
+		prof_zone_frame();
+	prof_zone_get_stats(&stats);
+	ASSERT_EQUAL_UNSIGNED(stats.events, 8, "invalid number of events with a full buffer");
+	ASSERT_EQUAL_UNSIGNED(stats.buffered, 8, "invalid number of buffered events with a full buffer");
+	ASSERT_EQUAL_UNSIGNED(stats.dropped, 2, "invalid number of dropped events");
+}
@@ -0,0 +1,35 @@
+#include <rsp_profile.h>
+
+void test_rsp_profile(TestContext *ctx) {
+	TEST_RSPQ_PROLOG();
+	test_ovl_init();
+	DEFER(test_ovl_close());
+	timer_init();
+	DEFER(timer_close());
+
+	rsp_profile_start(20000, 4);
+	DEFER(rsp_profile_close());
+
+	// Keep the RSP busy in the 2-instruction loop of command_wait
+	rspq_test_wait(0x400000);
+	rspq_wait();
+	rsp_profile_stop();
+
+	rsp_profile_stats_t stats;
+	rsp_profile_get_stats(&stats);
+	ASSERT(stats.samples > 20, "too few samples: %lu", stats.samples);
+	ASSERT_EQUAL_UNSIGNED(stats.dropped, 0, "samples dropped");
+
+	static uint32_t counts[RSP_PROFILE_IMEM_SLOTS];
+	uint32_t samples = rsp_profile_get_histogram(&rsp_test, counts);
+	ASSERT(samples > stats.samples / 2, "samples not attributed to the overlay: %lu of %lu", samples, stats.samples);
+
+	// The hottest address and its neighbour must be the wait loop
+	int hot = 0;
+	for (int i = 1; i < RSP_PROFILE_IMEM_SLOTS; i++)
+		if (counts[i] > counts[hot]) hot = i;
+	uint32_t prev = hot > 0 ? counts[hot-1] : 0;
+	uint32_t next = hot < RSP_PROFILE_IMEM_SLOTS-1 ? counts[hot+1] : 0;
+	uint32_t loop = counts[hot] + (prev > next ? prev : next);
+	ASSERT(loop > samples * 9 / 10, "samples not in the wait loop: %lu of %lu", loop, samples);
+}
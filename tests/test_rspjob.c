@@ -0,0 +1,46 @@
+#include <rspjob.h>
+
+DEFINE_RSP_UCODE(rsp_test_job);
+
+void test_rspjob_parallel_for(TestContext *ctx) {
+	rspq_init();
+	DEFER(rspq_close());
+	uint32_t ovl_id = rspq_overlay_register(&rsp_test_job);
+	DEFER(rspq_overlay_unregister(ovl_id));
+
+	rspjob_kernel_t add;
+	rspjob_kernel_init(&add, ovl_id, 0, 8, 8);
+	ASSERT_EQUAL_UNSIGNED(add.tile, RSPJOB_TILE_SIZE / 8, "wrong tile size");
+
+	// A partial tile at the end
+	const int count = RSPJOB_TILE_SIZE / 8 * 15 + 40;
+	uint32_t *in = malloc_uncached(count * 8);
+	DEFER(free_uncached(in));
+	uint32_t *out = malloc_uncached(count * 16 + 16);
+	DEFER(free_uncached(out));
+	for (int i = 0; i < count * 2; i++) in[i] = i * 0x10001;
+	memset(out, 0xAA, count * 16 + 16);
+
+	rspjob_parallel_for(&add, in, out, count, 7);
+	rspq_wait();
+	for (int i = 0; i < count * 2; i++)
+		ASSERT_EQUAL_HEX(out[i], i * 0x10001 + 7, "wrong output at word %d", i);
+	ASSERT_EQUAL_HEX(out[count * 2], 0xAAAAAAAA, "data after the output overwritten");
+
+	// Different sizes for input and output, and a whole number of tiles
+	rspjob_kernel_t expand;
+	rspjob_kernel_init(&expand, ovl_id, 1, 8, 16);
+	ASSERT_EQUAL_UNSIGNED(expand.tile, RSPJOB_TILE_SIZE / 16, "wrong tile size");
+	const int count2 = expand.tile * 3;
+	memset(out, 0xAA, count * 16 + 16);
+
+	rspjob_parallel_for(&expand, in, out, count2, 2);
+	rspq_wait();
+	for (int i = 0; i < count2; i++) {
+		for (int j = 0; j < 2; j++) {
+			ASSERT_EQUAL_HEX(out[i*4+j], in[i*2+j], "wrong copy at element %d", i);
+			ASSERT_EQUAL_HEX(out[i*4+2+j], in[i*2+j] << 2, "wrong result at element %d", i);
+		}
+	}
+	ASSERT_EQUAL_HEX(out[count2 * 4], 0xAAAAAAAA, "data after the output overwritten");
+}
@@ -0,0 +1,43 @@
+#include <rspmem.h>
+
+void test_rspmem_copy(TestContext *ctx) {
+	// Bigger than the DMEM buffers, and not a multiple of their size
+	const int size = 5000 * 8;
+	uint8_t *src = malloc_uncached(size);
+	DEFER(free_uncached(src));
+	uint8_t *dst = memalign(16, size + 32);
+	DEFER(free(dst));
+
+	for (int i = 0; i < size; i++) src[i] = RANDN(256);
+	memset(dst, 0xAA, size + 32);
+
+	// Copy into a cached buffer: rspmem must take care of the cache
+	rspmem_copy(dst + 16, src, size);
+	rspq_syncpoint_wait(rspq_syncpoint_new());
+
+	ASSERT_EQUAL_MEM(dst + 16, src, size, "wrong data copied");
+	for (int i = 0; i < 16; i++) {
+		ASSERT_EQUAL_HEX(dst[i], 0xAA, "data before the destination overwritten at %d", i);
+		ASSERT_EQUAL_HEX(dst[size + 16 + i], 0xAA, "data after the destination overwritten at %d", i);
+	}
+}
+
+void test_rspmem_fill(TestContext *ctx) {
+	const int size = 1000 * 8;
+	uint32_t *dst = malloc_uncached(size + 16);
+	DEFER(free_uncached(dst));
+	memset(dst, 0xAA, size + 16);
+
+	rspmem_fill(dst, 0x5C, size);
+	rspq_wait();
+	for (int i = 0; i < size / 4; i++)
+		ASSERT_EQUAL_HEX(dst[i], 0x5C5C5C5C, "wrong fill at word %d", i);
+	for (int i = size / 4; i < size / 4 + 4; i++)
+		ASSERT_EQUAL_HEX(dst[i], 0xAAAAAAAA, "data after the destination overwritten at word %d", i);
+
+	rspmem_fill32(dst + 2, 0x12345678, size - 8);
+	rspq_wait();
+	ASSERT_EQUAL_HEX(dst[1], 0x5C5C5C5C, "data before the destination overwritten");
+	for (int i = 2; i < size / 4; i++)
+		ASSERT_EQUAL_HEX(dst[i], 0x12345678, "wrong fill at word %d", i);
+}
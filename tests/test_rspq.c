@@ -366,6 +366,51 @@ void test_rspq_switch_overlay(TestContext *ctx)
     ASSERT_EQUAL_MEM(test2_state, (uint8_t*)expected_state, sizeof(expected_state), "State was not saved!");
 }
 
+void test_rspq_overlay_reload(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    // Make a copy of the ucode in RAM, as if it was received via USB
+    int code_size = (uint8_t*)rsp_test2.code_end - rsp_test2.code;
+    int data_size = (uint8_t*)rsp_test2.data_end - rsp_test2.data;
+    uint8_t *code = memalign(16, code_size);
+    DEFER(free(code));
+    uint8_t *data = memalign(16, data_size);
+    DEFER(free(data));
+    memcpy(code, rsp_test2.code, code_size);
+    memcpy(data, rsp_test2.data, data_size);
+
+    rsp_ucode_t reloaded = rsp_test2;
+    reloaded.code = code;
+    reloaded.code_end = code + code_size;
+    reloaded.data = data;
+    reloaded.data_end = data + data_size;
+
+    // Reload while the overlay is loaded: the state in DMEM must be kept
+    rspq_test2(0x123456, 0x87654321);
+    rspq_overlay_reload(test2_ovl_id, &reloaded);
+    DEFER(rspq_overlay_reload(test2_ovl_id, &rsp_test2));
+
+    uint32_t expected_state[] = {
+        test2_ovl_id | 0x123456,
+        0x87654321
+    };
+    uint8_t *test2_state = UncachedAddr(rspq_overlay_get_state(&reloaded));
+    ASSERT_EQUAL_MEM(test2_state, (uint8_t*)expected_state, sizeof(expected_state), "State was not carried over!");
+
+    // The new ucode is used by the following commands, with the same ID
+    rspq_test2(0x654321, 0x12345678);
+    rspq_test_16(0);
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+
+    expected_state[0] = test2_ovl_id | 0x654321;
+    expected_state[1] = 0x12345678;
+    ASSERT_EQUAL_MEM(test2_state, (uint8_t*)expected_state, sizeof(expected_state), "State was not saved into the new ucode!");
+}
+
 void test_rspq_multiple_flush(TestContext *ctx)
 {
     TEST_RSPQ_PROLOG();
@@ -508,6 +553,120 @@ void test_rspq_block(TestContext *ctx)
     TEST_RSPQ_EPILOG(0, rspq_timeout);
 }
 
+void test_rspq_block_arena(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    rspq_block_arena_t *arena = rspq_block_arena_new(0);
+    DEFER(rspq_block_arena_free(arena));
+
+    uint64_t actual_sum[2] __attribute__((aligned(16))) = {0};
+    data_cache_hit_writeback_invalidate(actual_sum, 16);
+
+    for (int round = 0; round < 3; round++)
+    {
+        rspq_block_begin_arena(arena);
+        rspq_test_8(1);
+        rspq_block_t *b1 = rspq_block_end();
+
+        rspq_block_begin_arena(arena);
+        for (uint32_t i = 0; i < 512; i++)
+            rspq_test_8(1);
+        rspq_block_t *b512 = rspq_block_end();
+
+        rspq_block_stats_t stats;
+        rspq_block_get_stats(b1, &stats);
+        ASSERT_EQUAL_SIGNED(stats.chunks, 1, "wrong number of chunks");
+        ASSERT_EQUAL_SIGNED(stats.bytes_used, 3*4, "wrong number of used bytes");
+        ASSERT_EQUAL_SIGNED(stats.bytes_wasted, (RSPQ_BLOCK_MIN_SIZE-3)*4, "wrong number of wasted bytes");
+
+        rspq_block_get_stats(b512, &stats);
+        ASSERT(stats.chunks > 1, "big block should have multiple chunks");
+        ASSERT(stats.bytes_used >= 512*8, "wrong number of used bytes: %d", stats.bytes_used);
+
+        rspq_test_reset();
+        rspq_block_run(b1);
+        rspq_block_run(b512);
+        rspq_test_output(actual_sum);
+        rspq_wait();
+        ASSERT_EQUAL_UNSIGNED(*actual_sum, 513, "sum is not correct (round %d)", round);
+        data_cache_hit_invalidate(actual_sum, 16);
+
+        rspq_block_arena_reset(arena);
+    }
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
+
+void test_rspq_block_patch(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    rspq_block_begin();
+    for (uint32_t i = 0; i < 100; i++)
+        rspq_test_8(1);
+    rspq_block_param_t p = rspq_block_param();
+    rspq_test_8(1);
+    rspq_block_t *b = rspq_block_end();
+    DEFER(rspq_block_free(b));
+
+    uint64_t actual_sum[2] __attribute__((aligned(16))) = {0};
+    data_cache_hit_writeback_invalidate(actual_sum, 16);
+
+    rspq_test_reset();
+    rspq_block_run(b);
+    rspq_test_output(actual_sum);
+    rspq_wait();
+    ASSERT_EQUAL_UNSIGNED(*actual_sum, 101, "sum #1 is not correct");
+    data_cache_hit_invalidate(actual_sum, 16);
+
+    rspq_block_patch(p, 0, 0xFF000010);
+
+    rspq_test_reset();
+    rspq_block_run(b);
+    rspq_test_output(actual_sum);
+    rspq_wait();
+    ASSERT_EQUAL_UNSIGNED(*actual_sum, 116, "sum #2 is not correct");
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
+
+void test_rspq_syncpoint_callback(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    volatile int cb_called = 0;
+    void * volatile cb_arg = NULL;
+    void cb(void *arg) {
+        cb_arg = arg;
+        cb_called++;
+    }
+
+    rspq_test_wait(0x8000);
+    rspq_syncpoint_t sync_id = rspq_syncpoint_new();
+    rspq_syncpoint_on_done(sync_id, cb, (void*)0x1234);
+
+    RSP_WAIT_LOOP(200) {
+        if (cb_called)
+            break;
+    }
+    ASSERT(rspq_syncpoint_check(sync_id), "syncpoint not reached");
+    ASSERT_EQUAL_SIGNED(cb_called, 1, "callback not called");
+    ASSERT(cb_arg == (void*)0x1234, "wrong callback context");
+
+    // A syncpoint already reached calls the callback immediately
+    rspq_syncpoint_on_done(sync_id, cb, (void*)0x1234);
+    ASSERT_EQUAL_SIGNED(cb_called, 2, "callback not called immediately");
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
+
 void test_rspq_wait_sync_in_block(TestContext *ctx)
 {
     TEST_RSPQ_PROLOG();
@@ -699,6 +858,115 @@ void test_rspq_highpri_overlay(TestContext *ctx)
     TEST_RSPQ_EPILOG(0, rspq_timeout);
 }
 
+void test_rspq_highpri_stats(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    rspq_highpri_reset_stats();
+
+    for (int i = 0; i < 4; i++)
+    {
+        rspq_test_wait(0x1000);
+        rspq_flush();
+
+        rspq_highpri_begin();
+            rspq_test_high(1);
+        rspq_highpri_end();
+        rspq_highpri_sync();
+        rspq_wait();
+    }
+
+    // Give the interrupt handler the time to run
+    wait_ms(1);
+
+    rspq_highpri_stats_t stats;
+    rspq_highpri_get_stats(&stats);
+    ASSERT_EQUAL_SIGNED(stats.count, 4, "wrong number of highpri sequences");
+    ASSERT(stats.yield_min <= stats.yield_avg && stats.yield_avg <= stats.yield_max, "invalid yield latency");
+    ASSERT(stats.done_min <= stats.done_avg && stats.done_avg <= stats.done_max, "invalid completion latency");
+    ASSERT(stats.yield_max <= stats.done_max, "yield latency bigger than completion latency");
+
+    rspq_highpri_reset_stats();
+    rspq_highpri_get_stats(&stats);
+    ASSERT_EQUAL_SIGNED(stats.count, 0, "statistics not reset");
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
+
+void test_rspq_dma_list(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    // Scratch area in DMEM. This falls within BIG_LOG of the test overlay,
+    // which is only used by rspq_test_high.
+    const uint32_t dmem = 0x800;
+
+    uint64_t src[6][2] __attribute__((aligned(16)));
+    uint64_t dst[6][2] __attribute__((aligned(16)));
+    for (int i = 0; i < 6; i++) {
+        src[i][0] = 0x0123456789ABCDEFull * (i+1);
+        src[i][1] = 0xFEDCBA9876543210ull * (i+1);
+    }
+    memset(dst, 0, sizeof(dst));
+    data_cache_hit_writeback_invalidate(dst, sizeof(dst));
+
+    // Gather: each buffer goes into DMEM in reverse order.
+    rspq_dma_desc_t gather[6] __attribute__((aligned(8)));
+    for (int i = 0; i < 6; i++)
+        gather[i] = rspq_dma_desc_to_dmem(dmem + (5-i)*16, src[i], 16);
+
+    // Scatter: copy back to RDRAM as is, so that dst is reversed
+    rspq_dma_desc_t scatter[6] __attribute__((aligned(8)));
+    for (int i = 0; i < 6; i++)
+        scatter[i] = rspq_dma_desc_to_rdram(dst[i], dmem + i*16, 16);
+
+    rspq_test_reset();
+    rspq_dma_list(gather, 6);
+    rspq_dma_list(scatter, 6);
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+
+    for (int i = 0; i < 6; i++)
+        ASSERT_EQUAL_MEM((uint8_t*)dst[i], (uint8_t*)src[5-i], 16, "buffer %d does not match", i);
+}
+
+uint32_t test_rspq_cpp_write_commands(uint32_t ovl_id, int count, const uint32_t *big_values);
+
+void test_rspq_cpp_write(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    uint32_t values[32];
+    for (uint32_t i = 0; i < 32; i++)
+        values[i] = RANDN(0xFFFFFFFF);
+
+    uint32_t big_before[32] __attribute__((aligned(16)));
+    uint32_t big_after[32] __attribute__((aligned(16)));
+    data_cache_hit_writeback_invalidate(big_before, 128);
+    data_cache_hit_writeback_invalidate(big_after, 128);
+    uint64_t actual_sum[2] __attribute__((aligned(16))) = {0};
+    data_cache_hit_writeback_invalidate(actual_sum, 16);
+
+    // Enough commands to switch buffer several times
+    rspq_test_big_out(big_before);
+    uint32_t expected_sum = test_rspq_cpp_write_commands(test_ovl_id, 1000, values);
+    rspq_test_output(actual_sum);
+    rspq_test_big_out(big_after);
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+
+    ASSERT_EQUAL_UNSIGNED(*actual_sum, expected_sum, "Possibly not all commands have been executed!");
+    for (int i = 0; i < 32; i++)
+        big_before[i] ^= values[i];
+    ASSERT_EQUAL_MEM((uint8_t*)big_after, (uint8_t*)big_before, 128, "Big command output does not match!");
+}
+
 void test_rspq_big_command(TestContext *ctx)
 {
     TEST_RSPQ_PROLOG();
@@ -744,3 +1012,177 @@ void test_rspq_big_command(TestContext *ctx)
     
     ASSERT_EQUAL_MEM((uint8_t*)output, (uint8_t*)expected, 128, "Output does not match!");
 }
+
+void test_rspq_isr_write(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+    timer_init();
+    DEFER(timer_close());
+
+    volatile int isr_count = 0;
+    void cb(int ovfl) {
+        if (isr_count < 20) {
+            uint32_t arg = 1;
+            if (rspq_isr_write(test_ovl_id, 0x0, &arg, 1))
+                isr_count++;
+        }
+    }
+
+    timer_link_t *t = new_timer(TICKS_FROM_MS(1), TF_CONTINUOUS, cb);
+    DEFER(delete_timer(t));
+
+    // Interleave writes from the main thread with writes from the timer
+    uint64_t expected_sum = 0;
+    while (isr_count < 20) {
+        rspq_test_4(1);
+        ++expected_sum;
+        rspq_flush();
+        wait_ms(1);
+    }
+    stop_timer(t);
+    expected_sum += isr_count;
+
+    uint64_t actual_sum[2] __attribute__((aligned(16))) = {0};
+    data_cache_hit_writeback_invalidate(actual_sum, 16);
+
+    rspq_test_output(actual_sum);
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+
+    ASSERT_EQUAL_UNSIGNED(*actual_sum, expected_sum, "Possibly not all commands have been executed!");
+}
+
+void test_rspq_overlay_stats(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    // Reset the counters
+    rspq_overlay_stats_next_frame();
+
+    for (uint32_t i = 0; i < 10; i++)
+    {
+        rspq_test_4(1);
+        rspq_test2(1, 2);
+        rspq_noop();
+    }
+
+    rspq_overlay_stats_next_frame();
+    rspq_wait();
+
+    rspq_overlay_stats_t stats;
+    rspq_overlay_get_stats(&stats);
+    ASSERT_EQUAL_UNSIGNED(stats.switches, 20, "wrong number of overlay switches");
+    ASSERT(stats.bytes > 0, "no bytes were transferred for overlay switches");
+
+    // Internal commands never trigger a switch
+    rspq_noop();
+    rspq_overlay_stats_next_frame();
+    rspq_wait();
+
+    rspq_overlay_get_stats(&stats);
+    ASSERT_EQUAL_UNSIGNED(stats.switches, 0, "internal commands caused an overlay switch");
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
+
+void test_rspq_profile(TestContext *ctx)
+{
+    if (!RSPQ_PROFILE)
+        SKIP("RSPQ_PROFILE is disabled");
+
+    TEST_RSPQ_PROLOG();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    rspq_profile_reset();
+    rspq_profile_start();
+
+    for (uint32_t i = 0; i < 100; i++)
+    {
+        rspq_test_4(1);
+        rspq_test_8(1);
+        rspq_test_wait(200);
+    }
+
+    rspq_profile_stop();
+
+    static rspq_profile_data_t data;
+    rspq_profile_get_data(&data);
+
+    uint32_t test_id = test_ovl_id >> 24;
+    ASSERT_EQUAL_UNSIGNED(data.commands[test_id | 0x0].calls, 100, "wrong number of calls to command 0x0");
+    ASSERT_EQUAL_UNSIGNED(data.commands[test_id | 0x1].calls, 100, "wrong number of calls to command 0x1");
+    ASSERT_EQUAL_UNSIGNED(data.commands[test_id | 0x3].calls, 100, "wrong number of calls to command 0x3");
+    ASSERT_EQUAL_UNSIGNED(data.dropped_samples, 0, "samples were dropped");
+    ASSERT_EQUAL_STR(data.commands[test_id | 0x3].overlay_name, rsp_test.name, "wrong overlay name");
+    ASSERT(data.commands[test_id | 0x3].total_cycles > data.commands[test_id | 0x0].total_cycles,
+        "wait command should take longer than a simple command");
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
+
+void test_rspq_capture(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    rspq_block_begin();
+    for (uint32_t i = 0; i < 100; i++)
+        rspq_test_8(1);
+    rspq_block_t *b100 = rspq_block_end();
+    DEFER(rspq_block_free(b100));
+
+    uint64_t actual_sum[2] __attribute__((aligned(16))) = {0};
+    data_cache_hit_writeback_invalidate(actual_sum, 16);
+
+    rspq_capture_t *cap = rspq_capture_start(16*1024);
+    DEFER(rspq_capture_free(cap));
+
+    // Frame 0: enough commands to switch buffers, and a syncpoint
+    rspq_test_reset();
+    for (uint32_t i = 0; i < 1000; i++)
+        rspq_test_8(1);
+    rspq_test_output(actual_sum);
+    rspq_wait();
+    rspq_capture_next_frame();
+
+    // Frame 1: a block
+    rspq_test_reset();
+    rspq_block_run(b100);
+    rspq_test_8(1);
+    rspq_test_output(actual_sum);
+    rspq_capture_next_frame();
+
+    // Not terminated by next_frame: dropped
+    rspq_test_8(1);
+    rspq_capture_stop();
+    rspq_wait();
+
+    ASSERT_EQUAL_SIGNED(rspq_capture_get_frame_count(cap), 2, "wrong number of frames");
+    ASSERT(!rspq_capture_is_truncated(cap), "capture should not be truncated");
+
+    for (int j = 0; j < 2; j++) {
+        *(volatile uint64_t*)UncachedAddr(actual_sum) = 0;
+        rspq_capture_replay(cap, 1);
+        data_cache_hit_invalidate(actual_sum, 16);
+        ASSERT_EQUAL_UNSIGNED(*actual_sum, 101, "sum of frame 1 is not correct");
+
+        *(volatile uint64_t*)UncachedAddr(actual_sum) = 0;
+        rspq_capture_replay(cap, 0);
+        data_cache_hit_invalidate(actual_sum, 16);
+        ASSERT_EQUAL_UNSIGNED(*actual_sum, 1000, "sum of frame 0 is not correct");
+    }
+
+    // Syncpoints created after the replay must be waited correctly
+    rspq_test_wait(0x8000);
+    rspq_syncpoint_t sp = rspq_syncpoint_new();
+    ASSERT(!rspq_syncpoint_check(sp), "syncpoint was reached too early");
+    rspq_syncpoint_wait(sp);
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
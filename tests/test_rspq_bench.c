@@ -0,0 +1,176 @@
+// Benchmarks of the rspq engine.
+//
+// These tests do not check for correctness (see test_rspq.c for that), but
+// measure the performance of the queue. Each result is reported via debugf
+// on a single line with the following machine-readable format:
+//
+//     BENCH:<name>:<value>:<unit>
+//
+// so that the results can be collected over USB and compared between
+// different versions of the library.
+
+/** @brief Report a benchmark result */
+#define BENCH_REPORT(name, value, unit) \
+    debugf("BENCH:%s:%lu:%s\n", (name), (unsigned long)(value), (unit))
+
+/** @brief Convert CPU ticks into RCP cycles (the RCP is clocked at 62.5 MHz) */
+#define BENCH_RCP_CYCLES(ticks)   ((uint32_t)((uint64_t)(ticks) * 62500000 / TICKS_PER_SECOND))
+
+/** @brief Measure the time (in ticks) taken by a full syncpoint round-trip on an idle queue */
+static uint32_t bench_rspq_wait_ticks(void)
+{
+    rspq_wait();
+    uint32_t t0 = TICKS_READ();
+    rspq_wait();
+    return TICKS_SINCE(t0);
+}
+
+/** @brief Measure the time (in ticks) taken by the RSP to run a block multiple times */
+static uint32_t bench_rspq_block_ticks(rspq_block_t *block, int runs)
+{
+    uint32_t overhead = bench_rspq_wait_ticks();
+
+    uint32_t t0 = TICKS_READ();
+    for (int i = 0; i < runs; i++)
+        rspq_block_run(block);
+    rspq_wait();
+    uint32_t ticks = TICKS_SINCE(t0);
+    return ticks > overhead ? ticks - overhead : 0;
+}
+
+void test_rspq_bench_throughput(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+
+    const int num_cmds = 1024, runs = 4;
+
+    rspq_block_begin();
+    for (int i = 0; i < num_cmds; i++)
+        rspq_noop();
+    rspq_block_t *b = rspq_block_end();
+    DEFER(rspq_block_free(b));
+
+    uint32_t ticks = bench_rspq_block_ticks(b, runs);
+    ASSERT(ticks > 0, "invalid measurement");
+
+    BENCH_REPORT("rspq.throughput", (uint64_t)num_cmds * runs * TICKS_PER_SECOND / ticks, "cmd/s");
+    BENCH_REPORT("rspq.noop", BENCH_RCP_CYCLES(ticks) / (num_cmds * runs), "cycles");
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
+
+void test_rspq_bench_payload(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    const int num_cmds = 256;
+
+    for (int size = 0; size < 4; size++)
+    {
+        rspq_block_begin();
+        for (int i = 0; i < num_cmds; i++) {
+            switch (size) {
+            case 0: rspq_test_4(1); break;
+            case 1: rspq_test_8(1); break;
+            case 2: rspq_test_16(1); break;
+            case 3: {
+                rspq_write_t w = rspq_write_begin(test_ovl_id, 0x8, 33);
+                for (int j = 0; j < 33; j++)
+                    rspq_write_arg(&w, 0);
+                rspq_write_end(&w);
+            }   break;
+            }
+        }
+        rspq_block_t *b = rspq_block_end();
+
+        uint32_t ticks = bench_rspq_block_ticks(b, 1);
+        rspq_block_free(b);
+
+        static const char *names[4] = {
+            "rspq.cmd.4B", "rspq.cmd.8B", "rspq.cmd.16B", "rspq.cmd.132B",
+        };
+        BENCH_REPORT(names[size], BENCH_RCP_CYCLES(ticks) / num_cmds, "cycles");
+    }
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
+
+void test_rspq_bench_block_nesting(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+
+    const int runs = 256;
+    rspq_block_t *blocks[RSPQ_MAX_BLOCK_NESTING_LEVEL];
+
+    // Block 0 contains a single command, while block N calls block N-1,
+    // so that running block N goes through N+1 nested calls.
+    for (int i = 0; i < RSPQ_MAX_BLOCK_NESTING_LEVEL; i++) {
+        rspq_block_begin();
+        if (i == 0) rspq_noop();
+        else        rspq_block_run(blocks[i-1]);
+        blocks[i] = rspq_block_end();
+    }
+
+    for (int i = 0; i < RSPQ_MAX_BLOCK_NESTING_LEVEL; i++) {
+        uint32_t ticks = bench_rspq_block_ticks(blocks[i], runs);
+
+        char name[32];
+        sprintf(name, "rspq.block.depth%d", i+1);
+        BENCH_REPORT(name, BENCH_RCP_CYCLES(ticks) / runs, "cycles");
+    }
+
+    for (int i = RSPQ_MAX_BLOCK_NESTING_LEVEL-1; i >= 0; i--)
+        rspq_block_free(blocks[i]);
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
+
+void test_rspq_bench_highpri(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+
+    const int runs = 64;
+
+    rspq_highpri_reset_stats();
+
+    uint32_t t0 = TICKS_READ();
+    for (int i = 0; i < runs; i++) {
+        rspq_highpri_begin();
+        rspq_noop();
+        rspq_highpri_end();
+        rspq_highpri_sync();
+    }
+    uint32_t ticks = TICKS_SINCE(t0);
+
+    // Give the interrupt handler the time to record the last sequence
+    wait_ms(1);
+
+    rspq_highpri_stats_t stats;
+    rspq_highpri_get_stats(&stats);
+    ASSERT_EQUAL_SIGNED(stats.count, runs, "wrong number of highpri sequences");
+
+    BENCH_REPORT("rspq.highpri.roundtrip", BENCH_RCP_CYCLES(ticks) / runs, "cycles");
+    BENCH_REPORT("rspq.highpri.yield", BENCH_RCP_CYCLES(stats.yield_avg), "cycles");
+    BENCH_REPORT("rspq.highpri.done", BENCH_RCP_CYCLES(stats.done_avg), "cycles");
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
+
+void test_rspq_bench_syncpoint(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+
+    const int runs = 256;
+
+    rspq_wait();
+    uint32_t t0 = TICKS_READ();
+    for (int i = 0; i < runs; i++)
+        rspq_wait();
+    uint32_t ticks = TICKS_SINCE(t0);
+
+    BENCH_REPORT("rspq.syncpoint.roundtrip", BENCH_RCP_CYCLES(ticks) / runs, "cycles");
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
@@ -0,0 +1,32 @@
+#include <stdint.h>
+#include <rspqcpp.h>
+
+// Commands of rsp_test.S
+constexpr rspq::command<0x0, 4>   CMD_TEST_4;
+constexpr rspq::command<0x1, 8>   CMD_TEST_8;
+constexpr rspq::command<0x2, 16>  CMD_TEST_16;
+constexpr rspq::command<0x8, 132> CMD_BIG;
+
+template<size_t... I>
+static void write_big(uint32_t ovl_id, const uint32_t *values, std::index_sequence<I...>)
+{
+    CMD_BIG(ovl_id, 0u, values[I]...);
+}
+
+extern "C" {
+    // Called by test_rspq_cpp_write (test_rspq.c). Returns the sum that the
+    // test commands add to the test variable.
+    uint32_t test_rspq_cpp_write_commands(uint32_t ovl_id, int count, const uint32_t *big_values)
+    {
+        uint32_t sum = 0;
+        for (int i = 0; i < count; i++) {
+            CMD_TEST_4(ovl_id, i);
+            CMD_TEST_8(ovl_id, 2*i, 0xFFFFFFFFu);
+            CMD_TEST_16(ovl_id, 3*i, 1, 2, 3);
+            rspq::write<0x0>(ovl_id, 1);
+            sum += 6*i + 1;
+        }
+        write_big(ovl_id, big_values, std::make_index_sequence<32>{});
+        return sum;
+    }
+}
@@ -0,0 +1,133 @@
+void test_surface_pool(TestContext *ctx) {
+	surface_pool_t *pool = surface_pool_new();
+	DEFER(surface_pool_free(pool));
+
+	surface_t s1 = surface_pool_alloc(pool, FMT_RGBA16, 64, 32);
+	surface_t s2 = surface_pool_alloc(pool, FMT_RGBA16, 64, 32);
+	ASSERT(s1.buffer != s2.buffer, "two live surfaces share the same buffer");
+	ASSERT_EQUAL_HEX((uint32_t)s1.buffer & 63, 0, "buffer is not 64-byte aligned");
+	ASSERT_EQUAL_HEX((uint32_t)s2.buffer & 63, 0, "buffer is not 64-byte aligned");
+	ASSERT_EQUAL_UNSIGNED(s1.stride, 128, "wrong stride");
+
+	// A released buffer is reused by the next allocation of the same size class
+	void *buf1 = s1.buffer;
+	surface_pool_release(pool, &s1);
+	ASSERT(s1.buffer == NULL, "released surface not cleared");
+	surface_t s3 = surface_pool_alloc(pool, FMT_I8, 100, 40);
+	ASSERT(s3.buffer == buf1, "released buffer not reused");
+
+	// After a reset, all buffers are available again
+	surface_pool_reset(pool);
+	surface_t s4 = surface_pool_alloc(pool, FMT_RGBA16, 64, 32);
+	surface_t s5 = surface_pool_alloc(pool, FMT_RGBA16, 64, 32);
+	ASSERT((s4.buffer == buf1 || s4.buffer == s2.buffer) && (s5.buffer == buf1 || s5.buffer == s2.buffer),
+		"buffers not reused after reset");
+
+	// A lent buffer is used for allocations that fit it
+	surface_t ext = surface_alloc(FMT_RGBA16, 64, 64);
+	DEFER(surface_free(&ext));
+	surface_pool_add_buffer(pool, &ext);
+	surface_t s6 = surface_pool_alloc(pool, FMT_RGBA32, 32, 64);
+	ASSERT(s6.buffer == ext.buffer, "lent buffer not used");
+}
+
+void test_surface_blit(TestContext *ctx) {
+	const int W = 13, H = 5;
+	uint16_t tlut[256];
+	for (int i=0; i<256; i++) tlut[i] = i * 0x0101 | 1;
+
+	surface_t src32 = surface_alloc(FMT_RGBA32, W, H);
+	DEFER(surface_free(&src32));
+	surface_t src8 = surface_alloc(FMT_CI8, W, H);
+	DEFER(surface_free(&src8));
+	surface_t src4 = surface_alloc(FMT_CI4, W+1, H);
+	DEFER(surface_free(&src4));
+	for (int j=0; j<H; j++) {
+		for (int i=0; i<W; i++) {
+			((uint32_t*)(src32.buffer + j*src32.stride))[i] = (i*19 + j*7) * 0x01030507;
+			((uint8_t*)(src8.buffer + j*src8.stride))[i] = i*11 + j*3;
+		}
+		for (int i=0; i<W+1; i+=2)
+			((uint8_t*)(src4.buffer + j*src4.stride))[i/2] = ((i+j) & 0xF) << 4 | ((i+j+1) & 0xF);
+	}
+
+	surface_t dst16 = surface_alloc(FMT_RGBA16, 32, 8);
+	DEFER(surface_free(&dst16));
+	surface_t dst32 = surface_alloc(FMT_RGBA32, 32, 8);
+	DEFER(surface_free(&dst32));
+
+	// Test all destination alignments, including clipping on the left
+	for (int x=-3; x<8; x++) {
+		memset(dst16.buffer, 0, dst16.stride * dst16.height);
+		surface_blit(&dst16, &src32, x, 1, NULL, 0);
+		for (int j=0; j<H; j++) {
+			for (int i=(x > 0 ? x : 0); i<x+W; i++) {
+				uint32_t c = ((uint32_t*)(src32.buffer + j*src32.stride))[i-x];
+				uint16_t exp = ((c >> 16) & 0xF800) | ((c >> 13) & 0x7C0) | ((c >> 10) & 0x3E) | ((c >> 7) & 0x1);
+				ASSERT_EQUAL_HEX(((uint16_t*)(dst16.buffer + (j+1)*dst16.stride))[i], exp,
+					"RGBA32->RGBA16: wrong pixel at (%d,%d) (x:%d)", i, j, x);
+			}
+		}
+		ASSERT_EQUAL_HEX(((uint16_t*)dst16.buffer)[(x > 0 ? x : 0)], 0, "RGBA32->RGBA16: row above overwritten (x:%d)", x);
+		if (x > 0)
+			ASSERT_EQUAL_HEX(((uint16_t*)(dst16.buffer + dst16.stride))[x-1], 0, "RGBA32->RGBA16: pixel before overwritten (x:%d)", x);
+		ASSERT_EQUAL_HEX(((uint16_t*)(dst16.buffer + dst16.stride))[x+W], 0, "RGBA32->RGBA16: pixel after overwritten (x:%d)", x);
+
+		surface_blit(&dst16, &src8, x, 1, tlut, 0);
+		for (int j=0; j<H; j++)
+			for (int i=(x > 0 ? x : 0); i<x+W; i++)
+				ASSERT_EQUAL_HEX(((uint16_t*)(dst16.buffer + (j+1)*dst16.stride))[i],
+					tlut[((uint8_t*)(src8.buffer + j*src8.stride))[i-x]],
+					"CI8->RGBA16: wrong pixel at (%d,%d) (x:%d)", i, j, x);
+
+		surface_blit(&dst16, &src4, x, 1, tlut, 0);
+		for (int j=0; j<H; j++)
+			for (int i=(x > 0 ? x : 0); i<x+W+1; i++)
+				ASSERT_EQUAL_HEX(((uint16_t*)(dst16.buffer + (j+1)*dst16.stride))[i], tlut[(i-x+j) & 0xF],
+					"CI4->RGBA16: wrong pixel at (%d,%d) (x:%d)", i, j, x);
+
+		// RGBA16 -> RGBA32 must reconstruct what RGBA32 -> RGBA16 produced, expanded
+		surface_blit(&dst32, &dst16, 0, 0, NULL, 0);
+		for (int j=0; j<8; j++) {
+			for (int i=0; i<32; i++) {
+				uint16_t c = ((uint16_t*)(dst16.buffer + j*dst16.stride))[i];
+				uint32_t r = (c >> 11) & 0x1F, g = (c >> 6) & 0x1F, b = (c >> 1) & 0x1F;
+				uint32_t exp = ((r << 3 | r >> 2) << 24) | ((g << 3 | g >> 2) << 16) | ((b << 3 | b >> 2) << 8) | ((c & 1) ? 0xFF : 0);
+				ASSERT_EQUAL_HEX(((uint32_t*)(dst32.buffer + j*dst32.stride))[i], exp,
+					"RGBA16->RGBA32: wrong pixel at (%d,%d) (x:%d)", i, j, x);
+			}
+		}
+	}
+}
+
+// Benchmarks of surface_blit, one per format pair and path. Results are
+// reported in the same machine-readable format of test_rspq_bench.c.
+void test_surface_blit_bench(TestContext *ctx) {
+	rspq_init();
+	DEFER(rspq_close());
+	rdp_init();
+	DEFER(rdp_close());
+
+	static const struct { tex_format_t src, dst; uint32_t flags; const char *name; } pairs[] = {
+		{ FMT_RGBA16, FMT_RGBA16, 0,                "blit_rgba16_rgba16_cpu" },
+		{ FMT_RGBA16, FMT_RGBA16, SURFACE_BLIT_RDP, "blit_rgba16_rgba16_rdp" },
+		{ FMT_RGBA32, FMT_RGBA16, 0,                "blit_rgba32_rgba16_cpu" },
+		{ FMT_RGBA16, FMT_RGBA32, 0,                "blit_rgba16_rgba32_cpu" },
+		{ FMT_CI8,    FMT_RGBA16, 0,                "blit_ci8_rgba16_cpu" },
+		{ FMT_CI4,    FMT_RGBA16, 0,                "blit_ci4_rgba16_cpu" },
+	};
+	static uint16_t tlut[256];
+
+	for (int p=0; p<sizeof(pairs)/sizeof(pairs[0]); p++) {
+		surface_t src = surface_alloc(pairs[p].src, 256, 128);
+		surface_t dst = surface_alloc(pairs[p].dst, 320, 240);
+
+		uint32_t t0 = TICKS_READ();
+		surface_blit(&dst, &src, 32, 32, tlut, pairs[p].flags);
+		uint32_t ticks = TICKS_SINCE(t0);
+		debugf("BENCH:%s:%lu:%s\n", pairs[p].name, (unsigned long)((uint64_t)ticks * 1000000 / TICKS_PER_SECOND), "us");
+
+		surface_free(&dst);
+		surface_free(&src);
+	}
+}
@@ -139,4 +139,38 @@ void test_ticks(TestContext *ctx) {
 	// Cleanup
 	unregister_VI_handler(frame_callback);
 	C0_WRITE_COUNT(continue_ticks);
-}
\ No newline at end of file
+}
+void test_ticks64(TestContext *ctx) {
+	uint32_t continue_ticks = TICKS_READ();
+
+	disable_interrupts();
+	uint64_t t0 = get_ticks64();
+
+	// Go across a wrap-around of the hardware counter: the clock must keep
+	// increasing, without any jump.
+	C0_WRITE_COUNT(0xFFFFFF00);
+	uint64_t t1 = get_ticks64();
+	uint64_t prev = t1;
+	bool monotonic = true;
+	for (int i = 0; i < 256; i++) {
+		uint64_t t = get_ticks64();
+		if (t < prev) monotonic = false;
+		prev = t;
+	}
+	uint64_t t2 = get_ticks64();
+	C0_WRITE_COUNT(continue_ticks);
+	enable_interrupts();
+
+	ASSERT(t1 > t0, "clock went back: %llx -> %llx", t0, t1);
+	ASSERT(monotonic, "clock not monotonic across the wrap-around");
+	ASSERT((uint32_t)t2 < 0xFFFFFF00, "counter did not wrap around: %llx", t2);
+	ASSERT_EQUAL_HEX(t2 >> 32, (t1 >> 32) + 1, "wrap-around not counted");
+	ASSERT(t2 - t1 < 0x10000, "clock jumped: %llx -> %llx", t1, t2);
+
+	ASSERT_EQUAL_UNSIGNED(ticks_to_us(TICKS_PER_SECOND), 1000000, "invalid conversion to us");
+	ASSERT_EQUAL_UNSIGNED(ticks_to_ns(TICKS_PER_SECOND / 1000), 1000000, "invalid conversion to ns");
+	ASSERT_EQUAL_UNSIGNED(ticks_to_ns((uint64_t)TICKS_PER_SECOND * 86400 * 365), 86400ull * 365 * 1000000000, "invalid conversion to ns (one year)");
+	ASSERT_EQUAL_UNSIGNED(ticks_from_us(1000000), TICKS_PER_SECOND, "invalid conversion from us");
+	uint64_t us = ticks_to_us(ticks_from_us(123456789));
+	ASSERT(us <= 123456789 && us >= 123456788, "invalid round trip: %llu", us);
+}
@@ -360,3 +360,90 @@ void test_timer_continuous_short(TestContext *ctx) {
 		ASSERT_EQUAL_SIGNED(cb_called, 50, "invalid number of calls to timer callback");
 	}
 }
+
+void test_timer_order(TestContext *ctx) {
+	timer_init();
+	DEFER(timer_close());
+
+	#define NUM_ORDER_TIMERS 64
+	timer_link_t *timers[NUM_ORDER_TIMERS] = {0};
+	DEFER(for (int i=0; i<NUM_ORDER_TIMERS; i++) delete_timer(timers[i]));
+
+	volatile int fired[NUM_ORDER_TIMERS];
+	volatile int num_fired = 0;
+	void cb(int ovfl, void *ctx) {
+		fired[num_fired++] = (int)ctx;
+	}
+
+	// Start the timers in a scrambled order, with deadlines 100us apart.
+	disable_interrupts();
+	for (int i=0; i<NUM_ORDER_TIMERS; i++) {
+		int idx = (i * 37) % NUM_ORDER_TIMERS;
+		timers[idx] = new_timer_context(TIMER_TICKS(1000 + idx * 100), TF_ONE_SHOT, cb, (void*)idx);
+	}
+	// Stop one timer every three, so that removals from the middle of the queue are exercised.
+	for (int i=0; i<NUM_ORDER_TIMERS; i+=3)
+		stop_timer(timers[i]);
+	enable_interrupts();
+
+	wait_ms(10);
+
+	int expected = 0;
+	for (int i=0; i<NUM_ORDER_TIMERS; i++)
+		if (i % 3) expected++;
+	ASSERT_EQUAL_SIGNED(num_fired, expected, "invalid number of timers fired");
+	for (int i=1; i<num_fired; i++) {
+		ASSERT(fired[i-1] < fired[i], "timers fired out of order: %d before %d", fired[i-1], fired[i]);
+		ASSERT(fired[i] % 3 != 0, "stopped timer %d was fired", fired[i]);
+	}
+	#undef NUM_ORDER_TIMERS
+}
+
+void test_timer_slack(TestContext *ctx) {
+	timer_init();
+	DEFER(timer_close());
+
+	volatile int ovfl1 = -1, ovfl2 = -1;
+	void cb1(int ovfl) { ovfl1 = ovfl; }
+	void cb2(int ovfl) { ovfl2 = ovfl; }
+
+	timer_link_t t1, t2;
+
+	// t1 could fire at 1ms but it is allowed to be late up to 2ms, so it must
+	// be coalesced with t2 that expires at 1.5ms.
+	disable_interrupts();
+	start_timer(&t1, TIMER_TICKS(1000), TF_ONE_SHOT, cb1);
+	timer_set_slack(&t1, TIMER_TICKS(1000));
+	start_timer(&t2, TIMER_TICKS(1500), TF_ONE_SHOT, cb2);
+	enable_interrupts();
+
+	wait_ms(3);
+	ASSERT(ovfl2 >= 0, "timer t2 did not fire");
+	ASSERT(ovfl1 >= TIMER_TICKS(450), "timer t1 was not coalesced (ovfl:%d)", ovfl1);
+	ASSERT(ovfl1 <= TIMER_TICKS(1000), "timer t1 fired after its slack (ovfl:%d)", ovfl1);
+}
+
+void test_timer_pool(TestContext *ctx) {
+	timer_init();
+	DEFER(timer_close());
+	timer_pool_init(2);
+
+	void cb(int ovfl) {}
+
+	timer_link_t *t1 = new_timer(TIMER_TICKS(1000), TF_DISABLED, cb);
+	timer_link_t *t2 = new_timer(TIMER_TICKS(1000), TF_DISABLED, cb);
+	ASSERT(t1 && t2 && t1 != t2, "invalid timers allocated from the pool");
+
+	// The preallocated timers are exhausted: the pool grows
+	timer_link_t *t3 = new_timer(TIMER_TICKS(1000), TF_DISABLED, cb);
+	ASSERT(t3 && t3 != t1 && t3 != t2, "invalid timer allocated after growing the pool");
+	delete_timer(t3);
+
+	// A deleted timer goes back to the pool
+	delete_timer(t1);
+	timer_link_t *t4 = new_timer(TIMER_TICKS(1000), TF_DISABLED, cb);
+	ASSERT(t4 == t1, "deleted timer was not reused from the pool");
+
+	delete_timer(t2);
+	delete_timer(t4);
+}
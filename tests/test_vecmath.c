@@ -0,0 +1,178 @@
+#include <math.h>
+#include <vecmath.h>
+
+// Number of slots used by the tests: more than a chunk of the ucode
+#define VECMATH_TEST_SLOTS   37
+
+static float vecmath_test_rand(void) {
+	return (float)(RANDN(2001) - 1000) / 100.0f;
+}
+
+void test_vecmath_transform(TestContext *ctx) {
+	vecmath_init();
+	DEFER(vecmath_close());
+
+	float m[16], in[VECMATH_TEST_SLOTS*8], out[VECMATH_TEST_SLOTS*8];
+	for (int i = 0; i < 16; i++) m[i] = vecmath_test_rand();
+	for (int i = 0; i < VECMATH_TEST_SLOTS*8; i++) in[i] = vecmath_test_rand();
+
+	vecmath_mtx_t *mtx = malloc_uncached(sizeof(vecmath_mtx_t));
+	DEFER(free_uncached(mtx));
+	vecmath_slot_t *buf = malloc_uncached(sizeof(vecmath_slot_t) * VECMATH_TEST_SLOTS);
+	DEFER(free_uncached(buf));
+
+	vecmath_mtx_from_floats(mtx, m);
+	vecmath_from_floats(buf, in, VECMATH_TEST_SLOTS*8);
+	vecmath_load_mtx(3, mtx);
+	vecmath_transform(buf, 3, buf, VECMATH_TEST_SLOTS);
+	rspq_wait();
+	vecmath_to_floats(out, buf, VECMATH_TEST_SLOTS*8);
+
+	for (int v = 0; v < VECMATH_TEST_SLOTS*2; v++) {
+		for (int r = 0; r < 4; r++) {
+			float exp = 0;
+			for (int c = 0; c < 4; c++)
+				exp += m[c*4+r] * in[v*4+c];
+			ASSERT(fabsf(out[v*4+r] - exp) < 0.01f, "vector %d, row %d: %f != %f", v, r, out[v*4+r], exp);
+		}
+	}
+}
+
+void test_vecmath_state(TestContext *ctx) {
+	vecmath_init();
+	DEFER(vecmath_close());
+
+	float m[16], in[8], out[8];
+	for (int i = 0; i < 16; i++) m[i] = vecmath_test_rand();
+	for (int i = 0; i < 8; i++) in[i] = vecmath_test_rand();
+
+	vecmath_mtx_t *mtx = malloc_uncached(sizeof(vecmath_mtx_t));
+	DEFER(free_uncached(mtx));
+	vecmath_slot_t *buf = malloc_uncached(sizeof(vecmath_slot_t) * 2);
+	DEFER(free_uncached(buf));
+	uint32_t *fill = malloc_uncached(64);
+	DEFER(free_uncached(fill));
+
+	// The matrix must survive the overlay switches, both after the load
+	// (state written back) and after a transform (state left clean)
+	vecmath_mtx_from_floats(mtx, m);
+	vecmath_load_mtx(2, mtx);
+	for (int j = 0; j < 2; j++) {
+		rspmem_fill(fill, j, 64);
+		vecmath_from_floats(buf, in, 8);
+		vecmath_transform(buf, 2, buf, 1);
+		rspq_wait();
+		vecmath_to_floats(out, buf, 8);
+
+		for (int v = 0; v < 2; v++) {
+			for (int r = 0; r < 4; r++) {
+				float exp = 0;
+				for (int c = 0; c < 4; c++)
+					exp += m[c*4+r] * in[v*4+c];
+				ASSERT(fabsf(out[v*4+r] - exp) < 0.01f, "pass %d, vector %d, row %d: %f != %f", j, v, r, out[v*4+r], exp);
+			}
+		}
+	}
+}
+
+void test_vecmath_dot_cross(TestContext *ctx) {
+	vecmath_init();
+	DEFER(vecmath_close());
+
+	float a[VECMATH_TEST_SLOTS*8], b[VECMATH_TEST_SLOTS*8], out[VECMATH_TEST_SLOTS*8];
+	for (int i = 0; i < VECMATH_TEST_SLOTS*8; i++) {
+		a[i] = vecmath_test_rand();
+		b[i] = vecmath_test_rand();
+	}
+
+	vecmath_slot_t *sa = malloc_uncached(sizeof(vecmath_slot_t) * VECMATH_TEST_SLOTS);
+	DEFER(free_uncached(sa));
+	vecmath_slot_t *sb = malloc_uncached(sizeof(vecmath_slot_t) * VECMATH_TEST_SLOTS);
+	DEFER(free_uncached(sb));
+	vecmath_slot_t *sd = malloc_uncached(sizeof(vecmath_slot_t) * VECMATH_TEST_SLOTS);
+	DEFER(free_uncached(sd));
+	vecmath_from_floats(sa, a, VECMATH_TEST_SLOTS*8);
+	vecmath_from_floats(sb, b, VECMATH_TEST_SLOTS*8);
+
+	vecmath_dot3(sd, sa, sb, VECMATH_TEST_SLOTS);
+	rspq_wait();
+	vecmath_to_floats(out, sd, VECMATH_TEST_SLOTS*8);
+	for (int v = 0; v < VECMATH_TEST_SLOTS*2; v++) {
+		const float *x = &a[v*4], *y = &b[v*4];
+		float exp = x[0]*y[0] + x[1]*y[1] + x[2]*y[2];
+		for (int c = 0; c < 4; c++)
+			ASSERT(fabsf(out[v*4+c] - exp) < 0.01f, "dot3 %d: %f != %f", v, out[v*4+c], exp);
+	}
+
+	vecmath_dot4(sd, sa, sb, VECMATH_TEST_SLOTS);
+	rspq_wait();
+	vecmath_to_floats(out, sd, VECMATH_TEST_SLOTS*8);
+	for (int v = 0; v < VECMATH_TEST_SLOTS*2; v++) {
+		const float *x = &a[v*4], *y = &b[v*4];
+		float exp = x[0]*y[0] + x[1]*y[1] + x[2]*y[2] + x[3]*y[3];
+		for (int c = 0; c < 4; c++)
+			ASSERT(fabsf(out[v*4+c] - exp) < 0.01f, "dot4 %d: %f != %f", v, out[v*4+c], exp);
+	}
+
+	vecmath_cross(sd, sa, sb, VECMATH_TEST_SLOTS);
+	rspq_wait();
+	vecmath_to_floats(out, sd, VECMATH_TEST_SLOTS*8);
+	for (int v = 0; v < VECMATH_TEST_SLOTS*2; v++) {
+		const float *x = &a[v*4], *y = &b[v*4];
+		float exp[4] = { x[1]*y[2] - x[2]*y[1], x[2]*y[0] - x[0]*y[2], x[0]*y[1] - x[1]*y[0], 0 };
+		for (int c = 0; c < 4; c++)
+			ASSERT(fabsf(out[v*4+c] - exp[c]) < 0.01f, "cross %d.%d: %f != %f", v, c, out[v*4+c], exp[c]);
+	}
+}
+
+void test_vecmath_normalize(TestContext *ctx) {
+	vecmath_init();
+	DEFER(vecmath_close());
+
+	float in[VECMATH_TEST_SLOTS*8], out[VECMATH_TEST_SLOTS*8];
+	for (int i = 0; i < VECMATH_TEST_SLOTS*8; i++) in[i] = vecmath_test_rand();
+	// A zero vector is left unchanged
+	in[0] = in[1] = in[2] = 0;
+
+	vecmath_slot_t *buf = malloc_uncached(sizeof(vecmath_slot_t) * VECMATH_TEST_SLOTS);
+	DEFER(free_uncached(buf));
+	vecmath_from_floats(buf, in, VECMATH_TEST_SLOTS*8);
+	vecmath_normalize(buf, buf, VECMATH_TEST_SLOTS);
+	rspq_wait();
+	vecmath_to_floats(out, buf, VECMATH_TEST_SLOTS*8);
+
+	for (int v = 0; v < VECMATH_TEST_SLOTS*2; v++) {
+		const float *x = &in[v*4];
+		float len = sqrtf(x[0]*x[0] + x[1]*x[1] + x[2]*x[2]);
+		for (int c = 0; c < 3; c++) {
+			float exp = len ? x[c] / len : 0;
+			ASSERT(fabsf(out[v*4+c] - exp) < 0.005f, "vector %d.%d: %f != %f", v, c, out[v*4+c], exp);
+		}
+		ASSERT(fabsf(out[v*4+3] - x[3]) < 0.0001f, "vector %d: w changed: %f != %f", v, out[v*4+3], x[3]);
+	}
+}
+
+void test_vecmath_fixed(TestContext *ctx) {
+	vecmath_init();
+	DEFER(vecmath_close());
+
+	int32_t *fixed = malloc_uncached(sizeof(int32_t) * VECMATH_TEST_SLOTS*8);
+	DEFER(free_uncached(fixed));
+	int32_t *back = malloc_uncached(sizeof(int32_t) * VECMATH_TEST_SLOTS*8);
+	DEFER(free_uncached(back));
+	vecmath_slot_t *buf = malloc_uncached(sizeof(vecmath_slot_t) * VECMATH_TEST_SLOTS);
+	DEFER(free_uncached(buf));
+
+	for (int i = 0; i < VECMATH_TEST_SLOTS*8; i++)
+		fixed[i] = (RANDN(65536) << 16) | RANDN(65536);
+
+	vecmath_from_fixed(buf, fixed, VECMATH_TEST_SLOTS);
+	vecmath_to_fixed(back, buf, VECMATH_TEST_SLOTS);
+	rspq_wait();
+
+	for (int i = 0; i < VECMATH_TEST_SLOTS*8; i++) {
+		ASSERT_EQUAL_SIGNED(buf[i/8].i[i%8], (int16_t)(fixed[i] >> 16), "integer part %d", i);
+		ASSERT_EQUAL_UNSIGNED(buf[i/8].f[i%8], fixed[i] & 0xFFFF, "fractional part %d", i);
+	}
+	ASSERT_EQUAL_MEM((uint8_t*)back, (uint8_t*)fixed, sizeof(int32_t) * VECMATH_TEST_SLOTS*8, "round trip failed");
+}
@@ -0,0 +1,67 @@
+
+void test_vmem_rom(TestContext *ctx) {
+	// Each file fits a single frame of two 4 KiB pages
+	vmem_init(4*1024, 2);
+	DEFER(vmem_close());
+
+	int size1, size2;
+	const uint8_t *counter = vmem_map_rom("rom:/counter.dat", &size1);
+	const uint8_t *random = vmem_map_rom("rom:/random.dat", &size2);
+	ASSERT_EQUAL_SIGNED(size1, 4096, "wrong size of counter.dat");
+	ASSERT_EQUAL_SIGNED(size2, 8192, "wrong size of random.dat");
+
+	uint8_t *expected = malloc(size2);
+	DEFER(free(expected));
+	int fh = dfs_open("random.dat");
+	dfs_read(expected, 1, size2, fh);
+	dfs_close(fh);
+
+	// Interleave the accesses to the two mappings
+	for (int i=0; i<size2; i+=256) {
+		ASSERT_EQUAL_HEX(random[i], expected[i], "wrong data in random.dat at %d", i);
+		ASSERT_EQUAL_HEX(counter[(i/2) % size1], (uint8_t)((i/2) % size1), "wrong data in counter.dat at %d", i/2);
+	}
+	ASSERT_EQUAL_MEM(random, expected, size2, "wrong data in random.dat");
+
+	vmem_stats_t stats;
+	vmem_get_stats(&stats);
+	ASSERT_EQUAL_UNSIGNED(stats.faults, 2, "wrong number of page faults");
+	ASSERT_EQUAL_UNSIGNED(stats.evictions, 0, "wrong number of evictions");
+	ASSERT_EQUAL_UNSIGNED(stats.bytes_loaded, 4096 + 8192, "wrong number of bytes loaded");
+	vmem_unmap(random);
+	vmem_unmap(counter);
+
+	// With a single frame, each access to the other file evicts the frame
+	vmem_init(4*1024, 1);
+	counter = vmem_map_rom("rom:/counter.dat", NULL);
+	random = vmem_map_rom("rom:/random.dat", NULL);
+	for (int i=0; i<8; i++) {
+		ASSERT_EQUAL_HEX(random[i*1000], expected[i*1000], "wrong data after eviction");
+		ASSERT_EQUAL_HEX(counter[i*500], (uint8_t)(i*500), "wrong data after eviction");
+	}
+	vmem_get_stats(&stats);
+	ASSERT_EQUAL_UNSIGNED(stats.faults, 16, "wrong number of page faults");
+	ASSERT_EQUAL_UNSIGNED(stats.evictions, 15, "wrong number of evictions");
+}
+
+void test_vmem_ram(TestContext *ctx) {
+	vmem_init(4*1024, 2);
+	DEFER(vmem_close());
+
+	uint32_t *buf = memalign(8*1024, 12*1024);
+	DEFER(free(buf));
+	for (int i=0; i<12*1024/4; i++) buf[i] = i;
+
+	uint32_t *map = vmem_map_ram(buf, 12*1024);
+	ASSERT(map != buf, "mapping is not virtual");
+	for (int i=0; i<12*1024/4; i+=64)
+		ASSERT_EQUAL_UNSIGNED(map[i], i, "wrong data at index %d", i);
+
+	// Writes through the mapping reach the buffer
+	map[5] = 0xDEADBEEF;
+	map[3000] = 0x12345678;
+	ASSERT_EQUAL_HEX(buf[5], 0xDEADBEEF, "write through mapping not visible");
+	ASSERT_EQUAL_HEX(buf[3000], 0x12345678, "write through mapping not visible");
+
+	vmem_unmap(map);
+}
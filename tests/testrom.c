@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <malloc.h>
 
 // Activate this when running under emulators such as cen64
 #ifndef IN_EMULATOR
@@ -189,6 +190,97 @@ int assert_equal_mem(TestContext *ctx, const char *file, int line, const uint8_t
 	} \
 })
 
+/**********************************************************************
+ * BENCHMARKS
+ **********************************************************************/
+
+#define BENCH_MAX_ITERS      512
+#define BENCH_MAX_BASELINE   128
+#define BENCH_BASELINE_FILE  "rom:/bench_baseline.txt"
+
+static uint32_t bench_samples[BENCH_MAX_ITERS];
+static struct { char name[48]; uint32_t ticks; } bench_baseline[BENCH_MAX_BASELINE];
+static int bench_baseline_count = -1;
+
+// Load the baseline file (once). Each line is "<name> <median ticks>", and
+// lines starting with '#' are comments. The file can be regenerated from
+// the BENCH lines printed by a run on the reference hardware.
+static void bench_load_baseline(void) {
+	if (bench_baseline_count >= 0)
+		return;
+	bench_baseline_count = 0;
+	FILE *f = fopen(BENCH_BASELINE_FILE, "r");
+	if (!f)
+		return;
+	char line[128];
+	while (fgets(line, sizeof(line), f) && bench_baseline_count < BENCH_MAX_BASELINE) {
+		unsigned long ticks;
+		if (line[0] == '#' || sscanf(line, "%47s %lu", bench_baseline[bench_baseline_count].name, &ticks) != 2)
+			continue;
+		bench_baseline[bench_baseline_count++].ticks = ticks;
+	}
+	fclose(f);
+}
+
+// Report the median and spread (10th to 90th percentile) of the samples of a
+// benchmark, and compare the median with the baseline. Returns false (and
+// fails the test) if the median is slower than the baseline by more than
+// 10% plus the spread.
+static bool bench_report(TestContext *ctx, const char *name, uint32_t *samples, int n) {
+	// Insertion sort: the number of samples is small
+	for (int i=1;i<n;i++) {
+		uint32_t v = samples[i]; int j = i;
+		for (; j>0 && samples[j-1] > v; j--)
+			samples[j] = samples[j-1];
+		samples[j] = v;
+	}
+	uint32_t median = samples[n/2];
+	uint32_t spread = samples[n*9/10] - samples[n/10];
+
+	debugf("BENCH:%s:%lu:ticks\n", name, median);
+	debugf("BENCH:%s.spread:%lu:ticks\n", name, spread);
+	LOG("%s: median %lu ticks (spread %lu, min %lu, max %lu)\n", name, median, spread, samples[0], samples[n-1]);
+
+	// Timings under emulators are meaningless, so do not compare them.
+	if (IN_EMULATOR || sys_bbplayer())
+		return true;
+	bench_load_baseline();
+	for (int i=0;i<bench_baseline_count;i++) {
+		if (strcmp(bench_baseline[i].name, name))
+			continue;
+		uint32_t limit = bench_baseline[i].ticks + bench_baseline[i].ticks / 10 + spread;
+		if (median > limit) {
+			ERR("BENCHMARK REGRESSION: %s\n", name);
+			ERR("median: %lu ticks, baseline: %lu ticks (+%.1f%%)\n", median, bench_baseline[i].ticks,
+				(float)(median - bench_baseline[i].ticks) * 100.0f / (float)bench_baseline[i].ticks);
+			ctx->result = TEST_FAILED;
+			return false;
+		}
+		break;
+	}
+	return true;
+}
+
+// TEST_BENCH(name, iters, body): run "body" for the specified number of
+// iterations, timing each of them, and report the median and spread via
+// debugf on two machine-readable lines:
+//
+//     BENCH:<name>:<median>:ticks
+//     BENCH:<name>.spread:<p90-p10>:ticks
+//
+// If the baseline file (tests/filesystem/bench_baseline.txt) has an entry for
+// the benchmark, the test fails when the median regresses (see bench_report).
+#define TEST_BENCH(name, iters, body) ({ \
+	int __bench_n = (iters); \
+	assertf(__bench_n > 0 && __bench_n <= BENCH_MAX_ITERS, "invalid number of iterations: %d", __bench_n); \
+	for (int __bench_i = 0; __bench_i < __bench_n; __bench_i++) { \
+		uint32_t __bench_t0 = TICKS_READ(); \
+		body; \
+		bench_samples[__bench_i] = TICKS_SINCE(__bench_t0); \
+	} \
+	if (!bench_report(ctx, (name), bench_samples, __bench_n)) return; \
+})
+
 /**********************************************************************
  * TEST FILES
  **********************************************************************/
@@ -198,14 +290,32 @@ int assert_equal_mem(TestContext *ctx, const char *file, int line, const uint8_t
 #include "test_cache.c"
 #include "test_ticks.c"
 #include "test_timer.c"
+#include "test_kernel.c"
 #include "test_irq.c"
+#include "test_prof_zone.c"
+#include "test_heap_profile.c"
+#include "test_arena.c"
+#include "test_blkpool.c"
+#include "test_fixed.c"
+#include "test_idle.c"
+#include "test_vmem.c"
+#include "test_overlay.c"
+#include "test_boot_profile.c"
 #include "test_exception.c"
 #include "test_debug.c"
 #include "test_dma.c"
 #include "test_cop1.c"
 #include "test_constructors.c"
 #include "test_backtrace.c"
+#include "test_graphics.c"
+#include "test_surface.c"
 #include "test_rspq.c"
+#include "test_rspq_bench.c"
+#include "test_vecmath.c"
+#include "test_rspmem.c"
+#include "test_rspjob.c"
+#include "test_rsp_profile.c"
+#include "test_bench.c"
 
 /**********************************************************************
  * MAIN
@@ -229,7 +339,9 @@ static const struct Testsuite
 	TEST_FUNC(test_exception,                  5, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_exception_syscall,          0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_constructors,               0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_constructors_priority,      0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_ticks,                      0, TEST_FLAGS_NO_BENCHMARK | TEST_FLAGS_NO_EMULATOR),
+	TEST_FUNC(test_ticks64,                    0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_timer_ticks,              292, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_timer_oneshot,            596, TEST_FLAGS_RESET_COUNT),
 	TEST_FUNC(test_timer_slow_callback,     1468, TEST_FLAGS_RESET_COUNT),
@@ -239,14 +351,56 @@ static const struct Testsuite
 	TEST_FUNC(test_timer_context,            186, TEST_FLAGS_RESET_COUNT),
 	TEST_FUNC(test_timer_disabled_start,     733, TEST_FLAGS_RESET_COUNT),
 	TEST_FUNC(test_timer_disabled_restart,   733, TEST_FLAGS_RESET_COUNT),
+	TEST_FUNC(test_timer_order,               10, TEST_FLAGS_RESET_COUNT),
+	TEST_FUNC(test_timer_slack,                3, TEST_FLAGS_RESET_COUNT),
+	TEST_FUNC(test_timer_pool,                 0, TEST_FLAGS_RESET_COUNT),
+	TEST_FUNC(test_kernel_threads,             0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_kernel_waitq,               2, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_irq_reentrancy,           230, TEST_FLAGS_RESET_COUNT),
+	TEST_FUNC(test_irq_handler_stats,          3, TEST_FLAGS_RESET_COUNT),
+	TEST_FUNC(test_prof_zone_buffer,           0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_heap_profile_sites,         0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_heap_profile_full,          0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_arena_alloc,                0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_arena_uncached,             0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_arena_surface,              0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_blkpool,                    0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_blkpool_interrupt,          0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_fixed,                      0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_idle,                       0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_vmem_rom,                   0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_vmem_ram,                   0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_overlay,                    0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_boot_profile,               0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_dfs_read,                 948, TEST_FLAGS_IO),
+	TEST_FUNC(test_dfs_fread_unbuffered,       0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_read_cache,             0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_many_files,             0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_dfs_rom_addr,              25, TEST_FLAGS_IO),
+	TEST_FUNC(test_dfs_map,                    0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_trace,                  0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_read_async,             0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_lookup,                 0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_dir_read,               0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_asset_load_async,       0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_asset_load_writeback,   0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_asset_stats,            0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_asset_seek,             0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_asset_stream_pool,      0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_asset_lzh5,             0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_asset_lzb,              0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_asset_prefetch,         0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_eepromfs,                   0, TEST_FLAGS_IO),
+	TEST_FUNC(test_eepromfs_deferred,          0, TEST_FLAGS_IO),
 	TEST_FUNC(test_cache_invalidate,        1763, TEST_FLAGS_NONE),
+	TEST_FUNC(test_cache_writeback_large,      0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_cache_range_bench,          0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_debug_sdfs,                 0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_dma_read_misalign,       7003, TEST_FLAGS_NONE),
+	TEST_FUNC(test_dma_queue,                  0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dma_speed_profile,          0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_cop1_denormalized_float,    0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_cop1_denormalized_operand,  0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_backtrace_analyze,          0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_backtrace_basic,            0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_backtrace_fp,               0, TEST_FLAGS_NO_BENCHMARK),
@@ -254,6 +408,13 @@ static const struct Testsuite
 	TEST_FUNC(test_backtrace_exception_leaf,   0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_backtrace_exception_fp,     0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_backtrace_invalidptr,       0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_backtrace_cache,            0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_backtrace_frametab,         0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_graphics_draw_box,          0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_graphics_draw_sprite_trans, 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_surface_pool,               0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_surface_blit,               0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_surface_blit_bench,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_queue_single,          0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_queue_multiple,        0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_queue_rapid,           0, TEST_FLAGS_NO_BENCHMARK),
@@ -262,17 +423,48 @@ static const struct Testsuite
 	TEST_FUNC(test_rspq_high_load,             0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_load_overlay,          0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_switch_overlay,        0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_overlay_reload,        0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_multiple_flush,        0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_wait,                  0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_rapid_sync,            0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_flush,                 0, TEST_FLAGS_NO_BENCHMARK | TEST_FLAGS_NO_EMULATOR),
 	TEST_FUNC(test_rspq_rapid_flush,           0, TEST_FLAGS_NO_BENCHMARK | TEST_FLAGS_NO_EMULATOR),
 	TEST_FUNC(test_rspq_block,                 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_block_arena,           0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_block_patch,           0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_syncpoint_callback,    0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_wait_sync_in_block,    0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_highpri_basic,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_highpri_multiple,      0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_highpri_overlay,       0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_highpri_stats,         0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_dma_list,              0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_big_command,           0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_cpp_write,             0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_isr_write,             0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_overlay_stats,         0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_profile,               0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_capture,               0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_vecmath_transform,          0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_vecmath_state,              0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_vecmath_dot_cross,          0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_vecmath_normalize,          0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_vecmath_fixed,              0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspmem_copy,                0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspmem_fill,                0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspjob_parallel_for,        0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rsp_profile,                0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_bench_throughput,      0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_bench_payload,         0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_bench_block_nesting,   0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_bench_highpri,         0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_bench_syncpoint,       0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_bench_dfs_read,             0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_bench_asset_load,           0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_bench_cache,                0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_bench_timer,                0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_bench_joybus,               0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_bench_rspq_syncpoint,       0, TEST_FLAGS_NO_BENCHMARK),
 };
 
 int main() {
@@ -8,8 +8,14 @@
 #include <dirent.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <math.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 bool flag_verbose = false;
+bool flag_update = false;
 
 #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
 	#define LE32_TO_HOST(i) __builtin_bswap32(i)
@@ -43,6 +49,90 @@ void fatal(const char *str, ...) {
 }
 
 
+/************************************************************************************
+ *  SAMPLE BANK
+ ************************************************************************************/
+
+#include "wav64internal.h"
+
+// Filename of the sample bank (NULL = samples are stored in each file)
+char *flag_bank = NULL;
+
+typedef struct {
+	uint8_t *data;
+	int size;
+} bank_entry_t;
+
+static bank_entry_t *bank_entries = NULL;
+static int bank_num_entries = 0;
+static int bank_shared_bytes = 0;
+
+// Identifier of the sample bank, written in all the files that refer to it
+uint32_t bank_id(void) {
+	return wav64_bank_hash(flag_bank);
+}
+
+// Add a waveform to the sample bank, and return the index of its entry.
+// If an identical waveform is already present, or a waveform of which this
+// is a prefix (or vice versa), the entry is shared.
+int bank_add(const uint8_t *data, int size) {
+	for (int i=0;i<bank_num_entries;i++) {
+		bank_entry_t *e = &bank_entries[i];
+		int n = size < e->size ? size : e->size;
+		if (memcmp(e->data, data, n) != 0)
+			continue;
+		bank_shared_bytes += n;
+		if (size > e->size) {
+			// The new waveform extends the existing one: grow the entry
+			e->data = realloc(e->data, size);
+			memcpy(e->data, data, size);
+			e->size = size;
+		}
+		return i;
+	}
+
+	bank_entries = realloc(bank_entries, (bank_num_entries+1) * sizeof(bank_entry_t));
+	bank_entry_t *e = &bank_entries[bank_num_entries];
+	e->data = malloc(size);
+	memcpy(e->data, data, size);
+	e->size = size;
+	return bank_num_entries++;
+}
+
+// Write the sample bank file
+void bank_write(const char *fn) {
+	FILE *out = fopen(fn, "wb");
+	if (!out) fatal("cannot create: %s\n", fn);
+
+	wav64_bank_header_t head;
+	memset(&head, 0, sizeof(head));
+	memcpy(head.id, WAV64_BANK_ID, 4);
+	head.version = WAV64_BANK_VERSION;
+	head.bank_id = HOST_TO_BE32(bank_id());
+	head.num_entries = HOST_TO_BE32(bank_num_entries);
+	fwrite(&head, 1, sizeof(head), out);
+
+	// Data of the entries is aligned to 8 bytes, after the table
+	uint32_t offset = sizeof(head) + bank_num_entries * sizeof(wav64_bank_entry_t);
+	for (int i=0;i<bank_num_entries;i++) {
+		offset = (offset + 7) & ~7;
+		wav64_bank_entry_t entry;
+		entry.offset = HOST_TO_BE32(offset);
+		entry.size = HOST_TO_BE32(bank_entries[i].size);
+		fwrite(&entry, 1, sizeof(entry), out);
+		offset += bank_entries[i].size;
+	}
+	for (int i=0;i<bank_num_entries;i++) {
+		while (ftell(out) % 8) fputc(0, out);
+		fwrite(bank_entries[i].data, 1, bank_entries[i].size, out);
+	}
+
+	if (flag_verbose)
+		fprintf(stderr, "Sample bank: %s (%d entries, %ld KiB, %d KiB shared)\n",
+			fn, bank_num_entries, ftell(out) / 1024, bank_shared_bytes / 1024);
+	fclose(out);
+}
+
 /************************************************************************************
  *  CONVERTERS
  ************************************************************************************/
@@ -69,10 +159,27 @@ void usage(void) {
 	printf("Global options:\n");
 	printf("   -o / --output <dir>       Specify output directory\n");
 	printf("   -v / --verbose            Verbose mode\n");
+	printf("   -j / --jobs <num>         Number of files to convert in parallel (default: number of cores)\n");
+	printf("   -u / --update             Skip files whose output is newer than the input (not with --bank)\n");
 	printf("\n");
 	printf("WAV options:\n");
 	printf("   --wav-loop <true|false>   Activate playback loop by default\n");
 	printf("   --wav-loop-offset <N>     Set looping offset (in samples; default: 0)\n");
+	printf("   --wav-compress <0|1|2>    Compress samples (default: 0)\n");
+	printf("                             0/false: uncompressed\n");
+	printf("                             1/true: ADPCM (~3.5x smaller)\n");
+	printf("                             2: MDCT, lossy for music streams (~11x smaller)\n");
+	printf("   --wav-bitrate <kbps>      Bitrate of MDCT compression (default: 64 kbps/channel at 44.1 kHz)\n");
+	printf("   --wav-resample <hz>       Resample to the specified rate (eg: the mixer output rate,\n");
+	printf("                             so that the sample is played without runtime resampling).\n");
+	printf("                             The loop length is rounded to a whole number of samples.\n");
+	printf("   --wav-loop-crossfade <N>  Crossfade the last N samples of the loop with the N samples\n");
+	printf("                             before the loop start, to hide clicks when looping (default: 0)\n");
+	printf("\n");
+	printf("Sample bank options:\n");
+	printf("   --bank <file>             Store the samples of all converted uncompressed WAV\n");
+	printf("                             and XM files in a shared sample bank, storing\n");
+	printf("                             identical waveforms only once\n");
 	printf("\n");
 	printf("YM options:\n");
 	printf("   --ym-compress <true|false>  Compress output file\n");
@@ -87,6 +194,25 @@ char* changeext(char* fn, char *ext) {
 	return strdup(buf);
 }
 
+// Check whether the output file is newer than the input file (see --update)
+bool uptodate(const char *infn, const char *outfn) {
+	struct stat in, out;
+	// All the files must be converted to rebuild the sample bank
+	if (flag_bank)
+		return false;
+	if (stat(infn, &in) != 0 || stat(outfn, &out) != 0)
+		return false;
+	if (out.st_mtime <= in.st_mtime)
+		return false;
+	if (flag_verbose)
+		fprintf(stderr, "Up to date: %s\n", outfn);
+	return true;
+}
+
+// The YM converter uses global state (including the LZH5 compressor and the
+// temporary files), so its calls must be serialized
+static pthread_mutex_t ym_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 void convert(char *infn, char *outfn1) {
 	char *ext = strrchr(infn, '.');
 	if (!ext) {
@@ -96,15 +222,21 @@ void convert(char *infn, char *outfn1) {
 
 	if (strcmp(ext, ".wav") == 0 || strcmp(ext, ".WAV") == 0) {
 		char *outfn = changeext(outfn1, ".wav64");
-		wav_convert(infn, outfn);
+		if (!flag_update || !uptodate(infn, outfn))
+			wav_convert(infn, outfn);
 		free(outfn);
 	} else if (strcmp(ext, ".xm") == 0 || strcmp(ext, ".XM") == 0) {
 		char *outfn = changeext(outfn1, ".xm64");
-		xm_convert(infn, outfn);
+		if (!flag_update || !uptodate(infn, outfn))
+			xm_convert(infn, outfn);
 		free(outfn);
 	} else if (strcmp(ext, ".ym") == 0 || strcmp(ext, ".YM") == 0) {
 		char *outfn = changeext(outfn1, ".ym64");
-		ym_convert(infn, outfn);
+		if (!flag_update || !uptodate(infn, outfn)) {
+			pthread_mutex_lock(&ym_mutex);
+			ym_convert(infn, outfn);
+			pthread_mutex_unlock(&ym_mutex);
+		}
 		free(outfn);
 	} else {
 		fprintf(stderr, "WARNING: ignoring unknown file: %s\n", infn);
@@ -118,14 +250,12 @@ bool exists(const char *path) {
 
 bool isfile(const char *path) {
 	struct stat st;
-	stat(path, &st);
-	return (st.st_mode & S_IFREG) != 0;
+	return stat(path, &st) == 0 && S_ISREG(st.st_mode);
 }
 
 bool isdir(const char *path) {
 	struct stat st;
-	stat(path, &st);
-	return (st.st_mode & S_IFDIR) != 0;
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
 }
 
 void walkdir(char *inpath, char *outpath, void (*func)(char *, char*)) {
@@ -175,6 +305,72 @@ void walkdir(char *inpath, char *outpath, void (*func)(char *, char*)) {
 		fprintf(stderr, "WARNING: ignoring special file: %s\n", inpath);
 	}
 }
+/************************************************************************************
+ *  BATCH CONVERSION
+ ************************************************************************************/
+
+// Files found by walkdir, converted by a pool of threads (see convert_jobs)
+typedef struct {
+	char *infn;
+	char *outfn;
+} job_t;
+
+static job_t *jobs = NULL;
+static int num_jobs = 0;
+static int next_job = 0;
+static pthread_mutex_t jobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int default_jobs(void) {
+#ifdef _WIN32
+	const char *env = getenv("NUMBER_OF_PROCESSORS");
+	int n = env ? atoi(env) : 1;
+#else
+	int n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return n > 0 ? n : 1;
+}
+
+void queue_convert(char *infn, char *outfn) {
+	jobs = realloc(jobs, (num_jobs+1) * sizeof(job_t));
+	jobs[num_jobs].infn = strdup(infn);
+	jobs[num_jobs].outfn = strdup(outfn);
+	num_jobs++;
+}
+
+void *convert_worker(void *arg) {
+	while (1) {
+		pthread_mutex_lock(&jobs_mutex);
+		int idx = next_job++;
+		pthread_mutex_unlock(&jobs_mutex);
+		if (idx >= num_jobs)
+			break;
+		convert(jobs[idx].infn, jobs[idx].outfn);
+	}
+	return NULL;
+}
+
+// Convert all the queued files using up to num_threads threads, and wait for them.
+// The options are global, so this must be called before they are changed.
+void convert_jobs(int num_threads) {
+	if (num_threads > num_jobs) num_threads = num_jobs;
+	if (num_threads <= 1) {
+		convert_worker(NULL);
+	} else {
+		pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+		for (int i=0;i<num_threads;i++)
+			pthread_create(&threads[i], NULL, convert_worker, NULL);
+		for (int i=0;i<num_threads;i++)
+			pthread_join(threads[i], NULL);
+		free(threads);
+	}
+
+	for (int i=0;i<num_jobs;i++) {
+		free(jobs[i].infn);
+		free(jobs[i].outfn);
+	}
+	num_jobs = next_job = 0;
+}
+
 int main(int argc, char *argv[]) {
 	if (argc < 2) {
 		usage();
@@ -182,6 +378,7 @@ int main(int argc, char *argv[]) {
 	}
 
 	char *outdir = ".";
+	int num_threads = default_jobs();
 
 	int i;
 	for (i=1; i<argc; i++) {
@@ -194,6 +391,18 @@ int main(int argc, char *argv[]) {
 					return 1;
 				}
 				outdir = argv[i];
+			} else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for -j/--jobs\n");
+					return 1;
+				}
+				char extra;
+				if (sscanf(argv[i], "%d%c", &num_threads, &extra) != 1 || num_threads <= 0) {
+					fprintf(stderr, "invalid integer argument for -j/--jobs: %s\n", argv[i]);
+					return 1;
+				}
+			} else if (!strcmp(argv[i], "-u") || !strcmp(argv[i], "--update")) {
+				flag_update = true;
 			} else if (!strcmp(argv[i], "--wav-loop")) {
 				if (++i == argc) {
 					fprintf(stderr, "missing argument for --wav-loop\n");
@@ -218,6 +427,57 @@ int main(int argc, char *argv[]) {
 					return 1;
 				}
 				flag_wav_looping = true;
+			} else if (!strcmp(argv[i], "--wav-compress")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for --wav-compress\n");
+					return 1;
+				}
+				if (!strcmp(argv[i], "true") || !strcmp(argv[i], "1"))
+					flag_wav_compress = 1;
+				else if (!strcmp(argv[i], "false") || !strcmp(argv[i], "0"))
+					flag_wav_compress = 0;
+				else if (!strcmp(argv[i], "2"))
+					flag_wav_compress = 2;
+				else {
+					fprintf(stderr, "invalid argument for --wav-compress: %s\n", argv[i]);
+					return 1;
+				}
+			} else if (!strcmp(argv[i], "--wav-bitrate")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for --wav-bitrate\n");
+					return 1;
+				}
+				char extra;
+				if (sscanf(argv[i], "%d%c", &flag_wav_bitrate, &extra) != 1 || flag_wav_bitrate <= 0) {
+					fprintf(stderr, "invalid integer argument for --wav-bitrate: %s\n", argv[i]);
+					return 1;
+				}
+			} else if (!strcmp(argv[i], "--wav-resample")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for --wav-resample\n");
+					return 1;
+				}
+				char extra;
+				if (sscanf(argv[i], "%d%c", &flag_wav_resample, &extra) != 1 || flag_wav_resample <= 0) {
+					fprintf(stderr, "invalid integer argument for --wav-resample: %s\n", argv[i]);
+					return 1;
+				}
+			} else if (!strcmp(argv[i], "--wav-loop-crossfade")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for --wav-loop-crossfade\n");
+					return 1;
+				}
+				char extra;
+				if (sscanf(argv[i], "%d%c", &flag_wav_loop_crossfade, &extra) != 1 || flag_wav_loop_crossfade < 0) {
+					fprintf(stderr, "invalid integer argument for --wav-loop-crossfade: %s\n", argv[i]);
+					return 1;
+				}
+			} else if (!strcmp(argv[i], "--bank")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for --bank\n");
+					return 1;
+				}
+				flag_bank = argv[i];
 			} else if (!strcmp(argv[i], "--ym-compress")) {
 				if (++i == argc) {
 					fprintf(stderr, "missing argument for --ym-compress\n");
@@ -240,10 +500,16 @@ int main(int argc, char *argv[]) {
 			if (!exists(argv[i])) {
 				fprintf(stderr, "ERROR: file %s does not exist\n", argv[i]);
 			} else {
-				walkdir(argv[i], outdir, convert);
+				walkdir(argv[i], outdir, queue_convert);
+				// The sample bank must contain the waveforms of all files, in a
+				// deterministic order: files using it are converted one by one.
+				convert_jobs(flag_bank ? 1 : num_threads);
 			}
 		}
 	}
 
+	if (flag_bank)
+		bank_write(flag_bank);
+
 	return 0;
 }
@@ -5,6 +5,461 @@
 
 bool flag_wav_looping = false;
 int flag_wav_looping_offset = 0;
+int flag_wav_compress = 0;
+int flag_wav_bitrate = 0;
+int flag_wav_resample = 0;
+int flag_wav_loop_crossfade = 0;
+
+// Resampling uses a Kaiser-windowed sinc, tabulated with RESAMPLE_PHASES
+// entries per zero crossing (and linearly interpolated).
+#define RESAMPLE_ZEROS      32      // Zero crossings of the kernel on each side
+#define RESAMPLE_PHASES     512     // Table entries per zero crossing
+#define RESAMPLE_BETA       9.0     // Kaiser window shape (~90 dB stopband)
+
+static double bessel_i0(double x) {
+	double sum = 1, term = 1;
+	for (int k=1; k<50; k++) {
+		term *= (x / (2*k)) * (x / (2*k));
+		sum += term;
+		if (term < sum * 1e-12) break;
+	}
+	return sum;
+}
+
+// Resample a waveform (16-bit big-endian samples) by the specified ratio
+// into out_cnt frames. Input frame t0 is mapped to output frame j0. If
+// loop_len is not zero, the output frames from j0 onwards are computed on
+// the periodic extension of the input loop (which starts at t0), so that
+// the output loop joins seamlessly.
+static int16_t *wav_resample(const int16_t *samples, int cnt, int channels, int loop_len,
+	double ratio, int t0, int j0, int out_cnt)
+{
+	// When downsampling, the cutoff is lowered to the output Nyquist frequency
+	double fc = ratio < 1 ? ratio : 1;
+	double width = RESAMPLE_ZEROS / fc;
+
+	int tbl_size = RESAMPLE_ZEROS * RESAMPLE_PHASES + 2;
+	double *tbl = malloc(tbl_size * sizeof(double));
+	for (int k=0; k<tbl_size; k++) {
+		double u = (double)k / RESAMPLE_PHASES;
+		double r = u / RESAMPLE_ZEROS;
+		double win = r < 1 ? bessel_i0(RESAMPLE_BETA * sqrt(1 - r*r)) / bessel_i0(RESAMPLE_BETA) : 0;
+		tbl[k] = (k == 0 ? 1 : sin(M_PI * u) / (M_PI * u)) * win;
+	}
+
+	int16_t *out = malloc(out_cnt * channels * sizeof(int16_t));
+	for (int j=0; j<out_cnt; j++) {
+		double t = t0 + (j - j0) / ratio;
+		bool periodic = loop_len && j >= j0;
+		int first = (int)ceil(t - width), last = (int)floor(t + width);
+		for (int ch=0; ch<channels; ch++) {
+			double acc = 0;
+			for (int i=first; i<=last; i++) {
+				// Input frames are silent before the start, and either silent
+				// or repeating the loop after the end
+				int idx = i;
+				if (periodic || (loop_len && idx >= cnt)) {
+					idx = (idx - t0) % loop_len;
+					if (idx < 0) idx += loop_len;
+					idx += t0;
+				} else if (idx < 0 || idx >= cnt)
+					continue;
+
+				double u = fabs(t - i) * fc * RESAMPLE_PHASES;
+				int k = (int)u;
+				if (k >= tbl_size - 1) continue;
+				double h = tbl[k] + (tbl[k+1] - tbl[k]) * (u - k);
+				acc += h * (int16_t)BE16_TO_HOST(samples[idx*channels + ch]);
+			}
+			acc *= fc;
+			int v = lrint(acc);
+			if (v > 32767) v = 32767;
+			if (v < -32768) v = -32768;
+			out[j*channels + ch] = HOST_TO_BE16((int16_t)v);
+		}
+	}
+
+	free(tbl);
+	return out;
+}
+
+// Crossfade the end of the loop with the frames that precede the loop start,
+// so that looping back does not cause a discontinuity
+static void wav_loop_crossfade(int16_t *samples, int cnt, int channels, int loop_len, int len) {
+	int start = cnt - loop_len;
+	if (len > start) len = start;
+	if (len > loop_len) len = loop_len;
+	for (int i=0; i<len; i++) {
+		double w = (double)(i+1) / (len+1);
+		for (int ch=0; ch<channels; ch++) {
+			int16_t *dst = &samples[(cnt - len + i)*channels + ch];
+			int16_t pre = BE16_TO_HOST(samples[(start - len + i)*channels + ch]);
+			int16_t cur = BE16_TO_HOST(*dst);
+			*dst = HOST_TO_BE16((int16_t)lrint(cur * (1-w) + pre * w));
+		}
+	}
+}
+
+// Encode a block of ADPCM samples. Predictors and shifts are searched
+// exhaustively, simulating the decoder so that its state (y1, y2) tracks
+// exactly what the player will reconstruct. Only the first n samples are
+// meaningful; the rest of the block is padding.
+static void adpcm_encode_block(const int16_t *x, int n, int *y1, int *y2, int16_t *dec, uint8_t *out) {
+	int64_t best_err = INT64_MAX;
+	int best_filter = 0, best_shift = 0;
+
+	for (int filter=0; filter<4; filter++) {
+		for (int shift=0; shift<=12; shift++) {
+			int64_t err = 0;
+			int s1 = *y1, s2 = *y2;
+			for (int i=0; i<WAV64_ADPCM_FRAME_SAMPLES && err < best_err; i++) {
+				int target = i < n ? x[i] : 0;
+				int pred = wav64_adpcm_predict(filter, s1, s2);
+				int e = target - pred;
+				int round = (1 << shift) >> 1;
+				int q = e >= 0 ? (e + round) >> shift : -((-e + round) >> shift);
+				if (q < -8) q = -8;
+				if (q > 7) q = 7;
+				int y = wav64_adpcm_sample(pred, q, shift);
+				if (i < n) err += (int64_t)(target - y) * (target - y);
+				s2 = s1; s1 = y;
+			}
+			if (err < best_err) {
+				best_err = err;
+				best_filter = filter;
+				best_shift = shift;
+			}
+		}
+	}
+
+	// Emit the block with the best parameters
+	out[0] = (best_shift << 4) | best_filter;
+	memset(out+1, 0, WAV64_ADPCM_BLOCK_BYTES-1);
+	for (int i=0; i<WAV64_ADPCM_FRAME_SAMPLES; i++) {
+		int target = i < n ? x[i] : 0;
+		int pred = wav64_adpcm_predict(best_filter, *y1, *y2);
+		int e = target - pred;
+		int round = (1 << best_shift) >> 1;
+		int q = e >= 0 ? (e + round) >> best_shift : -((-e + round) >> best_shift);
+		if (q < -8) q = -8;
+		if (q > 7) q = 7;
+		int y = wav64_adpcm_sample(pred, q, best_shift);
+		out[1 + i/2] |= (q & 0xF) << (i & 1 ? 0 : 4);
+		dec[i] = y;
+		*y2 = *y1; *y1 = y;
+	}
+}
+
+// Write the samples of a WAV64 file in ADPCM format (after the header)
+static void adpcm_write(FILE *out, const int16_t *samples, int cnt, int channels, int loop_len) {
+	// Amount of samples that can be overread by the player, past the end.
+	const int OVERREAD_SAMPLES = 64;
+	int nframes = (cnt + OVERREAD_SAMPLES + WAV64_ADPCM_FRAME_SAMPLES - 1) / WAV64_ADPCM_FRAME_SAMPLES;
+	int loop_start = cnt - loop_len;
+
+	int16_t *dec = malloc(nframes * WAV64_ADPCM_FRAME_SAMPLES * channels * sizeof(int16_t));
+	int y1[2] = {0}, y2[2] = {0};
+	uint8_t *data = malloc(nframes * WAV64_ADPCM_BLOCK_BYTES * channels);
+	uint8_t *dptr = data;
+
+	for (int f=0; f<nframes; f++) {
+		int pos = f * WAV64_ADPCM_FRAME_SAMPLES;
+		int n = cnt - pos;
+		if (n < 0) n = 0;
+		if (n > WAV64_ADPCM_FRAME_SAMPLES) n = WAV64_ADPCM_FRAME_SAMPLES;
+		for (int ch=0; ch<channels; ch++) {
+			int16_t x[WAV64_ADPCM_FRAME_SAMPLES];
+			for (int i=0; i<n; i++)
+				x[i] = BE16_TO_HOST(samples[(pos+i)*channels + ch]);
+			int16_t *d = dec + (ch * nframes + f) * WAV64_ADPCM_FRAME_SAMPLES;
+			adpcm_encode_block(x, n, &y1[ch], &y2[ch], d, dptr);
+			dptr += WAV64_ADPCM_BLOCK_BYTES;
+		}
+	}
+
+	// Record the decoder state at the loop start, so that the player can
+	// seek there without decoding the waveform from the beginning.
+	wav64_header_adpcm_t ahead;
+	memset(&ahead, 0, sizeof(ahead));
+	for (int ch=0; ch<channels; ch++) {
+		int16_t *d = dec + ch * nframes * WAV64_ADPCM_FRAME_SAMPLES;
+		if (loop_len && loop_start >= 1) ahead.loop_hist[ch][0] = HOST_TO_BE16(d[loop_start-1]);
+		if (loop_len && loop_start >= 2) ahead.loop_hist[ch][1] = HOST_TO_BE16(d[loop_start-2]);
+	}
+
+	fwrite(&ahead, 1, sizeof(ahead), out);
+	fwrite(data, 1, dptr - data, out);
+
+	if (flag_verbose) {
+		double err = 0, sig = 0;
+		for (int ch=0; ch<channels; ch++) {
+			int16_t *d = dec + ch * nframes * WAV64_ADPCM_FRAME_SAMPLES;
+			for (int i=0; i<cnt; i++) {
+				double x = (int16_t)BE16_TO_HOST(samples[i*channels + ch]);
+				sig += x*x; err += (x-d[i])*(x-d[i]);
+			}
+		}
+		fprintf(stderr, "  ADPCM: %d frames, SNR: %.1f dB\n", nframes, err ? 10*log10(sig/err) : 99.0);
+	}
+
+	free(data);
+	free(dec);
+}
+
+/************************************************************************************
+ *  MDCT
+ ************************************************************************************/
+
+#define MDCT_M      WAV64_MDCT_FRAME_SAMPLES
+#define MDCT_N      (2*MDCT_M)
+
+typedef struct {
+	uint8_t *buf;
+	int nbits;
+} bitwriter_t;
+
+static void bw_put(bitwriter_t *bw, uint32_t value, int nbits) {
+	for (int i=nbits-1; i>=0; i--) {
+		if ((value >> i) & 1)
+			bw->buf[bw->nbits >> 3] |= 0x80 >> (bw->nbits & 7);
+		bw->nbits++;
+	}
+}
+
+static int rice_bits(int v, int k) {
+	int q = v >> k;
+	return q >= WAV64_MDCT_RICE_ESCAPE ? WAV64_MDCT_RICE_ESCAPE + 16 : q + 1 + k;
+}
+
+static void rice_put(bitwriter_t *bw, int v, int k) {
+	int q = v >> k;
+	if (q >= WAV64_MDCT_RICE_ESCAPE) {
+		bw_put(bw, (1 << WAV64_MDCT_RICE_ESCAPE) - 1, WAV64_MDCT_RICE_ESCAPE);
+		bw_put(bw, v, 16);
+		return;
+	}
+	bw_put(bw, ((1 << q) - 1) << 1, q + 1);
+	bw_put(bw, v & ((1 << k) - 1), k);
+}
+
+// Signed exp-Golomb code (0, 1, -1, 2, -2...)
+static int sexpg_bits(int d) {
+	unsigned z = (d > 0 ? 2*d - 1 : -2*d) + 1;
+	int n = 0;
+	while ((z >> n) > 1) n++;
+	return 2*n + 1;
+}
+
+static void sexpg_put(bitwriter_t *bw, int d) {
+	unsigned z = (d > 0 ? 2*d - 1 : -2*d) + 1;
+	int n = 0;
+	while ((z >> n) > 1) n++;
+	bw_put(bw, 0, n);
+	bw_put(bw, z, n+1);
+}
+
+// Absolute threshold of hearing at the specified frequency, expressed as
+// the power of a MDCT coefficient (full scale sine = 96 dB SPL).
+static double mdct_ath(double freq) {
+	double khz = (freq < 20 ? 20 : freq) / 1000;
+	double db = 3.64*pow(khz, -0.8) - 6.5*exp(-0.6*pow(khz-3.3, 2)) + 1e-3*pow(khz, 4);
+	if (db > 96) db = 96;
+	double amp = 32768.0 * pow(10, (db-96) / 20);
+	return amp * amp * 0.5;
+}
+
+// Compute the masking threshold of each band: the energy of each band
+// masks the neighbours (with a steeper slope towards lower frequencies),
+// and the result is never below the threshold of hearing.
+static void mdct_mask(const double *X, int freq, double *mask) {
+	const double SMR_DB = 12;
+	double energy[WAV64_MDCT_BANDS];
+	for (int b=0; b<WAV64_MDCT_BANDS; b++) {
+		double e = 0;
+		for (int i=wav64_mdct_band_edges[b]; i<wav64_mdct_band_edges[b+1]; i++)
+			e += X[i]*X[i];
+		energy[b] = e / (wav64_mdct_band_edges[b+1] - wav64_mdct_band_edges[b]);
+	}
+	for (int b=0; b<WAV64_MDCT_BANDS; b++) {
+		double m = 0;
+		for (int j=0; j<WAV64_MDCT_BANDS; j++) {
+			double dist = b >= j ? 10.0*(b-j) : 20.0*(j-b);
+			m += energy[j] * pow(10, -(SMR_DB + dist) / 10);
+		}
+		double fc = (wav64_mdct_band_edges[b] + wav64_mdct_band_edges[b+1]) * 0.5 * freq / MDCT_N;
+		double ath = mdct_ath(fc);
+		mask[b] = m > ath ? m : ath;
+	}
+}
+
+typedef struct {
+	int sf[WAV64_MDCT_BANDS];       // scale factor of each band
+	int k[WAV64_MDCT_BANDS];        // Rice parameter of each band (-1: not coded)
+	int q[MDCT_M];                  // quantized coefficients
+	int bits;                       // size of the encoded bitstream
+} mdct_channel_t;
+
+// Quantize the coefficients of a channel. The quantization noise of each
+// band is shaped after the masking threshold, and globally scaled by 2^(g/4).
+static void mdct_quantize(const double *X, const double *mask, int g, mdct_channel_t *ch) {
+	int prev_sf = -1;
+	ch->bits = 0;
+	for (int b=0; b<WAV64_MDCT_BANDS; b++) {
+		int start = wav64_mdct_band_edges[b], end = wav64_mdct_band_edges[b+1];
+		double step = sqrt(12.0 * mask[b]) * pow(2.0, g / 4.0);
+		int sf = floor(4*log2(step) + 0.5);
+		if (sf < 0) sf = 0;
+		if (sf > 63) sf = 63;
+
+		double qstep = wav64_mdct_step(sf);
+		bool coded = false;
+		for (int i=start; i<end; i++) {
+			int q = floor(fabs(X[i]) / qstep + 0.5);
+			if (q > 0xFFFF) q = 0xFFFF;
+			ch->q[i] = X[i] < 0 ? -q : q;
+			coded |= q != 0;
+		}
+
+		ch->bits += 1;
+		if (!coded) {
+			ch->k[b] = -1;
+			continue;
+		}
+
+		// Select the Rice parameter that minimizes the size of the band
+		int best_k = 0, best_bits = INT_MAX;
+		for (int k=0; k<8; k++) {
+			int bits = 0;
+			for (int i=start; i<end; i++)
+				bits += rice_bits(abs(ch->q[i]), k) + (ch->q[i] != 0);
+			if (bits < best_bits) {
+				best_bits = bits;
+				best_k = k;
+			}
+		}
+		ch->k[b] = best_k;
+		ch->sf[b] = sf;
+		ch->bits += 3 + best_bits + (prev_sf < 0 ? 6 : sexpg_bits(sf - prev_sf));
+		prev_sf = sf;
+	}
+}
+
+static void mdct_put_channel(bitwriter_t *bw, const mdct_channel_t *ch) {
+	for (int b=0; b<WAV64_MDCT_BANDS; b++) {
+		bw_put(bw, ch->k[b] >= 0, 1);
+		if (ch->k[b] >= 0)
+			bw_put(bw, ch->k[b], 3);
+	}
+	int prev_sf = -1;
+	for (int b=0; b<WAV64_MDCT_BANDS; b++) {
+		if (ch->k[b] < 0) continue;
+		if (prev_sf < 0) bw_put(bw, ch->sf[b], 6);
+		else sexpg_put(bw, ch->sf[b] - prev_sf);
+		prev_sf = ch->sf[b];
+	}
+	for (int b=0; b<WAV64_MDCT_BANDS; b++) {
+		if (ch->k[b] < 0) continue;
+		for (int i=wav64_mdct_band_edges[b]; i<wav64_mdct_band_edges[b+1]; i++) {
+			rice_put(bw, abs(ch->q[i]), ch->k[b]);
+			if (ch->q[i])
+				bw_put(bw, ch->q[i] < 0, 1);
+		}
+	}
+}
+
+// Write the samples of a WAV64 file in MDCT format (after the header)
+static void mdct_write(FILE *out, const int16_t *samples, int cnt, int channels, int loop_len, int freq) {
+	// Amount of samples that can be overread by the player, past the end.
+	const int OVERREAD_SAMPLES = 64;
+	int nblocks = (cnt + OVERREAD_SAMPLES + MDCT_M - 1) / MDCT_M;
+	int nframes = nblocks + 1;
+	int loop_start = cnt - loop_len;
+
+	// Default bitrate: about 1/11 of the uncompressed size
+	int kbps = flag_wav_bitrate;
+	if (!kbps)
+		kbps = (64 * channels * freq + 22050) / 44100;
+	int frame_bytes = (kbps * 1000 / 8 * MDCT_M + freq/2) / freq;
+	if (frame_bytes < 8 * channels) frame_bytes = 8 * channels;
+	if (frame_bytes > WAV64_MDCT_MAX_FRAME_BYTES) frame_bytes = WAV64_MDCT_MAX_FRAME_BYTES;
+	int budget = frame_bytes * 8;
+
+	// Build the signal to encode for each channel: one frame of silence,
+	// then the waveform, followed by the loop (or silence) to cover the overread.
+	int padlen = (nframes + 1) * MDCT_M;
+	double *signal = calloc(padlen * channels, sizeof(double));
+	for (int ch=0; ch<channels; ch++) {
+		double *x = signal + ch * padlen;
+		for (int i=0; i<padlen - MDCT_M; i++) {
+			int idx = i;
+			if (idx >= cnt) {
+				if (!loop_len) break;
+				idx = loop_start + (idx - cnt) % loop_len;
+			}
+			x[MDCT_M + i] = (int16_t)BE16_TO_HOST(samples[idx*channels + ch]);
+		}
+	}
+
+	// Precalculate the windowed cosine basis of the transform
+	double *basis = malloc(MDCT_M * MDCT_N * sizeof(double));
+	for (int k=0; k<MDCT_M; k++)
+		for (int n=0; n<MDCT_N; n++)
+			basis[k*MDCT_N + n] = sin(M_PI * (n + 0.5) / MDCT_N) *
+				cos(M_PI / MDCT_M * (n + 0.5 + MDCT_M / 2.0) * (k + 0.5)) * 2.0 / MDCT_M;
+
+	uint8_t *data = calloc(nframes, frame_bytes);
+	double X[2][MDCT_M], mask[2][WAV64_MDCT_BANDS];
+	mdct_channel_t q[2];
+
+	for (int f=0; f<nframes; f++) {
+		for (int ch=0; ch<channels; ch++) {
+			const double *x = signal + ch * padlen + f * MDCT_M;
+			for (int k=0; k<MDCT_M; k++) {
+				double v = 0;
+				for (int n=0; n<MDCT_N; n++)
+					v += basis[k*MDCT_N + n] * x[n];
+				X[ch][k] = v;
+			}
+			mdct_mask(X[ch], freq, mask[ch]);
+		}
+
+		// Search the smallest global scale of the quantization noise
+		// that fits the frame size.
+		int lo = -64, hi = 128;
+		while (lo < hi) {
+			int g = (lo + hi) >> 1;
+			int bits = 0;
+			for (int ch=0; ch<channels; ch++) {
+				mdct_quantize(X[ch], mask[ch], g, &q[ch]);
+				bits += q[ch].bits;
+			}
+			if (bits <= budget) hi = g;
+			else lo = g + 1;
+		}
+
+		bitwriter_t bw = { .buf = data + f * frame_bytes };
+		for (int ch=0; ch<channels; ch++) {
+			mdct_quantize(X[ch], mask[ch], lo, &q[ch]);
+			mdct_put_channel(&bw, &q[ch]);
+		}
+		assert(bw.nbits <= budget);
+	}
+
+	wav64_header_mdct_t mhead;
+	memset(&mhead, 0, sizeof(mhead));
+	mhead.frame_bytes = HOST_TO_BE16(frame_bytes);
+	mhead.num_frames = HOST_TO_BE32(nframes);
+	fwrite(&mhead, 1, sizeof(mhead), out);
+	fwrite(data, 1, nframes * frame_bytes, out);
+
+	if (flag_verbose)
+		fprintf(stderr, "  MDCT: %d frames, %d bytes/frame (%.1f kbps)\n",
+			nframes, frame_bytes, frame_bytes * 8.0 * freq / MDCT_M / 1000);
+
+	free(data);
+	free(basis);
+	free(signal);
+}
 
 int wav_convert(const char *infn, const char *outfn) {
 	drwav wav;
@@ -46,6 +501,44 @@ int wav_convert(const char *infn, const char *outfn) {
 		fprintf(stderr, "WARNING: %s: invalid looping offset: %d (size: %zu)\n", infn, flag_wav_looping_offset, cnt);
 		loop_len = 0;
 	}
+	// Compressed formats always decode to 16-bit samples
+	if (flag_wav_compress)
+		nbits = 16;
+
+	if (loop_len && flag_wav_loop_crossfade) {
+		if (loop_len == cnt)
+			fprintf(stderr, "WARNING: %s: cannot crossfade a loop that starts at the beginning\n", infn);
+		wav_loop_crossfade(samples, cnt, wav.channels, loop_len, flag_wav_loop_crossfade);
+	}
+
+	int freq = wav.sampleRate;
+	if (flag_wav_resample && flag_wav_resample != freq) {
+		double ratio = (double)flag_wav_resample / freq;
+		int out_start, out_cnt;
+		if (loop_len) {
+			// Align the loop: its length must be a whole number of output frames
+			// (and even for 8-bit waveforms, see below). The ratio is adjusted
+			// accordingly, with a negligible change in pitch.
+			int out_loop = nbits == 8 ? 2*lrint(loop_len * ratio / 2) : lrint(loop_len * ratio);
+			if (out_loop < 2) out_loop = 2;
+			ratio = (double)out_loop / loop_len;
+			out_start = lrint((cnt - loop_len) * ratio);
+			out_cnt = out_start + out_loop;
+		} else {
+			out_start = 0;
+			out_cnt = lrint(cnt * ratio);
+		}
+
+		int16_t *resampled = wav_resample(samples, cnt, wav.channels, loop_len,
+			ratio, loop_len ? cnt - loop_len : 0, out_start, out_cnt);
+		free(samples);
+		samples = resampled;
+		if (loop_len)
+			loop_len = out_cnt - out_start;
+		cnt = out_cnt;
+		freq = flag_wav_resample;
+	}
+
 	if (loop_len&1 && nbits==8) {
 		// Odd loop lengths are not supported for 8-bit waveforms because they would
 		// change the 2-byte phase between ROM and RDRAM addresses during loop unrolling.
@@ -54,21 +547,33 @@ int wav_convert(const char *infn, const char *outfn) {
 		loop_len -= 1;
 	}
 
+	// Uncompressed samples can be stored in the sample bank, if requested
+	bool banked = flag_bank && !flag_wav_compress;
+
 	wav64_header_t head;
 	memset(&head, 0, sizeof(wav64_header_t));
 
 	memcpy(head.id, "WV64", 4);
 	head.version = WAV64_FILE_VERSION;
-	head.format = 0;
+	head.format = banked ? WAV64_FORMAT_BANK : flag_wav_compress;
 	head.channels = wav.channels;
 	head.nbits = nbits;
-	head.freq = HOST_TO_BE32(wav.sampleRate);
+	head.freq = HOST_TO_BE32(freq);
 	head.len = HOST_TO_BE32(cnt);
 	head.loop_len = HOST_TO_BE32(loop_len);
-	head.start_offset = HOST_TO_BE32(sizeof(wav64_header_t));
+	int extra_header = 0;
+	switch (head.format) {
+	case WAV64_FORMAT_ADPCM: extra_header = sizeof(wav64_header_adpcm_t); break;
+	case WAV64_FORMAT_MDCT:  extra_header = sizeof(wav64_header_mdct_t); break;
+	case WAV64_FORMAT_BANK:  extra_header = sizeof(wav64_header_bank_t); break;
+	}
+	head.start_offset = HOST_TO_BE32(sizeof(wav64_header_t) + extra_header);
 
-	if (flag_verbose)
+	if (flag_verbose) {
 		fprintf(stderr, "Converting: %s => %s\n", infn, outfn);
+		if (freq != wav.sampleRate)
+			fprintf(stderr, "  Resampled: %d Hz => %d Hz\n", wav.sampleRate, freq);
+	}
 
 	FILE *out = fopen(outfn, "wb");
 	if (!out) {
@@ -80,27 +585,44 @@ int wav_convert(const char *infn, const char *outfn) {
 
 	fwrite(&head, 1, sizeof(wav64_header_t), out);
 
+	if (flag_wav_compress) {
+		if (flag_wav_compress == WAV64_FORMAT_ADPCM)
+			adpcm_write(out, samples, cnt, wav.channels, loop_len);
+		else
+			mdct_write(out, samples, cnt, wav.channels, loop_len, freq);
+		fclose(out);
+		free(samples);
+		drwav_uninit(&wav);
+		return 0;
+	}
+
+	// Amount of data that can be overread by the player.
+	const int OVERREAD_BYTES = 64;
+	int bps = nbits == 8 ? 1 : 2;
+	uint8_t *data = malloc(cnt*wav.channels*bps + OVERREAD_BYTES + wav.channels*bps);
+	uint8_t *dptr = data;
+
 	int16_t *sptr = samples;
 	for (int i=0;i<cnt*wav.channels;i++) {
 		// Write the sample as 16bit or 8bit. Since *sptr is 16-bit big-endian,
 		// the 8bit representation is just the first byte (MSB). Notice
 		// that WAV64 8bit is signed anyway.
-		fwrite(sptr, 1, nbits == 8 ? 1 : 2, out);
+		memcpy(dptr, sptr, bps);
+		dptr += bps;
 		sptr++;
 	}
 
-	// Amount of data that can be overread by the player.
-	const int OVERREAD_BYTES = 64;
 	if (loop_len == 0) {
-		for (int i=0;i<OVERREAD_BYTES;i++)
-			fputc(0, out);
+		memset(dptr, 0, OVERREAD_BYTES);
+		dptr += OVERREAD_BYTES;
 	} else {
 		int idx = cnt - loop_len;
 		int nb = 0;
 		while (nb < OVERREAD_BYTES) {
 			int16_t *sptr = samples + idx*wav.channels;
 			for (int ch=0;ch<wav.channels;ch++) {
-				nb += fwrite(sptr, 1, nbits==8 ? 1 : 2, out);
+				memcpy(dptr, sptr, bps);
+				dptr += bps; nb += bps;
 				sptr++;
 			}
 			idx++;
@@ -109,6 +631,16 @@ int wav_convert(const char *infn, const char *outfn) {
 		}
 	}
 
+	if (banked) {
+		wav64_header_bank_t bhead;
+		bhead.bank_id = HOST_TO_BE32(bank_id());
+		bhead.index = HOST_TO_BE32(bank_add(data, dptr - data));
+		fwrite(&bhead, 1, sizeof(bhead), out);
+	} else {
+		fwrite(data, 1, dptr - data, out);
+	}
+	free(data);
+
 	fclose(out);
 	free(samples);
 	drwav_uninit(&wav);
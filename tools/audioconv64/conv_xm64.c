@@ -30,6 +30,118 @@
 #include "../../src/audio/libxm/context.c"
 #include "../../src/audio/libxm/load.c"
 
+#define ALIGN8(n)  ((((n) + 7) >> 3) << 3)
+
+// Drop the data of the module that can never be played: patterns that are
+// not listed in the pattern order table, instruments that are not referenced
+// by the remaining patterns, and samples that are not mapped to any note of
+// their instrument. Invalid references (which libxm treats as "no instrument"
+// or "no sample") are left untouched, as they stay invalid after the
+// renumbering. The memory required for the context is updated accordingly.
+static void xm_optimize(xm_context_t *ctx) {
+	xm_module_t *mod = &ctx->module;
+	int num_patterns = mod->num_patterns, num_instruments = mod->num_instruments;
+	int dropped_patterns = 0, dropped_instruments = 0, dropped_samples = 0, dropped_bytes = 0;
+
+	// Patterns: keep those in the order table
+	int *pat_map = calloc(num_patterns, sizeof(int));
+	for (int i=0;i<mod->length;i++)
+		if (mod->pattern_table[i] < num_patterns)
+			pat_map[mod->pattern_table[i]] = 1;
+	int n = 0;
+	for (int i=0;i<num_patterns;i++) {
+		xm_pattern_t *p = &mod->patterns[i];
+		int size = ALIGN8(p->num_rows * mod->num_channels * sizeof(xm_pattern_slot_t));
+		if (!pat_map[i]) {
+			ctx->ctx_size -= sizeof(xm_pattern_t) + size;
+			ctx->ctx_size_all_patterns -= size;
+			dropped_patterns++;
+			dropped_bytes += size;
+			continue;
+		}
+		pat_map[i] = n;
+		mod->patterns[n++] = *p;
+	}
+	for (int i=0;i<mod->length;i++)
+		if (mod->pattern_table[i] < num_patterns)
+			mod->pattern_table[i] = pat_map[mod->pattern_table[i]];
+	mod->num_patterns = n;
+	free(pat_map);
+
+	ctx->ctx_size_stream_pattern_buf = 0;
+	for (int i=0;i<mod->num_patterns;i++) {
+		int size = mod->patterns[i].num_rows * mod->num_channels * sizeof(xm_pattern_slot_t);
+		if (ctx->ctx_size_stream_pattern_buf < size)
+			ctx->ctx_size_stream_pattern_buf = size;
+	}
+
+	// Instruments: keep those referenced by the patterns (numbered from 1)
+	int *ins_map = calloc(num_instruments + 1, sizeof(int));
+	for (int i=0;i<mod->num_patterns;i++) {
+		xm_pattern_t *p = &mod->patterns[i];
+		for (int j=0;j<p->num_rows * mod->num_channels;j++)
+			if (p->slots[j].instrument > 0 && p->slots[j].instrument <= num_instruments)
+				ins_map[p->slots[j].instrument] = 1;
+	}
+	n = 0;
+	for (int i=0;i<num_instruments;i++) {
+		xm_instrument_t *ins = &mod->instruments[i];
+		if (!ins_map[i+1]) {
+			ctx->ctx_size -= sizeof(xm_instrument_t);
+			for (int j=0;j<ins->num_samples;j++) {
+				xm_sample_t *s = &ins->samples[j];
+				int size = ALIGN8(s->length * (s->bits / 8) + XM_WAVEFORM_OVERREAD);
+				ctx->ctx_size -= sizeof(xm_sample_t) + size;
+				ctx->ctx_size_all_samples -= size;
+				dropped_bytes += size;
+			}
+			dropped_instruments++;
+			continue;
+		}
+		ins_map[i+1] = ++n;
+		mod->instruments[n-1] = *ins;
+	}
+	for (int i=0;i<mod->num_patterns;i++) {
+		xm_pattern_t *p = &mod->patterns[i];
+		for (int j=0;j<p->num_rows * mod->num_channels;j++)
+			if (p->slots[j].instrument > 0 && p->slots[j].instrument <= num_instruments)
+				p->slots[j].instrument = ins_map[p->slots[j].instrument];
+	}
+	mod->num_instruments = n;
+	free(ins_map);
+
+	// Samples: keep those mapped to at least one note
+	for (int i=0;i<mod->num_instruments;i++) {
+		xm_instrument_t *ins = &mod->instruments[i];
+		int sam_map[256] = {0};
+		for (int k=0;k<NUM_NOTES;k++)
+			if (ins->sample_of_notes[k] < ins->num_samples)
+				sam_map[ins->sample_of_notes[k]] = 1;
+		n = 0;
+		for (int j=0;j<ins->num_samples;j++) {
+			xm_sample_t *s = &ins->samples[j];
+			if (!sam_map[j]) {
+				int size = ALIGN8(s->length * (s->bits / 8) + XM_WAVEFORM_OVERREAD);
+				ctx->ctx_size -= sizeof(xm_sample_t) + size;
+				ctx->ctx_size_all_samples -= size;
+				dropped_samples++;
+				dropped_bytes += size;
+				continue;
+			}
+			sam_map[j] = n;
+			ins->samples[n++] = *s;
+		}
+		for (int k=0;k<NUM_NOTES;k++)
+			if (ins->sample_of_notes[k] < ins->num_samples)
+				ins->sample_of_notes[k] = sam_map[ins->sample_of_notes[k]];
+		ins->num_samples = n;
+	}
+
+	if (flag_verbose && (dropped_patterns || dropped_instruments || dropped_samples))
+		fprintf(stderr, "  * Dropped unused data: %d patterns, %d instruments, %d samples (%d KiB)\n",
+			dropped_patterns, dropped_instruments, dropped_samples, dropped_bytes / 1024);
+}
+
 int xm_convert(const char *infn, const char *outfn) {
 	if (flag_verbose)
 		fprintf(stderr, "Converting: %s => %s\n", infn, outfn);
@@ -55,6 +167,8 @@ int xm_convert(const char *infn, const char *outfn) {
 	if (!ctx) fatal("cannot read XM file: invalid format?");
 	free(xmdata);
 
+	xm_optimize(ctx);
+
 	// Pre-process all waveforms:
 	//   1) Ping-pong loops will be unrolled as regular forward
 	//   2) Repeat initial data after loop end for MIXER_LOOP_OVERREAD bytes
@@ -133,7 +247,6 @@ int xm_convert(const char *infn, const char *outfn) {
 			// required for the context.
 			if (length != s->length*bps)
 			{
-				#define ALIGN8(n)  ((((n) + 7) >> 3) << 3)
 				ctx->ctx_size             -= ALIGN8(s->length*bps);
 				ctx->ctx_size_all_samples -= ALIGN8(s->length*bps);
 				ctx->ctx_size             += ALIGN8(length);
@@ -199,6 +312,32 @@ int xm_convert(const char *infn, const char *outfn) {
 		sam_size += ch_buf[i];
 	}
 
+	// If requested, move the waveforms into the sample bank. The data of
+	// each entry is laid out exactly as xm_context_save would write it in the
+	// XM64 file (big-endian, including the overread), so that it can be shared
+	// with WAV64 files. The XM64 file will refer to the entries by index.
+	if (flag_bank) {
+		for (int i=0;i<ctx->module.num_instruments;i++) {
+			xm_instrument_t *ins = &ctx->module.instruments[i];
+			for (int j=0;j<ins->num_samples;j++) {
+				xm_sample_t *s = &ins->samples[j];
+				int size = s->length * (s->bits / 8) + XM_WAVEFORM_OVERREAD;
+				uint8_t *data = malloc(size);
+				if (s->bits == 8)
+					memcpy(data, s->data8, size);
+				else {
+					for (int k=0;k<size/2;k++) {
+						data[k*2+0] = (uint16_t)s->data16[k] >> 8;
+						data[k*2+1] = (uint16_t)s->data16[k] & 0xFF;
+					}
+				}
+				s->data8_offset = bank_add(data, size);
+				free(data);
+			}
+		}
+		ctx->wave_bank_id = bank_id();
+	}
+
 	FILE *out = fopen(outfn, "wb");
 	if (!out) fatal("cannot create: %s", outfn);
 	xm_context_save(ctx, out);
@@ -207,12 +346,18 @@ int xm_convert(const char *infn, const char *outfn) {
 
 	// Dump some statistics for the conversion
 	if (flag_verbose) {	
+		// Sizes after the optimization and the pre-processing of the waveforms
+		mem_sam = ctx->ctx_size_all_samples;
+		mem_ctx = ctx->ctx_size - ctx->ctx_size_all_samples - ctx->ctx_size_all_patterns;
+
+		// Patterns are streamed one row at a time (see xm_stream_decode_row)
+		int pat_size = ((ctx->module.num_channels * sizeof(xm_pattern_slot_t) + 7) & ~7) + 2 * XM_STREAM_PATTERN_CHUNK_ALLOC;
 		fprintf(stderr, "  * ROM size: %u KiB (samples:%zu)\n",
 			romsize / 1024, mem_sam / 1024);
-		fprintf(stderr, "  * RAM size: %zu KiB (ctx:%zu, patterns:%u, samples:%u)\n",
-			(mem_ctx+sam_size+ctx->ctx_size_stream_pattern_buf)/1024,
+		fprintf(stderr, "  * RAM size: %zu KiB (ctx:%zu, patterns:%u bytes, samples:%u)\n",
+			(mem_ctx+sam_size+pat_size)/1024,
 			mem_ctx / 1024,
-			ctx->ctx_size_stream_pattern_buf / 1024,
+			pat_size,
 			sam_size / 1024
 		);
 		fprintf(stderr, "  * Samples RAM per channel: [");
@@ -228,6 +373,11 @@ int xm_convert(const char *infn, const char *outfn) {
 	// serialization bugs and other mistakes immediately at conversion time.
 	// It's not required if we can't trust our own code, but it's not a big
 	// deal anyway, so better safe than sorry.
+	// Modules referring to a sample bank cannot be reloaded here, as the
+	// waveforms are not available until the bank is written.
+	if (flag_bank)
+		return 0;
+
 	xm_context_t *ctx2;
 	out = fopen(outfn, "rb");
 	if (!out) fatal("cannot open: %s", outfn);
@@ -8,7 +8,7 @@
  *
  *   * Convert from older YM versions (eg: YM3!, YM3b).
  *   * Convert non-interleaved to interleaved.
- *   * Re-compress with LHA -lh5-.
+ *   * Re-compress with LHA -lh5-, in independent blocks to allow seeking.
  *
  */
 
@@ -66,24 +66,29 @@ static void ymwrite(const void *buf, int sz) {
     fwrite(buf, 1, sz, ym_f);
 }
 
-// Compress a file with LHA (algorithm -lh5-). This is done using
-// a stripped down version of https://github.com/jca02266/lha
-// stored as single file in lzh5_compress.c. The library works only
-// through FILE*, so the compression will happen from disk to disk.
-static void lha_compress(const char *outfn, const char *infn) {
-    
-    FILE *in = fopen(infn, "rb");
-    if (!in) fatal("cannot open file: %s\n", infn);
-
-    FILE *out = fopen(outfn, "wb");
-    if (!out) fatal("cannot create file: %s\n", infn);
+// Number of audioframes in each compressed block. Every block is stored as
+// an independent LHA member, so that the player can seek by restarting
+// decompression at the beginning of a block. Smaller blocks make seeking
+// faster, at the expense of compression ratio.
+#define YM64_BLOCK_FRAMES    256
+
+// Compress a buffer with LHA (algorithm -lh5-), appending it as a new member
+// of the archive. This is done using a stripped down version of
+// https://github.com/jca02266/lha stored as single file in lzh5_compress.c.
+// The library works only through FILE*, so the data is first written to a
+// temporary file.
+static void lha_compress_member(FILE *out, const uint8_t *data, int size, const char *lha_fn) {
+    const char *tmpfilename = ".block.tmp";
+    FILE *in = fopen(tmpfilename, "wb");
+    if (!in) fatal("cannot create: %s\n", tmpfilename);
+    fwrite(data, 1, size, in);
+    fclose(in);
+    in = fopen(tmpfilename, "rb");
+    if (!in) fatal("cannot open file: %s\n", tmpfilename);
 
     // Prepare a basic LHA header. Leave most fields empty,
-    // we will fill them later. The YM module itself is a file
-    // within the archive whose name doesn't matter, so we
-    // will use a fixed name of "audioconv64.bin".
+    // we will fill them later.
     lhaheader head; uint16_t crc16 = 0;
-    const char *lha_fn = "audioconv64.bin";
     memset(&head, 0, sizeof(head));
 
     head.size = (sizeof(head)-2) + strlen(lha_fn) + 2;
@@ -91,6 +96,7 @@ static void lha_compress(const char *outfn, const char *infn) {
     head.filename_len = strlen(lha_fn);
 
     // Write (incomplete) header, filename and (to be calculated) crc16.
+    long head_pos = ftell(out);
     fwrite(&head, 1, sizeof(head), out);
     fwrite(lha_fn, 1, strlen(lha_fn), out);
     fwrite(&crc16, 1, 2, out);
@@ -99,6 +105,7 @@ static void lha_compress(const char *outfn, const char *infn) {
     unsigned int crc, dsize, csize;
     lzh5_init(LZHUFF5_METHOD_NUM);
     lzh5_encode(in, out, &crc, &csize, &dsize);
+    long end_pos = ftell(out);
 
     // Complete the header with the information we got.
     head.csize = HOST_TO_LE32(csize);
@@ -117,13 +124,56 @@ static void lha_compress(const char *outfn, const char *infn) {
     head.checksum = csum;
 
     // Write again the header and the crc16 of the file.
-    fseek(out, 0, SEEK_SET);
+    fseek(out, head_pos, SEEK_SET);
     fwrite(&head, 1, sizeof(head), out);
 
-    fseek(out, head.size-2+2, SEEK_SET);
+    fseek(out, head_pos+head.size-2+2, SEEK_SET);
     fwrite(&crc16, 1, 2, out);
+    fseek(out, end_pos, SEEK_SET);
+
+    fclose(in);
+    remove(tmpfilename);
+}
+
+// Compress a YM file with LHA. The YM module is split into multiple
+// files within the archive, whose names don't matter: the first one
+// contains the header and metadata (header_size bytes), and the following
+// ones contain YM64_BLOCK_FRAMES audioframes each (the last one also
+// contains the terminator). Extracting the archive and concatenating
+// the files gives back the original YM module.
+static void lha_compress(const char *outfn, const char *infn, int header_size) {
+    FILE *in = fopen(infn, "rb");
+    if (!in) fatal("cannot open file: %s\n", infn);
+    fseek(in, 0, SEEK_END);
+    int size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    uint8_t *data = malloc(size);
+    fread(data, 1, size, in);
+    fclose(in);
+
+    FILE *out = fopen(outfn, "wb");
+    if (!out) fatal("cannot create file: %s\n", outfn);
+
+    char lha_fn[32]; int idx = 0;
+    snprintf(lha_fn, sizeof(lha_fn), "audioconv64.%03d", idx++);
+    lha_compress_member(out, data, header_size, lha_fn);
+
+    int off = header_size;
+    while (off < size) {
+        int len = MIN(YM64_BLOCK_FRAMES*16, size - off);
+        // Do not leave the terminator alone in its own block
+        if (size - (off+len) < 16)
+            len = size - off;
+        snprintf(lha_fn, sizeof(lha_fn), "audioconv64.%03d", idx++);
+        lha_compress_member(out, data + off, len, lha_fn);
+        off += len;
+    }
+
+    if (flag_verbose)
+        fprintf(stderr, "  compressed in %d blocks of %d frames\n", idx-1, YM64_BLOCK_FRAMES);
 
-    fclose(in); fclose(out);
+    fclose(out);
+    free(data);
 }
 
 int ym_convert(const char *infn, const char *outfn) {
@@ -210,13 +260,14 @@ int ym_convert(const char *infn, const char *outfn) {
         ymwrite(song_name, strlen(song_name)+1);
         ymwrite(song_author, strlen(song_author)+1);
         ymwrite(song_comment, strlen(song_comment)+1);
+        int header_size = ftell(ym_f);
 
         ymwrite(outdata, csize/14*16);
         ymwrite("End!", 4);
         fclose(ym_f);
 
         // Do LHA compression to convert the temporary file into the final file.
-        lha_compress(outfn, tmpfilename);
+        lha_compress(outfn, tmpfilename, header_size);
 
         free(data); free(outdata);
         remove(tmpfilename);
@@ -274,13 +325,14 @@ int ym_convert(const char *infn, const char *outfn) {
         ymwrite(song_name, strlen(song_name)+1);
         ymwrite(song_author, strlen(song_author)+1);
         ymwrite(song_comment, strlen(song_comment)+1);
+        int header_size = ftell(ym_f);
         ymwrite(outdata, datasize);
         ymwrite("End!", 4);
         fclose(ym_f);
 
         // Do LHA compression
         if (flag_ym_compress) {
-            lha_compress(outfn, tmpfilename);
+            lha_compress(outfn, tmpfilename, header_size);
             remove(tmpfilename);
         }
 
@@ -2,14 +2,21 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 #include "../common/binout.h"
+#include "../common/assetcomp.h"
 #include "../common/lzh5_compress.c"
+#include "../common/lzb_compress.c"
 #undef MIN
 #undef MAX
 #include "../../src/asset.c"
 #include "../../src/compress/lzh5.c"
 #include "../../src/compress/lz4_dec.c"
+#include "../../src/compress/lzb_dec.c"
 #include "../../src/compress/ringbuf.c"
 #undef MIN
 #undef MAX
@@ -23,61 +30,187 @@
 #undef MIN
 #undef MAX
 
+/** @brief The LZH5 compressor uses global state, so calls to it must be serialized */
+static pthread_mutex_t lzh5_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-bool asset_compress(const char *infn, const char *outfn, int compression)
+/** @brief True in threads spawned by #asset_compress_parallel (to avoid nested parallelism) */
+static __thread bool asset_compress_in_job = false;
+
+/** @brief Number of threads used to compress the blocks of seekable assets (0 = number of cores) */
+static int asset_compress_block_jobs = 0;
+
+int asset_compress_default_jobs(void)
 {
-    // Make sure the file exists before calling asset_load,
-    // which would just assert.
-    FILE *in = fopen(infn, "rb");
-    if (!in) {
-        fprintf(stderr, "error opening input file: %s\n", infn);
-        return false;
+#ifdef _WIN32
+    const char *env = getenv("NUMBER_OF_PROCESSORS");
+    int n = env ? atoi(env) : 1;
+#else
+    int n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return n > 0 ? n : 1;
+}
+
+/** @brief A block of a seekable asset, compressed by #asset_compress_block */
+typedef struct {
+    uint8_t *data;          ///< Uncompressed data
+    int len;                ///< Length of uncompressed data
+    int compression;        ///< Compression algorithm
+    void *output;           ///< Compressed data (allocated by the job)
+    size_t cmp_size;        ///< Length of compressed data
+} asset_block_t;
+
+static void asset_compress_block(asset_block_t *b)
+{
+    switch (b->compression) {
+    case 1: { // lz4hc
+        int cmp_max_size = LZ4_COMPRESSBOUND(b->len);
+        b->output = malloc(cmp_max_size);
+        b->cmp_size = LZ4_compress_HC((char*)b->data, b->output, b->len, cmp_max_size, LZ4HC_CLEVEL_MAX);
+        assert(b->cmp_size <= cmp_max_size);
+    }   break;
+    case 2: { // lzh5
+        unsigned int crc, dsize, csize;
+        FILE *in = fmemopen(b->data, b->len, "rb");
+        FILE *out = open_memstream((char**)&b->output, &b->cmp_size);
+        pthread_mutex_lock(&lzh5_mutex);
+        lzh5_init(LZHUFF5_METHOD_NUM);
+        lzh5_encode(in, out, &crc, &csize, &dsize);
+        pthread_mutex_unlock(&lzh5_mutex);
+        fclose(out);
+        fclose(in);
+    }   break;
+    case 3: { // lzb
+        b->output = malloc(LZB_COMPRESSBOUND(b->len));
+        b->cmp_size = lzb_compress(b->data, b->len, b->output);
+    }   break;
+    default:
+        assert(0);
     }
-    fclose(in);
+}
 
-    int sz;
-    uint8_t *data = asset_load(infn, &sz);
+/** @brief Queue of jobs shared by the worker threads of #asset_run_jobs */
+typedef struct {
+    pthread_mutex_t lock;   ///< Lock protecting next
+    int next;               ///< Next job to run
+    int count;              ///< Number of jobs
+    void (*run)(void *ctx, int idx);  ///< Function that runs a job
+    void *ctx;              ///< Context for the job function
+} asset_jobs_t;
+
+static void *asset_jobs_worker(void *arg)
+{
+    asset_jobs_t *q = arg;
+    asset_compress_in_job = true;
+    while (1) {
+        pthread_mutex_lock(&q->lock);
+        int idx = q->next++;
+        pthread_mutex_unlock(&q->lock);
+        if (idx >= q->count)
+            break;
+        q->run(q->ctx, idx);
+    }
+    return NULL;
+}
+
+/** @brief Run count jobs on up to num_threads threads, and wait for them to finish */
+static void asset_run_jobs(int count, int num_threads, void (*run)(void *ctx, int idx), void *ctx)
+{
+    if (num_threads > count) num_threads = count;
+    if (num_threads <= 1 || asset_compress_in_job) {
+        for (int i = 0; i < count; i++)
+            run(ctx, i);
+        return;
+    }
+
+    asset_jobs_t q = { .lock = PTHREAD_MUTEX_INITIALIZER, .count = count, .run = run, .ctx = ctx };
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    for (int i = 0; i < num_threads; i++)
+        pthread_create(&threads[i], NULL, asset_jobs_worker, &q);
+    for (int i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+}
+
+static void asset_compress_block_job(void *ctx, int idx)
+{
+    asset_compress_block((asset_block_t*)ctx + idx);
+}
+
+
+/**
+ * @brief Write a seekable compressed asset, made of independently compressed blocks.
+ * 
+ * See #asset_index_t for a description of the format.
+ */
+static void asset_compress_blocks(FILE *out, uint8_t *data, int sz, int compression, int block_size)
+{
+    int num_blocks = (sz + block_size - 1) / block_size;
+
+    fwrite("DCA2", 1, 4, out);
+    w16(out, compression); // algo
+    w16(out, ASSET_FLAG_SEEKABLE); // flags
+    int w_cmp_size = w32_placeholder(out); // cmp_size
+    w32(out, sz); // dec_size
+    w32(out, block_size);
+    w32(out, num_blocks);
+    int w_offsets = ftell(out);
+    for (int i = 0; i < num_blocks; i++)
+        w32(out, 0);
+
+    int data_start = ftell(out);
+
+    // Blocks are independent, so they can be compressed in parallel.
+    asset_block_t *blocks = calloc(num_blocks, sizeof(asset_block_t));
+    for (int i = 0; i < num_blocks; i++) {
+        blocks[i].data = data + i * block_size;
+        blocks[i].len = sz - i * block_size < block_size ? sz - i * block_size : block_size;
+        blocks[i].compression = compression;
+    }
+    int jobs = asset_compress_block_jobs ? asset_compress_block_jobs : asset_compress_default_jobs();
+    asset_run_jobs(num_blocks, jobs, asset_compress_block_job, blocks);
+
+    for (int i = 0; i < num_blocks; i++) {
+        w32_at(out, w_offsets + i*4, ftell(out) - data_start);
+        fwrite(blocks[i].output, 1, blocks[i].cmp_size, out);
+        free(blocks[i].output);
+    }
+    free(blocks);
+
+    w32_at(out, w_cmp_size, ftell(out) - data_start);
+}
 
+/** @brief Write a compressed asset with the specified algorithm (0: uncompressed) */
+static void asset_compress_data(FILE *out, uint8_t *data, int sz, int compression)
+{
     switch (compression) {
     case 0: { // none
-        FILE *out = fopen(outfn, "wb");
-        if (!out) {
-            fprintf(stderr, "error opening output file: %s\n", outfn);
-            return 1;
-        }
         fwrite(data, 1, sz, out);
-        fclose(out);
     }   break;
     case 2: { // lzh5
-        char *tmpfn = NULL;
-        asprintf(&tmpfn, "%s.tmp", outfn);
-        FILE *out = fopen(tmpfn, "wb");
-        if (!out) {
-            fprintf(stderr, "error opening output file: %s\n", tmpfn);
-            return 1;
-        }
-        fwrite(data, 1, sz, out);
-        fclose(out);
-
-        in = fopen(tmpfn, "rb");
-        out = fopen(outfn, "wb");
-        fwrite("DCA2", 1, 4, out);
-        w16(out, 2); // algo
-        w16(out, 0); // flags
-        int w_cmp_size = w32_placeholder(out); // cmp_size
-        int w_dec_size = w32_placeholder(out); // dec_size
+        char *cmp_data = NULL; size_t cmp_len = 0;
+        FILE *in = fmemopen(data, sz, "rb");
+        FILE *mem = open_memstream(&cmp_data, &cmp_len);
 
         unsigned int crc, dsize, csize;
+        pthread_mutex_lock(&lzh5_mutex);
         lzh5_init(LZHUFF5_METHOD_NUM);
-        lzh5_encode(in, out, &crc, &csize, &dsize);
+        lzh5_encode(in, mem, &crc, &csize, &dsize);
+        pthread_mutex_unlock(&lzh5_mutex);
+        fclose(mem);
+        fclose(in);
 
-        w32_at(out, w_cmp_size, csize);
-        w32_at(out, w_dec_size, dsize);
+        // Compute the margin for in-place decompression, and store it
+        // right after the header.
+        unsigned int margin = lzh5_inplace_margin((uint8_t*)cmp_data, csize, dsize);
 
-        fclose(in);
-        fclose(out);
-        remove(tmpfn);
-        free(tmpfn);
+        fwrite("DCA2", 1, 4, out);
+        w16(out, 2); // algo
+        w16(out, ASSET_FLAG_INPLACE); // flags
+        w32(out, csize); // cmp_size
+        w32(out, dsize); // dec_size
+        w32(out, margin); // inplace margin
+        fwrite(cmp_data, 1, csize, out);
+        free(cmp_data);
     }   break;
     case 1: { // lz4hc
         int cmp_max_size = LZ4_COMPRESSBOUND(sz);
@@ -85,19 +218,190 @@ bool asset_compress(const char *infn, const char *outfn, int compression)
         int cmp_size = LZ4_compress_HC((char*)data, output, sz, cmp_max_size, LZ4HC_CLEVEL_MAX);
         assert(cmp_size <= cmp_max_size);
 
-        FILE *out = fopen(outfn, "wb");
         fwrite("DCA2", 1, 4, out);
         w16(out, 1); // algo
         w16(out, 0); // flags
         w32(out, cmp_size); // cmp_size
         w32(out, sz); // dec_size
         fwrite(output, 1, cmp_size, out);
-        fclose(out);
         free(output);
     }   break;
+    case 3: { // lzb
+        void *output = malloc(LZB_COMPRESSBOUND(sz));
+        int cmp_size = lzb_compress(data, sz, output);
+
+        fwrite("DCA2", 1, 4, out);
+        w16(out, 3); // algo
+        w16(out, 0); // flags
+        w32(out, cmp_size); // cmp_size
+        w32(out, sz); // dec_size
+        fwrite(output, 1, cmp_size, out);
+        free(output);
+    }   break;
+    default:
+        assert(0);
+    }
+}
+
+bool asset_compress_mem(const uint8_t *data, int sz, int compression, uint8_t **out, size_t *out_size)
+{
+    char *buf = NULL; size_t len = 0;
+    FILE *mem = open_memstream(&buf, &len);
+    if (!mem)
+        return false;
+    asset_compress_data(mem, (uint8_t*)data, sz, compression);
+    fclose(mem);
+    *out = (uint8_t*)buf;
+    *out_size = len;
+    return true;
+}
+
+const asset_cost_model_t asset_default_cost_model = {
+    .rom_cpb = 18.0f,                                // ~5 MiB/s
+    .decode_cpb = { 0.0f, 4.0f, 40.0f, 3.0f },       // none, lz4, lzh5, lzb
+};
+
+/** @brief Configuration of the automatic selection of the compression algorithm */
+static struct {
+    int policy;                 ///< Policy (ASSET_OPTIMIZE_*)
+    unsigned algos;             ///< Bitmask of the algorithms to try
+    asset_cost_model_t model;   ///< Cost model
+    bool verbose;               ///< Print the choice for each file
+} asset_auto = { ASSET_OPTIMIZE_BALANCED, 0x7, {
+    .rom_cpb = 18.0f, .decode_cpb = { 0.0f, 4.0f, 40.0f, 3.0f },   // asset_default_cost_model
+}, false };
+
+void asset_compress_set_policy(int policy, unsigned algos, const asset_cost_model_t *model, bool verbose)
+{
+    asset_auto.policy = policy;
+    asset_auto.algos = algos ? algos : 1;
+    asset_auto.model = model ? *model : asset_default_cost_model;
+    asset_auto.verbose = verbose;
+}
+
+/** @brief Estimated time to load a file of the specified algorithm, in microseconds */
+static float asset_estimate_load_us(int algo, size_t file_size, int sz)
+{
+    const asset_cost_model_t *m = &asset_auto.model;
+    float io = m->rom_cpb * file_size;
+    float dec = m->decode_cpb[algo] * sz;
+    // LZ4 is decompressed while the DMA from ROM is still running (see
+    // decompress_lz4_full), so the two costs overlap.
+    float cycles = algo == 1 ? (io > dec ? io : dec) : io + dec;
+    return cycles / 93.75f;
+}
+
+int asset_compress_choose(const uint8_t *data, int sz, size_t *out_size, float *out_us)
+{
+    size_t size[4] = { SIZE_MAX, SIZE_MAX, SIZE_MAX, SIZE_MAX };
+    float us[4] = { 1e30f, 1e30f, 1e30f, 1e30f };
+    int best_time = -1, best_size = -1;
+
+    for (int algo = 0; algo < 4; algo++) {
+        if (!(asset_auto.algos & (1 << algo)))
+            continue;
+        uint8_t *out; size_t len;
+        if (!asset_compress_mem(data, sz, algo, &out, &len))
+            continue;
+        free(out);
+        size[algo] = len;
+        us[algo] = asset_estimate_load_us(algo, len, sz);
+        if (best_time < 0 || us[algo] < us[best_time]) best_time = algo;
+        if (best_size < 0 || len < size[best_size]) best_size = algo;
+    }
+    assert(best_time >= 0);
+
+    int algo = best_time;
+    switch (asset_auto.policy) {
+    case ASSET_OPTIMIZE_SIZE:
+        algo = best_size;
+        break;
+    case ASSET_OPTIMIZE_LOAD_TIME:
+        algo = best_time;
+        break;
+    case ASSET_OPTIMIZE_BALANCED:
+        // The smallest file whose load time is close enough to the best one
+        for (int i = 0; i < 4; i++) {
+            if ((asset_auto.algos & (1 << i)) && us[i] <= us[best_time] * 1.1f && size[i] < size[algo])
+                algo = i;
+        }
+        break;
     default:
         assert(0);
     }
 
+    if (out_size) *out_size = size[algo];
+    if (out_us) *out_us = us[algo];
+    return algo;
+}
+
+bool asset_compress_seekable(const char *infn, const char *outfn, int compression, int block_size)
+{
+    // Make sure the file exists before calling asset_load,
+    // which would just assert.
+    FILE *in = fopen(infn, "rb");
+    if (!in) {
+        fprintf(stderr, "error opening input file: %s\n", infn);
+        return false;
+    }
+    fclose(in);
+
+    int sz;
+    uint8_t *data = asset_load(infn, &sz);
+
+    if (compression == COMPRESSION_AUTO) {
+        size_t cmp_size; float us;
+        compression = asset_compress_choose(data, sz, &cmp_size, &us);
+        if (asset_auto.verbose)
+            printf("%s: selected algo=%d (%zu bytes, estimated load time %.0f us)\n", infn, compression, cmp_size, us);
+    }
+
+    if (compression && block_size) {
+        FILE *out = fopen(outfn, "wb");
+        if (!out) {
+            fprintf(stderr, "error opening output file: %s\n", outfn);
+            return false;
+        }
+        asset_compress_blocks(out, data, sz, compression, block_size);
+        fclose(out);
+        return true;
+    }
+
+    FILE *out = fopen(outfn, "wb");
+    if (!out) {
+        fprintf(stderr, "error opening output file: %s\n", outfn);
+        return false;
+    }
+    asset_compress_data(out, data, sz, compression);
+    fclose(out);
     return true;
 }
+
+bool asset_compress(const char *infn, const char *outfn, int compression)
+{
+    return asset_compress_seekable(infn, outfn, compression, 0);
+}
+
+/** @brief Arguments of #asset_compress_parallel, shared by all jobs */
+typedef struct {
+    const char **infn;      ///< Input filenames
+    const char **outfn;     ///< Output filenames
+    int compression;        ///< Compression algorithm
+    int block_size;         ///< Block size for seekable assets (0 = not seekable)
+    bool ok;                ///< Set to false if any file fails
+} asset_batch_t;
+
+static void asset_compress_file_job(void *ctx, int idx)
+{
+    asset_batch_t *b = ctx;
+    if (!asset_compress_seekable(b->infn[idx], b->outfn[idx], b->compression, b->block_size))
+        b->ok = false;
+}
+
+bool asset_compress_parallel(const char **infn, const char **outfn, int count, int compression, int block_size, int jobs)
+{
+    asset_batch_t b = { infn, outfn, compression, block_size, true };
+    asset_compress_block_jobs = jobs;
+    asset_run_jobs(count, jobs, asset_compress_file_job, &b);
+    return b.ok;
+}
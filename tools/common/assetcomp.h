@@ -3,6 +3,49 @@
 
 #define DEFAULT_COMPRESSION     1
 
+// Compression value that selects the algorithm of each file, by estimating
+// the cost of loading it on the console (see asset_compress_set_policy).
+#define COMPRESSION_AUTO        -1
+
+// Policies of the automatic selection of the compression algorithm
+#define ASSET_OPTIMIZE_SIZE         0   // Smallest file
+#define ASSET_OPTIMIZE_LOAD_TIME    1   // Shortest estimated load time
+#define ASSET_OPTIMIZE_BALANCED     2   // Smallest file within 10% of the shortest load time
+
+// Estimated costs of loading an asset on the console, in VR4300 cycles
+// (93.75 MHz) per byte. They can be calibrated with asset_stats_dump() on
+// the console: the decoding cost of an algorithm is 93.75 / "dec MB/s",
+// and the ROM cost is 93.75 * "io (us)" / cmp_size of an uncompressed file.
+typedef struct {
+    float rom_cpb;          // Transfer from ROM (per byte of the file)
+    float decode_cpb[4];    // Decompression (per decompressed byte), per algorithm
+} asset_cost_model_t;
+
+// Default cost model (approximate figures for a retail console)
+extern const asset_cost_model_t asset_default_cost_model;
+
+// Configure the selection done with COMPRESSION_AUTO: the policy, the
+// bitmask of the algorithms to try (bit N = level N), and the cost model
+// (NULL for the default one). If verbose, the choice is printed for each file.
+void asset_compress_set_policy(int policy, unsigned algos, const asset_cost_model_t *model, bool verbose);
+
+// Choose the algorithm for a buffer according to the configured policy.
+// Returns the level, and optionally the size of the compressed file and
+// its estimated load time in microseconds.
+int asset_compress_choose(const uint8_t *data, int sz, size_t *out_size, float *out_us);
+
 bool asset_compress(const char *infn, const char *outfn, int compression);
+bool asset_compress_seekable(const char *infn, const char *outfn, int compression, int block_size);
+
+// Compress a buffer in memory, producing the same contents of asset_compress.
+// The output buffer is allocated with malloc.
+bool asset_compress_mem(const uint8_t *data, int sz, int compression, uint8_t **out, size_t *out_size);
+
+// Compress multiple files using up to "jobs" threads. Each file is compressed
+// by a single thread, so the output is the same of asset_compress_seekable.
+bool asset_compress_parallel(const char **infn, const char **outfn, int count, int compression, int block_size, int jobs);
+
+// Number of host cores, used as default number of jobs
+int asset_compress_default_jobs(void);
 
 #endif
@@ -0,0 +1,125 @@
+// LZB compressor (see src/compress/lzb_dec_internal.h for the format).
+// This is a simple hash-chain matcher with one step of lazy evaluation,
+// which gets within a few percent of optimal parsing for this format.
+
+#include "lzb_compress.h"
+#include "../../src/compress/lzb_dec_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define LZB_HASH_BITS       15
+#define LZB_MAX_CHAIN       256
+
+static inline uint32_t lzb_hash(const uint8_t *p)
+{
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    return (v * 2654435761u) >> (32 - LZB_HASH_BITS);
+}
+
+typedef struct {
+    const uint8_t *src;
+    int src_size;
+    int *head;
+    int *prev;
+    int inserted;     // Next position to insert in the hash chains
+} lzb_matcher_t;
+
+static void lzb_insert_upto(lzb_matcher_t *m, int pos)
+{
+    while (m->inserted <= pos && m->inserted + LZB_MIN_MATCH <= m->src_size) {
+        uint32_t h = lzb_hash(m->src + m->inserted);
+        m->prev[m->inserted % LZB_MAX_OFFSET] = m->head[h];
+        m->head[h] = m->inserted;
+        m->inserted++;
+    }
+}
+
+static int lzb_find_match(lzb_matcher_t *m, int pos, int *out_offset)
+{
+    int best_len = 0;
+    int max_len = m->src_size - pos;
+    if (max_len > LZB_MAX_MATCH) max_len = LZB_MAX_MATCH;
+    if (max_len < LZB_MIN_MATCH) return 0;
+
+    lzb_insert_upto(m, pos);
+
+    int cand = m->prev[pos % LZB_MAX_OFFSET];
+    for (int chain = 0; cand >= 0 && pos - cand < LZB_MAX_OFFSET && chain < LZB_MAX_CHAIN; chain++) {
+        const uint8_t *a = m->src + cand, *b = m->src + pos;
+        if (a[best_len] == b[best_len]) {
+            int len = 0;
+            while (len < max_len && a[len] == b[len]) len++;
+            if (len > best_len) {
+                best_len = len;
+                *out_offset = pos - cand;
+                if (len == max_len) break;
+            }
+        }
+        int next = m->prev[cand % LZB_MAX_OFFSET];
+        if (next >= cand) break;   // Slot was reused by a newer position
+        cand = next;
+    }
+
+    return best_len >= LZB_MIN_MATCH ? best_len : 0;
+}
+
+static uint8_t* lzb_emit_literals(uint8_t *dst, const uint8_t *lit, int n)
+{
+    while (n > 0) {
+        int len = n > LZB_MAX_LITERALS ? LZB_MAX_LITERALS : n;
+        *dst++ = len - 1;
+        memcpy(dst, lit, len);
+        dst += len;
+        lit += len;
+        n -= len;
+    }
+    return dst;
+}
+
+int lzb_compress(const uint8_t *src, int src_size, uint8_t *dst)
+{
+    lzb_matcher_t m = {
+        .src = src, .src_size = src_size,
+        .head = malloc(sizeof(int) << LZB_HASH_BITS),
+        .prev = malloc(sizeof(int) * LZB_MAX_OFFSET),
+    };
+    memset(m.head, 0xFF, sizeof(int) << LZB_HASH_BITS);
+    memset(m.prev, 0xFF, sizeof(int) * LZB_MAX_OFFSET);
+
+    uint8_t *out = dst;
+    int lit_start = 0;
+    int pos = 0;
+
+    while (pos < src_size) {
+        int offset = 0;
+        int len = lzb_find_match(&m, pos, &offset);
+        if (len && pos + 1 < src_size) {
+            // Lazy evaluation: if the next position has a longer match,
+            // emit this byte as a literal instead.
+            int offset2 = 0;
+            int len2 = lzb_find_match(&m, pos + 1, &offset2);
+            if (len2 > len) {
+                pos++;
+                continue;
+            }
+        }
+        if (!len) {
+            pos++;
+            continue;
+        }
+
+        out = lzb_emit_literals(out, src + lit_start, pos - lit_start);
+        *out++ = 0x80 | (len - LZB_MIN_MATCH);
+        *out++ = (offset - 1) >> 8;
+        *out++ = (offset - 1) & 0xFF;
+        pos += len;
+        lit_start = pos;
+    }
+    out = lzb_emit_literals(out, src + lit_start, pos - lit_start);
+
+    free(m.head);
+    free(m.prev);
+    assert(out - dst <= LZB_COMPRESSBOUND(src_size));
+    return out - dst;
+}
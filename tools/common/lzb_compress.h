@@ -0,0 +1,14 @@
+#ifndef LZB_COMPRESS_H
+#define LZB_COMPRESS_H
+
+#include <stdint.h>
+
+/* Maximum size of the compressed output for an input of the given size
+   (worst case: all literals). */
+#define LZB_COMPRESSBOUND(sz)       ((sz) + ((sz) + 127) / 128 + 16)
+
+/* Compress a buffer with LZB (compression level 3). The output buffer must
+   be at least LZB_COMPRESSBOUND(src_size) bytes. Returns the compressed size. */
+int lzb_compress(const uint8_t *src, int src_size, uint8_t *dst);
+
+#endif
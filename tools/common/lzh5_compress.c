@@ -4,6 +4,7 @@
 // when something isn't right.
 
 #include "lzh5_compress.h"
+#include "../../src/compress/lzh5_internal.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
@@ -1015,10 +1016,11 @@ encode_alloc(
     dicsiz = (((unsigned long)1) << dicbit);
     txtsiz = dicsiz*2+maxmatch;
 
+    /* buf is released at the end of each encoding, so that it must be
+       reallocated when encoding multiple streams */
+    if (!buf) alloc_buf();
     if (hash) return method;
 
-    alloc_buf();
-
     hash = (struct hash*)malloc(HSHSIZ * sizeof(struct hash));
     prev = (unsigned int*)malloc(MAX_DICSIZ * sizeof(unsigned int));
     text = (unsigned char*)malloc(TXTSIZ);
@@ -1272,3 +1274,32 @@ lzh5_encode(FILE *in, FILE *out, unsigned int *out_crc, unsigned int *out_csize,
     if (out_dsize) *out_dsize = count;
     if (out_crc) *out_crc = crc;
 }
+
+unsigned int
+lzh5_inplace_margin(const uint8_t *cmp, unsigned int csize, unsigned int dsize)
+{
+    /* Run the decoder one byte at a time, checking how much input it has
+       consumed when each output byte is produced. When decompressing in-place,
+       the output byte k must not overwrite compressed data not read yet,
+       so the compressed data must start at least at k+1-consumed. */
+    FILE *in = fmemopen((void*)cmp, csize, "rb");
+    void *state = malloc(DECOMPRESS_LZH5_STATE_SIZE);
+    long min_cmp_offset = 0;
+
+    decompress_lzh5_init(state, in);
+    for (unsigned int k = 0; k < dsize; k++) {
+        uint8_t byte;
+        if (decompress_lzh5_read(state, &byte, 1) != 1)
+            fatal_error("lzh5_inplace_margin: decompression error at %u/%u", k, dsize);
+        long dist = (long)k + 1 - ftell(in);
+        if (dist > min_cmp_offset) min_cmp_offset = dist;
+    }
+
+    free(state);
+    fclose(in);
+
+    /* Margin is the distance between the end of the decompressed data and
+       the end of the compressed data */
+    long margin = min_cmp_offset + (long)csize - (long)dsize;
+    return margin > 0 ? margin : 0;
+}
@@ -2,6 +2,7 @@
 #define LZH5_COMPRESS_H
 
 #include <stdio.h>
+#include <stdint.h>
 
 #define LZHUFF5_METHOD_NUM      5
 #define LZHUFF6_METHOD_NUM      6
@@ -12,4 +13,8 @@ void lzh5_init(int method);
 void lzh5_encode(FILE *in, FILE *out,
 	unsigned int *out_crc, unsigned int *out_csize, unsigned int *out_dsize);
 
+/* Compute the margin required to decompress in-place a compressed stream
+   (see decompress_lzh5_full_inplace). */
+unsigned int lzh5_inplace_margin(const uint8_t *cmp, unsigned int csize, unsigned int dsize);
+
 #endif 
@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../common/binout.c"
+#include "../common/assetcomp.c"
+
+// decbench: host build of the runtime decompressors of libdragon (the same
+// sources used on the console, see src/compress), to benchmark and fuzz them
+// quickly, before validating changes on real hardware.
+
+bool flag_verbose = false;
+
+/** @brief Names of the compression algorithms (as in mkasset) */
+static const char *algo_names[] = { "none", "lz4", "lzh5", "lzb" };
+
+void print_args(char * name)
+{
+    fprintf(stderr, "%s -- Libdragon decompressors benchmark and fuzzer\n\n", name);
+    fprintf(stderr, "This tool compresses each input file in memory, and measures the decoding\n");
+    fprintf(stderr, "throughput of the runtime decompressors of libdragon, built for the host.\n");
+    fprintf(stderr, "LZ4 is also compared with the reference decoder (tools/common/lz4.c).\n\n");
+    fprintf(stderr, "Usage: %s [flags] <input files...>\n", name);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Command-line flags:\n");
+    fprintf(stderr, "   -v/--verbose          Verbose output\n");
+    fprintf(stderr, "   -c/--compress <algo>  Only test one algorithm: 1=lz4, 2=lzh5, 3=lzb (default: all)\n");
+    fprintf(stderr, "   -t/--time <ms>        Minimum time spent decoding each file (default: 200)\n");
+    fprintf(stderr, "   -f/--fuzz <num>       Instead of benchmarking, decode <num> randomly corrupted\n");
+    fprintf(stderr, "                         copies of each compressed file (build with \"make asan\"\n");
+    fprintf(stderr, "                         to catch out of bounds accesses)\n");
+    fprintf(stderr, "   -s/--seed <num>       Seed of the fuzzer (default: 1)\n");
+    fprintf(stderr, "\n");
+}
+
+/** @brief Current time in seconds */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** @brief Decode a buffer with the runtime decompressor of an algorithm */
+static int decode(int algo, const uint8_t *src, int src_size, uint8_t *dst, int dst_size)
+{
+    switch (algo) {
+    case 1: return decompress_lz4_full_mem(src, src_size, dst, dst_size, false);
+    case 2: return decompress_lzh5_full_mem(src, src_size, dst, dst_size);
+    case 3: return decompress_lzb_full_mem(src, src_size, dst, dst_size);
+    default: assert(0); return -1;
+    }
+}
+
+/** @brief Decode a buffer with the reference LZ4 decoder */
+static int decode_ref(int algo, const uint8_t *src, int src_size, uint8_t *dst, int dst_size)
+{
+    return LZ4_decompress_safe((const char*)src, (char*)dst, src_size, dst_size);
+}
+
+/**
+ * @brief Measure the throughput of a decoder
+ *
+ * The buffer is decoded repeatedly for at least the specified time, and
+ * the output is checked against the original data.
+ *
+ * @return The throughput in MiB/s (of decompressed data), or -1 on mismatch
+ */
+static double bench(int (*dec)(int, const uint8_t*, int, uint8_t*, int), int algo,
+    const uint8_t *cmp, int cmp_size, const uint8_t *data, int size, double min_time)
+{
+    uint8_t *dst = malloc(size);
+    int runs = 0;
+    double t0 = now(), elapsed;
+    do {
+        int n = dec(algo, cmp, cmp_size, dst, size);
+        if (n != size || memcmp(dst, data, size) != 0) {
+            free(dst);
+            return -1;
+        }
+        runs++;
+    } while ((elapsed = now() - t0) < min_time);
+    free(dst);
+    return (double)size * runs / elapsed / (1024 * 1024);
+}
+
+/** @brief xorshift32, so that fuzzing runs are reproducible */
+static uint32_t fuzz_state = 1;
+static uint32_t fuzz_rand(void)
+{
+    uint32_t x = fuzz_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 5;
+    return fuzz_state = x;
+}
+
+/**
+ * @brief Decode randomly corrupted copies of a compressed buffer
+ *
+ * Each copy has a few random bytes changed, and might be truncated. The
+ * decoder is expected to either fail, or produce at most the requested
+ * number of bytes, without crashing (or being reported by AddressSanitizer).
+ */
+static void fuzz(int algo, const char *fn, const uint8_t *cmp, int cmp_size, int size, int iterations)
+{
+    int failed = 0, ok = 0, corrupted = 0;
+    for (int i = 0; i < iterations; i++) {
+        int len = cmp_size;
+        if (fuzz_rand() % 4 == 0)
+            len = fuzz_rand() % (cmp_size + 1);
+        // Exact allocations, so that AddressSanitizer catches any overflow
+        uint8_t *src = malloc(len ? len : 1);
+        uint8_t *dst = malloc(size);
+        memcpy(src, cmp, len);
+        int nflips = 1 + fuzz_rand() % 8;
+        for (int j = 0; len && j < nflips; j++)
+            src[fuzz_rand() % len] ^= 1 << (fuzz_rand() % 8);
+
+        int n = decode(algo, src, len, dst, size);
+        if (n < 0) failed++;
+        else if (n == size) ok++;
+        else corrupted++;
+        if (n > size) {
+            fprintf(stderr, "%s: %s: decoder wrote %d bytes (max: %d) at iteration %d\n",
+                fn, algo_names[algo], n, size, i);
+            exit(1);
+        }
+        free(src);
+        free(dst);
+    }
+    printf("%-32s %-5s %d iterations: %d errors, %d short, %d full\n",
+        fn, algo_names[algo], iterations, failed, corrupted, ok);
+}
+
+int main(int argc, char *argv[])
+{
+    int only_algo = 0;
+    int min_time_ms = 200;
+    int fuzz_iterations = 0;
+    int num_files = 0;
+    bool error = false;
+
+    if (argc < 2) {
+        print_args(argv[0]);
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-') {
+            int *intarg = NULL;
+            if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+                print_args(argv[0]);
+                return 0;
+            } else if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
+                flag_verbose = true;
+                continue;
+            } else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--compress")) {
+                intarg = &only_algo;
+            } else if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--time")) {
+                intarg = &min_time_ms;
+            } else if (!strcmp(argv[i], "-f") || !strcmp(argv[i], "--fuzz")) {
+                intarg = &fuzz_iterations;
+            } else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--seed")) {
+                intarg = (int*)&fuzz_state;
+            } else {
+                fprintf(stderr, "invalid flag: %s\n", argv[i]);
+                return 1;
+            }
+            if (++i == argc) {
+                fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                return 1;
+            }
+            char extra;
+            if (sscanf(argv[i], "%d%c", intarg, &extra) != 1) {
+                fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                return 1;
+            }
+            if (only_algo < 0 || only_algo > 3) {
+                fprintf(stderr, "invalid compression algorithm: %d\n", only_algo);
+                return 1;
+            }
+            if (!fuzz_state) fuzz_state = 1;
+            continue;
+        }
+
+        const char *fn = argv[i];
+        FILE *f = fopen(fn, "rb");
+        if (!f) {
+            fprintf(stderr, "cannot open file: %s\n", fn);
+            error = true;
+            continue;
+        }
+        fseek(f, 0, SEEK_END);
+        int size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        uint8_t *data = malloc(size ? size : 1);
+        if (fread(data, 1, size, f) != size) {
+            fprintf(stderr, "cannot read file: %s\n", fn);
+            error = true;
+            fclose(f);
+            free(data);
+            continue;
+        }
+        fclose(f);
+        num_files++;
+
+        for (int algo = 1; algo <= 3; algo++) {
+            if (only_algo && algo != only_algo)
+                continue;
+
+            asset_block_t b = { .data = data, .len = size, .compression = algo };
+            asset_compress_block(&b);
+
+            if (fuzz_iterations) {
+                fuzz(algo, fn, b.output, b.cmp_size, size, fuzz_iterations);
+                free(b.output);
+                continue;
+            }
+
+            double mbs = bench(decode, algo, b.output, b.cmp_size, data, size, min_time_ms / 1000.0);
+            if (mbs < 0) {
+                fprintf(stderr, "%s: %s: decompressed data does not match the original\n", fn, algo_names[algo]);
+                error = true;
+                free(b.output);
+                continue;
+            }
+            printf("%-32s %-5s %8d -> %8zu bytes (%5.1f%%) %9.1f MiB/s",
+                fn, algo_names[algo], size, b.cmp_size, b.cmp_size * 100.0 / (size ? size : 1), mbs);
+            if (algo == 1) {
+                double ref = bench(decode_ref, algo, b.output, b.cmp_size, data, size, min_time_ms / 1000.0);
+                if (ref > 0)
+                    printf("  (reference: %9.1f MiB/s, %+.1f%%)", ref, (mbs - ref) * 100.0 / ref);
+            }
+            printf("\n");
+            free(b.output);
+        }
+        free(data);
+    }
+
+    if (!num_files && !error) {
+        fprintf(stderr, "no input files\n");
+        return 1;
+    }
+    return error ? 1 : 0;
+}
@@ -20,14 +20,56 @@ void print_args(char * name)
     fprintf(stderr, "Command-line flags:\n");
     fprintf(stderr, "   -v/--verbose          Verbose output\n");
     fprintf(stderr, "   -o/--output <dir>     Specify output directory (default: .)\n");
-    fprintf(stderr, "   -c/--compress <algo>  Compression: 0=none, 1=lha, 2=lzh5 (default: %d)\n", DEFAULT_COMPRESSION);
+    fprintf(stderr, "   -c/--compress <algo>  Compression: 0=none, 1=lz4, 2=lzh5, 3=lzb (default: %d)\n", DEFAULT_COMPRESSION);
+    fprintf(stderr, "   -s/--seekable <kib>   Compress in independent blocks of <kib> KiB, adding a block\n");
+    fprintf(stderr, "                         index so that asset_fopen() can seek (default: off)\n");
+    fprintf(stderr, "   -j/--jobs <num>       Number of files/blocks to compress in parallel (default: number of cores)\n");
     fprintf(stderr, "\n");
+    fprintf(stderr, "Automatic selection of the compression (per file):\n");
+    fprintf(stderr, "   --optimize=<policy>   Try several algorithms on each file, and choose by estimating the\n");
+    fprintf(stderr, "                         load time on the console. Policies: size, load-time, balanced\n");
+    fprintf(stderr, "                         (smallest file within 10%% of the shortest load time)\n");
+    fprintf(stderr, "   --algos <list>        Algorithms to try, eg: 0,1,2 (default: 0,1,2). Levels 2 and 3 require\n");
+    fprintf(stderr, "                         asset_init_compression() in the game\n");
+    fprintf(stderr, "   --model <costs>       Costs in CPU cycles per byte, eg: rom=18,lz4=4,lzh5=40,lzb=3\n");
+    fprintf(stderr, "                         (default: as in the example). Calibrate them with asset_stats_dump():\n");
+    fprintf(stderr, "                         the decoding cost is 93.75 / \"dec MB/s\"\n");
+    fprintf(stderr, "\n");
+}
+
+/** @brief Parse a cost model in the format of --model */
+static bool parse_model(char *arg, asset_cost_model_t *model)
+{
+    static const char *names[] = { "none", "lz4", "lzh5", "lzb" };
+    for (char *tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+        char name[16]; float cpb; char extra;
+        if (sscanf(tok, "%15[^=]=%f%c", name, &cpb, &extra) != 2 || cpb < 0)
+            return false;
+        if (!strcmp(name, "rom")) {
+            model->rom_cpb = cpb;
+            continue;
+        }
+        int algo = 0;
+        while (algo < 4 && strcmp(name, names[algo])) algo++;
+        if (algo == 4)
+            return false;
+        model->decode_cpb[algo] = cpb;
+    }
+    return true;
 }
 
 int main(int argc, char *argv[])
 {
     char *infn = NULL, *outdir = ".", *outfn = NULL;
     int compression = DEFAULT_COMPRESSION;
+    int block_size = 0;
+    int jobs = asset_compress_default_jobs();
+    const char **infns = calloc(argc, sizeof(char*));
+    const char **outfns = calloc(argc, sizeof(char*));
+    int num_files = 0;
+    int policy = -1;
+    unsigned algos = 0x7;
+    asset_cost_model_t model = asset_default_cost_model;
 
     if (argc < 2) {
         print_args(argv[0]);
@@ -57,10 +99,72 @@ int main(int argc, char *argv[])
                     fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
                     return 1;
                 }
-                if (compression < 0 || compression > 2) {
+                if (compression < 0 || compression > 3) {
                     fprintf(stderr, "invalid compression algorithm: %d\n", compression);
                     return 1;
                 }
+            } else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--seekable")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%d%c", &block_size, &extra) != 1 || block_size <= 0) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+                block_size *= 1024;
+            } else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%d%c", &jobs, &extra) != 1 || jobs <= 0) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+            } else if (!strcmp(argv[i], "--optimize") || !strncmp(argv[i], "--optimize=", 11)) {
+                const char *arg = argv[i] + 10;
+                if (*arg == '=') {
+                    arg++;
+                } else if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                } else {
+                    arg = argv[i];
+                }
+                if (!strcmp(arg, "size")) policy = ASSET_OPTIMIZE_SIZE;
+                else if (!strcmp(arg, "load-time")) policy = ASSET_OPTIMIZE_LOAD_TIME;
+                else if (!strcmp(arg, "balanced")) policy = ASSET_OPTIMIZE_BALANCED;
+                else {
+                    fprintf(stderr, "invalid argument for --optimize: %s\n", arg);
+                    return 1;
+                }
+                compression = COMPRESSION_AUTO;
+            } else if (!strcmp(argv[i], "--algos")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                algos = 0;
+                for (char *tok = strtok(argv[i], ","); tok; tok = strtok(NULL, ",")) {
+                    int algo; char extra;
+                    if (sscanf(tok, "%d%c", &algo, &extra) != 1 || algo < 0 || algo > 3) {
+                        fprintf(stderr, "invalid compression algorithm: %s\n", tok);
+                        return 1;
+                    }
+                    algos |= 1 << algo;
+                }
+            } else if (!strcmp(argv[i], "--model")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                if (!parse_model(argv[i], &model)) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
             } else {
                 fprintf(stderr, "invalid flag: %s\n", argv[i]);
                 return 1;
@@ -74,11 +178,26 @@ int main(int argc, char *argv[])
 
         asprintf(&outfn, "%s/%s", outdir, basename);
 
-        if (flag_verbose)
-            printf("Compressing: %s => %s [algo=%d]\n", infn, outfn, compression);
-
-        asset_compress(infn, outfn, compression);
+        if (flag_verbose) {
+            if (compression == COMPRESSION_AUTO)
+                printf("Compressing: %s => %s [algo=auto]\n", infn, outfn);
+            else
+                printf("Compressing: %s => %s [algo=%d]\n", infn, outfn, compression);
+        }
 
-        free(outfn);
+        infns[num_files] = infn;
+        outfns[num_files] = outfn;
+        num_files++;
     }
+
+    if (compression == COMPRESSION_AUTO)
+        asset_compress_set_policy(policy, algos, &model, flag_verbose);
+
+    bool ok = asset_compress_parallel(infns, outfns, num_files, compression, block_size, jobs);
+
+    for (int i = 0; i < num_files; i++)
+        free((char*)outfns[i]);
+    free(infns);
+    free(outfns);
+    return ok ? 0 : 1;
 }
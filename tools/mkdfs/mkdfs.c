@@ -5,10 +5,18 @@
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <sys/types.h>
 #include <sys/param.h>
+#include <time.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 #include "dragonfs.h"
 #include "dfsinternal.h"
+#include "../common/binout.c"
+#include "../common/assetcomp.h"
 
 #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
 #define SWAPLONG(i) (i)
@@ -18,6 +26,65 @@
 
 uint8_t *dfs = NULL;
 uint32_t fs_size = 0;
+uint32_t fs_capacity = 0;
+
+/* Files added to the filesystem. Their contents are laid out after all the
+   directory entries (see layout_files) and they are used to build the path
+   hash index. */
+typedef struct file_entry_s
+{
+    char *path;         /* Path within the filesystem */
+    char *source;       /* Path of the file on disk */
+    uint32_t dirent;    /* Offset of the directory entry */
+    uint32_t size;      /* Size of the file */
+    int align;          /* Alignment of the file data (0: default) */
+    int order;          /* Position in the manifest (-1: not listed) */
+    uint32_t offset;    /* Offset of the file data (see layout_files) */
+    long long mtime;    /* Modification time of the file on disk */
+    uint64_t hash;      /* Hash of the contents (see read_files) */
+    uint8_t *data;      /* Contents of the file, if loaded */
+    bool loaded;        /* The contents have been loaded */
+    bool failed;        /* The file could not be read */
+    bool compressed;    /* The contents have been compressed (see compress_file) */
+    struct file_entry_s *shared;  /* File with the same contents, whose data is shared (or NULL) */
+} file_entry_t;
+
+file_entry_t *file_entries = NULL;
+int num_file_entries = 0;
+
+/* Files sorted by offset of their data (see layout_files) */
+file_entry_t **layout = NULL;
+
+/* Default alignment of file data in the image */
+int file_align = SECTOR_SIZE;
+
+/* Compression level of the files (0: none, see compress_file) */
+int compression = 0;
+
+/* Extensions of the files that are never compressed. By default, the formats
+   that are streamed directly from ROM by libdragon. */
+const char **no_compress = NULL;
+int num_no_compress = 0;
+
+/* Entry of the cache of a previous build (see load_cache). The cache allows
+   to patch the existing image in place, when the layout did not change: only
+   the directory entries, index and modified files are written again. */
+typedef struct
+{
+    char *path;         /* Path within the filesystem */
+    uint32_t offset;    /* Offset of the file data */
+    uint32_t size;      /* Size of the file */
+    long long mtime;    /* Modification time of the file on disk */
+    uint64_t hash;      /* Hash of the contents */
+} cache_entry_t;
+
+#define CACHE_MAGIC "mkdfs-cache 1"
+
+cache_entry_t *cache_entries = NULL;
+int num_cache_entries = 0;
+uint32_t cache_image_size = 0;      /* Size of the image written by the previous build */
+long long cache_image_mtime = 0;    /* Modification time of that image */
+long long cache_scan_time = 0;      /* Time at which the previous build scanned the files */
 
 /* Offset from start of filesystem */
 inline uint32_t sector_offset(void *sector)
@@ -32,30 +99,58 @@ inline void *sector_to_memory(uint32_t offset)
     return (void *)(dfs + offset);
 }
 
-uint32_t dfs_alloc(int size)
+/* Allocate size bytes at the end of the filesystem, aligned to align bytes */
+uint32_t dfs_alloc_aligned(int size, int align)
 {
-    void *end;
-    int rsize = (size + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+    uint32_t start = (fs_size + align - 1) & ~(align - 1);
+    uint32_t end = start + size;
 
-    if(!dfs)
+    /* Grow the buffer geometrically, to avoid a copy of the image per file */
+    if(end > fs_capacity)
     {
-        dfs = malloc(rsize);
-        fs_size = rsize;
-
-        end = dfs;
+        uint64_t capacity = fs_capacity ? (uint64_t)fs_capacity * 2 : 64*1024;
+        if(capacity < end || capacity > UINT32_MAX)
+        {
+            capacity = end;
+        }
+        dfs = realloc(dfs, capacity);
+        if(!dfs)
+        {
+            fprintf(stderr, "Out of memory!\n");
+            exit(1);
+        }
+        fs_capacity = capacity;
     }
-    else
-    {
-        dfs = realloc(dfs, fs_size + rsize);
 
-        end = dfs + fs_size;
-        fs_size += rsize;
+    /* Zero out padding and new bytes */
+    memset(dfs + fs_size, 0, end - fs_size);
+    fs_size = end;
+
+    return start;
+}
+
+/* Reserve size bytes for file data at the end of the filesystem, aligned to
+   align bytes. File data is not kept in the buffer, but written directly from
+   the contents of each file (see write_image). */
+uint32_t dfs_reserve_aligned(uint32_t size, int align)
+{
+    uint32_t start = (fs_size + align - 1) & ~(align - 1);
+
+    if((uint64_t)start + size > UINT32_MAX)
+    {
+        fprintf(stderr, "Filesystem image too big!\n");
+        exit(1);
     }
 
-    /* Zero out last bytes */
-    memset(end, 0, rsize);
+    fs_size = start + size;
+    return start;
+}
 
-    return sector_offset(end);    
+uint32_t dfs_alloc(int size)
+{
+    int rsize = (size + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+
+    return dfs_alloc_aligned(rsize, SECTOR_SIZE);
 }
 
 /* Add a new sector to the filesystem, return that sector pointer */
@@ -75,55 +170,664 @@ void kill_fs()
     {
         free(dfs);
     }
+    for(int i = 0; i < num_file_entries; i++)
+    {
+        free(file_entries[i].data);
+    }
+    free(layout);
 }
 
 void print_help(const char * const prog_name)
 {
-    fprintf(stderr, "Usage: %s <File> <Directory>\n", prog_name);
+    fprintf(stderr, "Usage: %s [flags] <File> <Directory>\n", prog_name);
     fprintf(stderr, "  where <File> is the resulting filesystem image\n");
     fprintf(stderr, "  and <Directory> is the directory (including subdirectories) to include\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Flags:\n");
+    fprintf(stderr, "  --no-index            Do not emit the path hash index (used for fast lookups)\n");
+    fprintf(stderr, "  --align <N>           Alignment of file data in bytes (power of 2, min 2, default: %d)\n", SECTOR_SIZE);
+    fprintf(stderr, "  --manifest <file>     Lay out the files listed in the manifest first, in the listed order\n");
+    fprintf(stderr, "  --cache <file>        Cache of the file hashes and offsets, used to update the image in place\n");
+    fprintf(stderr, "  -j/--jobs <num>       Number of files to read in parallel (default: number of cores)\n");
+    fprintf(stderr, "  -c/--compress <level> Compress the files (1=LZ4, 2=LZH5, 3=LZB, default: 0=none)\n");
+    fprintf(stderr, "  --no-compress <ext>   Do not compress files with this extension (can be repeated)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "The manifest is a text file with one path per line (relative to <Directory>),\n");
+    fprintf(stderr, "optionally followed by the alignment for that file. Files that are loaded\n");
+    fprintf(stderr, "together should be listed together, so that they are read sequentially from ROM.\n");
+    fprintf(stderr, "Empty lines and lines starting with '#' are ignored.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Files with identical contents are stored only once in the image.\n");
+    fprintf(stderr, "With --cache, if the layout of the filesystem did not change since the previous\n");
+    fprintf(stderr, "run, only the directory entries and the files that were modified are written\n");
+    fprintf(stderr, "to the existing image. Otherwise, the image is created from scratch.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "With --compress, files are decompressed transparently while they are read.\n");
+    fprintf(stderr, "Files that are already compressed assets (eg: by mkasset), that do not shrink,\n");
+    fprintf(stderr, "or that are streamed directly from ROM (by default:");
+    for(int i = 0; i < num_no_compress; i++)
+    {
+        fprintf(stderr, " .%s", no_compress[i]);
+    }
+    fprintf(stderr, ") are stored\n");
+    fprintf(stderr, "uncompressed. Levels 2 and 3 require asset_init_compression() at runtime.\n");
 }
 
-uint32_t add_file(const char * const file, uint32_t *size)
+bool is_valid_align(int align)
 {
-    FILE *fp;
+    return align >= 2 && (align & (align - 1)) == 0;
+}
 
-    printf("Adding '%s' to filesystem image.\n", file);
+void add_file_entry(const char * const prefix, const char * const name, const char * const source, uint32_t size, long long mtime, uint32_t dirent)
+{
+    file_entries = realloc(file_entries, (num_file_entries + 1) * sizeof(file_entry_t));
+    file_entry_t *e = &file_entries[num_file_entries++];
+
+    e->path = malloc(strlen(prefix) + strlen(name) + 1);
+    strcpy(e->path, prefix);
+    strcat(e->path, name);
+    e->source = strdup(source);
+    e->size = size;
+    e->dirent = dirent;
+    e->align = 0;
+    e->order = -1;
+    e->offset = 0;
+    e->mtime = mtime;
+    e->hash = 0;
+    e->data = NULL;
+    e->loaded = false;
+    e->failed = false;
+    e->compressed = false;
+    e->shared = NULL;
+}
 
-    fp = fopen(file, "rb");
+/* Apply the manifest: record the order and alignment of the listed files */
+bool read_manifest(const char * const fn)
+{
+    FILE *fp = fopen(fn, "r");
 
     if(!fp)
     {
-        fprintf(stderr, "Cannot open file '%s' for read!\n", file);
-        return 0;
+        fprintf(stderr, "Cannot open manifest '%s' for read!\n", fn);
+        return false;
+    }
+
+    char line[1024];
+    int order = 0;
+    int lineno = 0;
+    while(fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+
+        char path[1024];
+        int align = 0;
+        int n = sscanf(line, " %1023s %d", path, &align);
+        if(n < 1 || path[0] == '#')
+        {
+            continue;
+        }
+        if(n == 2 && !is_valid_align(align))
+        {
+            fprintf(stderr, "%s:%d: invalid alignment %d\n", fn, lineno, align);
+            fclose(fp);
+            return false;
+        }
+
+        /* Paths are relative to the root, with or without the leading slash */
+        const char *p = path;
+        while(*p == '/')
+        {
+            p++;
+        }
+
+        int i;
+        for(i = 0; i < num_file_entries; i++)
+        {
+            if(!strcmp(file_entries[i].path, p))
+            {
+                break;
+            }
+        }
+        if(i == num_file_entries)
+        {
+            fprintf(stderr, "%s:%d: warning: file not found in filesystem: %s\n", fn, lineno, p);
+            continue;
+        }
+
+        if(file_entries[i].order < 0)
+        {
+            file_entries[i].order = order++;
+        }
+        if(n == 2)
+        {
+            file_entries[i].align = align;
+        }
     }
 
-    fseek(fp, 0, SEEK_END);
-    *size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    fclose(fp);
+    return true;
+}
+
+/* Sort files by position in the manifest; unlisted files keep the directory order */
+int compare_file_order(const void *a, const void *b)
+{
+    const file_entry_t *fa = *(const file_entry_t **)a;
+    const file_entry_t *fb = *(const file_entry_t **)b;
 
-    if (*size > 0x0FFFFFFF)
+    int oa = fa->order < 0 ? 0x7FFFFFFF : fa->order;
+    int ob = fb->order < 0 ? 0x7FFFFFFF : fb->order;
+    if(oa != ob)
     {
-        fprintf(stderr, "File '%s' too big for the filesystem!\n", file);
-        return 0;
+        return oa < ob ? -1 : 1;
     }
+    return fa < fb ? -1 : (fa > fb ? 1 : 0);
+}
 
-    uint32_t blob = new_blob(*size);
-    uint8_t *data = sector_to_memory(blob);
+/* Check whether two files have the same contents. When only the hash from
+   the cache is known, the contents are not compared. */
+bool same_contents(const file_entry_t *a, const file_entry_t *b)
+{
+    if(a->size != b->size || a->hash != b->hash)
+    {
+        return false;
+    }
+    return !a->loaded || !b->loaded || !memcmp(a->data, b->data, a->size);
+}
 
-    int read = fread(data, 1, *size, fp);
-    if (read < 0) {
-        /* Wat? */
-        fprintf(stderr, "Cannot add all contents of file '%s' to filesystem!\n", file);
+/* Reserve the space for the contents of all files after the directory entries,
+   and link them. Files with the same contents share the same data. */
+void layout_files(void)
+{
+    layout = malloc(num_file_entries * sizeof(file_entry_t*));
+    for(int i = 0; i < num_file_entries; i++)
+    {
+        layout[i] = &file_entries[i];
+    }
+    qsort(layout, num_file_entries, sizeof(file_entry_t*), compare_file_order);
+
+    /* Files laid out so far, by hash of the contents (linear probing) */
+    uint32_t num_slots = 1;
+    while(num_slots < num_file_entries * 2)
+    {
+        num_slots *= 2;
+    }
+    file_entry_t **slots = calloc(num_slots, sizeof(file_entry_t*));
+
+    for(int i = 0; i < num_file_entries; i++)
+    {
+        file_entry_t *e = layout[i];
+        int align = e->align ? e->align : file_align;
+
+        uint32_t slot = e->hash & (num_slots - 1);
+        while(slots[slot] && !same_contents(slots[slot], e))
+        {
+            slot = (slot + 1) & (num_slots - 1);
+        }
+
+        /* The data can be shared only if it is aligned as required by this file */
+        file_entry_t *same = slots[slot];
+        if(same && (same->offset & (align - 1)) == 0)
+        {
+            e->offset = same->offset;
+            e->shared = same;
+        }
+        else
+        {
+            e->offset = dfs_reserve_aligned(e->size, align);
+            if(!same)
+            {
+                slots[slot] = e;
+            }
+        }
+
+        directory_entry_t *entry = sector_to_memory(e->dirent);
+        entry->file_pointer = SWAPLONG(e->offset);
+    }
+
+    free(slots);
+}
+
+/* 64-bit FNV-1a hash of the contents of a file */
+uint64_t hash_contents(const uint8_t *data, uint32_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(uint32_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+int compare_cache_path(const void *a, const void *b)
+{
+    return strcmp(((const cache_entry_t *)a)->path, ((const cache_entry_t *)b)->path);
+}
+
+cache_entry_t *find_cache_entry(const char * const path)
+{
+    cache_entry_t key = { .path = (char *)path };
+
+    if(!num_cache_entries)
+    {
+        return NULL;
+    }
+    return bsearch(&key, cache_entries, num_cache_entries, sizeof(cache_entry_t), compare_cache_path);
+}
+
+/* Load the cache written by a previous run (see save_cache). Returns false if
+   there is no valid cache. */
+bool load_cache(const char * const fn)
+{
+    FILE *fp = fopen(fn, "r");
+
+    if(!fp)
+    {
+        return false;
+    }
+
+    char line[4096];
+    unsigned long long image_size;
+    if(!fgets(line, sizeof(line), fp) || strncmp(line, CACHE_MAGIC "\n", sizeof(CACHE_MAGIC)) ||
+       !fgets(line, sizeof(line), fp) ||
+       sscanf(line, "%llu %lld %lld", &image_size, &cache_image_mtime, &cache_scan_time) != 3)
+    {
+        fprintf(stderr, "warning: ignoring invalid cache: %s\n", fn);
         fclose(fp);
-        return 0;    
+        return false;
+    }
+    cache_image_size = image_size;
+
+    while(fgets(line, sizeof(line), fp))
+    {
+        unsigned long long offset, size, hash;
+        long long mtime;
+        int path;
+        if(sscanf(line, "%llu %llu %lld %llx %n", &offset, &size, &mtime, &hash, &path) != 4)
+        {
+            continue;
+        }
+        line[strcspn(line, "\n")] = 0;
+
+        cache_entries = realloc(cache_entries, (num_cache_entries + 1) * sizeof(cache_entry_t));
+        cache_entry_t *c = &cache_entries[num_cache_entries++];
+        c->path = strdup(line + path);
+        c->offset = offset;
+        c->size = size;
+        c->mtime = mtime;
+        c->hash = hash;
     }
 
     fclose(fp);
-    return blob;
+    qsort(cache_entries, num_cache_entries, sizeof(cache_entry_t), compare_cache_path);
+    return true;
+}
+
+/* Write the cache for the next run, after the image has been written */
+bool save_cache(const char * const fn, const char * const image, long long scan_time)
+{
+    struct stat stats;
+
+    if(stat(image, &stats) != 0)
+    {
+        return false;
+    }
+
+    FILE *fp = fopen(fn, "w");
+
+    if(!fp)
+    {
+        return false;
+    }
+
+    fprintf(fp, CACHE_MAGIC "\n");
+    fprintf(fp, "%llu %lld %lld\n", (unsigned long long)stats.st_size, (long long)stats.st_mtime, scan_time);
+    for(int i = 0; i < num_file_entries; i++)
+    {
+        file_entry_t *e = &file_entries[i];
+        fprintf(fp, "%lu %lu %lld %016llx %s\n", (unsigned long)e->offset, (unsigned long)e->size,
+            e->mtime, (unsigned long long)e->hash, e->path);
+    }
+
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+/* Check whether the image written by the previous run can be patched in
+   place: it must be untouched, and all files must be at the same offsets. */
+bool can_patch(const char * const image)
+{
+    struct stat stats;
+
+    if(stat(image, &stats) != 0 || stats.st_size != cache_image_size ||
+       (long long)stats.st_mtime != cache_image_mtime || cache_image_size != fs_size ||
+       num_cache_entries != num_file_entries)
+    {
+        return false;
+    }
+
+    for(int i = 0; i < num_file_entries; i++)
+    {
+        cache_entry_t *c = find_cache_entry(file_entries[i].path);
+        if(!c || c->offset != file_entries[i].offset)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Check whether a file can be compressed */
+bool can_compress(const file_entry_t *e)
+{
+    /* Already compressed by mkasset: compressing it again is pointless,
+       and asset_load would not see the header anymore */
+    if(e->size == 0 || (e->size >= 4 && !memcmp(e->data, "DCA", 3)))
+    {
+        return false;
+    }
+
+    const char *ext = strrchr(e->path, '.');
+    for(int i = 0; ext && i < num_no_compress; i++)
+    {
+        if(!strcasecmp(ext + 1, no_compress[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Compress the contents of a file in memory (in the same format of mkasset),
+   if that makes it smaller. The directory entry is updated by read_files. */
+void compress_file(file_entry_t *e)
+{
+    uint8_t *data;
+    size_t size;
+
+    if(!asset_compress_mem(e->data, e->size, compression, &data, &size))
+    {
+        return;
+    }
+    if(size >= e->size)
+    {
+        free(data);
+        return;
+    }
+
+    free(e->data);
+    e->data = data;
+    e->size = size;
+    e->compressed = true;
+}
+
+/* Load the contents of a file in memory */
+void read_file(file_entry_t *e)
+{
+    FILE *fp = fopen(e->source, "rb");
+
+    if(!fp)
+    {
+        fprintf(stderr, "Cannot open file '%s' for read!\n", e->source);
+        e->failed = true;
+        return;
+    }
+
+    e->data = malloc(e->size ? e->size : 1);
+    if(!e->data || fread(e->data, 1, e->size, fp) != e->size)
+    {
+        /* Wat? */
+        fprintf(stderr, "Cannot add all contents of file '%s' to filesystem!\n", e->source);
+        e->failed = true;
+    }
+    else
+    {
+        if(compression && can_compress(e))
+        {
+            compress_file(e);
+        }
+        e->hash = hash_contents(e->data, e->size);
+        e->loaded = true;
+    }
+
+    fclose(fp);
+}
+
+/* Queue of files shared by the worker threads of read_files */
+typedef struct
+{
+    pthread_mutex_t lock;   /* Lock protecting next */
+    file_entry_t **files;   /* Files to read */
+    int next;               /* Next file to read */
+    int count;              /* Number of files */
+} read_queue_t;
+
+void *read_files_worker(void *arg)
+{
+    read_queue_t *q = arg;
+
+    while(1)
+    {
+        pthread_mutex_lock(&q->lock);
+        int idx = q->next++;
+        pthread_mutex_unlock(&q->lock);
+        if(idx >= q->count)
+        {
+            break;
+        }
+        read_file(q->files[idx]);
+    }
+    return NULL;
+}
+
+/* Load the files that are not loaded yet, using up to num_threads threads.
+   Files that share the data of another file are skipped. With use_cache,
+   the files whose size and modification time match the cache are also
+   skipped, and get the hash from the cache (this cannot be used when
+   compressing, as the size of the compressed contents is not known). */
+bool read_files(bool use_cache, int num_threads)
+{
+    read_queue_t q = { .lock = PTHREAD_MUTEX_INITIALIZER, .next = 0, .count = 0 };
+    q.files = malloc(num_file_entries * sizeof(file_entry_t*));
+
+    for(int i = 0; i < num_file_entries; i++)
+    {
+        file_entry_t *e = &file_entries[i];
+        cache_entry_t *c = use_cache ? find_cache_entry(e->path) : NULL;
+
+        if(e->loaded || e->shared)
+        {
+            continue;
+        }
+
+        /* A file modified within the same second of the previous scan might
+           have the same mtime as in the cache: its contents must be checked */
+        if(c && c->size == e->size && c->mtime == e->mtime && e->mtime < cache_scan_time)
+        {
+            e->hash = c->hash;
+            continue;
+        }
+
+        printf("Adding '%s' to filesystem image.\n", e->source);
+        q.files[q.count++] = e;
+    }
+
+    if(num_threads > q.count)
+    {
+        num_threads = q.count;
+    }
+    if(num_threads <= 1)
+    {
+        read_files_worker(&q);
+    }
+    else
+    {
+        pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+        for(int i = 0; i < num_threads; i++)
+        {
+            pthread_create(&threads[i], NULL, read_files_worker, &q);
+        }
+        for(int i = 0; i < num_threads; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+    }
+
+    bool ok = true;
+    for(int i = 0; i < q.count; i++)
+    {
+        file_entry_t *e = q.files[i];
+        if(e->failed)
+        {
+            ok = false;
+        }
+        else if(e->compressed)
+        {
+            /* The directory entry stores the compressed size */
+            directory_entry_t *entry = sector_to_memory(e->dirent);
+            entry->flags = SWAPLONG(((FLAGS_FILE | FLAGS_COMPRESSED) << 28) | (e->size & 0x0FFFFFFF));
+        }
+    }
+
+    free(q.files);
+    return ok;
+}
+
+/* Write size zero bytes */
+bool write_zeros(FILE *fp, uint32_t size)
+{
+    static const uint8_t zeros[64*1024];
+
+    while(size > 0)
+    {
+        uint32_t n = MIN(size, sizeof(zeros));
+        if(fwrite(zeros, 1, n, fp) != n)
+        {
+            return false;
+        }
+        size -= n;
+    }
+    return true;
 }
 
-uint32_t add_directory(const char * const path)
+/* Write the whole image: the directory entries and index (everything before
+   meta_size), followed by the data of the files, in layout order */
+bool write_image(FILE *fp, uint32_t meta_size)
+{
+    bool ok = fwrite(dfs, 1, meta_size, fp) == meta_size;
+    uint32_t pos = meta_size;
+
+    for(int i = 0; ok && i < num_file_entries; i++)
+    {
+        file_entry_t *e = layout[i];
+        if(e->shared)
+        {
+            continue;
+        }
+
+        ok = write_zeros(fp, e->offset - pos) && fwrite(e->data, 1, e->size, fp) == e->size;
+        pos = e->offset + e->size;
+    }
+
+    return ok && write_zeros(fp, fs_size - pos);
+}
+
+/* Update the image of the previous run in place: write the directory entries
+   and index, and the files that were modified */
+bool patch_image(const char * const fn, uint32_t meta_size)
+{
+    FILE *fp = fopen(fn, "r+b");
+
+    if(!fp)
+    {
+        return false;
+    }
+
+    bool ok = fwrite(dfs, 1, meta_size, fp) == meta_size;
+    for(int i = 0; ok && i < num_file_entries; i++)
+    {
+        file_entry_t *e = &file_entries[i];
+        cache_entry_t *c = find_cache_entry(e->path);
+        if(e->shared || !e->loaded || (c->size == e->size && c->hash == e->hash))
+        {
+            continue;
+        }
+
+        /* Also clear the rest of the previous contents, if the file shrank */
+        ok = fseek(fp, e->offset, SEEK_SET) == 0 && fwrite(e->data, 1, e->size, fp) == e->size &&
+             (c->size <= e->size || write_zeros(fp, c->size - e->size));
+    }
+
+    if(fclose(fp) != 0)
+    {
+        ok = false;
+    }
+    return ok;
+}
+
+int default_jobs(void)
+{
+#ifdef _WIN32
+    const char *env = getenv("NUMBER_OF_PROCESSORS");
+    int n = env ? atoi(env) : 1;
+#else
+    int n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return n > 0 ? n : 1;
+}
+
+/* Append the path hash index to the filesystem, and link it from the root sector */
+void add_index(void)
+{
+    uint32_t num_slots = 1;
+    while(num_slots < num_file_entries * 2)
+    {
+        num_slots *= 2;
+    }
+
+    /* Paths are packed together in a single blob after the table */
+    uint32_t paths_size = 0;
+    for(int i = 0; i < num_file_entries; i++)
+    {
+        paths_size += strlen(file_entries[i].path) + 1;
+    }
+
+    uint32_t table = new_blob(sizeof(hash_index_header_t) + num_slots * sizeof(hash_index_slot_t));
+    uint32_t path = new_blob(paths_size);
+
+    /* Write all the paths, and fill the table with linear probing */
+    for(int i = 0; i < num_file_entries; i++)
+    {
+        file_entry_t *e = &file_entries[i];
+        strcpy(sector_to_memory(path), e->path);
+
+        uint32_t hash = hash_index_path(e->path);
+        hash_index_slot_t *slots = sector_to_memory(table + sizeof(hash_index_header_t));
+        uint32_t slot = hash & (num_slots - 1);
+        while(slots[slot].dirent)
+        {
+            slot = (slot + 1) & (num_slots - 1);
+        }
+
+        slots[slot].hash = SWAPLONG(hash);
+        slots[slot].dirent = SWAPLONG(e->dirent);
+        slots[slot].path = SWAPLONG(path);
+        slots[slot].reserved = 0;
+
+        path += strlen(e->path) + 1;
+    }
+
+    hash_index_header_t *header = sector_to_memory(table);
+    header->magic = SWAPLONG(HASH_INDEX_MAGIC);
+    header->num_slots = SWAPLONG(num_slots);
+
+    directory_entry_t *id = sector_to_memory(0);
+    id->file_pointer = SWAPLONG(table);
+}
+
+uint32_t add_directory(const char * const path, const char * const prefix)
 {
     directory_entry_t *tmp_entry;
     uint32_t first_entry = 0;
@@ -173,8 +877,15 @@ uint32_t add_directory(const char * const path)
 
                 if(S_ISREG(stats.st_mode))
                 {
+                    if (stats.st_size > 0x0FFFFFFF)
+                    {
+                        fprintf(stderr, "File '%s' too big for the filesystem!\n", file);
+                        free(file);
+                        return 0;
+                    }
+
                     uint32_t new_entry = new_sector();
-                    uint32_t file_size = 0;
+                    uint32_t file_size = stats.st_size;
 
                     tmp_entry = sector_to_memory(new_entry);
                     tmp_entry->next_entry = 0;
@@ -183,18 +894,11 @@ uint32_t add_directory(const char * const path)
                     strncpy(tmp_entry->path, dp->d_name, MAX_FILENAME_LEN);
                     tmp_entry->path[MAX_FILENAME_LEN] = 0;
 
-                    uint32_t new_file = add_file(file, &file_size);
-
-                    if(!new_file)
-                    {
-                        free(file);
-                        return 0;
-                    }
-
-                    tmp_entry = sector_to_memory(new_entry);
-                    tmp_entry->file_pointer = SWAPLONG(new_file);
+                    /* The contents are added later, see layout_files */
                     tmp_entry->flags = SWAPLONG((FLAGS_FILE << 28) | (file_size & 0x0FFFFFFF));
 
+                    add_file_entry(prefix, tmp_entry->path, file, file_size, stats.st_mtime, new_entry);
+
                     if(cur_entry)
                     {
                         /* Link up! */
@@ -217,7 +921,13 @@ uint32_t add_directory(const char * const path)
                     strncpy(tmp_entry->path, dp->d_name, MAX_FILENAME_LEN);
                     tmp_entry->path[MAX_FILENAME_LEN] = 0;
 
-                    uint32_t new_directory = add_directory(file);
+                    char *new_prefix = malloc(strlen(prefix) + strlen(tmp_entry->path) + 2);
+                    strcpy(new_prefix, prefix);
+                    strcat(new_prefix, tmp_entry->path);
+                    strcat(new_prefix, "/");
+
+                    uint32_t new_directory = add_directory(file, new_prefix);
+                    free(new_prefix);
 
                     if(!new_directory)
                     {
@@ -259,12 +969,96 @@ uint32_t add_directory(const char * const path)
 
 int main(int argc, char *argv[])
 {
+    bool flag_index = true;
+    const char *manifest = NULL;
+    const char *cache = NULL;
+    int jobs = default_jobs();
+    const char *prog_name = argv[0];
+
+    static const char *default_no_compress[] = { "wav64", "xm64" };
+    for(int i = 0; i < sizeof(default_no_compress) / sizeof(default_no_compress[0]); i++)
+    {
+        no_compress = realloc(no_compress, (num_no_compress + 1) * sizeof(char*));
+        no_compress[num_no_compress++] = default_no_compress[i];
+    }
+
+    while(argc > 1 && argv[1][0] == '-')
+    {
+        if(!strcmp(argv[1], "--no-index"))
+        {
+            flag_index = false;
+        }
+        else if(!strcmp(argv[1], "--align") && argc > 2)
+        {
+            file_align = atoi(argv[2]);
+            if(!is_valid_align(file_align))
+            {
+                fprintf(stderr, "Invalid alignment: %s\n", argv[2]);
+                return -1;
+            }
+            argv++;
+            argc--;
+        }
+        else if(!strcmp(argv[1], "--manifest") && argc > 2)
+        {
+            manifest = argv[2];
+            argv++;
+            argc--;
+        }
+        else if(!strcmp(argv[1], "--cache") && argc > 2)
+        {
+            cache = argv[2];
+            argv++;
+            argc--;
+        }
+        else if((!strcmp(argv[1], "-j") || !strcmp(argv[1], "--jobs")) && argc > 2)
+        {
+            char extra;
+            if(sscanf(argv[2], "%d%c", &jobs, &extra) != 1 || jobs <= 0)
+            {
+                fprintf(stderr, "Invalid number of jobs: %s\n", argv[2]);
+                return -1;
+            }
+            argv++;
+            argc--;
+        }
+        else if((!strcmp(argv[1], "-c") || !strcmp(argv[1], "--compress")) && argc > 2)
+        {
+            char extra;
+            if(sscanf(argv[2], "%d%c", &compression, &extra) != 1 || compression < 0 || compression > 3)
+            {
+                fprintf(stderr, "Invalid compression level: %s\n", argv[2]);
+                return -1;
+            }
+            argv++;
+            argc--;
+        }
+        else if(!strcmp(argv[1], "--no-compress") && argc > 2)
+        {
+            const char *ext = argv[2][0] == '.' ? argv[2] + 1 : argv[2];
+            no_compress = realloc(no_compress, (num_no_compress + 1) * sizeof(char*));
+            no_compress[num_no_compress++] = ext;
+            argv++;
+            argc--;
+        }
+        else
+        {
+            print_help(prog_name);
+            return -1;
+        }
+        argv++;
+        argc--;
+    }
+
     if(argc != 3)
     {
-        print_help(argv[0]);
+        print_help(prog_name);
         return -1;
     }
 
+    /* Files modified after this point are not trusted by the next run */
+    long long scan_time = time(NULL);
+
     /* Add in identifier */
     directory_entry_t *id = sector_to_memory(new_sector());
 
@@ -279,7 +1073,7 @@ int main(int argc, char *argv[])
     id->next_entry = SWAPLONG(ROOT_NEXT_ENTRY);
     strcpy(id->path, ROOT_PATH);
 
-    if(!add_directory(argv[2]))
+    if(!add_directory(argv[2], ""))
     {
         /* Error adding directory */
         fprintf(stderr, "Error creating filesystem: directory is empty or does not exist: %s\n", argv[2]);
@@ -289,21 +1083,97 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    /* Write out filesystem */
-    FILE *fp = fopen(argv[1], "wb");
+    if(flag_index)
+    {
+        add_index();
+    }
 
-    if(!fp)
+    if(manifest && !read_manifest(manifest))
+    {
+        kill_fs();
+
+        return -1;
+    }
+
+    /* The hashes of the contents are needed to find the identical files */
+    bool use_cache = cache && load_cache(cache);
+
+    if(!read_files(use_cache && !compression, jobs))
     {
-        /* Error writing file out */
-        fprintf(stderr, "Error opening '%s' for writing.\n", argv[1]);
+        fprintf(stderr, "Error creating filesystem: cannot add file contents\n");
 
         kill_fs();
 
         return -1;
     }
 
-    fwrite(dfs, 1, fs_size, fp);
-    fclose(fp);
+    uint32_t meta_size = fs_size;
+    layout_files();
+
+    /* Keep the image size a multiple of the sector size */
+    dfs_reserve_aligned(0, SECTOR_SIZE);
+
+    /* When the image must be written from scratch, all the files are needed */
+    bool patch = use_cache && can_patch(argv[1]);
+
+    if(!patch && !read_files(false, jobs))
+    {
+        fprintf(stderr, "Error creating filesystem: cannot add file contents\n");
+
+        kill_fs();
+
+        return -1;
+    }
+
+    /* The cache is invalid until the image is fully written */
+    if(cache)
+    {
+        remove(cache);
+    }
+
+    if(patch)
+    {
+        if(!patch_image(argv[1], meta_size))
+        {
+            /* The unchanged files were not read: the image cannot be written from scratch now */
+            fprintf(stderr, "Error updating '%s', run again to create it from scratch.\n", argv[1]);
+
+            kill_fs();
+
+            return -1;
+        }
+    }
+    else
+    {
+        /* Write out filesystem */
+        FILE *fp = fopen(argv[1], "wb");
+
+        if(!fp)
+        {
+            /* Error writing file out */
+            fprintf(stderr, "Error opening '%s' for writing.\n", argv[1]);
+
+            kill_fs();
+
+            return -1;
+        }
+
+        bool ok = write_image(fp, meta_size);
+
+        if(fclose(fp) != 0 || !ok)
+        {
+            fprintf(stderr, "Error writing '%s'.\n", argv[1]);
+
+            kill_fs();
+
+            return -1;
+        }
+    }
+
+    if(cache && !save_cache(cache, argv[1], scan_time))
+    {
+        fprintf(stderr, "warning: cannot write cache: %s\n", cache);
+    }
 
     kill_fs();
 
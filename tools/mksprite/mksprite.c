@@ -36,6 +36,7 @@
 	typeof(n) _n = n; typeof(d) _d = d; \
 	(((_n) + (_d) - 1) / (_d) * (_d)); \
 })
+#define MAX(a, b) ({ typeof(a) _a = a; typeof(b) _b = b; _a > _b ? _a : _b; })
 
 const char* tex_format_name(tex_format_t fmt) {
     switch ((int)fmt) {
@@ -122,6 +123,10 @@ typedef struct {
         bool         use_main_tex;
         bool         enabled;
     } detail;
+    int filter;
+    bool shared_palette;        // Quantize with the palette shared by all files (--shared-palette)
+    const uint8_t *palette;     // Shared palette (RGBA32), computed before conversion
+    int palette_colors;         // Number of colors in the shared palette
 
 } parms_t;
 
@@ -141,6 +146,10 @@ void print_supported_dithers(void) {
     fprintf(stderr, "Supported dithering algorithms: NONE (disable), RANDOM, ORDERED. \nNote that dithering is only applied while quantizing an image.\n");
 }
 
+void print_supported_filters(void) {
+    fprintf(stderr, "Supported pixel filters: NONE (disable), SUB (delta from left pixel), UP (delta from row above)\n");
+}
+
 void print_args( char * name )
 {
     fprintf(stderr, "Usage: %s [flags] <input files...>\n", name);
@@ -152,6 +161,13 @@ void print_args( char * name )
     fprintf(stderr, "   -D/--dither <dither>  Dithering algorithm (default: NONE)\n");
     fprintf(stderr, "   -c/--compress <level> Compress output files (default: %d)\n", DEFAULT_COMPRESSION);
     fprintf(stderr, "   -d/--debug            Dump computed images (eg: mipmaps) as PNG files in output directory\n");
+    fprintf(stderr, "   --filter <filter>     Prefilter pixels to improve compression (default: NONE)\n");
+    fprintf(stderr, "   -j/--jobs <n>         Number of files converted in parallel (default: number of cores)\n");
+    fprintf(stderr, "   --shared-palette      Quantize all the following CI4/CI8 files together, to a single palette\n");
+    fprintf(stderr, "\nAtlas flags:\n");
+    fprintf(stderr, "   -a/--atlas <name>     Pack all the following input files into a single <name>.sprite atlas\n");
+    fprintf(stderr, "                         (frames are accessed with sprite_get_frame, in command line order)\n");
+    fprintf(stderr, "   --atlas-width <w>     Width of the atlas in pixels (default: automatic)\n");
     fprintf(stderr, "\nSampling flags:\n");
     fprintf(stderr, "   --texparms <x,s,r,m>          Sampling parameters:\n");
     fprintf(stderr, "                                 x=translation, s=scale, r=repetitions, m=mirror\n");
@@ -220,6 +236,16 @@ typedef struct {
 
 #define MAX_IMAGES 8
 
+// Pixel prefilters, applied to each image (reversed by sprite_load)
+#define FILTER_NONE     0
+#define FILTER_SUB      1   // Each byte is stored as the delta from the same byte of the pixel on the left
+#define FILTER_UP       2   // Each byte is stored as the delta from the same byte of the row above
+
+typedef struct {
+    int x, y;               // Position of the frame in the atlas
+    int width, height;      // Size of the frame
+} frame_t;
+
 typedef struct {
     const char *infn;       // Input file
     const char *outfn;      // Output file
@@ -235,6 +261,9 @@ typedef struct {
         bool         use_main_tex;  // If true, use the main texture as detail (fractal detail)
         bool         enabled;       // If true, detail texture is enabled
     } detail;
+    int filter;             // Pixel prefilter (FILTER_*)
+    frame_t *frames;        // Frames of the atlas (if any)
+    int num_frames;         // Number of frames of the atlas
 } spritemaker_t;
 
 
@@ -291,11 +320,12 @@ bool load_png_image(const char *infn, tex_format_t fmt, image_t *imgout, palette
     if (fmt == FMT_NONE) {
         // Check the filename string if it contains a texformat for output
         char *fntok = strdup(infn);
-        char *sect = strtok(fntok, ".");
+        char *saveptr;
+        char *sect = strtok_r(fntok, ".", &saveptr);
         while (sect) {
             fmt = tex_format_from_name(sect);
             if (fmt != FMT_NONE) break;
-            sect = strtok(NULL, ".");
+            sect = strtok_r(NULL, ".", &saveptr);
         }
         if (fmt != FMT_NONE) {
             if (flag_verbose)
@@ -911,6 +941,33 @@ bool spritemaker_convert_ihq(spritemaker_t *spr) {
     return true;
 }
 
+/** 
+ * @brief Apply a reversible prefilter to the pixels of an image already written to file.
+ * 
+ * The filters work on bytes, so that they are independent of the pixel format,
+ * and are meant to increase the redundancy of the data for the asset compression.
+ * They are reversed by sprite_load (see __sprite_unfilter in sprite.c).
+ */
+void spritemaker_filter_image(FILE *out, long pos, int size, int height, int bpp, int filter) {
+    uint8_t *data = malloc(size);
+    int pitch = size / height;
+    fseek(out, pos, SEEK_SET);
+    fread(data, 1, size, out);
+
+    // Go backward, so that each delta is computed from the original bytes
+    for (int i=size-1; i>=0; i--) {
+        int x = i % pitch;
+        switch (filter) {
+        case FILTER_SUB: if (x >= bpp)   data[i] -= data[i-bpp];   break;
+        case FILTER_UP:  if (i >= pitch) data[i] -= data[i-pitch]; break;
+        }
+    }
+
+    fseek(out, pos, SEEK_SET);
+    fwrite(data, 1, size, out);
+    free(data);
+}
+
 bool spritemaker_write(spritemaker_t *spr) {
     FILE *out;
     if (strcmp(spr->outfn, "(stdout)") == 0) {
@@ -922,7 +979,7 @@ bool spritemaker_write(spritemaker_t *spr) {
             return false;
         }
     } else {
-        out = fopen(spr->outfn, "wb");
+        out = fopen(spr->outfn, "w+b");
         if (!out) {
             fprintf(stderr, "ERROR: cannot open output file %s\n", spr->outfn);
             return false;
@@ -954,6 +1011,7 @@ bool spritemaker_write(spritemaker_t *spr) {
             uint32_t xpos = ftell(out) | (image->fmt << 24);
             w32_at(out, w_lodpos[m-1], xpos);
         }
+        long image_pos = ftell(out);
 
         switch ((int)image->fmt) {
         case FMT_RGBA16: {
@@ -1046,6 +1104,12 @@ bool spritemaker_write(spritemaker_t *spr) {
         }
         }
 
+        // Apply the prefilter to the converted pixels, in place
+        if (spr->filter != FILTER_NONE)
+            spritemaker_filter_image(out, image_pos, ftell(out) - image_pos,
+                image->height, image->fmt == FMT_ZBUF ? 2 : MAX(1, TEX_FORMAT_BITDEPTH(image->fmt) / 8),
+                spr->filter);
+
         // Padding to force alignment of every image
         walign(out, 8);
         
@@ -1068,8 +1132,10 @@ bool spritemaker_write(spritemaker_t *spr) {
             if (spr->texparms.defined) flags |= 0x8;
             if (spr->detail.enabled) flags |= 0x10;
             if (spritemaker_fit_tmem(spr, NULL)) flags |= 0x20;
+            if (spr->num_frames) flags |= 0x40;
+            flags |= spr->filter << 7;
             w16(out, flags);
-            w16(out, 0); // padding
+            w16(out, spr->num_frames);
             wf32(out, spr->texparms.s.translate);
             wf32(out, spr->texparms.s.repeats);
             w16(out, spr->texparms.s.scale);
@@ -1099,6 +1165,15 @@ bool spritemaker_write(spritemaker_t *spr) {
             w8(out, 0); // padding
 
             walign(out, 8);
+
+            // Frame table of the atlas, right after the extended header
+            for (int i=0; i<spr->num_frames; i++) {
+                w16(out, spr->frames[i].x);
+                w16(out, spr->frames[i].y);
+                w16(out, spr->frames[i].width);
+                w16(out, spr->frames[i].height);
+            }
+            walign(out, 8);
         }
     }
 
@@ -1175,6 +1250,7 @@ void spritemaker_free(spritemaker_t *spr) {
     for (int i=0; i<MAX_IMAGES; i++)
         if (spr->images[i].image)
             free(spr->images[i].image);
+    free(spr->frames);
     memset(spr, 0, sizeof(*spr));
 }
 
@@ -1188,6 +1264,7 @@ int convert(const char *infn, const char *outfn, const parms_t *pm) {
     spr.infn = infn;
     spr.outfn = outfn;
     spr.texparms = pm->texparms;
+    spr.filter = pm->filter;
     if (!spr.texparms.defined) {
         spr.texparms.s.translate = 0.0f;
         spr.texparms.s.scale = 0;
@@ -1259,7 +1336,13 @@ int convert(const char *infn, const char *outfn, const parms_t *pm) {
     }
 
     // Run quantization if needed
-    if (spr.images[0].fmt == FMT_CI8 || spr.images[0].fmt == FMT_CI4) {
+    if (pm->palette && (spr.images[0].fmt == FMT_CI8 || spr.images[0].fmt == FMT_CI4)) {
+        // Remap to the palette shared with the other files
+        if (spr.images[0].ct == LCT_PALETTE && !spritemaker_expand_rgba(&spr))
+            goto error;
+        if (!spritemaker_quantize(&spr, (uint8_t*)pm->palette, pm->palette_colors, pm->dither_algo))
+            goto error;
+    } else if (spr.images[0].fmt == FMT_CI8 || spr.images[0].fmt == FMT_CI4) {
         int expected_colors = spr.images[0].fmt == FMT_CI8 ? 256 : 16;
 
         switch (spr.images[0].ct) {
@@ -1320,6 +1403,190 @@ error:
     return 1;
 }
 
+/** @brief Number of bytes per pixel of a decoded image, given its color type */
+static int image_bpp(const image_t *img) {
+    switch (img->ct) {
+    case LCT_RGBA: return 4;
+    case LCT_GREY_ALPHA: return 2;
+    case LCT_GREY: return img->fmt == FMT_ZBUF ? 2 : 1;
+    default: assert(0); return 0;
+    }
+}
+
+int convert_atlas(const char **infns, int num_files, const char *outfn, const parms_t *pm, int atlas_width) {
+    if (flag_verbose)
+        fprintf(stderr, "Packing atlas: %d files -> %s [fmt=%s]\n", num_files, outfn, tex_format_name(pm->outfmt));
+
+    spritemaker_t spr = {0};
+    image_t *imgs = calloc(num_files, sizeof(image_t));
+    int *order = calloc(num_files, sizeof(int));
+    tex_format_t fmt = pm->outfmt;
+    int ret = 1;
+
+    spr.infn = infns[0];
+    spr.outfn = outfn;
+    spr.texparms = pm->texparms;
+    spr.filter = pm->filter;
+    if (!spr.texparms.defined) {
+        spr.texparms.s.repeats = 1;
+        spr.texparms.t = spr.texparms.s;
+    }
+
+    // Load all the images. The format of the first one (possibly autodetected)
+    // is used for all of them.
+    for (int i=0; i<num_files; i++) {
+        palette_t pal = {0};
+        if (!load_png_image(infns[i], fmt, &imgs[i], &pal))
+            goto error;
+        if (fmt == FMT_NONE)
+            fmt = imgs[i].fmt;
+        if (fmt == FMT_CI4 || fmt == FMT_CI8 || fmt == FMT_IHQ) {
+            fprintf(stderr, "ERROR: %s: atlases do not support format %s yet\n", infns[i], tex_format_name(fmt));
+            goto error;
+        }
+        imgs[i].fmt = fmt;
+        order[i] = i;
+    }
+
+    // Frames are aligned to 8 bytes (a TMEM line) horizontally, so that each one
+    // can be loaded on its own, and subsurfaces are always valid.
+    int xalign = fmt == FMT_ZBUF ? 4 : MAX(1, TEX_FORMAT_BYTES2PIX(fmt, 8));
+    int max_w = 0, area = 0;
+    for (int i=0; i<num_files; i++) {
+        max_w = MAX(max_w, ROUND_UP(imgs[i].width, xalign));
+        area += ROUND_UP(imgs[i].width, xalign) * imgs[i].height;
+    }
+    if (!atlas_width) {
+        atlas_width = 1;
+        while (atlas_width * atlas_width < area) atlas_width *= 2;
+    }
+    atlas_width = ROUND_UP(MAX(atlas_width, max_w), xalign);
+
+    // Shelf packing: sort by decreasing height, and fill rows left to right
+    for (int i=0; i<num_files; i++)
+        for (int j=i+1; j<num_files; j++)
+            if (imgs[order[j]].height > imgs[order[i]].height)
+                SWAP(order[i], order[j]);
+
+    spr.frames = calloc(num_files, sizeof(frame_t));
+    spr.num_frames = num_files;
+    int x = 0, y = 0, shelf_h = 0;
+    for (int k=0; k<num_files; k++) {
+        image_t *img = &imgs[order[k]];
+        if (x + img->width > atlas_width) {
+            x = 0;
+            y += shelf_h;
+            shelf_h = 0;
+        }
+        spr.frames[order[k]] = (frame_t){ x, y, img->width, img->height };
+        x += ROUND_UP(img->width, xalign);
+        shelf_h = MAX(shelf_h, img->height);
+    }
+    int atlas_height = y + shelf_h;
+
+    // Compose the atlas image, with transparent padding
+    int bpp = image_bpp(&imgs[0]);
+    spr.images[0] = (image_t){
+        .image = calloc(atlas_width * atlas_height, bpp),
+        .width = atlas_width,
+        .height = atlas_height,
+        .fmt = fmt,
+        .ct = imgs[0].ct,
+    };
+    for (int i=0; i<num_files; i++) {
+        frame_t *f = &spr.frames[i];
+        for (int j=0; j<f->height; j++)
+            memcpy(spr.images[0].image + ((f->y + j) * atlas_width + f->x) * bpp,
+                imgs[i].image + j * f->width * bpp, f->width * bpp);
+        if (flag_verbose)
+            fprintf(stderr, "frame %d: %s at (%d,%d) size %dx%d%s\n", i, infns[i], f->x, f->y, f->width, f->height,
+                calc_tmem_usage(fmt, f->width, f->height) > 4096 ? " (does not fit TMEM)" : "");
+    }
+    if (flag_verbose)
+        fprintf(stderr, "atlas size: %dx%d\n", atlas_width, atlas_height);
+
+    spr.hslices = 1;
+    spr.vslices = 1;
+    if (!spritemaker_write(&spr))
+        goto error;
+    if (flag_debug)
+        spritemaker_write_pngs(&spr);
+    ret = 0;
+
+error:
+    for (int i=0; i<num_files; i++)
+        free(imgs[i].image);
+    free(imgs);
+    free(order);
+    spritemaker_free(&spr);
+    return ret;
+}
+
+/** @brief A file to convert, with the parameters in effect at its position in the command line */
+typedef struct {
+    const char *infn;       // Input file
+    char *outfn;            // Output file
+    parms_t pm;             // Conversion parameters
+    bool ok;                // True if the conversion succeeded
+} convert_job_t;
+
+static void convert_job(void *ctx, int idx)
+{
+    convert_job_t *job = (convert_job_t*)ctx + idx;
+    job->ok = (convert(job->infn, job->outfn, &job->pm) == 0);
+}
+
+/** 
+ * @brief Compute a single palette for all the jobs requesting a shared palette.
+ * 
+ * All the images are fed at once to the quantizer, so that the resulting
+ * palette is optimal for the whole set. Each job is then remapped to this
+ * palette during conversion (see #convert).
+ */
+bool compute_shared_palette(convert_job_t *jobs, int num_jobs, uint8_t colors[256][4]) {
+    exq_data *exq = exq_init();
+    exq->numBitsPerChannel = 5;   // force calculations using rgb555
+    int num_colors = 256, num_images = 0;
+    bool ok = false;
+
+    for (int i=0; i<num_jobs; i++) {
+        parms_t *pm = &jobs[i].pm;
+        if (!pm->shared_palette)
+            continue;
+        if (pm->outfmt != FMT_CI4 && pm->outfmt != FMT_CI8) {
+            fprintf(stderr, "ERROR: %s: --shared-palette requires an explicit CI4 or CI8 format\n", jobs[i].infn);
+            goto error;
+        }
+        if (pm->outfmt == FMT_CI4)
+            num_colors = 16;
+
+        image_t img = {0}; palette_t pal = {0};
+        if (!load_png_image(jobs[i].infn, FMT_RGBA32, &img, &pal))
+            goto error;
+        exq_feed(exq, img.image, img.width * img.height);
+        free(img.image);
+        num_images++;
+    }
+
+    if (num_images) {
+        if (flag_verbose)
+            fprintf(stderr, "quantizing %d image(s) to a shared palette of %d colors\n", num_images, num_colors);
+        exq_quantize_hq(exq, num_colors);
+        exq_get_palette(exq, colors[0], num_colors);
+        for (int i=0; i<num_jobs; i++) {
+            if (jobs[i].pm.shared_palette) {
+                jobs[i].pm.palette = colors[0];
+                jobs[i].pm.palette_colors = num_colors;
+            }
+        }
+    }
+    ok = true;
+
+error:
+    exq_free(exq);
+    return ok;
+}
+
 bool cli_parse_texparms(const char *opt, texparms_t *parms)
 {
     char extra;
@@ -1387,6 +1654,13 @@ int main(int argc, char *argv[])
     }
 
     bool error = false;
+    const char **outfns = calloc(argc, sizeof(char*));
+    int num_files = 0;
+    const char *atlas_name = NULL;
+    const char **atlas_files = calloc(argc, sizeof(char*));
+    int num_atlas_files = 0, atlas_width = 0;
+    convert_job_t *jobs = calloc(argc, sizeof(convert_job_t));
+    int num_jobs = 0, num_threads = asset_compress_default_jobs();
     /* console arguments */
     for (int i = 1; i < argc; i++) {
         if (argv[i][0] == '-') {
@@ -1480,6 +1754,43 @@ int main(int argc, char *argv[])
                 }
             } 
             
+            /* ---------------- JOBS console argument ------------------- */
+            /* -j/--jobs <n>         Number of files converted in parallel             */
+            else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                num_threads = atoi(argv[i]);
+                if (num_threads <= 0) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+            }
+
+            /* ---------------- SHARED PALETTE console argument ------------------- */
+            /* --shared-palette      Quantize all the following files to a single palette             */
+            else if (!strcmp(argv[i], "--shared-palette")) {
+                pm.shared_palette = true;
+            }
+
+            /* ---------------- FILTER console argument ------------------- */
+            /* --filter <filter>     Prefilter pixels to improve compression (default: NONE)             */
+            else if (!strcmp(argv[i], "--filter")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                if (!strcmp(argv[i], "NONE")) pm.filter = FILTER_NONE;
+                else if (!strcmp(argv[i], "SUB")) pm.filter = FILTER_SUB;
+                else if (!strcmp(argv[i], "UP")) pm.filter = FILTER_UP;
+                else {
+                    fprintf(stderr, "invalid pixel filter: %s\n", argv[i]);
+                    print_supported_filters();
+                    return 1;
+                }
+            }
+
             /* ---------------- COMPRESS console argument ------------------- */
             /* -c/--compress         Compress output files (using mksasset)             */
             else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--compress")) {
@@ -1572,6 +1883,29 @@ int main(int argc, char *argv[])
                     return 1;
             }
             
+            /* ---------------- ATLAS console argument ------------------- */
+            /* -a/--atlas <name>     Pack all the following input files into a single atlas */
+            else if (!strcmp(argv[i], "-a") || !strcmp(argv[i], "--atlas")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                atlas_name = argv[i];
+            }
+
+            /* --atlas-width <w>     Width of the atlas in pixels */
+            else if (!strcmp(argv[i], "--atlas-width")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                atlas_width = atoi(argv[i]);
+                if (atlas_width <= 0 || atlas_width > 1024) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+            }
+
             else {
                 fprintf(stderr, "invalid flag: %s\n", argv[i]);
                 return 1;
@@ -1580,6 +1914,11 @@ int main(int argc, char *argv[])
         }
 
         at_least_one_file = true;
+        if (atlas_name) {
+            // Packed together at the end
+            atlas_files[num_atlas_files++] = argv[i];
+            continue;
+        }
         infn = argv[i];
         char *basename = strrchr(infn, '/');
         if (!basename) basename = infn; else basename += 1;
@@ -1589,24 +1928,60 @@ int main(int argc, char *argv[])
 
         asprintf(&outfn, "%s/%s.sprite", outdir, basename_noext);
 
-        if (convert(infn, outfn, &pm) != 0) {
+        // Conversion is done at the end, in parallel over all files
+        jobs[num_jobs++] = (convert_job_t){ .infn = infn, .outfn = outfn, .pm = pm };
+    }
+
+    uint8_t shared_colors[256][4];
+    if (!compute_shared_palette(jobs, num_jobs, shared_colors))
+        return 1;
+    asset_run_jobs(num_jobs, num_threads, convert_job, jobs);
+    for (int i = 0; i < num_jobs; i++) {
+        if (!jobs[i].ok) {
             error = true;
+            free(jobs[i].outfn);
         } else {
-            if (compression == -1)
-                compression = DEFAULT_COMPRESSION;
-            if (compression) {
-                struct stat st_decomp = {0}, st_comp = {0};
-                stat(outfn, &st_decomp);
-                asset_compress(outfn, outfn, compression);
-                stat(outfn, &st_comp);
-                if (flag_verbose)
-                    fprintf(stderr, "compressed: %s (%d -> %d, ratio %.1f%%)\n", outfn,
-                    (int)st_decomp.st_size, (int)st_comp.st_size, 100.0 * (float)st_comp.st_size / (float)(st_decomp.st_size == 0 ? 1 :st_decomp.st_size));
-            }
+            // Compression is done at the end, in parallel over all files
+            outfns[num_files++] = jobs[i].outfn;
         }
+    }
+    free(jobs);
 
-        free(outfn);
+    if (num_atlas_files) {
+        asprintf(&outfn, "%s/%s.sprite", outdir, atlas_name);
+        if (convert_atlas(atlas_files, num_atlas_files, outfn, &pm, atlas_width) != 0) {
+            error = true;
+            free(outfn);
+        } else {
+            outfns[num_files++] = outfn;
+        }
+    }
+    free(atlas_files);
+
+    if (compression == -1)
+        compression = DEFAULT_COMPRESSION;
+    if (compression && num_files) {
+        int *decomp_size = calloc(num_files, sizeof(int));
+        for (int i = 0; i < num_files; i++) {
+            struct stat st_decomp = {0};
+            stat(outfns[i], &st_decomp);
+            decomp_size[i] = st_decomp.st_size;
+        }
+        if (!asset_compress_parallel(outfns, outfns, num_files, compression, 0, asset_compress_default_jobs()))
+            error = true;
+        if (flag_verbose) {
+            for (int i = 0; i < num_files; i++) {
+                struct stat st_comp = {0};
+                stat(outfns[i], &st_comp);
+                fprintf(stderr, "compressed: %s (%d -> %d, ratio %.1f%%)\n", outfns[i],
+                    decomp_size[i], (int)st_comp.st_size, 100.0 * (float)st_comp.st_size / (float)(decomp_size[i] == 0 ? 1 : decomp_size[i]));
+            }
+        }
+        free(decomp_size);
     }
+    for (int i = 0; i < num_files; i++)
+        free((char*)outfns[i]);
+    free(outfns);
 
     if (!at_least_one_file) {
         infn = "(stdin)";
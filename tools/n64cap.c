@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Keep in sync with display.h
+#define DISPLAY_CAPTURE_MAGIC       0x4652414D
+#define DISPLAY_CAPTURE_VERSION     1
+#define DISPLAY_CAPTURE_HALF        0x1
+#define DISPLAY_CAPTURE_DELTA       0x2
+// Keep in sync with display.c
+#define CAPTURE_TILE                16
+
+const char *flag_output = NULL;
+bool flag_verbose = false;
+
+void usage(const char *progname)
+{
+    fprintf(stderr, "%s - Decode the frames captured by display_capture_start\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Usage: %s [flags] <capture.bin> [<capture.bin>...]\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Command-line flags:\n");
+    fprintf(stderr, "   -o/--output <fmt>     Write each frame to a PPM file (eg: frame%%05d.ppm)\n");
+    fprintf(stderr, "   -v/--verbose          Print information about each frame\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "The files are concatenated in order, as the frames can be split across\n");
+    fprintf(stderr, "multiple USB messages. Without -o, the frames are written to standard\n");
+    fprintf(stderr, "output as a stream of PPM images, that can be encoded into a video with:\n");
+    fprintf(stderr, "   %s capture.bin | ffmpeg -f image2pipe -framerate 30 -c:v ppm -i - capture.mp4\n", progname);
+}
+
+uint32_t r32(const uint8_t *p) { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+uint16_t r16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+
+// Append the contents of a file to a buffer
+void file_append(const char *fn, uint8_t **data, long *size)
+{
+    FILE *f = fopen(fn, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: cannot open file: %s\n", fn);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    *data = realloc(*data, *size + sz);
+    if (fread(*data + *size, 1, sz, f) != sz) {
+        fprintf(stderr, "Error: cannot read file: %s\n", fn);
+        exit(1);
+    }
+    *size += sz;
+    fclose(f);
+}
+
+// Current frame, with compact rows
+struct {
+    uint8_t *pixels;
+    int width, height, bpp;
+    bool valid;
+} canvas;
+
+void canvas_resize(int width, int height, int bpp)
+{
+    if (canvas.width == width && canvas.height == height && canvas.bpp == bpp)
+        return;
+    canvas.pixels = realloc(canvas.pixels, width * height * bpp);
+    canvas.width = width;
+    canvas.height = height;
+    canvas.bpp = bpp;
+    canvas.valid = false;
+}
+
+// Apply a delta frame: a bitmap of the changed tiles, followed by their rows
+bool canvas_apply_delta(const uint8_t *payload, uint32_t size)
+{
+    int tiles_x = (canvas.width + CAPTURE_TILE - 1) / CAPTURE_TILE;
+    int tiles_y = (canvas.height + CAPTURE_TILE - 1) / CAPTURE_TILE;
+    uint32_t bitmap_size = (tiles_x * tiles_y + 31) / 32 * 4;
+    if (size < bitmap_size)
+        return false;
+    const uint8_t *in = payload + bitmap_size, *end = payload + size;
+    int stride = canvas.width * canvas.bpp;
+
+    for (int t = 0; t < tiles_x * tiles_y; t++) {
+        if (!(r32(payload + t / 32 * 4) & (0x80000000 >> (t & 31))))
+            continue;
+        int tx = t % tiles_x, ty = t / tiles_x;
+        int rows = canvas.height - ty * CAPTURE_TILE;
+        if (rows > CAPTURE_TILE) rows = CAPTURE_TILE;
+        int row_bytes = canvas.width - tx * CAPTURE_TILE;
+        if (row_bytes > CAPTURE_TILE) row_bytes = CAPTURE_TILE;
+        row_bytes *= canvas.bpp;
+        if (in + rows * row_bytes > end)
+            return false;
+        uint8_t *dst = canvas.pixels + ty * CAPTURE_TILE * stride + tx * CAPTURE_TILE * canvas.bpp;
+        for (int y = 0; y < rows; y++) {
+            memcpy(dst + y * stride, in, row_bytes);
+            in += row_bytes;
+        }
+    }
+    return true;
+}
+
+// Write the canvas as a binary PPM image
+void canvas_write(FILE *f)
+{
+    fprintf(f, "P6\n%d %d\n255\n", canvas.width, canvas.height);
+    for (int i = 0; i < canvas.width * canvas.height; i++) {
+        const uint8_t *p = canvas.pixels + i * canvas.bpp;
+        uint8_t rgb[3];
+        if (canvas.bpp == 2) {
+            uint16_t c = r16(p);
+            int r = (c >> 11) & 0x1F, g = (c >> 6) & 0x1F, b = (c >> 1) & 0x1F;
+            rgb[0] = (r << 3) | (r >> 2);
+            rgb[1] = (g << 3) | (g >> 2);
+            rgb[2] = (b << 3) | (b >> 2);
+        } else {
+            memcpy(rgb, p, 3);
+        }
+        fwrite(rgb, 1, 3, f);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            usage(argv[0]);
+            return 0;
+        } else if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) {
+            if (++i == argc) {
+                fprintf(stderr, "Error: missing argument for %s\n", argv[i-1]);
+                return 1;
+            }
+            flag_output = argv[i];
+        } else if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
+            flag_verbose = true;
+        } else {
+            fprintf(stderr, "Error: invalid flag: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (i == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    uint8_t *data = NULL;
+    long size = 0;
+    for (; i < argc; i++)
+        file_append(argv[i], &data, &size);
+
+    int num_frames = 0, num_skipped = 0;
+    int64_t last_seq = -1;
+    long pos = 0;
+    while (pos + 32 <= size) {
+        // Search the next frame header, skipping any other data
+        const uint8_t *h = data + pos;
+        if (r32(h) != DISPLAY_CAPTURE_MAGIC) {
+            pos += 4;
+            continue;
+        }
+        if (r32(h+4) != DISPLAY_CAPTURE_VERSION) {
+            fprintf(stderr, "Error: unsupported capture version: %d\n", r32(h+4));
+            return 1;
+        }
+        uint32_t seq = r32(h+8), flags = r32(h+12);
+        int width = r32(h+16), height = r32(h+20);
+        int bpp = r32(h+24) >> 16, stride = r32(h+24) & 0xFFFF;
+        uint32_t payload_size = r32(h+28);
+        const uint8_t *payload = h + 32;
+        if (pos + 32 + payload_size > size) {
+            fprintf(stderr, "Warning: truncated frame %d\n", seq);
+            break;
+        }
+        pos += 32 + payload_size;
+
+        if (last_seq >= 0 && seq != last_seq + 1) {
+            fprintf(stderr, "Warning: missing frames %d-%d\n", (int)(last_seq + 1), seq - 1);
+            canvas.valid = false;
+        }
+        last_seq = seq;
+
+        if ((bpp != 2 && bpp != 4) || width <= 0 || height <= 0 || stride < width * bpp) {
+            fprintf(stderr, "Warning: invalid frame %d (%dx%d, %d bytes per pixel)\n", seq, width, height, bpp);
+            continue;
+        }
+        canvas_resize(width, height, bpp);
+
+        if (flags & DISPLAY_CAPTURE_DELTA) {
+            // A delta frame can only be applied on top of the previous one
+            if (!canvas.valid || !canvas_apply_delta(payload, payload_size)) {
+                canvas.valid = false;
+                num_skipped++;
+                continue;
+            }
+        } else {
+            if (payload_size < (uint32_t)stride * (height - 1) + width * bpp) {
+                fprintf(stderr, "Warning: invalid frame %d (payload too short)\n", seq);
+                continue;
+            }
+            for (int y = 0; y < height; y++)
+                memcpy(canvas.pixels + y * width * bpp, payload + y * stride, width * bpp);
+            canvas.valid = true;
+        }
+
+        if (flag_verbose)
+            fprintf(stderr, "frame %d: %dx%d %s%s, %d bytes\n", seq, width, height,
+                flags & DISPLAY_CAPTURE_DELTA ? "delta" : "full",
+                flags & DISPLAY_CAPTURE_HALF ? " (half)" : "", payload_size);
+
+        if (flag_output) {
+            char fn[4096];
+            snprintf(fn, sizeof(fn), flag_output, num_frames);
+            FILE *f = fopen(fn, "wb");
+            if (!f) {
+                fprintf(stderr, "Error: cannot create file: %s\n", fn);
+                return 1;
+            }
+            canvas_write(f);
+            fclose(f);
+        } else {
+            canvas_write(stdout);
+        }
+        num_frames++;
+    }
+
+    fprintf(stderr, "%d frames decoded", num_frames);
+    if (num_skipped)
+        fprintf(stderr, ", %d delta frames skipped (missing previous frame)", num_skipped);
+    fprintf(stderr, "\n");
+    free(data);
+    return 0;
+}
@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Keep in sync with debug.c
+#define BINLOG_MAGIC             0x424C4F47
+#define BINLOG_VERSION           1
+#define TICKS_PER_SECOND         46875000
+
+bool flag_timestamps = true;
+
+void usage(const char *progname)
+{
+    fprintf(stderr, "%s - Format binary logs recorded by debugbf\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Usage: %s [flags] <program.elf> <binlog.bin> [<binlog.bin>...]\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Command-line flags:\n");
+    fprintf(stderr, "   --no-timestamps       Do not prefix messages with their timestamp\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Files must be given in the order they were received. The ELF file\n");
+    fprintf(stderr, "must be the one the ROM was built from, as format strings are read\n");
+    fprintf(stderr, "from it.\n");
+}
+
+uint32_t r32(const uint8_t *p) { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+uint16_t r16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+uint64_t r64(const uint8_t *p) { return ((uint64_t)r32(p) << 32) | r32(p + 4); }
+
+uint8_t *file_read(const char *fn, long *size)
+{
+    FILE *f = fopen(fn, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: cannot open file: %s\n", fn);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*size + 1);
+    if (fread(data, 1, *size, f) != *size) {
+        fprintf(stderr, "Error: cannot read file: %s\n", fn);
+        exit(1);
+    }
+    data[*size] = 0;
+    fclose(f);
+    return data;
+}
+
+// ELF file, used to read the format strings
+uint8_t *elf;
+long elf_size;
+
+void elf_load(const char *fn)
+{
+    elf = file_read(fn, &elf_size);
+    if (elf_size < 52 || memcmp(elf, "\x7F" "ELF", 4) || elf[4] != 1 || elf[5] != 2) {
+        fprintf(stderr, "Error: not a 32-bit big-endian ELF file: %s\n", fn);
+        exit(1);
+    }
+}
+
+// Return the string at the specified address in the ELF file, or NULL
+const char *elf_string(uint32_t addr)
+{
+    uint32_t shoff = r32(elf + 0x20);
+    uint16_t shentsize = r16(elf + 0x2E);
+    uint16_t shnum = r16(elf + 0x30);
+    for (int i = 0; i < shnum; i++) {
+        const uint8_t *sh = elf + shoff + i * shentsize;
+        if (sh + 40 > elf + elf_size) break;
+        uint32_t type = r32(sh + 4), flags = r32(sh + 8);
+        uint32_t sh_addr = r32(sh + 12), offset = r32(sh + 16), size = r32(sh + 20);
+        // Only allocated sections with contents (not NOBITS)
+        if (!(flags & 2) || type == 8) continue;
+        if (addr >= sh_addr && addr < sh_addr + size && offset + size <= elf_size) {
+            const char *s = (const char*)elf + offset + (addr - sh_addr);
+            if (memchr(s, 0, sh_addr + size - addr)) return s;
+        }
+    }
+    return NULL;
+}
+
+// Format a message, consuming the arguments from the payload. This must
+// parse the format string exactly like debug_binlogf.
+void format_message(FILE *out, const char *fmt, const uint8_t *p, const uint8_t *end)
+{
+    #define ARG_CHECK(n)   if (p + (n) > end) { fprintf(out, "<missing argument>"); return; }
+    for (const char *f = fmt; *f; f++) {
+        if (*f != '%') { fputc(*f, out); continue; }
+
+        // Rebuild the specifier for the host printf, without length modifiers
+        char spec[64] = "%"; int sl = 1;
+        const char *start = f++;
+        while (*f && strchr("-+ #0", *f) && sl < 16) spec[sl++] = *f++;
+        if (*f == '*') { ARG_CHECK(4); sl += sprintf(spec + sl, "%d", (int32_t)r32(p)); p += 4; f++; }
+        while (*f >= '0' && *f <= '9' && sl < 32) spec[sl++] = *f++;
+        if (*f == '.') {
+            spec[sl++] = *f++;
+            if (*f == '*') { ARG_CHECK(4); sl += sprintf(spec + sl, "%d", (int32_t)r32(p)); p += 4; f++; }
+            while (*f >= '0' && *f <= '9' && sl < 48) spec[sl++] = *f++;
+        }
+        bool is64 = false;
+        for (int longs = 0; *f && strchr("hlLqjzt", *f); f++) {
+            if (*f == 'l' && ++longs == 2) is64 = true;
+            if (*f == 'q' || *f == 'j') is64 = true;
+        }
+        if (!*f) { fputs(start, out); return; }
+
+        switch (*f) {
+        case 'd': case 'i':
+            if (is64) { ARG_CHECK(8); strcpy(spec + sl, "lld"); fprintf(out, spec, (long long)r64(p)); p += 8; }
+            else      { ARG_CHECK(4); spec[sl++] = *f; spec[sl] = 0; fprintf(out, spec, (int32_t)r32(p)); p += 4; }
+            break;
+        case 'u': case 'x': case 'X': case 'o':
+            if (is64) { ARG_CHECK(8); sprintf(spec + sl, "ll%c", *f); fprintf(out, spec, (unsigned long long)r64(p)); p += 8; }
+            else      { ARG_CHECK(4); spec[sl++] = *f; spec[sl] = 0; fprintf(out, spec, r32(p)); p += 4; }
+            break;
+        case 'c':
+            ARG_CHECK(4); spec[sl++] = 'c'; spec[sl] = 0; fprintf(out, spec, (int)r32(p)); p += 4;
+            break;
+        case 'p':
+            ARG_CHECK(4); fprintf(out, "0x%08x", r32(p)); p += 4;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+            ARG_CHECK(8);
+            uint64_t bits = r64(p); double v; memcpy(&v, &bits, 8); p += 8;
+            spec[sl++] = *f; spec[sl] = 0; fprintf(out, spec, v);
+            break;
+        }
+        case 's': {
+            ARG_CHECK(4);
+            uint32_t len = r32(p); p += 4;
+            ARG_CHECK(len);
+            char *s = strndup((const char*)p, len);
+            p += (len + 3) & ~3;
+            spec[sl++] = 's'; spec[sl] = 0; fprintf(out, spec, s);
+            free(s);
+            break;
+        }
+        case '%':
+            fputc('%', out);
+            break;
+        default:
+            // Unsupported conversion (eg: %n): print it as it is
+            fwrite(start, 1, f - start + 1, out);
+            break;
+        }
+    }
+    #undef ARG_CHECK
+}
+
+bool has_time = false;
+uint32_t last_ticks;
+uint64_t time64;
+bool line_start = true;
+
+void load_binlog(const char *fn)
+{
+    long size;
+    uint8_t *data = file_read(fn, &size);
+    uint8_t *p = data, *end = data + size;
+
+    // A file might contain multiple messages concatenated
+    while (p + 16 <= end) {
+        if (r32(p) != BINLOG_MAGIC || r32(p + 4) != BINLOG_VERSION) {
+            fprintf(stderr, "Error: invalid binary log file: %s\n", fn);
+            exit(1);
+        }
+        uint32_t words = r32(p + 8);
+        uint32_t dropped = r32(p + 12);
+        p += 16;
+        uint8_t *mend = p + words * 4;
+        if (mend > end) {
+            fprintf(stderr, "Warning: truncated binary log file: %s\n", fn);
+            mend = end;
+        }
+
+        if (dropped)
+            printf("%s[n64log: %u messages dropped]\n", line_start ? "" : "\n", dropped);
+
+        while (p + 12 <= mend) {
+            uint32_t fmt_addr = r32(p), ticks = r32(p + 4), psize = r32(p + 8);
+            p += 12;
+            const uint8_t *payload = p;
+            p += (psize + 3) & ~3;
+            if (p > mend) break;
+
+            // Timestamps are 32-bit and wrap around, but consecutive messages
+            // are usually much closer than that.
+            if (has_time)
+                time64 += (uint32_t)(ticks - last_ticks);
+            has_time = true;
+            last_ticks = ticks;
+
+            if (flag_timestamps && line_start)
+                printf("[%12.6f] ", (double)time64 / TICKS_PER_SECOND);
+
+            const char *fmt = elf_string(fmt_addr);
+            if (!fmt) {
+                printf("<unknown format string at 0x%08x>\n", fmt_addr);
+                line_start = true;
+                continue;
+            }
+            format_message(stdout, fmt, payload, payload + psize);
+            line_start = fmt[0] && fmt[strlen(fmt) - 1] == '\n';
+        }
+        p = mend;
+    }
+    free(data);
+}
+
+int main(int argc, char *argv[])
+{
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            usage(argv[0]);
+            return 0;
+        } else if (!strcmp(argv[i], "--no-timestamps")) {
+            flag_timestamps = false;
+        } else {
+            fprintf(stderr, "invalid flag: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (argc - i < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    elf_load(argv[i++]);
+    for (; i < argc; i++)
+        load_binlog(argv[i]);
+    return 0;
+}
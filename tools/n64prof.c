@@ -0,0 +1,456 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define STBDS_NO_SHORT_NAMES
+#define STB_DS_IMPLEMENTATION
+#include "common/stb_ds.h"
+
+// Keep in sync with cpu_profile.h
+#define CPU_PROFILE_MAGIC           0x50524F46
+#define CPU_PROFILE_VERSION         1
+#define CPU_PROFILE_MAX_DEPTH       16
+
+// Keep in sync with heap_profile.h
+#define HEAP_PROFILE_MAGIC          0x48454150
+#define HEAP_PROFILE_VERSION        1
+#define HEAP_PROFILE_MAX_DEPTH      8
+
+bool flag_folded = false;
+bool flag_callgraph = true;
+bool flag_hot = false;
+int flag_max_lines = 50;
+
+void usage(const char *progname)
+{
+    fprintf(stderr, "%s - Symbolize and analyze CPU and heap profiles recorded by cpu_profile and heap_profile\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Usage: %s [flags] <program.sym> <profile.bin> [<profile.bin>...]\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Command-line flags:\n");
+    fprintf(stderr, "   -n/--lines <N>        Number of functions to show (default: 50, 0: all)\n");
+    fprintf(stderr, "   --flat                Only show the flat profile (no call graph)\n");
+    fprintf(stderr, "   --folded              Output folded stacks (for flamegraph.pl)\n");
+    fprintf(stderr, "   --hot                 Output the names of the hot functions (for N64_HOT_FUNCTIONS)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "The symbol table is generated by n64sym from the ELF file. For heap\n");
+    fprintf(stderr, "profiles, the last dump found in the files is shown.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "With --hot, the -n functions that were most often on the stack are listed,\n");
+    fprintf(stderr, "hottest first. Save the list to a file and set N64_HOT_FUNCTIONS to it, so\n");
+    fprintf(stderr, "that the linker lays them out contiguously (for I-cache locality).\n");
+}
+
+uint32_t r32(const uint8_t *p) { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+uint16_t r16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+
+uint8_t *file_read(const char *fn, int *size)
+{
+    FILE *f = fopen(fn, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: cannot open file: %s\n", fn);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*size);
+    if (fread(data, 1, *size, f) != *size) {
+        fprintf(stderr, "Error: cannot read file: %s\n", fn);
+        exit(1);
+    }
+    fclose(f);
+    return data;
+}
+
+// Symbol table, as generated by n64sym. See symtable_header_t in backtrace.c
+// for the layout.
+struct {
+    uint8_t *data;
+    int size;
+    uint32_t addrtab_off, addrtab_size;
+    uint32_t symtab_off, symtab_size;
+    uint32_t strtab_off, strtab_size;
+} symt;
+
+void symt_load(const char *fn)
+{
+    symt.data = file_read(fn, &symt.size);
+    if (symt.size < 32 || memcmp(symt.data, "SYMT", 4)) {
+        fprintf(stderr, "Error: invalid symbol table: %s\n", fn);
+        exit(1);
+    }
+    if (r32(symt.data + 4) < 2 || r32(symt.data + 4) > 4) {
+        fprintf(stderr, "Error: unsupported symbol table version %d: %s\n", r32(symt.data + 4), fn);
+        exit(1);
+    }
+    symt.addrtab_off = r32(symt.data + 8);
+    symt.addrtab_size = r32(symt.data + 12);
+    symt.symtab_off = r32(symt.data + 16);
+    symt.symtab_size = r32(symt.data + 20);
+    symt.strtab_off = r32(symt.data + 24);
+    symt.strtab_size = r32(symt.data + 28);
+}
+
+uint32_t symt_addr(int idx) { return r32(symt.data + symt.addrtab_off + idx * 4); }
+
+// Return the index of the function containing the address, or -1 if unknown
+int symt_find_func(uint32_t addr)
+{
+    int lo = 0, hi = symt.addrtab_size - 1, idx = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if ((symt_addr(mid) & ~3) <= addr) {
+            idx = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    while (idx >= 0 && !(symt_addr(idx) & 1))
+        idx--;
+    return idx;
+}
+
+// Return the name of the function at the specified index (as returned by symt_find_func)
+char *symt_func_name(int idx)
+{
+    static char unknown[] = "???";
+    if (idx < 0) return unknown;
+    const uint8_t *e = symt.data + symt.symtab_off + idx * 16;
+    uint32_t sidx = r32(e);
+    uint16_t len = r16(e + 8);
+    if (sidx == 0xFFFFFFFF || sidx + len > symt.strtab_size) return unknown;
+    return strndup((const char*)symt.data + symt.strtab_off + sidx, len);
+}
+
+// Statistics for a function
+typedef struct {
+    int key;                    // Function index in the symbol table
+    char *name;
+    int self;                   // Samples where the function was running
+    int total;                  // Samples where the function was on the stack
+    struct { int key; int value; } *callers;   // Samples per calling function
+} func_t;
+
+func_t *funcs = NULL;
+struct { char *key; int value; } *folded = NULL;
+int num_samples = 0;
+int num_dropped = 0;
+uint32_t period = 0;
+
+// A call site in a heap dump
+typedef struct {
+    uint32_t live_bytes, live_blocks, peak_bytes, allocs, total_bytes;
+    int depth;
+    uint32_t callstack[HEAP_PROFILE_MAX_DEPTH];
+} heap_site_t;
+
+// Last heap dump found
+struct {
+    bool found;
+    int count;
+    uint32_t live_bytes, live_blocks, peak_bytes, dropped;
+    heap_site_t *sites;
+} heap;
+
+func_t *func_get(int idx)
+{
+    func_t *f = stbds_hmgetp_null(funcs, idx);
+    if (!f) {
+        stbds_hmputs(funcs, ((func_t){ .key = idx, .name = symt_func_name(idx) }));
+        f = stbds_hmgetp_null(funcs, idx);
+    }
+    return f;
+}
+
+void add_sample(uint32_t *addrs, int depth)
+{
+    int fidx[CPU_PROFILE_MAX_DEPTH];
+    for (int i = 0; i < depth; i++)
+        fidx[i] = symt_find_func(addrs[i]);
+
+    num_samples++;
+    func_get(fidx[0])->self++;
+
+    for (int i = 0; i < depth; i++) {
+        // Count each function once per sample, even if recursive
+        bool seen = false;
+        for (int j = 0; j < i; j++)
+            if (fidx[j] == fidx[i]) { seen = true; break; }
+        func_t *f = func_get(fidx[i]);
+        if (!seen)
+            f->total++;
+        if (i + 1 < depth && !seen) {
+            int n = stbds_hmget(f->callers, fidx[i+1]);
+            stbds_hmput(f->callers, fidx[i+1], n + 1);
+        }
+    }
+
+    if (flag_folded) {
+        // Folded stacks start from the outermost caller
+        char *line = NULL;
+        for (int i = depth - 1; i >= 0; i--) {
+            char *name = func_get(fidx[i])->name;
+            int len = strlen(name);
+            int pos = stbds_arraddnindex(line, len + 1);
+            memcpy(line + pos, name, len);
+            line[pos + len] = i ? ';' : 0;
+        }
+        int n = stbds_shget(folded, line);
+        stbds_shput(folded, line, n + 1);
+        stbds_arrfree(line);
+    }
+}
+
+// Load a heap dump, returning the pointer to the data that follows it
+uint8_t *load_heap_dump(const char *fn, uint8_t *p, uint8_t *end)
+{
+    if (p + 28 > end || r32(p + 4) != HEAP_PROFILE_VERSION) {
+        fprintf(stderr, "Error: invalid heap profile file: %s\n", fn);
+        exit(1);
+    }
+    heap.found = true;
+    heap.count++;
+    heap.live_bytes = r32(p + 8);
+    heap.live_blocks = r32(p + 12);
+    heap.peak_bytes = r32(p + 16);
+    uint32_t num_sites = r32(p + 20);
+    heap.dropped = r32(p + 24);
+    p += 28;
+
+    stbds_arrfree(heap.sites);
+    for (int i = 0; i < num_sites; i++) {
+        heap_site_t s = {0};
+        if (p + 24 > end || (s.depth = r32(p + 20)) > HEAP_PROFILE_MAX_DEPTH || p + 24 + s.depth * 4 > end) {
+            fprintf(stderr, "Error: corrupted heap profile file: %s\n", fn);
+            exit(1);
+        }
+        s.live_bytes = r32(p);
+        s.live_blocks = r32(p + 4);
+        s.peak_bytes = r32(p + 8);
+        s.allocs = r32(p + 12);
+        s.total_bytes = r32(p + 16);
+        p += 24;
+        for (int j = 0; j < s.depth; j++, p += 4)
+            s.callstack[j] = r32(p);
+        stbds_arrput(heap.sites, s);
+    }
+    return p;
+}
+
+void load_profile(const char *fn)
+{
+    int size;
+    uint8_t *data = file_read(fn, &size);
+    uint8_t *end = data + size;
+    uint8_t *p = data;
+
+    // A file might contain multiple dumps concatenated
+    while (p + 20 <= end) {
+        if (r32(p) == HEAP_PROFILE_MAGIC) {
+            p = load_heap_dump(fn, p, end);
+            continue;
+        }
+        if (r32(p) != CPU_PROFILE_MAGIC || r32(p + 4) != CPU_PROFILE_VERSION) {
+            fprintf(stderr, "Error: invalid profile file: %s\n", fn);
+            exit(1);
+        }
+        period = r32(p + 8);
+        uint32_t words = r32(p + 12);
+        num_dropped += r32(p + 16);
+        p += 20;
+        uint8_t *dend = p + words * 4;
+        if (dend > end) {
+            fprintf(stderr, "Warning: truncated profile file: %s\n", fn);
+            dend = end;
+        }
+
+        while (p + 4 <= dend) {
+            int depth = r32(p); p += 4;
+            if (depth < 1 || depth > CPU_PROFILE_MAX_DEPTH || p + depth * 4 > dend) {
+                fprintf(stderr, "Error: corrupted profile file: %s\n", fn);
+                exit(1);
+            }
+            uint32_t addrs[CPU_PROFILE_MAX_DEPTH];
+            for (int i = 0; i < depth; i++, p += 4)
+                addrs[i] = r32(p);
+            add_sample(addrs, depth);
+        }
+        p = dend;
+    }
+    free(data);
+}
+
+int cmp_self(const void *a, const void *b)
+{
+    const func_t *fa = a, *fb = b;
+    if (fa->self != fb->self) return fb->self - fa->self;
+    return fb->total - fa->total;
+}
+
+int cmp_total(const void *a, const void *b)
+{
+    const func_t *fa = a, *fb = b;
+    if (fa->total != fb->total) return fb->total - fa->total;
+    return fb->self - fa->self;
+}
+
+void print_profile(void)
+{
+    int n = stbds_hmlen(funcs);
+    int lines = flag_max_lines && flag_max_lines < n ? flag_max_lines : n;
+    func_t *sorted = malloc(n * sizeof(func_t));
+    memcpy(sorted, funcs, n * sizeof(func_t));
+
+    printf("%d samples", num_samples);
+    if (period)
+        printf(" (%.1f Hz, %.2f s)", 46875000.0 / period, (double)num_samples * period / 46875000.0);
+    if (num_dropped)
+        printf(", %d dropped", num_dropped);
+    printf("\n\n");
+
+    printf("Flat profile:\n");
+    printf("  self%%  total%%     self    total  function\n");
+    qsort(sorted, n, sizeof(func_t), cmp_self);
+    for (int i = 0; i < lines; i++) {
+        func_t *f = &sorted[i];
+        printf("%6.2f %7.2f %8d %8d  %s\n",
+            100.0 * f->self / num_samples, 100.0 * f->total / num_samples, f->self, f->total, f->name);
+    }
+
+    if (flag_callgraph) {
+        printf("\nCall graph (callers of each function):\n");
+        qsort(sorted, n, sizeof(func_t), cmp_total);
+        for (int i = 0; i < lines; i++) {
+            func_t *f = &sorted[i];
+            printf("\n%6.2f%%  %s\n", 100.0 * f->total / num_samples, f->name);
+            for (int j = 0; j < stbds_hmlen(f->callers); j++) {
+                func_t *caller = stbds_hmgetp_null(funcs, f->callers[j].key);
+                printf("           %8d  called from %s\n", f->callers[j].value, caller ? caller->name : "???");
+            }
+        }
+    }
+    free(sorted);
+}
+
+// Print the names of the hot functions, as used in their sections (.text.NAME)
+void print_hot_functions(void)
+{
+    int n = stbds_hmlen(funcs);
+    int lines = flag_max_lines && flag_max_lines < n ? flag_max_lines : n;
+    func_t *sorted = malloc(n * sizeof(func_t));
+    memcpy(sorted, funcs, n * sizeof(func_t));
+
+    // Functions on the stack run too (around the calls), so sort by total
+    qsort(sorted, n, sizeof(func_t), cmp_total);
+    int skipped = 0;
+    for (int i = 0; i < n && lines > 0; i++) {
+        func_t *f = &sorted[i];
+        // The symbol table has demangled names: C++ functions (and unknown
+        // addresses) cannot be matched to their sections
+        if (f->key < 0 || strpbrk(f->name, ":( <")) {
+            skipped++;
+            continue;
+        }
+        printf("%s\n", f->name);
+        lines--;
+    }
+    if (skipped)
+        fprintf(stderr, "%d functions skipped (C++ or unknown)\n", skipped);
+    free(sorted);
+}
+
+int cmp_live_bytes(const void *a, const void *b)
+{
+    const heap_site_t *sa = a, *sb = b;
+    if (sa->live_bytes != sb->live_bytes) return sa->live_bytes < sb->live_bytes ? 1 : -1;
+    return sa->total_bytes < sb->total_bytes ? 1 : (sa->total_bytes > sb->total_bytes ? -1 : 0);
+}
+
+void print_heap_profile(void)
+{
+    int n = stbds_arrlen(heap.sites);
+    int lines = flag_max_lines && flag_max_lines < n ? flag_max_lines : n;
+    qsort(heap.sites, n, sizeof(heap_site_t), cmp_live_bytes);
+
+    printf("Heap: %u bytes in %u blocks (peak: %u bytes)", heap.live_bytes, heap.live_blocks, heap.peak_bytes);
+    if (heap.dropped)
+        printf(", %u allocations not tracked", heap.dropped);
+    if (heap.count > 1)
+        printf(" [last of %d dumps]", heap.count);
+    printf("\n\n");
+
+    printf("      live   blocks       peak   allocs      total  call site\n");
+    for (int i = 0; i < lines; i++) {
+        heap_site_t *s = &heap.sites[i];
+        printf("%10u %8u %10u %8u %10u  ", s->live_bytes, s->live_blocks, s->peak_bytes, s->allocs, s->total_bytes);
+        for (int j = 0; j < s->depth; j++)
+            printf("%s%s", j ? " <- " : "", func_get(symt_find_func(s->callstack[j]))->name);
+        printf("\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            usage(argv[0]);
+            return 0;
+        } else if (!strcmp(argv[i], "--flat")) {
+            flag_callgraph = false;
+        } else if (!strcmp(argv[i], "--folded")) {
+            flag_folded = true;
+        } else if (!strcmp(argv[i], "--hot")) {
+            flag_hot = true;
+        } else if (!strcmp(argv[i], "-n") || !strcmp(argv[i], "--lines")) {
+            if (++i == argc) {
+                fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                return 1;
+            }
+            flag_max_lines = atoi(argv[i]);
+        } else {
+            fprintf(stderr, "invalid flag: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (argc - i < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    stbds_sh_new_strdup(folded);
+    symt_load(argv[i++]);
+    for (; i < argc; i++)
+        load_profile(argv[i]);
+
+    if (!num_samples && !heap.found) {
+        fprintf(stderr, "No samples found\n");
+        return 1;
+    }
+
+    if (flag_hot) {
+        if (!num_samples) {
+            fprintf(stderr, "No CPU samples found\n");
+            return 1;
+        }
+        print_hot_functions();
+    } else if (flag_folded) {
+        for (int j = 0; j < stbds_shlen(folded); j++)
+            printf("%s %d\n", folded[j].key, folded[j].value);
+    } else {
+        if (num_samples)
+            print_profile();
+        if (num_samples && heap.found)
+            printf("\n");
+        if (heap.found)
+            print_heap_profile();
+    }
+    return 0;
+}
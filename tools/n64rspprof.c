@@ -0,0 +1,350 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+
+// Keep in sync with rsp_profile.h
+#define RSP_PROFILE_MAGIC           0x52535050
+#define RSP_PROFILE_VERSION         1
+#define RSP_PROFILE_IMEM_SLOTS      1024
+#define RSP_PROFILE_NAME_LEN        32
+
+bool flag_addr = false;
+int flag_max_lines = 50;
+
+void usage(const char *progname)
+{
+    fprintf(stderr, "%s - Symbolize and analyze RSP profiles recorded by rsp_profile\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Usage: %s [flags] [<ucode.elf>...] <profile.bin> [<profile.bin>...]\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Command-line flags:\n");
+    fprintf(stderr, "   -n/--lines <N>        Number of lines to show per ucode (default: 50, 0: all)\n");
+    fprintf(stderr, "   --addr                Show the samples of each address, instead of each label\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "The ELF files of the ucodes are left by the build system next to the object\n");
+    fprintf(stderr, "files (eg: build/rsp_mixer.elf). Each ucode is matched to the ELF file with\n");
+    fprintf(stderr, "the same name; ucodes without an ELF file are shown with raw addresses.\n");
+}
+
+uint32_t r32(const uint8_t *p) { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+uint16_t r16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+
+uint8_t *file_read(const char *fn, int *size)
+{
+    FILE *f = fopen(fn, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: cannot open file: %s\n", fn);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*size);
+    if (fread(data, 1, *size, f) != *size) {
+        fprintf(stderr, "Error: cannot read file: %s\n", fn);
+        exit(1);
+    }
+    fclose(f);
+    return data;
+}
+
+// A label in the text segment of a ucode
+typedef struct {
+    uint32_t addr;
+    char *name;
+    bool global;
+} label_t;
+
+// Samples of a ucode, with its labels
+typedef struct {
+    char name[RSP_PROFILE_NAME_LEN + 1];
+    uint32_t samples;
+    uint32_t counts[RSP_PROFILE_IMEM_SLOTS];
+    label_t *labels;
+    int num_labels;
+} ucode_t;
+
+ucode_t *ucodes = NULL;
+int num_ucodes = 0;
+int num_samples = 0;
+int num_idle = 0;
+int num_dropped = 0;
+uint32_t period = 0;
+
+// ELF files given on the command line, matched to ucodes by name
+struct { char *name; char *fn; } *elfs = NULL;
+int num_elfs = 0;
+
+ucode_t *ucode_get(const char *name)
+{
+    for (int i = 0; i < num_ucodes; i++)
+        if (!strcmp(ucodes[i].name, name))
+            return &ucodes[i];
+    ucodes = realloc(ucodes, (num_ucodes + 1) * sizeof(ucode_t));
+    ucode_t *u = &ucodes[num_ucodes++];
+    memset(u, 0, sizeof(ucode_t));
+    strncpy(u->name, name, RSP_PROFILE_NAME_LEN);
+    return u;
+}
+
+int cmp_label(const void *a, const void *b)
+{
+    const label_t *la = a, *lb = b;
+    if (la->addr != lb->addr) return la->addr < lb->addr ? -1 : 1;
+    return lb->global - la->global;
+}
+
+// Load the labels of the text segment from the symbol table of a ucode ELF file
+void elf_load_labels(ucode_t *u, const char *fn)
+{
+    int size;
+    uint8_t *data = file_read(fn, &size);
+    if (size < 52 || memcmp(data, "\x7F" "ELF\x01\x02", 6)) {
+        fprintf(stderr, "Error: not a big-endian ELF32 file: %s\n", fn);
+        exit(1);
+    }
+    uint32_t shoff = r32(data + 0x20);
+    uint16_t shentsize = r16(data + 0x2E);
+    uint16_t shnum = r16(data + 0x30);
+    if (shoff + shnum * shentsize > size) {
+        fprintf(stderr, "Error: corrupted ELF file: %s\n", fn);
+        exit(1);
+    }
+
+    for (int i = 0; i < shnum; i++) {
+        uint8_t *sh = data + shoff + i * shentsize;
+        if (r32(sh + 4) != 2)   // SHT_SYMTAB
+            continue;
+        uint32_t symoff = r32(sh + 16), symsize = r32(sh + 20);
+        uint8_t *strsh = data + shoff + r32(sh + 24) * shentsize;
+        uint32_t stroff = r32(strsh + 16);
+        if (symoff + symsize > size) {
+            fprintf(stderr, "Error: corrupted ELF file: %s\n", fn);
+            exit(1);
+        }
+
+        for (uint8_t *sym = data + symoff; sym + 16 <= data + symoff + symsize; sym += 16) {
+            uint16_t shndx = r16(sym + 14);
+            int type = sym[12] & 0xF;
+            if (shndx == 0 || shndx >= shnum || (type != 0 && type != 2))  // STT_NOTYPE, STT_FUNC
+                continue;
+            if (!(r32(data + shoff + shndx * shentsize + 8) & 0x4))         // SHF_EXECINSTR
+                continue;
+            const char *name = (const char*)data + stroff + r32(sym);
+            if (!name[0] || name[0] == '$' || !strncmp(name, ".L", 2))
+                continue;
+            u->labels = realloc(u->labels, (u->num_labels + 1) * sizeof(label_t));
+            u->labels[u->num_labels++] = (label_t){
+                .addr = r32(sym + 4) & 0xFFF,
+                .name = strdup(name),
+                .global = (sym[12] >> 4) != 0,
+            };
+        }
+    }
+    free(data);
+
+    // Sort the labels, keeping only one label per address (preferring globals)
+    qsort(u->labels, u->num_labels, sizeof(label_t), cmp_label);
+    int n = 0;
+    for (int i = 0; i < u->num_labels; i++)
+        if (!n || u->labels[n-1].addr != u->labels[i].addr)
+            u->labels[n++] = u->labels[i];
+    u->num_labels = n;
+}
+
+// Return the index of the label containing the address, or -1 if none
+int label_find(ucode_t *u, uint32_t addr)
+{
+    int lo = 0, hi = u->num_labels - 1, idx = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (u->labels[mid].addr <= addr) {
+            idx = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return idx;
+}
+
+void load_profile(const char *fn)
+{
+    int size;
+    uint8_t *data = file_read(fn, &size);
+    uint8_t *end = data + size;
+    uint8_t *p = data;
+
+    // A file might contain multiple dumps concatenated
+    while (p + 28 <= end) {
+        if (r32(p) != RSP_PROFILE_MAGIC || r32(p + 4) != RSP_PROFILE_VERSION) {
+            fprintf(stderr, "Error: invalid RSP profile file: %s\n", fn);
+            exit(1);
+        }
+        period = r32(p + 8);
+        num_samples += r32(p + 12);
+        num_idle += r32(p + 16);
+        num_dropped += r32(p + 20);
+        int n = r32(p + 24);
+        p += 28;
+
+        for (int i = 0; i < n; i++) {
+            if (p + RSP_PROFILE_NAME_LEN + 4 > end) {
+                fprintf(stderr, "Error: truncated RSP profile file: %s\n", fn);
+                exit(1);
+            }
+            char name[RSP_PROFILE_NAME_LEN + 1] = {0};
+            memcpy(name, p, RSP_PROFILE_NAME_LEN);
+            ucode_t *u = ucode_get(name);
+            int entries = r32(p + RSP_PROFILE_NAME_LEN);
+            p += RSP_PROFILE_NAME_LEN + 4;
+            if (p + entries * 8 > end) {
+                fprintf(stderr, "Error: truncated RSP profile file: %s\n", fn);
+                exit(1);
+            }
+            for (int j = 0; j < entries; j++, p += 8) {
+                uint32_t addr = r32(p) & 0xFFC, count = r32(p + 4);
+                u->counts[addr / 4] += count;
+                u->samples += count;
+            }
+        }
+    }
+    free(data);
+}
+
+// Samples accumulated for a label (or an address)
+typedef struct {
+    uint32_t addr;
+    int label;
+    uint32_t samples;
+} row_t;
+
+int cmp_row(const void *a, const void *b)
+{
+    const row_t *ra = a, *rb = b;
+    if (ra->samples != rb->samples) return ra->samples < rb->samples ? 1 : -1;
+    return ra->addr < rb->addr ? -1 : (ra->addr > rb->addr);
+}
+
+int cmp_ucode(const void *a, const void *b)
+{
+    const ucode_t *ua = a, *ub = b;
+    return ua->samples < ub->samples ? 1 : (ua->samples > ub->samples ? -1 : 0);
+}
+
+void print_ucode(ucode_t *u)
+{
+    row_t *rows = calloc(RSP_PROFILE_IMEM_SLOTS, sizeof(row_t));
+    int n = 0;
+
+    for (int i = 0; i < RSP_PROFILE_IMEM_SLOTS; i++) {
+        if (!u->counts[i])
+            continue;
+        uint32_t addr = i * 4;
+        int label = label_find(u, addr);
+        if (!flag_addr && label >= 0 && n > 0 && rows[n-1].label == label) {
+            rows[n-1].samples += u->counts[i];
+            continue;
+        }
+        if (!flag_addr && label >= 0)
+            addr = u->labels[label].addr;
+        rows[n++] = (row_t){ .addr = addr, .label = label, .samples = u->counts[i] };
+    }
+    qsort(rows, n, sizeof(row_t), cmp_row);
+
+    printf("%s: %u samples (%.2f%%)\n", u->name[0] ? u->name : "<unknown ucode>",
+        u->samples, 100.0 * u->samples / num_samples);
+    printf("   ucode%%     busy%%  samples  imem   %s\n", flag_addr ? "address" : "label");
+    int lines = flag_max_lines && flag_max_lines < n ? flag_max_lines : n;
+    for (int i = 0; i < lines; i++) {
+        row_t *r = &rows[i];
+        printf("  %6.2f%%  %7.2f%%  %7u  %04x   ", 100.0 * r->samples / u->samples,
+            100.0 * r->samples / num_samples, r->samples, r->addr);
+        if (r->label < 0)
+            printf("???\n");
+        else if (r->addr == u->labels[r->label].addr)
+            printf("%s\n", u->labels[r->label].name);
+        else
+            printf("%s+0x%x\n", u->labels[r->label].name, r->addr - u->labels[r->label].addr);
+    }
+    free(rows);
+}
+
+int main(int argc, char *argv[])
+{
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            usage(argv[0]);
+            return 0;
+        } else if (!strcmp(argv[i], "--addr")) {
+            flag_addr = true;
+        } else if (!strcmp(argv[i], "-n") || !strcmp(argv[i], "--lines")) {
+            if (++i == argc) {
+                fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                return 1;
+            }
+            flag_max_lines = atoi(argv[i]);
+        } else {
+            fprintf(stderr, "invalid flag: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (i == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // ELF files are recognized by their extension, everything else is a profile
+    for (; i < argc; i++) {
+        int len = strlen(argv[i]);
+        if (len > 4 && !strcmp(argv[i] + len - 4, ".elf")) {
+            char *base = strdup(argv[i]);
+            char *name = strndup(basename(base), strlen(basename(base)) - 4);
+            free(base);
+            elfs = realloc(elfs, (num_elfs + 1) * sizeof(*elfs));
+            elfs[num_elfs].name = name;
+            elfs[num_elfs].fn = argv[i];
+            num_elfs++;
+        } else {
+            load_profile(argv[i]);
+        }
+    }
+
+    if (!num_samples && !num_idle) {
+        fprintf(stderr, "No samples found\n");
+        return 1;
+    }
+
+    for (int j = 0; j < num_ucodes; j++) {
+        for (int k = 0; k < num_elfs; k++) {
+            if (!strcmp(ucodes[j].name, elfs[k].name)) {
+                elf_load_labels(&ucodes[j], elfs[k].fn);
+                break;
+            }
+        }
+        if (ucodes[j].name[0] && !ucodes[j].num_labels)
+            fprintf(stderr, "Warning: no ELF file for ucode %s (expected %s.elf)\n", ucodes[j].name, ucodes[j].name);
+    }
+
+    int total = num_samples + num_idle;
+    printf("%d samples", total);
+    if (period)
+        printf(" (%.1f Hz, %.2f s)", 46875000.0 / period, (double)total * period / 46875000.0);
+    printf(", RSP busy: %.2f%%", 100.0 * num_samples / total);
+    if (num_dropped)
+        printf(", %d dropped", num_dropped);
+    printf("\n");
+
+    qsort(ucodes, num_ucodes, sizeof(ucode_t), cmp_ucode);
+    for (int j = 0; j < num_ucodes; j++) {
+        printf("\n");
+        print_ucode(&ucodes[j]);
+    }
+    return 0;
+}
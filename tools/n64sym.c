@@ -58,17 +58,28 @@ int stringtable_add(char *word)
             return pos;
     }
 
-    // Append the word (without the trailing \0)
-    int idx = stbds_arraddnindex(stringtable, word_len);
+    // Append the word (without the trailing \0). If the end of the table
+    // matches the start of the word, overlap them.
+    int table_len = stbds_arrlen(stringtable);
+    int overlap = word_len - 1 < table_len ? word_len - 1 : table_len;
+    while (overlap > 0 && memcmp(stringtable + table_len - overlap, word, overlap))
+        overlap--;
+    int idx = table_len - overlap;
+    stbds_arraddnindex(stringtable, word_len - overlap);
     memcpy(stringtable + idx, word, word_len);
 
-    // Add all prefixes to the hash
+    // Add all prefixes and all suffixes to the hash, so that later words
+    // (which are shorter) can be found within this one.
     for (int i = word_len; i >= 2; --i) {
         char ch = word[i];
         word[i] = 0;
         stbds_shput(string_hash, word, idx);
         word[i] = ch;
     }
+    for (int i = 1; i <= word_len - 2; i++) {
+        if (stbds_shget(string_hash, word + i) < 0)
+            stbds_shput(string_hash, word + i, idx + i);
+    }
     return idx;
 }
 
@@ -111,6 +122,68 @@ struct symtable_s {
     bool is_func, is_inline;
 } *symtable = NULL;
 
+// Frame information of a function, extracted from its prologue. This mirrors
+// the heuristic of __bt_analyze_func in backtrace.c, so that the backtrace
+// engine can look it up instead of analyzing the code at runtime.
+struct frametable_s {
+    uint32_t addr;
+    int stack_size;
+    int ra_offset;
+    int fp_offset;
+    int num_ra_saves;
+    int num_fp_saves;
+    bool uses_fp;
+    bool invalid;
+} *frametable = NULL;
+
+#define MIPS_OP_ADDIU_SP(op)   (((op) & 0xFFFF0000) == 0x27BD0000)   ///< Matches: addiu $sp, $sp, imm
+#define MIPS_OP_DADDIU_SP(op)  (((op) & 0xFFFF0000) == 0x67BD0000)   ///< Matches: daddiu $sp, $sp, imm
+#define MIPS_OP_SD_RA_SP(op)   (((op) & 0xFFFF0000) == 0xFFBF0000)   ///< Matches: sd $ra, imm($sp)
+#define MIPS_OP_SD_FP_SP(op)   (((op) & 0xFFFF0000) == 0xFFBE0000)   ///< Matches: sd $fp, imm($sp)
+#define MIPS_OP_LUI_GP(op)     (((op) & 0xFFFF0000) == 0x3C1C0000)   ///< Matches: lui $gp, imm
+#define MIPS_OP_MOVE_FP_SP(op) ((op) == 0x03A0F025)                  ///< Matches: move $fp, $sp
+
+void frame_add(uint32_t addr)
+{
+    // Multiple labels at the same address: only the last one has code
+    if (stbds_arrlen(frametable) && stbds_arrlast(frametable).addr == addr)
+        stbds_arrlast(frametable) = (struct frametable_s){ .addr = addr };
+    else
+        stbds_arrput(frametable, ((struct frametable_s){ .addr = addr }));
+}
+
+void frame_analyze(uint32_t op)
+{
+    if (!stbds_arrlen(frametable)) return;
+    struct frametable_s *f = &stbds_arrlast(frametable);
+
+    if (MIPS_OP_ADDIU_SP(op) || MIPS_OP_DADDIU_SP(op)) {
+        // The stack frame is the allocation done just before saving RA.
+        // Later allocations are alloca() / VLAs.
+        if ((op & 0x8000) && !f->num_ra_saves)
+            f->stack_size = -(int16_t)(op & 0xFFFF);
+    } else if (MIPS_OP_SD_RA_SP(op)) {
+        f->ra_offset = (int16_t)(op & 0xFFFF) + 4; // +4 = load low 32 bit of RA
+        f->num_ra_saves++;
+    } else if (MIPS_OP_SD_FP_SP(op)) {
+        f->fp_offset = (int16_t)(op & 0xFFFF) + 4; // +4 = load low 32 bit of FP
+        f->num_fp_saves++;
+    } else if (MIPS_OP_LUI_GP(op)) {
+        // Startup code: let the runtime heuristic stop the backtrace here
+        f->invalid = true;
+    } else if (MIPS_OP_MOVE_FP_SP(op)) {
+        f->uses_fp = true;
+    }
+}
+
+bool frame_is_valid(struct frametable_s *f)
+{
+    // Functions with multiple (or no) prologues are left to the runtime
+    // heuristic, that can find the one preceding each call site.
+    return !f->invalid && f->num_ra_saves == 1 && f->num_fp_saves <= 1 &&
+        f->stack_size > 0 && f->ra_offset > 0 && f->ra_offset < f->stack_size;
+}
+
 void symbol_add(const char *elf, uint32_t addr, bool is_func)
 {
     // We keep one addr2line process open for the last ELF file we processed.
@@ -220,11 +293,19 @@ void elf_find_callsites(const char *elf)
 
     // Parse the disassembly
     char *line = NULL; size_t line_size = 0;
+    uint32_t last_op_addr = 0;
     while (getline(&line, &line_size, disasm) != -1) {
         // Find the functions
         if (strstr(line, ">:")) {
             uint32_t addr = strtoul(line, NULL, 16);
             symbol_add(elf, addr, true);
+            frame_add(addr);
+        }
+        // Analyze the opcodes, to extract the frame information
+        char *op = strstr(line, ":\t");
+        if (op) {
+            frame_analyze(strtoul(op + 2, NULL, 16));
+            last_op_addr = strtoul(line, NULL, 16);
         }
         // Find the callsites
         if (strstr(line, "\tjal\t") || strstr(line, "\tjalr\t")) {
@@ -232,6 +313,9 @@ void elf_find_callsites(const char *elf)
             symbol_add(elf, addr, false);
         }
     }
+    // Terminate the frame table with an empty entry marking the end of the code
+    if (last_op_addr)
+        frame_add(last_op_addr + 4);
     free(line);
     pclose(disasm);
     free(cmd);
@@ -272,6 +356,33 @@ int symtable_sort_by_func(const void *a, const void *b)
     return sb_len - sa_len;
 }
 
+// Maximum number of address table entries in a page of the page table
+// that the runtime can fetch with a single DMA (see SYMT_PAGE_WINDOW in backtrace.c).
+#define PAGE_WINDOW             32
+
+// Choose the size of the pages of the page table: the biggest one for which
+// almost all entries of the address table are in pages small enough to be
+// fetched with a single DMA.
+int pagetable_choose_shift(void)
+{
+    int n = stbds_arrlen(symtable);
+    for (int shift = 16; shift > 6; shift--) {
+        int good = 0;
+        for (int i = 0; i < n; ) {
+            uint32_t page = symtable[i].addr >> shift;
+            int j = i;
+            while (j < n && symtable[j].addr >> shift == page)
+                j++;
+            if (j - i <= PAGE_WINDOW)
+                good += j - i;
+            i = j;
+        }
+        if (good >= n * 95 / 100)
+            return shift;
+    }
+    return 6;
+}
+
 void process(const char *infn, const char *outfn)
 {
     verbose("Processing: %s -> %s\n", infn, outfn);
@@ -321,13 +432,21 @@ void process(const char *infn, const char *outfn)
 
     // Write header. See symtable_header_t in backtrace.c for the layout.
     fwrite("SYMT", 4, 1, out);
-    w32(out, 2); // Version
+    w32(out, 4); // Version
     int addrtable_off = w32_placeholder(out);
     w32(out, stbds_arrlen(symtable));
     int symtable_off = w32_placeholder(out);
     w32(out, stbds_arrlen(symtable));
     int stringtable_off = w32_placeholder(out);
     w32(out, stbds_arrlen(stringtable));
+    int frametable_off = w32_placeholder(out);
+    w32(out, stbds_arrlen(frametable));
+    int pagetable_off = w32_placeholder(out);
+    int pagetable_size = w32_placeholder(out);
+    int page_shift = stbds_arrlen(symtable) ? pagetable_choose_shift() : 0;
+    uint32_t page_base = stbds_arrlen(symtable) ? symtable[0].addr & ~((1u << page_shift) - 1) : 0;
+    w32(out, page_shift);
+    w32(out, page_base);
 
     // Write address table. This is a sequence of 32-bit addresses.
     walign(out, 16);
@@ -350,9 +469,43 @@ void process(const char *infn, const char *outfn)
         w16(out, sym->func_offset < 0x10000 ? sym->func_offset : 0);
     }
 
+    // Write frame table. See frametable_entry_t in backtrace.c for the layout.
+    walign(out, 16);
+    w32_at(out, frametable_off, ftell(out));
+    int num_valid_frames = 0;
+    for (int i=0; i < stbds_arrlen(frametable); i++) {
+        struct frametable_s *f = &frametable[i];
+        bool valid = frame_is_valid(f);
+        num_valid_frames += valid;
+        w32(out, f->addr | (valid ? 0x1 : 0) | (valid && f->uses_fp ? 0x2 : 0));
+        w16(out, valid ? f->stack_size : 0);
+        w16(out, valid ? f->ra_offset : 0);
+        w16(out, valid && f->num_fp_saves ? f->fp_offset : 0);
+        w16(out, 0);
+    }
+    verbose("Frame information available for %d/%d functions\n", num_valid_frames, stbds_arrlen(frametable));
+
+    // Write page table. For each page, this is the index of the first entry of
+    // the address table at or after the start of the page, plus a final entry.
+    walign(out, 16);
+    w32_at(out, pagetable_off, ftell(out));
+    if (stbds_arrlen(symtable)) {
+        int npages = ((stbds_arrlast(symtable).addr - page_base) >> page_shift) + 1;
+        for (int p = 0, i = 0; p < npages; p++) {
+            uint32_t page_start = page_base + ((uint32_t)p << page_shift);
+            while (i < stbds_arrlen(symtable) && symtable[i].addr < page_start)
+                i++;
+            w32(out, i);
+        }
+        w32(out, stbds_arrlen(symtable));
+        w32_at(out, pagetable_size, npages + 1);
+        verbose("Page table: %d pages of %d bytes\n", npages, 1 << page_shift);
+    }
+
     walign(out, 16);
     w32_at(out, stringtable_off, ftell(out));
     fwrite(stringtable, stbds_arrlen(stringtable), 1, out);
+    verbose("String table: %d bytes\n", stbds_arrlen(stringtable));
     fclose(out);
 }
 
@@ -27,6 +27,8 @@
 #ifndef __MINGW32__
 #include <sys/errno.h>
 #endif
+#include "common/lz4.c"
+#include "common/lz4hc.c"
 
 #define ROUND_UP(n, d) ({ \
 	typeof(n) _n = n; typeof(d) _d = d; \
@@ -71,6 +73,16 @@ size_t __strlcpy(char * restrict dst, const char * restrict src, size_t dstsize)
 #define TOC_ENTRY_SIZE   64
 #define TOC_MAX_ENTRIES  ((TOC_SIZE - 16) / 64)
 
+// Alignment of the files placed by --layout, unless a bigger one is requested
+// with --align. This is a data cacheline, so that files can be loaded via DMA
+// into aligned buffers without any fixup.
+#define LAYOUT_ALIGN     16
+
+// Payload descriptor at the start of the binary (see entrypoint.S)
+#define BOOT_DESC_OFFSET 0x10
+#define BOOT_DESC_MAGIC  "LZ4B"
+#define BOOT_DESC_SIZE   20
+
 #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
 #define SWAPLONG(i) (i)
 #else
@@ -98,6 +110,14 @@ struct toc_s {
 
 _Static_assert(sizeof(toc) <= TOC_SIZE, "invalid table size");
 
+// Files to be placed by --layout, after the first binary
+struct layout_file_s {
+	const char *path;
+	size_t size;
+	int align;
+} layout_files[TOC_MAX_ENTRIES];
+int num_layout_files = 0;
+
 int print_usage(const char * prog_name)
 {
 	fprintf(stderr, "Usage: %s [flags] <file> [[file-flags] <file> ...]\n\n", prog_name);
@@ -110,6 +130,9 @@ int print_usage(const char * prog_name)
 	fprintf(stderr, "\t-h, --header <file>    Use <file> as IPL3 header.\n");
 	fprintf(stderr, "\t-o, --output <file>    Save output ROM to <file>.\n");
 	fprintf(stderr, "\t-T, --toc              Create a table of contents file after the first binary.\n");
+	fprintf(stderr, "\t-z, --compress         Compress the first binary (decompressed at boot, loads faster).\n");
+	fprintf(stderr, "\t-L, --layout           Choose the order of the files after the first one, to minimize padding.\n");
+	fprintf(stderr, "\t                       Each file is aligned to %d bytes, or to its --align if bigger.\n", LAYOUT_ALIGN);
 	fprintf(stderr, "\n");
 	fprintf(stderr, "File flags (to be used between files):\n");
 	fprintf(stderr, "\t-a, --align <align>    Next file is aligned at <align> bytes from top of memory (minimum: 4).\n");
@@ -202,6 +225,86 @@ ssize_t output_zeros(FILE * dest, ssize_t amount)
 	return 0;
 }
 
+static uint32_t read_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void write_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+ssize_t copy_compressed_file(FILE * dest, const char * file)
+{
+	FILE *read_file = fopen(file, "rb");
+
+	if(!read_file)
+	{
+		fprintf(stderr, "ERROR: Cannot open %s for reading!\n", file);
+		return -1;
+	}
+
+	size_t fsize = get_file_size(read_file);
+	uint8_t *buffer = malloc(fsize);
+
+	if(!buffer)
+	{
+		fprintf(stderr, "ERROR: Out of memory!\n");
+		fclose(read_file);
+		return -1;
+	}
+
+	fread(buffer, 1, fsize, read_file);
+	fclose(read_file);
+
+	/* Locate the code and data to compress via the payload descriptor */
+	uint8_t *desc = buffer + BOOT_DESC_OFFSET;
+	if(fsize < BOOT_DESC_OFFSET + BOOT_DESC_SIZE || memcmp(desc, BOOT_DESC_MAGIC, 4))
+	{
+		fprintf(stderr, "ERROR: %s does not support compression (built with an older libdragon?)\n", file);
+		free(buffer);
+		return -1;
+	}
+
+	uint32_t start = read_be32(desc + 4);
+	size_t boot_size = read_be32(desc + 8) - start;
+	size_t data_size = read_be32(desc + 12) - start;
+	if(boot_size > data_size || data_size > fsize || read_be32(desc + 16) != 0)
+	{
+		fprintf(stderr, "ERROR: Invalid payload descriptor in %s\n", file);
+		free(buffer);
+		return -1;
+	}
+
+	int src_size = data_size - boot_size;
+	int cmp_max_size = LZ4_COMPRESSBOUND(src_size);
+	uint8_t *cmp = malloc(cmp_max_size);
+	int cmp_size = LZ4_compress_HC((char*)buffer + boot_size, (char*)cmp, src_size, cmp_max_size, LZ4HC_CLEVEL_MAX);
+
+	if(cmp_size <= 0 || cmp_size >= src_size)
+	{
+		/* Not worth it: store the binary as is */
+		fprintf(stderr, "WARNING: %s does not compress, storing it uncompressed\n", file);
+		fwrite(buffer, 1, fsize, dest);
+	}
+	else
+	{
+		/* Store the compressed data after the boot code, and pad it to the
+		   original size: the ROM layout of what follows does not change,
+		   but the padding is never read at boot. */
+		write_be32(desc + 16, cmp_size);
+		fwrite(buffer, 1, boot_size, dest);
+		fwrite(cmp, 1, cmp_size, dest);
+		output_zeros(dest, src_size - cmp_size);
+		fwrite(buffer + data_size, 1, fsize - data_size, dest);
+	}
+
+	free(cmp);
+	free(buffer);
+	return fsize;
+}
+
 ssize_t parse_bytes(const char * arg)
 {
 	size_t arg_len = strlen(arg);
@@ -231,6 +334,46 @@ ssize_t parse_bytes(const char * arg)
 	}
 }
 
+bool toc_add(const char * file, size_t offset)
+{
+	if (toc.num_entries >= TOC_MAX_ENTRIES)
+		return false;
+
+	toc.files[toc.num_entries].offset = offset;
+
+	const char *basename = strrchr(file, '/');
+	if (!basename) basename = strrchr(file, '\\');
+	if (!basename) basename = file;
+	if (basename[0] == '/' || basename[0] == '\\') basename++;
+	strlcpy(toc.files[toc.num_entries].name, basename, sizeof(toc.files[toc.num_entries].name));
+	toc.num_entries++;
+	return true;
+}
+
+/* Choose the next file to place at the specified offset: the one that needs
+   the least padding. Ties go to the most aligned file (which is harder to
+   place later), and then to the command line order. */
+int layout_next_file(size_t offset)
+{
+	int best = -1;
+	size_t best_pad = 0;
+
+	for (int i=0; i<num_layout_files; i++)
+	{
+		struct layout_file_s *f = &layout_files[i];
+		if (!f->path)
+			continue;
+
+		size_t pad = ROUND_UP(offset, (size_t)f->align) - offset;
+		if (best < 0 || pad < best_pad || (pad == best_pad && f->align > layout_files[best].align))
+		{
+			best = i;
+			best_pad = pad;
+		}
+	}
+	return best;
+}
+
 void remove_tmp_file(void)
 {
 	if(tmp_output)
@@ -246,6 +389,9 @@ int main(int argc, char *argv[])
 	size_t total_bytes_written = 0;
 	char title[TITLE_SIZE + 1] = { 0, };
 	bool create_toc = false;
+	bool compress = false;
+	bool layout = false;
+	int layout_align = 0;
 	size_t toc_offset = 0;
 
 
@@ -356,6 +502,26 @@ int main(int argc, char *argv[])
 			create_toc = true;
 			continue;
 		}
+		if(check_flag(arg, "-z", "--compress"))
+		{
+			if(total_bytes_written)
+			{
+				fprintf(stderr, "ERROR: -z / --compress must be specified before any input file\n\n");
+				return print_usage(argv[0]);
+			}
+			compress = true;
+			continue;
+		}
+		if(check_flag(arg, "-L", "--layout"))
+		{
+			if(total_bytes_written)
+			{
+				fprintf(stderr, "ERROR: -L / --layout must be specified before any input file\n\n");
+				return print_usage(argv[0]);
+			}
+			layout = true;
+			continue;
+		}
 		if(check_flag(arg, "-s", "--offset"))
 		{
 			if(!header || !output)
@@ -370,6 +536,12 @@ int main(int argc, char *argv[])
 				return print_usage(argv[0]);
 			}
 
+			if(layout)
+			{
+				fprintf(stderr, "ERROR: --offset cannot be used with --layout\n\n");
+				return print_usage(argv[0]);
+			}
+
 			if(i >= argc)
 			{
 				/* Expected another argument */
@@ -432,6 +604,18 @@ int main(int argc, char *argv[])
 				return print_usage(argv[0]);
 			}
 
+			if(layout)
+			{
+				/* The alignment applies to the next file, wherever it is placed */
+				if(align & (align - 1))
+				{
+					fprintf(stderr, "ERROR: Alignment must be a power of two with --layout\n\n");
+					return print_usage(argv[0]);
+				}
+				layout_align = align;
+				continue;
+			}
+
 			if (total_bytes_written % align)
 			{
 				ssize_t num_zeros = align - (total_bytes_written % align);
@@ -502,10 +686,37 @@ int main(int argc, char *argv[])
 			}
 		}
 
+		/* With --layout, the files after the first one are placed at the end */
+		if(layout && total_bytes_written)
+		{
+			FILE *f = fopen(arg, "rb");
+			if(!f)
+			{
+				fprintf(stderr, "ERROR: Cannot open %s for reading!\n", arg);
+				return STATUS_ERROR;
+			}
+			size_t size = get_file_size(f);
+			fclose(f);
+
+			if(num_layout_files >= TOC_MAX_ENTRIES)
+			{
+				fprintf(stderr, "ERROR: Too many files to add to table.\n");
+				return STATUS_ERROR;
+			}
+			layout_files[num_layout_files++] = (struct layout_file_s){
+				.path = arg,
+				.size = size,
+				.align = layout_align > LAYOUT_ALIGN ? layout_align : LAYOUT_ALIGN,
+			};
+			layout_align = 0;
+			continue;
+		}
+
 		size_t offset = ftell(write_file);
 
 		/* Copy the input file into the output file */
-		ssize_t bytes_copied = copy_file(write_file, arg);
+		ssize_t bytes_copied = (compress && !total_bytes_written) ?
+			copy_compressed_file(write_file, arg) : copy_file(write_file, arg);
 
 		if(bytes_copied < 0)
 		{
@@ -513,25 +724,11 @@ int main(int argc, char *argv[])
 			return STATUS_ERROR;
 		}
 
-		if (toc.num_entries < TOC_MAX_ENTRIES)
+		/* Add the file to the toc */
+		if (!toc_add(arg, offset) && create_toc)
 		{
-			/* Add the file to the toc */
-			toc.files[toc.num_entries].offset = offset;
-
-			const char *basename = strrchr(arg, '/');
-			if (!basename) basename = strrchr(arg, '\\');
-			if (!basename) basename = arg;
-			if (basename[0] == '/' || basename[0] == '\\') basename++;
-			strlcpy(toc.files[toc.num_entries].name, basename, sizeof(toc.files[toc.num_entries].name));
-			toc.num_entries++;
-		}
-		else
-		{
-			if (create_toc)
-			{
-				fprintf(stderr, "ERROR: Too many files to add to table.\n");
-				return STATUS_ERROR;
-			}
+			fprintf(stderr, "ERROR: Too many files to add to table.\n");
+			return STATUS_ERROR;
 		}
 
 
@@ -554,6 +751,33 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* Place the files collected by --layout */
+	for(int n=0; n<num_layout_files; n++)
+	{
+		int idx = layout_next_file(total_bytes_written);
+		struct layout_file_s *f = &layout_files[idx];
+
+		ssize_t num_zeros = ROUND_UP(total_bytes_written, (size_t)f->align) - total_bytes_written;
+		output_zeros(write_file, num_zeros);
+		total_bytes_written += num_zeros;
+
+		size_t offset = ftell(write_file);
+		ssize_t bytes_copied = copy_file(write_file, f->path);
+		if(bytes_copied < 0)
+		{
+			fprintf(stderr, "ERROR: Unable to copy file from '%s' to '%s'\n", f->path, output);
+			return STATUS_ERROR;
+		}
+		if(bytes_copied != f->size)
+		{
+			fprintf(stderr, "ERROR: %s changed size while creating the ROM\n", f->path);
+			return STATUS_ERROR;
+		}
+		toc_add(f->path, offset);
+		total_bytes_written += bytes_copied;
+		f->path = NULL;
+	}
+
 	if(!total_bytes_written)
 	{
 		/* Didn't write anything! */
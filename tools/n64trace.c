@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Keep in sync with prof_zone.h
+#define PROF_ZONE_MAGIC             0x5A4F4E45
+#define PROF_ZONE_VERSION           1
+#define NO_NAME                     0xFFFF
+
+enum { EVENT_BEGIN = 0, EVENT_END = 1, EVENT_MARK = 2, EVENT_FRAME = 3 };
+
+const char *track_names[] = { "CPU", "RSP", "RDP" };
+#define NUM_TRACKS (sizeof(track_names) / sizeof(track_names[0]))
+
+void usage(const char *progname)
+{
+    fprintf(stderr, "%s - Convert timeline profiles recorded by prof_zone to JSON traces\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Usage: %s [flags] <trace.bin> [<trace.bin>...]\n", progname);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Command-line flags:\n");
+    fprintf(stderr, "   -o/--output <file>    Output file (default: stdout)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Files must be given in the order they were received. The output\n");
+    fprintf(stderr, "can be opened with chrome://tracing or https://ui.perfetto.dev.\n");
+}
+
+uint32_t r32(const uint8_t *p) { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+FILE *out;
+bool first_event = true;
+// Timestamps, extended to 64 bits
+bool has_time = false;
+uint32_t last_ticks;
+uint64_t time64;
+int frame_count = 0;
+
+void json_string(const char *s, int len)
+{
+    fputc('"', out);
+    for (int i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+void json_event_start(void)
+{
+    fprintf(out, first_event ? "\n" : ",\n");
+    first_event = false;
+}
+
+void load_trace(const char *fn)
+{
+    FILE *f = fopen(fn, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: cannot open file: %s\n", fn);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size);
+    if (fread(data, 1, size, f) != size) {
+        fprintf(stderr, "Error: cannot read file: %s\n", fn);
+        exit(1);
+    }
+    fclose(f);
+
+    // A file might contain multiple messages concatenated
+    uint8_t *p = data, *end = data + size;
+    while (p + 24 <= end) {
+        if (r32(p) != PROF_ZONE_MAGIC || r32(p + 4) != PROF_ZONE_VERSION) {
+            fprintf(stderr, "Error: invalid trace file: %s\n", fn);
+            exit(1);
+        }
+        double ticks_per_us = r32(p + 8) / 1e6;
+        uint32_t num_events = r32(p + 12);
+        uint32_t num_strings = r32(p + 16);
+        uint32_t dropped = r32(p + 20);
+        p += 24;
+
+        uint8_t *events = p;
+        p += num_events * 8;
+        if (p > end) {
+            fprintf(stderr, "Error: truncated trace file: %s\n", fn);
+            exit(1);
+        }
+
+        const char **strings = calloc(num_strings, sizeof(char*));
+        int *lengths = calloc(num_strings, sizeof(int));
+        for (int i = 0; i < num_strings; i++) {
+            if (p + 4 > end || p + 4 + r32(p) > end) {
+                fprintf(stderr, "Error: truncated trace file: %s\n", fn);
+                exit(1);
+            }
+            lengths[i] = r32(p);
+            strings[i] = (const char*)p + 4;
+            p += 4 + ((lengths[i] + 3) & ~3);
+        }
+
+        for (int i = 0; i < num_events; i++) {
+            uint32_t ticks = r32(events + i * 8);
+            uint32_t info = r32(events + i * 8 + 4);
+            int type = info >> 24;
+            int track = (info >> 16) & 0xFF;
+            int sidx = info & 0xFFFF;
+
+            // Timestamps are 32-bit and wrap around, but consecutive events
+            // are always much closer than that.
+            if (has_time)
+                time64 += (uint32_t)(ticks - last_ticks);
+            has_time = true;
+            last_ticks = ticks;
+            double ts = time64 / ticks_per_us;
+
+            if (track >= NUM_TRACKS) {
+                fprintf(stderr, "Warning: invalid track %d in %s\n", track, fn);
+                continue;
+            }
+
+            json_event_start();
+            fprintf(out, "{\"pid\":1,\"tid\":%d,\"ts\":%.3f,", track + 1, ts);
+            switch (type) {
+            case EVENT_BEGIN:
+            case EVENT_MARK:
+                fprintf(out, "\"ph\":\"%s\",\"name\":", type == EVENT_BEGIN ? "B" : "i");
+                if (sidx != NO_NAME && sidx < num_strings)
+                    json_string(strings[sidx], lengths[sidx]);
+                else
+                    fprintf(out, "\"?\"");
+                if (type == EVENT_MARK)
+                    fprintf(out, ",\"s\":\"t\"");
+                break;
+            case EVENT_END:
+                fprintf(out, "\"ph\":\"E\"");
+                break;
+            case EVENT_FRAME:
+                fprintf(out, "\"ph\":\"i\",\"s\":\"g\",\"name\":\"frame %d\"", frame_count++);
+                break;
+            default:
+                fprintf(stderr, "Warning: invalid event type %d in %s\n", type, fn);
+                fprintf(out, "\"ph\":\"i\",\"name\":\"?\"");
+                break;
+            }
+            fprintf(out, "}");
+        }
+
+        if (dropped) {
+            json_event_start();
+            fprintf(out, "{\"pid\":1,\"tid\":1,\"ts\":%.3f,\"ph\":\"i\",\"s\":\"g\",\"name\":\"%u events dropped\"}",
+                time64 / ticks_per_us, dropped);
+        }
+
+        free(strings);
+        free(lengths);
+    }
+    free(data);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *outfn = NULL;
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            usage(argv[0]);
+            return 0;
+        } else if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) {
+            if (++i == argc) {
+                fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                return 1;
+            }
+            outfn = argv[i];
+        } else {
+            fprintf(stderr, "invalid flag: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (i == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    out = outfn ? fopen(outfn, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Error: cannot create file: %s\n", outfn);
+        return 1;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (int t = 0; t < NUM_TRACKS; t++) {
+        json_event_start();
+        fprintf(out, "{\"pid\":1,\"tid\":%d,\"ph\":\"M\",\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+            t + 1, track_names[t]);
+    }
+    for (; i < argc; i++)
+        load_trace(argv[i]);
+    fprintf(out, "\n]}\n");
+
+    if (outfn)
+        fclose(out);
+    return 0;
+}